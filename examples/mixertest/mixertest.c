@@ -33,6 +33,11 @@ int main(void) {
 	wav64_open(&sfx_monosample, "monosample8.wav64");
 	wav64_set_loop(&sfx_monosample, true);
 
+	// Stream the background music through a prefetch buffer, so that the
+	// mixer never waits for the PI.
+	static uint8_t music_stream[WAV64_STREAM_BUFFER_SIZE] __attribute__((aligned(16)));
+	wav64_set_stream_buffer(&sfx_monosample, music_stream, sizeof(music_stream));
+
 	bool music = false;
 	int music_frequency = sfx_monosample.wave.frequency;
 
@@ -85,8 +90,10 @@ int main(void) {
 		// Check whether one audio buffer is ready, otherwise wait for next
 		// frame to perform mixing.
 		if (audio_can_write()) {    	
+			// Mixing runs on the RSP in background; the buffer is sent
+			// to the AI as soon as it's ready.
 			short *buf = audio_write_begin();
-			mixer_poll(buf, audio_get_buffer_length());
+			mixer_poll_async(buf, audio_get_buffer_length());
 			audio_write_end();
 		}
 	}
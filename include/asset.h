@@ -0,0 +1,60 @@
+/**
+ * @file asset.h
+ * @brief Asset manager
+ * @ingroup dfs
+ */
+#ifndef __LIBDRAGON_ASSET_H
+#define __LIBDRAGON_ASSET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @addtogroup dfs
+ * @{
+ */
+
+/** @brief Maximum number of assets loaded in background at the same time */
+#define ASSET_MAX_LOADS     2
+
+/** @brief Asset loaded from DragonFS by #asset_get (opaque) */
+typedef struct asset_s asset_t;
+
+/** @brief Memory usage of the asset manager, see #asset_get_stats */
+typedef struct
+{
+    /** @brief Number of assets in memory (or being loaded) */
+    uint32_t count;
+    /** @brief Bytes used by the assets in memory */
+    uint32_t used;
+    /** @brief Bytes used by the unreferenced assets kept as a cache */
+    uint32_t cached;
+    /** @brief Number of requests served by an asset already in memory */
+    uint32_t hits;
+    /** @brief Number of unreferenced assets dropped to stay within the budget */
+    uint32_t evictions;
+} asset_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void asset_init(int budget);
+void asset_close(void);
+
+asset_t *asset_get(const char * const path);
+void asset_release(asset_t *asset);
+int asset_poll(void);
+bool asset_ready(asset_t *asset);
+int asset_wait(asset_t *asset);
+void *asset_data(asset_t *asset, int *size);
+
+void asset_get_stats(asset_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */ /* dfs */
+
+#endif
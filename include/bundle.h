@@ -0,0 +1,65 @@
+/**
+ * @file bundle.h
+ * @brief Asset bundles
+ * @ingroup dfs
+ */
+#ifndef __LIBDRAGON_BUNDLE_H
+#define __LIBDRAGON_BUNDLE_H
+
+#include <stdint.h>
+#include "system.h"
+
+/**
+ * @addtogroup dfs
+ * @{
+ */
+
+/** @brief Member of a loaded bundle */
+typedef struct
+{
+    /** @brief Path of the member, relative to the bundle directory */
+    const char *name;
+    /** @brief Data of the member (16-byte aligned) */
+    void *data;
+    /** @brief Size of the data in bytes */
+    uint32_t size;
+    /** @brief Reserved */
+    uint32_t reserved;
+} bundle_file_t;
+
+/**
+ * @brief Bundle loaded in memory by #bundle_load
+ *
+ * The whole bundle file is loaded in a single buffer, and its table of
+ * contents is fixed up in place, so that the members can be accessed
+ * directly, without any copy.
+ */
+typedef struct
+{
+    /** @brief Magic value (private) */
+    uint32_t magic;
+    /** @brief Number of members */
+    uint32_t num_files;
+    /** @brief Size of the whole bundle in bytes */
+    uint32_t size;
+    /** @brief Reserved */
+    uint32_t reserved;
+    /** @brief Members, sorted by name */
+    bundle_file_t files[];
+} bundle_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int bundle_size(const char * const path);
+bundle_t *bundle_load(const char * const path, arena_t *arena);
+void *bundle_get(const bundle_t *bundle, const char * const name, uint32_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */ /* dfs */
+
+#endif
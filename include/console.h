@@ -84,6 +84,7 @@ void console_set_debug(bool debug);
 void console_set_render_mode(int mode);
 void console_clear();
 void console_render();
+void console_render_to(display_context_t disp);
 
 #ifdef __cplusplus
 }
@@ -6,6 +6,9 @@
 #ifndef __LIBDRAGON_CONTROLLER_H
 #define __LIBDRAGON_CONTROLLER_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 /**
  * @addtogroup controller
  * @{
@@ -173,6 +176,51 @@ struct controller_origin_data
     struct SI_origdat_gc gc[4];
 };
 
+/**
+ * @name Packed buttons
+ * @brief Masks of the buttons of a controller in #controller_packed_t
+ *
+ * The 16 bits of each controller follow the order of the SI response, as in #SI_condat.
+ * @{
+ */
+#define CONTROLLER_BUTTON_A         0x8000
+#define CONTROLLER_BUTTON_B         0x4000
+#define CONTROLLER_BUTTON_Z         0x2000
+#define CONTROLLER_BUTTON_START     0x1000
+#define CONTROLLER_BUTTON_UP        0x0800
+#define CONTROLLER_BUTTON_DOWN      0x0400
+#define CONTROLLER_BUTTON_LEFT      0x0200
+#define CONTROLLER_BUTTON_RIGHT     0x0100
+#define CONTROLLER_BUTTON_L         0x0020
+#define CONTROLLER_BUTTON_R         0x0010
+#define CONTROLLER_BUTTON_C_UP      0x0008
+#define CONTROLLER_BUTTON_C_DOWN    0x0004
+#define CONTROLLER_BUTTON_C_LEFT    0x0002
+#define CONTROLLER_BUTTON_C_RIGHT   0x0001
+/** @} */
+
+/** @brief Shift of the buttons of a controller (0-3) in #controller_packed_t::buttons */
+#define CONTROLLER_PACKED_SHIFT(port)       (48 - 16 * (port))
+/** @brief Buttons of a controller (0-3) in packed buttons */
+#define CONTROLLER_PACKED_PORT(buttons, port) ((uint16_t)((buttons) >> CONTROLLER_PACKED_SHIFT(port)))
+/** @brief Mask of buttons repeated for the 4 controllers, to test them all at once */
+#define CONTROLLER_PACKED_ALL(mask)         ((uint64_t)(uint16_t)(mask) * 0x0001000100010001ULL)
+
+/**
+ * @brief State of the 4 N64 controllers, packed so that they are compared in one go
+ *
+ * See #controller_pack and #get_keys_packed.
+ */
+typedef struct controller_packed
+{
+    /** @brief Buttons of the 4 controllers, 16 bits each, controller 0 first (see #CONTROLLER_PACKED_PORT) */
+    uint64_t buttons;
+    /** @brief Stick X of each controller */
+    int8_t x[4];
+    /** @brief Stick Y of each controller */
+    int8_t y[4];
+} controller_packed_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -181,6 +229,8 @@ void controller_init( void );
 void controller_read( struct controller_data * data );
 void controller_read_gc( struct controller_data * data, const uint8_t rumble[4] );
 void controller_read_gc_origin( struct controller_origin_data * data);
+void controller_read_mixed( struct controller_data * data, int gc_ports, const uint8_t rumble[4] );
+void controller_pack( const struct controller_data * data, controller_packed_t * packed );
 int get_controllers_present( void );
 int get_accessories_present( struct controller_data * data );
 void controller_scan( void );
@@ -189,11 +239,25 @@ struct controller_data get_keys_up( void );
 struct controller_data get_keys_held( void );
 struct controller_data get_keys_pressed( void );
 int get_dpad_direction( int controller );
+void get_keys_packed( controller_packed_t * packed );
+uint64_t get_keys_down_packed( void );
+uint64_t get_keys_up_packed( void );
+uint64_t get_keys_held_packed( void );
 int read_mempak_address( int controller, uint16_t address, uint8_t *data );
 int write_mempak_address( int controller, uint16_t address, uint8_t *data );
+int read_mempak_range( int controller, uint16_t address, uint8_t *data, int len );
+int write_mempak_range( int controller, uint16_t address, const uint8_t *data, int len );
 int identify_accessory( int controller );
 void rumble_start( int controller );
 void rumble_stop( int controller );
+void rumble_set( int controller, bool active );
+void controller_enable_vi_sampling( int lines );
+void controller_disable_vi_sampling( void );
+long long controller_get_scan_ticks( void );
+int controller_record_start( const char * const path, uint32_t seed );
+int controller_replay_start( const char * const path, uint32_t *seed );
+void controller_record_stop( void );
+bool controller_is_replaying( void );
 void execute_raw_command( int controller, int command, int bytesout, int bytesin, unsigned char *out, unsigned char *in );
 
 #ifdef __cplusplus
@@ -34,6 +34,9 @@
 #define C1_CAUSE_INVALID_OP         0x00010000
 #define C1_CAUSE_NOT_IMPLEMENTED    0x00020000
 
+/** @brief Flush denormalized results to zero instead of raising an unimplemented operation exception */
+#define C1_FLUSH_DENORMS_TO_ZERO    0x01000000
+
 /** @brief Read the COP1 FCR31 register (floating-point control register 31)
  *
  * FCR31 is also known as the Control/Status register. It keeps control and
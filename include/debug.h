@@ -107,6 +107,35 @@ extern "C" {
  */
 #define DEBUG_FEATURE_FILE_SD       (1 << 3)
 
+/**
+ * @brief Flag to activate a RAM filesystem of files pushed through USB.
+ *
+ * This flag activates a read-only filesystem, stored in RDRAM, whose
+ * files are pushed from the PC through the USB channel of a supported
+ * cartridge while the application runs. Call debug_usbfs_poll()
+ * regularly (eg: once per frame) to receive them.
+ *
+ * To access the files, prefix their name with "usb:/". To shadow the
+ * files of the ROM with them, attach an overlay:
+ *
+ * @code{.c}
+ *     debug_init(DEBUG_FEATURE_LOG_USB | DEBUG_FEATURE_FILE_USB);
+ *     dfs_init(DFS_DEFAULT_LOCATION);
+ *     overlayfs_attach("rom:/", "usb:/", 4096);
+ * @endcode
+ *
+ * Afterwards, a texture pushed as "gfx/hero.sprite" with the n64hotreload
+ * tool is read instead of rom:/gfx/hero.sprite the next time it is opened.
+ *
+ * Supported development cartridges:
+ *
+ *   * 64drive (rev 1 or 2)
+ *   * EverDrive64
+ *   * SummerCart64
+ *
+ */
+#define DEBUG_FEATURE_FILE_USB      (1 << 4)
+
 
 /**
  * @brief Flag to activate all supported debugging features.
@@ -130,10 +159,25 @@ extern "C" {
 	bool debug_init_sdlog(const char *fn, const char *openfmt);
 	/** @brief Initialize SD filesystem */
 	bool debug_init_sdfs(const char *prefix, int npart);
+	/** @brief Initialize the RAM filesystem of files pushed through USB. */
+	bool debug_init_usbfs(const char *prefix);
+	/** @brief Receive the files pushed through USB. */
+	int debug_usbfs_poll(void (*updated)(const char *name));
 
 	/** @brief Shutdown SD filesystem. */
 	void debug_close_sdfs(void);
 
+	/** @brief Buffer the log in RAM, to be written by #debug_log_poll. */
+	bool debug_enable_log_buffer(int size, int chunk);
+	/** @brief Write the log synchronously again. */
+	void debug_disable_log_buffer(void);
+	/** @brief Write a chunk of the buffered log. */
+	int debug_log_poll(void);
+	/** @brief Write all of the buffered log. */
+	void debug_log_flush(void);
+	/** @brief Number of bytes of log dropped because the buffer was full. */
+	unsigned long debug_log_dropped(void);
+
 	/**
 	 * @brief Initialize debugging features of libdragon.
 	 *
@@ -154,6 +198,8 @@ extern "C" {
 			ok = debug_init_isviewer() || ok;
 		if (features & DEBUG_FEATURE_FILE_SD)
 			ok = debug_init_sdfs("sd:/", -1) || ok;
+		if (features & DEBUG_FEATURE_FILE_USB)
+			ok = debug_init_usbfs("usb:/") || ok;
 		if (features & DEBUG_FEATURE_LOG_SD)
 			ok = debug_init_sdlog("sd:/libdragon.log", "a");
 		return ok;
@@ -194,6 +240,13 @@ extern "C" {
 	#define debug_init_isviewer()      ({ false; })
 	#define debug_init_sdlog(fn,fmt)   ({ false; })
 	#define debug_init_sdfs(prefix,np) ({ false; })
+	#define debug_init_usbfs(prefix)   ({ false; })
+	#define debug_usbfs_poll(cb)       ({ 0; })
+	#define debug_enable_log_buffer(size,chunk) ({ false; })
+	#define debug_disable_log_buffer() ({ })
+	#define debug_log_poll()           ({ 0; })
+	#define debug_log_flush()          ({ })
+	#define debug_log_dropped()        ({ 0UL; })
 	#define debugf(msg, ...)           ({ })
 	#define assertf(expr, msg, ...)    ({ })
 #endif
@@ -6,6 +6,9 @@
 #ifndef __LIBDRAGON_DFSINTERNAL_H
 #define __LIBDRAGON_DFSINTERNAL_H
 
+#include <string.h>
+#include "dma.h"
+
 /**
  * @addtogroup dfs
  * @{
@@ -41,6 +44,246 @@ _Static_assert(sizeof(struct directory_entry) == SECTOR_SIZE, "invalid directory
 /** @brief Type definition */
 typedef struct directory_entry directory_entry_t;
 
+/** @brief Magic value identifying the path index (#dfs_index_header_t) */
+#define DFS_INDEX_MAGIC         0x44465349  /* "DFSI" */
+/** @brief Maximum length of a path stored in the path index (including terminator) */
+#define DFS_INDEX_MAX_PATH      256
+
+/**
+ * @brief Header of the optional path index
+ *
+ * The index is emitted by mkdfs when requested, and referenced by the
+ * #directory_entry::file_pointer field of the root sector (which is 0 in
+ * images without an index). It is a hash table of the full path of every
+ * file (relative to the root, without leading slash, eg: "dir/file.dat").
+ *
+ * The header is followed by num_buckets+1 32-bit words, with the index of
+ * the first #dfs_index_entry_t of each bucket (the last word is num_entries),
+ * and then by the array of entries, sorted by bucket, and then by the
+ * NUL-terminated paths referenced by the entries.
+ */
+typedef struct dfs_index_header
+{
+    /** @brief Magic value, see #DFS_INDEX_MAGIC */
+    uint32_t magic;
+    /** @brief Number of hash buckets (always a power of two) */
+    uint32_t num_buckets;
+    /** @brief Number of entries in the index */
+    uint32_t num_entries;
+    /** @brief Reserved, must be 0 */
+    uint32_t reserved;
+} dfs_index_header_t;
+
+/** @brief Entry of the path index, see #dfs_index_header_t */
+typedef struct dfs_index_entry
+{
+    /** @brief Hash of the path (see #dfs_path_hash) */
+    uint32_t hash;
+    /** @brief Offset of the NUL-terminated path, from the start of the filesystem */
+    uint32_t path;
+    /** @brief Same as #directory_entry::flags of the file */
+    uint32_t flags;
+    /** @brief Same as #directory_entry::file_pointer of the file */
+    uint32_t file_pointer;
+} dfs_index_entry_t;
+
+_Static_assert(sizeof(dfs_index_header_t) == 16, "invalid dfs_index_header_t size");
+_Static_assert(sizeof(dfs_index_entry_t) == 16, "invalid dfs_index_entry_t size");
+
+/**
+ * @brief Hash function used by the path index (32-bit FNV-1a)
+ *
+ * @param[in] path
+ *            Full path of the file, relative to the root
+ *
+ * @return The hash value
+ */
+static inline uint32_t dfs_path_hash(const char *path)
+{
+    uint32_t hash = 0x811C9DC5;
+
+    while(*path)
+    {
+        hash ^= (uint8_t)*path++;
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+/** @brief Size of the blocks in which mkdfs compresses files */
+#define DFS_COMPRESS_BLOCK_SIZE 8192
+
+/**
+ * @brief Header of the contents of a compressed file (#FLAGS_COMPRESSED)
+ *
+ * The file is split in blocks of block_size bytes (the last one can be
+ * shorter), each compressed independently with the LZ4 block format, so that
+ * they can be decoded in any order. The header is followed by num_blocks+1
+ * 32-bit offsets of each block, relative to the start of the file contents
+ * (the last offset is the end of the last block). Offsets are always even,
+ * as each block is padded to 2 bytes for DMA. A block whose compressed size
+ * is not smaller than its decompressed size is stored uncompressed.
+ *
+ * The size in the directory entry is the decompressed size.
+ */
+typedef struct dfs_compressed_header
+{
+    /** @brief Decompressed size of each block */
+    uint32_t block_size;
+    /** @brief Number of blocks */
+    uint32_t num_blocks;
+} dfs_compressed_header_t;
+
+_Static_assert(sizeof(dfs_compressed_header_t) == 8, "invalid dfs_compressed_header_t size");
+
+/** @brief Magic value identifying a bundle (#dfs_bundle_header_t) */
+#define DFS_BUNDLE_MAGIC        0x424E444C  /* "BNDL" */
+/** @brief Alignment of the members of a bundle */
+#define DFS_BUNDLE_ALIGN        16
+
+/**
+ * @brief Header of a bundle file
+ *
+ * A bundle is a regular file, built by 'mkdfs --bundles' from a directory
+ * named *.bundle, which packs all the files in it (see #bundle_load). The
+ * header is followed by num_files #dfs_bundle_entry_t, sorted by name, then
+ * by the NUL-terminated names and then by the data of the members, each
+ * aligned to #DFS_BUNDLE_ALIGN. All offsets are relative to the start of
+ * the bundle.
+ */
+typedef struct dfs_bundle_header
+{
+    /** @brief Magic value, see #DFS_BUNDLE_MAGIC */
+    uint32_t magic;
+    /** @brief Number of members */
+    uint32_t num_files;
+    /** @brief Size of the whole bundle in bytes */
+    uint32_t size;
+    /** @brief Reserved, must be 0 */
+    uint32_t reserved;
+} dfs_bundle_header_t;
+
+/** @brief Member of a bundle, see #dfs_bundle_header_t */
+typedef struct dfs_bundle_entry
+{
+    /** @brief Offset of the NUL-terminated path, relative to the bundle directory */
+    uint32_t name;
+    /** @brief Offset of the data */
+    uint32_t data;
+    /** @brief Size of the data in bytes */
+    uint32_t size;
+    /** @brief Reserved, must be 0 */
+    uint32_t reserved;
+} dfs_bundle_entry_t;
+
+_Static_assert(sizeof(dfs_bundle_header_t) == 16, "invalid dfs_bundle_header_t size");
+_Static_assert(sizeof(dfs_bundle_entry_t) == 16, "invalid dfs_bundle_entry_t size");
+
+/**
+ * @brief Decompress a LZ4 block
+ *
+ * @param[in]  src
+ *             Compressed data
+ * @param[in]  src_len
+ *             Size of the compressed data (trailing padding is ignored)
+ * @param[out] dst
+ *             Output buffer
+ * @param[in]  dst_len
+ *             Decompressed size
+ *
+ * @return The number of decompressed bytes, or -1 if the data is corrupted.
+ */
+static inline int dfs_lz4_decompress(const uint8_t *src, int src_len, uint8_t *dst, int dst_len)
+{
+    const uint8_t *send = src + src_len;
+    uint8_t *d = dst;
+    uint8_t *dend = dst + dst_len;
+
+    while(src < send && d < dend)
+    {
+        uint8_t token = *src++;
+        int len = token >> 4;
+
+        /* Literals */
+        if(len == 15)
+        {
+            uint8_t b;
+            do {
+                if(src >= send) { return -1; }
+                b = *src++;
+                len += b;
+            } while(b == 255);
+        }
+
+        if(len > send - src || len > dend - d) { return -1; }
+        memcpy(d, src, len);
+        src += len;
+        d += len;
+
+        /* The last sequence has only literals */
+        if(d == dend) { break; }
+
+        /* Match */
+        if(send - src < 2) { return -1; }
+        int offset = src[0] | (src[1] << 8);
+        src += 2;
+        if(offset == 0 || offset > d - dst) { return -1; }
+
+        len = token & 15;
+        if(len == 15)
+        {
+            uint8_t b;
+            do {
+                if(src >= send) { return -1; }
+                b = *src++;
+                len += b;
+            } while(b == 255);
+        }
+        len += 4;
+
+        if(len > dend - d) { return -1; }
+
+        const uint8_t *m = d - offset;
+        if(offset >= len)
+        {
+            memcpy(d, m, len);
+            d += len;
+        }
+        else
+        {
+            /* Overlapping match (repeated pattern) */
+            while(len--) { *d++ = *m++; }
+        }
+    }
+
+    return d - dst;
+}
+
+/** @brief Runtime state of an open compressed file */
+typedef struct dfs_compressed_file
+{
+    /** @brief Decompressed size of each block */
+    uint32_t block_size;
+    /** @brief Number of blocks */
+    uint32_t num_blocks;
+    /** @brief Offsets of each block, see #dfs_compressed_header_t */
+    uint32_t *offsets;
+    /** @brief Buffer holding the last decompressed block */
+    uint8_t *decoded;
+    /** @brief Index of the block in #dfs_compressed_file::decoded (-1 if none) */
+    int decoded_block;
+    /** @brief Staging buffers for compressed blocks, so that one can be
+     *  decompressed while the next one is read by DMA */
+    uint8_t *staging[2];
+    /** @brief Index of the compressed block in each staging buffer (-1 if none) */
+    int staged_block[2];
+    /** @brief True if a DMA into the staging buffer is (or might still be) in flight */
+    bool staging_busy[2];
+    /** @brief DMA queue requests used to prefetch compressed blocks */
+    dma_request_t staging_req[2];
+} dfs_compressed_file_t;
+
 /** @brief Open file handle structure */
 typedef struct open_file
 {
@@ -53,6 +296,20 @@ typedef struct open_file
     uint8_t cached_data[512] __attribute__((aligned(16)));
     /** @brief location of the cached data */
     uint32_t cached_loc;
+    /** @brief Current read-ahead window (#open_file::cached_data unless configured) */
+    uint8_t *cache_buf;
+    /** @brief Size of the read-ahead window in bytes */
+    int cache_size;
+    /** @brief Second read-ahead window being prefetched (NULL if prefetch is disabled) */
+    uint8_t *prefetch_buf;
+    /** @brief location of the data in the prefetch window */
+    uint32_t prefetch_loc;
+    /** @brief True if the prefetch DMA is (or might still be) in flight */
+    bool prefetch_busy;
+    /** @brief DMA queue request used to prefetch the next read-ahead window */
+    dma_request_t prefetch_req;
+    /** @brief Decompression state, for compressed files (NULL otherwise) */
+    dfs_compressed_file_t *comp;
     /** @brief The unique file handle to refer to this file by */
     uint32_t handle;
     /** @brief The size in bytes of this file */
@@ -61,6 +318,23 @@ typedef struct open_file
     uint32_t loc;
     /** @brief The offset within the filesystem where the file is stored */
     uint32_t cart_start_loc;
+
+    /** @brief True if an asynchronous read is pending (see #dfs_read_async) */
+    bool async_busy;
+    /** @brief True if the pending asynchronous read DMAs straight into the destination */
+    bool async_direct;
+    /** @brief Destination buffer of the pending asynchronous read */
+    uint8_t *async_buf;
+    /** @brief Bytes still to be transferred by the pending asynchronous read */
+    int async_left;
+    /** @brief Bytes already transferred by the pending asynchronous read */
+    int async_done;
+    /** @brief Completion callback of the pending asynchronous read */
+    dfs_read_callback_t async_cb;
+    /** @brief Opaque context pointer passed to #open_file::async_cb */
+    void *async_ctx;
+    /** @brief DMA queue request used for the PI transfers of the asynchronous read */
+    dma_request_t async_req;
 } open_file_t;
 
 /** @} */ /* dfs */
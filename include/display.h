@@ -68,14 +68,37 @@ typedef enum
 /** @brief Display context */
 typedef int display_context_t;
 
+/** @brief Frame pacing statistics (see #display_get_stats) */
+typedef struct
+{
+    /** @brief Number of vertical blanks since #display_init */
+    uint32_t vblanks;
+    /** @brief Number of frames displayed */
+    uint32_t frames;
+    /** @brief Number of vertical blanks, after the first frame, with no new frame to display */
+    uint32_t missed_vblanks;
+    /** @brief Time between #display_lock and #display_show for the last frame, in ticks */
+    uint32_t last_frame_ticks;
+    /** @brief Longest time between #display_lock and #display_show, in ticks */
+    uint32_t max_frame_ticks;
+} display_stats_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void display_init( resolution_t res, bitdepth_t bit, uint32_t num_buffers, gamma_t gamma, antialias_t aa );
+void display_init_size( uint32_t width, uint32_t height, bitdepth_t bit, uint32_t num_buffers, gamma_t gamma, antialias_t aa );
 display_context_t display_lock();
+display_context_t display_lock_wait();
+display_context_t display_lock_clear(uint32_t color);
 void display_show(display_context_t disp);
 void display_close();
+void display_get_stats(display_stats_t *out);
+void display_set_viewport(display_context_t disp, uint32_t width, uint32_t height);
+void display_set_flip_line(uint32_t line);
+uint32_t display_get_scanline(void);
+int display_get_scanout_y(void);
 
 #ifdef __cplusplus
 }
@@ -6,6 +6,92 @@
 #ifndef __LIBDRAGON_DMA_H
 #define __LIBDRAGON_DMA_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @addtogroup dma
+ * @{
+ */
+
+/**
+ * @brief Maximum size of a single PI transfer issued by the DMA queue
+ *
+ * Queued requests larger than this are split into multiple PI transfers, so
+ * that a higher priority request never waits for more than one chunk.
+ */
+#define DMA_QUEUE_CHUNK_SIZE    (16*1024)
+
+/** @brief Priority of a queued PI DMA request */
+typedef enum {
+    /** @brief Latency-sensitive transfers (eg: audio streaming) */
+    DMA_PRIORITY_HIGH = 0,
+    /** @brief Bulk transfers (eg: asset loading) */
+    DMA_PRIORITY_NORMAL,
+    /** @brief Number of priority levels */
+    DMA_PRIORITY_COUNT
+} dma_priority_t;
+
+struct dma_request_s;
+
+/**
+ * @brief Callback invoked when a queued DMA request is complete
+ *
+ * The callback is normally invoked from within the PI interrupt handler,
+ * so it should be short and must not block. It is allowed to queue new
+ * requests, including reusing the request that just completed.
+ */
+typedef void (*dma_callback_t)(struct dma_request_s *req, void *ctx);
+
+/**
+ * @brief A queued PI DMA request
+ *
+ * The structure is owned by the caller and must stay valid until the request
+ * is complete. Fill it through #dma_queue_read or #dma_queue_write.
+ */
+typedef struct dma_request_s {
+    /** @brief RDRAM address */
+    void *ram_address;
+    /** @brief PI address */
+    unsigned long pi_address;
+    /** @brief Length of the transfer in bytes */
+    unsigned long len;
+    /** @brief True for RDRAM to PI transfers */
+    bool write;
+    /** @brief Set to true when the whole transfer is complete */
+    volatile bool done;
+    /** @brief Priority of the request */
+    dma_priority_t priority;
+    /** @brief Completion callback (can be NULL) */
+    dma_callback_t callback;
+    /** @brief Opaque pointer passed to the callback */
+    void *ctx;
+    /** @brief Number of bytes already transferred (private) */
+    unsigned long offset;
+    /** @brief Length of the PI transfer in flight (private) */
+    unsigned long chunk;
+    /** @brief Tick at which the request was queued (private) */
+    uint32_t queued_tick;
+    /** @brief Next request with the same priority (private) */
+    struct dma_request_s *next;
+} dma_request_t;
+
+/** @brief Statistics of the DMA queue, per priority level */
+typedef struct {
+    /** @brief Number of requests currently queued (including the one in flight) */
+    int depth[DMA_PRIORITY_COUNT];
+    /** @brief Highest number of requests queued at the same time */
+    int max_depth[DMA_PRIORITY_COUNT];
+    /** @brief Number of requests that were started */
+    uint32_t requests[DMA_PRIORITY_COUNT];
+    /** @brief Total ticks spent by requests waiting in the queue before starting */
+    uint64_t total_stall[DMA_PRIORITY_COUNT];
+    /** @brief Longest wait (in ticks) of a request in the queue before starting */
+    uint32_t max_stall[DMA_PRIORITY_COUNT];
+} dma_queue_stats_t;
+
+/** @} */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -19,6 +105,16 @@ void dma_read(void * ram_address, unsigned long pi_address, unsigned long len);
 
 void dma_wait(void);
 
+void dma_queue_read(dma_request_t *req, void *ram_address, unsigned long pi_address, unsigned long len,
+    dma_priority_t priority, dma_callback_t callback, void *ctx);
+void dma_queue_write(dma_request_t *req, const void *ram_address, unsigned long pi_address, unsigned long len,
+    dma_priority_t priority, dma_callback_t callback, void *ctx);
+bool dma_request_done(dma_request_t *req);
+void dma_request_wait(dma_request_t *req);
+int dma_queue_depth(void);
+void dma_queue_get_stats(dma_queue_stats_t *stats);
+void dma_queue_reset_stats(void);
+
 /* 32 bit IO read from PI device */
 uint32_t io_read(uint32_t pi_address);
 
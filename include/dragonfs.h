@@ -6,6 +6,11 @@
 #ifndef __LIBDRAGON_DRAGONFS_H
 #define __LIBDRAGON_DRAGONFS_H
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "dma.h"
+
 /** 
  * @addtogroup dfs
  * @{
@@ -19,10 +24,25 @@
 #define DFS_DEFAULT_LOCATION    0xB0101000
 
 /**
- * @brief Maximum open files in DragonFS
+ * @brief Default maximum open files in DragonFS (see #dfs_set_max_open_files)
  */
 #define MAX_OPEN_FILES      4
 
+/**
+ * @brief Upper bound of #dfs_set_max_open_files
+ */
+#define DFS_MAX_OPEN_FILES_LIMIT    4095
+
+/**
+ * @brief Maximum number of filesystem images mounted at the same time (see #dfs_mount)
+ */
+#define DFS_MAX_MOUNTS      4
+
+/**
+ * @brief Default number of directory sectors cached by #dfs_init
+ */
+#define DFS_DEFAULT_DIR_CACHE_SECTORS   16
+
 /**
  * @brief Maximum filename length
  *
@@ -73,8 +93,40 @@
 #define FLAGS_DIR           0x1
 /** @brief This is the end of a directory list */
 #define FLAGS_EOF           0x2
+/** @brief The file contents are compressed (see mkdfs --compress) */
+#define FLAGS_COMPRESSED    0x4
 /** @} */
 
+/**
+ * @brief Callback invoked when an asynchronous read completes
+ *
+ * The callback is invoked from within the PI interrupt handler (or from
+ * #dfs_read_async itself, if the read could be satisfied without any DMA
+ * transfer), so it should be short and must not block.
+ *
+ * @param[in] handle
+ *            The file handle the read was issued on
+ * @param[in] read
+ *            The number of bytes that have been read into the buffer
+ * @param[in] ctx
+ *            The opaque context pointer passed to #dfs_read_async
+ */
+typedef void (*dfs_read_callback_t)(uint32_t handle, int read, void *ctx);
+
+/**
+ * @brief Location of the contents of a file in cartridge space
+ *
+ * Filled by #dfs_rom_desc or #dfs_rom_desc_handle. It allows to access
+ * immutable data directly from ROM, without reading it through a file handle.
+ */
+typedef struct dfs_rom_desc_s
+{
+    /** @brief PI address of the first byte of the file */
+    uint32_t rom_addr;
+    /** @brief Size of the file in bytes */
+    uint32_t size;
+} dfs_rom_desc_t;
+
 /** @} */
 
 #ifdef __cplusplus
@@ -82,18 +134,32 @@ extern "C" {
 #endif
 
 int dfs_init(uint32_t base_fs_loc);
+int dfs_init_with_cache(uint32_t base_fs_loc, int cache_sectors);
+int dfs_mount(const char * const prefix, uint32_t base_fs_loc);
+int dfs_unmount(const char * const prefix);
+int dfs_set_max_open_files(int count);
 int dfs_chdir(const char * const path);
 int dfs_dir_findfirst(const char * const path, char *buf);
 int dfs_dir_findnext(char *buf);
 
 int dfs_open(const char * const path);
 int dfs_read(void * const buf, int size, int count, uint32_t handle);
+void *dfs_alloc_buffer(int size);
+FILE *dfs_fopen(const char *path, const char *mode);
+int dfs_read_async(uint32_t handle, void * const buf, int len, dfs_read_callback_t cb, void *ctx);
+bool dfs_read_async_busy(uint32_t handle);
+int dfs_set_readahead(uint32_t handle, void *buf, int size, bool prefetch);
 int dfs_seek(uint32_t handle, int offset, int origin);
 int dfs_tell(uint32_t handle);
 int dfs_close(uint32_t handle);
 int dfs_eof(uint32_t handle);
 int dfs_size(uint32_t handle);
 uint32_t dfs_rom_addr(const char *path);
+int dfs_rom_desc(const char *path, dfs_rom_desc_t *desc);
+int dfs_rom_desc_handle(uint32_t handle, dfs_rom_desc_t *desc);
+uint32_t dfs_rom_io_read(const dfs_rom_desc_t *desc, uint32_t offset);
+void dfs_rom_dma(dma_request_t *req, const dfs_rom_desc_t *desc, uint32_t offset, void *ram_address,
+    uint32_t len, dma_priority_t priority, dma_callback_t callback, void *ctx);
 
 #ifdef __cplusplus
 }
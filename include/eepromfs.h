@@ -30,6 +30,19 @@
 #define EEPFS_ECONFLICT  -6
 /** @} */
 
+/**
+ * @brief Use a lookup table to compute CRC-16 checksums.
+ * 
+ * Set to 0 at build time to save the 512 bytes of the table,
+ * at the cost of slower checksums.
+ */
+#ifndef EEPFS_CRC16_TABLE
+#define EEPFS_CRC16_TABLE 1
+#endif
+
+/** @brief Initial value of a CRC-16 checksum (see #eepfs_crc16_update) */
+#define EEPFS_CRC16_INIT 0xFFFF
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -84,6 +97,12 @@ int eepfs_erase(const char * path);
 bool eepfs_verify_signature(void);
 void eepfs_wipe(void);
 
+int eepfs_enable_async(void);
+int eepfs_poll(void);
+void eepfs_flush(void);
+
+uint16_t eepfs_crc16_update(uint16_t crc, const void * data, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -102,6 +102,37 @@ typedef struct
 	volatile reg_block_t* regs;
 } exception_t;
 
+/**
+ * @brief FPU handling of denormalized numbers
+ *
+ * The VR4300 FPU does not handle denormalized numbers in hardware: an operation
+ * with a denormalized input, or a denormalized result, raises an unimplemented
+ * operation exception.
+ *
+ * @see #exception_set_fpu_denormal_mode
+ */
+typedef enum {
+	/** @brief Every denormalized number raises an exception (the default) */
+	FPU_DENORMAL_TRAP = 0,
+	/** @brief Denormalized results are flushed to zero, denormalized inputs raise an exception */
+	FPU_DENORMAL_FLUSH,
+	/**
+	 * @brief Denormalized results are flushed to zero, and the exception handler flushes
+	 *        denormalized inputs to zero and retries the instruction
+	 */
+	FPU_DENORMAL_EMULATE,
+} fpu_denormal_mode_t;
+
+/**
+ * @brief Statistics of the denormalized inputs flushed by the exception handler
+ */
+typedef struct {
+	/** @brief Number of instructions retried with denormalized inputs flushed to zero */
+	uint32_t count;
+	/** @brief Address of the last of these instructions */
+	uint32_t last_pc;
+} fpu_denormal_stats_t;
+
 /** @} */
 
 #ifdef __cplusplus
@@ -110,6 +141,8 @@ extern "C" {
 
 void register_exception_handler( void (*cb)(exception_t *) );
 void exception_default_handler( exception_t* ex );
+void exception_set_fpu_denormal_mode( fpu_denormal_mode_t mode );
+void exception_fpu_denormal_stats( fpu_denormal_stats_t *stats );
 
 #ifdef __cplusplus
 }
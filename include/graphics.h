@@ -7,6 +7,7 @@
 #define __LIBDRAGON_GRAPHICS_H
 
 #include "display.h"
+#include "memops.h"
 
 /**
  * @addtogroup graphics
@@ -36,12 +37,14 @@ typedef struct
     /** 
      * @brief Bit depth expressed in bytes
      *
-     * A 32 bit sprite would have a value of '4' here
+     * A 32 bit sprite would have a value of '4' here.  4-bit sprites have a value of '0'.
      */
     uint8_t bitdepth;
     /** 
      * @brief Sprite format
-     * @note Currently unused
+     *
+     * One of the SPRITE_FORMAT_* values.  Only #SPRITE_FORMAT_RGBA sprites can be drawn by
+     * the graphics functions; the other formats are texture formats for the RDP.
      */
     uint8_t format;
     /** @brief Number of horizontal slices for spritemaps */
@@ -53,6 +56,44 @@ typedef struct
     uint32_t data[0];
 } sprite_t;
 
+/**
+ * @name Sprite formats
+ * @brief Values of the format field of #sprite_t
+ * @{
+ */
+/** @brief RGBA, 16 (5-5-5-1) or 32 (8-8-8-8) bits per pixel depending on the bit depth */
+#define SPRITE_FORMAT_RGBA  0
+/** @brief Color index, 4 bits per pixel, followed by a palette of 16 RGBA 5-5-5-1 colors */
+#define SPRITE_FORMAT_CI4   1
+/** @brief Color index, 8 bits per pixel, followed by a palette of 256 RGBA 5-5-5-1 colors */
+#define SPRITE_FORMAT_CI8   2
+/** @brief Intensity, 4 bits per pixel */
+#define SPRITE_FORMAT_I4    3
+/** @brief Intensity, 8 bits per pixel */
+#define SPRITE_FORMAT_I8    4
+/** @brief Intensity and alpha, 3 + 1 bits per pixel */
+#define SPRITE_FORMAT_IA4   5
+/** @brief Intensity and alpha, 4 + 4 bits per pixel */
+#define SPRITE_FORMAT_IA8   6
+/** @} */
+
+/**
+ * @brief Flag of the format field of #sprite_t: the pixels are compressed
+ *
+ * Set in the sprite files written by mksprite --compress.  #sprite_load uncompresses
+ * them, and clears the flag: compressed sprites cannot be drawn as they are.
+ */
+#define SPRITE_FLAGS_COMPRESSED 0x80
+
+/** @brief Backend used by the graphics functions to draw */
+typedef enum
+{
+    /** @brief Draw with the CPU */
+    GRAPHICS_BACKEND_CPU,
+    /** @brief Draw with the RDP when it is attached to the display context, where supported */
+    GRAPHICS_BACKEND_RDP
+} graphics_backend_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -66,7 +107,9 @@ void graphics_draw_line_trans( display_context_t disp, int x0, int y0, int x1, i
 void graphics_draw_box( display_context_t disp, int x, int y, int width, int height, uint32_t color );
 void graphics_draw_box_trans( display_context_t disp, int x, int y, int width, int height, uint32_t color );
 void graphics_fill_screen( display_context_t disp, uint32_t c );
+rsp_memops_fence_t graphics_fill_screen_async( display_context_t disp, uint32_t c );
 void graphics_set_color( uint32_t forecolor, uint32_t backcolor );
+void graphics_set_backend( graphics_backend_t backend );
 void graphics_draw_character( display_context_t disp, int x, int y, char c );
 void graphics_draw_text( display_context_t disp, int x, int y, const char * const msg );
 void graphics_draw_sprite( display_context_t disp, int x, int y, sprite_t *sprite );
@@ -74,6 +117,8 @@ void graphics_draw_sprite_stride( display_context_t disp, int x, int y, sprite_t
 void graphics_draw_sprite_trans( display_context_t disp, int x, int y, sprite_t *sprite );
 void graphics_draw_sprite_trans_stride( display_context_t disp, int x, int y, sprite_t *sprite, int offset );
 
+sprite_t *sprite_load( const char * const fn );
+
 #ifdef __cplusplus
 }
 #endif
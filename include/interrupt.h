@@ -6,6 +6,9 @@
 #ifndef __LIBDRAGON_INTERRUPT_H
 #define __LIBDRAGON_INTERRUPT_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -28,6 +31,58 @@ typedef enum
     INTERRUPTS_ENABLED
 } interrupt_state_t;
 
+/** @brief Interrupt sources, see #register_interrupt_handler */
+typedef enum
+{
+    /** @brief RSP interrupt */
+    INTERRUPT_SP,
+    /** @brief Serial interface interrupt */
+    INTERRUPT_SI,
+    /** @brief Audio interface interrupt */
+    INTERRUPT_AI,
+    /** @brief Video interface interrupt */
+    INTERRUPT_VI,
+    /** @brief Peripheral interface interrupt */
+    INTERRUPT_PI,
+    /** @brief RDP interrupt */
+    INTERRUPT_DP,
+    /** @brief Timer interrupt */
+    INTERRUPT_TI,
+    /** @brief Number of interrupt sources */
+    INTERRUPT_NUM_SOURCES
+} interrupt_source_t;
+
+/** @brief Interrupt handler, called with the context it was registered with */
+typedef void (*interrupt_handler_t)(void *ctx);
+
+/** @brief Maximum number of handlers registered for each interrupt source */
+#define INTERRUPT_MAX_HANDLERS  8
+
+/** @brief Maximum number of scanline handlers, see #register_VI_line_handler */
+#define INTERRUPT_MAX_VI_LINES  8
+
+/** @brief Statistics of an interrupt source, see #interrupt_get_stats */
+typedef struct
+{
+    /** @brief Number of interrupts */
+    uint32_t count;
+    /** @brief Longest time spent in the handlers of an interrupt, in ticks */
+    uint32_t max_ticks;
+    /** @brief Total time spent in the handlers, in ticks (divide by count for the average) */
+    uint64_t total_ticks;
+} interrupt_source_stats_t;
+
+/** @brief Interrupt statistics, see #interrupt_enable_stats */
+typedef struct
+{
+    /** @brief Statistics of each interrupt source */
+    interrupt_source_stats_t sources[INTERRUPT_NUM_SOURCES];
+    /** @brief Longest time spent with interrupts disabled by #disable_interrupts, in ticks */
+    uint32_t max_disabled_ticks;
+    /** @brief Address #disable_interrupts was called from, for the longest time */
+    void *max_disabled_caller;
+} interrupt_stats_t;
+
 /** @} */
 
 void register_AI_handler( void (*callback)() );
@@ -46,8 +101,14 @@ void unregister_TI_handler( void (*callback)() );
 void unregister_SI_handler( void (*callback)() );
 void unregister_SP_handler( void (*callback)() );
 
+int register_interrupt_handler( interrupt_source_t source, interrupt_handler_t handler, void *ctx );
+int register_interrupt_handler_nofpu( interrupt_source_t source, interrupt_handler_t handler, void *ctx );
+void unregister_interrupt_handler( interrupt_source_t source, interrupt_handler_t handler, void *ctx );
+
 void set_AI_interrupt( int active );
 void set_VI_interrupt( int active, unsigned long line );
+int register_VI_line_handler( unsigned long line, interrupt_handler_t handler, void *ctx );
+void unregister_VI_line_handler( unsigned long line, interrupt_handler_t handler, void *ctx );
 void set_PI_interrupt( int active );
 void set_DP_interrupt( int active );
 void set_SI_interrupt( int active );
@@ -60,6 +121,11 @@ void disable_interrupts();
 
 interrupt_state_t get_interrupts_state(); 
 
+void interrupt_enable_stats( bool enable );
+void interrupt_get_stats( interrupt_stats_t *out );
+void interrupt_reset_stats( void );
+void interrupt_dump_stats( void );
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,6 +8,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * @addtogroup joybus
@@ -23,6 +24,38 @@
  */
 #define JOYBUS_BLOCK_DWORDS ( JOYBUS_BLOCK_SIZE / sizeof(uint64_t) )
 
+/**
+ * @brief Maximum number of transactions queued by #joybus_exec_async
+ */
+#define JOYBUS_ASYNC_QUEUE_SIZE 4
+
+/**
+ * @brief Callback of #joybus_exec_async, called with the output block
+ */
+typedef void (*joybus_callback_t)(void *outblock);
+
+/**
+ * @brief Number of Joybus channels (the 4 controller ports and the cartridge)
+ */
+#define JOYBUS_NUM_CHANNELS 5
+
+/**
+ * @brief A list of Joybus commands packed in a single input block
+ *
+ * See #joybus_cmdlist_init.
+ */
+typedef struct
+{
+    /** @brief Input block being built */
+    uint8_t block[JOYBUS_BLOCK_SIZE];
+    /** @brief Number of bytes of the block used by the commands */
+    int length;
+    /** @brief Channel of the last command (-1 if none) */
+    int channel;
+    /** @brief Offset of the receive length of the command of each channel (-1 if none) */
+    int result[JOYBUS_NUM_CHANNELS];
+} joybus_cmdlist_t;
+
 /**
  * @brief EEPROM Probe Values
  * @see #eeprom_present
@@ -47,6 +80,12 @@ extern "C" {
 #endif
 
 void joybus_exec( const void * inblock, void * outblock );
+int joybus_exec_async( const void * inblock, void * outblock, joybus_callback_t callback );
+bool joybus_async_busy( void );
+void joybus_cmdlist_init( joybus_cmdlist_t * list );
+int joybus_cmdlist_add( joybus_cmdlist_t * list, int channel, uint8_t command, const void * send, int send_len, int recv_len );
+const void * joybus_cmdlist_block( joybus_cmdlist_t * list );
+const uint8_t * joybus_cmdlist_result( const joybus_cmdlist_t * list, const void * outblock, int channel, int * err );
 eeprom_type_t eeprom_present( void );
 size_t eeprom_total_blocks( void );
 void eeprom_read( uint8_t block, uint8_t * dest );
@@ -55,10 +55,17 @@
 #include "display.h"
 #include "dma.h"
 #include "dragonfs.h"
+#include "bundle.h"
+#include "asset.h"
+#include "overlayfs.h"
+#include "overlay.h"
+#include "vmath.h"
 #include "eepromfs.h"
+#include "save.h"
 #include "graphics.h"
 #include "interrupt.h"
 #include "n64sys.h"
+#include "memops.h"
 #include "rdp.h"
 #include "rsp.h"
 #include "timer.h"
@@ -67,5 +74,9 @@
 #include "mixer.h"
 #include "samplebuffer.h"
 #include "wav64.h"
+#include "video.h"
+#include "mod64.h"
+#include "profile.h"
+#include "thread.h"
 
 #endif
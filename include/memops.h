@@ -0,0 +1,49 @@
+/**
+ * @file memops.h
+ * @brief Optimized memory copy and fill
+ * @ingroup memops
+ */
+#ifndef __LIBDRAGON_MEMOPS_H
+#define __LIBDRAGON_MEMOPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @addtogroup memops
+ * @{
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *fast_memcpy(void *dst, const void *src, size_t n);
+void *fast_memset(void *dst, int c, size_t n);
+void *fast_memcpy_overwrite(void *dst, const void *src, size_t n);
+void *fast_memset_overwrite(void *dst, int c, size_t n);
+
+/**
+ * @brief Fence of an RSP memory operation
+ *
+ * Fences increase with each operation queued: an operation is complete when
+ * #rsp_memops_done returns true for its fence.  The fence 0 is never returned,
+ * and is always complete.
+ */
+typedef uint32_t rsp_memops_fence_t;
+
+rsp_memops_fence_t rsp_memcpy(void *dst, const void *src, int size);
+rsp_memops_fence_t rsp_memset32(void *dst, uint32_t value, int size);
+rsp_memops_fence_t rsp_convert_16to32(void *dst, const void *src, int num_pixels);
+rsp_memops_fence_t rsp_convert_32to16(void *dst, const void *src, int num_pixels);
+bool rsp_memops_done(rsp_memops_fence_t fence);
+void rsp_memops_wait(rsp_memops_fence_t fence);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */ /* memops */
+
+#endif
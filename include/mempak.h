@@ -14,6 +14,9 @@
 /** @brief Size in bytes of a Mempak block */
 #define MEMPAK_BLOCK_SIZE   256
 
+/** @brief Number of sectors cached by #mempak_mount: the header, the two TOCs and the note table */
+#define MEMPAK_CACHED_SECTORS   5
+
 /**
  * @brief Structure representing a save entry in a mempak
  */
@@ -55,6 +58,8 @@ typedef struct entry_structure
 extern "C" {
 #endif
 
+int mempak_mount( int controller );
+void mempak_unmount( int controller );
 int read_mempak_sector( int controller, int sector, uint8_t *sector_data );
 int write_mempak_sector( int controller, int sector, uint8_t *sector_data );
 int validate_mempak( int controller );
@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "vmath.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,13 +20,13 @@ extern "C" {
  * @ingroup audio
  * @brief Flexible, composable, fast, RSP-based audio mixer.
  *
- * This module offers a flexible API to mix and play up to 32 independent audio
+ * This module offers a flexible API to mix and play up to 64 independent audio
  * streams called "waveforms". It also supports resampling: each waveform can
  * play at a different playback frequency, which in turn can be different from
  * the final output frequency. The resampling and mixing is performed by a very
  * efficient RSP microcode (see rsp_mixer.S).
  *
- * The mixer exposes 32 channels that can be used to play different audio sources.
+ * The mixer exposes 64 channels that can be used to play different audio sources.
  * An audio source is called a "waveform", and is represented by the type
  * waveform_t. To be able to produce audio that can be mixed (eg: decompress
  * and playback a MP3 file), the decoder/player code must implement a waveform_t.
@@ -55,7 +56,7 @@ extern "C" {
  */
 
 /** @brief Maximum number of channels supported by the mixer */
-#define MIXER_MAX_CHANNELS      32
+#define MIXER_MAX_CHANNELS      64
 
 /**
  * Number of bytes in sample buffers that must be over-read to make the
@@ -85,6 +86,9 @@ typedef struct samplebuffer_s samplebuffer_t;
  * more memory as the mixer will allocate one sample buffer per channel,
  * but it does not affect performance (which correlates to the
  * actual number of simultaneously playing channels).
+ *
+ * The RSP mixes up to 32 playing channels in a single run; when more
+ * channels are playing, the mixing is performed in multiple passes.
  * 
  * @param[in]    num_channels   Number of channels to initialize.
  */
@@ -166,6 +170,106 @@ void mixer_ch_set_vol_pan(int ch, float vol, float pan);
 void mixer_ch_set_vol_dolby(int ch, float fl, float fr,
 	float c, float sl, float sr);
 
+/**
+ * @brief Configure a low-pass filter on the specified channel.
+ *
+ * Each channel can be run through a one-pole low-pass filter before it is
+ * mixed, for instance to muffle sounds behind walls or underwater. The filter
+ * runs on the RSP as part of the mixing, so it has no CPU cost.
+ *
+ * For stereo waveforms, the filter is applied to both the left and the
+ * right samples.
+ *
+ * @param[in]   ch              Channel index
+ * @param[in]   cutoff          Cutoff frequency in Hz, or 0 to disable the
+ *                              filter (default). Frequencies at or above
+ *                              half of the output sample rate also disable it.
+ */
+void mixer_ch_set_lowpass(int ch, float cutoff);
+
+/**
+ * @brief Set the level of a channel sent to the echo bus.
+ *
+ * The mixer has a single echo bus, shared by all channels (see
+ * #mixer_set_echo). Each channel feeds it with its samples scaled by its send
+ * level, after the low-pass filter (#mixer_ch_set_lowpass) but before its
+ * volume and panning, so the echo does not fade when the channel volume does.
+ *
+ * @param[in]   ch              Channel index
+ * @param[in]   level           Send level (range [0..1], default 0)
+ */
+void mixer_ch_set_send(int ch, float level);
+
+/**
+ * @brief Configure the echo bus.
+ *
+ * The echo bus is a delay line in RDRAM: the samples sent by the channels
+ * (see #mixer_ch_set_send) are played back after the specified delay, scaled
+ * by the wet level, and fed back into the delay line scaled by the feedback
+ * level, so that they repeat with decreasing volume. Short delays with high
+ * feedback give a simple reverb. The whole bus runs on the RSP as part of the
+ * mixing.
+ *
+ * The delay line takes 4 bytes per sample of delay at the output sample rate.
+ * Changing the delay waits for the mixing in progress, and clears the samples
+ * in the delay line; the levels can be changed at any time.
+ *
+ * @param[in]   delay           Delay in seconds, or 0 to disable the bus
+ *                              (default)
+ * @param[in]   feedback        Level of the samples fed back into the delay
+ *                              line (range [0..1])
+ * @param[in]   wet             Level of the delayed samples added to the
+ *                              output (range [0..1])
+ */
+void mixer_set_echo(float delay, float feedback, float wet);
+
+/**
+ * @brief Listener of the positional audio (see #mixer_spatial_update).
+ *
+ * Positions and velocities are in world units (and units per second): only
+ * the distance parameters and the speed of sound need to use the same units.
+ */
+typedef struct {
+	vec3_t pos;                 ///< Position of the listener
+	vec3_t vel;                 ///< Velocity of the listener (for the Doppler effect)
+	vec3_t right;               ///< Unit vector pointing to the right of the listener
+	float ref_dist;             ///< Distance within which sounds are not attenuated
+	float max_dist;             ///< Distance beyond which sounds are silent
+	float rolloff;              ///< Rolloff factor of the inverse distance attenuation (1 is physical)
+	float speed_of_sound;       ///< Speed of sound for the Doppler effect (0 disables it)
+} mixer_listener_t;
+
+/**
+ * @brief Sound source of the positional audio (see #mixer_spatial_update).
+ */
+typedef struct {
+	int ch;                     ///< Channel playing the emitter
+	vec3_t pos;                 ///< Position of the emitter
+	vec3_t vel;                 ///< Velocity of the emitter (for the Doppler effect)
+	float vol;                  ///< Volume within the reference distance (range [0..1])
+	float frequency;            ///< Playback frequency without Doppler effect (eg: the waveform frequency)
+} mixer_emitter_t;
+
+/**
+ * @brief Update the volume, panning and frequency of a batch of positional sounds.
+ *
+ * For each emitter, this computes the distance attenuation, the stereo panning
+ * and the Doppler shift relative to the listener, and configures its channel
+ * in a single pass. This is equivalent to calling #mixer_ch_set_vol_pan and
+ * #mixer_ch_set_freq for each emitter, but avoids recomputing the constant
+ * parts of the conversions for each channel, so it is much cheaper when
+ * dozens of emitters are updated every frame.
+ *
+ * The attenuation is ref_dist / (ref_dist + rolloff * (distance - ref_dist))
+ * between the reference and the maximum distance. The panning follows the
+ * same law as #mixer_ch_set_vol_pan, so a centered sound is attenuated by 50%.
+ *
+ * @param[in]   listener        Listener
+ * @param[in]   emitters        Emitters to update
+ * @param[in]   num_emitters    Number of emitters
+ */
+void mixer_spatial_update(const mixer_listener_t *listener, const mixer_emitter_t *emitters, int num_emitters);
+
 /**
  * @brief Start playing the specified waveform on the specified channel.
  * 
@@ -176,11 +280,10 @@ void mixer_ch_set_vol_dolby(int ch, float fl, float fr,
  * frequency of the channel is modified to adapt to the frequency requested
  * for correct playback of the waveform.
  * 
- * If the waveform is marked as stereo (channels == 2), the mixer will need
- * two channels to play it back. "ch" will be used for the left samples,
- * while "ch+1" will be used for the right samples. After this, it is
- * forbidden to call mixer functions on "ch+1" until the stereo
- * waveform is stopped.
+ * If the waveform is marked as stereo (channels == 2), the channel plays
+ * the interleaved left and right samples: the left volume of the channel
+ * applies to the left samples, and the right volume to the right samples.
+ * The other channels are not affected.
  * 
  * If the same waveform (same pointer) was already being played or was the
  * last one that was played on this channel, the channel sample buffer
@@ -200,6 +303,10 @@ void mixer_ch_play(int ch, waveform_t *wave);
  * This function must be called after mixer_ch_play, as otherwise the
  * frequency is reset to the default of the waveform.
  * 
+ * Channels playing exactly at the output rate of the mixer are copied
+ * without resampling, which is considerably faster on the RSP: convert
+ * waveforms to that rate offline when possible (see audioconv64).
+ * 
  * @param[in]   ch              Channel index
  * @param[in]   frequency       Playback frequency (in Hz / samples per second)
  */
@@ -282,6 +389,92 @@ bool mixer_ch_playing(int ch);
  */
 void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_sz);
 
+/** @brief Handle of a voice played through the voice pool (see #mixer_voice_play) */
+typedef int mixer_voice_t;
+
+/** @brief Invalid voice handle, returned when a waveform could not be played */
+#define MIXER_VOICE_NONE        (-1)
+
+/**
+ * @brief Configure the channels used by the voice pool.
+ *
+ * The voice pool allocates channels automatically to the waveforms played
+ * via #mixer_voice_play, so that the application does not need to assign
+ * a fixed channel to each sound. The pool uses the channels in the range
+ * [first_ch, first_ch+num_ch); the other channels can still be used
+ * directly with the mixer_ch_* functions (eg: for music).
+ *
+ * @param[in]   first_ch        First channel of the pool
+ * @param[in]   num_ch          Number of channels in the pool
+ */
+void mixer_voice_pool_init(int first_ch, int num_ch);
+
+/**
+ * @brief Play a waveform on a channel of the voice pool.
+ *
+ * If there is no free channel in the pool, the voice with the lowest
+ * priority is stopped to make room for the new one (among voices with the
+ * same priority, the quietest one is stopped, and among equally loud ones,
+ * the oldest one). If all voices have a higher priority than the requested
+ * one, the waveform is not played.
+ *
+ * The returned handle stays valid until the voice is stopped, finishes
+ * playing, or is stolen by another voice. Use #mixer_voice_channel to obtain
+ * the channel, to configure volume and frequency with the mixer_ch_* functions.
+ *
+ * @param[in]   wave            Waveform to playback
+ * @param[in]   priority        Priority of the voice (higher is more important)
+ * @return                      Voice handle, or #MIXER_VOICE_NONE if the
+ *                              waveform could not be played
+ */
+mixer_voice_t mixer_voice_play(waveform_t *wave, int priority);
+
+/**
+ * @brief Return the channel a voice is playing on.
+ *
+ * @param[in]   voice           Voice handle
+ * @return                      Channel index, or -1 if the voice is not
+ *                              playing anymore
+ */
+int mixer_voice_channel(mixer_voice_t voice);
+
+/** @brief Stop a voice (does nothing if the voice is not playing anymore) */
+void mixer_voice_stop(mixer_voice_t voice);
+
+/** @brief Maximum number of waveforms that can be resident at the same time (see #mixer_waveform_preload) */
+#define MIXER_MAX_RESIDENT      32
+
+/**
+ * @brief Load a waveform in memory, so that channels play it without copies.
+ *
+ * Normally, each channel decodes the waveform it plays into its own sample
+ * buffer, that is refilled as playback goes on. Short waveforms that are
+ * played often and on many channels at the same time (eg: sound effects)
+ * can instead be preloaded: the whole waveform is decoded once into a
+ * buffer shared by all the channels, that the RSP reads directly. Channels
+ * playing a resident waveform never refill their sample buffer.
+ *
+ * Resident waveforms are reference counted: each call to this function must
+ * be paired with a call to #mixer_waveform_release. Only the first call
+ * actually loads the samples.
+ *
+ * The waveform must have a known length, and it must stay valid while it is
+ * resident.
+ *
+ * @param[in]   wave            Waveform to load
+ */
+void mixer_waveform_preload(waveform_t *wave);
+
+/**
+ * @brief Release a waveform loaded with #mixer_waveform_preload.
+ *
+ * When the last reference is released, the channels still playing the
+ * waveform are stopped, and its memory is freed.
+ *
+ * @param[in]   wave            Waveform to release
+ */
+void mixer_waveform_release(waveform_t *wave);
+
 /**
  * @brief Run the mixer to produce output samples.
  * 
@@ -304,6 +497,102 @@ void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_
  */
 void mixer_poll(int16_t *out, int nsamples);
 
+/**
+ * @brief Run the mixer asynchronously to produce output samples.
+ *
+ * This function is like #mixer_poll, but it does not wait for the RSP to
+ * finish mixing: it starts the ucode and returns immediately, so that the
+ * mixing time is hidden behind other CPU work. The channel state is read
+ * back from the RSP in the SP interrupt.
+ *
+ * If out is an audio buffer obtained via #audio_write_begin, #audio_write_end
+ * can be called right away: the buffer will be sent to the AI only once the
+ * mixing is complete.
+ *
+ * The mixer functions that need the updated channel state (eg: #mixer_ch_play
+ * or #mixer_ch_get_pos) wait for the mixing to finish. The mixing runs as a
+ * RSP task (see #rsp_task_submit), so it is serialized with other RSP users.
+ *
+ * @param[in]   out             Output buffer were samples will be written.
+ * @param[in]   nsamples        Number of stereo samples to generate.
+ */
+void mixer_poll_async(int16_t *out, int nsamples);
+
+/**
+ * @brief Refill the audio buffers from the interrupts, for low latency.
+ *
+ * When enabled, the mixer registers itself as the asynchronous fill callback
+ * of the audio subsystem (see #audio_set_async_buffer_callback): every time
+ * an audio buffer is free, it is mixed on the RSP straight from the
+ * interrupts, and sent to the AI as soon as it is ready. The interrupts never
+ * wait for the RSP: a buffer split by mixer events is mixed one part at a
+ * time, each part started when the previous one is complete.
+ * The application must not call #mixer_poll or #mixer_poll_async anymore.
+ *
+ * Together with the short buffers of #audio_init_low_latency, this brings
+ * the latency between a call like #mixer_ch_play and the sound under
+ * 10 milliseconds.
+ *
+ * Since mixing now runs at any time in interrupt context, the code that
+ * changes several channels settings at once from the main loop should do so
+ * with interrupts disabled (#disable_interrupts / #enable_interrupts), so
+ * that no buffer is mixed with only some of them applied. Mixer events
+ * (see #mixer_add_event) and the waveform read callbacks run in interrupt
+ * context as well.
+ *
+ * @param[in]   enable          True to enable, false to go back to polling
+ */
+void mixer_set_low_latency(bool enable);
+
+/**
+ * @brief Return true if an asynchronous mixing started by #mixer_poll_async
+ *        is still in progress.
+ */
+bool mixer_poll_busy(void);
+
+/**
+ * @brief Wait for the asynchronous mixing started by #mixer_poll_async.
+ */
+void mixer_poll_wait(void);
+
+/**
+ * @brief Profiling counters of the mixer.
+ *
+ * Counters are accumulated by #mixer_poll since #mixer_init or the last call
+ * to #mixer_reset_stats. Ticks are measured with TICKS_READ (#TICKS_PER_SECOND).
+ * They can be used to budget the audio processing time within a frame.
+ */
+typedef struct {
+	/** @brief CPU ticks spent in waveform read callbacks (decoding / loading samples) */
+	uint64_t read_ticks;
+	/** @brief RSP ticks spent running the mixer ucode */
+	uint64_t rsp_ticks;
+	/** @brief Longest single run of the mixer ucode, in RSP ticks */
+	uint32_t rsp_max_ticks;
+	/** @brief Number of runs of the mixer ucode (one per pass of up to 32 channels) */
+	uint32_t rsp_runs;
+	/** @brief Number of output samples mixed */
+	uint64_t samples;
+	/** @brief Number of sample buffer flushes (at start of playback or after a seek) */
+	uint32_t flushes;
+	/** @brief Number of calls to the waveform read callback, per channel */
+	uint32_t ch_refills[MIXER_MAX_CHANNELS];
+} mixer_stats_t;
+
+/**
+ * @brief Fetch the profiling counters of the mixer.
+ *
+ * @param[out]  stats           Structure filled with the current counters
+ */
+void mixer_get_stats(mixer_stats_t *stats);
+
+/**
+ * @brief Reset the profiling counters of the mixer.
+ *
+ * A common pattern is to fetch and reset the counters once per frame.
+ */
+void mixer_reset_stats(void);
+
 /**
  * @brief Callback invoked by mixer_poll at a specified time
  * 
@@ -333,6 +622,11 @@ typedef int (*MixerEvent)(void* ctx);
  * Register a new event into the mixer. "delay" is the number of samples to
  * wait before calling the event callback. "cb" is the event callback. "ctx"
  * is an opaque pointer that will be passed to the callback when invoked.
+ *
+ * Events are sample-accurate: if an event falls in the middle of the buffer
+ * being mixed by #mixer_poll, the buffer is split at that point and the
+ * callback is invoked exactly after the samples that precede it have been
+ * mixed. Up to 64 events can be registered at the same time.
  * 
  * @param[in]   delay           Number of samples to wait before invoking
  *                              the event.
@@ -425,9 +719,8 @@ typedef void (*WaveformRead)(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen
  * implementing an audio format like VADPCM or MPEG-2.
  *
  * Waveforms can produce samples as 8-bit or 16-bit. Samples must always be
- * signed. Stereo waveforms (interleaved samples) are supported: when used
- * with #mixer_ch_play, they will use automatically two channels (the specified
- * one and the following).
+ * signed. Stereo waveforms (interleaved samples) are supported: they are
+ * played on a single channel, like mono waveforms.
  */
 typedef struct waveform_s {
 	// Name of the waveform (for debugging purposes)
@@ -438,8 +731,7 @@ typedef struct waveform_s {
 	uint8_t bits;
 
 	// Number of interleaved audio channels in this waveforms. Supported values
-	// are 1 and 2 (mono and stereo waveforms). Notice that a stereo waveform
-	// will use two consecutive mixer channels to be played back.
+	// are 1 and 2 (mono and stereo waveforms).
 	uint8_t channels;
 
 	// Desired playback frequency (in samples per second, aka Hz).
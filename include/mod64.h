@@ -0,0 +1,137 @@
+/**
+ * @file mod64.h
+ * @brief Module music player (ProTracker MOD)
+ * @ingroup audio
+ */
+
+#ifndef __LIBDRAGON_MOD64_H
+#define __LIBDRAGON_MOD64_H
+
+#include "mixer.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @brief Maximum number of channels of a module supported by the player */
+#define MOD64_MAX_CHANNELS    8
+
+/** @brief Number of instrument samples in a module */
+#define MOD64_NUM_SAMPLES     31
+
+/** @brief Instrument sample of a module */
+typedef struct {
+	/** @brief #waveform_t used to play back the sample through the mixer */
+	waveform_t wave;
+	/** @brief Signed 8-bit sample data (in RDRAM) */
+	int8_t *data;
+	/** @brief Default volume (0..64) */
+	int volume;
+	/** @brief Finetune, in 1/8th of semitone (-8..7) */
+	int finetune;
+} mod64_sample_t;
+
+/** @brief Playback state of a channel of a module */
+typedef struct {
+	/** @brief Current instrument sample (1-based, 0 if none) */
+	int sample;
+	/** @brief Current Amiga period */
+	int period;
+	/** @brief Current volume (0..64) */
+	int volume;
+	/** @brief Effect and parameter of the current row */
+	int effect, param;
+	/** @brief Target period and speed of the tone portamento */
+	int porta_target, porta_speed;
+	/** @brief Vibrato position, speed and depth */
+	int vib_pos, vib_speed, vib_depth;
+	/** @brief Period offset applied by vibrato in the current tick */
+	int vib_ofs;
+	/** @brief Semitone offset applied by arpeggio in the current tick */
+	int arp_ofs;
+	/** @brief Note (period) delayed to a later tick by effect EDx */
+	int delay_period;
+} mod64_channel_t;
+
+/**
+ * @brief MOD64 structure
+ *
+ * This structure is initialized by #mod64_open to refer to a module (.mod
+ * file, as created by ProTracker and compatible trackers). The whole module
+ * is loaded in RDRAM: instrument samples are played through the mixer as
+ * looping waveforms, while the patterns are processed by a mixer event
+ * (see #mixer_add_event), once per tracker tick. Compared to streaming a
+ * full-length waveform, this uses a few kilobytes of pattern data and
+ * no ROM bandwidth during playback.
+ */
+typedef struct {
+	/** @brief Module file data */
+	uint8_t *data;
+	/** @brief Pattern data */
+	uint8_t *patterns;
+	/** @brief Order table (sequence of patterns) */
+	uint8_t *orders;
+	/** @brief Number of entries in the order table, and restart position */
+	int num_orders, restart;
+	/** @brief Number of channels of the module */
+	int num_channels;
+	/** @brief Instrument samples */
+	mod64_sample_t samples[MOD64_NUM_SAMPLES];
+	/** @brief Playback state of each channel */
+	mod64_channel_t ch[MOD64_MAX_CHANNELS];
+
+	/** @brief First mixer channel used for playback */
+	int first_ch;
+	/** @brief Current position: order, row and tick within the row */
+	int order, row, tick;
+	/** @brief Current speed (ticks per row) and tempo (BPM) */
+	int speed, bpm;
+	/** @brief Pending position jump / pattern break (-1 if none) */
+	int jump_order, jump_row;
+	/** @brief Playback volume (range [0..1]) */
+	float vol;
+	/** @brief True if the module restarts when it reaches the end */
+	bool loop;
+	/** @brief True if the module is currently playing */
+	bool playing;
+} mod64_t;
+
+/**
+ * @brief Open a module from the DragonFS filesystem.
+ *
+ * The whole file is loaded into RDRAM. Both 4-channel (M.K.) and multi-channel
+ * (6CHN, 8CHN, ...) modules are supported, up to #MOD64_MAX_CHANNELS.
+ * Files whose patterns or samples go past their end are rejected with an
+ * assertion, like unsupported formats.
+ *
+ * @param   mod         Pointer to mod64_t structure
+ * @param   fn          Filename of the module (on DragonFS)
+ */
+void mod64_open(mod64_t *mod, const char *fn);
+
+/** @brief Configure whether the module restarts when it reaches the end (default: true) */
+void mod64_set_loop(mod64_t *mod, bool loop);
+
+/** @brief Set the playback volume of the module (range [0..1]) */
+void mod64_set_vol(mod64_t *mod, float vol);
+
+/**
+ * @brief Start playing a module.
+ *
+ * The module uses the mixer channels [first_ch, first_ch + mod->num_channels).
+ * Since all the samples are 8-bit, it is possible to call #mixer_ch_set_limits
+ * on these channels to reduce the memory used by the mixer.
+ *
+ * @param   mod         Pointer to mod64_t structure
+ * @param   first_ch    First mixer channel to use for playback
+ */
+void mod64_play(mod64_t *mod, int first_ch);
+
+/** @brief Stop playing a module */
+void mod64_stop(mod64_t *mod);
+
+/** @brief Return true if the module is currently playing */
+bool mod64_playing(mod64_t *mod);
+
+/** @brief Stop playback (if needed) and release the memory of the module */
+void mod64_close(mod64_t *mod);
+
+#endif
@@ -7,6 +7,7 @@
 #define __LIBDRAGON_N64SYS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <assert.h>
 #include "cop0.h"
 #include "cop1.h"
@@ -210,6 +211,22 @@ void inst_cache_hit_invalidate(volatile void *, unsigned long);
 void inst_cache_index_invalidate(volatile void *, unsigned long);
 void inst_cache_invalidate_all(void);
 
+void *malloc_uncached(size_t size);
+void free_uncached(void *buf);
+
+/** @brief Size of an RDRAM bank (each bank keeps its own page open) */
+#define RDRAM_BANK_SIZE     0x100000
+/** @brief Size of an RDRAM page */
+#define RDRAM_PAGE_SIZE     2048
+/** @brief Let #malloc_video pick the RDRAM bank, packing the buffers together */
+#define RDRAM_BANK_ANY      -1
+/** @brief Let #malloc_video pick the RDRAM bank, spreading the buffers across the banks of the expansion pak */
+#define RDRAM_BANK_SPREAD   -2
+
+void *malloc_video(size_t size, int bank);
+void free_video(void *buf);
+int rdram_get_bank(const void *addr);
+
 int get_memory_size();
 bool is_memory_expanded();
 
@@ -0,0 +1,62 @@
+/**
+ * @file overlay.h
+ * @brief Code and data overlays
+ * @ingroup overlay
+ */
+#ifndef __LIBDRAGON_OVERLAY_H
+#define __LIBDRAGON_OVERLAY_H
+
+#include <stdbool.h>
+
+/**
+ * @addtogroup overlay
+ * @{
+ */
+
+/** @brief Number of overlays supported by the linker script */
+#define OVERLAY_MAX             8
+
+/** @brief Virtual address at which the first overlay is linked */
+#define OVERLAY_BASE_ADDR       0xC0000000
+
+/** @brief Maximum size of an overlay (distance between two consecutive overlays) */
+#define OVERLAY_MAX_SIZE        0x100000
+
+/** @cond */
+#define __OVERLAY_STR(x)        #x
+#define __OVERLAY_SECTION(n, s) __attribute__((section(".overlay" __OVERLAY_STR(n) "." s)))
+/** @endcond */
+
+/**
+ * @brief Place a function in overlay @p n
+ *
+ * The function is marked as long_call, so that code outside the overlay can
+ * call it: calls between main memory and the overlay region cannot use the
+ * jal instruction. Code within the overlay calling functions in main memory
+ * has the same problem, so translation units containing overlay code must be
+ * compiled with -mlong-calls.
+ */
+#define OVERLAY_TEXT(n)         __OVERLAY_SECTION(n, "text") __attribute__((long_call, noinline))
+
+/** @brief Place a read-only variable in overlay @p n */
+#define OVERLAY_RODATA(n)       __OVERLAY_SECTION(n, "rodata")
+
+/** @brief Place an initialized variable in overlay @p n */
+#define OVERLAY_DATA(n)         __OVERLAY_SECTION(n, "data")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int overlay_load( int n );
+void overlay_unload( int n );
+bool overlay_loaded( int n );
+int overlay_size( int n );
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */ /* overlay */
+
+#endif
@@ -0,0 +1,31 @@
+/**
+ * @file overlayfs.h
+ * @brief Filesystem overlays
+ * @ingroup system
+ */
+#ifndef __LIBDRAGON_OVERLAYFS_H
+#define __LIBDRAGON_OVERLAYFS_H
+
+/**
+ * @addtogroup system
+ * @{
+ */
+
+/** @brief Default size of the read cache of each file served by the overlay */
+#define OVERLAYFS_DEFAULT_CACHE_SIZE    (64 * 1024)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int overlayfs_attach( const char * const prefix, const char * const upper_dir, int cache_size );
+int overlayfs_detach( void );
+void overlayfs_invalidate( const char * const name );
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */ /* system */
+
+#endif
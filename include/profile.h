@@ -0,0 +1,159 @@
+/**
+ * @file profile.h
+ * @brief Frame profiler
+ * @ingroup profile
+ */
+#ifndef __LIBDRAGON_PROFILE_H
+#define __LIBDRAGON_PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "display.h"
+
+/**
+ * @addtogroup profile
+ * @{
+ */
+
+/** @brief Maximum number of RSP tasks time-stamped in a frame */
+#define PROFILE_MAX_RSP_TASKS   16
+
+/** @brief Maximum number of CPU scopes (see #PROFILE_SCOPE) recorded in a frame */
+#define PROFILE_MAX_SCOPES      256
+
+/** @brief Magic number at the start of a frame exported by #profile_export ("PRF1") */
+#define PROFILE_EXPORT_MAGIC    0x50524631
+
+/** @brief Magic number at the start of samples exported by #profile_sampling_export ("PRS1") */
+#define PROFILE_SAMPLING_MAGIC  0x50525331
+
+/** @brief An RSP task run during a frame */
+typedef struct
+{
+    /** @brief Start of the task, in CPU ticks since the start of the frame */
+    uint32_t start;
+    /** @brief Duration of the task in CPU ticks */
+    uint32_t ticks;
+} profile_rsp_task_t;
+
+/** @brief A CPU scope run during a frame (see #PROFILE_SCOPE) */
+typedef struct
+{
+    /** @brief Name of the scope (a string literal) */
+    const char *name;
+    /** @brief Start of the scope, in CPU ticks since the start of the frame */
+    uint32_t start;
+    /** @brief Duration of the scope in CPU ticks (0 if it was still open at the end of the frame) */
+    uint32_t ticks;
+    /** @brief Nesting depth of the scope (0 for outermost scopes) */
+    uint32_t depth;
+} profile_scope_t;
+
+/** @brief Profile of a frame (see #profile_next_frame) */
+typedef struct
+{
+    /** @brief Duration of the frame in CPU ticks */
+    uint32_t frame_ticks;
+    /** @brief CPU ticks spent by the RSP running tasks */
+    uint32_t rsp_ticks;
+    /** @brief Number of RSP tasks completed (some might not be time-stamped) */
+    uint32_t num_rsp_tasks;
+    /** @brief Time stamps of the first RSP tasks of the frame */
+    profile_rsp_task_t rsp_tasks[PROFILE_MAX_RSP_TASKS];
+    /** @brief Number of full syncs (see #rdp_sync) completed by the RDP */
+    uint32_t rdp_syncs;
+    /** @brief RCP cycles counted by the RDP clock counter */
+    uint32_t rdp_clock;
+    /** @brief RCP cycles during which the RDP command buffer was busy */
+    uint32_t rdp_buffer_busy;
+    /** @brief RCP cycles during which the RDP pipeline was busy */
+    uint32_t rdp_pipe_busy;
+    /** @brief RCP cycles during which TMEM was busy */
+    uint32_t rdp_tmem_busy;
+    /** @brief Number of samples of the bus monitor (see #profile_bus_start) */
+    uint32_t bus_samples;
+    /** @brief Samples during which the PI was busy (DMA or I/O) */
+    uint32_t pi_busy;
+    /** @brief Samples during which the SI was busy (DMA or I/O) */
+    uint32_t si_busy;
+    /** @brief Samples during which an SP DMA was in progress */
+    uint32_t sp_dma_busy;
+    /** @brief Samples during which the RDP was busy (command buffer or pipeline) */
+    uint32_t rdp_busy;
+    /** @brief Number of CPU scopes recorded (some might have been dropped) */
+    uint32_t num_scopes;
+    /** @brief CPU scopes recorded, in order of start (valid until the next #profile_next_frame) */
+    const profile_scope_t *scopes;
+} profile_frame_t;
+
+/** @brief Convert RCP cycles (62.5 MHz) of #profile_frame_t to CPU ticks */
+#define PROFILE_RCP_TO_TICKS(cycles)   ((uint32_t)(((uint64_t)(cycles) * 3) / 4))
+
+/**
+ * @brief Percentage of a frame during which a bus was busy, from the bus monitor counters
+ *
+ * @param[in] frame
+ *            Statistics of the frame (a #profile_frame_t)
+ * @param[in] field
+ *            Counter of the bus: pi_busy, si_busy, sp_dma_busy or rdp_busy
+ */
+#define PROFILE_BUS_PERCENT(frame, field) \
+    ((frame).bus_samples ? (int)((frame).field * 100 / (frame).bus_samples) : 0)
+
+/**
+ * @brief Profile the rest of the enclosing block as a CPU scope
+ *
+ * Records the ticks at this point and at the end of the enclosing block (however
+ * it is left) in the current frame, under the given name.  Scopes can be nested.
+ * When the profiler is not running this costs a single test; when
+ * PROFILE_DISABLE_SCOPES is defined, it compiles to nothing.
+ *
+ * Scopes must only be used by one thread, and not in interrupt handlers.
+ *
+ * @param[in] name
+ *            Name of the scope: it must be a string literal (only the pointer is stored)
+ */
+#ifndef PROFILE_DISABLE_SCOPES
+#define PROFILE_SCOPE(name) \
+    __PROFILE_SCOPE(name, __LINE__)
+#else
+#define PROFILE_SCOPE(name) do {} while(0)
+#endif
+
+/** @cond */
+#define __PROFILE_SCOPE(name, line)     __PROFILE_SCOPE_(name, line)
+#define __PROFILE_SCOPE_(name, line) \
+    int __profile_scope_##line __attribute__((cleanup(__profile_scope_end))) = __profile_scope_begin(name)
+/** @endcond */
+
+/** @} */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void profile_init( void );
+void profile_close( void );
+void profile_next_frame( profile_frame_t *frame );
+void profile_draw( display_context_t disp, int x, int y, const profile_frame_t *frame );
+int profile_export( const profile_frame_t *frame, void *buf, int size );
+bool profile_export_usb( const profile_frame_t *frame );
+
+bool profile_sampling_start( int rate_hz, int num_buckets );
+void profile_sampling_stop( void );
+void profile_sampling_reset( void );
+uint32_t profile_sampling_count( void );
+int profile_sampling_export( void *buf, int size );
+bool profile_sampling_export_usb( void );
+
+void profile_bus_start( int rate_hz );
+void profile_bus_stop( void );
+
+int __profile_scope_begin( const char *name );
+void __profile_scope_end( int *scope );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
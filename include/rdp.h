@@ -8,6 +8,8 @@
 
 #include "display.h"
 #include "graphics.h"
+#include "rdp_commands.h"
+#include <stdbool.h>
 
 /**
  * @addtogroup rdp
@@ -55,6 +57,203 @@ typedef enum
     FLUSH_STRATEGY_AUTOMATIC
 } flush_t;
 
+/**
+ * @brief Submission strategy for RDP commands
+ */
+typedef enum
+{
+    /** @brief Commands are submitted to the RDP as soon as they are built */
+    SUBMIT_STRATEGY_IMMEDIATE,
+    /** @brief Commands are accumulated and submitted by #rdp_flush */
+    SUBMIT_STRATEGY_DEFERRED
+} submit_t;
+
+/**
+ * @brief A sprite to draw with #rdp_draw_sprite_batch
+ */
+typedef struct
+{
+    /** @brief Sprite to take the texture from */
+    sprite_t *sprite;
+    /** @brief Slice of the sprite to draw (see #rdp_load_texture_stride), or -1 for the whole sprite */
+    int offset;
+    /** @brief Pixel X location of the top left of the sprite */
+    int x;
+    /** @brief Pixel Y location of the top left of the sprite */
+    int y;
+    /** @brief Horizontal scaling factor */
+    float x_scale;
+    /** @brief Vertical scaling factor */
+    float y_scale;
+    /** @brief Whether the texture should be mirrored */
+    mirror_t mirror;
+    /** @brief Drawing layer: sprites in lower layers are drawn first */
+    int layer;
+} rdp_sprite_t;
+
+/** @brief Triangle is shaded with the colors of its vertices */
+#define TRIANGLE_SHADE      0x4
+/** @brief Triangle is textured with the texture coordinates of its vertices */
+#define TRIANGLE_TEXTURE    0x2
+/** @brief Triangle is compared against and written to the Z-buffer */
+#define TRIANGLE_ZBUFFER    0x1
+
+/**
+ * @brief A vertex of a triangle drawn with #rdp_draw_triangle
+ */
+typedef struct
+{
+    /** @brief Pixel X location of the vertex */
+    float x;
+    /** @brief Pixel Y location of the vertex */
+    float y;
+    /** @brief Depth of the vertex (0.0 is nearest, 1.0 is farthest) */
+    float z;
+    /** @brief Texel S coordinate of the vertex, relative to the loaded texture */
+    float s;
+    /** @brief Texel T coordinate of the vertex, relative to the loaded texture */
+    float t;
+    /** @brief Red component of the vertex color (0-255) */
+    float r;
+    /** @brief Green component of the vertex color (0-255) */
+    float g;
+    /** @brief Blue component of the vertex color (0-255) */
+    float b;
+    /** @brief Alpha component of the vertex color (0-255) */
+    float a;
+} rdp_vertex_t;
+
+/** @brief Maximum number of vertices in a batch drawn by #rdp_geom_draw_triangles */
+#define RDP_GEOM_MAX_VERTICES   64
+
+/**
+ * @brief A vertex of a triangle drawn with #rdp_geom_draw_triangles
+ */
+typedef struct
+{
+    /** @brief X coordinate */
+    int16_t x;
+    /** @brief Y coordinate */
+    int16_t y;
+    /** @brief Z coordinate */
+    int16_t z;
+    /** @brief Padding (unused) */
+    int16_t pad;
+} rdp_geom_vertex_t;
+
+/**
+ * @brief A vertex transformed by #rdp_geom_transform_vertices
+ *
+ * The position is in pixels, as s15.16 fixed point numbers split into integer and
+ * fractional parts (see #rdp_geom_tvertex_x and the like).
+ */
+typedef struct
+{
+    /** @brief Integer part of the X screen coordinate */
+    int16_t x_int;
+    /** @brief Integer part of the Y screen coordinate */
+    int16_t y_int;
+    /** @brief Integer part of the Z coordinate (divided by W) */
+    int16_t z_int;
+    /** @brief Clip code: one bit per side of the clipping rectangle (#RDP_GEOM_CLIP_X_MIN and so on) */
+    uint16_t clip;
+    /** @brief Fractional part of the X screen coordinate */
+    uint16_t x_frac;
+    /** @brief Fractional part of the Y screen coordinate */
+    uint16_t y_frac;
+    /** @brief Fractional part of the Z coordinate */
+    uint16_t z_frac;
+    /** @brief Padding (unused) */
+    uint16_t pad;
+} __attribute__((aligned(16))) rdp_geom_tvertex_t;
+
+/** @brief Transformed vertex left of the clipping rectangle */
+#define RDP_GEOM_CLIP_X_MIN     (1 << 0)
+/** @brief Transformed vertex right of the clipping rectangle */
+#define RDP_GEOM_CLIP_X_MAX     (1 << 1)
+/** @brief Transformed vertex above the clipping rectangle */
+#define RDP_GEOM_CLIP_Y_MIN     (1 << 2)
+/** @brief Transformed vertex below the clipping rectangle */
+#define RDP_GEOM_CLIP_Y_MAX     (1 << 3)
+/** @brief Transformed vertex more than 1023 pixels off the origin */
+#define RDP_GEOM_CLIP_GUARD     (1 << 4)
+/** @brief Transformed vertex with W < 1 (its position is meaningless) */
+#define RDP_GEOM_CLIP_NEAR      (1 << 5)
+
+/** @brief X screen coordinate of a transformed vertex, in s15.16 fixed point */
+#define rdp_geom_tvertex_x(v)   ((int32_t)(((uint32_t)(uint16_t)(v)->x_int << 16) | (v)->x_frac))
+/** @brief Y screen coordinate of a transformed vertex, in s15.16 fixed point */
+#define rdp_geom_tvertex_y(v)   ((int32_t)(((uint32_t)(uint16_t)(v)->y_int << 16) | (v)->y_frac))
+/** @brief Z coordinate of a transformed vertex, in s15.16 fixed point */
+#define rdp_geom_tvertex_z(v)   ((int32_t)(((uint32_t)(uint16_t)(v)->z_int << 16) | (v)->z_frac))
+
+/**
+ * @brief An image of a sprite atlas (see #rdp_atlas_load)
+ */
+typedef struct
+{
+    /** @brief Name of the image (its file name without extension) */
+    char name[22];
+    /** @brief Page of the atlas holding the image */
+    uint8_t page;
+    /** @brief Padding (unused) */
+    uint8_t pad;
+    /** @brief Pixel X location of the image in the page */
+    uint16_t x;
+    /** @brief Pixel Y location of the image in the page */
+    uint16_t y;
+    /** @brief Width of the image in pixels */
+    uint16_t width;
+    /** @brief Height of the image in pixels */
+    uint16_t height;
+} rdp_atlas_entry_t;
+
+/**
+ * @brief A sprite atlas created by mkatlas
+ *
+ * An atlas packs many images into pages: 16-bit sprites that fit TMEM.  Drawing
+ * images of the same page one after the other only loads the page once.
+ */
+typedef struct
+{
+    /** @brief Number of pages */
+    uint16_t num_pages;
+    /** @brief Number of images */
+    uint16_t num_entries;
+    /** @brief Images of the atlas */
+    rdp_atlas_entry_t *entries;
+    /** @brief Pages of the atlas */
+    sprite_t **pages;
+} rdp_atlas_t;
+
+/**
+ * @brief Statistics of the TMEM texture cache (see #rdp_texture_cache_get_stats)
+ */
+typedef struct
+{
+    /** @brief Number of textures found already resident in TMEM */
+    uint32_t hits;
+    /** @brief Number of textures that had to be loaded into TMEM */
+    uint32_t misses;
+    /** @brief Number of resident textures evicted to make room for another one */
+    uint32_t evictions;
+} rdp_texture_cache_stats_t;
+
+/**
+ * @brief A display list: RDP commands recorded once to be replayed many times
+ *
+ * See #rdp_display_list_begin.
+ */
+typedef struct
+{
+    /** @brief Buffer holding the commands (8-byte aligned) */
+    uint32_t *commands;
+    /** @brief Size of the buffer in bytes */
+    uint32_t size;
+    /** @brief Size of the recorded commands in bytes */
+    uint32_t length;
+} rdp_display_list_t;
+
 /** @} */
 
 #ifdef __cplusplus
@@ -63,24 +262,57 @@ extern "C" {
 
 void rdp_init( void );
 void rdp_attach_display( display_context_t disp );
+void rdp_attach_zbuffer( void *zbuffer );
 void rdp_detach_display( void );
+display_context_t rdp_get_attached_display( void );
+void rdp_wait_idle( void );
+void rdp_set_dynamic_resolution( uint32_t budget_us, float min_scale );
+void rdp_get_resolution( uint32_t *width, uint32_t *height );
+uint32_t rdp_get_frame_ticks( void );
 void rdp_sync( sync_t sync );
 void rdp_set_clipping( uint32_t tx, uint32_t ty, uint32_t bx, uint32_t by );
 void rdp_set_default_clipping( void );
 void rdp_enable_primitive_fill( void );
 void rdp_enable_blend_fill( void );
 void rdp_enable_texture_copy( void );
+void rdp_enable_palette( bool enable );
 uint32_t rdp_load_texture( uint32_t texslot, uint32_t texloc, mirror_t mirror, sprite_t *sprite );
 uint32_t rdp_load_texture_stride( uint32_t texslot, uint32_t texloc, mirror_t mirror, sprite_t *sprite, int offset );
+uint32_t rdp_texture_cache_load( sprite_t *sprite, int offset, mirror_t mirror );
+void rdp_texture_cache_invalidate( sprite_t *sprite );
+void rdp_texture_cache_get_stats( rdp_texture_cache_stats_t *stats );
 void rdp_draw_textured_rectangle( uint32_t texslot, int tx, int ty, int bx, int by,  mirror_t mirror );
 void rdp_draw_textured_rectangle_scaled( uint32_t texslot, int tx, int ty, int bx, int by, double x_scale, double y_scale,  mirror_t mirror );
 void rdp_draw_sprite( uint32_t texslot, int x, int y ,  mirror_t mirror);
 void rdp_draw_sprite_scaled( uint32_t texslot, int x, int y, double x_scale, double y_scale,  mirror_t mirror);
+void rdp_draw_sprite_batch( const rdp_sprite_t *sprites, int count );
+void rdp_draw_sprite_region( sprite_t *sprite, int sx, int sy, int width, int height, int x, int y );
+rdp_atlas_t *rdp_atlas_load( const char *fn );
+int rdp_atlas_find( const rdp_atlas_t *atlas, const char *name );
+void rdp_draw_atlas_sprite( const rdp_atlas_t *atlas, int index, int x, int y );
+void rdp_atlas_free( rdp_atlas_t *atlas );
+void rdp_enable_text( uint32_t color );
+void rdp_draw_text( int x, int y, const char *text );
 void rdp_set_primitive_color( uint32_t color );
 void rdp_set_blend_color( uint32_t color );
 void rdp_draw_filled_rectangle( int tx, int ty, int bx, int by );
+void rdp_clear( uint32_t color );
 void rdp_draw_filled_triangle( float x1, float y1, float x2, float y2, float x3, float y3 );
+void rdp_enable_triangle_mode( uint32_t flags );
+void rdp_draw_triangle( uint32_t flags, uint32_t texslot, const rdp_vertex_t *v1, const rdp_vertex_t *v2, const rdp_vertex_t *v3 );
+void rdp_geom_set_matrix( const float m[4][4] );
+void rdp_geom_draw_triangles( const rdp_geom_vertex_t *vertices, int num_vertices, const uint16_t *indices, int num_triangles );
+void rdp_geom_transform_vertices( const rdp_geom_vertex_t *vertices, int num_vertices, rdp_geom_tvertex_t *out );
+void rdp_geom_wait( void );
 void rdp_set_texture_flush( flush_t flush );
+void rdp_set_command_buffer( void *buffer, uint32_t size );
+void rdp_set_submit_strategy( submit_t submit );
+void rdp_flush( void );
+void rdp_display_list_begin( rdp_display_list_t *list, void *buffer, uint32_t size );
+uint32_t rdp_display_list_position( void );
+void rdp_display_list_end( void );
+void rdp_display_list_translate( rdp_display_list_t *list, uint32_t start, uint32_t end, int dx, int dy );
+void rdp_display_list_replay( const rdp_display_list_t *list );
 void rdp_close( void );
 
 #ifdef __cplusplus
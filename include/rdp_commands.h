@@ -0,0 +1,274 @@
+/**
+ * @file rdp_commands.h
+ * @brief RDP command builder
+ * @ingroup rdp
+ */
+#ifndef __LIBDRAGON_RDP_COMMANDS_H
+#define __LIBDRAGON_RDP_COMMANDS_H
+
+#include <stdint.h>
+
+/**
+ * @addtogroup rdp
+ * @{
+ *
+ * The macros of this header build RDP commands as 64-bit words.  With constant
+ * arguments they are computed by the compiler, so that a whole render state can
+ * be set up by #rdp_send_raw with a few stores instead of packing the bits at
+ * runtime:
+ *
+ * @code{.c}
+ *     // Textured, Z-buffered triangles modulated by the shade color
+ *     RDP_SEND(
+ *         RDP_CMD_SYNC_PIPE,
+ *         RDP_CMD_SET_COMBINE_1CYCLE( RDP_COMBINE_TEX0, RDP_COMBINE_ZERO, RDP_COMBINE_SHADE, RDP_COMBINE_ZERO,
+ *                                     RDP_COMBINE_TEX0, RDP_COMBINE_ZERO, RDP_COMBINE_SHADE, RDP_COMBINE_ZERO ),
+ *         RDP_CMD_SET_OTHER_MODES( RDP_SOM_CYCLE_1 | RDP_SOM_SAMPLE_BILINEAR | RDP_SOM_Z_COMPARE | RDP_SOM_Z_UPDATE )
+ *     );
+ * @endcode
+ *
+ * In C++, the commands can also be built with the constexpr functions of the rdp
+ * namespace, and sent with the rdp::send template, which only accepts commands
+ * known at compile time.
+ *
+ * These commands bypass the state tracked by the other RDP functions: for instance,
+ * setting other modes does not take into account #rdp_enable_palette, and the functions
+ * that set up their own modes (eg: #rdp_enable_texture_copy) must be called again
+ * after sending raw commands that change them.
+ */
+
+/**
+ * @name Other modes
+ * @brief Flags of #RDP_CMD_SET_OTHER_MODES
+ * @{
+ */
+/** @brief Don't start a primitive before the previous one is written to memory */
+#define RDP_SOM_ATOMIC_PRIM         (1ULL << 55)
+/** @brief One cycle mode */
+#define RDP_SOM_CYCLE_1             (0ULL << 52)
+/** @brief Two cycles mode */
+#define RDP_SOM_CYCLE_2             (1ULL << 52)
+/** @brief Copy mode (texture rectangles copied as they are) */
+#define RDP_SOM_CYCLE_COPY          (2ULL << 52)
+/** @brief Fill mode (rectangles filled with the fill color) */
+#define RDP_SOM_CYCLE_FILL          (3ULL << 52)
+/** @brief Perspective correction of the texture coordinates */
+#define RDP_SOM_TEXTURE_PERSP       (1ULL << 51)
+/** @brief Look up the texels in the palette (TLUT) */
+#define RDP_SOM_TLUT                (1ULL << 47)
+/** @brief Palette of IA 8-8 colors instead of RGBA 5-5-5-1 */
+#define RDP_SOM_TLUT_IA             (1ULL << 46)
+/** @brief Bilinear filtering of the textures */
+#define RDP_SOM_SAMPLE_BILINEAR     (1ULL << 45 | 1ULL << 43 | 1ULL << 42)
+/** @brief Blender equation (P * A + M * B) / (A + B) of the first cycle (see RDP_BLEND_*) */
+#define RDP_SOM_BLEND_CYCLE0(p, a, m, b)    ((uint64_t)((uint32_t)((p) & 3) << 30 | ((a) & 3) << 26 | ((m) & 3) << 22 | ((b) & 3) << 18))
+/** @brief Blender equation (P * A + M * B) / (A + B) of the second cycle (see RDP_BLEND_*) */
+#define RDP_SOM_BLEND_CYCLE1(p, a, m, b)    ((uint64_t)(((p) & 3) << 28 | ((a) & 3) << 24 | ((m) & 3) << 20 | ((b) & 3) << 16))
+/** @brief Blend even the pixels that are fully covered */
+#define RDP_SOM_FORCE_BLEND         (1ULL << 14)
+/** @brief Use the coverage as alpha */
+#define RDP_SOM_ALPHA_CVG_SELECT    (1ULL << 13)
+/** @brief Multiply the coverage by alpha */
+#define RDP_SOM_CVG_TIMES_ALPHA     (1ULL << 12)
+/** @brief Read the color buffer, for the blender */
+#define RDP_SOM_IMAGE_READ          (1ULL << 6)
+/** @brief Write the Z-buffer */
+#define RDP_SOM_Z_UPDATE            (1ULL << 5)
+/** @brief Compare against the Z-buffer */
+#define RDP_SOM_Z_COMPARE           (1ULL << 4)
+/** @brief Antialiasing */
+#define RDP_SOM_ANTIALIAS           (1ULL << 3)
+/** @brief Use the primitive depth instead of the per-pixel one */
+#define RDP_SOM_Z_SOURCE_PRIM       (1ULL << 2)
+/** @brief Discard the pixels whose alpha is 0 */
+#define RDP_SOM_ALPHA_COMPARE       (1ULL << 0)
+/** @} */
+
+/**
+ * @name Blender inputs
+ * @brief Inputs of #RDP_SOM_BLEND_CYCLE0 and #RDP_SOM_BLEND_CYCLE1
+ * @{
+ */
+/** @brief P and M: color of the pixel */
+#define RDP_BLEND_PIXEL             0
+/** @brief P and M: color in memory */
+#define RDP_BLEND_MEMORY            1
+/** @brief P and M: blend color */
+#define RDP_BLEND_BLEND_COLOR       2
+/** @brief P and M: fog color */
+#define RDP_BLEND_FOG_COLOR         3
+/** @brief A: alpha of the pixel */
+#define RDP_BLEND_PIXEL_ALPHA       0
+/** @brief A: alpha of the shade color */
+#define RDP_BLEND_SHADE_ALPHA       2
+/** @brief A and B: zero */
+#define RDP_BLEND_ZERO              3
+/** @brief B: one minus A */
+#define RDP_BLEND_INV_ALPHA         0
+/** @brief B: alpha in memory */
+#define RDP_BLEND_MEMORY_ALPHA      1
+/** @brief B: one */
+#define RDP_BLEND_ONE               2
+/** @} */
+
+/**
+ * @name Combiner inputs
+ * @brief Inputs of the (A - B) * C + D equation of #RDP_CMD_SET_COMBINE
+ *
+ * #RDP_COMBINE_ONE is valid for the A and D inputs of the color, and the A, B and D
+ * inputs of the alpha.  #RDP_COMBINE_COMBINED is valid everywhere but in the C input
+ * of the alpha, where the same value selects the LOD fraction.  The other inputs are
+ * valid everywhere.
+ * @{
+ */
+/** @brief Result of the first cycle (second cycle only); LOD fraction in the C input of the alpha */
+#define RDP_COMBINE_COMBINED        0
+/** @brief Texel of the first tile */
+#define RDP_COMBINE_TEX0            1
+/** @brief Texel of the second tile */
+#define RDP_COMBINE_TEX1            2
+/** @brief Primitive color */
+#define RDP_COMBINE_PRIM            3
+/** @brief Shade color */
+#define RDP_COMBINE_SHADE           4
+/** @brief Environment color */
+#define RDP_COMBINE_ENV             5
+/** @brief One */
+#define RDP_COMBINE_ONE             6
+/** @brief Zero */
+#define RDP_COMBINE_ZERO            0x1F
+/** @} */
+
+/**
+ * @name Commands
+ * @{
+ */
+/** @brief Wait for the primitives to be done before changing the modes */
+#define RDP_CMD_SYNC_PIPE           0xE700000000000000ULL
+/** @brief Wait for the texture loads to be done */
+#define RDP_CMD_SYNC_LOAD           0xE600000000000000ULL
+/** @brief Wait for the tile descriptors to be used */
+#define RDP_CMD_SYNC_TILE           0xE800000000000000ULL
+/** @brief Wait for everything to be written to memory, then raise the DP interrupt */
+#define RDP_CMD_SYNC_FULL           0xE900000000000000ULL
+/** @brief Set the other modes (a combination of RDP_SOM_* flags), without dithering like the other RDP functions */
+#define RDP_CMD_SET_OTHER_MODES(modes)  (0xEF0000FF00000000ULL | (uint64_t)(modes))
+/**
+ * @brief Set the color combiner equation of both cycles
+ *
+ * The inputs are the RDP_COMBINE_* values: (A - B) * C + D for the color and
+ * the alpha of the first cycle, then for the color and the alpha of the second one.
+ */
+#define RDP_CMD_SET_COMBINE(a0, b0, c0, d0, aa0, ba0, ca0, da0, a1, b1, c1, d1, aa1, ba1, ca1, da1) \
+    (0xFC00000000000000ULL | \
+     (uint64_t)(((a0) & 0xF) << 20 | ((c0) & 0x1F) << 15 | ((aa0) & 7) << 12 | ((ca0) & 7) << 9 | ((a1) & 0xF) << 5 | ((c1) & 0x1F)) << 32 | \
+     (uint64_t)((uint32_t)((b0) & 0xF) << 28 | ((b1) & 0xF) << 24 | ((aa1) & 7) << 21 | ((ca1) & 7) << 18 | ((d0) & 7) << 15 | \
+                ((ba0) & 7) << 12 | ((da0) & 7) << 9 | ((d1) & 7) << 6 | ((ba1) & 7) << 3 | ((da1) & 7)))
+/** @brief Set the same color combiner equation for both cycles (see #RDP_CMD_SET_COMBINE) */
+#define RDP_CMD_SET_COMBINE_1CYCLE(a, b, c, d, aa, ba, ca, da) \
+    RDP_CMD_SET_COMBINE(a, b, c, d, aa, ba, ca, da, a, b, c, d, aa, ba, ca, da)
+/** @brief Set the fill color (the color set by #rdp_set_primitive_color) */
+#define RDP_CMD_SET_FILL_COLOR(color)   (0xF700000000000000ULL | (uint32_t)(color))
+/** @brief Set the fog color (RGBA 8-8-8-8) */
+#define RDP_CMD_SET_FOG_COLOR(color)    (0xF800000000000000ULL | (uint32_t)(color))
+/** @brief Set the blend color (RGBA 8-8-8-8) */
+#define RDP_CMD_SET_BLEND_COLOR(color)  (0xF900000000000000ULL | (uint32_t)(color))
+/** @brief Set the primitive color of the combiner (RGBA 8-8-8-8) */
+#define RDP_CMD_SET_PRIM_COLOR(color)   (0xFA00000000000000ULL | (uint32_t)(color))
+/** @brief Set the environment color of the combiner (RGBA 8-8-8-8) */
+#define RDP_CMD_SET_ENV_COLOR(color)    (0xFB00000000000000ULL | (uint32_t)(color))
+/** @brief Set the clipping rectangle, in pixels (see #rdp_set_clipping) */
+#define RDP_CMD_SET_SCISSOR(tx, ty, bx, by) \
+    (0xED00000000000000ULL | (uint64_t)(((tx) & 0x3FF) << 14 | ((ty) & 0x3FF) << 2) << 32 | (uint32_t)(((bx) & 0x3FF) << 14 | ((by) & 0x3FF) << 2))
+/** @brief Fill a rectangle, in pixels (see #rdp_draw_filled_rectangle) */
+#define RDP_CMD_FILL_RECTANGLE(tx, ty, bx, by) \
+    (0xF600000000000000ULL | (uint64_t)(((bx) & 0x3FF) << 14 | ((by) & 0x3FF) << 2) << 32 | (uint32_t)(((tx) & 0x3FF) << 14 | ((ty) & 0x3FF) << 2))
+/** @} */
+
+/**
+ * @brief Send RDP commands known at compile time
+ *
+ * The commands are stored in a constant array, so the compiler refuses arguments
+ * that are not constant.
+ */
+#define RDP_SEND(...) ({ \
+    static const uint64_t __rdp_commands[] = { __VA_ARGS__ }; \
+    rdp_send_raw( __rdp_commands, sizeof(__rdp_commands) / sizeof(uint64_t) ); \
+})
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void rdp_send_raw( const uint64_t *commands, int count );
+
+#ifdef __cplusplus
+}
+
+namespace rdp
+{
+    /** @brief Set the other modes (see #RDP_CMD_SET_OTHER_MODES) */
+    constexpr uint64_t set_other_modes( uint64_t modes ) { return RDP_CMD_SET_OTHER_MODES( modes ); }
+
+    /** @brief Set the color combiner equation of both cycles (see #RDP_CMD_SET_COMBINE) */
+    constexpr uint64_t set_combine( uint32_t a0, uint32_t b0, uint32_t c0, uint32_t d0,
+                                    uint32_t aa0, uint32_t ba0, uint32_t ca0, uint32_t da0,
+                                    uint32_t a1, uint32_t b1, uint32_t c1, uint32_t d1,
+                                    uint32_t aa1, uint32_t ba1, uint32_t ca1, uint32_t da1 )
+    {
+        return RDP_CMD_SET_COMBINE( a0, b0, c0, d0, aa0, ba0, ca0, da0, a1, b1, c1, d1, aa1, ba1, ca1, da1 );
+    }
+
+    /** @brief Set the same color combiner equation for both cycles (see #RDP_CMD_SET_COMBINE_1CYCLE) */
+    constexpr uint64_t set_combine( uint32_t a, uint32_t b, uint32_t c, uint32_t d,
+                                    uint32_t aa, uint32_t ba, uint32_t ca, uint32_t da )
+    {
+        return RDP_CMD_SET_COMBINE_1CYCLE( a, b, c, d, aa, ba, ca, da );
+    }
+
+    /** @brief Set the fill color (see #RDP_CMD_SET_FILL_COLOR) */
+    constexpr uint64_t set_fill_color( uint32_t color ) { return RDP_CMD_SET_FILL_COLOR( color ); }
+    /** @brief Set the fog color (see #RDP_CMD_SET_FOG_COLOR) */
+    constexpr uint64_t set_fog_color( uint32_t color ) { return RDP_CMD_SET_FOG_COLOR( color ); }
+    /** @brief Set the blend color (see #RDP_CMD_SET_BLEND_COLOR) */
+    constexpr uint64_t set_blend_color( uint32_t color ) { return RDP_CMD_SET_BLEND_COLOR( color ); }
+    /** @brief Set the primitive color (see #RDP_CMD_SET_PRIM_COLOR) */
+    constexpr uint64_t set_prim_color( uint32_t color ) { return RDP_CMD_SET_PRIM_COLOR( color ); }
+    /** @brief Set the environment color (see #RDP_CMD_SET_ENV_COLOR) */
+    constexpr uint64_t set_env_color( uint32_t color ) { return RDP_CMD_SET_ENV_COLOR( color ); }
+
+    /** @brief Set the clipping rectangle (see #RDP_CMD_SET_SCISSOR) */
+    constexpr uint64_t set_scissor( uint32_t tx, uint32_t ty, uint32_t bx, uint32_t by )
+    {
+        return RDP_CMD_SET_SCISSOR( tx, ty, bx, by );
+    }
+
+    /** @brief Fill a rectangle (see #RDP_CMD_FILL_RECTANGLE) */
+    constexpr uint64_t fill_rectangle( uint32_t tx, uint32_t ty, uint32_t bx, uint32_t by )
+    {
+        return RDP_CMD_FILL_RECTANGLE( tx, ty, bx, by );
+    }
+
+    /**
+     * @brief Send RDP commands computed at compile time
+     *
+     * The commands are template arguments, so they are computed by the compiler
+     * even when built with the constexpr functions above:
+     *
+     * @code{.cpp}
+     *     rdp::send<RDP_CMD_SYNC_PIPE, rdp::set_other_modes( RDP_SOM_CYCLE_FILL ), rdp::set_fill_color( 0 )>();
+     * @endcode
+     */
+    template<uint64_t... Commands>
+    inline void send( void )
+    {
+        static_assert( sizeof...(Commands) > 0, "no RDP commands to send" );
+        static constexpr uint64_t commands[] = { Commands... };
+        rdp_send_raw( commands, sizeof...(Commands) );
+    }
+}
+#endif
+
+/** @} */ /* rdp */
+
+#endif
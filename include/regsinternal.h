@@ -119,7 +119,18 @@ typedef struct PI_regs_s {
     uint32_t dom1_latency;
     /** @brief Cartridge domain 1 pulse width in RCP clock cycles. Requires DMA status bit guards to work reliably */
     uint32_t dom1_pulse_width;
-    // TODO: add remaining registers
+    /** @brief Cartridge domain 1 page size */
+    uint32_t dom1_page_size;
+    /** @brief Cartridge domain 1 release duration */
+    uint32_t dom1_release;
+    /** @brief Cartridge domain 2 (SRAM and FlashRAM) latency in RCP clock cycles */
+    uint32_t dom2_latency;
+    /** @brief Cartridge domain 2 pulse width in RCP clock cycles */
+    uint32_t dom2_pulse_width;
+    /** @brief Cartridge domain 2 page size */
+    uint32_t dom2_page_size;
+    /** @brief Cartridge domain 2 release duration */
+    uint32_t dom2_release;
 } PI_regs_t;
 
 /** 
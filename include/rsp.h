@@ -6,6 +6,9 @@
 #ifndef __LIBDRAGON_RSP_H
 #define __LIBDRAGON_RSP_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -95,6 +98,57 @@ typedef struct {
         .name = #ucode_name, .start_pc = 0, \
     }
 
+/** @brief A task to run on the RSP, see #rsp_task_submit. */
+typedef struct rsp_task_s rsp_task_t;
+
+/**
+ * @brief Callback of a RSP task.
+ *
+ * Task callbacks are invoked from within the SP interrupt handler (or from
+ * #rsp_task_submit / #rsp_task_wait if the RSP is idle), so they should be
+ * short and must not block.  The setup and done callbacks run while the queue
+ * is being advanced, so they must not submit or wait for tasks: use the notify
+ * callback to chain more work to a task.
+ */
+typedef void (*rsp_task_callback_t)(rsp_task_t *task);
+
+/**
+ * @brief RSP task.
+ *
+ * A task is a run of a ucode. Tasks are submitted to a queue with
+ * #rsp_task_submit, and executed one at a time in submission order. This
+ * allows different modules (eg: audio and graphics) to share the RSP without
+ * knowing about each other.
+ *
+ * Fill the public fields before submitting the task. The structure must stay
+ * valid until the task is complete.
+ */
+struct rsp_task_s {
+    /** @brief Ucode to run. It is loaded only if not already resident. */
+    rsp_ucode_t *ucode;
+    /** @brief Called right before starting the RSP, with the ucode loaded:
+     *  use it to fill DMEM with the task input (optional). */
+    rsp_task_callback_t setup;
+    /** @brief Called after the RSP has halted: use it to read back the output
+     *  from DMEM (optional). */
+    rsp_task_callback_t done;
+    /** @brief Called once the task is complete, after the queue has been
+     *  advanced (optional). Unlike done, it may submit new tasks, including
+     *  this one again; #rsp_task_wait polls the RSP, so it can also wait for them. */
+    rsp_task_callback_t notify;
+    /** @brief Opaque pointer for the callbacks */
+    void *ctx;
+    /** @brief RSP ticks spent running the task (valid once complete) */
+    uint32_t rsp_ticks;
+    /** @brief True when the task is complete */
+    volatile bool complete;
+
+    /** @brief Tick when the task was started (private) */
+    uint32_t start_tick;
+    /** @brief Next task in the queue (private) */
+    rsp_task_t *next;
+};
+
 /** @brief Initialize the RSP subsytem. */
 void rsp_init(void);
 
@@ -108,6 +162,8 @@ void rsp_init(void);
  * ucode passed is the same, it does nothing. This makes it easier to write
  * code that optimistically switches between different ucodes, but without
  * forcing transfers every time.
+ *
+ * Tasks submitted via #rsp_task_submit are completed before loading.
  * 
  * @param[in]     ucode       Ucode to load into RSP
  **/
@@ -116,6 +172,7 @@ void rsp_load(rsp_ucode_t *ucode);
 /** @brief Run RSP ucode.
  * 
  * This function starts running the RSP, and wait until the ucode is finished.
+ * Tasks submitted via #rsp_task_submit are completed first.
  */
 void rsp_run(void);
 
@@ -126,9 +183,29 @@ void rsp_run(void);
  */
 void rsp_run_async(void);
 
-/** @brief Wait until RSP has finished processing. */
+/** @brief Wait until RSP has finished processing, yielding to other threads
+ *  (see #thread_yield). */
 void rsp_wait(void);
 
+/** @brief Submit a task to the RSP queue.
+ *
+ * The task is started right away if the RSP is idle, otherwise as soon as
+ * the previous tasks are complete. Its ucode is loaded only if a different
+ * ucode is resident in IMEM.
+ *
+ * @param[in]     task          Task to run (see #rsp_task_t)
+ */
+void rsp_task_submit(rsp_task_t *task);
+
+/** @brief Wait until a task submitted via #rsp_task_submit is complete. */
+void rsp_task_wait(rsp_task_t *task);
+
+/** @brief Wait until all the tasks submitted via #rsp_task_submit are complete. */
+void rsp_task_wait_all(void);
+
+/** @brief Return the number of tasks submitted and not yet complete. */
+int rsp_task_pending(void);
+
 /** @brief Do a DMA transfer to load a piece of code into RSP IMEM.
  * 
  * This is a lower-level function that actually executes a DMA transfer
@@ -182,6 +259,101 @@ void rsp_read_code(void* code, unsigned long size, unsigned int imem_offset);
  */
 void rsp_read_data(void* data, unsigned long size, unsigned int dmem_offset);
 
+/** @brief Queue a DMA transfer to load a piece of code into RSP IMEM.
+ *
+ * Same as #rsp_load_code, but the transfer is queued and the function returns
+ * right away. Transfers are executed in the order they are queued, by all the
+ * rsp_*_async functions and their synchronous versions: several of them can be
+ * queued to upload scattered pieces of code and data, while the CPU does other
+ * work. The RDRAM buffer must not be changed until the transfer is complete
+ * (see #rsp_dma_wait).
+ *
+ * Transfers must be queued only while the RSP is halted, as they share the
+ * DMA engine with the RSP. #rsp_run and the task queue wait for the pending
+ * transfers before starting the RSP.
+ *
+ * @param[in]     code          Pointer to buffer in RDRAM containing code.
+ *                              Must be aligned to 8 bytes.
+ * @param[in]     size          Size of the code to load. Must be a multiple of 8.
+ * @param[in]     imem_offset   Byte offset in IMEM where to load the code.
+ *                              Must be a multiple of 8.
+ *
+ * @return A fence to pass to #rsp_dma_done or #rsp_dma_wait.
+ */
+uint32_t rsp_load_code_async(void* code, unsigned long size, unsigned int imem_offset);
+
+/** @brief Queue a DMA transfer to load a piece of data into RSP DMEM.
+ *
+ * Same as #rsp_load_data, but asynchronous (see #rsp_load_code_async).
+ *
+ * @return A fence to pass to #rsp_dma_done or #rsp_dma_wait.
+ */
+uint32_t rsp_load_data_async(void* data, unsigned long size, unsigned int dmem_offset);
+
+/** @brief Queue a DMA transfer to read a piece of code from RSP IMEM to RDRAM.
+ *
+ * Same as #rsp_read_code, but asynchronous (see #rsp_load_code_async). The
+ * buffer is invalidated from the data cache when the transfer is queued: do
+ * not access it until the transfer is complete.
+ *
+ * @return A fence to pass to #rsp_dma_done or #rsp_dma_wait.
+ */
+uint32_t rsp_read_code_async(void* code, unsigned long size, unsigned int imem_offset);
+
+/** @brief Queue a DMA transfer to read a piece of data from RSP DMEM to RDRAM.
+ *
+ * Same as #rsp_read_data, but asynchronous (see #rsp_read_code_async).
+ *
+ * @return A fence to pass to #rsp_dma_done or #rsp_dma_wait.
+ */
+uint32_t rsp_read_data_async(void* data, unsigned long size, unsigned int dmem_offset);
+
+/** @brief Queue the load of a RSP ucode.
+ *
+ * Same as #rsp_load, but the code and data segments are queued as asynchronous
+ * transfers (see #rsp_load_code_async). Additional data can be queued right
+ * after with #rsp_load_data_async: #rsp_run_async waits for all of them.
+ *
+ * @param[in]     ucode       Ucode to load into RSP
+ *
+ * @return A fence to pass to #rsp_dma_done or #rsp_dma_wait.
+ **/
+uint32_t rsp_load_async(rsp_ucode_t *ucode);
+
+/** @brief Return true if the SP DMA transfer with the given fence (and all the
+ *  ones queued before it) is complete. */
+bool rsp_dma_done(uint32_t fence);
+
+/** @brief Wait until the SP DMA transfer with the given fence (and all the ones
+ *  queued before it) is complete. */
+void rsp_dma_wait(uint32_t fence);
+
+/**
+ * @brief Define one RSP ucode overlay compiled via libdragon's build system (n64.mk).
+ *
+ * An overlay is a piece of code that a resident "kernel" ucode loads into IMEM
+ * by itself, so that the whole ucode can be larger than IMEM. It is written in
+ * a rsp_*.S file starting with RSP_OVERLAY_BEGIN (see rsp_overlay.inc), and
+ * registered into its kernel with #rsp_ucode_set_overlays.
+ */
+#define DEFINE_RSP_OVERLAY(ovl_name)   DEFINE_RSP_UCODE(ovl_name)
+
+/**
+ * @brief Register the overlays of a kernel ucode.
+ *
+ * This function fills the overlay table of the kernel (RSP_OVERLAY_TABLE, at the
+ * start of its data segment) with the RDRAM address and size of each overlay.
+ * The kernel can then load overlay i with RSPOverlayLoad / RSPOverlayCall.
+ * It must be called before the kernel is loaded: if the kernel is currently
+ * resident, it will be loaded again by the next #rsp_load.
+ *
+ * @param[in]     kernel        Kernel ucode
+ * @param[in]     overlays      Array of overlays, defined with #DEFINE_RSP_OVERLAY
+ * @param[in]     num_overlays  Number of overlays (at most the capacity declared
+ *                              with RSP_OVERLAY_TABLE)
+ */
+void rsp_ucode_set_overlays(rsp_ucode_t *kernel, rsp_ucode_t * const *overlays, int num_overlays);
+
 static inline __attribute__((deprecated("use rsp_load_code instead")))
 void load_ucode(void * start, unsigned long size) {
     rsp_load_code(start, size, 0);
@@ -45,6 +45,8 @@ bool rtc_is_writable( void );
 bool rtc_get( rtc_time_t * rtc_time );
 bool rtc_set( rtc_time_t * rtc_time );
 void rtc_normalize_time( rtc_time_t * rtc_time );
+bool rtc_enable_background_refresh( int period_ms );
+void rtc_disable_background_refresh( void );
 
 #ifdef __cplusplus
 }
@@ -56,13 +56,14 @@ typedef uint32_t sample_ptr_t;
  * so that they become available for the mixer. The decoder can be configured
  * with samplebuffer_set_decoder.
  *
- * The current implementation of samplebuffer does not achieve full zero copy,
- * because when the buffer is full, it is flushed and samples that need to 
- * be preserved (that is, already in the buffer but not yet played back) are
- * copied back at the beginning of the buffer with the CPU. This limitation
- * exists because the RSP ucode (rsp_audio.S) isn't currently able to "wrap around"
- * in the sample buffer. In future, this limitation could be lifted to achieve
- * full zero copy.
+ * By default, when the buffer is full, samples that need to be preserved
+ * (that is, already in the buffer but not yet played back) are copied back at
+ * the beginning of the buffer with the CPU, so that the samples are always
+ * stored contiguously. In ring mode (see #samplebuffer_set_ring), the buffer
+ * instead wraps around: new samples are appended at the start of the buffer
+ * while older ones are still being played back at its end, and nothing is
+ * ever moved. The RSP ucode follows the wrap point as if it was a waveform
+ * loop (see #samplebuffer_get_wrap).
  *
  * The sample buffer tries to always stay 8-byte aligned to simplify operations
  * of decoders that might need to use DMA transfers (either PI DMA or RSP DMA).
@@ -92,26 +93,56 @@ typedef struct samplebuffer_s {
 
     /**
      * Absolute position in the waveform of the first sample
-     * in the sample buffer (the sample at index 0). It keeps track of
+     * in the sample buffer (the sample at index head). It keeps track of
      * which part of the waveform this sample buffer contains.
      */
     int wpos;
 
     /**
-     * Write pointer in the sample buffer (expressed as index of samples).
-     * Since sample buffers are always filled from index 0, it is also
-     * the number of samples stored in the buffer.
+     * Write pointer in the sample buffer (expressed as index of samples,
+     * relative to head). It is also the number of samples stored in
+     * the buffer.
      */
     int widx;
 
     /**
-     * Read pointer in the sample buffer (expressed as index of samples).
-     * It remembers which sample was last read. Assuming a forward
+     * Read pointer in the sample buffer (expressed as index of samples,
+     * relative to head). It remembers which sample was last read. Assuming a forward
      * streaming, it is used by the sample buffer to discard unused samples
      * when not needed anymore.
      */
     int ridx;
 
+    /**
+     * Index in the buffer of the sample at wpos. This is always 0 (or 1, to
+     * preserve the 2-byte phase of 8-bit waveforms) unless in ring mode.
+     */
+    int head;
+
+    /**
+     * In ring mode, index of the first sample past the end of the
+     * buffer contents (0 if the contents do not wrap around). The samples
+     * following it are stored starting from index (wrap - wrap_jump).
+     */
+    int wrap;
+
+    /**
+     * In ring mode, distance (in samples) between the position of a sample
+     * after the wrap and its actual index in the buffer.
+     */
+    int wrap_jump;
+
+    /**
+     * In ring mode, number of bytes after the wrap point that have been
+     * mirrored past the end of the samples before it, for the RSP overread.
+     */
+    int mirrored;
+
+    /**
+     * True if ring mode is enabled (see #samplebuffer_set_ring).
+     */
+    bool ring;
+
     /*/
      * wv_read is invoked by samplebuffer_get whenever more samples are
      * requested by the mixer. See WaveformRead for more information.
@@ -152,6 +183,28 @@ void samplebuffer_init(samplebuffer_t *buf, uint8_t *mem, int size);
  */
 void samplebuffer_set_bps(samplebuffer_t *buf, int bps);
 
+/**
+ * @brief Enable or disable ring mode.
+ *
+ * In ring mode, the sample buffer never compacts its contents: when there
+ * is no space left at the end of the buffer, new samples are appended at
+ * its start, before the older samples that are still needed for playback.
+ * Readers must then follow the wrap point as reported by
+ * #samplebuffer_get_wrap.
+ *
+ * Since the RSP ucode reads up to #MIXER_LOOP_OVERREAD bytes past the
+ * current position, the first samples after the wrap point are also
+ * mirrored after the samples that come before it. The memory buffer must
+ * thus have #MIXER_LOOP_OVERREAD bytes of padding after its end (not
+ * accounted in the size passed to #samplebuffer_init).
+ *
+ * Ring mode can only be changed while the buffer is empty.
+ *
+ * @param[in]   buf     Sample buffer
+ * @param[in]   ring    True to enable ring mode, false to disable it.
+ */
+void samplebuffer_set_ring(samplebuffer_t *buf, bool ring);
+
 /**
  * Connect a waveform reader callback to this sample buffer. The waveform
  * will be use to produce samples whenever they are required by the mixer
@@ -199,6 +252,25 @@ void samplebuffer_set_waveform(samplebuffer_t *buf, WaveformRead read, void *ctx
  */
 void* samplebuffer_get(samplebuffer_t *buf, int wpos, int *wlen);
 
+/**
+ * @brief Check if the samples following a position wrap around (ring mode).
+ *
+ * In ring mode, the samples returned by #samplebuffer_get are only
+ * contiguous up to the wrap point. The function returns the absolute waveform
+ * position of the wrap point, that is the first sample which is not stored
+ * right after the previous one. "jump" is set to the distance (in samples)
+ * by which the pointer must be moved back to read from that position onward.
+ *
+ * @param[in]   buf     Sample buffer
+ * @param[in]   wpos    Absolute waveform position of the first sample
+ *                      that will be read (as passed to #samplebuffer_get).
+ * @param[out]  jump    Distance between the wrap point and the actual
+ *                      location of its sample in the buffer.
+ * @return              Absolute waveform position of the wrap point, or -1
+ *                      if the samples from wpos onward are contiguous.
+ */
+int samplebuffer_get_wrap(samplebuffer_t *buf, int wpos, int *jump);
+
 /**
  * @brief Append samples into the buffer (zero-copy). 
  *
@@ -0,0 +1,83 @@
+/**
+ * @file save.h
+ * @brief Cartridge save memory
+ * @ingroup save
+ */
+#ifndef __LIBDRAGON_SAVE_H
+#define __LIBDRAGON_SAVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @addtogroup save
+ * @{
+ */
+
+/**
+ * @name Save memory return values
+ * @{
+ */
+/** @brief Success */
+#define SAVE_ESUCCESS    0
+/** @brief Input parameters invalid (out of range or misaligned) */
+#define SAVE_EBADINPUT   -1
+/** @brief The save memory is not present, or not initialized */
+#define SAVE_ENODEVICE   -2
+/** @brief An asynchronous operation is still in progress */
+#define SAVE_EBUSY       -3
+/** @brief The save memory did not complete an operation */
+#define SAVE_EIO         -4
+/** @brief No memory for operation */
+#define SAVE_ENOMEM      -5
+/** @} */
+
+/** @brief Size of a FlashRAM page, the unit of programming */
+#define FLASHRAM_PAGE_SIZE      128
+/** @brief Size of a FlashRAM sector, the unit of erasing */
+#define FLASHRAM_SECTOR_SIZE    (16 * 1024)
+
+/**
+ * @brief Cartridge save memory types
+ *
+ * Sizes are in kilobits, as for #eeprom_type_t.
+ */
+typedef enum
+{
+    /** @brief No save memory */
+    SAVE_TYPE_NONE = 0,
+    /** @brief 4 kilobit (512 bytes) EEPROM, on the joybus */
+    SAVE_TYPE_EEPROM_4K,
+    /** @brief 16 kilobit (2 KiB) EEPROM, on the joybus */
+    SAVE_TYPE_EEPROM_16K,
+    /** @brief 256 kilobit (32 KiB) SRAM, on the PI */
+    SAVE_TYPE_SRAM_256K,
+    /** @brief 768 kilobit (96 KiB) SRAM in three banks, on the PI */
+    SAVE_TYPE_SRAM_768K,
+    /** @brief 1 megabit (128 KiB) FlashRAM, on the PI */
+    SAVE_TYPE_FLASHRAM_1M,
+} save_type_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int save_init( save_type_t type );
+save_type_t save_type( void );
+size_t save_size( void );
+
+int save_read( void * dest, size_t offset, size_t len );
+int save_write( const void * src, size_t offset, size_t len );
+
+int save_read_async( void * dest, size_t offset, size_t len );
+int save_write_async( const void * src, size_t offset, size_t len );
+int save_poll( void );
+int save_wait( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */ /* save */
+
+#endif
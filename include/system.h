@@ -22,6 +22,109 @@ extern "C" {
 
 #include <dir.h>
 #include <sys/stat.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @brief Default alignment of arena and pool allocations */
+#define ARENA_ALIGN         8
+
+/**
+ * @brief Heap statistics
+ * @see #sys_get_heap_stats
+ */
+typedef struct
+{
+    /** @brief Size of the heap, from the end of the program to the stack */
+    size_t total;
+    /** @brief Bytes of the heap handed to malloc so far */
+    size_t reserved;
+    /** @brief Highest amount of bytes handed to malloc at any time */
+    size_t high_water;
+    /** @brief Bytes currently allocated by malloc */
+    size_t used;
+    /** @brief Bytes still available for allocation */
+    size_t free;
+} heap_stats_t;
+
+/**
+ * @brief Subsystems the memory is accounted to
+ * @see #malloc_tagged
+ */
+typedef enum
+{
+    /** @brief Application memory (and allocations without a tag) */
+    MEM_TAG_USER = 0,
+    /** @brief Framebuffers allocated by #display_init */
+    MEM_TAG_DISPLAY,
+    /** @brief Output buffers allocated by #audio_init */
+    MEM_TAG_AUDIO,
+    /** @brief Channel sample buffers and resident waveforms of the mixer */
+    MEM_TAG_MIXER,
+    /** @brief Render buffer of the console */
+    MEM_TAG_CONSOLE,
+    /** @brief Number of tags */
+    MEM_TAG_COUNT
+} mem_tag_t;
+
+/**
+ * @brief Memory accounted to a tag
+ * @see #sys_get_mem_tag_stats
+ */
+typedef struct
+{
+    /** @brief Bytes currently allocated */
+    size_t live;
+    /** @brief Highest value of @c live so far */
+    size_t peak;
+    /** @brief Number of allocations currently alive */
+    int count;
+} mem_tag_stats_t;
+
+/**
+ * @brief Word the unused stack is filled with by #sys_stack_paint
+ */
+#define STACK_PAINT_PATTERN     0x57ACC0DE
+
+/**
+ * @brief Bump allocator
+ * @see #arena_init
+ */
+typedef struct
+{
+    /** @brief Memory of the arena */
+    uint8_t *base;
+    /** @brief Size of the arena in bytes */
+    size_t size;
+    /** @brief Bytes allocated since the last reset */
+    size_t used;
+    /** @brief Highest value of @c used so far */
+    size_t high_water;
+    /** @brief Whether the memory was allocated by #arena_init */
+    bool owned;
+} arena_t;
+
+/**
+ * @brief Pool of fixed-size objects
+ * @see #pool_init
+ */
+typedef struct
+{
+    /** @brief Memory of the pool */
+    uint8_t *base;
+    /** @brief List of the free objects */
+    void *free_list;
+    /** @brief Size of each object, rounded up to #ARENA_ALIGN */
+    size_t object_size;
+    /** @brief Number of objects */
+    int count;
+    /** @brief Number of objects in use */
+    int used;
+    /** @brief Highest value of @c used so far */
+    int high_water;
+    /** @brief Whether the memory was allocated by #pool_init */
+    bool owned;
+} pool_t;
 
 /**
  * @brief Filesystem hook structure
@@ -184,6 +287,7 @@ typedef struct
 
 int attach_filesystem( const char * const prefix, filesystem_t *filesystem );
 int detach_filesystem( const char * const prefix );
+filesystem_t *get_filesystem( const char * const prefix );
 
 int hook_stdio_calls( stdio_t *stdio_calls );
 int unhook_stdio_calls( stdio_t *stdio_calls );
@@ -191,6 +295,30 @@ int unhook_stdio_calls( stdio_t *stdio_calls );
 int hook_time_call( time_t (*time_fn)( void ) );
 int unhook_time_call( time_t (*time_fn)( void ) );
 
+void sys_get_heap_stats( heap_stats_t *stats );
+void *sbrk_top( int incr );
+
+void *malloc_tagged( mem_tag_t tag, size_t size );
+void *memalign_tagged( mem_tag_t tag, size_t align, size_t size );
+void free_tagged( mem_tag_t tag, void *ptr );
+void sys_mem_tag_alloc( mem_tag_t tag, size_t size );
+void sys_mem_tag_free( mem_tag_t tag, size_t size );
+void sys_get_mem_tag_stats( mem_tag_t tag, mem_tag_stats_t *stats );
+
+void sys_stack_paint( void );
+size_t sys_get_stack_high_water( void );
+
+int arena_init( arena_t *arena, void *buffer, size_t size );
+void *arena_alloc( arena_t *arena, size_t size );
+void *arena_alloc_aligned( arena_t *arena, size_t size, size_t align );
+void arena_reset( arena_t *arena );
+void arena_close( arena_t *arena );
+
+int pool_init( pool_t *pool, void *buffer, size_t object_size, int count );
+void *pool_alloc( pool_t *pool );
+void pool_free( pool_t *pool, void *ptr );
+void pool_close( pool_t *pool );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,101 @@
+/**
+ * @file thread.h
+ * @brief Threads
+ * @ingroup thread
+ */
+#ifndef __LIBDRAGON_THREAD_H
+#define __LIBDRAGON_THREAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @addtogroup thread
+ * @{
+ */
+
+/** @brief A thread, see #thread_create */
+typedef struct thread_s thread_t;
+
+/** @brief Entry point of a thread */
+typedef void (*thread_entry_t)(void *arg);
+
+/** @brief Interrupts a thread can wait for with #thread_wait_event */
+typedef enum
+{
+    /** @brief RSP interrupt */
+    THREAD_EVENT_SP,
+    /** @brief Serial interface interrupt */
+    THREAD_EVENT_SI,
+    /** @brief Audio interface interrupt */
+    THREAD_EVENT_AI,
+    /** @brief Video interface interrupt */
+    THREAD_EVENT_VI,
+    /** @brief Peripheral interface interrupt */
+    THREAD_EVENT_PI,
+    /** @brief RDP interrupt */
+    THREAD_EVENT_DP,
+    /** @brief Number of events */
+    THREAD_NUM_EVENTS
+} thread_event_t;
+
+/** @brief Default size of the stack of a thread in bytes */
+#define THREAD_DEFAULT_STACK_SIZE   (16 * 1024)
+
+/** @brief Default priority of a thread, see #thread_set_priority */
+#define THREAD_PRIORITY_NORMAL      0
+
+/** @brief A mutex, see #mutex_init */
+typedef struct
+{
+    /** @brief Thread that locked the mutex (NULL if unlocked) */
+    thread_t *owner;
+    /** @brief Threads waiting for the mutex, by decreasing priority */
+    thread_t *waiters;
+} mutex_t;
+
+/** @brief A counting semaphore, see #semaphore_init */
+typedef struct
+{
+    /** @brief Current count */
+    int count;
+    /** @brief Threads waiting for the count to be positive, by decreasing priority */
+    thread_t *waiters;
+} semaphore_t;
+
+/** @} */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void thread_init( void );
+void thread_close( void );
+thread_t *thread_create( thread_entry_t entry, void *arg, uint32_t stack_size );
+thread_t *thread_current( void );
+void thread_yield( void );
+void thread_wait_event( thread_event_t event );
+void thread_exit( void ) __attribute__((noreturn));
+void thread_join( thread_t *thread );
+void thread_set_priority( thread_t *thread, int priority );
+int thread_get_priority( thread_t *thread );
+size_t thread_get_stack_high_water( thread_t *thread );
+void thread_enable_preemption( int timeslice );
+void thread_disable_preemption( void );
+
+void mutex_init( mutex_t *mutex );
+void mutex_lock( mutex_t *mutex );
+bool mutex_try_lock( mutex_t *mutex );
+void mutex_unlock( mutex_t *mutex );
+
+void semaphore_init( semaphore_t *sem, int count );
+void semaphore_wait( semaphore_t *sem );
+bool semaphore_try_wait( semaphore_t *sem );
+void semaphore_post( semaphore_t *sem );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,12 +24,16 @@ typedef struct timer_link
     uint32_t set;
     /** @brief To correct for drift */
     int ovfl;
-    /** @brief Timer flags.  See #TF_ONE_SHOT, #TF_CONTINUOUS, and #TF_DISABLED */
+    /** @brief Timer flags.  See #TF_ONE_SHOT, #TF_CONTINUOUS, #TF_DISABLED and #TF_DEFERRED */
     int flags;
     /** @brief Callback function to call when timer fires */
     void (*callback)(int ovfl);
-    /** @brief Link to next timer */
+    /** @brief First child in the heap of started timers (private) */
+    struct timer_link *child;
+    /** @brief Next sibling in the heap of started timers (private) */
     struct timer_link *next;
+    /** @brief Previous sibling, or parent, in the heap of started timers (private, NULL if stopped) */
+    struct timer_link *prev;
 } timer_link_t;
 
 /** @brief Timer should fire only once */
@@ -38,6 +42,8 @@ typedef struct timer_link
 #define TF_CONTINUOUS 1
 /** @brief Timer is enabled or not. Can be used to get a new timer that's not started. */
 #define TF_DISABLED 2
+/** @brief Timer callback is deferred to #timer_poll, rather than called under interrupt. */
+#define TF_DEFERRED 4
 
 /** 
  * @brief Calculate timer ticks based on microseconds 
@@ -76,6 +82,59 @@ typedef struct timer_link
  * @return Microseconds as a long long
  */
 #define TIMER_MICROS_LL(tk) ((long long)(tk) * 1000LL / 46875LL)
+/**
+ * @brief Calculate nanoseconds based on timer ticks
+ *
+ * @param[in] tk
+ *            Ticks to convert to nanoseconds
+ *
+ * @return Nanoseconds as a long long
+ */
+#define TIMER_NANOS_LL(tk) ((long long)(tk) * 64LL / 3LL)
+
+/**
+ * @brief Convert a number of ticks (eg: a difference of #timer_ticks) to microseconds
+ *
+ * This is the same as #TIMER_MICROS_LL, but tick counts that fit 32 bits (about
+ * 90 seconds) are converted with 32-bit operations, avoiding a slow 64-bit
+ * division.
+ *
+ * @param[in] tk
+ *            Ticks to convert to microseconds
+ *
+ * @return Microseconds
+ */
+static inline long long timer_ticks_to_us(long long tk)
+{
+    if (__builtin_expect((unsigned long long)tk <= 0xFFFFFFFF, 1)) {
+        /* 1 microsecond is 46.875 = 375/8 ticks */
+        uint32_t t = tk;
+        return (long long)(t / 375) * 8 + (t % 375) * 8 / 375;
+    }
+    return TIMER_MICROS_LL(tk);
+}
+
+/**
+ * @brief Convert a number of ticks (eg: a difference of #timer_ticks) to nanoseconds
+ *
+ * This is the same as #TIMER_NANOS_LL, but tick counts that fit 32 bits (about
+ * 90 seconds) are converted with 32-bit operations, avoiding a slow 64-bit
+ * division.
+ *
+ * @param[in] tk
+ *            Ticks to convert to nanoseconds
+ *
+ * @return Nanoseconds
+ */
+static inline long long timer_ticks_to_ns(long long tk)
+{
+    if (__builtin_expect((unsigned long long)tk <= 0xFFFFFFFF, 1)) {
+        /* 1 tick is 64/3 nanoseconds */
+        uint32_t t = tk;
+        return (long long)(t / 3) * 64 + (t % 3) * 64 / 3;
+    }
+    return TIMER_NANOS_LL(tk);
+}
 
 /** @} */
 
@@ -85,20 +144,22 @@ extern "C" {
 
 /* initialize timer subsystem */
 void timer_init(void);
-/* create a new timer and add to list */
+/* create a new timer and start it */
 timer_link_t *new_timer(int ticks, int flags, void (*callback)(int ovfl));
-/* start a timer not currently in the list */
+/* start a timer, or start it again with new settings */
 void start_timer(timer_link_t *timer, int ticks, int flags, void (*callback)(int ovfl));
-/* reset a timer and add to list */
+/* reset a timer and start it */
 void restart_timer(timer_link_t *timer);
-/* remove a timer from the list */
+/* stop a timer */
 void stop_timer(timer_link_t *timer);
-/* remove a timer from the list and delete it */
+/* stop a timer and delete it */
 void delete_timer(timer_link_t *timer);
-/* delete all timers in list */
+/* delete all continuous timers and close the timer subsystem */
 void timer_close(void);
 /* return total ticks since timer was initialized */
 long long timer_ticks(void);
+/* call the callbacks of the expired deferred timers */
+int timer_poll(void);
 
 #ifdef __cplusplus
 }
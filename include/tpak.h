@@ -75,4 +75,46 @@ bool tpak_check_header(struct gameboy_cartridge_header* header);
 int tpak_write(int controller, uint16_t address, uint8_t* data, uint16_t size);
 int tpak_read(int controller, uint16_t address, uint8_t* buffer, uint16_t size);
 
+/** @brief Maximum number of control writes before the reads of a cartridge bank */
+#define TPAK_STREAM_MAX_WRITES 6
+
+/**
+ * @brief State of a cartridge dump started by #tpak_stream_rom or #tpak_stream_ram
+ *
+ * The fields are private, except for @c total.
+ */
+typedef struct
+{
+    /** @brief Total number of bytes of the dump */
+    uint32_t total;
+
+    int controller;
+    int mbc;
+    bool ram;
+    volatile int bank;
+    int num_steps;
+    uint32_t address;
+    uint32_t end_address;
+    uint16_t writes[TPAK_STREAM_MAX_WRITES][2];
+    int num_writes;
+    int write_index;
+    int retries;
+    bool reading;
+
+    uint8_t *ring;
+    uint32_t ring_size;
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile int error;
+    volatile bool busy;
+
+    joybus_cmdlist_t list;
+    uint64_t output[JOYBUS_BLOCK_DWORDS];
+} tpak_stream_t;
+
+int tpak_stream_rom(tpak_stream_t* stream, int controller, struct gameboy_cartridge_header* header, uint8_t* ring, uint32_t ring_size);
+int tpak_stream_ram(tpak_stream_t* stream, int controller, struct gameboy_cartridge_header* header, uint8_t* ring, uint32_t ring_size);
+int tpak_stream_read(tpak_stream_t* stream, uint8_t* buffer, uint32_t size);
+bool tpak_stream_done(tpak_stream_t* stream);
+
 #endif
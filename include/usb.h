@@ -118,4 +118,60 @@
     
     extern void usb_purge();
 
+    
+    
+    /*********************************
+         Asynchronous USB Functions
+    *********************************/
+    
+    #ifdef LIBDRAGON
+    
+        /*==============================
+            usb_write_async
+            Starts writing data to the USB and returns without waiting for it to be sent.
+            On the 64Drive and SummerCart64 the data is DMA'd straight from the provided
+            buffer in as few transfers as possible, so it must stay untouched until
+            usb_async_done returns 1. Buffers which are not 8 byte aligned, and all writes
+            on the EverDrive, are sent synchronously instead.
+            Will not write if there is data to read from USB
+            @param The DATATYPE that is being sent
+            @param A buffer with the data to send
+            @param The size of the data being sent
+            @return 1 if the write was started, 0 if not
+        ==============================*/
+        
+        extern char usb_write_async(int datatype, const void* data, int size);
+        
+        
+        /*==============================
+            usb_read_async
+            Starts reading bytes received from USB into the provided buffer, with a single
+            DMA from the cart. The buffer must not be accessed until usb_async_done returns 1.
+            @param The buffer to put the read data in
+            @param The number of bytes to read
+            @return 1 if the read was started, 0 if there's no data to read
+        ==============================*/
+        
+        extern char usb_read_async(void* buffer, int nbytes);
+        
+        
+        /*==============================
+            usb_async_done
+            Advances the asynchronous transfer in progress. Call it regularly (eg: once
+            per frame) until it returns 1.
+            @return 1 if there's no transfer in progress, 0 if not
+        ==============================*/
+        
+        extern char usb_async_done();
+        
+        
+        /*==============================
+            usb_async_wait
+            Waits until the asynchronous transfer in progress is done
+        ==============================*/
+        
+        extern void usb_async_wait();
+        
+    #endif
+
 #endif
\ No newline at end of file
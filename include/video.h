@@ -0,0 +1,120 @@
+/**
+ * @file video.h
+ * @brief Full-motion video playback
+ * @ingroup video
+ */
+#ifndef __LIBDRAGON_VIDEO_H
+#define __LIBDRAGON_VIDEO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "display.h"
+#include "rsp.h"
+#include "wav64.h"
+
+/**
+ * @addtogroup video
+ * @{
+ */
+
+/** @brief Input of the RSP decoding or conversion of a frame (see rsp_video.S) */
+typedef struct
+{
+    /** @brief Physical address of the luma plane (converted, or decoded into) */
+    uint32_t y;
+    /** @brief Physical address of the chroma plane (converted, or decoded into) */
+    uint32_t uv;
+    /** @brief Physical address of the first pixel in the framebuffer */
+    uint32_t dst;
+    /** @brief Width of the frame in pixels */
+    uint32_t width;
+    /** @brief Height of the frame in pixels */
+    uint32_t height;
+    /** @brief Distance in bytes between framebuffer lines */
+    uint32_t stride;
+    /** @brief 1 for 16 bpp framebuffers, 2 for 32 bpp */
+    uint32_t bpp_shift;
+    /** @brief 0 to convert the planes into the framebuffer, 1 to decode a frame into them */
+    uint32_t op;
+    /** @brief Physical address of the macroblock commands (decoding only) */
+    uint32_t mbs;
+    /** @brief Number of macroblock commands (decoding only) */
+    uint32_t num_mbs;
+    /** @brief Padding to a multiple of 8 bytes */
+    uint32_t padding[2];
+} video_rsp_input_t;
+
+/**
+ * @brief Video player
+ *
+ * This structure is initialized by #video_open to play a video file created
+ * with mkvideo, streaming it from DragonFS. The fields are read-only for the
+ * application, starting from handle they are private.
+ */
+typedef struct
+{
+    /** @brief Width of the video in pixels */
+    int width;
+    /** @brief Height of the video in pixels */
+    int height;
+    /** @brief Number of frames */
+    int num_frames;
+    /** @brief Frame rate, in 16.16 fixed point */
+    uint32_t fps;
+    /** @brief Index of the next frame to decode */
+    int frame;
+    /** @brief Number of frames that were decoded but not displayed, as they were late */
+    int skipped;
+
+    /** @brief DragonFS handle of the file */
+    uint32_t handle;
+    /** @brief Buffer holding the frame record being read or decoded */
+    uint8_t *record;
+    /** @brief Macroblock commands of the last decoded frame, for the RSP */
+    uint8_t *mbs;
+    /** @brief Luma planes of the last two decoded frames */
+    uint8_t *y_plane[2];
+    /** @brief Chroma planes of the last two decoded frames (U and V interleaved) */
+    uint8_t *uv_plane[2];
+    /** @brief Index of the planes of the last decoded frame (the other ones are the reference) */
+    int plane;
+    /** @brief Waveform played along with the video (or NULL) */
+    wav64_t *audio;
+    /** @brief Mixer channel of the waveform */
+    int audio_ch;
+    /** @brief True once playback has started */
+    bool started;
+    /** @brief Playback time in ticks */
+    int64_t time;
+    /** @brief Ticks of the last update of #time */
+    uint32_t last_ticks;
+    /** @brief Framebuffer holding a frame waiting to be displayed (or 0) */
+    display_context_t disp;
+    /** @brief Index of the frame in #disp */
+    int disp_frame;
+    /** @brief RSP task converting the frame into #disp */
+    rsp_task_t task;
+    /** @brief Input of #task */
+    video_rsp_input_t input __attribute__((aligned(8)));
+    /** @brief RSP task decoding the last frame into its planes */
+    rsp_task_t decode_task;
+    /** @brief Input of #decode_task */
+    video_rsp_input_t decode_input __attribute__((aligned(8)));
+} video_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void video_open(video_t *video, const char *fn);
+void video_set_audio(video_t *video, wav64_t *wav, int ch);
+bool video_update(video_t *video);
+void video_close(video_t *video);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */ /* video */
+
+#endif
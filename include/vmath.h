@@ -0,0 +1,143 @@
+/**
+ * @file vmath.h
+ * @brief Vector and matrix math
+ * @ingroup vmath
+ */
+#ifndef __LIBDRAGON_VMATH_H
+#define __LIBDRAGON_VMATH_H
+
+#include <stdint.h>
+
+/**
+ * @addtogroup vmath
+ * @{
+ */
+
+/** @brief A 3D vector */
+typedef struct
+{
+    float x, y, z;
+} vec3_t;
+
+/** @brief A 4D vector (homogeneous coordinates) */
+typedef struct
+{
+    float x, y, z, w;
+} vec4_t;
+
+/** @brief A rotation quaternion (x, y, z is the vector part) */
+typedef struct
+{
+    float x, y, z, w;
+} quat_t;
+
+/**
+ * @brief A 4x4 matrix, by rows
+ *
+ * Matrices transform column vectors: the element m[r][c] multiplies the
+ * coordinate c of the input vector to produce the coordinate r of the output
+ * vector. This is the layout expected by #rdp_geom_set_matrix.
+ */
+typedef struct
+{
+    float m[4][4];
+} __attribute__((aligned(8))) mat4_t;
+
+/** @brief A s15.16 fixed point number */
+typedef int32_t fix16_t;
+
+/** @brief A 3D vector in s15.16 fixed point */
+typedef struct
+{
+    fix16_t x, y, z;
+} vec3x_t;
+
+/** @brief A 4D vector in s15.16 fixed point */
+typedef struct
+{
+    fix16_t x, y, z, w;
+} vec4x_t;
+
+/** @brief A 4x4 matrix in s15.16 fixed point, with the same layout as #mat4_t */
+typedef struct
+{
+    fix16_t m[4][4];
+} mat4x_t;
+
+/** @brief The s15.16 fixed point representation of a constant (eg: FIX16(0.5)) */
+#define FIX16(f)    ((fix16_t)((f) * 65536.0))
+
+/** @brief Convert a float to s15.16 fixed point (truncating towards zero) */
+static inline fix16_t fix16_from_float( float f )
+{
+    return (fix16_t)(f * 65536.0f);
+}
+
+/** @brief Convert a s15.16 fixed point number to float */
+static inline float fix16_to_float( fix16_t x )
+{
+    return (float)x * (1.0f / 65536.0f);
+}
+
+/** @brief Multiply two s15.16 fixed point numbers */
+static inline fix16_t fix16_mul( fix16_t a, fix16_t b )
+{
+    return (fix16_t)(((int64_t)a * b) >> 16);
+}
+
+/**
+ * @brief Convert a s15.16 fixed point Y coordinate to the s11.2 format of the RDP
+ *
+ * This is the format of the Y coordinates of the RDP triangle commands, while the
+ * X coordinates and the slopes are s15.16 fixed point numbers themselves.
+ */
+static inline uint32_t fix16_to_rdp_y( fix16_t y )
+{
+    return (y >> 14) & 0x3FFF;
+}
+
+/** @brief Dot product of two 3D vectors */
+static inline float vec3_dot( const vec3_t *a, const vec3_t *b )
+{
+    return a->x * b->x + a->y * b->y + a->z * b->z;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void vec3_cross( vec3_t *out, const vec3_t *a, const vec3_t *b );
+float vec3_length( const vec3_t *v );
+void vec3_normalize( vec3_t *out, const vec3_t *v );
+
+void mat4_identity( mat4_t *out );
+void mat4_mul( mat4_t *out, const mat4_t *a, const mat4_t *b );
+void mat4_transpose( mat4_t *out, const mat4_t *m );
+void mat4_translation( mat4_t *out, float x, float y, float z );
+void mat4_scaling( mat4_t *out, float x, float y, float z );
+void mat4_rotation( mat4_t *out, const quat_t *q );
+void mat4_perspective( mat4_t *out, float fovy, float aspect, float near, float far );
+void mat4_ortho( mat4_t *out, float left, float right, float bottom, float top, float near, float far );
+void mat4_viewport( mat4_t *out, float x, float y, float width, float height );
+void mat4_transform( vec4_t *out, const mat4_t *m, const vec4_t *v );
+void mat4_transform_points( vec4_t *out, const mat4_t *m, const vec3_t *in, int count );
+
+void quat_identity( quat_t *out );
+void quat_from_axis_angle( quat_t *out, const vec3_t *axis, float angle );
+void quat_mul( quat_t *out, const quat_t *a, const quat_t *b );
+void quat_normalize( quat_t *out, const quat_t *q );
+void quat_nlerp( quat_t *out, const quat_t *a, const quat_t *b, float t );
+void quat_rotate( vec3_t *out, const quat_t *q, const vec3_t *v );
+
+void mat4_to_fix16( mat4x_t *out, const mat4_t *m );
+void mat4x_mul( mat4x_t *out, const mat4x_t *a, const mat4x_t *b );
+void mat4x_transform_points( vec4x_t *out, const mat4x_t *m, const vec3x_t *in, int count );
+void mat4_to_rsp( int16_t out[8][8], const mat4_t *m );
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */ /* vmath */
+
+#endif
@@ -8,6 +8,15 @@
 #define __LIBDRAGON_WAV64_H
 
 #include "mixer.h"
+#include "dma.h"
+
+/**
+ * @brief Suggested size of the streaming buffer of a WAV64 (see #wav64_set_stream_buffer)
+ *
+ * The buffer is split in two halves, each one holding about 4 KiB of samples:
+ * around 46 ms of a 44.1 KHz 16-bit stereo waveform.
+ */
+#define WAV64_STREAM_BUFFER_SIZE   8192
 
 /** 
  * @brief WAV64 structure
@@ -16,7 +25,11 @@
  * file. It is meant to be played back through the audio mixer, implementing
  * the #waveform_t interface. As such, samples are not preloaded in memory
  * but rather loaded on request when needed for playback, streaming directly
- * from ROM. See #waveform_t for more details.
+ * from ROM. See #waveform_t for more details. WAV64 files converted with
+ * "audioconv64 --wav-compress true" hold VADPCM samples (16 samples in 9 bytes,
+ * about 1/3.5 of the size of 16-bit samples), which are decoded by the RSP
+ * while streaming, so that compressed files save ROM space and PI bandwidth
+ * without costing CPU time.
  * 
  * Use #wav64_play to playback. For more advanced usage, call directly the
  * mixer functions, accessing the #wave structure field.
@@ -30,6 +43,43 @@ typedef struct {
 
 	/** @brief Absolute ROM address of WAV64 */
 	uint32_t rom_addr;
+
+	/** @brief Format of the samples in ROM (raw or VADPCM) */
+	int format;
+
+	/** @brief VADPCM decoder state (only for compressed files) */
+	struct {
+		/** @brief Codebook of each channel: 8 predictors of two 8-tap vectors (read by the RSP) */
+		int16_t book[2][8][2][8] __attribute__((aligned(16)));
+		/** @brief Decoder state of each channel at the loop point */
+		int16_t loop_state[2][2];
+		/** @brief Decoder state of each channel: the last two decoded samples */
+		int16_t state[2][2];
+		/** @brief Decoder state of each channel before the last decoded frame */
+		int16_t last_state[2][2];
+		/** @brief Frame that follows the decoder state (#state) */
+		int state_frame;
+		/** @brief Frame that follows #last_state, or -1 if unknown */
+		int last_frame;
+	} vadpcm;
+
+	/** @brief Double-buffered streaming state (see #wav64_set_stream_buffer) */
+	struct {
+		/** @brief The two halves of the streaming buffer (NULL if disabled) */
+		uint8_t *buf[2];
+		/** @brief Size of each half, in bytes */
+		int size;
+		/** @brief First sample (or VADPCM frame) held by each half */
+		int start[2];
+		/** @brief Number of samples (or VADPCM frames) held by each half (0 if empty) */
+		int len[2];
+		/** @brief Offset of the first sample within each half, to match the ROM 8-byte phase */
+		int ofs[2];
+		/** @brief True if the DMA transfer into a half might be still in progress */
+		bool busy[2];
+		/** @brief DMA queue requests filling each half */
+		dma_request_t req[2];
+	} stream;
 } wav64_t;
 
 /** @brief Open a WAV64 file for playback from the DragonFS filesystem.  
@@ -45,6 +95,29 @@ void wav64_open(wav64_t *wav, const char *fn);
 /** @brief Configure a WAV64 file for looping playback. */
 void wav64_set_loop(wav64_t *wav, bool loop);
 
+/**
+ * @brief Enable double-buffered streaming for a WAV64 file.
+ *
+ * By default, every time the mixer requests more samples, they are read
+ * from ROM with a blocking PI DMA transfer, right on the mixer critical path.
+ * With a streaming buffer, the samples that follow each read are prefetched
+ * in background through the DMA queue into one half of the buffer, while
+ * the other half is being consumed. Requests from the mixer are then served
+ * with a memory copy, and only seeks (eg: at start or via #mixer_ch_set_pos)
+ * go through a blocking transfer. This allows to stream many waveforms at once
+ * without audio underruns when the PI is busy. Compressed files are streamed
+ * in the same way, with the RSP decoding frames straight from the buffer.
+ *
+ * The buffer is owned by the caller and must stay valid while the WAV64 is
+ * played back. Call this function again with a NULL buffer to disable
+ * streaming (and wait for pending transfers) before releasing it.
+ *
+ * @param   wav         Pointer to wav64_t structure
+ * @param   buf         Buffer (16-byte aligned), or NULL to disable streaming
+ * @param   size        Size of the buffer in bytes (multiple of 32), see #WAV64_STREAM_BUFFER_SIZE
+ */
+void wav64_set_stream_buffer(wav64_t *wav, void *buf, int size);
+
 /** @brief Start playing a WAV64 file.
  * 
  * This is just a simple wrapper that calls #mixer_ch_play on the WAV64's
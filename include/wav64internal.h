@@ -4,6 +4,7 @@
 #define WAV64_ID            "WV64"
 #define WAV64_FILE_VERSION  2
 #define WAV64_FORMAT_RAW    0
+#define WAV64_FORMAT_VADPCM 2
 
 typedef struct __attribute__((packed)) {
 	char id[4];
@@ -19,4 +20,55 @@ typedef struct __attribute__((packed)) {
 
 _Static_assert(sizeof(wav64_header_t) == 24, "invalid wav64_header size");
 
+// VADPCM format: frames of WAV64_VADPCM_FRAME_SAMPLES samples per channel,
+// each one WAV64_VADPCM_FRAME_BYTES bytes; stereo files have a frame for each
+// channel, left first. The frame header byte holds the scale (high nibble)
+// and the predictor (low nibble); byte 1+j holds the 4-bit residual of
+// sample j in the high nibble, and that of sample 8+j in the low nibble.
+// The samples are decoded by the RSP (rsp_vadpcm.S), always as 16-bit.
+//
+// The header is followed by wav64_vadpcm_header_t, and by the codebook:
+// for each channel and each predictor, book0[8] and book1[8] (big-endian,
+// 5.11 fixed point). The samples start at start_offset.
+#define WAV64_VADPCM_FRAME_SAMPLES   16
+#define WAV64_VADPCM_FRAME_BYTES     9
+#define WAV64_VADPCM_MAX_PREDICTORS  8
+// Largest scale, so that the residuals fit 16 bits
+#define WAV64_VADPCM_MAX_SCALE       11
+
+typedef struct __attribute__((packed)) {
+	int8_t npredictors;         // Number of predictors per channel
+	int8_t order;               // Order of the predictors (always 2)
+	int16_t reserved;
+	int16_t loop_state[2][2];   // Decoder state of each channel at the frame of the loop point
+} wav64_vadpcm_header_t;
+
+_Static_assert(sizeof(wav64_vadpcm_header_t) == 12, "invalid wav64_vadpcm_header size");
+
+// Decode a VADPCM frame of one channel, with the predictor selected by its
+// header. state holds the last two decoded samples, and it is updated. This
+// matches the arithmetic of the RSP decoder bit by bit.
+static inline void wav64_vadpcm_decode(const int16_t book[][2][8], const uint8_t *frame, int16_t state[2], int16_t out[16]) {
+	const int16_t (*b)[8] = book[frame[0] & (WAV64_VADPCM_MAX_PREDICTORS-1)];
+	int scale = frame[0] >> 4;
+
+	for (int h=0; h<2; h++) {
+		int e[8];
+		for (int j=0; j<8; j++) {
+			int n = h ? frame[1+j] & 0xF : frame[1+j] >> 4;
+			e[j] = ((n ^ 8) - 8) * (1 << scale);
+		}
+		for (int j=0; j<8; j++) {
+			// The sum wraps at 32 bits, as in the high part of the RSP accumulator
+			uint32_t sum = b[0][j]*state[0] + b[1][j]*state[1] + e[j]*2048;
+			for (int k=0; k<j; k++)
+				sum += b[1][j-k-1]*e[k];
+			int32_t acc = (int32_t)sum >> 11;
+			out[h*8+j] = acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc;
+		}
+		state[0] = out[h*8+6];
+		state[1] = out[h*8+7];
+	}
+}
+
 #endif
@@ -24,6 +24,18 @@ N64_OBJDUMP = $(N64_GCCPREFIX)objdump
 N64_SIZE = $(N64_GCCPREFIX)size
 
 N64_ROM_TITLE = "N64 ROM"
+N64_MKDFSFLAGS ?=
+
+# Set to true to store the program image compressed in the ROM: it is
+# decompressed into RDRAM by the boot code, which is faster than copying
+# a bigger image and leaves more room in the ROM for the data.
+N64_COMPRESS ?= false
+
+ifeq ($(N64_COMPRESS),true)
+N64_BINFILES = $<.boot.bin -z $<.bin $<.overlay.bin
+else
+N64_BINFILES = $<.bin
+endif
 
 ifeq ($(D),1)
 CFLAGS+=-g3
@@ -50,13 +62,19 @@ ASFLAGS+=-MMD    # automatic .d dependency generation
 %.z64: MAPCMD=-Map
 %.z64: $(BUILD_DIR)/%.elf
 	@echo "    [N64] $@"
+ifeq ($(N64_COMPRESS),true)
+	$(N64_OBJCOPY) $< $<.boot.bin -O binary -j .boot
+	$(N64_OBJCOPY) $< $<.bin -O binary -R .boot -R '.overlay*'
+	$(N64_OBJCOPY) $< $<.overlay.bin -O binary -j '.overlay*'
+else
 	$(N64_OBJCOPY) $< $<.bin -O binary
+endif
 	@rm -f $@
 	DFS_FILE=$(filter %.dfs, $^); \
 	if [ -z "$$DFS_FILE" ]; then \
-		$(N64_TOOL) $(N64_FLAGS) -o $@  -t $(N64_ROM_TITLE) $<.bin; \
+		$(N64_TOOL) $(N64_FLAGS) -o $@  -t $(N64_ROM_TITLE) $(N64_BINFILES); \
 	else \
-		$(N64_TOOL) $(N64_FLAGS) -o $@  -t $(N64_ROM_TITLE) $<.bin -s 1M $$DFS_FILE; \
+		$(N64_TOOL) $(N64_FLAGS) -o $@  -t $(N64_ROM_TITLE) $(N64_BINFILES) -s 1M $$DFS_FILE; \
 	fi
 	$(N64_CHKSUMPATH) $@ >/dev/null
 
@@ -69,7 +87,7 @@ endif
 %.dfs:
 	@mkdir -p $(dir $@)
 	@echo "    [DFS] $@"
-	$(N64_MKDFSPATH) $@ $(<D) >/dev/null
+	$(N64_MKDFSPATH) $(N64_MKDFSFLAGS) $@ $(<D) >/dev/null
 
 # Assembly rule. We use .S for both RSP and MIPS assembly code, and we differentiate
 # using the prefix of the filename: if it starts with "rsp", it is RSP ucode, otherwise
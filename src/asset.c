@@ -0,0 +1,491 @@
+/**
+ * @file asset.c
+ * @brief Asset manager
+ * @ingroup dfs
+ */
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "dragonfs.h"
+#include "asset.h"
+#include "debug.h"
+
+/**
+ * @addtogroup dfs
+ * @{
+ *
+ * The asset manager loads files from DragonFS on behalf of all the subsystems
+ * of a game, so that a file requested by several of them is loaded only once:
+ *
+ * @code{.c}
+ *     asset_init(512 * 1024);
+ *
+ *     // Start loading in background, while the game goes on
+ *     asset_t *tex = asset_get("gfx/hero.sprite");
+ *     ...
+ *     if(asset_wait(tex) == DFS_ESUCCESS)
+ *     {
+ *         sprite_t *sprite = asset_data(tex, NULL);
+ *         ...
+ *     }
+ *     asset_release(tex);
+ * @endcode
+ *
+ * #asset_get returns a reference counted handle to the asset: requests for a
+ * file that is already in memory, or still being loaded, share the same data.
+ * Files are loaded in background with #dfs_read_async (see #ASSET_MAX_LOADS),
+ * straight into buffers allocated with #dfs_alloc_buffer.  #asset_poll makes
+ * progress on the pending loads: it is called by all the asset functions, and
+ * it can be also called once per frame while assets are loading.
+ *
+ * Assets that are not referenced anymore are kept in memory as a cache, as long
+ * as the memory used by all the assets stays within the budget passed to
+ * #asset_init: the least recently released ones are dropped first.  The
+ * budget only limits this cache: an asset that is requested is loaded even if
+ * the referenced assets already exceed it.
+ */
+
+/** @brief Asset waiting for a file handle to start loading */
+#define ASSET_QUEUED        0
+/** @brief Asset being read in background */
+#define ASSET_LOADING       1
+/** @brief Asset read, the file must be closed */
+#define ASSET_READ          2
+/** @brief Asset in memory */
+#define ASSET_READY         3
+/** @brief Asset that could not be loaded */
+#define ASSET_ERROR         4
+
+/** @brief Asset loaded from DragonFS */
+struct asset_s
+{
+    /** @brief Next asset, in order of request */
+    struct asset_s *next;
+    /** @brief Path of the file */
+    char *path;
+    /** @brief Contents of the file (16-byte aligned) */
+    void *data;
+    /** @brief Size of the file in bytes */
+    int size;
+    /** @brief Number of references */
+    int refs;
+    /** @brief State of the asset (ASSET_QUEUED...) */
+    volatile int state;
+    /** @brief Bytes transferred by the asynchronous read */
+    volatile int read;
+    /** @brief Error code (ASSET_ERROR only) */
+    int error;
+    /** @brief File handle (ASSET_LOADING and ASSET_READ only) */
+    uint32_t handle;
+    /** @brief Time of the last release, to evict the least recently used */
+    uint32_t last_use;
+};
+
+/** @brief State of the asset manager */
+static struct
+{
+    /** @brief True if #asset_init was called */
+    bool initialized;
+    /** @brief Memory budget in bytes */
+    int budget;
+    /** @brief First asset, in order of request */
+    asset_t *head;
+    /** @brief Number of assets being read in background */
+    int loads;
+    /** @brief Counter incremented at each release */
+    uint32_t clock;
+    /** @brief Statistics */
+    asset_stats_t stats;
+} manager;
+
+/**
+ * @brief Drop an asset from memory
+ *
+ * @param[in] asset
+ *            Asset to drop (not being read)
+ */
+static void __asset_free(asset_t *asset)
+{
+    asset_t **link = &manager.head;
+
+    while(*link != asset)
+    {
+        link = &(*link)->next;
+    }
+
+    *link = asset->next;
+
+    if(asset->data)
+    {
+        manager.stats.used -= asset->size;
+    }
+
+    manager.stats.count--;
+    free(asset->data);
+    free(asset->path);
+    free(asset);
+}
+
+/**
+ * @brief Drop the least recently used unreferenced assets, to make room
+ *
+ * @param[in] needed
+ *            Bytes that are about to be allocated
+ */
+static void __asset_trim(int needed)
+{
+    while(manager.stats.used + needed > manager.budget)
+    {
+        asset_t *lru = NULL;
+
+        for(asset_t *a = manager.head; a; a = a->next)
+        {
+            if(a->refs == 0 && a->state == ASSET_READY && (!lru || (int32_t)(a->last_use - lru->last_use) < 0))
+            {
+                lru = a;
+            }
+        }
+
+        if(!lru)
+        {
+            return;
+        }
+
+        __asset_free(lru);
+        manager.stats.evictions++;
+    }
+}
+
+/**
+ * @brief Callback of the asynchronous read of an asset (called under interrupt)
+ */
+static void __asset_read_done(uint32_t handle, int read, void *ctx)
+{
+    asset_t *asset = ctx;
+
+    asset->read = read;
+    asset->state = ASSET_READ;
+}
+
+/**
+ * @brief Start loading a queued asset
+ *
+ * @param[in] asset
+ *            Asset to load
+ *
+ * @return False if no file handle is available, true otherwise (the asset is
+ *         either loading or failed).
+ */
+static bool __asset_start(asset_t *asset)
+{
+    int fh = dfs_open(asset->path);
+
+    if(fh < 0)
+    {
+        /* All handles are in use: retry once one of our loads is done */
+        if(fh == DFS_ENOMEM && manager.loads > 0)
+        {
+            return false;
+        }
+
+        asset->error = fh;
+        asset->state = ASSET_ERROR;
+        return true;
+    }
+
+    int size = dfs_size(fh);
+    __asset_trim(size);
+    void *data = dfs_alloc_buffer(size);
+
+    if(!data)
+    {
+        dfs_close(fh);
+        asset->error = DFS_ENOMEM;
+        asset->state = ASSET_ERROR;
+        return true;
+    }
+
+    asset->data = data;
+    asset->size = size;
+    asset->handle = fh;
+    asset->state = ASSET_LOADING;
+    manager.stats.used += size;
+    manager.loads++;
+
+    int ret = dfs_read_async(fh, data, size, __asset_read_done, asset);
+
+    if(ret < 0)
+    {
+        dfs_close(fh);
+        manager.loads--;
+        asset->error = ret;
+        asset->state = ASSET_ERROR;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Initialize the asset manager
+ *
+ * @param[in] budget
+ *            Memory in bytes that the assets can use before the unreferenced
+ *            ones are dropped
+ */
+void asset_init(int budget)
+{
+    assertf(!manager.initialized, "asset manager already initialized");
+
+    memset(&manager, 0, sizeof(manager));
+    manager.budget = budget;
+    manager.initialized = true;
+}
+
+/**
+ * @brief Close the asset manager
+ *
+ * Waits for the pending loads, then drops all the assets from memory, including
+ * the referenced ones: their handles must not be used anymore.
+ */
+void asset_close(void)
+{
+    if(!manager.initialized)
+    {
+        return;
+    }
+
+    while(manager.loads > 0)
+    {
+        asset_poll();
+    }
+
+    while(manager.head)
+    {
+        __asset_free(manager.head);
+    }
+
+    manager.initialized = false;
+}
+
+/**
+ * @brief Get a reference to an asset, loading it in background if needed
+ *
+ * If the file is already in memory, or being loaded, the same asset is
+ * returned with one more reference.  Otherwise, the asset is queued to be
+ * loaded in background.  Use #asset_wait or #asset_ready to know when the
+ * data is available.
+ *
+ * @param[in] path
+ *            Path of the file in DragonFS (eg: "gfx/hero.sprite")
+ *
+ * @return The asset (to be released with #asset_release), or NULL if out of memory.
+ */
+asset_t *asset_get(const char * const path)
+{
+    assertf(manager.initialized, "asset manager not initialized");
+
+    for(asset_t *a = manager.head; a; a = a->next)
+    {
+        if(strcmp(a->path, path) == 0)
+        {
+            a->refs++;
+            manager.stats.hits++;
+            return a;
+        }
+    }
+
+    asset_t *asset = calloc(1, sizeof(asset_t));
+    char *copy = strdup(path);
+
+    if(!asset || !copy)
+    {
+        free(asset);
+        free(copy);
+        return NULL;
+    }
+
+    asset->path = copy;
+    asset->refs = 1;
+    asset->state = ASSET_QUEUED;
+
+    /* Append, so that assets are loaded in order of request */
+    asset_t **link = &manager.head;
+
+    while(*link)
+    {
+        link = &(*link)->next;
+    }
+
+    *link = asset;
+    manager.stats.count++;
+
+    asset_poll();
+    return asset;
+}
+
+/**
+ * @brief Release a reference to an asset
+ *
+ * When the last reference is released, the asset is kept in memory as long as
+ * the budget allows it, so that requesting it again is immediate.
+ *
+ * @param[in] asset
+ *            Asset returned by #asset_get
+ */
+void asset_release(asset_t *asset)
+{
+    assertf(asset->refs > 0, "asset %s released too many times", asset->path);
+
+    asset->last_use = ++manager.clock;
+
+    if(--asset->refs > 0)
+    {
+        return;
+    }
+
+    /* Nobody is waiting for it: cancel the load, or forget the error */
+    if(asset->state == ASSET_QUEUED || asset->state == ASSET_ERROR)
+    {
+        __asset_free(asset);
+        return;
+    }
+
+    __asset_trim(0);
+}
+
+/**
+ * @brief Make progress on the assets being loaded in background
+ *
+ * @return The number of assets still queued or loading.
+ */
+int asset_poll(void)
+{
+    int pending = 0;
+    asset_t *next;
+
+    /* Close the files that have been read */
+    for(asset_t *a = manager.head; a; a = next)
+    {
+        next = a->next;
+
+        if(a->state == ASSET_READ)
+        {
+            dfs_close(a->handle);
+            manager.loads--;
+
+            if(a->read == a->size)
+            {
+                a->state = ASSET_READY;
+            }
+            else
+            {
+                a->error = DFS_EBADFS;
+                a->state = ASSET_ERROR;
+            }
+        }
+
+        if(a->state == ASSET_ERROR && a->refs == 0)
+        {
+            __asset_free(a);
+        }
+    }
+
+    /* Start the queued loads, in order of request */
+    for(asset_t *a = manager.head; a; a = a->next)
+    {
+        if(a->state == ASSET_QUEUED && (manager.loads >= ASSET_MAX_LOADS || !__asset_start(a)))
+        {
+            break;
+        }
+    }
+
+    for(asset_t *a = manager.head; a; a = a->next)
+    {
+        if(a->state != ASSET_READY && a->state != ASSET_ERROR)
+        {
+            pending++;
+        }
+    }
+
+    __asset_trim(0);
+    return pending;
+}
+
+/**
+ * @brief Check whether the data of an asset is available
+ *
+ * @param[in] asset
+ *            Asset returned by #asset_get
+ *
+ * @return True if the asset is in memory, false if it is still loading or it
+ *         could not be loaded.
+ */
+bool asset_ready(asset_t *asset)
+{
+    asset_poll();
+    return asset->state == ASSET_READY;
+}
+
+/**
+ * @brief Wait until an asset has been loaded
+ *
+ * @param[in] asset
+ *            Asset returned by #asset_get
+ *
+ * @return DFS_ESUCCESS if the asset is in memory, or the error that prevented
+ *         loading it (eg: DFS_ENOFILE).
+ */
+int asset_wait(asset_t *asset)
+{
+    while(asset->state != ASSET_READY && asset->state != ASSET_ERROR)
+    {
+        asset_poll();
+    }
+
+    return asset->state == ASSET_READY ? DFS_ESUCCESS : asset->error;
+}
+
+/**
+ * @brief Get the data of an asset
+ *
+ * @param[in]  asset
+ *             Asset returned by #asset_get
+ * @param[out] size
+ *             Size of the data in bytes (can be NULL)
+ *
+ * @return The data (16-byte aligned), valid until the asset is released, or
+ *         NULL if the asset is not in memory (see #asset_ready).
+ */
+void *asset_data(asset_t *asset, int *size)
+{
+    if(asset->state != ASSET_READY)
+    {
+        return NULL;
+    }
+
+    if(size) { *size = asset->size; }
+    return asset->data;
+}
+
+/**
+ * @brief Get the memory usage of the asset manager
+ *
+ * @param[out] stats
+ *             Structure to fill
+ */
+void asset_get_stats(asset_stats_t *stats)
+{
+    *stats = manager.stats;
+    stats->cached = 0;
+
+    for(asset_t *a = manager.head; a; a = a->next)
+    {
+        if(a->refs == 0 && a->state == ASSET_READY)
+        {
+            stats->cached += a->size;
+        }
+    }
+}
+
+/** @} */ /* dfs */
@@ -9,6 +9,7 @@
 #include "libdragon.h"
 #include "regsinternal.h"
 #include "n64sys.h"
+#include "system.h"
 
 /**
  * @defgroup audio Audio Subsystem
@@ -43,6 +44,14 @@
  * not return until there is room and the samples have been written.
  * When all audio has been written, code should call #audio_close to shut
  * down the audio subsystem cleanly.
+ *
+ * For the lowest latency between a gameplay event and the sound, initialize
+ * the subsystem with #audio_init_low_latency, which uses a few very short
+ * buffers, and register an asynchronous fill callback with
+ * #audio_set_async_buffer_callback (the mixer does so in
+ * #mixer_set_low_latency). The buffers are then refilled as soon as there
+ * is room for them, straight from the interrupts, rather than by the main
+ * loop, so that they can be kept short without underruns.
  * @{
  */
 
@@ -91,6 +100,8 @@ static short **buffers = NULL;
 
 static audio_fill_buffer_callback _fill_buffer_callback = NULL;
 static audio_fill_buffer_callback _orig_fill_buffer_callback = NULL;
+/** @brief Callback that generates the buffers in background (see #audio_set_async_buffer_callback) */
+static audio_fill_buffer_callback _async_fill_buffer_callback = NULL;
 
 static volatile bool _paused = false;
 
@@ -100,6 +111,8 @@ static volatile int now_playing = 0;
 static volatile int now_writing = 0;
 /** @brief Bitmask of buffers indicating which buffers are full */
 static volatile int buf_full = 0;
+/** @brief Bitmask of buffers whose samples are still being generated (eg: by #mixer_poll_async) */
+static volatile int buf_pending = 0;
 
 /** @brief Structure used to interact with the AI registers */
 static volatile struct AI_regs_s * const AI_regs = (struct AI_regs_s *)0xa4500000;
@@ -151,6 +164,12 @@ static void audio_callback()
             break;
         }
 
+        /* The buffer is still being generated: it will be picked up later */
+        if (buf_pending & (1<<next))
+        {
+            break;
+        }
+
         /* clear buffer full flag */
         buf_full &= ~(1<<next);
 
@@ -171,28 +190,47 @@ static void audio_callback()
         MEMORY_BARRIER();
     }
 
+    /* Start generating the next buffer, unless one is already in progress.
+     * When it is complete, the callback marks it as not pending anymore,
+     * which calls us again to send it to the AI and start the next one. The
+     * buffers queued in the AI (the one playing, and the previous one that
+     * might be still draining) cannot be overwritten. */
+    if (_async_fill_buffer_callback && !_paused && !buf_pending)
+    {
+        int next = (now_writing + 1) % _num_buf;
+        int prev = (now_playing + _num_buf - 1) % _num_buf;
+        if (!(buf_full & (1<<next)) && next != now_playing && next != prev)
+        {
+            now_writing = next;
+            buf_full |= (1<<next);
+            _async_fill_buffer_callback(buffers[next], _buf_size);
+            if (!buf_pending)
+            {
+                /* The callback completed synchronously */
+                enable_interrupts();
+                audio_callback();
+                return;
+            }
+        }
+    }
+
     /* Safe to enable interrupts here */
     enable_interrupts();
 }
 
 
 /**
- * @brief Initialize the audio subsystem
- *
- * This function will set up the AI to play at a given frequency and
- * allocate a number of back buffers to write data to.
- *
- * @note Before re-initializing the audio subsystem to a new playback
- *       frequency, remember to call #audio_close.
+ * @brief Initialize the AI and allocate the buffers
  *
  * @param[in] frequency
  *            The frequency in Hz to play back samples at
  * @param[in] numbuffers
  *            The number of buffers to allocate internally
- * @param[in] fill_buffer_callback
- *            A function to be called when more sample data is needed
+ * @param[in] buffer_length
+ *            The number of stereo samples in each buffer, or 0 to calculate
+ *            it from the frequency
  */
-void audio_init(const int frequency, int numbuffers)
+static void audio_init_internal(const int frequency, int numbuffers, int buffer_length)
 {
     int clockrate;
 
@@ -233,14 +271,15 @@ void audio_init(const int frequency, int numbuffers)
     set_AI_interrupt(1);
 
     /* Set up buffers */
-    _buf_size = CALC_BUFFER(_frequency);
+    _buf_size = buffer_length ? buffer_length : CALC_BUFFER(_frequency);
     _num_buf = (numbuffers > 1) ? numbuffers : NUM_BUFFERS;
     buffers = malloc(_num_buf * sizeof(short *));
 
     for(int i = 0; i < _num_buf; i++)
     {
-        /* Stereo buffers, interleaved */
-        buffers[i] = malloc(sizeof(short) * 2 * _buf_size);
+        /* Stereo buffers, interleaved, away from the framebuffers if possible */
+        buffers[i] = malloc_video(sizeof(short) * 2 * _buf_size, RDRAM_BANK_ANY);
+        sys_mem_tag_alloc(MEM_TAG_AUDIO, sizeof(short) * 2 * _buf_size);
         memset(buffers[i], 0, sizeof(short) * 2 * _buf_size);
     }
 
@@ -248,7 +287,55 @@ void audio_init(const int frequency, int numbuffers)
     now_playing = 0;
     now_writing = 0;
     buf_full = 0;
+    buf_pending = 0;
     _paused = false;
+    _async_fill_buffer_callback = NULL;
+}
+
+/**
+ * @brief Initialize the audio subsystem
+ *
+ * This function will set up the AI to play at a given frequency and
+ * allocate a number of back buffers to write data to.
+ *
+ * @note Before re-initializing the audio subsystem to a new playback
+ *       frequency, remember to call #audio_close.
+ *
+ * @param[in] frequency
+ *            The frequency in Hz to play back samples at
+ * @param[in] numbuffers
+ *            The number of buffers to allocate internally
+ */
+void audio_init(const int frequency, int numbuffers)
+{
+    audio_init_internal(frequency, numbuffers, 0);
+}
+
+/**
+ * @brief Initialize the audio subsystem with short buffers
+ *
+ * This works like #audio_init, but the buffers contain the specified number
+ * of samples instead of 1/25th of second each. The latency is roughly the
+ * duration of numbuffers buffers: for instance, 4 buffers of 128 samples at
+ * 44100 Hz give less than 12 milliseconds.
+ *
+ * Buffers this short can hardly be filled in time by the main loop. They are
+ * meant to be generated by an asynchronous callback, that refills them from
+ * the interrupts (see #audio_set_async_buffer_callback).
+ *
+ * @param[in] frequency
+ *            The frequency in Hz to play back samples at
+ * @param[in] numbuffers
+ *            The number of buffers to allocate internally (at least 3)
+ * @param[in] buffer_length
+ *            The number of stereo samples in each buffer (rounded up to a
+ *            multiple of 8)
+ */
+void audio_init_low_latency(const int frequency, int numbuffers, int buffer_length)
+{
+    assertf(numbuffers >= 3, "audio_init_low_latency: at least 3 buffers are required");
+    assertf(buffer_length > 0, "audio_init_low_latency: invalid buffer length %d", buffer_length);
+    audio_init_internal(frequency, numbuffers, (buffer_length + 7) & ~7);
 }
 
 void audio_set_buffer_callback(audio_fill_buffer_callback fill_buffer_callback)
@@ -261,6 +348,38 @@ void audio_set_buffer_callback(audio_fill_buffer_callback fill_buffer_callback)
     enable_interrupts();
 }
 
+/**
+ * @brief Set a callback that generates the buffers asynchronously
+ *
+ * The callback is called from the interrupts, with interrupts disabled, every
+ * time a buffer is free, and must start generating its samples and return
+ * right away. To do so, the callback marks the buffer as pending until the
+ * samples are complete, for instance by mixing them on the RSP with
+ * #mixer_poll_async. The buffer is sent to the AI as soon as it is ready,
+ * and the next one is started at the same time.
+ *
+ * This keeps all the buffers full without any involvement of the main loop,
+ * which is required to use the short buffers of #audio_init_low_latency.
+ * While the callback is set, #audio_write and related functions must not
+ * be used.
+ *
+ * @param[in] fill_buffer_callback
+ *            Function that starts generating a buffer, or NULL to stop
+ */
+void audio_set_async_buffer_callback(audio_fill_buffer_callback fill_buffer_callback)
+{
+    disable_interrupts();
+    _async_fill_buffer_callback = fill_buffer_callback;
+    enable_interrupts();
+
+    /* Start generating the first buffer. The AI interrupts will then keep
+     * the chain going. */
+    if(fill_buffer_callback)
+    {
+        audio_callback();
+    }
+}
+
 /**
  * @brief Close the audio subsystem
  *
@@ -271,6 +390,7 @@ void audio_close()
 {
     set_AI_interrupt(0);
     unregister_AI_handler(audio_callback);
+    _async_fill_buffer_callback = NULL;
 
     if(buffers)
     {
@@ -279,7 +399,8 @@ void audio_close()
             /* Nuke anything that isn't freed */
             if(buffers[i])
             {
-                free(buffers[i]);
+                free_video(buffers[i]);
+                sys_mem_tag_free(MEM_TAG_AUDIO, sizeof(short) * 2 * _buf_size);
                 buffers[i] = 0;
             }
         }
@@ -306,7 +427,7 @@ static void audio_paused_callback(short *buffer, size_t numsamples)
  * Silence will be generated while playback is paused.
  */
 void audio_pause(bool pause) {
-    if (pause != _paused && _fill_buffer_callback) {
+    if (pause != _paused && (_fill_buffer_callback || _async_fill_buffer_callback)) {
         disable_interrupts();
 
         _paused = pause;
@@ -428,6 +549,49 @@ void audio_write_end(void)
     enable_interrupts();
 }
 
+/**
+ * @brief Mark an internal buffer as being generated asynchronously
+ *
+ * A pending buffer is not sent to the AI, even if #audio_write_end has
+ * already been called on it, until it is marked as not pending anymore.
+ * This is used by #mixer_poll_async, which completes the mixing in background.
+ *
+ * @param[in] buffer
+ *            Pointer returned by #audio_write_begin (other pointers are ignored)
+ * @param[in] pending
+ *            True if the samples are still being generated
+ */
+void __audio_buffer_set_pending(short *buffer, bool pending)
+{
+    if(!buffers)
+    {
+        return;
+    }
+
+    disable_interrupts();
+
+    for(int i = 0; i < _num_buf; i++)
+    {
+        if(((uint32_t)buffers[i] & 0x1FFFFFFF) == ((uint32_t)buffer & 0x1FFFFFFF))
+        {
+            if(pending)
+            {
+                buf_pending |= (1<<i);
+            }
+            else
+            {
+                buf_pending &= ~(1<<i);
+
+                /* The AI might have been waiting for this buffer */
+                audio_callback();
+            }
+            break;
+        }
+    }
+
+    enable_interrupts();
+}
+
 /**
  * @brief Write a chunk of silence
  *
@@ -1,10 +1,13 @@
 #include "libdragon.h"
 #include "regsinternal.h"
 #include "mixer.h"
+#include "system.h"
 #include <memory.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <math.h>
 #include <stdio.h>
+#include <limits.h>
 
 #define MIXER_TRACE   0
 
@@ -24,7 +27,7 @@
 #define AI_STATUS_FULL  ( 1 << 31 )
 /** @} */
 
-#define MAX_EVENTS              32
+#define MAX_EVENTS              64
 #define MIXER_POLL_PER_SECOND   8
 
 /**
@@ -38,8 +41,8 @@ DEFINE_RSP_UCODE(rsp_mixer);
 // NOTE: keep these in sync with rsp_mixer.S
 #define CH_FLAGS_BPS_SHIFT  (3<<0)   // BPS shift value
 #define CH_FLAGS_16BIT      (1<<2)   // Set if the channel is 16 bit
-#define CH_FLAGS_STEREO     (1<<3)   // Set if the channel is stereo (left)
-#define CH_FLAGS_STEREO_SUB (1<<4)   // The channel is the second half of a stereo (right)
+#define CH_FLAGS_STEREO     (1<<3)   // Set if the channel plays an interleaved stereo waveform
+#define CH_FLAGS_RESIDENT   (1<<5)   // The channel plays a resident waveform (ignored by RSP)
 
 // Fixed point value used in waveform position calculations. This is a signed
 // 64-bit integer with the fractional part using MIXER_FX64_FRAC bits.
@@ -71,6 +74,11 @@ typedef struct mixer_channel_s {
 	mixer_fx64_t loop_len;
 	/* Pointer to the waveform */
 	void *ptr;
+	/* Position (in bytes) where the samples wrap around in the sample buffer
+	   (ring mode), and distance of the jump back. ring_jump is 0 if the
+	   samples being mixed are contiguous. */
+	mixer_fx64_t ring_wrap;
+	mixer_fx64_t ring_jump;
 	/* Misc flags */
 	uint32_t flags;
 } mixer_channel_t;
@@ -86,6 +94,45 @@ typedef struct rsp_mixer_channel_s {
 
 _Static_assert(sizeof(rsp_mixer_channel_t) == 6*4);
 
+// Number of channels mixed by a single run of the RSP ucode (MAX_CHANNELS in
+// rsp_mixer.S). More channels are mixed in multiple passes.
+#define MIXER_RSP_CHANNELS   32
+// Maximum number of passes. A stereo channel takes two slots of a pass (left
+// and right), so in the worst case there are two passes per MIXER_RSP_CHANNELS
+// channels, plus one because a stereo channel is never split between passes.
+#define MIXER_MAX_PASSES     (MIXER_MAX_CHANNELS * 2 / MIXER_RSP_CHANNELS + 1)
+
+typedef struct {
+	// RSP task running the mixer ucode on this batch of channels
+	rsp_task_t task;
+	// Number of channels in the batch, and mixer channel for each
+	// of them (-1 if the slot is unused). The right samples of a stereo
+	// channel take the slot after the channel, flagged in chsub.
+	int num_channels;
+	int8_t chmap[MIXER_RSP_CHANNELS];
+	bool chsub[MIXER_RSP_CHANNELS];
+
+	// Input of the ucode, copied into DMEM when the task starts
+	uint32_t args[4];
+	mixer_fx15_t lvol[MIXER_RSP_CHANNELS] __attribute__((aligned(8)));
+	mixer_fx15_t rvol[MIXER_RSP_CHANNELS] __attribute__((aligned(8)));
+	rsp_mixer_channel_t wv[MIXER_RSP_CHANNELS] __attribute__((aligned(8)));
+	mixer_fx15_t lp_a[MIXER_RSP_CHANNELS] __attribute__((aligned(8)));
+	mixer_fx15_t lp_b[MIXER_RSP_CHANNELS] __attribute__((aligned(8)));
+	uint32_t lp_groups;
+	uint32_t accumulate;
+	// Echo bus: delay line, its length, position, and (feedback<<16)|wet
+	// (ECHO_RDRAM...ECHO_WET), and send level of each slot (CHANNEL_SENDS).
+	uint32_t echo[4];
+	uint32_t send_enabled;
+	mixer_fx15_t send[MIXER_RSP_CHANNELS] __attribute__((aligned(8)));
+
+	// Permanent state of the ucode (XVOL_L, XVOL_R, LOWPASS_STATE). This is
+	// loaded from the state of each channel before the run, and saved back
+	// after it, so that channels can move between passes.
+	int16_t state[3][MIXER_RSP_CHANNELS] __attribute__((aligned(16)));
+} mixer_pass_t;
+
 typedef struct {
 	int max_bits;
 	float max_frequency;
@@ -94,10 +141,18 @@ typedef struct {
 
 typedef struct {
 	int64_t ticks;
+	uint32_t seq;
 	MixerEvent cb;
 	void *ctx;
 } mixer_event_t;
 
+typedef struct {
+	waveform_t *wave;
+	// Whole waveform followed by MIXER_LOOP_OVERREAD bytes of padding
+	uint8_t *mem;
+	int refcount;
+} mixer_resident_t;
+
 struct {
 	uint32_t sample_rate;
 	int num_channels;
@@ -106,19 +161,75 @@ struct {
 
 	int64_t ticks;
 	int num_events;
+	uint32_t event_seq;
 	mixer_event_t events[MAX_EVENTS];
 
 	uint8_t *ch_buf_mem;
 	samplebuffer_t ch_buf[MIXER_MAX_CHANNELS];
 	channel_limit_t limits[MIXER_MAX_CHANNELS];
 
+	// Waveforms fully loaded in memory (see mixer_waveform_preload)
+	mixer_resident_t resident[MIXER_MAX_RESIDENT];
+
 	mixer_channel_t channels[MIXER_MAX_CHANNELS];
 	mixer_fx15_t lvol[MIXER_MAX_CHANNELS];
 	mixer_fx15_t rvol[MIXER_MAX_CHANNELS];
-
-	// Permanent state of the ucode across different executions
-	uint8_t ucode_state[128] __attribute__((aligned(8)));
-
+	// Low-pass filter coefficient (0 = filter disabled)
+	mixer_fx15_t lowpass[MIXER_MAX_CHANNELS];
+	// Send level to the echo bus (see mixer_ch_set_send)
+	mixer_fx15_t send[MIXER_MAX_CHANNELS];
+
+	// Echo bus (see mixer_set_echo): delay line of echo_len stereo frames
+	// (NULL if disabled), current position in it, and levels.
+	int32_t *echo_buf;
+	int echo_len;
+	int echo_pos;
+	mixer_fx15_t echo_feedback;
+	mixer_fx15_t echo_wet;
+
+	// Permanent state of the ucode for each channel (see mixer_pass_t)
+	int16_t xvol_l[MIXER_MAX_CHANNELS];
+	int16_t xvol_r[MIXER_MAX_CHANNELS];
+	int16_t lp_state[MIXER_MAX_CHANNELS];
+	// Same state, for the slot of the right samples of stereo channels
+	int16_t xvol_sub[MIXER_MAX_CHANNELS];
+	int16_t lp_state_sub[MIXER_MAX_CHANNELS];
+
+	// Voice pool (see mixer_voice_play). The generation counter of each
+	// channel is bumped every time a new voice starts on it, so that the
+	// handles of the previous voices become invalid.
+	int voice_first;
+	int voice_num;
+	int voice_prio[MIXER_MAX_CHANNELS];
+	uint16_t voice_gen[MIXER_MAX_CHANNELS];
+	// Start order of the voice on each channel, to steal the oldest one
+	// among equally important and loud voices.
+	uint32_t voice_seq[MIXER_MAX_CHANNELS];
+	uint32_t voice_next_seq;
+
+	// Profiling counters (see mixer_get_stats)
+	mixer_stats_t stats;
+
+	// RSP passes (one per batch of channels) of the current mixing. There
+	// are two sets, used in turns, so that the tasks of a mixing are never
+	// reused while the queue is still completing the previous one.
+	mixer_pass_t passes[2][MIXER_MAX_PASSES];
+	int pass_set;
+	int num_passes;
+
+	// Mixing in progress on the RSP (see mixer_poll_async)
+	volatile bool async_busy;
+	// Audio buffers refilled from the interrupts (see mixer_set_low_latency)
+	bool low_latency;
+	int16_t *async_out;
+	int async_num_samples;
+
+	// Audio buffer being refilled from the interrupts, and number of samples
+	// mixed so far. The buffer is mixed in parts split by the events, each one
+	// started when the previous one is complete (see mixer_fill_continue).
+	int16_t *fill_buf;
+	int fill_len;
+	int fill_done;
 } Mixer;
 
 /** @brief Count of ticks spent in mixer RSP, used for debugging purposes. */
@@ -126,6 +237,17 @@ int64_t __mixer_profile_rsp = 0;
 
 static inline int mixer_initialized(void) { return Mixer.num_channels != 0; }
 
+// Size of a buffer allocated with malloc_uncached, as accounted to MEM_TAG_MIXER.
+static inline size_t mixer_mem_size(void *mem) { return malloc_usable_size(CachedAddr(mem)); }
+
+// Implemented in audio.c: hold an audio buffer back from the AI while the RSP
+// is still writing into it.
+void __audio_buffer_set_pending(short *buffer, bool pending);
+
+static void mixer_async_wait(void);
+static void mixer_fill_continue(void);
+static void mixer_pass_add_channel(mixer_pass_t *pass, int ch, bool sub, bool fake_loop);
+
 void mixer_init(int num_channels) {
 	memset(&Mixer, 0, sizeof(Mixer));
 
@@ -163,19 +285,22 @@ static void mixer_init_samplebuffers(void) {
 			bufsize[i] = Mixer.limits[i].max_buf_sz;
 
 		assert((bufsize[i] % 8) == 0);
-		totsize += bufsize[i];
+		totsize += bufsize[i] + MIXER_LOOP_OVERREAD;
 	}
 
 	// Do one large allocations for all sample buffers
 	assert(Mixer.ch_buf_mem == NULL);
-	Mixer.ch_buf_mem = malloc(totsize);
+	// Sample buffers are only accessed through uncached memory, as well as the
+	// padding after each of them required by ring mode (see samplebuffer_set_ring).
+	Mixer.ch_buf_mem = malloc_uncached(totsize);
 	assert(Mixer.ch_buf_mem != NULL);
+	sys_mem_tag_alloc(MEM_TAG_MIXER, mixer_mem_size(Mixer.ch_buf_mem));
 	uint8_t *cur = Mixer.ch_buf_mem;
 
-	// Initialize the sample buffers
+	// Initialize the sample buffers.
 	for (int i=0;i<Mixer.num_channels;i++) {
 		samplebuffer_init(&Mixer.ch_buf[i], cur, bufsize[i]);
-		cur += bufsize[i];
+		cur += bufsize[i] + MIXER_LOOP_OVERREAD;
 	}
 
 	assert(cur == Mixer.ch_buf_mem+totsize);
@@ -187,32 +312,144 @@ void mixer_set_vol(float vol) {
 
 void mixer_close(void) {
 	assert(mixer_initialized());
+	if (Mixer.low_latency)
+		mixer_set_low_latency(false);
+	mixer_async_wait();
 
 	if (Mixer.ch_buf_mem) {
-		free(Mixer.ch_buf_mem);
+		sys_mem_tag_free(MEM_TAG_MIXER, mixer_mem_size(Mixer.ch_buf_mem));
+		free_uncached(Mixer.ch_buf_mem);
 		Mixer.ch_buf_mem = NULL;
 	}
 
+	for (int i=0;i<MIXER_MAX_RESIDENT;i++) {
+		if (Mixer.resident[i].mem) {
+			sys_mem_tag_free(MEM_TAG_MIXER, mixer_mem_size(Mixer.resident[i].mem));
+			free_uncached(Mixer.resident[i].mem);
+		}
+		Mixer.resident[i] = (mixer_resident_t){0};
+	}
+
+	if (Mixer.echo_buf) {
+		sys_mem_tag_free(MEM_TAG_MIXER, mixer_mem_size(Mixer.echo_buf));
+		free_uncached(Mixer.echo_buf);
+		Mixer.echo_buf = NULL;
+	}
+
 	Mixer.num_channels = 0;
 }
 
 void mixer_ch_set_freq(int ch, float frequency) {
 	mixer_channel_t *c = &Mixer.channels[ch];
-	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_set_freq: cannot call on secondary stereo channel %d", ch);
 	c->step = MIXER_FX64(frequency / (float)Mixer.sample_rate) << (c->flags & CH_FLAGS_BPS_SHIFT);
 }
 
 void mixer_ch_set_vol(int ch, float lvol, float rvol) {
-	mixer_channel_t *c = &Mixer.channels[ch];
-	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_set_vol: cannot call on secondary stereo channel %d", ch);
 	Mixer.lvol[ch] = MIXER_FX15(lvol);
 	Mixer.rvol[ch] = MIXER_FX15(rvol);
 }
 
+void mixer_ch_set_lowpass(int ch, float cutoff) {
+	if (cutoff <= 0 || cutoff >= Mixer.sample_rate * 0.5f) {
+		Mixer.lowpass[ch] = 0;
+		return;
+	}
+
+	// Coefficient of the one-pole filter y = y + a*(x-y) for the
+	// requested cutoff frequency.
+	float alpha = 1.0f - expf(-2.0f * (float)M_PI * cutoff / (float)Mixer.sample_rate);
+	mixer_fx15_t a = MIXER_FX15(alpha);
+	Mixer.lowpass[ch] = a > 0 ? a : 1;
+}
+
+void mixer_ch_set_send(int ch, float level) {
+	Mixer.send[ch] = level > 0 ? MIXER_FX15(level) : 0;
+}
+
+void mixer_set_echo(float delay, float feedback, float wet) {
+	assert(mixer_initialized());
+	int len = delay * Mixer.sample_rate;
+
+	// The delay line is read and written by the RSP, so stop the mixing
+	// before replacing it.
+	if (len != Mixer.echo_len) {
+		mixer_async_wait();
+		if (Mixer.echo_buf) {
+			sys_mem_tag_free(MEM_TAG_MIXER, mixer_mem_size(Mixer.echo_buf));
+			free_uncached(Mixer.echo_buf);
+			Mixer.echo_buf = NULL;
+		}
+		if (len > 0) {
+			// Add 8 bytes, as the RSP DMA might write the frame after the
+			// last one (preserving its value).
+			Mixer.echo_buf = malloc_uncached(len * 4 + 8);
+			assertf(Mixer.echo_buf, "not enough memory for the echo delay line");
+			memset(Mixer.echo_buf, 0, len * 4 + 8);
+			sys_mem_tag_alloc(MEM_TAG_MIXER, mixer_mem_size(Mixer.echo_buf));
+		}
+		Mixer.echo_len = len > 0 ? len : 0;
+		Mixer.echo_pos = 0;
+	}
+
+	Mixer.echo_feedback = feedback > 0 ? MIXER_FX15(feedback) : 0;
+	Mixer.echo_wet = wet > 0 ? MIXER_FX15(wet) : 0;
+}
+
 void mixer_ch_set_vol_pan(int ch, float vol, float pan) {
 	mixer_ch_set_vol(ch, vol * (1.f - pan), vol * pan);
 }
 
+void mixer_spatial_update(const mixer_listener_t *l, const mixer_emitter_t *emitters, int num_emitters) {
+	assert(mixer_initialized());
+
+	// Constant parts of the conversions to fixed point, hoisted out of the loop
+	const float vol_fx = (float)((1<<MIXER_FX15_FRAC)-1) * 0.5f;
+	const float freq_fx = (float)(1<<MIXER_FX64_FRAC) / (float)Mixer.sample_rate;
+	const float c = l->speed_of_sound;
+	const float ref = l->ref_dist;
+	const float max2 = l->max_dist * l->max_dist;
+
+	for (int i=0;i<num_emitters;i++) {
+		const mixer_emitter_t *e = &emitters[i];
+		assertf(e->ch >= 0 && e->ch < Mixer.num_channels, "invalid channel: %d", e->ch);
+
+		float dx = e->pos.x - l->pos.x;
+		float dy = e->pos.y - l->pos.y;
+		float dz = e->pos.z - l->pos.z;
+		float d2 = dx*dx + dy*dy + dz*dz;
+		float gain = 0, x = 0, freq = e->frequency;
+
+		if (d2 < max2) {
+			float dist = sqrtf(d2);
+			float inv = dist > 1e-6f ? 1.0f / dist : 0;
+
+			gain = dist <= ref ? e->vol : e->vol * ref / (ref + l->rolloff * (dist - ref));
+
+			// Position along the right axis of the listener, in [-1..1]
+			x = (dx*l->right.x + dy*l->right.y + dz*l->right.z) * inv;
+			if (x > 1) x = 1;
+			if (x < -1) x = -1;
+
+			if (c > 0) {
+				// Speeds towards the other end of the listener-emitter line
+				float vl = (dx*l->vel.x + dy*l->vel.y + dz*l->vel.z) * inv;
+				float ve = (dx*e->vel.x + dy*e->vel.y + dz*e->vel.z) * inv;
+				float den = c + ve;
+				if (den < c * 0.1f) den = c * 0.1f;
+				freq *= (c + vl > 0 ? c + vl : 0) / den;
+			}
+		}
+
+		// Same panning law of mixer_ch_set_vol_pan, with pan = (1+x)/2
+		float g = gain * vol_fx;
+		Mixer.lvol[e->ch] = (mixer_fx15_t)(g * (1.f - x));
+		Mixer.rvol[e->ch] = (mixer_fx15_t)(g * (1.f + x));
+
+		mixer_channel_t *ch = &Mixer.channels[e->ch];
+		ch->step = (mixer_fx64_t)(int64_t)(freq * freq_fx) << (ch->flags & CH_FLAGS_BPS_SHIFT);
+	}
+}
+
 void mixer_ch_set_vol_dolby(int ch, float fl, float fr,
 	float c, float sl, float sr) {
 
@@ -257,10 +494,27 @@ static int waveform_wrap_wpos(int wpos, int len, int loop_len) {
 // in the range [0, len].
 static void waveform_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
 	waveform_t *wave = (waveform_t*)ctx;
+	uint32_t t0 = TICKS_READ();
+
+	// The sample buffer only requests a seeking read after having been flushed.
+	Mixer.stats.ch_refills[sbuf - Mixer.ch_buf]++;
+	if (seeking)
+		Mixer.stats.flushes++;
 
 	if (!wave->loop_len) {
-		// No loop defined: just call the waveform's read function.
-		wave->read(wave->ctx, sbuf, wpos, wlen, seeking);
+		// No loop defined: just call the waveform's read function. In ring
+		// mode, the mixer might ask for samples past the end of the waveform:
+		// pad them with silence, as the RSP might play them while following
+		// the wrap point of the buffer (see mixer_pass_add_channel).
+		int len1 = wlen;
+		if (wpos + wlen > wave->len)
+			len1 = wave->len > wpos ? wave->len - wpos : 0;
+		if (len1 > 0)
+			wave->read(wave->ctx, sbuf, wpos, len1, seeking);
+		if (len1 < wlen) {
+			int nbytes = (wlen - len1) << SAMPLES_BPS_SHIFT(sbuf);
+			memset(samplebuffer_append(sbuf, wlen - len1), 0, nbytes);
+		}
 	} else {
 		// Calculate wrapped position
 		if (wpos >= wave->len)
@@ -301,12 +555,38 @@ static void waveform_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, b
 			len2 -= ns;
 		}
 	}
+
+	Mixer.stats.read_ticks += TICKS_READ() - t0;
+}
+
+// Configure the mixer channel structure used by the RSP ucode to play a waveform
+static void mixer_ch_configure(int ch, waveform_t *wave, int bps) {
+	mixer_channel_t *c = &Mixer.channels[ch];
+
+	assertf(wave->len >= 0 && wave->len <= WAVEFORM_MAX_LEN, "waveform %s: invalid length %x", wave->name, wave->len);
+	assertf(wave->len != WAVEFORM_UNKNOWN_LEN || wave->loop_len == 0, "waveform %s with unknown length cannot loop", wave->name);
+	c->flags = bps | (wave->channels == 2 ? CH_FLAGS_STEREO : 0) | (wave->bits == 16 ? CH_FLAGS_16BIT : 0);
+	c->len = MIXER_FX64((int64_t)wave->len) << bps;
+	c->loop_len = MIXER_FX64((int64_t)wave->loop_len) << bps;
+	mixer_ch_set_freq(ch, wave->frequency);
+
+	tracef("mixer_ch_play: ch=%d len=%llx loop_len=%llx wave=%s\n", ch, c->len >> (MIXER_FX64_FRAC+bps), c->loop_len >> (MIXER_FX64_FRAC+bps), wave->name);
+}
+
+static mixer_resident_t* mixer_find_resident(waveform_t *wave) {
+	for (int i=0;i<MIXER_MAX_RESIDENT;i++)
+		if (Mixer.resident[i].wave == wave)
+			return &Mixer.resident[i];
+	return NULL;
 }
 
 void mixer_ch_play(int ch, waveform_t *wave) {
 	samplebuffer_t *sbuf = &Mixer.ch_buf[ch];
 	mixer_channel_t *c = &Mixer.channels[ch];
 
+	// The RSP might still be reading the sample buffer and updating positions
+	mixer_async_wait();
+
 	if (!Mixer.ch_buf_mem) {
 		// If we have not yet allocated the memory for the sample buffers,
 		// this is a good moment to do so, as we might need the configure
@@ -314,6 +594,22 @@ void mixer_ch_play(int ch, waveform_t *wave) {
 		mixer_init_samplebuffers();
 	}
 
+	mixer_resident_t *res = mixer_find_resident(wave);
+	if (res) {
+		// The whole waveform is already in memory, shared with the other
+		// channels playing it: point the RSP straight at it. The sample
+		// buffer of the channel is not used, so forget what it contains.
+		samplebuffer_flush(sbuf);
+		sbuf->wv_ctx = NULL;
+
+		int bps = (wave->channels == 2 ? 1 : 0) + (wave->bits == 16 ? 1 : 0);
+		mixer_ch_configure(ch, wave, bps);
+		c->flags |= CH_FLAGS_RESIDENT;
+		c->ptr = res->mem;
+		c->pos = 0;
+		return;
+	}
+
 	// Configure the waveform on this channel, if we have not
 	// already. This optimization is useful in case the caller
 	// wants to play the same waveform on the same channel multiple
@@ -328,23 +624,12 @@ void mixer_ch_play(int ch, waveform_t *wave) {
 		samplebuffer_set_bps(sbuf, wave->bits*wave->channels);
 		samplebuffer_set_waveform(sbuf, wave->read ? waveform_read : NULL, wave);
 
-		// Configure the mixer channel structured used by the RSP ucode
-		assertf(wave->len >= 0 && wave->len <= WAVEFORM_MAX_LEN, "waveform %s: invalid length %x", wave->name, wave->len);
-		assertf(wave->len != WAVEFORM_UNKNOWN_LEN || wave->loop_len == 0, "waveform %s with unknown length cannot loop", wave->name);
-		int bps = SAMPLES_BPS_SHIFT(sbuf);
-		c->flags = bps | (wave->channels == 2 ? CH_FLAGS_STEREO : 0) | (wave->bits == 16 ? CH_FLAGS_16BIT : 0);
-		c->len = MIXER_FX64((int64_t)wave->len) << bps;
-		c->loop_len = MIXER_FX64((int64_t)wave->loop_len) << bps;
-		mixer_ch_set_freq(ch, wave->frequency);
-
-		if (wave->channels == 2) {
-			assertf(ch != Mixer.num_channels-1, "cannot configure last channel (%d) as stereo", ch);
-			Mixer.channels[ch+1].flags |= CH_FLAGS_STEREO_SUB;
-		} else if (ch != Mixer.num_channels-1) {
-			Mixer.channels[ch+1].flags &= ~CH_FLAGS_STEREO_SUB;
-		}
+		// Waveforms that are streamed through the sample buffer (that is,
+		// unless the whole loop can be cached, see mixer_exec_start) use
+		// the buffer in ring mode, so that samples are never moved.
+		samplebuffer_set_ring(sbuf, !wave->loop_len || wave->loop_len >= sbuf->size);
 
-		tracef("mixer_ch_play: ch=%d len=%llx loop_len=%llx wave=%s\n", ch, c->len >> (MIXER_FX64_FRAC+bps), c->loop_len >> (MIXER_FX64_FRAC+bps), wave->name);
+		mixer_ch_configure(ch, wave, SAMPLES_BPS_SHIFT(sbuf));
 	}
 
 	// Restart from the beginning of the waveform
@@ -353,23 +638,22 @@ void mixer_ch_play(int ch, waveform_t *wave) {
 }
 
 void mixer_ch_set_pos(int ch, float pos) {
+	mixer_async_wait();
 	mixer_channel_t *c = &Mixer.channels[ch];
-	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_set_pos: cannot call on secondary stereo channel %d", ch);
 	c->pos = MIXER_FX64(pos) << (c->flags & CH_FLAGS_BPS_SHIFT);
 }
 
 float mixer_ch_get_pos(int ch) {
+	mixer_async_wait();
 	mixer_channel_t *c = &Mixer.channels[ch];
-	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_get_pos: cannot call on secondary stereo channel %d", ch);
 	uint32_t pos = c->pos >> (c->flags & CH_FLAGS_BPS_SHIFT);
 	return (float)pos / (float)(1<<MIXER_FX64_FRAC);
 }
 
 void mixer_ch_stop(int ch) {
+	mixer_async_wait();
 	mixer_channel_t *c = &Mixer.channels[ch];
 	c->ptr = 0;
-	if (c->flags & CH_FLAGS_STEREO)
-		c[1].flags &= ~CH_FLAGS_STEREO_SUB;
 
 	// Restart caching if played again. We need this guarantee
 	// because after calling stop(), the caller must be able
@@ -380,7 +664,6 @@ void mixer_ch_stop(int ch) {
 
 bool mixer_ch_playing(int ch) {
 	mixer_channel_t *c = &Mixer.channels[ch];
-	assertf(!(c->flags & CH_FLAGS_STEREO_SUB), "mixer_ch_playing: cannot call on secondary stereo channel %d", ch);
 	return c->ptr != 0;
 }
 
@@ -398,14 +681,148 @@ void mixer_ch_set_limits(int ch, int max_bits, float max_frequency, int max_buf_
 	// Changing the limits will invalidate the whole sample buffer
 	// memory area. Invalidate all sample buffers.
 	if (Mixer.ch_buf_mem) {
+		mixer_async_wait();
 		for (int i=0;i<Mixer.num_channels;i++)
 			samplebuffer_close(&Mixer.ch_buf[i]);
-		free(Mixer.ch_buf_mem);
+		sys_mem_tag_free(MEM_TAG_MIXER, mixer_mem_size(Mixer.ch_buf_mem));
+		free_uncached(Mixer.ch_buf_mem);
 		Mixer.ch_buf_mem = NULL;
 	}
 }
 
-void mixer_exec(int32_t *out, int num_samples) {
+void mixer_voice_pool_init(int first_ch, int num_ch) {
+	assert(first_ch >= 0 && num_ch > 0 && first_ch + num_ch <= Mixer.num_channels);
+	Mixer.voice_first = first_ch;
+	Mixer.voice_num = num_ch;
+}
+
+mixer_voice_t mixer_voice_play(waveform_t *wave, int priority) {
+	assertf(Mixer.voice_num > 0, "mixer_voice_pool_init() must be called before mixer_voice_play()");
+	int best = -1, best_prio = 0, best_vol = 0;
+	uint32_t best_seq = 0;
+
+	// Find the channel whose current voice is the cheapest to stop.
+	for (int ch=Mixer.voice_first; ch < Mixer.voice_first+Mixer.voice_num; ch++) {
+		int prio = INT_MIN, vol = 0;
+		uint32_t seq = 0;
+		if (Mixer.channels[ch].ptr) {
+			prio = Mixer.voice_prio[ch];
+			vol = abs(Mixer.lvol[ch]) + abs(Mixer.rvol[ch]);
+			seq = Mixer.voice_seq[ch];
+		}
+
+		if (best < 0 || prio < best_prio || (prio == best_prio && (vol < best_vol ||
+			(vol == best_vol && (int32_t)(seq - best_seq) < 0)))) {
+			best = ch;
+			best_prio = prio;
+			best_vol = vol;
+			best_seq = seq;
+		}
+	}
+
+	if (best < 0 || best_prio > priority)
+		return MIXER_VOICE_NONE;
+
+	if (Mixer.channels[best].ptr)
+		mixer_ch_stop(best);
+	Mixer.voice_gen[best]++;
+
+	mixer_ch_play(best, wave);
+	Mixer.voice_prio[best] = priority;
+	Mixer.voice_seq[best] = Mixer.voice_next_seq++;
+	return (Mixer.voice_gen[best] << 8) | best;
+}
+
+int mixer_voice_channel(mixer_voice_t voice) {
+	if (voice == MIXER_VOICE_NONE)
+		return -1;
+	int ch = voice & 0xFF;
+	assertf(ch >= Mixer.voice_first && ch < Mixer.voice_first+Mixer.voice_num,
+		"mixer_voice_channel: invalid voice handle %08x", voice);
+	mixer_channel_t *c = &Mixer.channels[ch];
+	if (Mixer.voice_gen[ch] != (uint16_t)(voice >> 8) || !c->ptr)
+		return -1;
+	return ch;
+}
+
+void mixer_voice_stop(mixer_voice_t voice) {
+	int ch = mixer_voice_channel(voice);
+	if (ch >= 0)
+		mixer_ch_stop(ch);
+}
+
+void mixer_waveform_preload(waveform_t *wave) {
+	assert(mixer_initialized());
+	mixer_resident_t *res = mixer_find_resident(wave);
+	if (res) {
+		res->refcount++;
+		return;
+	}
+
+	assert(wave->channels == 1 || wave->channels == 2);
+	assert(wave->bits == 8 || wave->bits == 16);
+	assertf(wave->len >= 0 && wave->len != WAVEFORM_UNKNOWN_LEN && wave->len <= WAVEFORM_MAX_LEN,
+		"waveform %s: cannot preload a waveform of unknown length", wave->name);
+	assertf(wave->read, "waveform %s: cannot preload a waveform without read callback", wave->name);
+
+	res = mixer_find_resident(NULL);
+	assertf(res, "too many resident waveforms (max: %d)", MIXER_MAX_RESIDENT);
+
+	// Decode the whole waveform through a temporary sample buffer that covers
+	// the resident memory, so that any waveform implementation can be used.
+	int bits = wave->bits*wave->channels;
+	int nbytes = ROUND_UP(wave->len * (bits/8), 8) + MIXER_LOOP_OVERREAD;
+	uint8_t *mem = malloc_uncached(nbytes);
+	assert(mem);
+	sys_mem_tag_alloc(MEM_TAG_MIXER, mixer_mem_size(mem));
+
+	samplebuffer_t sbuf;
+	samplebuffer_init(&sbuf, mem, nbytes);
+	samplebuffer_set_bps(&sbuf, bits);
+	wave->read(wave->ctx, &sbuf, 0, wave->len, true);
+
+	// Fill the overread area after the end of the waveform. The RSP runs
+	// over it before following the loop (see MIXER_LOOP_OVERREAD), so it
+	// must repeat the loop start. Without a loop, it is never played.
+	int pad = sbuf.size - sbuf.widx;
+	if (wave->loop_len) {
+		while (pad > 0) {
+			int ns = MIN(pad, wave->loop_len);
+			wave->read(wave->ctx, &sbuf, wave->len - wave->loop_len, ns, true);
+			pad -= ns;
+		}
+	} else {
+		memset(samplebuffer_append(&sbuf, pad), 0, pad << SAMPLES_BPS_SHIFT(&sbuf));
+	}
+
+	*res = (mixer_resident_t){ .wave = wave, .mem = mem, .refcount = 1 };
+	tracef("mixer_waveform_preload: wave=%s len=%x bytes=%x\n", wave->name, wave->len, nbytes);
+}
+
+void mixer_waveform_release(waveform_t *wave) {
+	mixer_resident_t *res = mixer_find_resident(wave);
+	assertf(res, "waveform %s is not resident", wave->name);
+	if (--res->refcount > 0)
+		return;
+
+	// Stop the channels still reading the memory, before freeing it
+	for (int ch=0;ch<Mixer.num_channels;ch++) {
+		mixer_channel_t *c = &Mixer.channels[ch];
+		if ((c->flags & CH_FLAGS_RESIDENT) && c->ptr == res->mem)
+			mixer_ch_stop(ch);
+	}
+
+	mixer_async_wait();
+	sys_mem_tag_free(MEM_TAG_MIXER, mixer_mem_size(res->mem));
+	free_uncached(res->mem);
+	*res = (mixer_resident_t){0};
+}
+
+// Prepare the channels and start the RSP ucode to mix the next samples.
+static void mixer_exec_start(int32_t *out, int num_samples) {
+	// Wait for the previous asynchronous run, that updates the positions.
+	mixer_async_wait();
+
 	if (!Mixer.ch_buf_mem) {
 		// If we have not yet allocated the memory for the sample buffers,
 		// this is a good moment to do so.
@@ -414,7 +831,7 @@ void mixer_exec(int32_t *out, int num_samples) {
 
 	tracef("mixer_exec: 0x%x samples\n", num_samples);
 
-	uint32_t fake_loop = 0;
+	uint64_t fake_loop = 0;
 
 	for (int i=0; i<Mixer.num_channels; i++) {
 		samplebuffer_t *sbuf = &Mixer.ch_buf[i];
@@ -431,18 +848,27 @@ void mixer_exec(int32_t *out, int num_samples) {
 			assertf(wlen >= 0, "channel %d: wpos overflow", i);
 			tracef("ch:%d wpos:%x wlen:%x len:%x loop_len:%x sbuf_size:%x\n", i, wpos, wlen, len, loop_len, sbuf->size);
 
+			// If we reached the end of the waveform, stop the channel
+			// by NULL-ing the buffer pointer.
+			if (!loop_len && wpos >= len) {
+				ch->ptr = 0;
+				continue;
+			}
+
+			if (ch->flags & CH_FLAGS_RESIDENT) {
+				// The whole waveform is in memory (see mixer_waveform_preload),
+				// and ch->ptr already points to it. The RSP follows the loop
+				// by itself, as for a fully cached loop.
+				ch->ring_jump = 0;
+				continue;
+			}
+
 			if (!loop_len) {
-				// If we reached the end of the waveform, stop the channel
-				// by NULL-ing the buffer pointer.
-				if (wpos >= len) {
-					ch->ptr = 0;
-					if (ch->flags & CH_FLAGS_STEREO)
-						ch[1].flags &= ~CH_FLAGS_STEREO_SUB;
-					continue;
-				}
 				// When there's no loop, do not ask for more samples then
-				// actually present in the waveform.
-				if (wpos+wlen > len)
+				// actually present in the waveform. In ring mode instead,
+				// the missing samples are filled with silence (see
+				// waveform_read).
+				if (wpos+wlen > len && !sbuf->ring)
 					wlen = len-wpos;
 				assert(wlen >= 0);
 			} else if (loop_len < sbuf->size) {
@@ -492,134 +918,492 @@ void mixer_exec(int32_t *out, int num_samples) {
 				// no loop in this waveform, since the RSP will always see
 				// the loop unrolled in the buffer, so it doesn't need to
 				// do anything.
-				fake_loop |= 1<<i;
+				fake_loop |= 1ull<<i;
 			}
 
 			void* ptr = samplebuffer_get(sbuf, wpos, &wlen);
 			assert(ptr);
 			ch->ptr = (uint8_t*)ptr - (wpos<<bps);
+
+			// In ring mode, the samples might wrap around in the buffer.
+			// Record where, so that the RSP can follow the wrap point.
+			int jump;
+			int wrap_wpos = samplebuffer_get_wrap(sbuf, wpos, &jump);
+			ch->ring_wrap = (int64_t)wrap_wpos << bps_fx64;
+			ch->ring_jump = wrap_wpos >= 0 ? (int64_t)jump << bps_fx64 : 0;
 		}
 	}
 
-	rsp_wait();
-	rsp_load(&rsp_mixer);
-
-	volatile rsp_mixer_channel_t *rsp_wv = (volatile rsp_mixer_channel_t *)&SP_DMEM[36];
-	mixer_fx15_t lvol[MIXER_MAX_CHANNELS] __attribute__((aligned(8)));
-	mixer_fx15_t rvol[MIXER_MAX_CHANNELS] __attribute__((aligned(8)));
+	// Assign the playing channels to the RSP passes, in batches of
+	// MIXER_RSP_CHANNELS slots. Stopped channels are skipped so that they cost
+	// no RSP time. Their filter state is reset: the volume filter would
+	// have ramped down to zero anyway while the channel is keyed off.
+	// Stereo channels take two adjacent slots: the RSP fetches and resamples
+	// the interleaved samples once, writing the left samples into the first
+	// slot and the right ones into the second.
+	Mixer.pass_set ^= 1;
+	Mixer.num_passes = 0;
+	mixer_pass_t *passes = Mixer.passes[Mixer.pass_set];
+	mixer_pass_t *pass = NULL;
 
 	for (int ch=0;ch<Mixer.num_channels;ch++) {
 		mixer_channel_t *c = &Mixer.channels[ch];
 
-		// Stereo sub-channel. Will be ignored by RSP but we need to configure
-		// volume correctly.
-		if (c->flags & CH_FLAGS_STEREO_SUB) {
-			rsp_wv[ch].ptr = 0;
-			lvol[ch] = 0;
-			rvol[ch] = Mixer.rvol[ch-1];
+		if (!c->ptr) {
+			Mixer.xvol_l[ch] = Mixer.xvol_r[ch] = Mixer.xvol_sub[ch] = 0;
+			Mixer.lp_state[ch] = Mixer.lp_state_sub[ch] = 0;
 			continue;
 		}
 
-		// Check if the channel is stopped
-		if (!c->ptr) {
-			rsp_wv[ch].ptr = 0;
-			// Configure the volume to 0 when the channel is keyed off. This
-			// makes sure that we smooth volume correctly even for waveforms
-			// where the sequencer creates an a attack ramp (which would nullify
-			// the one-tap volume filter if the volume started from max).
-			lvol[ch] = 0;
-			rvol[ch] = 0;
-			continue;
+		int nslots = (c->flags & CH_FLAGS_STEREO) ? 2 : 1;
+		if (!pass || pass->num_channels + nslots > MIXER_RSP_CHANNELS) {
+			assert(Mixer.num_passes < MIXER_MAX_PASSES);
+			pass = &passes[Mixer.num_passes++];
+			pass->num_channels = 0;
 		}
 
-		// Convert to RSP mixer channel structure truncating 64-bit values to 32-bit.
-		// We don't need full absolute position on the RSP, so 32-bit is more
-		// than enough. In fact, we only expose 31 bits, so that we can use the
-		// 32th bit later to correctly update the position without overflow bugs.
-		rsp_wv[ch].pos = (uint32_t)c->pos & 0x7FFFFFFF;
-		rsp_wv[ch].step = (uint32_t)c->step & 0x7FFFFFFF;
-		rsp_wv[ch].ptr = c->ptr + ((c->pos & ~0x7FFFFFFF) >> MIXER_FX64_FRAC);
-		rsp_wv[ch].flags = c->flags;
+		for (int i=0;i<nslots;i++)
+			mixer_pass_add_channel(pass, ch, i == 1, fake_loop & (1ull<<ch));
+	}
+
+	// If no channel is playing, run a single pass with an empty channel
+	// to produce silence.
+	if (!Mixer.num_passes) {
+		pass = &passes[Mixer.num_passes++];
+		pass->num_channels = 0;
+		mixer_pass_add_channel(pass, -1, false, false);
+	}
 
+	for (int p=0;p<Mixer.num_passes;p++) {
+		pass = &passes[p];
+
+		// Low-pass filter coefficients. Unfiltered channels that share a group
+		// of 8 with a filtered one go through an (almost) transparent filter.
+		pass->lp_groups = 0;
+		for (int i=0;i<MIXER_RSP_CHANNELS;i++) {
+			mixer_fx15_t a = 0;
+			if (i < pass->num_channels && pass->chmap[i] >= 0)
+				a = Mixer.lowpass[pass->chmap[i]];
+
+			if (a) {
+				pass->lp_groups |= 1 << (i / 8);
+				pass->lp_a[i] = a;
+				pass->lp_b[i] = 0x8000 - a;
+			} else {
+				pass->lp_a[i] = 0x7FFF;
+				pass->lp_b[i] = 1;
+			}
+		}
+
+		// Load the ucode state from the state of the channels. The RSP
+		// will read and write it via DMA.
+		for (int i=0;i<MIXER_RSP_CHANNELS;i++) {
+			int ch = i < pass->num_channels ? pass->chmap[i] : -1;
+			if (ch >= 0 && pass->chsub[i]) {
+				// The right samples of a stereo channel are never mixed to the left
+				pass->state[0][i] = 0;
+				pass->state[1][i] = Mixer.xvol_sub[ch];
+				pass->state[2][i] = Mixer.lp_state_sub[ch];
+			} else {
+				pass->state[0][i] = ch >= 0 ? Mixer.xvol_l[ch] : 0;
+				pass->state[1][i] = ch >= 0 ? Mixer.xvol_r[ch] : 0;
+				pass->state[2][i] = ch >= 0 ? Mixer.lp_state[ch] : 0;
+			}
+		}
+		data_cache_hit_writeback_invalidate(pass->state, sizeof(pass->state));
+
+		// All passes after the first one add their channels to the output
+		// of the previous ones.
+		pass->accumulate = p > 0;
+
+		// Echo bus. All passes process the same part of the delay line: the
+		// first one plays it back, and each one adds the sends of its
+		// channels. The two slots of a stereo channel share its send level.
+		pass->echo[0] = (uint32_t)Mixer.echo_buf;
+		pass->echo[1] = Mixer.echo_len;
+		pass->echo[2] = Mixer.echo_pos;
+		pass->echo[3] = ((uint32_t)(uint16_t)Mixer.echo_feedback << 16) | (uint16_t)Mixer.echo_wet;
+		pass->send_enabled = 0;
+		for (int i=0;i<MIXER_RSP_CHANNELS;i++) {
+			int ch = i < pass->num_channels ? pass->chmap[i] : -1;
+			mixer_fx15_t send = 0;
+			if (ch >= 0 && Mixer.echo_buf) {
+				send = Mixer.send[ch];
+				if (Mixer.channels[ch].flags & CH_FLAGS_STEREO)
+					send >>= 1;
+			}
+			pass->send[i] = send;
+			pass->send_enabled |= send != 0;
+		}
+
+		pass->args[0] = MIXER_FX16(Mixer.vol);
+		pass->args[1] = (num_samples << 16) | pass->num_channels;
+		pass->args[2] = (uint32_t)out;
+		pass->args[3] = (uint32_t)pass->state;
+	}
+
+	if (Mixer.echo_buf)
+		Mixer.echo_pos = (Mixer.echo_pos + num_samples) % Mixer.echo_len;
+}
+
+// Add a mixer channel to the next slot of a RSP pass (or an unused slot if
+// ch is -1), converting its playback state to the ucode format. If sub is
+// true, the slot receives the right samples of the stereo channel ch.
+static void mixer_pass_add_channel(mixer_pass_t *pass, int ch, bool sub, bool fake_loop) {
+	int slot = pass->num_channels++;
+	rsp_mixer_channel_t *rsp_wv = &pass->wv[slot];
+
+	pass->chmap[slot] = ch;
+	pass->chsub[slot] = sub;
+	if (ch < 0) {
+		rsp_wv->ptr = 0;
+		pass->lvol[slot] = 0;
+		pass->rvol[slot] = 0;
+		return;
+	}
+
+	mixer_channel_t *c = &Mixer.channels[ch];
+
+	// Right samples of a stereo channel. The slot is filled by the RSP
+	// while resampling the previous one, but we need to configure the
+	// volume correctly.
+	if (sub) {
+		rsp_wv->ptr = 0;
+		pass->lvol[slot] = 0;
+		pass->rvol[slot] = Mixer.rvol[ch];
+		return;
+	}
+
+	// Convert to RSP mixer channel structure truncating 64-bit values to 32-bit.
+	// We don't need full absolute position on the RSP, so 32-bit is more
+	// than enough. In fact, we only expose 31 bits, so that we can use the
+	// 32th bit later to correctly update the position without overflow bugs.
+	rsp_wv->pos = (uint32_t)c->pos & 0x7FFFFFFF;
+	rsp_wv->step = (uint32_t)c->step & 0x7FFFFFFF;
+	rsp_wv->ptr = c->ptr + ((c->pos & ~0x7FFFFFFF) >> MIXER_FX64_FRAC);
+	rsp_wv->flags = c->flags;
+
+	if (c->ring_jump) {
+		// The samples wrap around in the sample buffer. The RSP can follow
+		// the wrap point as if it was a loop: when it gets there, it jumps
+		// back to the start of the buffer. Notice that this channel doesn't
+		// have a loop of its own (see mixer_ch_play), and any sample past the
+		// end of the waveform is silence, so we don't need to tell the RSP
+		// where the waveform ends.
+		// The position exposed to the RSP must be large enough that the jump
+		// doesn't make it negative, so truncate it differently (to a
+		// multiple of 8 bytes, as the difference is moved into the pointer).
+		mixer_fx64_t base = c->pos - c->ring_jump;
+		base = base > 0 ? base & ~(mixer_fx64_t)((8<<MIXER_FX64_FRAC)-1) : 0;
+		rsp_wv->pos = (uint32_t)(c->pos - base);
+		rsp_wv->ptr = c->ptr + (base >> MIXER_FX64_FRAC);
+		rsp_wv->len = (uint32_t)(c->ring_wrap - base);
+		rsp_wv->loop_len = (uint32_t)c->ring_jump;
+	} else if (fake_loop || c->pos>>31 != c->len>>31) {
 		// If the loop is fake (i.e. we are unrolling it), or the current
 		// position has been truncated but it's far from the end of the waveform,
 		// just tell the RSP that there is no loop.
-		if (fake_loop & (1<<ch) || c->pos>>31 != c->len>>31) {
-			rsp_wv[ch].len = 0xFFFFFFFF;
-			rsp_wv[ch].loop_len = 0;
-		} else {
-			rsp_wv[ch].len = (uint32_t)c->len & 0x7FFFFFFF;
-			// We can't represent a very long loop in RSP. But those loops
-			// should be unrolled anyway (and thus be a fake_loop), so we
-			// should not get here.
-			assert(c->loop_len <= 0x7FFFFFFF);
-			rsp_wv[ch].loop_len = (uint32_t)c->loop_len & 0x7FFFFFFF;
-		}
+		rsp_wv->len = 0xFFFFFFFF;
+		rsp_wv->loop_len = 0;
+	} else {
+		rsp_wv->len = (uint32_t)c->len & 0x7FFFFFFF;
+		// We can't represent a very long loop in RSP. But those loops
+		// should be unrolled anyway (and thus be a fake_loop), so we
+		// should not get here.
+		assert(c->loop_len <= 0x7FFFFFFF);
+		rsp_wv->loop_len = (uint32_t)c->loop_len & 0x7FFFFFFF;
+	}
 
-		if (c->flags & CH_FLAGS_STEREO) {
-			lvol[ch] = Mixer.lvol[ch];
-			rvol[ch] = 0;
-		} else {
-			lvol[ch] = Mixer.lvol[ch];
-			rvol[ch] = Mixer.rvol[ch];
-		}
+	if (c->flags & CH_FLAGS_STEREO) {
+		pass->lvol[slot] = Mixer.lvol[ch];
+		pass->rvol[slot] = 0;
+	} else {
+		pass->lvol[slot] = Mixer.lvol[ch];
+		pass->rvol[slot] = Mixer.rvol[ch];
 	}
+}
+
+// Task setup: copy the input of the pass prepared by mixer_exec_start into DMEM.
+static void mixer_task_setup(rsp_task_t *task) {
+	mixer_pass_t *pass = task->ctx;
+
+	for (int i=0;i<4;i++)
+		SP_DMEM[i] = pass->args[i];
 
 	// Copy the volumes into DMEM. TODO: check if should change this loop into
-	// a DMA copy, or fold it into the above loop.
-	uint32_t *lvol32 = (uint32_t*)lvol;
-	uint32_t *rvol32 = (uint32_t*)rvol;
-	for (int ch=0;ch<MIXER_MAX_CHANNELS/2;ch++)  {
+	// a DMA copy.
+	uint32_t *lvol32 = (uint32_t*)pass->lvol;
+	uint32_t *rvol32 = (uint32_t*)pass->rvol;
+	for (int ch=0;ch<MIXER_RSP_CHANNELS/2;ch++)  {
 		SP_DMEM[4+0*16+ch] = lvol32[ch];
 		SP_DMEM[4+1*16+ch] = rvol32[ch];
 	}
 
-	SP_DMEM[0] = MIXER_FX16(Mixer.vol);
-	SP_DMEM[1] = (num_samples << 16) | Mixer.num_channels;
-	SP_DMEM[2] = (uint32_t)out;
-	SP_DMEM[3] = (uint32_t)Mixer.ucode_state;
+	uint32_t *wv32 = (uint32_t*)pass->wv;
+	for (int i=0;i<pass->num_channels*6;i++)
+		SP_DMEM[36+i] = wv32[i];
+
+	// Low-pass coefficients (CHANNEL_LOWPASS_A/B and LOWPASS_GROUPS), only
+	// needed when at least one channel is filtered.
+	SP_DMEM[260] = pass->lp_groups;
+	if (pass->lp_groups) {
+		uint32_t *lpa32 = (uint32_t*)pass->lp_a;
+		uint32_t *lpb32 = (uint32_t*)pass->lp_b;
+		for (int ch=0;ch<MIXER_RSP_CHANNELS/2;ch++) {
+			SP_DMEM[228+ch] = lpa32[ch];
+			SP_DMEM[244+ch] = lpb32[ch];
+		}
+	}
 
-	uint32_t t0 = TICKS_READ();
-	rsp_run();
-	__mixer_profile_rsp += TICKS_READ() - t0;
+	SP_DMEM[261] = pass->accumulate;
 
-	for (int i=0;i<Mixer.num_channels;i++) {
-		mixer_channel_t *ch = &Mixer.channels[i];
-		ch->pos += (uint64_t)rsp_wv[i].pos - (uint64_t)(ch->pos & 0x7FFFFFFF);
+	// Echo bus (ECHO_RDRAM...SEND_ENABLED, and CHANNEL_SENDS)
+	for (int i=0;i<4;i++)
+		SP_DMEM[262+i] = pass->echo[i];
+	SP_DMEM[266] = pass->send_enabled;
+	if (pass->send_enabled) {
+		uint32_t *send32 = (uint32_t*)pass->send;
+		for (int ch=0;ch<MIXER_RSP_CHANNELS/2;ch++)
+			SP_DMEM[268+ch] = send32[ch];
+	}
+}
+
+// Read back the state of the channels after the RSP ucode has run a pass.
+static void mixer_exec_finish(mixer_pass_t *pass, uint32_t rsp_ticks) {
+	volatile rsp_mixer_channel_t *rsp_wv = (volatile rsp_mixer_channel_t *)&SP_DMEM[36];
+
+	__mixer_profile_rsp += rsp_ticks;
+
+	Mixer.stats.rsp_ticks += rsp_ticks;
+	Mixer.stats.rsp_runs++;
+	if (rsp_ticks > Mixer.stats.rsp_max_ticks)
+		Mixer.stats.rsp_max_ticks = rsp_ticks;
+
+	data_cache_hit_invalidate(pass->state, sizeof(pass->state));
+
+	for (int i=0;i<pass->num_channels;i++) {
+		int ch = pass->chmap[i];
+		if (ch < 0)
+			continue;
+
+		if (pass->chsub[i]) {
+			Mixer.xvol_sub[ch] = pass->state[1][i];
+			Mixer.lp_state_sub[ch] = pass->state[2][i];
+			continue;
+		}
+
+		// If the RSP followed a wrap point of the sample buffer, its
+		// position has been moved back. The actual position in the
+		// waveform has just advanced by the number of mixed samples.
+		mixer_channel_t *c = &Mixer.channels[ch];
+		if (c->ring_jump)
+			c->pos += c->step * Mixer.async_num_samples;
+		else
+			c->pos += (uint64_t)rsp_wv[i].pos - (uint64_t)(c->pos & 0x7FFFFFFF);
+
+		Mixer.xvol_l[ch] = pass->state[0][i];
+		Mixer.xvol_r[ch] = pass->state[1][i];
+		Mixer.lp_state[ch] = pass->state[2][i];
+	}
+}
+
+// Last pass of the current mixing.
+static inline mixer_pass_t* mixer_last_pass(void) {
+	return &Mixer.passes[Mixer.pass_set][Mixer.num_passes-1];
+}
+
+// Task completion (from the SP interrupt, when mixing asynchronously).
+static void mixer_task_done(rsp_task_t *task) {
+	mixer_pass_t *pass = task->ctx;
+
+	mixer_exec_finish(pass, task->rsp_ticks);
+
+	// After the last pass, the output is complete
+	if (pass == mixer_last_pass()) {
+		Mixer.stats.samples += Mixer.async_num_samples;
+		Mixer.async_busy = false;
+	}
+}
+
+// Notification of the last pass, once the RSP queue has moved on. This is
+// where the next mixing is started, as task callbacks cannot submit tasks.
+static void mixer_task_notify(rsp_task_t *task) {
+	// Mix the next part of the buffer being refilled from the interrupts
+	if (Mixer.fill_buf) {
+		mixer_fill_continue();
+		return;
 	}
 
+	// Send the audio buffer to the AI. In low latency mode, this also
+	// starts the refill of the next one.
+	int16_t *out = Mixer.async_out;
+	if (out) {
+		Mixer.async_out = NULL;
+		__audio_buffer_set_pending(out, false);
+	}
+}
+
+// Queue the passes of the mixer ucode on the RSP, with the input from
+// mixer_exec_start.
+static void mixer_exec_submit(int32_t *out, int num_samples, int16_t *async_buf) {
+	disable_interrupts();
+	Mixer.async_out = async_buf;
+	Mixer.async_num_samples = num_samples;
+	Mixer.async_busy = true;
+	if (async_buf)
+		__audio_buffer_set_pending((short*)async_buf, true);
+	enable_interrupts();
+
+	// Advance the mixer clock as soon as the samples are scheduled, so that
+	// events are triggered at the correct time even when mixing asynchronously.
 	Mixer.ticks += num_samples;
+
+	for (int p=0;p<Mixer.num_passes;p++) {
+		mixer_pass_t *pass = &Mixer.passes[Mixer.pass_set][p];
+		pass->task = (rsp_task_t){
+			.ucode = &rsp_mixer,
+			.setup = mixer_task_setup,
+			.done = mixer_task_done,
+			.notify = p == Mixer.num_passes-1 ? mixer_task_notify : NULL,
+			.ctx = pass,
+		};
+		rsp_task_submit(&pass->task);
+	}
 }
 
-static mixer_event_t* mixer_next_event(void) {
-	mixer_event_t *e = NULL;
-	for (int i=0;i<Mixer.num_events;i++) {
-		if (!e || Mixer.events[i].ticks < e->ticks)
-			e = &Mixer.events[i];
+// Wait for the asynchronous mixing. The notification of a run might start
+// the next part of a buffer refilled from the interrupts, so keep waiting
+// until the whole buffer is mixed.
+static void mixer_async_wait(void) {
+	while (Mixer.async_busy)
+		rsp_task_wait(&mixer_last_pass()->task);
+}
+
+void mixer_exec(int32_t *out, int num_samples) {
+	mixer_exec_start(out, num_samples);
+	mixer_exec_submit(out, num_samples, NULL);
+	rsp_task_wait(&mixer_last_pass()->task);
+}
+
+// Start mixing asynchronously: the run is completed by mixer_task_done.
+// If buf is not NULL, it is the audio buffer that is marked as pending until
+// the run is complete.
+static void mixer_exec_async(int32_t *out, int num_samples, int16_t *buf) {
+	mixer_exec_start(out, num_samples);
+	mixer_exec_submit(out, num_samples, buf);
+}
+
+void mixer_get_stats(mixer_stats_t *stats) {
+	*stats = Mixer.stats;
+}
+
+void mixer_reset_stats(void) {
+	memset(&Mixer.stats, 0, sizeof(Mixer.stats));
+}
+
+// Events are kept in a binary min-heap ordered by ticks, so that the next
+// event to trigger is always the first one. Events due on the same tick are
+// ordered by insertion sequence number, so that they trigger in the order
+// they were added.
+static bool mixer_event_before(mixer_event_t *a, mixer_event_t *b) {
+	if (a->ticks != b->ticks)
+		return a->ticks < b->ticks;
+	return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static void mixer_event_swap(int i, int j) {
+	mixer_event_t tmp = Mixer.events[i];
+	Mixer.events[i] = Mixer.events[j];
+	Mixer.events[j] = tmp;
+}
+
+static void mixer_event_sift_up(int i) {
+	while (i > 0) {
+		int parent = (i-1) / 2;
+		if (!mixer_event_before(&Mixer.events[i], &Mixer.events[parent]))
+			break;
+		mixer_event_swap(i, parent);
+		i = parent;
+	}
+}
+
+static void mixer_event_sift_down(int i) {
+	while (1) {
+		int l = 2*i+1, r = 2*i+2, min = i;
+		if (l < Mixer.num_events && mixer_event_before(&Mixer.events[l], &Mixer.events[min]))
+			min = l;
+		if (r < Mixer.num_events && mixer_event_before(&Mixer.events[r], &Mixer.events[min]))
+			min = r;
+		if (min == i)
+			break;
+		mixer_event_swap(i, min);
+		i = min;
 	}
-	return e;
+}
+
+static void mixer_event_push(mixer_event_t ev) {
+	assertf(Mixer.num_events < MAX_EVENTS, "mixer: too many events (max: %d)", MAX_EVENTS);
+	ev.seq = Mixer.event_seq++;
+	Mixer.events[Mixer.num_events] = ev;
+	mixer_event_sift_up(Mixer.num_events++);
+}
+
+static void mixer_event_remove_at(int i) {
+	Mixer.num_events--;
+	if (i == Mixer.num_events)
+		return;
+	Mixer.events[i] = Mixer.events[Mixer.num_events];
+	mixer_event_sift_down(i);
+	mixer_event_sift_up(i);
+}
+
+static mixer_event_t* mixer_next_event(void) {
+	return Mixer.num_events ? &Mixer.events[0] : NULL;
 }
 
 void mixer_add_event(int64_t delay, MixerEvent cb, void *ctx) {
-	Mixer.events[Mixer.num_events++] = (mixer_event_t){
+	mixer_event_push((mixer_event_t){
 		.cb = cb,
 		.ctx = ctx,
 		.ticks = Mixer.ticks + delay
-	};
+	});
 }
 
 void mixer_remove_event(MixerEvent cb, void *ctx) {
 	for (int i=0;i<Mixer.num_events;i++) {
-		if (Mixer.events[i].cb == cb) {
-			memmove(&Mixer.events[i], &Mixer.events[i+1], sizeof(mixer_event_t) * (Mixer.num_events-i-1));
-			Mixer.num_events--;
+		if (Mixer.events[i].cb == cb && Mixer.events[i].ctx == ctx) {
+			mixer_event_remove_at(i);
 			return;
 		}
 	}
-	assertf("mixer_remove_event: specified event does not exist\ncb:%p ctx:%p", (void*)cb, ctx);
 }
 
-void mixer_poll(int16_t *out16, int num_samples) {
+// Trigger all the events that are due. The event is removed from the heap
+// while the callback runs, so that the callback can freely add or remove
+// other events.
+static void mixer_trigger_events(void) {
+	mixer_event_t *e;
+	while ((e = mixer_next_event()) && e->ticks <= Mixer.ticks) {
+		mixer_event_t ev = *e;
+		mixer_event_remove_at(0);
+
+		int64_t repeat = ev.cb(ev.ctx);
+		if (repeat) {
+			ev.ticks += repeat;
+			mixer_event_push(ev);
+		}
+	}
+}
+
+// Number of samples (at most num_samples) that can be mixed before the next
+// event, so that the buffer is split where the event triggers on the exact
+// sample.
+static int mixer_samples_to_event(int num_samples) {
+	mixer_event_t *e = mixer_next_event();
+	return MIN(num_samples, e ? e->ticks - Mixer.ticks : num_samples);
+}
+
+static void mixer_poll_internal(int16_t *out16, int num_samples, bool async) {
 	int32_t *out = (int32_t*)out16;
 
 	// Since the AI can only play an even number of samples,
@@ -628,20 +1412,79 @@ void mixer_poll(int16_t *out16, int num_samples) {
 	assert(num_samples % 2 == 0);
 
 	while (num_samples > 0) {
-		mixer_event_t *e = mixer_next_event();
-
-		int ns = MIN(num_samples, e ? e->ticks - Mixer.ticks : num_samples);
+		// Mix up to the next event
+		int ns = mixer_samples_to_event(num_samples);
 		if (ns > 0) {
-			mixer_exec(out, ns);
+			// The runs are serialized on the RSP: only the last one needs
+			// to hold the audio buffer pending (which must be identified
+			// by its start address).
+			if (async)
+				mixer_exec_async(out, ns, ns == num_samples ? out16 : NULL);
+			else
+				mixer_exec(out, ns);
 			out += ns;
 			num_samples -= ns;
 		}
-		if (e && Mixer.ticks == e->ticks) {
-			int64_t repeat = e->cb(e->ctx);
-			if (repeat)
-				e->ticks += repeat;
-			else
-				mixer_remove_event(e->cb, e->ctx);
-		}
+
+		mixer_trigger_events();
 	}
 }
+
+void mixer_poll(int16_t *out, int num_samples) {
+	mixer_poll_internal(out, num_samples, false);
+}
+
+void mixer_poll_async(int16_t *out, int num_samples) {
+	mixer_poll_internal(out, num_samples, true);
+}
+
+// Mix the next part of the audio buffer being refilled from the interrupts.
+// Unlike mixer_poll_async, this never waits for the RSP: a part that follows
+// an event needs the channel positions updated by the previous one, so it is
+// only started by mixer_task_notify, once the previous part is complete.
+static void mixer_fill_continue(void) {
+	int16_t *buf = Mixer.fill_buf;
+	if (!buf || Mixer.async_busy)
+		return;
+
+	// The events due at the end of the previous part are triggered now that
+	// it is complete, so that their callbacks don't wait for the RSP either.
+	mixer_trigger_events();
+
+	int start = Mixer.fill_done;
+	int ns = mixer_samples_to_event(Mixer.fill_len - start);
+	Mixer.fill_done += ns;
+
+	// The last part releases the buffer to the AI once it is complete
+	bool last = Mixer.fill_done == Mixer.fill_len;
+	if (last)
+		Mixer.fill_buf = NULL;
+	mixer_exec_async((int32_t*)buf + start, ns, last ? buf : NULL);
+}
+
+// Refill of an audio buffer from the interrupts (see mixer_set_low_latency).
+// The buffer is held back from the AI until its last part is mixed.
+static void mixer_fill_buffer_async(short *buffer, size_t numsamples) {
+	assert(numsamples % 2 == 0);
+	assert(!Mixer.fill_buf);
+
+	Mixer.fill_buf = buffer;
+	Mixer.fill_len = numsamples;
+	Mixer.fill_done = 0;
+	__audio_buffer_set_pending(buffer, true);
+	mixer_fill_continue();
+}
+
+void mixer_set_low_latency(bool enable) {
+	assert(mixer_initialized());
+	Mixer.low_latency = enable;
+	audio_set_async_buffer_callback(enable ? mixer_fill_buffer_async : NULL);
+}
+
+bool mixer_poll_busy(void) {
+	return Mixer.async_busy;
+}
+
+void mixer_poll_wait(void) {
+	mixer_async_wait();
+}
@@ -0,0 +1,394 @@
+/**
+ * @file mod64.c
+ * @brief Module music player (ProTracker MOD)
+ * @ingroup audio
+ */
+
+#include "libdragon.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define MIN(a,b)  ({ typeof(a) _a = a; typeof(b) _b = b; _a < _b ? _a : _b; })
+#define MAX(a,b)  ({ typeof(a) _a = a; typeof(b) _b = b; _a > _b ? _a : _b; })
+
+/** @brief Number of rows in a pattern */
+#define MOD_ROWS            64
+/** @brief Offset of the order table in the file */
+#define MOD_ORDERS_OFFSET   950
+/** @brief Offset of the format signature in the file */
+#define MOD_SIG_OFFSET      1080
+/** @brief Offset of the first pattern in the file */
+#define MOD_PATTERNS_OFFSET 1084
+
+/** @brief Amiga PAL clock, used to convert periods into frequencies */
+#define AMIGA_CLOCK         7093789.2f
+
+/** @brief Range of valid Amiga periods */
+#define PERIOD_MIN          28
+#define PERIOD_MAX          1712
+
+/** @brief Vibrato sine table (ProTracker) */
+static const uint8_t vibrato_sine[32] = {
+	0, 24, 49, 74, 97, 120, 141, 161, 180, 197, 212, 224, 235, 244, 250, 253,
+	255, 253, 250, 244, 235, 224, 212, 197, 180, 161, 141, 120, 97, 74, 49, 24,
+};
+
+static inline int read_be16(const uint8_t *p) {
+	return (p[0] << 8) | p[1];
+}
+
+/** @brief Return the number of channels of a module from its signature, or 0 if unknown */
+static int mod_signature_channels(const uint8_t *sig) {
+	if (!memcmp(sig, "M.K.", 4) || !memcmp(sig, "M!K!", 4) ||
+		!memcmp(sig, "FLT4", 4) || !memcmp(sig, "4CHN", 4))
+		return 4;
+	if (!memcmp(sig, "OCTA", 4) || !memcmp(sig, "FLT8", 4) || !memcmp(sig, "CD81", 4))
+		return 8;
+	if (sig[0] >= '1' && sig[0] <= '9' && !memcmp(sig+1, "CHN", 3))
+		return sig[0] - '0';
+	if (sig[0] >= '1' && sig[0] <= '9' && sig[1] >= '0' && sig[1] <= '9' && !memcmp(sig+2, "CH", 2))
+		return (sig[0] - '0') * 10 + (sig[1] - '0');
+	return 0;
+}
+
+/** @brief #WaveformRead for instrument samples: copy them from RDRAM */
+static void sample_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
+	mod64_sample_t *s = (mod64_sample_t*)ctx;
+	wlen = MIN(wlen, s->wave.len - wpos);
+	if (wlen <= 0)
+		return;
+	fast_memcpy(samplebuffer_append(sbuf, wlen), s->data + wpos, wlen);
+}
+
+void mod64_open(mod64_t *mod, const char *fn) {
+	memset(mod, 0, sizeof(*mod));
+
+	int fh = dfs_open(fn);
+	assertf(fh >= 0, "file does not exist: %s", fn);
+	int size = dfs_size(fh);
+	assertf(size > MOD_PATTERNS_OFFSET, "mod64 %s: invalid file size: %d\n", fn, size);
+
+	mod->data = malloc(size);
+	assert(mod->data);
+	dfs_read(mod->data, 1, size, fh);
+	dfs_close(fh);
+
+	uint8_t *data = mod->data;
+	mod->num_channels = mod_signature_channels(data + MOD_SIG_OFFSET);
+	assertf(mod->num_channels > 0, "mod64 %s: unsupported format: %02x%02x%02x%02x\n",
+		fn, data[MOD_SIG_OFFSET+0], data[MOD_SIG_OFFSET+1], data[MOD_SIG_OFFSET+2], data[MOD_SIG_OFFSET+3]);
+	assertf(mod->num_channels <= MOD64_MAX_CHANNELS, "mod64 %s: too many channels: %d\n",
+		fn, mod->num_channels);
+
+	mod->num_orders = data[MOD_ORDERS_OFFSET];
+	mod->restart = data[MOD_ORDERS_OFFSET+1];
+	mod->orders = data + MOD_ORDERS_OFFSET + 2;
+	assertf(mod->num_orders > 0 && mod->num_orders <= 128, "mod64 %s: invalid song length: %d\n",
+		fn, mod->num_orders);
+	if (mod->restart >= mod->num_orders)
+		mod->restart = 0;
+
+	// The number of patterns is not stored: it is the highest pattern
+	// referenced by the order table (including unused entries).
+	int num_patterns = 0;
+	for (int i=0; i<128; i++)
+		num_patterns = MAX(num_patterns, mod->orders[i] + 1);
+
+	mod->patterns = data + MOD_PATTERNS_OFFSET;
+	int pattern_size = MOD_ROWS * mod->num_channels * 4;
+	int sample_offset = MOD_PATTERNS_OFFSET + num_patterns * pattern_size;
+	assertf(sample_offset <= size, "mod64 %s: truncated file: %d patterns need %d bytes, file is %d bytes\n",
+		fn, num_patterns, sample_offset, size);
+	int8_t *sdata = (int8_t*)data + sample_offset;
+
+	for (int i=0; i<MOD64_NUM_SAMPLES; i++) {
+		uint8_t *h = data + 20 + i*30;
+		mod64_sample_t *s = &mod->samples[i];
+		int len = read_be16(h+22) * 2;
+		int loop_start = read_be16(h+26) * 2;
+		int loop_len = read_be16(h+28) * 2;
+
+		s->finetune = (int8_t)(h[24] << 4) >> 4;
+		s->volume = MIN(h[25], 64);
+
+		assertf(len <= (int)(data + size - (uint8_t*)sdata), "mod64 %s: truncated file: sample %d needs %d bytes, %d are left\n",
+			fn, i+1, len, (int)(data + size - (uint8_t*)sdata));
+		s->data = sdata;
+		sdata += len;
+
+		// A loop of 2 bytes or less means no loop. Samples are only played up
+		// to the loop end, as the loop then repeats forever.
+		if (loop_len <= 2 || loop_start >= len)
+			loop_len = 0;
+		else {
+			loop_len = MIN(loop_len, len - loop_start);
+			len = loop_start + loop_len;
+		}
+
+		s->wave.name = fn;
+		s->wave.bits = 8;
+		s->wave.channels = 1;
+		s->wave.frequency = AMIGA_CLOCK / (428*2);
+		s->wave.len = len;
+		s->wave.loop_len = loop_len;
+		s->wave.read = sample_read;
+		s->wave.ctx = s;
+	}
+
+	mod->vol = 1.0f;
+	mod->loop = true;
+}
+
+void mod64_set_loop(mod64_t *mod, bool loop) {
+	mod->loop = loop;
+}
+
+void mod64_set_vol(mod64_t *mod, float vol) {
+	mod->vol = vol;
+}
+
+/** @brief Start playing a note on a channel */
+static void mod_trigger(mod64_t *mod, int c, int period) {
+	mod64_channel_t *ch = &mod->ch[c];
+	ch->period = period;
+	ch->vib_pos = 0;
+	if (ch->sample && mod->samples[ch->sample-1].wave.len > 0)
+		mixer_ch_play(mod->first_ch + c, &mod->samples[ch->sample-1].wave);
+	else
+		mixer_ch_stop(mod->first_ch + c);
+}
+
+/** @brief Apply a volume slide (effect Axy) */
+static void mod_volume_slide(mod64_channel_t *ch) {
+	int up = ch->param >> 4, down = ch->param & 0xF;
+	ch->volume = up ? MIN(ch->volume + up, 64) : MAX(ch->volume - down, 0);
+}
+
+/** @brief Apply a tone portamento (effect 3xx) */
+static void mod_tone_porta(mod64_channel_t *ch) {
+	if (!ch->porta_target)
+		return;
+	if (ch->period < ch->porta_target)
+		ch->period = MIN(ch->period + ch->porta_speed, ch->porta_target);
+	else
+		ch->period = MAX(ch->period - ch->porta_speed, ch->porta_target);
+}
+
+/** @brief Apply a vibrato (effect 4xy) */
+static void mod_vibrato(mod64_channel_t *ch) {
+	int delta = vibrato_sine[ch->vib_pos & 31] * ch->vib_depth / 128;
+	ch->vib_ofs = (ch->vib_pos & 32) ? -delta : delta;
+	ch->vib_pos = (ch->vib_pos + ch->vib_speed) & 63;
+}
+
+/** @brief Process a new row: read the notes and run the first tick of the effects */
+static void mod_row(mod64_t *mod) {
+	uint8_t *row = mod->patterns +
+		(mod->orders[mod->order] * MOD_ROWS + mod->row) * mod->num_channels * 4;
+
+	for (int c=0; c<mod->num_channels; c++, row+=4) {
+		mod64_channel_t *ch = &mod->ch[c];
+		int sample = (row[0] & 0xF0) | (row[2] >> 4);
+		int period = ((row[0] & 0x0F) << 8) | row[1];
+		int effect = row[2] & 0x0F;
+		int param = row[3];
+
+		ch->effect = effect;
+		ch->param = param;
+		ch->vib_ofs = 0;
+		ch->arp_ofs = 0;
+		ch->delay_period = 0;
+
+		if (sample && sample <= MOD64_NUM_SAMPLES) {
+			ch->sample = sample;
+			ch->volume = mod->samples[sample-1].volume;
+		}
+
+		if (period) {
+			period = MAX(MIN(period, PERIOD_MAX), PERIOD_MIN);
+			if (effect == 0x3 || effect == 0x5)
+				ch->porta_target = period;
+			else if (effect == 0xE && (param >> 4) == 0xD && (param & 0xF))
+				ch->delay_period = period;
+			else
+				mod_trigger(mod, c, period);
+		}
+
+		switch (effect) {
+		case 0x3:
+			if (param) ch->porta_speed = param;
+			break;
+		case 0x4:
+			if (param >> 4) ch->vib_speed = param >> 4;
+			if (param & 0xF) ch->vib_depth = param & 0xF;
+			break;
+		case 0x9:
+			if (period && ch->sample)
+				mixer_ch_set_pos(mod->first_ch + c, param * 256);
+			break;
+		case 0xB:
+			mod->jump_order = param;
+			if (mod->jump_row < 0) mod->jump_row = 0;
+			break;
+		case 0xC:
+			ch->volume = MIN(param, 64);
+			break;
+		case 0xD:
+			if (mod->jump_order < 0) mod->jump_order = mod->order + 1;
+			mod->jump_row = MIN((param >> 4) * 10 + (param & 0xF), MOD_ROWS-1);
+			break;
+		case 0xE:
+			switch (param >> 4) {
+			case 0x1: ch->period = MAX(ch->period - (param & 0xF), PERIOD_MIN); break;
+			case 0x2: ch->period = MIN(ch->period + (param & 0xF), PERIOD_MAX); break;
+			case 0xA: ch->volume = MIN(ch->volume + (param & 0xF), 64); break;
+			case 0xB: ch->volume = MAX(ch->volume - (param & 0xF), 0); break;
+			case 0xC: if (!(param & 0xF)) ch->volume = 0; break;
+			}
+			break;
+		case 0xF:
+			if (param == 0) break;
+			if (param < 0x20) mod->speed = param;
+			else mod->bpm = param;
+			break;
+		}
+	}
+}
+
+/** @brief Run the effects of the current row on the ticks after the first one */
+static void mod_effects(mod64_t *mod) {
+	for (int c=0; c<mod->num_channels; c++) {
+		mod64_channel_t *ch = &mod->ch[c];
+		int param = ch->param;
+
+		ch->vib_ofs = 0;
+		ch->arp_ofs = 0;
+
+		switch (ch->effect) {
+		case 0x0:
+			// Arpeggio: cycle between the note, note+x and note+y semitones
+			if (param) {
+				int i = mod->tick % 3;
+				ch->arp_ofs = i == 1 ? param >> 4 : (i == 2 ? param & 0xF : 0);
+			}
+			break;
+		case 0x1: ch->period = MAX(ch->period - param, PERIOD_MIN); break;
+		case 0x2: ch->period = MIN(ch->period + param, PERIOD_MAX); break;
+		case 0x3: mod_tone_porta(ch); break;
+		case 0x4: mod_vibrato(ch); break;
+		case 0x5: mod_tone_porta(ch); mod_volume_slide(ch); break;
+		case 0x6: mod_vibrato(ch); mod_volume_slide(ch); break;
+		case 0xA: mod_volume_slide(ch); break;
+		case 0xE:
+			if ((param >> 4) == 0xC && mod->tick == (param & 0xF))
+				ch->volume = 0;
+			if ((param >> 4) == 0xD && mod->tick == (param & 0xF) && ch->delay_period) {
+				mod_trigger(mod, c, ch->delay_period);
+				ch->delay_period = 0;
+			}
+			break;
+		}
+	}
+}
+
+/** @brief Update the mixer channels with the current period and volume */
+static void mod_update_channels(mod64_t *mod) {
+	for (int c=0; c<mod->num_channels; c++) {
+		mod64_channel_t *ch = &mod->ch[c];
+		int mch = mod->first_ch + c;
+		if (!ch->period || !ch->sample || !mixer_ch_playing(mch))
+			continue;
+
+		int period = MAX(ch->period + ch->vib_ofs, PERIOD_MIN);
+		float freq = AMIGA_CLOCK / (period * 2);
+		int semitones8 = mod->samples[ch->sample-1].finetune + ch->arp_ofs * 8;
+		if (semitones8)
+			freq *= powf(2.0f, semitones8 / 96.0f);
+		mixer_ch_set_freq(mch, freq);
+
+		// Amiga panning: channels are hard-panned alternating LRRL.
+		float pan = ((c & 3) == 0 || (c & 3) == 3) ? 0.25f : 0.75f;
+		mixer_ch_set_vol_pan(mch, ch->volume / 64.0f * mod->vol, pan);
+	}
+}
+
+/** @brief Move to the next row, following jumps and the end of the song */
+static void mod_next_row(mod64_t *mod) {
+	if (mod->jump_order >= 0) {
+		mod->order = mod->jump_order;
+		mod->row = mod->jump_row;
+		mod->jump_order = mod->jump_row = -1;
+	} else if (++mod->row == MOD_ROWS) {
+		mod->row = 0;
+		mod->order++;
+	}
+
+	if (mod->order >= mod->num_orders) {
+		if (mod->loop)
+			mod->order = mod->restart;
+		else
+			mod->playing = false;
+	}
+}
+
+/** @brief Mixer event: run a tick of the module */
+static int mod_tick(void *ctx) {
+	mod64_t *mod = (mod64_t*)ctx;
+
+	if (!mod->playing) {
+		for (int c=0; c<mod->num_channels; c++)
+			mixer_ch_stop(mod->first_ch + c);
+		return 0;
+	}
+
+	if (mod->tick == 0)
+		mod_row(mod);
+	else
+		mod_effects(mod);
+	mod_update_channels(mod);
+
+	if (++mod->tick >= mod->speed) {
+		mod->tick = 0;
+		mod_next_row(mod);
+	}
+
+	// A tick lasts 2.5/BPM seconds
+	return audio_get_frequency() * 5 / (mod->bpm * 2);
+}
+
+void mod64_play(mod64_t *mod, int first_ch) {
+	assert(mod->data);
+	if (mod->playing)
+		mod64_stop(mod);
+
+	mod->first_ch = first_ch;
+	mod->order = mod->row = mod->tick = 0;
+	mod->speed = 6;
+	mod->bpm = 125;
+	mod->jump_order = mod->jump_row = -1;
+	memset(mod->ch, 0, sizeof(mod->ch));
+	mod->playing = true;
+
+	mixer_add_event(0, mod_tick, mod);
+}
+
+void mod64_stop(mod64_t *mod) {
+	if (!mod->playing)
+		return;
+	mod->playing = false;
+	mixer_remove_event(mod_tick, mod);
+	for (int c=0; c<mod->num_channels; c++)
+		mixer_ch_stop(mod->first_ch + c);
+}
+
+bool mod64_playing(mod64_t *mod) {
+	return mod->playing;
+}
+
+void mod64_close(mod64_t *mod) {
+	mod64_stop(mod);
+	free(mod->data);
+	mod->data = NULL;
+}
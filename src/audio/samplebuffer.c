@@ -28,8 +28,10 @@ void samplebuffer_init(samplebuffer_t *buf, uint8_t* mem, int nbytes) {
 	buf->size = nbytes;
 
 	// Make sure there is no spurious CPU cache content in the buffer that might
-	// get written back later overwriting some samples.
-	data_cache_hit_writeback_invalidate(mem, nbytes);
+	// get written back later overwriting some samples. Memory allocated with
+	// malloc_uncached is already evicted from the cache.
+	if ((uint32_t)mem < 0xA0000000)
+		data_cache_hit_writeback_invalidate(mem, nbytes);
 }
 
 void samplebuffer_set_bps(samplebuffer_t *buf, int bits_per_sample) {
@@ -44,6 +46,12 @@ void samplebuffer_set_bps(samplebuffer_t *buf, int bits_per_sample) {
 	buf->size = nbytes >> bps;
 }
 
+void samplebuffer_set_ring(samplebuffer_t *buf, bool ring) {
+	assertf(buf->widx == 0 && buf->ridx == 0 && buf->wpos == 0,
+		"samplebuffer_set_ring can only be called on an empty samplebuffer");
+	buf->ring = ring;
+}
+
 void samplebuffer_set_waveform(samplebuffer_t *buf, WaveformRead read, void *ctx) {
 	buf->wv_read = read;
 	buf->wv_ctx = ctx;
@@ -53,6 +61,38 @@ void samplebuffer_close(samplebuffer_t *buf) {
 	buf->ptr_and_flags = 0;
 }
 
+// Convert an index relative to head into an actual index in the buffer,
+// following the wrap point (in ring mode).
+static inline int samplebuffer_index(samplebuffer_t *buf, int idx) {
+	idx += buf->head;
+	if (buf->wrap && idx >= buf->wrap)
+		idx -= buf->wrap_jump;
+	return idx;
+}
+
+// Copy the first samples after the wrap point right after the samples that
+// come before it. The RSP fetches samples in chunks and will thus read past
+// the wrap point before jumping back, so this area must mirror the samples
+// stored at the start of the buffer. Only MIXER_LOOP_OVERREAD bytes at most
+// are ever copied, once per wrap.
+static void samplebuffer_mirror(samplebuffer_t *buf) {
+	if (!buf->wrap)
+		return;
+
+	int bps = SAMPLES_BPS_SHIFT(buf);
+	int nbytes = (buf->widx - (buf->wrap - buf->head)) << bps;
+	if (nbytes > MIXER_LOOP_OVERREAD)
+		nbytes = MIXER_LOOP_OVERREAD;
+
+	uint8_t *src = (uint8_t*)SAMPLES_PTR(buf) + ((buf->wrap - buf->wrap_jump) << bps);
+	uint8_t *dst = (uint8_t*)SAMPLES_PTR(buf) + (buf->wrap << bps);
+	for (int i=buf->mirrored; i<nbytes; i++)
+		dst[i] = src[i];
+
+	if (nbytes > buf->mirrored)
+		buf->mirrored = nbytes;
+}
+
 void* samplebuffer_get(samplebuffer_t *buf, int wpos, int *wlen) {
 	// ROUNDUP8_BPS rounds up the specified number of samples
 	// (given the bps shift) so that they span an exact multiple
@@ -117,30 +157,132 @@ void* samplebuffer_get(samplebuffer_t *buf, int wpos, int *wlen) {
 	if (len < *wlen)
 		*wlen = len;
 
-	return SAMPLES_PTR(buf) + (idx << SAMPLES_BPS_SHIFT(buf));
+	samplebuffer_mirror(buf);
+	return SAMPLES_PTR(buf) + (samplebuffer_index(buf, idx) << SAMPLES_BPS_SHIFT(buf));
+}
+
+int samplebuffer_get_wrap(samplebuffer_t *buf, int wpos, int *jump) {
+	if (!buf->wrap)
+		return -1;
+
+	int wrap_wpos = buf->wpos + buf->wrap - buf->head;
+	if (wpos >= wrap_wpos)
+		return -1;
+
+	*jump = buf->wrap_jump;
+	return wrap_wpos;
+}
+
+// Return the index (relative to head) of the first sample that must be kept
+// in the buffer, rolled back to a 8-byte aligned position. This preserves
+// the guarantee that samplebuffer_append will always return a 8-byte aligned
+// pointer, which is good for DMA purposes.
+static int samplebuffer_keep_idx(samplebuffer_t *buf) {
+	assertf(buf->widx >= buf->ridx,
+		"samplebuffer_append: invalid consistency check\n"
+		"widx:%x ridx:%x\n", buf->widx, buf->ridx);
+
+	int ridx = buf->ridx;
+	while (ridx > 0 && (samplebuffer_index(buf, ridx) << SAMPLES_BPS_SHIFT(buf)) & 7)
+		ridx--;
+	return ridx;
+}
+
+// Move samples to the start of the buffer. The destination must be 8-byte
+// aligned.
+static void samplebuffer_move(samplebuffer_t *buf, int dst_idx, int src_idx, int nsamples) {
+	int nbytes = nsamples << SAMPLES_BPS_SHIFT(buf);
+	if (nbytes <= 0)
+		return;
+
+	tracef("samplebuffer_move: compacting buffer, moving 0x%x bytes\n", nbytes);
+
+	// NOTE: this violates the zero-copy principle as we do a memmove here.
+	// Luckily, this is a rare chance and in most cases just a few
+	// samples are moved (in the normal playback case, it should be just 1,
+	// as in general a sample could be used more than once for resampling).
+	// Ring mode avoids it altogether for streamed waveforms.
+	uint8_t *src = SAMPLES_PTR(buf) + (src_idx << SAMPLES_BPS_SHIFT(buf));
+	uint8_t *dst = SAMPLES_PTR(buf) + (dst_idx << SAMPLES_BPS_SHIFT(buf));
+	assert(((uint32_t)dst & 7) == 0);
+
+	// Optimized copy of samples. We work on uncached memory directly
+	// so that we don't need to flush, and use only 64-bits ops. We round up
+	// to a multiple of 8 the amount of bytes, as it doesn't matter if we
+	// copy more, as long as we're fast.
+	// This has been benchmarked to be faster than memmove() + cache flush.
+	// fast_memcpy copies forward, so it is safe as dst is below src.
+	fast_memcpy(dst, src, ROUND_UP(nbytes, 8));
+}
+
+// Append samples in ring mode. Returns NULL if there is no contiguous space
+// for them (even after discarding the samples not needed anymore).
+static void* samplebuffer_ring_append(samplebuffer_t *buf, int wlen) {
+	int bps = SAMPLES_BPS_SHIFT(buf);
+
+	for (int retry=0; retry<2; retry++) {
+		int end = samplebuffer_index(buf, buf->widx);
+
+		if (!buf->wrap) {
+			// Append after the existing samples, if they fit
+			if (end + wlen <= buf->size) {
+				buf->widx += wlen;
+				return SAMPLES_PTR(buf) + (end << bps);
+			}
+
+			// Otherwise, wrap around and continue from the start of the
+			// buffer, if there is enough space before the head. Start at an
+			// odd address if required to preserve the 2-byte phase.
+			int start = ((buf->wpos + buf->widx) << bps) & 1;
+			if (start + wlen <= buf->head) {
+				tracef("samplebuffer_append: wrapping at %x\n", end);
+				buf->wrap = end;
+				buf->wrap_jump = end - start;
+				buf->mirrored = 0;
+				buf->widx += wlen;
+				return SAMPLES_PTR(buf) + (start << bps);
+			}
+		} else {
+			// Already wrapped: append if there is space before the head
+			if (end + wlen <= buf->head) {
+				buf->widx += wlen;
+				return SAMPLES_PTR(buf) + (end << bps);
+			}
+		}
+
+		// Make space in the buffer by discarding everything that is not
+		// needed anymore for playback, and try again.
+		if (retry == 0)
+			samplebuffer_discard(buf, buf->wpos + samplebuffer_keep_idx(buf));
+	}
+
+	return NULL;
 }
 
 void* samplebuffer_append(samplebuffer_t *buf, int wlen) {
-	// If the requested number of samples doesn't fit the buffer, we
-	// need to make space for it by discarding older samples.
-	if (buf->widx + wlen > buf->size) {
-		// Make space in the buffer by discarding everything up to the
-		// ridx index, which is the first sample that we still need for playback.
-		assertf(buf->widx >= buf->ridx,
-			"samplebuffer_append: invalid consistency check\n"
-			"widx:%x ridx:%x\n", buf->widx, buf->ridx);
-
-		// Rollback ridx until it hit a 8-byte aligned position.
-		// This preserves the guarantee that samplebuffer_append
-		// will always return a 8-byte aligned pointer, which is
-		// good for DMA purposes.
-		int ridx = buf->ridx;
-		while ((ridx << SAMPLES_BPS_SHIFT(buf)) & 7)
-			ridx--;
-		samplebuffer_discard(buf, buf->wpos+ridx);
+	if (buf->ring) {
+		void *data = samplebuffer_ring_append(buf, wlen);
+		if (data)
+			return data;
+
+		// The free space is fragmented around the samples still required
+		// for playback. If they do not wrap, fall back to compacting them
+		// at the start of the buffer. Keep the sample before the head if
+		// needed to preserve the 2-byte phase.
+		assertf(!buf->wrap,
+			"samplebuffer_append: buffer too small\n"
+			"ridx:%x widx:%x wlen:%x size:%x", buf->ridx, buf->widx, wlen, buf->size);
+		int start = buf->head - ((buf->head << SAMPLES_BPS_SHIFT(buf)) & 1);
+		samplebuffer_move(buf, 0, start, buf->head - start + buf->widx);
+		buf->head -= start;
+	} else if (buf->widx + wlen > buf->size) {
+		// If the requested number of samples doesn't fit the buffer, we
+		// need to make space for it by discarding older samples, up to
+		// the first sample that we still need for playback.
+		samplebuffer_discard(buf, buf->wpos+samplebuffer_keep_idx(buf));
 	}
 
-	assertf(((buf->wpos<< SAMPLES_BPS_SHIFT(buf)) % 2) == 0, "buf->wpos:%x", buf->wpos);
+	assertf((((buf->wpos - buf->head) << SAMPLES_BPS_SHIFT(buf)) % 2) == 0, "buf->wpos:%x", buf->wpos);
 
 	// If there is still not space in the buffer, it means that the
 	// buffer is too small for this append call. This is a logic error,
@@ -148,59 +290,44 @@ void* samplebuffer_append(samplebuffer_t *buf, int wlen) {
 	// TODO: in principle, we could bubble this error up to the callers,
 	// let them fill less samples than requested, and obtain some cracks
 	// in the audio. Is it worth it?
-	assertf(buf->widx + wlen <= buf->size,
+	assertf(buf->head + buf->widx + wlen <= buf->size,
 		"samplebuffer_append: buffer too small\n"
 		"ridx:%x widx:%x wlen:%x size:%x", buf->ridx, buf->widx, wlen, buf->size);
 
-	void *data = SAMPLES_PTR(buf) + (buf->widx << SAMPLES_BPS_SHIFT(buf));
+	void *data = SAMPLES_PTR(buf) + ((buf->head + buf->widx) << SAMPLES_BPS_SHIFT(buf));
 	buf->widx += wlen;
 	return data;
 }
 
 void samplebuffer_discard(samplebuffer_t *buf, int wpos) {
-	// Compute the index of the first sample that will be preserved (and thus
-	// will be moved to position 0 of the buffer).
+	// Compute the index of the first sample that will be preserved (and thus,
+	// unless in ring mode, will be moved to position 0 of the buffer).
 	int idx = wpos - buf->wpos;
 	if (idx <= 0)
 		return;
 	if (idx > buf->widx)
 		idx = buf->widx;
 
-	// Make sure moving this sample at the beginning of the buffer doesn't change
-	// the 2-byte phase of the waveform address. This is not strictly required,
-	// but it helps waveform implementations that want to use dma_read().
-	if ((idx << SAMPLES_BPS_SHIFT(buf)) & 1) {
-		idx--;
-		if (idx == 0)
-			return;
-	}
-
 	tracef("discard: wpos=%x idx:%x buf->wpos=%x buf->widx=%x\n", wpos, idx, buf->wpos, buf->widx);
-	int kept_bytes = (buf->widx - idx) << SAMPLES_BPS_SHIFT(buf);
-	if (kept_bytes > 0) {		
-		tracef("samplebuffer_discard: compacting buffer, moving 0x%x bytes\n", kept_bytes);
-
-		// FIXME: this violates the zero-copy principle as we do a memmove here.
-		// The problem is that the RSP ucode doesn't fully support a circular
-		// buffer of samples (and also our samplebuffer_t isn't structured for
-		// this). Luckily, this is a rare chance and in most cases just a few
-		// samples are moved (in the normal playback case, it should be just 1,
-		// as in general a sample could be used more than once for resampling).
-		uint8_t *src = SAMPLES_PTR(buf) + (idx << SAMPLES_BPS_SHIFT(buf));
-		uint8_t *dst = SAMPLES_PTR(buf);
-		assert(((uint32_t)dst & 7) == 0);
-
-		// Optimized copy of samples. We work on uncached memory directly
-		// so that we don't need to flush, and use only 64-bits ops. We round up
-		// to a multiple of 8 the amount of bytes, as it doesn't matter if we
-		// copy more, as long as we're fast.
-		// This has been benchmarked to be faster than memmove() + cache flush.
-		typedef uint64_t u_uint64_t __attribute__((aligned(1)));
-		kept_bytes = ROUND_UP(kept_bytes, 8);
-		u_uint64_t *src64 = (u_uint64_t*)src;
-		uint64_t *dst64 = (uint64_t*)dst;
-		for (int i=0;i<kept_bytes/8;i++)
-			*dst64++ = *src64++;
+
+	if (buf->ring) {
+		// In ring mode, samples are never moved: just advance the head,
+		// following the wrap point.
+		buf->head += idx;
+		if (buf->wrap && buf->head >= buf->wrap) {
+			buf->head -= buf->wrap_jump;
+			buf->wrap = 0;
+		}
+	} else {
+		// Make sure moving this sample at the beginning of the buffer doesn't change
+		// the 2-byte phase of the waveform address. This is not strictly required,
+		// but it helps waveform implementations that want to use dma_read().
+		if ((idx << SAMPLES_BPS_SHIFT(buf)) & 1) {
+			idx--;
+			if (idx == 0)
+				return;
+		}
+		samplebuffer_move(buf, 0, idx, buf->widx - idx);
 	}
 
 	buf->wpos += idx;
@@ -208,8 +335,15 @@ void samplebuffer_discard(samplebuffer_t *buf, int wpos) {
 	buf->ridx -= idx;
 	if (buf->ridx < 0)
 		buf->ridx = 0;
+
+	// Once empty, a ring buffer can restart from the beginning
+	if (buf->ring && buf->widx == 0) {
+		buf->head = (buf->wpos << SAMPLES_BPS_SHIFT(buf)) & 1;
+		buf->wrap = 0;
+	}
 }
 
 void samplebuffer_flush(samplebuffer_t *buf) {
 	buf->wpos = buf->widx = buf->ridx = 0;
+	buf->head = buf->wrap = buf->wrap_jump = buf->mirrored = 0;
 }
@@ -10,6 +10,8 @@
 #include <string.h>
 #include <assert.h>
 
+#define MIN(a,b)  ({ typeof(a) _a = a; typeof(b) _b = b; _a < _b ? _a : _b; })
+
 /** @brief Profile of DMA usage by WAV64, used for debugging purposes. */
 int64_t __wav64_profile_dma = 0;
 
@@ -29,14 +31,311 @@ void raw_waveform_read(samplebuffer_t *sbuf, int base_rom_addr, int wpos, int wl
 	// also for misaligned addresses and odd lengths.
 	// The mixer/samplebuffer guarantees that ROM/RAM addresses are always
 	// on the same 2-byte phase, as the only requirement of dma_read.
-	dma_read(ram_addr, rom_addr, bytes);
+	// Go through the DMA queue with high priority, so that we are never
+	// stuck behind a large background transfer (eg: asset loading).
+	dma_request_t req;
+	dma_queue_read(&req, ram_addr, rom_addr, bytes, DMA_PRIORITY_HIGH, NULL, NULL);
+	dma_request_wait(&req);
+	__wav64_profile_dma += TICKS_READ() - t0;
+}
+
+/** @brief Return the half of the streaming buffer holding a unit, or -1 if none */
+static int stream_find(wav64_t *wav, int pos) {
+	for (int i=0; i<2; i++) {
+		if (wav->stream.len[i] && pos >= wav->stream.start[i] &&
+			pos < wav->stream.start[i] + wav->stream.len[i])
+			return i;
+	}
+	return -1;
+}
+
+/** @brief Wait for the DMA transfer into a half of the streaming buffer */
+static void stream_wait(wav64_t *wav, int i) {
+	if (wav->stream.busy[i]) {
+		dma_request_wait(&wav->stream.req[i]);
+		wav->stream.busy[i] = false;
+	}
+}
+
+/**
+ * @brief Prefetch the data that follows a read into the streaming buffer.
+ *
+ * The streaming buffer holds units of unit_bytes bytes: samples for raw files,
+ * or frames for VADPCM files. The half holding pos (if any) is being consumed,
+ * so the other one is refilled with the units that follow it, wrapping at the
+ * loop point (loop_pos, or -1 if the waveform does not loop).
+ */
+static void stream_prefetch(wav64_t *wav, int pos, int unit_bytes, int len, int loop_pos) {
+	int cur = stream_find(wav, pos);
+	int next = cur >= 0 ? wav->stream.start[cur] + wav->stream.len[cur] : pos;
+
+	if (next >= len) {
+		if (loop_pos < 0)
+			return;
+		next = loop_pos;
+	}
+
+	// Already prefetched (eg: the whole loop fits the buffer)
+	if (stream_find(wav, next) >= 0)
+		return;
+
+	int i = (cur == 0) ? 1 : 0;
+	stream_wait(wav, i);
+
+	uint32_t rom_addr = wav->rom_addr + next * unit_bytes;
+	int ofs = rom_addr & 7;
+	int n = MIN((wav->stream.size - 8) / unit_bytes, len - next);
+
+	wav->stream.start[i] = next;
+	wav->stream.len[i] = n;
+	wav->stream.ofs[i] = ofs;
+
+	data_cache_hit_invalidate(wav->stream.buf[i], wav->stream.size);
+	dma_queue_read(&wav->stream.req[i], wav->stream.buf[i] + ofs, rom_addr, n * unit_bytes,
+		DMA_PRIORITY_HIGH, NULL, NULL);
+	wav->stream.busy[i] = true;
+}
+
+/**
+ * @brief Implementation of #WaveformRead for a WAV64 with a streaming buffer.
+ *
+ * Samples already prefetched are copied into the sample buffer; the rest
+ * (after a seek) are read synchronously. Then, the following samples are
+ * prefetched for the next call.
+ */
+static void stream_waveform_read(wav64_t *wav, samplebuffer_t *sbuf, int wpos, int wlen, int bps) {
+	uint8_t* ram_addr = (uint8_t*)samplebuffer_append(sbuf, wlen);
+
+	uint32_t t0 = TICKS_READ();
+	while (wlen > 0) {
+		int i = stream_find(wav, wpos);
+		if (i < 0)
+			break;
+
+		stream_wait(wav, i);
+
+		int n = MIN(wlen, wav->stream.start[i] + wav->stream.len[i] - wpos);
+		uint8_t *src = wav->stream.buf[i] + wav->stream.ofs[i] + ((wpos - wav->stream.start[i]) << bps);
+		fast_memcpy(ram_addr, src, n << bps);
+
+		ram_addr += n << bps;
+		wpos += n;
+		wlen -= n;
+	}
+
+	if (wlen > 0) {
+		// Samples were not prefetched: read them synchronously, as
+		// raw_waveform_read does.
+		dma_request_t req;
+		dma_queue_read(&req, ram_addr, wav->rom_addr + (wpos << bps), wlen << bps,
+			DMA_PRIORITY_HIGH, NULL, NULL);
+		dma_request_wait(&req);
+		wpos += wlen;
+	}
 	__wav64_profile_dma += TICKS_READ() - t0;
+
+	stream_prefetch(wav, wpos, 1 << bps, wav->wave.len,
+		wav->wave.loop_len ? wav->wave.len - wav->wave.loop_len : -1);
+}
+
+DEFINE_RSP_UCODE(rsp_vadpcm);
+
+/** @brief Input of the VADPCM ucode (keep in sync with rsp_vadpcm.S) */
+typedef struct {
+	uint32_t src;              ///< RDRAM address of the frames
+	uint32_t num_frames;       ///< Number of frames to decode
+	uint32_t dst;              ///< RDRAM address of the output samples
+	uint32_t skip;             ///< Number of decoded samples to skip before the output
+	uint32_t num_samples;      ///< Number of samples to output
+	uint32_t channels;         ///< Number of channels (1 or 2)
+	uint32_t book;             ///< RDRAM address of the codebook
+	uint32_t reserved;
+	int16_t state[2][8];       ///< Decoder state of each channel (lanes 6 and 7)
+} vadpcm_rsp_input_t;
+
+/** @brief Number of VADPCM frames read from ROM with a single DMA transfer */
+#define VADPCM_FRAMES_PER_READ    32
+
+/**
+ * @brief Task decoding VADPCM frames, with its input.
+ *
+ * Reads are serialized by the mixer, so a single task is enough.
+ */
+static rsp_task_t vadpcm_task;
+static vadpcm_rsp_input_t vadpcm_input __attribute__((aligned(8)));
+/** @brief Frames read from ROM (when not streaming), at the ROM 8-byte phase */
+static uint8_t vadpcm_frames[VADPCM_FRAMES_PER_READ * WAV64_VADPCM_FRAME_BYTES * 2 + 8] __attribute__((aligned(16)));
+
+static void vadpcm_task_setup(rsp_task_t *task) {
+	uint32_t *input = (uint32_t*)&vadpcm_input;
+	for (int i=0; i<sizeof(vadpcm_input)/4; i++)
+		SP_DMEM[i] = input[i];
+}
+
+// Read back the decoder state (VADPCM_STATE and VADPCM_STATE_LAST: lanes 6
+// and 7 are the last word of each channel vector).
+static void vadpcm_task_done(rsp_task_t *task) {
+	wav64_t *wav = task->ctx;
+	for (int ch=0; ch<2; ch++) {
+		uint32_t state = SP_DMEM[8 + ch*4 + 3];
+		uint32_t last = SP_DMEM[16 + ch*4 + 3];
+		wav->vadpcm.state[ch][0] = state >> 16;
+		wav->vadpcm.state[ch][1] = state & 0xFFFF;
+		wav->vadpcm.last_state[ch][0] = last >> 16;
+		wav->vadpcm.last_state[ch][1] = last & 0xFFFF;
+	}
+}
+
+/**
+ * @brief Decode VADPCM frames in RDRAM with the RSP.
+ *
+ * The frames follow the current decoder state. Of the decoded samples, the
+ * first skip ones are dropped, and the next num_samples ones are written
+ * to dst. The function waits for the task, as the sample buffer might be
+ * accessed by the CPU as soon as the read is over.
+ */
+static void vadpcm_decode(wav64_t *wav, const uint8_t *src, int nframes, int16_t *dst, int skip, int num_samples) {
+	vadpcm_input = (vadpcm_rsp_input_t){
+		.src = (uint32_t)src,
+		.num_frames = nframes,
+		.dst = (uint32_t)dst,
+		.skip = skip,
+		.num_samples = num_samples,
+		.channels = wav->wave.channels,
+		.book = (uint32_t)wav->vadpcm.book,
+	};
+	for (int ch=0; ch<wav->wave.channels; ch++) {
+		vadpcm_input.state[ch][6] = wav->vadpcm.state[ch][0];
+		vadpcm_input.state[ch][7] = wav->vadpcm.state[ch][1];
+	}
+
+	vadpcm_task = (rsp_task_t){
+		.ucode = &rsp_vadpcm,
+		.setup = vadpcm_task_setup,
+		.done = vadpcm_task_done,
+		.ctx = wav,
+	};
+	rsp_task_submit(&vadpcm_task);
+	rsp_task_wait(&vadpcm_task);
+	wav->vadpcm.state_frame += nframes;
+	wav->vadpcm.last_frame = wav->vadpcm.state_frame - 1;
+}
+
+/**
+ * @brief Decode VADPCM frames, starting at frame f with the current state.
+ *
+ * Frames are taken from the streaming buffer when prefetched, or read from
+ * ROM in batches. Of the decoded samples, the first skip ones are dropped
+ * and the next wlen ones are written to dst.
+ */
+static void vadpcm_read(wav64_t *wav, int f, int nframes, int16_t *dst, int skip, int wlen) {
+	int nch = wav->wave.channels;
+	int frame_bytes = WAV64_VADPCM_FRAME_BYTES * nch;
+
+	while (nframes > 0) {
+		const uint8_t *src;
+		int n;
+
+		int i = wav->stream.size ? stream_find(wav, f) : -1;
+		if (i >= 0) {
+			stream_wait(wav, i);
+			n = MIN(nframes, wav->stream.start[i] + wav->stream.len[i] - f);
+			src = wav->stream.buf[i] + wav->stream.ofs[i] + (f - wav->stream.start[i]) * frame_bytes;
+		} else {
+			uint32_t rom_addr = wav->rom_addr + f * frame_bytes;
+			n = MIN(nframes, VADPCM_FRAMES_PER_READ);
+			src = vadpcm_frames + (rom_addr & 7);
+
+			uint32_t t0 = TICKS_READ();
+			data_cache_hit_writeback_invalidate(vadpcm_frames, sizeof(vadpcm_frames));
+			dma_request_t req;
+			dma_queue_read(&req, (void*)src, rom_addr, n * frame_bytes,
+				DMA_PRIORITY_HIGH, NULL, NULL);
+			dma_request_wait(&req);
+			__wav64_profile_dma += TICKS_READ() - t0;
+		}
+
+		int ns = MIN(n * WAV64_VADPCM_FRAME_SAMPLES - skip, wlen);
+		vadpcm_decode(wav, src, n, dst, skip, ns);
+
+		dst += ns * nch;
+		wlen -= ns;
+		skip = 0;
+		f += n;
+		nframes -= n;
+	}
+}
+
+/** @brief Frame of the loop point of a VADPCM WAV64, or -1 if it does not loop */
+static int vadpcm_loop_frame(wav64_t *wav) {
+	if (!wav->wave.loop_len)
+		return -1;
+	return (wav->wave.len - wav->wave.loop_len) / WAV64_VADPCM_FRAME_SAMPLES;
+}
+
+/**
+ * @brief Move the VADPCM decoder state to the start of frame f.
+ *
+ * The state is known at the start of the waveform, at the loop point (stored
+ * by audioconv64), and around the last decoded frame. Otherwise (a seek via
+ * #mixer_ch_set_pos), the frames before f are decoded from the closest of them.
+ */
+static void vadpcm_seek(wav64_t *wav, int f) {
+	if (f == wav->vadpcm.state_frame)
+		return;
+
+	if (f == wav->vadpcm.last_frame) {
+		memcpy(wav->vadpcm.state, wav->vadpcm.last_state, sizeof(wav->vadpcm.state));
+		wav->vadpcm.state_frame = f;
+		wav->vadpcm.last_frame = -1;
+		return;
+	}
+
+	int loop_frame = vadpcm_loop_frame(wav);
+	if (loop_frame >= 0 && loop_frame <= f && (wav->vadpcm.state_frame > f || loop_frame > wav->vadpcm.state_frame)) {
+		memcpy(wav->vadpcm.state, wav->vadpcm.loop_state, sizeof(wav->vadpcm.state));
+		wav->vadpcm.state_frame = loop_frame;
+		wav->vadpcm.last_frame = -1;
+	} else if (wav->vadpcm.state_frame > f) {
+		memset(wav->vadpcm.state, 0, sizeof(wav->vadpcm.state));
+		wav->vadpcm.state_frame = 0;
+		wav->vadpcm.last_frame = -1;
+	}
+
+	vadpcm_read(wav, wav->vadpcm.state_frame, f - wav->vadpcm.state_frame, NULL, 0, 0);
+}
+
+/**
+ * @brief Implementation of #WaveformRead for VADPCM-compressed WAV64.
+ *
+ * The RSP decodes the frames covering the requested samples straight into
+ * the sample buffer. Reads rarely end on a frame boundary, so the next one
+ * usually starts by decoding again the last frame (see #vadpcm_seek).
+ */
+static void vadpcm_waveform_read(wav64_t *wav, samplebuffer_t *sbuf, int wpos, int wlen) {
+	int16_t *dst = (int16_t*)samplebuffer_append(sbuf, wlen);
+	int f = wpos / WAV64_VADPCM_FRAME_SAMPLES;
+	int end = (wpos + wlen + WAV64_VADPCM_FRAME_SAMPLES - 1) / WAV64_VADPCM_FRAME_SAMPLES;
+
+	vadpcm_seek(wav, f);
+	vadpcm_read(wav, f, end - f, dst, wpos % WAV64_VADPCM_FRAME_SAMPLES, wlen);
+
+	if (wav->stream.size) {
+		int num_frames = (wav->wave.len + WAV64_VADPCM_FRAME_SAMPLES - 1) / WAV64_VADPCM_FRAME_SAMPLES;
+		stream_prefetch(wav, (wpos + wlen) / WAV64_VADPCM_FRAME_SAMPLES,
+			WAV64_VADPCM_FRAME_BYTES * wav->wave.channels, num_frames, vadpcm_loop_frame(wav));
+	}
 }
 
 static void waveform_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
 	wav64_t *wav = (wav64_t*)ctx;
 	int bps = (wav->wave.bits == 8 ? 0 : 1) + (wav->wave.channels == 2 ? 1 : 0);
-	raw_waveform_read(sbuf, wav->rom_addr, wpos, wlen, bps);
+	if (wav->format == WAV64_FORMAT_VADPCM)
+		vadpcm_waveform_read(wav, sbuf, wpos, wlen);
+	else if (wav->stream.size)
+		stream_waveform_read(wav, sbuf, wpos, wlen, bps);
+	else
+		raw_waveform_read(sbuf, wav->rom_addr, wpos, wlen, bps);
 }
 
 void wav64_open(wav64_t *wav, const char *fn) {
@@ -51,8 +350,8 @@ void wav64_open(wav64_t *wav, const char *fn) {
 		fn, head.id[0], head.id[1], head.id[2], head.id[3]);
 	assertf(head.version == WAV64_FILE_VERSION, "wav64 %s: invalid version: %02x\n",
 		fn, head.version);
-	assertf(head.format == WAV64_FORMAT_RAW, "wav64 %s: invalid format: %02x\n",
-		fn, head.format);
+	assertf(head.format == WAV64_FORMAT_RAW || head.format == WAV64_FORMAT_VADPCM,
+		"wav64 %s: invalid format: %02x\n", fn, head.format);
 
 	wav->wave.name = fn;
 	wav->wave.channels = head.channels;
@@ -60,7 +359,27 @@ void wav64_open(wav64_t *wav, const char *fn) {
 	wav->wave.frequency = head.freq;
 	wav->wave.len = head.len;
 	wav->wave.loop_len = head.loop_len; 
-	wav->rom_addr = dfs_rom_addr(fn) + head.start_offset;
+	wav->format = head.format;
+	uint32_t rom_addr = dfs_rom_addr(fn);
+	assertf(rom_addr != 0, "wav64 %s: cannot be streamed (compressed files are not supported)\n", fn);
+	wav->rom_addr = rom_addr + head.start_offset;
+
+	if (head.format == WAV64_FORMAT_VADPCM) {
+		wav64_vadpcm_header_t vhead;
+		dfs_read(&vhead, 1, sizeof(vhead), fh);
+		assertf(vhead.npredictors >= 1 && vhead.npredictors <= WAV64_VADPCM_MAX_PREDICTORS && vhead.order == 2,
+			"wav64 %s: invalid VADPCM codebook: %d predictors, order %d\n", fn, vhead.npredictors, vhead.order);
+		assertf(head.nbits == 16, "wav64 %s: invalid VADPCM sample size: %d\n", fn, head.nbits);
+
+		// Unused predictors are left zeroed: frames only select valid ones
+		for (int ch=0; ch<head.channels; ch++)
+			dfs_read(wav->vadpcm.book[ch], 1, vhead.npredictors * sizeof(wav->vadpcm.book[ch][0]), fh);
+		memcpy(wav->vadpcm.loop_state, vhead.loop_state, sizeof(vhead.loop_state));
+		wav->vadpcm.last_frame = -1;
+
+		// The codebook is read by the RSP via DMA
+		data_cache_hit_writeback(wav->vadpcm.book, sizeof(wav->vadpcm.book));
+	}
 	dfs_close(fh);
 
 	wav->wave.read = waveform_read;
@@ -77,3 +396,26 @@ void wav64_set_loop(wav64_t *wav, bool loop) {
 	if (wav->wave.bits == 8 && wav->wave.loop_len & 1)
 		wav->wave.loop_len -= 1;
 }
+
+void wav64_set_stream_buffer(wav64_t *wav, void *buf, int size) {
+	// Wait for pending transfers into the previous buffer
+	for (int i=0; i<2; i++) {
+		if (wav->stream.size)
+			stream_wait(wav, i);
+		wav->stream.len[i] = 0;
+		wav->stream.busy[i] = false;
+	}
+
+	if (!buf) {
+		wav->stream.buf[0] = wav->stream.buf[1] = NULL;
+		wav->stream.size = 0;
+		return;
+	}
+
+	assertf(((uint32_t)buf & 15) == 0, "wav64 %s: stream buffer must be 16-byte aligned\n", wav->wave.name);
+	assertf(size >= 64 && (size & 31) == 0, "wav64 %s: invalid stream buffer size: %d\n", wav->wave.name, size);
+
+	wav->stream.size = size / 2;
+	wav->stream.buf[0] = (uint8_t*)buf;
+	wav->stream.buf[1] = (uint8_t*)buf + size / 2;
+}
@@ -0,0 +1,158 @@
+/**
+ * @file bundle.c
+ * @brief Asset bundles
+ * @ingroup dfs
+ */
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include "dragonfs.h"
+#include "dfsinternal.h"
+#include "bundle.h"
+
+/**
+ * @addtogroup dfs
+ * @{
+ *
+ * Images built with 'mkdfs --bundles' store each directory named *.bundle as
+ * a single file, which packs all the files in it together with a table of
+ * contents (see #dfs_bundle_header_t). #bundle_load reads a bundle into memory
+ * with a single large transfer, instead of opening and reading each file; the
+ * members are then accessed in place with #bundle_get. This is the fastest way
+ * to load a set of assets that are always used together, like the contents of
+ * a level.
+ */
+
+_Static_assert(sizeof(bundle_file_t) == sizeof(dfs_bundle_entry_t), "invalid bundle_file_t size");
+_Static_assert(sizeof(bundle_t) == sizeof(dfs_bundle_header_t), "invalid bundle_t size");
+
+/**
+ * @brief Return the size of the memory required to load a bundle
+ *
+ * @param[in] path
+ *            Path of the bundle (eg: "level1.bundle")
+ *
+ * @return The size in bytes, or a negative value on error.
+ */
+int bundle_size(const char * const path)
+{
+    int fh = dfs_open(path);
+
+    if(fh < 0)
+    {
+        return fh;
+    }
+
+    int size = dfs_size(fh);
+    dfs_close(fh);
+
+    return size;
+}
+
+/**
+ * @brief Load a bundle into memory
+ *
+ * The bundle is read with a single call to #dfs_read, which transfers it with
+ * DMA straight into the destination. Then the table of contents is converted
+ * in place into pointers to the members, which stay where they were loaded.
+ *
+ * @param[in] path
+ *            Path of the bundle (eg: "level1.bundle")
+ * @param[in] arena
+ *            Arena to allocate the bundle from (#bundle_size bytes, aligned to
+ *            16 bytes), or NULL to allocate it with #dfs_alloc_buffer (to be
+ *            released with free).  On error, the memory allocated from the
+ *            arena is not given back to it.
+ *
+ * @return The loaded bundle (at the start of the allocation), or NULL on error.
+ */
+bundle_t *bundle_load(const char * const path, arena_t *arena)
+{
+    int fh = dfs_open(path);
+
+    if(fh < 0)
+    {
+        return NULL;
+    }
+
+    int size = dfs_size(fh);
+    uint8_t *buf = arena ? arena_alloc_aligned(arena, size, DFS_BUNDLE_ALIGN) : dfs_alloc_buffer(size);
+
+    if(!buf || size < sizeof(bundle_t) || dfs_read(buf, 1, size, fh) != size)
+    {
+        dfs_close(fh);
+        if(!arena) { free(buf); }
+        return NULL;
+    }
+
+    dfs_close(fh);
+
+    bundle_t *bundle = (bundle_t *)buf;
+
+    if(bundle->magic != DFS_BUNDLE_MAGIC || bundle->size != size ||
+       sizeof(bundle_t) + bundle->num_files * sizeof(bundle_file_t) > size)
+    {
+        if(!arena) { free(buf); }
+        return NULL;
+    }
+
+    /* Relocate the table of contents */
+    for(int i = 0; i < bundle->num_files; i++)
+    {
+        dfs_bundle_entry_t *entry = (dfs_bundle_entry_t *)&bundle->files[i];
+
+        if(entry->name >= size || entry->data > size || entry->size > size - entry->data)
+        {
+            if(!arena) { free(buf); }
+            return NULL;
+        }
+
+        bundle->files[i].name = (const char *)(buf + entry->name);
+        bundle->files[i].data = buf + entry->data;
+    }
+
+    return bundle;
+}
+
+/**
+ * @brief Find a member of a loaded bundle
+ *
+ * @param[in]  bundle
+ *             Bundle returned by #bundle_load
+ * @param[in]  name
+ *             Path of the member, relative to the bundle directory (eg: "sub/file.dat")
+ * @param[out] size
+ *             Size of the member in bytes (can be NULL)
+ *
+ * @return A pointer to the data of the member, or NULL if not found.
+ */
+void *bundle_get(const bundle_t *bundle, const char * const name, uint32_t *size)
+{
+    int lo = 0, hi = bundle->num_files - 1;
+
+    /* Members are sorted by name */
+    while(lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(name, bundle->files[mid].name);
+
+        if(cmp == 0)
+        {
+            if(size) { *size = bundle->files[mid].size; }
+            return bundle->files[mid].data;
+        }
+
+        if(cmp < 0)
+        {
+            hi = mid - 1;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+
+    return NULL;
+}
+
+/** @} */ /* dfs */
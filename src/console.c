@@ -36,6 +36,13 @@
  * code wishes to switch to the display subsystem, #console_clear should be called
  * to cleanly shut down the console support.
  *
+ * The console keeps track of the lines that changed since each framebuffer was last
+ * drawn, and only redraws those.  To show the console on top of other graphics (for
+ * example as a debug overlay), use the manual render mode and call #console_render_to
+ * with the display context being drawn: the lines are drawn into it without clearing
+ * the screen, so the console area of the framebuffer must be left untouched by the rest
+ * of the code.
+ *
  * @{
  */
 
@@ -43,10 +50,25 @@
 static void __console_render(void);
 
 /** @brief Size of the console buffer in bytes */
-#define CONSOLE_SIZE        ((sizeof(char) * CONSOLE_WIDTH * CONSOLE_HEIGHT) + sizeof(char))
+#define CONSOLE_SIZE        (sizeof(char) * CONSOLE_WIDTH * CONSOLE_HEIGHT)
 
-/** @brief The console buffer */
+/**
+ * @brief The console buffer
+ *
+ * The buffer is a circular array of #CONSOLE_HEIGHT lines: scrolling the console
+ * just moves #top_line, without moving the text.
+ */
 static char *render_buffer = 0;
+/** @brief Number of characters written in each line of the buffer */
+static uint8_t line_len[CONSOLE_HEIGHT];
+/** @brief Line of the buffer shown at the top of the screen */
+static int top_line;
+/** @brief Column of the cursor */
+static int cursor_x;
+/** @brief Screen line of the cursor (#CONSOLE_HEIGHT if the console must scroll first) */
+static int cursor_y;
+/** @brief Number of times the console scrolled */
+static uint32_t scroll_count;
 /** 
  * @brief Internal state of the render mode
  * @see #RENDER_AUTOMATIC and #RENDER_MANUAL
@@ -55,6 +77,31 @@ static int render_now;
 /** @brief True if the console output is sent to debug channel as well */
 static bool console_redirect_debug = true;
 
+/** @brief Maximum number of framebuffers (see #display_init) */
+#define CONSOLE_MAX_BUFFERS 3
+
+/** @brief Mask with a bit set for each line of the console */
+#define ALL_LINES           (0xFFFFFFFFu >> (32 - CONSOLE_HEIGHT))
+
+_Static_assert(CONSOLE_HEIGHT <= 32, "dirty lines are tracked in a 32-bit mask");
+
+/** @brief Lines changed since each framebuffer was last drawn (indexed by display context - 1) */
+static uint32_t dirty_lines[CONSOLE_MAX_BUFFERS];
+
+/**
+ * @brief Mark lines of the console as changed in all framebuffers
+ *
+ * @param[in] lines
+ *            Mask of the lines that changed
+ */
+static void __console_mark_dirty( uint32_t lines )
+{
+    for( int i = 0; i < CONSOLE_MAX_BUFFERS; i++ )
+    {
+        dirty_lines[i] |= lines;
+    }
+}
+
 /**
  * @brief Set the console rendering mode
  *
@@ -75,11 +122,53 @@ void console_set_render_mode(int mode)
 }
 
 /**
- * @brief Macro to move the console up one line
+ * @brief Get the line of the buffer shown at a line of the screen
+ *
+ * @param[in] y
+ *            Screen line
+ *
+ * @return The index of the line in the buffer
+ */
+static inline int __console_line( int y )
+{
+    return (top_line + y) % CONSOLE_HEIGHT;
+}
+
+/**
+ * @brief Move the console up one line, leaving the cursor on an empty last line
  */
-#define move_buffer() \
-    memmove(render_buffer, render_buffer + (sizeof(char) * CONSOLE_WIDTH), CONSOLE_SIZE - (CONSOLE_WIDTH * sizeof(char))); \
-    pos -= CONSOLE_WIDTH;
+static void __console_scroll( void )
+{
+    top_line = __console_line( 1 );
+    cursor_y = CONSOLE_HEIGHT - 1;
+    line_len[__console_line( cursor_y )] = 0;
+    scroll_count++;
+}
+
+/**
+ * @brief Write a character at the cursor, and advance it
+ *
+ * @param[in] c
+ *            Character to write
+ */
+static inline void __console_putc( char c )
+{
+    if( cursor_y == CONSOLE_HEIGHT )
+    {
+        /* Need to scroll the buffer */
+        __console_scroll();
+    }
+
+    int line = __console_line( cursor_y );
+    render_buffer[line * CONSOLE_WIDTH + cursor_x] = c;
+    line_len[line] = ++cursor_x;
+
+    if( cursor_x == CONSOLE_WIDTH )
+    {
+        cursor_x = 0;
+        cursor_y++;
+    }
+}
 
 /**
  * @brief Newlib hook to allow printf/iprintf to appear on console
@@ -93,7 +182,8 @@ void console_set_render_mode(int mode)
  */
 static int __console_write( char *buf, unsigned int len )
 {
-    int pos = strlen(render_buffer);
+    int first_line = cursor_y;
+    uint32_t scrolls = scroll_count;
 
     /* Redirect to stderr if requested for debugging purposes */
     if (console_redirect_debug)
@@ -102,61 +192,48 @@ static int __console_write( char *buf, unsigned int len )
     /* Copy over to screen buffer */
     for(int x = 0; x < len; x++)
     {
-        if(pos == CONSOLE_WIDTH * CONSOLE_HEIGHT)
-        {
-            /* Need to scroll the buffer */
-            move_buffer();
-        }
-
         switch(buf[x])
         {
             case '\r':
             case '\n':
                 /* Add enough space to get to next line */
-                if(!(pos % CONSOLE_WIDTH))
+                do
                 {
-                    render_buffer[pos++] = ' ';
-                }
-
-                while(pos % CONSOLE_WIDTH)
-                {
-                    render_buffer[pos++] = ' ';
-                }
+                    __console_putc( ' ' );
+                } while(cursor_x);
 
                 /* Make sure we don't run down the end */
-                if(pos == CONSOLE_WIDTH * CONSOLE_HEIGHT)
+                if(cursor_y == CONSOLE_HEIGHT)
                 {
-                    move_buffer();
+                    __console_scroll();
                 }
-
                 break;
             case '\t':
                 /* Add enough spaces to go to the next tab stop */
-                if(!(pos % TAB_WIDTH))
-                {
-                    render_buffer[pos++] = ' ';
-                }
-
-                while(pos % TAB_WIDTH)
+                do
                 {
-                    render_buffer[pos++] = ' ';
-                }
+                    __console_putc( ' ' );
+                } while(cursor_x % TAB_WIDTH);
 
                 /* Make sure we don't run down the end */
-                if(pos == CONSOLE_WIDTH * CONSOLE_HEIGHT)
+                if(cursor_y == CONSOLE_HEIGHT)
                 {
-                    move_buffer();
+                    __console_scroll();
                 }
                 break;
             default:
                 /* Copy character over */
-                render_buffer[pos++] = buf[x];
+                __console_putc( buf[x] );
                 break;
         }
     }
 
-    /* Cap off the end! */
-    render_buffer[pos] = 0;
+    /* Lines from the first one written to the cursor need to be redrawn (all of them
+     * if the buffer scrolled) */
+    if(scroll_count != scrolls) { first_line = 0; }
+    int last_line = cursor_y;
+    if(last_line >= CONSOLE_HEIGHT) { last_line = CONSOLE_HEIGHT - 1; }
+    __console_mark_dirty( (ALL_LINES >> (CONSOLE_HEIGHT - 1 - last_line)) & ~((1u << first_line) - 1) );
     
     /* Out to screen! */
     if(render_now == RENDER_AUTOMATIC)
@@ -180,7 +257,7 @@ void console_init()
     display_close();
     display_init( RESOLUTION_640x240, DEPTH_16_BPP, 2, GAMMA_NONE, ANTIALIAS_RESAMPLE );
 
-    render_buffer = malloc(CONSOLE_SIZE);
+    render_buffer = malloc_tagged(MEM_TAG_CONSOLE, CONSOLE_SIZE);
 
     console_set_render_mode(RENDER_AUTOMATIC);
     console_clear();
@@ -202,7 +279,7 @@ void console_close()
     if(render_buffer)
     {
         /* Nuke the console buffer */
-        free(render_buffer);
+        free_tagged(MEM_TAG_CONSOLE, render_buffer);
         render_buffer = 0;
     }
 
@@ -231,7 +308,10 @@ void console_clear()
     render_now = render;
 
     /* Remove all data */
-    memset(render_buffer, 0, CONSOLE_SIZE);
+    memset(line_len, 0, sizeof(line_len));
+    top_line = 0;
+    cursor_x = cursor_y = 0;
+    __console_mark_dirty( ALL_LINES );
     
     /* Should we display? */
     if(render_now == RENDER_AUTOMATIC)
@@ -241,38 +321,60 @@ void console_clear()
 }
 
 /**
- * @brief Helper function to render the console
+ * @brief Draw the lines of the console that changed since a framebuffer was last drawn
+ *
+ * @param[in] dc
+ *            Display context to draw to
+ * @param[in] clear_screen
+ *            True to clear the whole screen if all lines must be redrawn
  */
-static void __console_render(void)
+static void __console_draw_lines( display_context_t dc, bool clear_screen )
 {
-    if(!render_buffer) { return; }
-
-    static display_context_t dc = 0;
+    assertf(dc > 0 && dc <= CONSOLE_MAX_BUFFERS, "invalid display context: %d", dc);
 
-    /* Wait until we get a valid context */
-    while(!(dc = display_lock()));
+    uint32_t lines = dirty_lines[dc - 1];
+    dirty_lines[dc - 1] = 0;
 
-    /* Background color! */
-    graphics_fill_screen( dc, 0 );
+    if(clear_screen && lines == ALL_LINES)
+    {
+        /* Background color! */
+        graphics_fill_screen( dc, 0 );
+    }
 
     for(int y = 0; y < CONSOLE_HEIGHT; y++)
     {
-        for(int x = 0; x < CONSOLE_WIDTH; x++)
+        if(!(lines & (1u << y))) { continue; }
+
+        if(!clear_screen || lines != ALL_LINES)
         {
-            char t_buf = render_buffer[y * CONSOLE_WIDTH + x];
+            graphics_draw_box( dc, HORIZONTAL_PADDING, VERTICAL_PADDING + 8 * y, 8 * CONSOLE_WIDTH, 8, 0 );
+        }
 
-            if(t_buf == 0)
-            {
-                goto end;
-            }
+        int line = __console_line( y );
+        for(int x = 0; x < line_len[line]; x++)
+        {
+            char t_buf = render_buffer[line * CONSOLE_WIDTH + x];
 
             /* Draw to the screen using the forecolor and backcolor set in the graphics
              * subsystem */
             graphics_draw_character( dc, HORIZONTAL_PADDING + 8 * x, VERTICAL_PADDING + 8 * y, t_buf );
         }
     }
+}
 
-end:;
+/**
+ * @brief Helper function to render the console
+ */
+static void __console_render(void)
+{
+    if(!render_buffer) { return; }
+
+    static display_context_t dc = 0;
+
+    /* Wait until we get a valid context */
+    while(!(dc = display_lock()));
+
+    __console_draw_lines( dc, true );
     /* If the interrupts are disabled, the console wouldn't show to the screen.
      * Since the console is only used for development and emergency context,
      * it is better to force display irrespective of vblank. */
@@ -306,6 +408,30 @@ void console_render()
     __console_render();
 }
 
+/**
+ * @brief Render the console into a display context
+ *
+ * Draw the lines of the console that changed since the last time this framebuffer was
+ * drawn, without clearing the screen and without locking or showing the display context.
+ * This allows to show the console as an overlay on top of other graphics, as long as the
+ * area of the console in the framebuffer is not overwritten: otherwise, call
+ * #console_clear or print the console contents again.
+ *
+ * This should be used in manual rendering mode (see #console_set_render_mode).
+ *
+ * @param[in] disp
+ *            The display context to draw the console to
+ */
+void console_render_to(display_context_t disp)
+{
+    if(!render_buffer || disp == 0) { return; }
+
+    /* Ensure data is flushed before rendering */
+    fflush( stdout );
+
+    __console_draw_lines( disp, false );
+}
+
 /**
  * @brief Send console output to debug channel
  *
@@ -4,6 +4,7 @@
  * @ingroup controller
  */
 
+#include <stdio.h>
 #include <string.h>
 #include "libdragon.h"
 
@@ -31,9 +32,17 @@
  * #get_dpad_direction will return a number signifying the polar direction that the
  * D-Pad is being pressed in.
  *
+ * The same state is available packed by #get_keys_packed: the buttons of the four
+ * controllers fit in a single 64-bit word, so that #get_keys_down_packed,
+ * #get_keys_up_packed and #get_keys_held_packed find the changes of all of them
+ * with a couple of bitwise operations, and a button is tested on all controllers
+ * at once with #CONTROLLER_PACKED_ALL.
+ *
  * To read controllers in a non-managed fashion, call #controller_read.  This will
  * return a structure consisting of all button states on all controllers currently
- * inserted.
+ * inserted.  #controller_read_mixed reads N64 and GameCube controllers plugged
+ * in any combination of ports, with a command block that is built once and reused
+ * as long as the ports do not change.
  *
  * To enable or disable rumbling on a controller, use #rumble_start and #rumble_stop.
  * These functions will turn rumble on and off at full speed respectively, so if
@@ -49,13 +58,110 @@
  * #write_mempak_address.  The @ref mempak handles reading and writing from the mempak
  * in a way compatible with official games.
  *
+ * To benchmark the same gameplay across builds, the state of the controllers read by
+ * #controller_scan and #controller_read can be recorded to a file (for instance on
+ * the SD card, see #debug_init_sdfs) with #controller_record_start, and then replayed
+ * in place of the controllers with #controller_replay_start, frame by frame.  The
+ * recording also stores a seed, such as the #timer_ticks value the game seeds its
+ * random number generator with, so that the replay follows the same course.
+ *
  * @{
  */
 
+/** @brief Magic at the start of the recordings of #controller_record_start ("CREC") */
+#define RECORD_MAGIC            0x43524543
+/** @brief Size of the stdio buffer of the recording, to write to the file in large chunks */
+#define RECORD_BUFFER_SIZE      8192
+
 /** @brief The current sampled controller data */
 static struct controller_data current;
 /** @brief The previously sampled controller data */
 static struct controller_data last;
+/** @brief The current sampled controller data, packed */
+static controller_packed_t current_packed;
+/** @brief The previously sampled buttons, packed */
+static uint64_t last_packed = 0;
+/** @brief Rumble state to send with the next #controller_scan for each controller (-1 if none) */
+static volatile int rumble_pending[4] = { -1, -1, -1, -1 };
+/** @brief When the current controller data was read, see #controller_get_scan_ticks */
+static long long current_ticks = 0;
+
+/** @brief Prebuilt scan reading all the controllers, used when no rumble changes */
+static joybus_cmdlist_t read_list;
+/** @brief True once #read_list is built */
+static bool read_list_ready = false;
+/** @brief Prebuilt block of #controller_read_mixed */
+static joybus_cmdlist_t mixed_list;
+/** @brief GameCube ports of #mixed_list (-1 until built) */
+static int mixed_gc_ports = -1;
+
+/** @brief True if the controllers are sampled from the VI interrupt */
+static bool vi_sampling = false;
+/** @brief Timer delaying the samples after the VI interrupt (NULL to sample right away) */
+static timer_link_t *vi_sampling_timer = 0;
+/** @brief Block to build the commands of the sample in progress in, if rumble changes */
+static joybus_cmdlist_t sample_list;
+/** @brief Commands of the sample in progress (#sample_list or #read_list) */
+static joybus_cmdlist_t *sample_cmds = 0;
+/** @brief Rumble state sent with the sample in progress for each controller (-1 if none) */
+static int sample_rumble[4];
+/** @brief Output block of the sample in progress */
+static uint64_t sample_output[JOYBUS_BLOCK_DWORDS];
+/** @brief Double buffer of samples: the latest one, and the one being read */
+static struct controller_data samples[2];
+/** @brief When each sample was read */
+static long long sample_ticks[2];
+/** @brief Index of the latest sample */
+static volatile int sample_latest = 0;
+/** @brief True while a sample is being read */
+static volatile bool sample_busy = false;
+
+/** @brief File the controller states are recorded to or replayed from (NULL if none) */
+static FILE *record_file = 0;
+/** @brief True if #record_file is being replayed, false if it is being recorded */
+static bool record_replay = false;
+
+/**
+ * @brief Take the next controller state of the recording being replayed
+ *
+ * At the end of the recording, the replay stops.
+ *
+ * @param[out] data
+ *             Structure to place the recorded controller state
+ *
+ * @return True if the state was replayed, false if the controllers must be read
+ */
+static bool __controller_replay( struct controller_data *data )
+{
+    struct SI_condat c[4];
+
+    if( !record_file || !record_replay ) { return false; }
+
+    if( fread( c, sizeof(c), 1, record_file ) != 1 )
+    {
+        /* Back to the controllers */
+        controller_record_stop();
+        return false;
+    }
+
+    memset( data, 0, sizeof(*data) );
+    memcpy( data->c, c, sizeof(c) );
+    return true;
+}
+
+/**
+ * @brief Add a controller state to the recording in progress
+ *
+ * @param[in] data
+ *            Controller state read from the controllers
+ */
+static void __controller_record( const struct controller_data *data )
+{
+    if( record_file && !record_replay )
+    {
+        fwrite( data->c, sizeof(data->c), 1, record_file );
+    }
+}
 
 /** 
  * @brief Initialize the controller subsystem 
@@ -64,6 +170,13 @@ void controller_init( void )
 {
     memset(&current, 0, sizeof(current));
     memset(&last, 0, sizeof(last));
+    memset(&current_packed, 0, sizeof(current_packed));
+    last_packed = 0;
+
+    for( int i = 0; i < 4; i++ )
+    {
+        rumble_pending[i] = -1;
+    }
 }
 
 /**
@@ -90,7 +203,10 @@ void controller_read( struct controller_data * output )
         1
     };
 
+    if( __controller_replay( output ) ) { return; }
+
     joybus_exec( SI_read_con_block, output );
+    __controller_record( output );
 }
 
 /**
@@ -106,38 +222,7 @@ void controller_read( struct controller_data * output )
  */
 void controller_read_gc( struct controller_data * outdata, const uint8_t rumble[4] )
 {
-    static const unsigned long long SI_read_con_block[8] =
-    {
-        0x0308400300ffffff,
-        0xffffffffff030840,
-        0x0300ffffffffffff,
-        0xffff0308400300ff,
-        0xffffffffffffff03,
-        0x08400300ffffffff,
-        0xfffffffffe000000,
-        1
-    };
-
-    static unsigned long long output[8], input[8];
-
-    memcpy( input, SI_read_con_block, 64 );
-
-    // Fill in the rumbles
-    if (rumble[0])
-        input[0] |= 1LLU << 24;
-    if (rumble[1])
-        input[2] |= 1LLU << 48;
-    if (rumble[2])
-        input[3] |= 1LLU << 8;
-    if (rumble[3])
-        input[5] |= 1LLU << 32;
-
-    joybus_exec( input, output );
-
-    memcpy( &outdata->gc[0], ((uint8_t *) output) + 5, 8 );
-    memcpy( &outdata->gc[1], ((uint8_t *) output) + 5 + 13, 8 );
-    memcpy( &outdata->gc[2], ((uint8_t *) output) + 5 + 13 * 2, 8 );
-    memcpy( &outdata->gc[3], ((uint8_t *) output) + 5 + 13 * 3, 8 );
+    controller_read_mixed( outdata, 0xF, rumble );
 }
 
 /**
@@ -174,6 +259,214 @@ void controller_read_gc_origin( struct controller_origin_data * outdata )
     memcpy( &outdata->gc[3], ((uint8_t *) output) + 3 + 13 * 3, 10 );
 }
 
+/**
+ * @brief Read the controller button status for all controllers, N64 and GC mixed
+ *
+ * Read the N64 controllers and the GameCube controllers immediately, in a single
+ * SI transaction.  The command block is built on the first call, and rebuilt only
+ * when gc_ports changes: the calls that follow only update the rumble of the
+ * GameCube controllers in it.
+ *
+ * @param[out] outdata
+ *             Structure to place the returned controller button status: c[] for
+ *             the N64 ports and gc[] for the GameCube ports (the others are left
+ *             untouched)
+ * @param[in]  gc_ports
+ *             Mask of the ports with a GameCube controller (bit 0 for port 0...)
+ * @param[in]  rumble
+ *             Set to 1 to start rumble, 0 to stop it (GameCube ports only)
+ */
+void controller_read_mixed( struct controller_data * outdata, int gc_ports, const uint8_t rumble[4] )
+{
+    static uint64_t output[JOYBUS_BLOCK_DWORDS];
+
+    gc_ports &= 0xF;
+
+    if( gc_ports != mixed_gc_ports )
+    {
+        static const uint8_t gc_read[2] = { 0x03, 0x00 };
+
+        joybus_cmdlist_init( &mixed_list );
+
+        for( int i = 0; i < 4; i++ )
+        {
+            if( gc_ports & (1 << i) )
+            {
+                joybus_cmdlist_add( &mixed_list, i, 0x40, gc_read, sizeof(gc_read), 8 );
+            }
+            else
+            {
+                joybus_cmdlist_add( &mixed_list, i, 0x01, 0, 0, 4 );
+            }
+        }
+
+        joybus_cmdlist_block( &mixed_list );
+        mixed_gc_ports = gc_ports;
+    }
+
+    /* Fill in the rumbles: the last parameter of each GameCube read, after the
+       receive length, the command and the first parameter */
+    for( int i = 0; i < 4; i++ )
+    {
+        if( gc_ports & (1 << i) )
+        {
+            mixed_list.block[mixed_list.result[i] + 3] = rumble[i] != 0;
+        }
+    }
+
+    joybus_exec( mixed_list.block, output );
+
+    for( int i = 0; i < 4; i++ )
+    {
+        int err;
+        const uint8_t *recv = joybus_cmdlist_result( &mixed_list, output, i, &err );
+
+        if( gc_ports & (1 << i) )
+        {
+            memcpy( &outdata->gc[i], recv, 8 );
+        }
+        else
+        {
+            memset( &outdata->c[i], 0, sizeof(outdata->c[i]) );
+            outdata->c[i].err = err;
+            outdata->c[i].data = (recv[0] << 24) | (recv[1] << 16) | (recv[2] << 8) | recv[3];
+        }
+    }
+}
+
+/**
+ * @brief Pack the state of the N64 controllers
+ *
+ * The controllers that did not answer (see #ERROR_NOT_PRESENT) have no button pressed
+ * and the sticks centered.
+ *
+ * @param[in]  data
+ *             Controller data, as returned by #controller_read
+ * @param[out] packed
+ *             Packed state of the controllers
+ */
+void controller_pack( const struct controller_data * data, controller_packed_t * packed )
+{
+    uint64_t buttons = 0;
+
+    for( int i = 0; i < 4; i++ )
+    {
+        /* All ones if the controller answered, zero otherwise */
+        uint32_t v = data->c[i].data & -(uint32_t)(data->c[i].err == ERROR_NONE);
+
+        buttons = (buttons << 16) | (v >> 16);
+        packed->x[i] = (int8_t)(v >> 8);
+        packed->y[i] = (int8_t)v;
+    }
+
+    packed->buttons = buttons;
+}
+
+uint16_t __calc_address_crc( uint16_t address );
+
+/**
+ * @brief Build the block of a scan: a button read, or a pending rumble change, for each controller
+ *
+ * Without rumble changes, the block is always the same: the prebuilt #read_list is
+ * returned instead.
+ *
+ * @param[out] list
+ *             List to build the commands of the scan in, if rumble changes
+ * @param[out] rumble
+ *             Rumble state sent for each controller (-1 if its rumble does not change)
+ *
+ * @return The list of commands of the scan, either list or #read_list
+ */
+static joybus_cmdlist_t *__controller_build_scan( joybus_cmdlist_t *list, int rumble[4] )
+{
+    /* All of them are negative only if no rumble is pending */
+    if( (rumble_pending[0] & rumble_pending[1] & rumble_pending[2] & rumble_pending[3]) < 0 )
+    {
+        for( int i = 0; i < 4; i++ ) { rumble[i] = -1; }
+
+        if( !read_list_ready )
+        {
+            joybus_cmdlist_init( &read_list );
+
+            for( int i = 0; i < 4; i++ )
+            {
+                joybus_cmdlist_add( &read_list, i, 0x01, 0, 0, 4 );
+            }
+
+            joybus_cmdlist_block( &read_list );
+            read_list_ready = true;
+        }
+
+        return &read_list;
+    }
+
+    joybus_cmdlist_init( list );
+
+    for( int i = 0; i < 4; i++ )
+    {
+        int active = rumble_pending[i];
+
+        rumble[i] = -1;
+
+        if( active >= 0 )
+        {
+            uint8_t send[34];
+            uint16_t address = __calc_address_crc( 0xC000 );
+
+            send[0] = address >> 8;
+            send[1] = address & 0xFF;
+            memset( &send[2], active ? 0x01 : 0x00, 32 );
+
+            /* The write returns the CRC of the data */
+            if( joybus_cmdlist_add( list, i, 0x03, send, sizeof(send), 1 ) == 0 )
+            {
+                rumble[i] = active;
+                continue;
+            }
+        }
+
+        joybus_cmdlist_add( list, i, 0x01, 0, 0, 4 );
+    }
+
+    joybus_cmdlist_block( list );
+    return list;
+}
+
+/**
+ * @brief Parse the output block of a scan
+ *
+ * @param[in]     list
+ *                List of commands of the scan
+ * @param[in]     output
+ *                Output block
+ * @param[in]     rumble
+ *                Rumble state sent for each controller (-1 if none); those controllers
+ *                keep their previous state
+ * @param[in,out] data
+ *                Controller data to update
+ */
+static void __controller_parse_scan( const joybus_cmdlist_t *list, const void *output, const int rumble[4], struct controller_data *data )
+{
+    for( int i = 0; i < 4; i++ )
+    {
+        int err;
+        const uint8_t *recv = joybus_cmdlist_result( list, output, i, &err );
+
+        if( rumble[i] >= 0 )
+        {
+            /* Keep the change if #rumble_set was called again during the scan */
+            disable_interrupts();
+            if( rumble_pending[i] == rumble[i] ) { rumble_pending[i] = -1; }
+            enable_interrupts();
+            continue;
+        }
+
+        memset( &data->c[i], 0, sizeof(data->c[i]) );
+        data->c[i].err = err;
+        data->c[i].data = (recv[0] << 24) | (recv[1] << 16) | (recv[2] << 8) | recv[3];
+    }
+}
+
 /**
  * @brief Scan the controllers to determine the current button state
  *
@@ -181,15 +474,270 @@ void controller_read_gc_origin( struct controller_origin_data * outdata )
  * must be called before calling #get_keys_down, #get_keys_up,
  * #get_keys_held, #get_keys_pressed or #get_dpad_direction. Only N64
  * controllers supported.
+ *
+ * The rumble changes requested with #rumble_set are sent in the same SI
+ * transaction.  Since the PIF runs a single command per controller, the buttons
+ * of a controller whose rumble changes keep their previous state for this scan.
+ *
+ * With #controller_enable_vi_sampling, this takes the latest sample instead,
+ * without accessing the SI.  While replaying a recording (see #controller_replay_start),
+ * this takes the next recorded state.
  */
 void controller_scan( void )
 {
     /* Remember last */
     memcpy( &last, &current, sizeof(current) );
+    last_packed = current_packed.buttons;
+
+    if( __controller_replay( &current ) )
+    {
+        current_ticks = 0;
+    }
+    else if( vi_sampling )
+    {
+        /* Grab the latest sample */
+        disable_interrupts();
+        memcpy( &current, &samples[sample_latest], sizeof(current) );
+        current_ticks = sample_ticks[sample_latest];
+        enable_interrupts();
+        __controller_record( &current );
+    }
+    else
+    {
+        static joybus_cmdlist_t list;
+        static uint64_t output[JOYBUS_BLOCK_DWORDS];
+        int rumble[4];
+
+        /* Pack the button reads and the rumble changes in one block */
+        joybus_cmdlist_t *cmds = __controller_build_scan( &list, rumble );
+        joybus_exec( cmds->block, output );
+
+        /* Grab current */
+        __controller_parse_scan( cmds, output, rumble, &current );
+        current_ticks = 0;
+        __controller_record( &current );
+    }
+
+    controller_pack( &current, &current_packed );
+}
+
+/**
+ * @brief Completion of the scan started by the VI interrupt (called by the SI interrupt)
+ */
+static void __controller_sample_done( void *output )
+{
+    int next = sample_latest ^ 1;
+
+    /* Start from the previous sample, for controllers whose rumble changed */
+    memcpy( &samples[next], &samples[sample_latest], sizeof(samples[next]) );
+    __controller_parse_scan( sample_cmds, output, sample_rumble, &samples[next] );
+    sample_ticks[next] = timer_ticks();
+
+    sample_latest = next;
+    sample_busy = false;
+}
+
+/**
+ * @brief Start an asynchronous scan of the controllers
+ */
+static void __controller_sample( int ovfl )
+{
+    /* The previous scan is still in progress */
+    if( sample_busy ) { return; }
+
+    sample_cmds = __controller_build_scan( &sample_list, sample_rumble );
+    sample_busy = joybus_exec_async( sample_cmds->block, sample_output, __controller_sample_done ) == 0;
+}
+
+/**
+ * @brief VI interrupt handler of the sampling mode
+ */
+static void __controller_vi_handler( void *ctx )
+{
+    if( vi_sampling_timer ) { restart_timer( vi_sampling_timer ); }
+    else { __controller_sample( 0 ); }
+}
+
+/**
+ * @brief Sample the controllers from the VI interrupt
+ *
+ * Instead of reading the controllers when #controller_scan is called, which makes the
+ * input latency depend on when the game loop gets to it, the controllers are read
+ * in the background, a fixed number of lines after the VI interrupt (by default, at
+ * the vertical blank when enabled by #display_init, see #set_VI_interrupt).
+ * #controller_scan then just takes the latest sample, and #controller_get_scan_ticks
+ * tells when it was read.
+ *
+ * The rumble changes requested with #rumble_set are sent with the samples.  The timer
+ * subsystem must be initialized (see #timer_init).
+ *
+ * @param[in] lines
+ *            Number of lines to wait after the VI interrupt before reading the
+ *            controllers, for instance to sample input as late as possible before
+ *            the game logic of the frame runs
+ */
+void controller_enable_vi_sampling( int lines )
+{
+    assertf( lines >= 0, "invalid number of lines: %d", lines );
+    controller_disable_vi_sampling();
+
+    if( lines )
+    {
+        /* A line lasts 1/(60*263) s in NTSC and M-PAL, 1/(50*313) s in PAL */
+        int line_us = get_tv_type() == TV_PAL ? 64 : 63;
+        vi_sampling_timer = new_timer( TIMER_TICKS( lines * line_us ), TF_ONE_SHOT | TF_DISABLED, __controller_sample );
+    }
+
+    /* Start with the current state of the controllers */
+    controller_scan();
+    memcpy( &samples[0], &current, sizeof(current) );
+    sample_ticks[0] = timer_ticks();
+    sample_latest = 0;
+    sample_busy = false;
+
+    disable_interrupts();
+    vi_sampling = true;
+    register_interrupt_handler_nofpu( INTERRUPT_VI, __controller_vi_handler, 0 );
+    enable_interrupts();
+}
+
+/**
+ * @brief Stop sampling the controllers from the VI interrupt
+ *
+ * #controller_scan reads the controllers again.
+ */
+void controller_disable_vi_sampling( void )
+{
+    if( !vi_sampling ) { return; }
+
+    disable_interrupts();
+    vi_sampling = false;
+    unregister_interrupt_handler( INTERRUPT_VI, __controller_vi_handler, 0 );
+    enable_interrupts();
+
+    if( vi_sampling_timer )
+    {
+        delete_timer( vi_sampling_timer );
+        vi_sampling_timer = 0;
+    }
+
+    /* Let the scan in progress complete */
+    while( joybus_async_busy() ) { ; }
+}
+
+/**
+ * @brief Return when the controller state of the last #controller_scan was read
+ *
+ * @return The value of #timer_ticks when the controllers were sampled, with
+ *         #controller_enable_vi_sampling (0 otherwise)
+ */
+long long controller_get_scan_ticks( void )
+{
+    return current_ticks;
+}
+
+/**
+ * @brief Start recording the state of the controllers
+ *
+ * From now on, each state read by #controller_scan or #controller_read is added to
+ * the recording, which can be replayed with #controller_replay_start.  The file is
+ * written in large chunks, and completed by #controller_record_stop.
+ *
+ * @param[in] path
+ *            Path of the file to write (eg: "sd:/run.rec")
+ * @param[in] seed
+ *            Value to store with the recording, returned when replaying it (for
+ *            instance the #timer_ticks value used to seed the random number generator)
+ *
+ * @return 0 on success, or -1 if the file cannot be written
+ */
+int controller_record_start( const char * const path, uint32_t seed )
+{
+    uint32_t header[2] = { RECORD_MAGIC, seed };
+
+    controller_record_stop();
+
+    FILE *f = fopen( path, "wb" );
+
+    if( !f ) { return -1; }
+
+    setvbuf( f, NULL, _IOFBF, RECORD_BUFFER_SIZE );
+
+    if( fwrite( header, sizeof(header), 1, f ) != 1 )
+    {
+        fclose( f );
+        return -1;
+    }
+
+    record_file = f;
+    record_replay = false;
+    return 0;
+}
 
-    /* Grab current */
-    memset( &current, 0, sizeof(current) );
-    controller_read( &current );
+/**
+ * @brief Replay a recording in place of the controllers
+ *
+ * From now on, #controller_scan and #controller_read return the states of the recording
+ * made by #controller_record_start, one per call, instead of reading the controllers,
+ * until the end of the recording is reached (see #controller_is_replaying).  Rumble
+ * changes are not sent to the controllers during the replay.
+ *
+ * @param[in]  path
+ *             Path of the recording (eg: "sd:/run.rec", or "usb:/run.rec" once pushed
+ *             by the PC, see #debug_usbfs_poll)
+ * @param[out] seed
+ *             Where to store the seed passed to #controller_record_start (can be NULL)
+ *
+ * @return 0 on success, -1 if the file cannot be read, or -2 if it is not a recording
+ */
+int controller_replay_start( const char * const path, uint32_t *seed )
+{
+    uint32_t header[2];
+
+    controller_record_stop();
+
+    FILE *f = fopen( path, "rb" );
+
+    if( !f ) { return -1; }
+
+    setvbuf( f, NULL, _IOFBF, RECORD_BUFFER_SIZE );
+
+    if( fread( header, sizeof(header), 1, f ) != 1 || header[0] != RECORD_MAGIC )
+    {
+        fclose( f );
+        return -2;
+    }
+
+    if( seed ) { *seed = header[1]; }
+
+    record_file = f;
+    record_replay = true;
+    return 0;
+}
+
+/**
+ * @brief Stop the recording or the replay in progress
+ *
+ * The controllers are read again.
+ */
+void controller_record_stop( void )
+{
+    if( !record_file ) { return; }
+
+    fclose( record_file );
+    record_file = 0;
+    record_replay = false;
+}
+
+/**
+ * @brief Check whether a recording is being replayed
+ *
+ * @return True if the controller states come from a recording, false if they
+ *         are read from the controllers (including once the replay has ended)
+ */
+bool controller_is_replaying( void )
+{
+    return record_file && record_replay;
 }
 
 /**
@@ -280,6 +828,55 @@ struct controller_data get_keys_pressed( void )
     return current;
 }
 
+/**
+ * @brief Get the packed state of the controllers, regardless of previous state
+ *
+ * The packed equivalent of #get_keys_pressed, see #controller_pack.
+ *
+ * @param[out] packed
+ *             Packed state of the controllers at the last #controller_scan
+ */
+void get_keys_packed( controller_packed_t * packed )
+{
+    *packed = current_packed;
+}
+
+/**
+ * @brief Get the buttons of all controllers that were pressed since the last inspection
+ *
+ * The packed equivalent of #get_keys_down, for the buttons only.
+ *
+ * @return The packed buttons that were just pressed down (see #CONTROLLER_PACKED_PORT)
+ */
+uint64_t get_keys_down_packed( void )
+{
+    return current_packed.buttons & ~last_packed;
+}
+
+/**
+ * @brief Get the buttons of all controllers that were released since the last inspection
+ *
+ * The packed equivalent of #get_keys_up, for the buttons only.
+ *
+ * @return The packed buttons that were just released (see #CONTROLLER_PACKED_PORT)
+ */
+uint64_t get_keys_up_packed( void )
+{
+    return ~current_packed.buttons & last_packed;
+}
+
+/**
+ * @brief Get the buttons of all controllers that were held since the last inspection
+ *
+ * The packed equivalent of #get_keys_held, for the buttons only.
+ *
+ * @return The packed buttons that were held (see #CONTROLLER_PACKED_PORT)
+ */
+uint64_t get_keys_held_packed( void )
+{
+    return current_packed.buttons & last_packed;
+}
+
 /**
  * @brief Return the DPAD calculated direction
  *
@@ -499,7 +1096,7 @@ int get_accessories_present(struct controller_data *out)
  *
  * @return The mempak address | CRC
  */
-static uint16_t __calc_address_crc( uint16_t address )
+uint16_t __calc_address_crc( uint16_t address )
 {
     /* CRC table */
     uint16_t xor_table[16] = { 0x0, 0x0, 0x0, 0x0, 0x0, 0x15, 0x1F, 0x0B, 0x16, 0x19, 0x07, 0x0E, 0x1C, 0x0D, 0x1A, 0x01 };
@@ -536,7 +1133,7 @@ static uint16_t __calc_address_crc( uint16_t address )
  *
  * @return The calculated 8 bit CRC over the data
  */
-static uint8_t __calc_data_crc( uint8_t *data )
+uint8_t __calc_data_crc( uint8_t *data )
 {
     uint8_t ret = 0;
 
@@ -717,6 +1314,132 @@ int write_mempak_address( int controller, uint16_t address, uint8_t *data )
     return ret;
 }
 
+/**
+ * @brief Number of attempts at transferring a block whose CRC does not match
+ */
+#define MEMPAK_RANGE_RETRIES 3
+
+/**
+ * @brief Transfer a range of 32-byte blocks from or to a mempak
+ *
+ * The input block is built once, and only the address (and the data, when writing)
+ * is updated for each block.
+ *
+ * @param[in]     controller
+ *                The controller (0-3)
+ * @param[in]     address
+ *                A 32 byte aligned offset on the mempak
+ * @param[in,out] data
+ *                Data to write, or buffer for the data read
+ * @param[in]     len
+ *                Number of bytes, multiple of 32
+ * @param[in]     write
+ *                True to write, false to read
+ *
+ * @return 0 on success, or the error of the first block that failed (see #read_mempak_address)
+ */
+static int __transfer_mempak_range( int controller, uint16_t address, uint8_t *data, int len, bool write )
+{
+    joybus_cmdlist_t list;
+    uint8_t output[JOYBUS_BLOCK_SIZE];
+    uint8_t send[34];
+
+    if( controller < 0 || controller > 3 ) { return -1; }
+    if( (address & 0x1F) || (len & 0x1F) || len < 0 || address + len > 0x10000 ) { return -1; }
+
+    /* One command per PIF transaction: a read returns 32 bytes and the CRC, a write returns the CRC */
+    memset( send, 0, sizeof(send) );
+    joybus_cmdlist_init( &list );
+    joybus_cmdlist_add( &list, controller, write ? 0x03 : 0x02, send, write ? 34 : 2, write ? 1 : 33 );
+    joybus_cmdlist_block( &list );
+    uint8_t *block = list.block;
+    uint8_t *params = &block[list.result[controller] + 2];
+
+    for( int offset = 0; offset < len; offset += 32 )
+    {
+        uint16_t crc_address = __calc_address_crc( address + offset );
+        params[0] = crc_address >> 8;
+        params[1] = crc_address & 0xFF;
+        if( write ) { memcpy( &params[2], data + offset, 32 ); }
+
+        int ret = -3;
+
+        for( int attempt = 0; attempt < MEMPAK_RANGE_RETRIES && ret == -3; attempt++ )
+        {
+            joybus_exec( block, output );
+
+            const uint8_t *recv = joybus_cmdlist_result( &list, output, controller, 0 );
+            uint8_t crc = __calc_data_crc( write ? data + offset : (uint8_t *)recv );
+            uint8_t pak_crc = recv[write ? 0 : 32];
+
+            if( crc == pak_crc )
+            {
+                if( !write ) { memcpy( data + offset, recv, 32 ); }
+                ret = 0;
+            }
+            else if( crc == (pak_crc ^ 0xFF) )
+            {
+                /* Pak not present! */
+                ret = -2;
+            }
+        }
+
+        if( ret ) { return ret; }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read a range of data from a mempak
+ *
+ * This reads the blocks of the range back to back, and checks the CRC of each of
+ * them, trying again on a mismatch.  The PIF runs a single command per controller in
+ * a transaction, so each 32-byte block still takes its own transaction.
+ *
+ * @param[in]  controller
+ *             Which controller to read the data from (0-3)
+ * @param[in]  address
+ *             A 32 byte aligned offset to read from on the mempak
+ * @param[out] data
+ *             Buffer to place the data read from the mempak
+ * @param[in]  len
+ *             Number of bytes to read, multiple of 32
+ *
+ * @retval 0  if reading was successful
+ * @retval -1 if the controller or the range was invalid
+ * @retval -2 if there was no mempak present in the controller
+ * @retval -3 if the mempak returned invalid data
+ */
+int read_mempak_range( int controller, uint16_t address, uint8_t *data, int len )
+{
+    return __transfer_mempak_range( controller, address, data, len, false );
+}
+
+/**
+ * @brief Write a range of data to a mempak
+ *
+ * See #read_mempak_range.
+ *
+ * @param[in] controller
+ *            Which controller to write the data to (0-3)
+ * @param[in] address
+ *            A 32 byte aligned offset to write to on the mempak
+ * @param[in] data
+ *            Data to write to the mempak
+ * @param[in] len
+ *            Number of bytes to write, multiple of 32
+ *
+ * @retval 0  if writing was successful
+ * @retval -1 if the controller or the range was invalid
+ * @retval -2 if there was no mempak present in the controller
+ * @retval -3 if the mempak returned invalid data
+ */
+int write_mempak_range( int controller, uint16_t address, const uint8_t *data, int len )
+{
+    return __transfer_mempak_range( controller, address, (uint8_t *)data, len, true );
+}
+
 /**
  * @brief Check if connected accesory is transfer pak by setting power to the device on and off and checking that it responds as expected.
  *
@@ -839,4 +1562,20 @@ void rumble_stop( int controller )
     write_mempak_address( controller, 0xC000, data );
 }
 
+/**
+ * @brief Turn rumble on or off for a particular controller, with the next scan
+ *
+ * Unlike #rumble_start and #rumble_stop, which write to the rumblepak right away, this
+ * sends the change in the SI transaction of the next #controller_scan.
+ *
+ * @param[in] controller
+ *            The controller (0-3) who's rumblepak should change
+ * @param[in] active
+ *            True to start rumble, false to stop it
+ */
+void rumble_set( int controller, bool active )
+{
+    rumble_pending[controller & 0x3] = active ? 1 : 0;
+}
+
 /** @} */ /* controller */
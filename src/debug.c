@@ -21,6 +21,7 @@
 // SD implementations
 #include "debug_sdfs_ed64.c"
 #include "debug_sdfs_64drive.c"
+#include "debug_usbfs.c"
 
 /**
  * @defgroup debug Debugging Support
@@ -47,6 +48,9 @@
  *    stored within the ROM image (dragonfs), these debugging features
  *    allow access to an external filesystem in both read and write mode.
  *    Currently, this is possibly on SD cards (#DEBUG_FEATURE_FILE_SD).
+ *    Files can also be pushed from the PC through USB into a RAM
+ *    filesystem (#DEBUG_FEATURE_FILE_USB), to shadow the files of the ROM
+ *    with #overlayfs_attach while iterating on assets.
  *
  * All the debugging features can be disabled at compile-time using
  * the standard "NDEBUG" macro. This is suggested when building
@@ -69,6 +73,17 @@ static char sdfs_logic_drive[3] = { 0 };
 /** @brief debug writer functions (USB, SD, IS64) */
 static void (*debug_writer[3])(const uint8_t *buf, int size) = { 0 };
 
+/** @brief log ring buffer (NULL if logging is synchronous) */
+static uint8_t *log_ring = NULL;
+/** @brief size of the log ring buffer */
+static uint32_t log_ring_size = 0;
+/** @brief total bytes appended to and flushed from the log ring buffer */
+static volatile uint32_t log_head = 0, log_tail = 0;
+/** @brief maximum number of bytes written by each #debug_log_poll */
+static int log_chunk = 0;
+/** @brief bytes dropped because the log ring buffer was full */
+static volatile uint32_t log_dropped = 0, log_dropped_reported = 0;
+
 
 /*********************************************************************
  * Log writers
@@ -219,6 +234,37 @@ static fat_disk_t fat_disk_64drive =
 static FIL fat_files[MAX_FAT_FILES] = {0};
 static DIR find_dir;
 
+// Cluster link maps used by FatFs fast seek, so that seeking does not walk the
+// FAT chain. The static tables cover files made of up to 15 fragments; more
+// fragmented files get a table allocated on the heap.
+#define FAT_LINKMAP_SIZE 32
+static DWORD fat_linkmaps[MAX_FAT_FILES][FAT_LINKMAP_SIZE];
+
+static void __fat_setup_fastseek(FIL *f, DWORD *tbl)
+{
+	f->cltbl = tbl;
+	tbl[0] = FAT_LINKMAP_SIZE;
+	FRESULT res = f_lseek(f, CREATE_LINKMAP);
+	if (res == FR_NOT_ENOUGH_CORE)
+	{
+		// The first item now contains the required size
+		DWORD size = tbl[0];
+		tbl = malloc(size * sizeof(DWORD));
+		if (tbl)
+		{
+			tbl[0] = size;
+			f->cltbl = tbl;
+			res = f_lseek(f, CREATE_LINKMAP);
+		}
+	}
+	if (res != FR_OK)
+	{
+		if (f->cltbl != fat_linkmaps[f - fat_files])
+			free(f->cltbl);
+		f->cltbl = NULL;
+	}
+}
+
 static void *__fat_open(char *name, int flags)
 {
 	int i;
@@ -253,6 +299,10 @@ static void *__fat_open(char *name, int flags)
 		fat_files[i].obj.fs = NULL;
 		return NULL;
 	}
+
+	// Fast seek cannot be used on files that might grow
+	if (fatfs_flags == (FA_READ | FA_OPEN_EXISTING))
+		__fat_setup_fastseek(&fat_files[i], fat_linkmaps[i]);
 	return &fat_files[i];
 }
 
@@ -292,6 +342,11 @@ static int __fat_write(void *file, uint8_t *ptr, int len)
 
 static int __fat_close(void *file)
 {
+	FIL *f = file;
+	if (f->cltbl && f->cltbl != fat_linkmaps[f - fat_files])
+		free(f->cltbl);
+	f->cltbl = NULL;
+
 	FRESULT res = f_close(file);
 	if (res != FR_OK)
 		return -1;
@@ -373,11 +428,32 @@ static bool usb_initialize_once(void) {
 	return ok;
 }
 
-static int __stderr_write(char *buf, unsigned int len)
+static void debug_write_all(const uint8_t *buf, int len)
 {
 	for (int i=0; i<sizeof(debug_writer) / sizeof(debug_writer[0]); i++)
 		if (debug_writer[i])
-			debug_writer[i]((uint8_t*)buf, len);
+			debug_writer[i](buf, len);
+}
+
+static int __stderr_write(char *buf, unsigned int len)
+{
+	if (log_ring)
+	{
+		// Append the whole write, or drop it to keep lines intact
+		disable_interrupts();
+		if (log_head - log_tail + len <= log_ring_size)
+		{
+			for (int i=0; i<len; i++)
+				log_ring[(log_head + i) % log_ring_size] = buf[i];
+			log_head += len;
+		}
+		else
+			log_dropped += len;
+		enable_interrupts();
+		return len;
+	}
+
+	debug_write_all((uint8_t*)buf, len);
 
 	// Pretend stderr is written correctly even if it isn't. 
 	// There's really no benefit in bubbling up I/O errors
@@ -474,6 +550,19 @@ bool debug_init_sdfs(const char *prefix, int npart)
 	return true;
 }
 
+bool debug_init_usbfs(const char *prefix)
+{
+	if (usbfs_attached)
+		return true;
+	if (!usb_initialize_once())
+		return false;
+
+	attach_filesystem(prefix, &usb_fs);
+	usbfs_attached = true;
+	enabled_features |= DEBUG_FEATURE_FILE_USB;
+	return true;
+}
+
 void debug_close_sdfs(void)
 {
 	if (enabled_features & DEBUG_FEATURE_FILE_SD)
@@ -483,8 +572,144 @@ void debug_close_sdfs(void)
 	}
 }
 
+/**
+ * @brief Write up to a number of bytes of the log ring buffer to the logging channels.
+ *
+ * The bytes are written in at most two contiguous chunks (where the ring wraps).
+ *
+ * @return number of bytes still buffered
+ */
+static int debug_log_drain(int max)
+{
+	disable_interrupts();
+	uint32_t tail = log_tail;
+	uint32_t len = log_head - tail;
+	uint32_t dropped = log_dropped - log_dropped_reported;
+	log_dropped_reported += dropped;
+	enable_interrupts();
+
+	if (len > max)
+		len = max;
+
+	while (len > 0)
+	{
+		uint32_t offset = tail % log_ring_size;
+		uint32_t n = log_ring_size - offset;
+		if (n > len)
+			n = len;
+
+		debug_write_all(log_ring + offset, n);
+		tail += n;
+		len -= n;
+	}
+
+	disable_interrupts();
+	log_tail = tail;
+	int left = log_head - tail;
+	enable_interrupts();
+
+	if (dropped)
+	{
+		char msg[48];
+		int n = snprintf(msg, sizeof(msg), "[debug: %lu bytes of log dropped]\n", (unsigned long)dropped);
+		debug_write_all((uint8_t*)msg, n);
+	}
+
+	return left;
+}
+
+/**
+ * @brief Buffer the log in RAM, and write it to the logging channels in background.
+ *
+ * Afterwards, writes to stderr (eg: #debugf) are only appended to a RAM ring buffer,
+ * and #debug_log_poll writes the buffered log to the logging channels, at most a
+ * chunk of bytes at a time. This keeps logging from stalling the game (SD logging
+ * in particular is slow): call #debug_log_poll once per frame, or from a
+ * low-priority thread. When the ring buffer is full, log writes are dropped, and the
+ * number of bytes dropped is reported in the log once there is room again.
+ *
+ * @param size   size of the ring buffer in bytes
+ * @param chunk  maximum number of bytes written by each #debug_log_poll
+ *
+ * @return true if the ring buffer was allocated, false otherwise.
+ */
+bool debug_enable_log_buffer(int size, int chunk)
+{
+	debug_disable_log_buffer();
+
+	uint8_t *ring = malloc(size);
+	if (!ring)
+		return false;
+
+	hook_init_once();
+
+	// Lines are buffered in the ring already
+	setvbuf(stderr, NULL, _IONBF, 0);
+
+	log_ring_size = size;
+	log_chunk = chunk;
+	log_head = log_tail = 0;
+	log_dropped = log_dropped_reported = 0;
+	log_ring = ring;
+	return true;
+}
+
+/**
+ * @brief Write the log to the logging channels synchronously again.
+ *
+ * The buffered log is flushed first.
+ */
+void debug_disable_log_buffer(void)
+{
+	if (!log_ring)
+		return;
+
+	debug_log_flush();
+
+	disable_interrupts();
+	uint8_t *ring = log_ring;
+	log_ring = NULL;
+	enable_interrupts();
+
+	free(ring);
+	setvbuf(stderr, NULL, _IOLBF, BUFSIZ);
+}
+
+/**
+ * @brief Write a chunk of the buffered log to the logging channels.
+ *
+ * @return number of bytes still buffered
+ */
+int debug_log_poll(void)
+{
+	if (!log_ring)
+		return 0;
+	return debug_log_drain(log_chunk);
+}
+
+/**
+ * @brief Write all of the buffered log to the logging channels.
+ */
+void debug_log_flush(void)
+{
+	if (!log_ring)
+		return;
+	while (debug_log_drain(log_ring_size) > 0) {}
+}
+
+/**
+ * @brief Return the number of bytes of log dropped because the ring buffer was full.
+ */
+unsigned long debug_log_dropped(void)
+{
+	return log_dropped;
+}
+
 void debug_assert_func_f(const char *file, int line, const char *func, const char *failedexpr, const char *msg, ...)
 {
+	// Do not lose the log that led to the assertion
+	debug_log_flush();
+
 	console_close();
 	console_init();
 	console_set_debug(true);
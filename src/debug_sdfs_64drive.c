@@ -28,6 +28,11 @@ static DRESULT fat_disk_read_64drive(BYTE* buff, LBA_t sector, UINT count)
 	_Static_assert(FF_MIN_SS == 512, "this function assumes sector size == 512");
 	_Static_assert(FF_MAX_SS == 512, "this function assumes sector size == 512");
 
+	// The sectors are transferred straight into the caller buffer, which
+	// FatFs passes whole for multi-sector reads. Evict it from the cache
+	// once for the whole transfer.
+	data_cache_hit_writeback_invalidate(buff, count*512);
+
 	for (int i=0;i<count;i++)
 	{
 		usb_64drive_wait();
@@ -49,7 +54,6 @@ static DRESULT fat_disk_read_64drive(BYTE* buff, LBA_t sector, UINT count)
 			return FR_DISK_ERR;
 		}
 
-		data_cache_hit_writeback_invalidate(buff, 512);
 		dma_read(buff, D64_CIBASE_ADDRESS + D64_BUFFER, 512);
 		buff += 512;
 	}
@@ -446,7 +446,10 @@ static DRESULT fat_disk_read_everdrive(BYTE* buff, LBA_t sector, UINT count)
 	_Static_assert(FF_MIN_SS == 512, "this function assumes sector size == 512");
 	_Static_assert(FF_MAX_SS == 512, "this function assumes sector size == 512");
 
-	uint8_t crc[8];
+	// The CRC of each block is discarded in an uncached scratch, so that
+	// it does not need any cache maintenance.
+	static uint8_t __attribute__((aligned(16))) crc_buf[16];
+	uint8_t *crc = UncachedAddr(crc_buf);
 	DRESULT ret_val = RES_OK;
 
 	// Overclock the PI
@@ -457,6 +460,11 @@ static DRESULT fat_disk_read_everdrive(BYTE* buff, LBA_t sector, UINT count)
 		ret_val = RES_ERROR; goto cleanup;
 	};
 
+	// The blocks are transferred straight into the caller buffer, which
+	// FatFs passes whole for multi-sector reads, with a single multiple
+	// block read command. Evict it from the cache once for the whole transfer.
+	data_cache_hit_writeback_invalidate(buff, count*512);
+
 	for (int i=0;i<count;i++)
 	{
 		uint16_t timeout = -1;
@@ -482,11 +490,9 @@ static DRESULT fat_disk_read_everdrive(BYTE* buff, LBA_t sector, UINT count)
 
 		set_everdrive_sd_bitlen(4);
 
-		data_cache_hit_writeback_invalidate(buff, 512);
 		dma_read(buff,  ED64_BASE_ADDRESS + ED64_SD_IO_BUFFER, 512);
 
 		// TODO: actually check the CRC?
-		data_cache_hit_writeback_invalidate(crc, 8);
 		dma_read(crc, ED64_BASE_ADDRESS + ED64_SD_IO_BUFFER, 8);
 		buff += 512;
 	}
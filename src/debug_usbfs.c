@@ -0,0 +1,276 @@
+#include <stdbool.h>
+#include <malloc.h>
+
+/*********************************************************************
+ * USB filesystem: files pushed from the PC, stored in RDRAM
+ *********************************************************************/
+
+// Magic of the packets that push a file ("HRLD")
+#define USBFS_PACKET_MAGIC    0x48524C44
+
+// Maximum number of files that can be pushed
+#define USBFS_MAX_FILES       64
+
+// Maximum length of the path of a pushed file
+#define USBFS_MAX_PATH        255
+
+// Payloads this large are DMA'd straight from the cart in background
+#define USBFS_ASYNC_MIN_SIZE  4096
+
+// Header of a packet pushing a file, sent as DATATYPE_RAWBINARY. It
+// is followed by the path (not NUL terminated), padded so that the
+// file contents start at a multiple of 8 bytes from the packet start.
+typedef struct {
+	uint32_t magic;
+	uint32_t size;
+	uint32_t path_len;
+} usbfs_packet_t;
+
+// Contents of a pushed file, shared by the entry and the open handles
+typedef struct {
+	int refs;
+	int size;
+	uint8_t *data;
+} usbfs_blob_t;
+
+typedef struct {
+	char *name;
+	usbfs_blob_t *blob;
+} usbfs_entry_t;
+
+typedef struct {
+	usbfs_blob_t *blob;
+	int pos;
+} usbfs_file_t;
+
+static bool usbfs_attached = false;
+static usbfs_entry_t usbfs_entries[USBFS_MAX_FILES];
+
+// File being received in background
+static char usbfs_pending_name[USBFS_MAX_PATH+1];
+static usbfs_blob_t *usbfs_pending_blob = NULL;
+
+static usbfs_blob_t *usbfs_blob_new(int size)
+{
+	usbfs_blob_t *blob = malloc(sizeof(usbfs_blob_t));
+	if (!blob)
+		return NULL;
+	// Aligned, so that the payload can be DMA'd into it
+	blob->data = memalign(16, size ? size : 16);
+	if (!blob->data) {
+		free(blob);
+		return NULL;
+	}
+	blob->refs = 1;
+	blob->size = size;
+	return blob;
+}
+
+static void usbfs_blob_unref(usbfs_blob_t *blob)
+{
+	if (blob && --blob->refs == 0) {
+		free(blob->data);
+		free(blob);
+	}
+}
+
+static usbfs_entry_t *usbfs_find(const char *name)
+{
+	while (*name == '/')
+		name++;
+	for (int i=0; i<USBFS_MAX_FILES; i++)
+		if (usbfs_entries[i].name && !strcmp(usbfs_entries[i].name, name))
+			return &usbfs_entries[i];
+	return NULL;
+}
+
+// Replace the contents of a file (or create it) with a blob,
+// taking ownership of it. Open handles keep the old contents.
+static bool usbfs_store(const char *name, usbfs_blob_t *blob)
+{
+	usbfs_entry_t *e = usbfs_find(name);
+	if (!e) {
+		for (int i=0; i<USBFS_MAX_FILES && !e; i++)
+			if (!usbfs_entries[i].name)
+				e = &usbfs_entries[i];
+		if (!e || !(e->name = strdup(name))) {
+			debugf("[debug] usbfs: cannot store %s\n", name);
+			usbfs_blob_unref(blob);
+			return false;
+		}
+		e->blob = NULL;
+	}
+	usbfs_blob_unref(e->blob);
+	e->blob = blob;
+	return true;
+}
+
+static void *__usbfs_open(char *name, int flags)
+{
+	if ((flags & O_ACCMODE) != O_RDONLY)
+		return NULL;
+
+	usbfs_entry_t *e = usbfs_find(name);
+	if (!e)
+		return NULL;
+
+	usbfs_file_t *f = malloc(sizeof(usbfs_file_t));
+	if (!f)
+		return NULL;
+	f->blob = e->blob;
+	f->blob->refs++;
+	f->pos = 0;
+	return f;
+}
+
+static int __usbfs_fstat(void *file, struct stat *st)
+{
+	usbfs_file_t *f = file;
+
+	memset(st, 0, sizeof(struct stat));
+	st->st_size = f->blob->size;
+	st->st_mode = S_IFREG | 0444;
+	return 0;
+}
+
+static int __usbfs_lseek(void *file, int offset, int whence)
+{
+	usbfs_file_t *f = file;
+	int pos;
+	switch (whence)
+	{
+	case SEEK_SET: pos = offset; break;
+	case SEEK_CUR: pos = f->pos + offset; break;
+	case SEEK_END: pos = f->blob->size + offset; break;
+	default: return -1;
+	}
+	if (pos < 0)
+		return -1;
+	f->pos = pos;
+	return pos;
+}
+
+static int __usbfs_read(void *file, uint8_t *ptr, int len)
+{
+	usbfs_file_t *f = file;
+	if (f->pos >= f->blob->size)
+		return 0;
+	if (len > f->blob->size - f->pos)
+		len = f->blob->size - f->pos;
+	memcpy(ptr, f->blob->data + f->pos, len);
+	f->pos += len;
+	return len;
+}
+
+static int __usbfs_close(void *file)
+{
+	usbfs_file_t *f = file;
+	usbfs_blob_unref(f->blob);
+	free(f);
+	return 0;
+}
+
+static filesystem_t usb_fs = {
+	__usbfs_open,
+	__usbfs_fstat,
+	__usbfs_lseek,
+	__usbfs_read,
+	NULL,
+	__usbfs_close,
+	NULL,
+	NULL,
+	NULL
+};
+
+// Complete the reception of a file, storing it and notifying the caller
+static int usbfs_commit(const char *name, usbfs_blob_t *blob, void (*updated)(const char *name))
+{
+	// Skip anything the host sent after the contents
+	usb_skip(usb_dataleft);
+
+	if (!usbfs_store(name, blob))
+		return 0;
+
+	overlayfs_invalidate(NULL);
+	if (updated)
+		updated(name);
+	return 1;
+}
+
+/**
+ * @brief Receive the files pushed from the PC through USB.
+ *
+ * Each call receives at most one file. Files whose contents are large are
+ * transferred from the cartridge in background, and are made available by
+ * a later call, once the transfer is done. USB packets that do not push a
+ * file are left to be read by the application.
+ *
+ * To push a file, send a DATATYPE_RAWBINARY packet made of a header of
+ * three big-endian 32-bit words (the magic "HRLD", the size of the file
+ * and the length of its path), followed by the path relative to the root
+ * of the filesystem, padded with zeros to a multiple of 8 bytes from the
+ * start of the packet, and then the file contents. The n64hotreload tool
+ * creates such packets.
+ *
+ * @param updated   optional callback called with the path of each file
+ *                  that has been updated (eg: to reload a texture)
+ *
+ * @return number of files that have been updated
+ */
+int debug_usbfs_poll(void (*updated)(const char *name))
+{
+	if (!usbfs_attached)
+		return 0;
+
+	if (usbfs_pending_blob)
+	{
+		if (!usb_async_done())
+			return 0;
+		usbfs_blob_t *blob = usbfs_pending_blob;
+		usbfs_pending_blob = NULL;
+		return usbfs_commit(usbfs_pending_name, blob, updated);
+	}
+
+	uint32_t header = usb_poll();
+	if (USBHEADER_GETTYPE(header) != DATATYPE_RAWBINARY ||
+		USBHEADER_GETSIZE(header) < sizeof(usbfs_packet_t) ||
+		usb_dataleft != usb_datasize)
+		return 0;
+
+	usbfs_packet_t pkt;
+	usb_read(&pkt, sizeof(pkt));
+	int hdr_len = (sizeof(pkt) + pkt.path_len + 7) & ~7;
+	if (pkt.magic != USBFS_PACKET_MAGIC || pkt.path_len == 0 ||
+		pkt.path_len > USBFS_MAX_PATH || pkt.size > usb_datasize ||
+		hdr_len + pkt.size > usb_datasize)
+	{
+		// Not ours: leave it for the application
+		usb_rewind(sizeof(pkt));
+		return 0;
+	}
+
+	char name[USBFS_MAX_PATH+1];
+	usb_read(name, pkt.path_len);
+	name[pkt.path_len] = '\0';
+	usb_skip(hdr_len - sizeof(pkt) - pkt.path_len);
+
+	usbfs_blob_t *blob = usbfs_blob_new(pkt.size);
+	if (!blob)
+	{
+		debugf("[debug] usbfs: not enough memory for %s (%lu bytes)\n", name, (unsigned long)pkt.size);
+		usb_skip(usb_dataleft);
+		return 0;
+	}
+
+	// The file contents start 8-byte aligned in the packet, like the
+	// blob, so they can be DMA'd straight into it
+	if (pkt.size >= USBFS_ASYNC_MIN_SIZE && usb_read_async(blob->data, pkt.size))
+	{
+		strcpy(usbfs_pending_name, name);
+		usbfs_pending_blob = blob;
+		return 0;
+	}
+
+	usb_read(blob->data, pkt.size);
+	return usbfs_commit(name, blob, updated);
+}
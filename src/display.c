@@ -9,6 +9,7 @@
 #include "libdragon.h"
 #include "regsinternal.h"
 #include "n64sys.h"
+#include "system.h"
 
 /**
  * @defgroup display Display Subsystem
@@ -34,6 +35,19 @@
  * #display_show.  Once code has finished rendering all graphics, #display_close can 
  * be used to shut down the display subsystem.
  *
+ * Frames passed to #display_show are displayed in order, one per vertical blank.  With
+ * three buffers, code can render one frame ahead: while a frame is displayed and the
+ * next one is waiting for the vertical blank, the third buffer can be drawn.  When no
+ * buffer is free, #display_lock returns 0, while #display_lock_wait waits for the video
+ * interface to release one.  #display_get_stats reports how the frames were paced.
+ *
+ * For the lowest input latency, a single buffer can be requested: there is no swap, and
+ * the buffer returned by #display_lock is the one being scanned out, so code must draw
+ * each part of the screen right after the VI has displayed it ("racing the beam"), using
+ * #display_get_scanline or #display_get_scanout_y to know where the VI is.  Alternatively,
+ * #display_set_flip_line makes the frames passed to #display_show appear at a chosen line
+ * instead of at the vertical blank.
+ *
  * @{
  */
 
@@ -55,16 +69,6 @@
  */
 #define UNCACHED_ADDR(x)    ((void *)(((uint32_t)(x)) | 0xA0000000))
 
-/**
- * @brief Align a memory address to 64 byte offset
- * 
- * @param[in] x
- *            Unaligned memory address
- *
- * @return An aligned address guaranteed to be >= the unaligned address
- */
-#define ALIGN_64BYTE(x)     ((void *)(((uint32_t)(x)+63) & 0xFFFFFFC0))
-
 /**
  * @name Video Mode Register Presets
  * @brief Presets to use when setting a particular video mode
@@ -188,12 +192,33 @@ void *__safe_buffer[NUM_BUFFERS];
 /** @brief Currently displayed buffer */
 static int now_showing = -1;
 
-/** @brief Complete drawn buffer to display next */
-static int show_next = -1;
+/** @brief Completely drawn buffers to display next, in order */
+static int show_queue[NUM_BUFFERS];
+
+/** @brief Number of buffers in #show_queue */
+static int show_count = 0;
 
 /** @brief Buffer currently being drawn on */
 static int now_drawing = -1;
 
+/** @brief Number of vertical blanks since #display_init */
+static volatile uint32_t vblank_count = 0;
+
+/** @brief Frame pacing statistics */
+static display_stats_t stats;
+
+/** @brief Time at which the buffer being drawn was locked, in ticks */
+static uint32_t lock_ticks;
+
+/** @brief True if the current video mode is interlaced */
+static int interlaced_mode = 0;
+
+/** @brief Line at which frames are flipped, or 0 to flip at the vertical blank (see #display_set_flip_line) */
+static uint32_t flip_line = 0;
+
+/** @brief VI X and Y scale registers to use when displaying each buffer (see #display_set_viewport) */
+static uint32_t vi_scale[NUM_BUFFERS][2];
+
 /**
  * @brief Write a set of video registers to the VI
  *
@@ -234,51 +259,129 @@ static void __write_dram_register( void const * const dram_val )
 }
 
 /**
- * @brief Interrupt handler for vertical blank
+ * @brief Point the VI to a buffer, with its viewport
+ *
+ * @param[in] i
+ *            Index of the buffer to display
+ */
+static void __display_buffer( int i )
+{
+    uint32_t *reg_base = (uint32_t *)REGISTER_BASE;
+
+    __write_dram_register( __safe_buffer[i] );
+    reg_base[12] = vi_scale[i][0];
+    reg_base[13] = vi_scale[i][1];
+    MEMORY_BARRIER();
+    now_showing = i;
+}
+
+/**
+ * @brief Display the next frame of the queue, if any
+ *
+ * @retval 1 if a new frame was displayed
+ * @retval 0 if there was no frame to display
+ */
+static int __display_flip()
+{
+    if( show_count == 0 ) { return 0; }
+
+    __display_buffer( show_queue[0] );
+
+    show_count--;
+    memmove( &show_queue[0], &show_queue[1], show_count * sizeof(show_queue[0]) );
+
+    stats.frames++;
+    return 1;
+}
+
+/**
+ * @brief Interrupt handler for the line at which frames are flipped
  *
  * If there is another frame to display, display the frame
  */
-static void __display_callback()
+static void __display_flip_callback( void *ctx )
 {
     /* Only swap frames if we have a new frame to swap, otherwise just
-       leave up the current frame */
-    if(show_next >= 0 && show_next != now_drawing)
+       leave up the current frame.  With a single buffer there is nothing
+       to swap. */
+    if( !__display_flip() && stats.frames > 0 && __buffers > 1 )
     {
-        __write_dram_register( __safe_buffer[show_next] );
-
-        now_showing = show_next;
-        show_next = -1;
+        stats.missed_vblanks++;
     }
 }
 
 /**
- * @brief Initialize the display to a particular resolution and bit depth
+ * @brief Interrupt handler for vertical blank
  *
- * Initialize video system.  This sets up a double or triple buffered drawing surface which can
- * be blitted or rendered to using software or hardware.
+ * If there is another frame to display and no flip line is set, display the frame
+ */
+static void __display_callback( void *ctx )
+{
+    vblank_count++;
+    stats.vblanks++;
+
+    if( !flip_line ) { __display_flip_callback( ctx ); }
+}
+
+/**
+ * @brief Calculate the VI X scale register to display a given width on the whole screen
  *
- * @param[in] res
- *            The requested resolution
+ * @param[in] width
+ *            Width in pixels
+ *
+ * @return The scale in 2.10 fixed point (the screen is 640 pixels wide)
+ */
+static uint32_t __vi_x_scale( uint32_t width )
+{
+    return (width * 1024 + 320) / 640;
+}
+
+/**
+ * @brief Calculate the VI Y scale register to display a given height on the whole screen
+ *
+ * @param[in] height
+ *            Height in lines
+ * @param[in] interlaced
+ *            True if the video mode is interlaced
+ *
+ * @return The scale in 2.10 fixed point (the screen is 240 lines tall per field); interlaced
+ *         modes offset the second field by half a line
+ */
+static uint32_t __vi_y_scale( uint32_t height, int interlaced )
+{
+    return ((height * 1024 + 120) / 240) | (interlaced ? 0x02000000 : 0);
+}
+
+/**
+ * @brief Initialize the display with a set of VI register values
+ *
+ * @param[in] preset
+ *            The VI register values for the resolution and TV type
+ * @param[in] width
+ *            Width of the framebuffers in pixels
+ * @param[in] height
+ *            Height of the framebuffers in pixels
+ * @param[in] interlaced
+ *            True if the video mode is interlaced (height above 240)
  * @param[in] bit
  *            The requested bit depth
  * @param[in] num_buffers
- *            Number of buffers (2 or 3)
+ *            Number of buffers (1, 2 or 3)
  * @param[in] gamma
  *            The requested gamma setting
  * @param[in] aa
  *            The requested anti-aliasing setting
  */
-void display_init( resolution_t res, bitdepth_t bit, uint32_t num_buffers, gamma_t gamma, antialias_t aa )
+static void __display_init( const uint32_t *preset, uint32_t width, uint32_t height, int interlaced, bitdepth_t bit, uint32_t num_buffers, gamma_t gamma, antialias_t aa )
 {
     uint32_t registers[REGISTER_COUNT];
-    uint32_t tv_type = get_tv_type();
     uint32_t control = 0x3000;
 
     /* Can't have the video interrupt happening here */
     disable_interrupts();
 
-    /* Ensure that buffering is either double or twiple */
-    if( num_buffers != 2 && num_buffers != 3 )
+    /* Ensure that buffering is either single, double or twiple */
+    if( num_buffers < 1 || num_buffers > NUM_BUFFERS )
     {
         __buffers = NUM_BUFFERS;
     }
@@ -287,34 +390,14 @@ void display_init( resolution_t res, bitdepth_t bit, uint32_t num_buffers, gamma
         __buffers = num_buffers;
     }
 
-	switch( res )
-	{
-		case RESOLUTION_640x480:
-			/* Serrate on to stop vertical jitter */
-			control |= 0x40;
-			tv_type += 3;
-			break;
-		case RESOLUTION_256x240:
-			tv_type += 6;
-			break;
-		case RESOLUTION_512x480:
-			/* Serrate on to stop vertical jitter */
-			control |= 0x40;
-			tv_type += 9;
-			break;
-		case RESOLUTION_512x240:
-			tv_type += 12;
-			break;
-		case RESOLUTION_640x240:
-			tv_type += 15;
-			break;
-		case RESOLUTION_320x240:
-		default:
-			break;
+    if( interlaced )
+    {
+        /* Serrate on to stop vertical jitter */
+        control |= 0x40;
     }
 
     /* Copy over to temporary for extra initializations */
-    memcpy( registers, reg_values[tv_type], sizeof( uint32_t ) * REGISTER_COUNT );
+    memcpy( registers, preset, sizeof( uint32_t ) * REGISTER_COUNT );
 
     /* Figure out control register based on input given */
     switch( bit )
@@ -373,64 +456,150 @@ void display_init( resolution_t res, bitdepth_t bit, uint32_t num_buffers, gamma
     __write_registers( registers );
 
     /* Set up the display */
-	switch( res )
-	{
-		case RESOLUTION_320x240:
-			__width = 320;
-			__height = 240;
-			break;
-		case RESOLUTION_640x480:
-			__width = 640;
-			__height = 480;
-			break;
-		case RESOLUTION_256x240:
-			__width = 256;
-			__height = 240;
-			break;
-		case RESOLUTION_512x480:
-			__width = 512;
-			__height = 480;
-			break;
-		case RESOLUTION_512x240:
-			__width = 512;
-			__height = 240;
-			break;
-		case RESOLUTION_640x240:
-			__width = 640;
-			__height = 240;
-			break;
-	}
+    __width = width;
+    __height = height;
+    interlaced_mode = interlaced;
     __bitdepth = ( bit == DEPTH_16_BPP ) ? 2 : 4;
 
     /* Initialize buffers and set parameters */
     for( int i = 0; i < __buffers; i++ )
     {
         /* Set parameters necessary for drawing */
-        /* Grab a location to render to */
-        buffer[i] = malloc( __width * __height * __bitdepth + 63 );
-        __safe_buffer[i] = ALIGN_64BYTE( UNCACHED_ADDR( buffer[i] ) );
+        /* Grab a location to render to, in its own RDRAM bank if possible */
+        buffer[i] = malloc_video( __width * __height * __bitdepth, RDRAM_BANK_ANY );
+        __safe_buffer[i] = UNCACHED_ADDR( buffer[i] );
+        sys_mem_tag_alloc( MEM_TAG_DISPLAY, __width * __height * __bitdepth );
 
         /* Baseline is blank */
         memset( __safe_buffer[i], 0, __width * __height * __bitdepth );
+
+        /* The whole buffer is displayed */
+        vi_scale[i][0] = registers[12];
+        vi_scale[i][1] = registers[13];
     }
 
     /* Set the first buffer as the displaying buffer */
     now_showing = 0;
     now_drawing = -1;
-    show_next = -1;
+    show_count = 0;
+    flip_line = 0;
+    memset( &stats, 0, sizeof(stats) );
 
     /* Show our screen normally */
     registers[1] = (uintptr_t) __safe_buffer[0];
-    registers[9] = reg_values[tv_type][9];
+    registers[9] = preset[9];
     __write_registers( registers );
 
     enable_interrupts();
 
     /* Set which line to call back on in order to flip screens */
-    register_VI_handler( __display_callback );
+    register_interrupt_handler_nofpu( INTERRUPT_VI, __display_callback, 0 );
     set_VI_interrupt( 1, 0x200 );
 }
 
+/**
+ * @brief Initialize the display to a particular resolution and bit depth
+ *
+ * Initialize video system.  This sets up a double or triple buffered drawing surface which can
+ * be blitted or rendered to using software or hardware.
+ *
+ * With a single buffer, the framebuffer is drawn while it is displayed, with no swap: this
+ * removes up to a frame of latency, provided that code draws behind the VI scanout (see
+ * #display_get_scanout_y).
+ *
+ * @param[in] res
+ *            The requested resolution
+ * @param[in] bit
+ *            The requested bit depth
+ * @param[in] num_buffers
+ *            Number of buffers (1, 2 or 3)
+ * @param[in] gamma
+ *            The requested gamma setting
+ * @param[in] aa
+ *            The requested anti-aliasing setting
+ */
+void display_init( resolution_t res, bitdepth_t bit, uint32_t num_buffers, gamma_t gamma, antialias_t aa )
+{
+    uint32_t tv_type = get_tv_type();
+    uint32_t width = 320, height = 240;
+    int interlaced = 0;
+
+	switch( res )
+	{
+		case RESOLUTION_640x480:
+			tv_type += 3;
+			width = 640;
+			height = 480;
+			interlaced = 1;
+			break;
+		case RESOLUTION_256x240:
+			tv_type += 6;
+			width = 256;
+			break;
+		case RESOLUTION_512x480:
+			tv_type += 9;
+			width = 512;
+			height = 480;
+			interlaced = 1;
+			break;
+		case RESOLUTION_512x240:
+			tv_type += 12;
+			width = 512;
+			break;
+		case RESOLUTION_640x240:
+			tv_type += 15;
+			width = 640;
+			break;
+		case RESOLUTION_320x240:
+		default:
+			break;
+    }
+
+    __display_init( reg_values[tv_type], width, height, interlaced, bit, num_buffers, gamma, aa );
+}
+
+/**
+ * @brief Initialize the display with framebuffers of any size
+ *
+ * Same as #display_init, but the framebuffers can have any size up to 640x480: the VI
+ * scales them to the full screen.  Rendering to smaller framebuffers (for example 288x208)
+ * reduces the fill rate and memory bandwidth needed to draw each frame.  Framebuffers
+ * taller than 240 lines use an interlaced video mode.
+ *
+ * To change the size of the framebuffers, call #display_close first.
+ *
+ * @param[in] width
+ *            Width of the framebuffers in pixels (a multiple of 4, up to 640)
+ * @param[in] height
+ *            Height of the framebuffers in pixels (up to 480)
+ * @param[in] bit
+ *            The requested bit depth
+ * @param[in] num_buffers
+ *            Number of buffers (1, 2 or 3)
+ * @param[in] gamma
+ *            The requested gamma setting
+ * @param[in] aa
+ *            The requested anti-aliasing setting
+ */
+void display_init_size( uint32_t width, uint32_t height, bitdepth_t bit, uint32_t num_buffers, gamma_t gamma, antialias_t aa )
+{
+    assertf( width > 0 && width <= 640 && (width % 4) == 0, "invalid framebuffer width: %lu", width );
+    assertf( height > 0 && height <= 480, "invalid framebuffer height: %lu", height );
+
+    int interlaced = height > 240;
+    uint32_t registers[REGISTER_COUNT];
+
+    /* Start from the 320x240 or 640x480 preset for the TV type */
+    memcpy( registers, reg_values[get_tv_type() + (interlaced ? 3 : 0)], sizeof( uint32_t ) * REGISTER_COUNT );
+
+    /* Scale the framebuffer to the whole screen */
+    registers[2] = width;
+    registers[12] = __vi_x_scale( width );
+    registers[13] = __vi_y_scale( height, interlaced );
+
+    __display_init( registers, width, height, interlaced, bit, num_buffers, gamma, aa );
+}
+
 /**
  * @brief Close the display
  *
@@ -442,12 +611,15 @@ void display_close()
     disable_interrupts();
 
     set_VI_interrupt( 0, 0 );
-    unregister_VI_handler( __display_callback );
+    unregister_interrupt_handler( INTERRUPT_VI, __display_callback, 0 );
+    if( flip_line ) { unregister_VI_line_handler( flip_line, __display_flip_callback, 0 ); }
+    flip_line = 0;
 
     now_showing = -1;
     now_drawing = -1;
-    show_next = -1;
+    show_count = 0;
 
+    int size = __width * __height * __bitdepth;
     __width = 0;
     __height = 0;
 
@@ -458,7 +630,8 @@ void display_close()
         /* Free framebuffer memory */
         if( buffer[i] )
         {
-            free( buffer[i]);
+            free_video( buffer[i] );
+            sys_mem_tag_free( MEM_TAG_DISPLAY, size );
         }
 
         buffer[i] = 0;
@@ -475,6 +648,8 @@ void display_close()
  * then this will return 0.  Do not check out more than one display
  * context at a time.
  *
+ * With a single buffer, the buffer being displayed is returned.
+ *
  * @return A valid display context to render to or 0 if none is available.
  */
 display_context_t display_lock()
@@ -486,11 +661,19 @@ display_context_t display_lock()
 
     for( int i = 0; i < __buffers; i++ )
     {
-        if( i != now_showing && i != now_drawing && i != show_next )
+        int queued = 0;
+
+        for( int j = 0; j < show_count; j++ )
+        {
+            if( show_queue[j] == i ) { queued = 1; }
+        }
+
+        if( (i != now_showing || __buffers == 1) && i != now_drawing && !queued )
         {
             /* This screen should be returned */
             now_drawing = i;
             retval = i + 1;
+            lock_ticks = TICKS_READ();
 
             break;
         }
@@ -502,6 +685,61 @@ display_context_t display_lock()
     return retval;
 }
 
+/**
+ * @brief Lock a display buffer for rendering, waiting for one to be available
+ *
+ * Same as #display_lock, but if no buffer is available, wait for the video interface
+ * to release one.  Buffers are only released at vertical blank, so this waits for the
+ * next vertical blank interrupt instead of retrying continuously, letting the other
+ * threads run meanwhile (see #thread_wait_event).  Interrupts must be enabled.
+ *
+ * @return A valid display context to render to.
+ */
+display_context_t display_lock_wait()
+{
+    display_context_t disp;
+
+    assertf( get_interrupts_state() == INTERRUPTS_ENABLED, "display_lock_wait called with interrupts disabled" );
+
+    while( !(disp = display_lock()) )
+    {
+        uint32_t vblank = vblank_count;
+
+        /* Let other threads run until the VI interrupt (see #thread_wait_event).
+           Without threads, this spins until the interrupt handler runs. */
+        while( vblank == vblank_count ) { thread_wait_event( THREAD_EVENT_VI ); }
+    }
+
+    return disp;
+}
+
+/**
+ * @brief Lock a display buffer for rendering, cleared by the RDP
+ *
+ * Same as #display_lock, but the RDP is also attached to the buffer (see
+ * #rdp_attach_display), and a clear of the buffer and of the attached Z-buffer is queued
+ * with #rdp_clear.  The clear runs in background, before the RDP commands that follow,
+ * so it does not cost a pass of the CPU over the framebuffer.  The RDP must have been
+ * initialized with #rdp_init.
+ *
+ * @param[in] color
+ *            Color to clear the buffer to (see #graphics_make_color)
+ *
+ * @return A valid display context to render to or 0 if none is available.
+ */
+display_context_t display_lock_clear( uint32_t color )
+{
+    display_context_t disp = display_lock();
+
+    if( disp )
+    {
+        rdp_attach_display( disp );
+        rdp_clear( color );
+    }
+
+    return disp;
+}
+
 /**
  * @brief Display a previously locked buffer
  *
@@ -525,9 +763,25 @@ void display_show( display_context_t disp )
     /* This should match, or something went awry */
     assertf( i == now_drawing, "display_show_force invoked on non-locked display" );
 
-    /* Ensure we display this next time */
     now_drawing = -1;
-    show_next = i;
+
+    if( __buffers == 1 )
+    {
+        /* Already on screen: just apply the viewport */
+        __display_buffer( i );
+        stats.frames++;
+    }
+    else
+    {
+        /* Queue this for display after the frames already waiting */
+        show_queue[show_count++] = i;
+    }
+
+    stats.last_frame_ticks = TICKS_DISTANCE( lock_ticks, TICKS_READ() );
+    if( stats.last_frame_ticks > stats.max_frame_ticks )
+    {
+        stats.max_frame_ticks = stats.last_frame_ticks;
+    }
 
     enable_interrupts();
 }
@@ -549,7 +803,124 @@ void display_show_force( display_context_t disp )
     /* Can't have the video interrupt screwing this up */
     disable_interrupts();
     display_show(disp);
-    __display_callback();
+
+    /* Skip any frame still waiting, up to this one */
+    while( __display_flip() ) {}
+
+    enable_interrupts();
+}
+
+/**
+ * @brief Set the part of a display context that is scaled to the screen
+ *
+ * By default, the whole framebuffer is displayed.  This makes the VI display only the top
+ * left width x height pixels of the display context, scaled to the whole screen, starting
+ * from the next time it is shown.  This allows to change the rendering resolution from frame
+ * to frame without reallocating the framebuffers (see #rdp_set_dynamic_resolution).
+ *
+ * @param[in] disp
+ *            A display context retrieved using #display_lock
+ * @param[in] width
+ *            Width of the displayed part in pixels (up to the width of the framebuffer)
+ * @param[in] height
+ *            Height of the displayed part in pixels (up to the height of the framebuffer)
+ */
+void display_set_viewport( display_context_t disp, uint32_t width, uint32_t height )
+{
+    if( disp == 0 ) { return; }
+
+    assertf( width > 0 && width <= __width && height > 0 && height <= __height,
+             "invalid viewport: %lux%lu", width, height );
+
+    disable_interrupts();
+    vi_scale[disp - 1][0] = __vi_x_scale( width );
+    vi_scale[disp - 1][1] = __vi_y_scale( height, interlaced_mode );
+    enable_interrupts();
+}
+
+/**
+ * @brief Flip the frames at a chosen line instead of the vertical blank
+ *
+ * The frames passed to #display_show are displayed when the VI reaches the line, instead
+ * of at the vertical blank, so a frame completed just before that line appears in the
+ * current field rather than in the next one.  When the line is inside the visible area,
+ * the part of the screen already scanned out keeps the previous frame (tearing).
+ *
+ * @param[in] line
+ *            The vertical line, in the units of #display_get_scanline, or 0 to flip at
+ *            the vertical blank again
+ */
+void display_set_flip_line( uint32_t line )
+{
+    disable_interrupts();
+
+    if( flip_line ) { unregister_VI_line_handler( flip_line, __display_flip_callback, 0 ); }
+    flip_line = 0;
+
+    if( line )
+    {
+        int ret = register_VI_line_handler( line, __display_flip_callback, 0 );
+        assertf( ret == 0, "too many VI line handlers" );
+        flip_line = line;
+    }
+
+    enable_interrupts();
+}
+
+/**
+ * @brief Get the line currently scanned out by the VI
+ *
+ * @return The VI current line register: half-lines from the start of the field, so that
+ *         the visible area of a non-interlaced screen spans even lines (in interlaced modes,
+ *         the lowest bit is the field).
+ */
+uint32_t display_get_scanline( void )
+{
+    uint32_t *reg_base = (uint32_t *)REGISTER_BASE;
+
+    return reg_base[4] & 0x3FF;
+}
+
+/**
+ * @brief Get the framebuffer row currently scanned out by the VI
+ *
+ * Rows above the returned one have already been displayed in this field: with a single
+ * buffer, they can be drawn again without tearing until the next field starts.
+ *
+ * @return The row of the displayed buffer (taking its viewport into account), -1 during
+ *         the vertical blank before the visible area, or the height of the viewport after it.
+ */
+int display_get_scanout_y( void )
+{
+    uint32_t *reg_base = (uint32_t *)REGISTER_BASE;
+    int line = display_get_scanline();
+    int start = (reg_base[10] >> 16) & 0x3FF;
+    int end = reg_base[10] & 0x3FF;
+
+    if( now_showing < 0 || line < start ) { return -1; }
+    if( line >= end ) { line = end; }
+
+    /* The Y scale is the number of framebuffer rows per screen line, in 2.10 fixed point */
+    int scale = vi_scale[now_showing][1] & 0xFFF;
+    int y = (((line - start) >> 1) * scale) >> 10;
+    if( interlaced_mode ) { y &= ~1; y |= line & 1; }
+
+    return y;
+}
+
+/**
+ * @brief Get the frame pacing statistics
+ *
+ * The statistics are reset by #display_init.  To measure a particular period, take
+ * the difference between the values at its start and end.
+ *
+ * @param[out] out
+ *             Structure to fill with the statistics
+ */
+void display_get_stats( display_stats_t *out )
+{
+    disable_interrupts();
+    *out = stats;
     enable_interrupts();
 }
 
@@ -24,6 +24,14 @@
  * manipulating registers on a cartridge such as a gameshark.  Code should never
  * make raw 32-bit reads or writes in the cartridge domain as it could collide with
  * an in-progress DMA transfer or run into caching issues.
+ *
+ * The functions above issue the transfer immediately, waiting for any in-progress
+ * transfer to finish first. For background streaming, #dma_queue_read and
+ * #dma_queue_write instead append a request to a queue that is drained by the PI
+ * interrupt. Requests are served in priority order, and large requests are split
+ * into chunks of #DMA_QUEUE_CHUNK_SIZE bytes so that a high priority request (eg:
+ * audio streaming) is never stuck behind a long, low priority one. Each request
+ * signals completion through its #dma_request_t::done flag and an optional callback.
  * @{
  */
 
@@ -42,6 +50,30 @@
 /** @brief Structure used to interact with the PI registers */
 static volatile struct PI_regs_s * const PI_regs = (struct PI_regs_s *)0xa4600000;
 
+/** @brief Head of the queue of pending requests, per priority */
+static dma_request_t *dma_queue_head[DMA_PRIORITY_COUNT];
+/** @brief Tail of the queue of pending requests, per priority */
+static dma_request_t *dma_queue_tail[DMA_PRIORITY_COUNT];
+/** @brief Queued request whose chunk is currently in flight on the PI */
+static dma_request_t *dma_queue_cur;
+/** @brief Statistics of the DMA queue */
+static dma_queue_stats_t dma_stats;
+
+/**
+ * @brief Convert an address to the PI bus address of a DMA transfer
+ *
+ * Addresses in the cartridge domain 2 (SRAM and FlashRAM, 0x08000000-0x0FFFFFFF)
+ * are kept as they are. Everything else is mapped to the cartridge ROM, so that
+ * ROM offsets can be used as well as ROM addresses.
+ */
+static uint32_t __pi_bus_address(unsigned long pi_address)
+{
+    pi_address &= 0x1FFFFFFF;
+    if ((pi_address & 0xF8000000) == 0x08000000)
+        return pi_address;
+    return pi_address | 0x10000000;
+}
+
 /** 
  * @brief Return whether the DMA controller is currently busy
  *
@@ -87,7 +119,7 @@ void dma_read_raw_async(void * ram_address, unsigned long pi_address, unsigned l
     MEMORY_BARRIER();
     PI_regs->ram_address = ram_address;
     MEMORY_BARRIER();
-    PI_regs->pi_address = (pi_address | 0x10000000) & 0x1FFFFFFF;
+    PI_regs->pi_address = __pi_bus_address(pi_address);
     MEMORY_BARRIER();
     PI_regs->write_length = len-1;
     MEMORY_BARRIER();
@@ -123,7 +155,7 @@ void dma_write_raw_async(const void * ram_address, unsigned long pi_address, uns
     MEMORY_BARRIER();
     PI_regs->ram_address = (void*)ram_address;
     MEMORY_BARRIER();
-    PI_regs->pi_address = (pi_address | 0x10000000) & 0x1FFFFFFF;
+    PI_regs->pi_address = __pi_bus_address(pi_address);
     MEMORY_BARRIER();
     PI_regs->read_length = len-1;
     MEMORY_BARRIER();
@@ -293,10 +325,11 @@ void dma_read_async(void *ram_address, unsigned long pi_address, unsigned long l
     enable_interrupts();
 }
 
-/** @brief Wait until an async DMA transfer is finished. */
+/** @brief Wait until an async DMA transfer is finished, yielding to other threads. */
 void dma_wait(void)
 {
-    while (__dma_busy()) {}
+    /* Let other threads run meanwhile (see #thread_yield) */
+    while (__dma_busy()) thread_yield();
 }
 
 
@@ -327,6 +360,285 @@ void dma_write(const void * ram_address, unsigned long pi_address, unsigned long
     dma_wait();
 }
 
+/**
+ * @brief Start the PI transfer of the next chunk of a queued request
+ *
+ * The first chunk is shortened so that all following chunks start at an
+ * 8-byte aligned RDRAM address, which keeps them on the fast DMA path.
+ *
+ * @note This function must be called with interrupts disabled.
+ */
+static void __dma_queue_issue(dma_request_t *req)
+{
+    unsigned long ram = (unsigned long)req->ram_address + req->offset;
+    unsigned long pi = req->pi_address + req->offset;
+    unsigned long len = req->len - req->offset;
+
+    if (len > DMA_QUEUE_CHUNK_SIZE)
+        len = DMA_QUEUE_CHUNK_SIZE - (ram & 7);
+
+    req->chunk = len;
+    if (req->write)
+        dma_write_raw_async((void*)ram, pi, len);
+    else
+        dma_read_async((void*)ram, pi, len);
+}
+
+/**
+ * @brief Advance the DMA queue
+ *
+ * Retire the chunk in flight if the PI became idle, and start the next chunk
+ * of the highest priority request. The PI does not tell which transfer raised
+ * an interrupt, so completion is detected by checking that the PI went idle;
+ * this also works when other code issues PI transfers bypassing the queue.
+ *
+ * @note This function must be called with interrupts disabled.
+ */
+static void __dma_queue_poll(void)
+{
+    static bool polling = false;
+
+    /* Completion callbacks may queue new requests: the loop below will pick them up */
+    if (polling) return;
+    polling = true;
+
+    while (!__dma_busy()) {
+        dma_request_t *req = dma_queue_cur;
+
+        if (req) {
+            dma_queue_cur = NULL;
+            req->offset += req->chunk;
+
+            if (req->offset >= req->len) {
+                /* The request is complete: it is always the head of its queue */
+                int p = req->priority;
+                dma_queue_head[p] = req->next;
+                if (!dma_queue_head[p])
+                    dma_queue_tail[p] = NULL;
+                dma_stats.depth[p]--;
+
+                req->done = true;
+                if (req->callback)
+                    req->callback(req, req->ctx);
+                continue;
+            }
+        }
+
+        /* Pick the highest priority request. A partially transferred request
+           stays at the head of its queue, so it is resumed after any higher
+           priority request is served. */
+        req = NULL;
+        for (int p = 0; p < DMA_PRIORITY_COUNT && !req; p++)
+            req = dma_queue_head[p];
+        if (!req)
+            break;
+
+        if (req->offset == 0) {
+            int p = req->priority;
+            uint32_t stall = TICKS_READ() - req->queued_tick;
+            dma_stats.requests[p]++;
+            dma_stats.total_stall[p] += stall;
+            if (stall > dma_stats.max_stall[p])
+                dma_stats.max_stall[p] = stall;
+        }
+
+        dma_queue_cur = req;
+        __dma_queue_issue(req);
+    }
+
+    polling = false;
+}
+
+/** @brief PI interrupt handler draining the DMA queue */
+static void __dma_queue_pi_handler(void)
+{
+    __dma_queue_poll();
+}
+
+/** @brief Append a request to the DMA queue, and start it if the PI is free. */
+static void __dma_queue_push(dma_request_t *req)
+{
+    static bool pi_handler_registered = false;
+    int p = req->priority;
+
+    assert(req->len > 0);
+    assert(p >= 0 && p < DMA_PRIORITY_COUNT);
+
+    disable_interrupts();
+
+    if (!pi_handler_registered) {
+        register_PI_handler(__dma_queue_pi_handler);
+        set_PI_interrupt(1);
+        pi_handler_registered = true;
+    }
+
+    req->done = false;
+    req->offset = 0;
+    req->chunk = 0;
+    req->next = NULL;
+    req->queued_tick = TICKS_READ();
+
+    if (dma_queue_tail[p])
+        dma_queue_tail[p]->next = req;
+    else
+        dma_queue_head[p] = req;
+    dma_queue_tail[p] = req;
+
+    if (++dma_stats.depth[p] > dma_stats.max_depth[p])
+        dma_stats.max_depth[p] = dma_stats.depth[p];
+
+    __dma_queue_poll();
+
+    enable_interrupts();
+}
+
+/**
+ * @brief Queue a read from a peripheral through PI DMA
+ *
+ * The request is appended to the DMA queue and the function returns immediately.
+ * Transfers are performed via #dma_read_async, so the same alignment constraints
+ * apply: RAM and PI addresses must have the same 1-bit misalignment.
+ *
+ * The request structure is owned by the caller and must not be modified until
+ * the request is complete (see #dma_request_done and #dma_request_wait).
+ *
+ * @param[out] req
+ *             Request structure to fill and queue
+ * @param[out] ram_address
+ *             Pointer to a buffer to place read data
+ * @param[in]  pi_address
+ *             Memory address of the peripheral to read from
+ * @param[in]  len
+ *             Length in bytes to read into ram_address
+ * @param[in]  priority
+ *             Priority of the request
+ * @param[in]  callback
+ *             Function to call on completion (can be NULL)
+ * @param[in]  ctx
+ *             Opaque pointer passed to the callback
+ */
+void dma_queue_read(dma_request_t *req, void *ram_address, unsigned long pi_address, unsigned long len,
+    dma_priority_t priority, dma_callback_t callback, void *ctx)
+{
+    req->ram_address = ram_address;
+    req->pi_address = pi_address;
+    req->len = len;
+    req->write = false;
+    req->priority = priority;
+    req->callback = callback;
+    req->ctx = ctx;
+    __dma_queue_push(req);
+}
+
+/**
+ * @brief Queue a write to a peripheral through PI DMA
+ *
+ * Same as #dma_queue_read, but transferring from RDRAM to the peripheral.
+ * Transfers are performed via #dma_write_raw_async, so the RAM address must be
+ * 8-byte aligned, and the PI address and length must be multiple of 2.
+ *
+ * @param[out] req
+ *             Request structure to fill and queue
+ * @param[in]  ram_address
+ *             Pointer to a buffer to read data from
+ * @param[in]  pi_address
+ *             Memory address of the peripheral to write to
+ * @param[in]  len
+ *             Length in bytes to write to the peripheral
+ * @param[in]  priority
+ *             Priority of the request
+ * @param[in]  callback
+ *             Function to call on completion (can be NULL)
+ * @param[in]  ctx
+ *             Opaque pointer passed to the callback
+ */
+void dma_queue_write(dma_request_t *req, const void *ram_address, unsigned long pi_address, unsigned long len,
+    dma_priority_t priority, dma_callback_t callback, void *ctx)
+{
+    req->ram_address = (void*)ram_address;
+    req->pi_address = pi_address;
+    req->len = len;
+    req->write = true;
+    req->priority = priority;
+    req->callback = callback;
+    req->ctx = ctx;
+    __dma_queue_push(req);
+}
+
+/**
+ * @brief Check whether a queued request is complete
+ *
+ * This also advances the queue, so it can be used for polling even when
+ * interrupts are disabled.
+ *
+ * @param[in] req
+ *            A request queued with #dma_queue_read or #dma_queue_write
+ *
+ * @return true if the whole transfer is complete
+ */
+bool dma_request_done(dma_request_t *req)
+{
+    disable_interrupts();
+    __dma_queue_poll();
+    enable_interrupts();
+
+    return req->done;
+}
+
+/**
+ * @brief Wait until a queued request is complete
+ *
+ * @param[in] req
+ *            A request queued with #dma_queue_read or #dma_queue_write
+ */
+void dma_request_wait(dma_request_t *req)
+{
+    while (!dma_request_done(req)) {}
+}
+
+/**
+ * @brief Return the number of requests pending in the DMA queue
+ *
+ * @return Number of requests not yet complete, in all priority levels
+ */
+int dma_queue_depth(void)
+{
+    int depth = 0;
+    for (int p = 0; p < DMA_PRIORITY_COUNT; p++)
+        depth += dma_stats.depth[p];
+    return depth;
+}
+
+/**
+ * @brief Read the statistics of the DMA queue
+ *
+ * @param[out] stats
+ *             Structure to fill with the current statistics
+ */
+void dma_queue_get_stats(dma_queue_stats_t *stats)
+{
+    disable_interrupts();
+    *stats = dma_stats;
+    enable_interrupts();
+}
+
+/**
+ * @brief Reset the statistics of the DMA queue
+ *
+ * The current depth is preserved, as it reflects the state of the queue.
+ */
+void dma_queue_reset_stats(void)
+{
+    disable_interrupts();
+    for (int p = 0; p < DMA_PRIORITY_COUNT; p++) {
+        dma_stats.max_depth[p] = dma_stats.depth[p];
+        dma_stats.requests[p] = 0;
+        dma_stats.total_stall[p] = 0;
+        dma_stats.max_stall[p] = 0;
+    }
+    enable_interrupts();
+}
+
 /**
  * @brief Read a 32 bit integer from a peripheral
  *
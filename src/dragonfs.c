@@ -5,7 +5,9 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <stdint.h>
+#include <malloc.h>
 #include <sys/stat.h>
 #include "libdragon.h"
 #include "system.h"
@@ -33,13 +35,45 @@
  *
  * DFS files have a maximum size of 16,777,216 bytes.  Directories can have an unlimited
  * number of files in them.  Each token (separated by a / in the path) can be 243 characters
- * maximum.  Directories can be 100 levels deep at maximum.  There can be 4 files open
- * simultaneously.
+ * maximum.  Directories can be 100 levels deep at maximum.  By default, there can be
+ * #MAX_OPEN_FILES files open simultaneously; #dfs_set_max_open_files raises the limit.
  *
  * When DFS is initialized, it will register itself with newlib using 'rom:/' as a prefix.
  * Files can be accessed either with standard POSIX functions and the 'rom:/' prefix or
  * with DFS API calls and no prefix.  Files can be opened using both sets of API calls
- * simultaneously as long as no more than four files are open at any one time.
+ * simultaneously, and they share the same limit of open files.
+ *
+ * Additional images (eg: DLC or per-region asset packs appended to the ROM) can be
+ * mounted under their own prefix with #dfs_mount.  Their files are accessed through
+ * newlib, or through the DFS API calls by prefixing the path (eg: "dlc1:/gfx/hero.sprite").
+ * Paths without a prefix, as well as #dfs_chdir and the directory listing functions,
+ * refer to the image passed to #dfs_init.
+ *
+ * Large reads into 8-byte aligned buffers (see #dfs_alloc_buffer) are transferred
+ * from ROM with DMA, without any intermediate copy. To get the same through
+ * fread, open files with #dfs_fopen, which disables the newlib buffering.
+ *
+ * Reads can also be performed asynchronously with #dfs_read_async: the transfer
+ * is queued on the PI and a callback is invoked from the PI interrupt once the
+ * data is available, so that the CPU can keep working while the cartridge is
+ * being read.
+ *
+ * Images built with 'mkdfs --compress' contain files compressed with LZ4 (when
+ * this makes them smaller). They are decompressed transparently by #dfs_read,
+ * which reads the following compressed block in background while decompressing
+ * the current one. Compressed files cannot be accessed via #dfs_rom_addr.
+ *
+ * Images built with 'mkdfs --index' embed a hash table of all file paths, which
+ * is used by #dfs_open and #dfs_rom_addr to find files with a few PI accesses,
+ * instead of walking the directory tree entry by entry.
+ *
+ * The data of each file starts on a sector boundary of the image, so reads from
+ * the beginning of a file always meet the alignment required by the DMA fast
+ * path. Files that are loaded together can be listed in a layout manifest
+ * ('mkdfs --order'): they are placed one after the other, in the given order, at
+ * the start of the image, so that a set of them (eg: the assets of a level) can
+ * be fetched with a single long PI transfer, spanning from the #dfs_rom_desc of
+ * the first file to the end of the last one.
  * @{
  */
 
@@ -67,19 +101,62 @@ enum
     TYPE_DIR
 };
 
-/** @brief Base filesystem pointer */
-static uint32_t base_ptr = 0;
-/** @brief Open file tracking */
-static open_file_t open_files[MAX_OPEN_FILES];
-/** @brief Directory pointer stack */
-static uint32_t directories[MAX_DIRECTORY_DEPTH];
-/** @brief Depth into directory pointer stack */
-static uint32_t directory_top = 0;
-/** @brief Pointer to next directory entry set when doing a directory walk */
-static directory_entry_t *next_entry = 0;
+/** @brief Number of bits of a file handle holding the slot in the open file table */
+#define HANDLE_SLOT_BITS    12
+/** @brief Mask of the slot in a file handle (the slot is stored plus one, so that 0 is never valid) */
+#define HANDLE_SLOT_MASK    ((1 << HANDLE_SLOT_BITS) - 1)
+/** @brief Mask of the generation counter in a file handle (keeps handles positive) */
+#define HANDLE_GEN_MASK     (0x7FFFFFFF >> HANDLE_SLOT_BITS)
+
+/** @brief Maximum length of a mount prefix, including the terminator */
+#define MOUNT_PREFIX_LEN    16
+
+/** @brief State of a mounted DragonFS image */
+typedef struct
+{
+    /** @brief Base filesystem pointer (0 if the mount is unused) */
+    uint32_t base_ptr;
+    /** @brief Location of the path index in cartspace (0 if the image has no index) */
+    uint32_t index_ptr;
+    /** @brief Number of buckets in the path index */
+    uint32_t index_num_buckets;
+    /** @brief Directory pointer stack */
+    uint32_t directories[MAX_DIRECTORY_DEPTH];
+    /** @brief Depth into directory pointer stack */
+    uint32_t directory_top;
+    /** @brief Pointer to next directory entry set when doing a directory walk */
+    directory_entry_t *next_entry;
+    /** @brief Prefix the image is attached to newlib with (eg: "rom:/") */
+    char prefix[MOUNT_PREFIX_LEN];
+} dfs_mount_t;
+
+/** @brief Mounted images (the first one is the image passed to #dfs_init) */
+static dfs_mount_t mounts[DFS_MAX_MOUNTS];
+
+/** @brief Open file tracking, indexed by the slot of the handle */
+static open_file_t *open_files = 0;
+/** @brief Generation counter of each slot, so that stale handles are not valid */
+static uint32_t *open_files_gen = 0;
+/** @brief Stack of the free slots in #open_files */
+static uint16_t *free_slots = 0;
+/** @brief Number of slots in #open_files */
+static int open_files_size = 0;
+/** @brief Number of free slots on the #free_slots stack */
+static int free_slots_top = 0;
+
+/** @brief Directory sector cache: sector contents (16-byte aligned for DMA) */
+static directory_entry_t *sector_cache = 0;
+/** @brief Directory sector cache: cartridge location of each cached sector (0 if empty) */
+static uint32_t *sector_cache_loc = 0;
+/** @brief Directory sector cache: last access stamp of each cached sector, for LRU */
+static uint32_t *sector_cache_stamp = 0;
+/** @brief Number of sectors in the directory sector cache */
+static int sector_cache_size = 0;
+/** @brief Monotonic access counter used to stamp cache entries */
+static uint32_t sector_cache_clock = 0;
 
 /**
- * @brief Read a sector from cartspace
+ * @brief Read a sector from cartspace, bypassing the sector cache
  *
  * This function handles fetching a sector from cartspace into RDRAM using
  * DMA.
@@ -89,32 +166,199 @@ static directory_entry_t *next_entry = 0;
  * @param[out] ram_loc
  *             Pointer to RAM buffer to place the read sector
  */
-static inline void grab_sector(void *cart_loc, void *ram_loc)
+static inline void grab_sector_uncached(void *cart_loc, void *ram_loc)
 {
-    /* Make sure we have fresh cache */
-    data_cache_hit_writeback_invalidate(ram_loc, SECTOR_SIZE);
+    /* Make sure we have fresh cache. A sector is a multiple of the cacheline
+     * size, so an aligned buffer has no hot data to write back. */
+    if (((uint32_t)ram_loc & 15) == 0)
+        data_cache_hit_invalidate(ram_loc, SECTOR_SIZE);
+    else
+        data_cache_hit_writeback_invalidate(ram_loc, SECTOR_SIZE);
 
     dma_read((void *)(((uint32_t)ram_loc) & 0x1FFFFFFF), (uint32_t)cart_loc, SECTOR_SIZE);
 }
 
 /**
- * @brief Find a free open file structure
+ * @brief Read a sector from cartspace
  *
- * @return A pointer to an open file structure or NULL if no more open file structures.
+ * Directory walks visit the same sectors over and over (each #dfs_open
+ * restarts from the current directory), so sectors are kept in a small LRU
+ * cache keyed by cartridge location. A hit costs a 256-byte memcpy instead of
+ * a PI round-trip.
+ *
+ * @param[in]  cart_loc
+ *             Pointer to cartridge location
+ * @param[out] ram_loc
+ *             Pointer to RAM buffer to place the read sector
  */
-static open_file_t *find_free_file()
+static void grab_sector(void *cart_loc, void *ram_loc)
 {
-    for(int i = 0; i < MAX_OPEN_FILES; i++)
+    if(!sector_cache_size)
+    {
+        grab_sector_uncached(cart_loc, ram_loc);
+        return;
+    }
+
+    int lru = 0;
+    sector_cache_clock++;
+
+    for(int i = 0; i < sector_cache_size; i++)
     {
-        if(!open_files[i].handle)
+        if(sector_cache_loc[i] == (uint32_t)cart_loc)
         {
-            /* Found one! */
-            return &open_files[i];
+            /* Hit */
+            sector_cache_stamp[i] = sector_cache_clock;
+            fast_memcpy(ram_loc, &sector_cache[i], SECTOR_SIZE);
+            return;
+        }
+
+        if(sector_cache_stamp[i] < sector_cache_stamp[lru])
+        {
+            lru = i;
         }
     }
 
-    /* No free files */
-    return 0;
+    /* Miss: evict the least recently used sector */
+    grab_sector_uncached(cart_loc, &sector_cache[lru]);
+    sector_cache_loc[lru] = (uint32_t)cart_loc;
+    sector_cache_stamp[lru] = sector_cache_clock;
+    fast_memcpy(ram_loc, &sector_cache[lru], SECTOR_SIZE);
+}
+
+/**
+ * @brief Allocate (or resize) the directory sector cache, and empty it
+ *
+ * @param[in] num_sectors
+ *            Number of sectors to cache (0 disables the cache)
+ *
+ * @return DFS_ESUCCESS on success, or DFS_ENOMEM if the cache cannot be allocated.
+ */
+static int sector_cache_init(int num_sectors)
+{
+    if(num_sectors != sector_cache_size)
+    {
+        free(sector_cache);
+        free(sector_cache_loc);
+        free(sector_cache_stamp);
+        sector_cache = 0;
+        sector_cache_loc = 0;
+        sector_cache_stamp = 0;
+        sector_cache_size = 0;
+
+        if(num_sectors > 0)
+        {
+            sector_cache = memalign(16, num_sectors * SECTOR_SIZE);
+            sector_cache_loc = malloc(num_sectors * sizeof(uint32_t));
+            sector_cache_stamp = malloc(num_sectors * sizeof(uint32_t));
+
+            if(!sector_cache || !sector_cache_loc || !sector_cache_stamp)
+            {
+                free(sector_cache);
+                free(sector_cache_loc);
+                free(sector_cache_stamp);
+                sector_cache = 0;
+                sector_cache_loc = 0;
+                sector_cache_stamp = 0;
+                return DFS_ENOMEM;
+            }
+
+            sector_cache_size = num_sectors;
+        }
+    }
+
+    if(sector_cache_size)
+    {
+        memset(sector_cache_loc, 0, sector_cache_size * sizeof(uint32_t));
+        memset(sector_cache_stamp, 0, sector_cache_size * sizeof(uint32_t));
+    }
+    sector_cache_clock = 0;
+
+    return DFS_ESUCCESS;
+}
+
+/**
+ * @brief Allocate (or resize) the open file table, and mark all the slots free
+ *
+ * @param[in] count
+ *            Number of files that can be open at the same time
+ *
+ * @return DFS_ESUCCESS on success, or DFS_ENOMEM if the table cannot be allocated.
+ */
+static int open_files_init(int count)
+{
+    if(count != open_files_size)
+    {
+        free(open_files);
+        free(open_files_gen);
+        free(free_slots);
+        open_files_size = 0;
+
+        /* The read buffer of each file must be 16-byte aligned */
+        open_files = memalign(16, count * sizeof(open_file_t));
+        open_files_gen = calloc(count, sizeof(uint32_t));
+        free_slots = malloc(count * sizeof(uint16_t));
+
+        if(!open_files || !open_files_gen || !free_slots)
+        {
+            free(open_files);
+            free(open_files_gen);
+            free(free_slots);
+            open_files = 0;
+            open_files_gen = 0;
+            free_slots = 0;
+            free_slots_top = 0;
+            return DFS_ENOMEM;
+        }
+
+        open_files_size = count;
+    }
+
+    memset(open_files, 0, count * sizeof(open_file_t));
+
+    /* Hand out the lowest slots first */
+    for(int i = 0; i < count; i++)
+    {
+        free_slots[i] = count - 1 - i;
+    }
+    free_slots_top = count;
+
+    return DFS_ESUCCESS;
+}
+
+/**
+ * @brief Find a free open file structure, and assign it a new handle
+ *
+ * @return A pointer to an open file structure or NULL if no more open file structures.
+ */
+static open_file_t *alloc_file()
+{
+    if(!free_slots_top)
+    {
+        /* No free files */
+        return 0;
+    }
+
+    int slot = free_slots[--free_slots_top];
+    open_file_t *file = &open_files[slot];
+
+    /* Ensure we always open with a unique handle */
+    open_files_gen[slot] = (open_files_gen[slot] + 1) & HANDLE_GEN_MASK;
+    file->handle = (open_files_gen[slot] << HANDLE_SLOT_BITS) | (slot + 1);
+
+    return file;
+}
+
+/**
+ * @brief Release an open file structure
+ *
+ * @param[in] file
+ *            Open file structure returned by #alloc_file
+ */
+static void release_file(open_file_t *file)
+{
+    /* Closing the handle is easy as zeroing out the file */
+    memset(file, 0, sizeof(open_file_t));
+    free_slots[free_slots_top++] = file - open_files;
 }
 
 /**
@@ -127,19 +371,49 @@ static open_file_t *find_free_file()
  */
 static open_file_t *find_open_file(uint32_t x)
 {
-    if(x == 0) { return 0; }
+    /* The handle tells the slot, the generation tells if it is still open */
+    int slot = (int)(x & HANDLE_SLOT_MASK) - 1;
 
-    for(int i = 0; i < MAX_OPEN_FILES; i++)
+    if(slot < 0 || slot >= open_files_size || open_files[slot].handle != x)
     {
-        if(open_files[i].handle == x)
-        {
-            /* Found it! */
-            return &open_files[i];
-        }
+        /* Couldn't find handle */
+        return 0;
     }
 
-    /* Couldn't find handle */
-    return 0;
+    return &open_files[slot];
+}
+
+/**
+ * @brief Wait for the asynchronous read pending on a file (if any) to complete
+ *
+ * An asynchronous read is made of one or more DMA queue requests, issued
+ * one after the other reusing #open_file::async_req, so keep waiting until
+ * the last one is done.
+ *
+ * @param[in] file
+ *            Open file structure to wait on
+ */
+static void async_wait(open_file_t *file)
+{
+    while(file->async_busy)
+    {
+        dma_request_wait(&file->async_req);
+    }
+}
+
+/**
+ * @brief Wait for the read-ahead prefetch pending on a file (if any) to complete
+ *
+ * @param[in] file
+ *            Open file structure to wait on
+ */
+static void prefetch_wait(open_file_t *file)
+{
+    if(file->prefetch_busy)
+    {
+        dma_request_wait(&file->prefetch_req);
+        file->prefetch_busy = false;
+    }
 }
 
 /**
@@ -225,27 +499,31 @@ static inline uint32_t get_size(directory_entry_t *dirent)
  * This function is used to grab the first directory entry of a subdirectory given
  * the current directory pointer.
  *
+ * @param[in] mnt
+ *            Image the directory entry belongs to
  * @param[in] dirent
  *            Directory entry to retrieve directory pointer from
  *
  * @return A pointer to the directory represented by the directory entry.
  */
-static inline directory_entry_t *get_first_entry(directory_entry_t *dirent)
+static inline directory_entry_t *get_first_entry(dfs_mount_t *mnt, directory_entry_t *dirent)
 {
-    return (directory_entry_t *)(dirent->file_pointer ? (dirent->file_pointer + base_ptr) : 0);
+    return (directory_entry_t *)(dirent->file_pointer ? (dirent->file_pointer + mnt->base_ptr) : 0);
 }
 
 /**
  * @brief Get the next directory entry
  *
+ * @param[in] mnt
+ *            Image the directory entry belongs to
  * @param[in] dirent
  *            Directory entry to retrieve next entry from
  *
  * @return A pointer to the next directory entry after the current directory entry.
  */
-static inline directory_entry_t *get_next_entry(directory_entry_t *dirent)
+static inline directory_entry_t *get_next_entry(dfs_mount_t *mnt, directory_entry_t *dirent)
 {
-    return (directory_entry_t *)(dirent->next_entry ? (dirent->next_entry + base_ptr) : 0);
+    return (directory_entry_t *)(dirent->next_entry ? (dirent->next_entry + mnt->base_ptr) : 0);
 }
 
 /**
@@ -254,73 +532,86 @@ static inline directory_entry_t *get_next_entry(directory_entry_t *dirent)
  * This function is used to grab the starting location of a file given the current
  * directory pointer.
  *
+ * @param[in] mnt
+ *            Image the directory entry belongs to
  * @param[in] dirent
  *            Directory entry to retrieve file pointer from
  *
  * @return A location of the start of the file.
  */
-static inline uint32_t get_start_location(directory_entry_t *dirent)
+static inline uint32_t get_start_location(dfs_mount_t *mnt, directory_entry_t *dirent)
 {
-    return (dirent->file_pointer ? (dirent->file_pointer + base_ptr) : 0);
+    return (dirent->file_pointer ? (dirent->file_pointer + mnt->base_ptr) : 0);
 }
 
 /**
  * @brief Reset the directory stack to the root
+ *
+ * @param[in] mnt
+ *            Image to reset the directory stack of
  */
-static inline void clear_directory()
+static inline void clear_directory(dfs_mount_t *mnt)
 {
-    directory_top = 0;
+    mnt->directory_top = 0;
 }
 
 /**
  * @brief Push a directory onto the stack
  *
+ * @param[in] mnt
+ *            Image to push the directory onto the stack of
  * @param[in] dirent
  *            Directory entry to push onto the stack
  */
-static inline void push_directory(directory_entry_t *dirent)
+static inline void push_directory(dfs_mount_t *mnt, directory_entry_t *dirent)
 {
-    if(directory_top < MAX_DIRECTORY_DEPTH)
+    if(mnt->directory_top < MAX_DIRECTORY_DEPTH)
     {
         /* Order of execution for assignment undefined in C, lets force it */
-        directories[directory_top] = (uint32_t)dirent;
+        mnt->directories[mnt->directory_top] = (uint32_t)dirent;
 
-        directory_top++;
+        mnt->directory_top++;
     }
 }
 
 /**
  * @brief Pop a directory from the stack
  *
+ * @param[in] mnt
+ *            Image to pop the directory from the stack of
+ *
  * @return The directory entry on the top of the stack
  */
-static inline directory_entry_t *pop_directory()
+static inline directory_entry_t *pop_directory(dfs_mount_t *mnt)
 {
-    if(directory_top > 0)
+    if(mnt->directory_top > 0)
     {
         /* Order of execution for assignment undefined in C */
-        directory_top--;
+        mnt->directory_top--;
 
-        return (directory_entry_t *)directories[directory_top];
+        return (directory_entry_t *)mnt->directories[mnt->directory_top];
     }
 
     /* Just return the root pointer */
-    return (directory_entry_t *)(base_ptr + SECTOR_SIZE);
+    return (directory_entry_t *)(mnt->base_ptr + SECTOR_SIZE);
 }
 
 /**
  * @brief Peek at the top directory on the stack
  *
+ * @param[in] mnt
+ *            Image to peek at the directory stack of
+ *
  * @return The directory entry on the top of the stack
  */
-static inline directory_entry_t *peek_directory()
+static inline directory_entry_t *peek_directory(dfs_mount_t *mnt)
 {
-    if(directory_top > 0)
+    if(mnt->directory_top > 0)
     {
-        return (directory_entry_t *)directories[directory_top-1];
+        return (directory_entry_t *)mnt->directories[mnt->directory_top-1];
     }
 
-    return (directory_entry_t *)(base_ptr + SECTOR_SIZE);
+    return (directory_entry_t *)(mnt->base_ptr + SECTOR_SIZE);
 }
 
 /**
@@ -426,6 +717,8 @@ static char *get_next_token(char *path, char *token)
 /**
  * @brief Find a directory node in the current path given a name
  *
+ * @param[in] mnt
+ *            Image to search
  * @param[in] name
  *            Name of the file or directory in question
  * @param[in] cur_node
@@ -433,7 +726,7 @@ static char *get_next_token(char *path, char *token)
  *
  * @return The directory entry matching the name requested or NULL if not found.
  */
-static directory_entry_t *find_dirent(char *name, directory_entry_t *cur_node)
+static directory_entry_t *find_dirent(dfs_mount_t *mnt, char *name, directory_entry_t *cur_node)
 {
     while(cur_node)
     {
@@ -449,7 +742,7 @@ static directory_entry_t *find_dirent(char *name, directory_entry_t *cur_node)
         }
 
         /* Follow linked list */
-        cur_node = get_next_entry(&node);
+        cur_node = get_next_entry(mnt, &node);
     }
 
     /* Couldn't find entry */
@@ -471,6 +764,8 @@ static directory_entry_t *find_dirent(char *name, directory_entry_t *cur_node)
  * The type specifier allows a person to specify that only a directory or file
  * should be returned.  This works for WALK_OPEN only.
  * 
+ * @param[in]     mnt
+ *                Image to walk, whose directory stack is the current directory
  * @param[in]     path
  *                The path to walk through
  * @param[in]     mode
@@ -482,13 +777,13 @@ static directory_entry_t *find_dirent(char *name, directory_entry_t *cur_node)
  *
  * @return DFS_ESUCCESS on successful recurse, or a negative error on failure.
  */
-static int recurse_path(const char * const path, int mode, directory_entry_t **dirent, int type)
+static int recurse_path(dfs_mount_t *mnt, const char * const path, int mode, directory_entry_t **dirent, int type)
 {
     int ret = DFS_ESUCCESS;
     char token[MAX_FILENAME_LEN+1];
     char *cur_path = (char *)path;
     uint32_t dir_stack[MAX_DIRECTORY_DEPTH];
-    uint32_t dir_loc = directory_top;
+    uint32_t dir_loc = mnt->directory_top;
     int last_type = TYPE_ANY;
     int ignore = 1; // Do not, by default, read again during the first while
 
@@ -496,7 +791,7 @@ static int recurse_path(const char * const path, int mode, directory_entry_t **d
     token[0] = 0;
 
     /* Save directory stack */
-    memcpy(dir_stack, directories, sizeof(uint32_t) * MAX_DIRECTORY_DEPTH);
+    memcpy(dir_stack, mnt->directories, sizeof(uint32_t) * MAX_DIRECTORY_DEPTH);
 
     /* Grab first token, make sure it isn't root */
     cur_path = get_next_token(cur_path, token);
@@ -504,7 +799,7 @@ static int recurse_path(const char * const path, int mode, directory_entry_t **d
     if(strcmp(token, "/") == 0)
     {
         /* It is an absolute path */
-        clear_directory();
+        clear_directory(mnt);
 
         /* Ensure that we remember this as a directory */
         last_type = TYPE_DIR;
@@ -529,14 +824,14 @@ static int recurse_path(const char * const path, int mode, directory_entry_t **d
         else if(strcmp(token, "..") == 0)
         {
             /* Up one directory */
-            pop_directory();
+            pop_directory(mnt);
 
             last_type = TYPE_DIR;
         }
         else
         {
             /* Find directory entry, push */
-            directory_entry_t *tmp_node = find_dirent(token, peek_directory());
+            directory_entry_t *tmp_node = find_dirent(mnt, token, peek_directory(mnt));
 
             if(tmp_node)
             {
@@ -549,7 +844,7 @@ static int recurse_path(const char * const path, int mode, directory_entry_t **d
                 if(FILETYPE(flags) == FLAGS_DIR)
                 {
                     /* Push subdirectory onto stack and loop */
-                    push_directory(get_first_entry(&node));
+                    push_directory(mnt, get_first_entry(mnt, &node));
                     last_type = TYPE_DIR;
                 }
                 else
@@ -568,7 +863,7 @@ static int recurse_path(const char * const path, int mode, directory_entry_t **d
                         if(!cur_path)
                         {
                             /* Push file entry onto stack in preparation of a return */
-                            push_directory(tmp_node);
+                            push_directory(mnt, tmp_node);
                         }
                         else
                         {
@@ -599,49 +894,296 @@ static int recurse_path(const char * const path, int mode, directory_entry_t **d
         /* Must return the node found if we found one */
         if(ret == DFS_ESUCCESS && dirent)
         {
-            *dirent = peek_directory();
+            *dirent = peek_directory(mnt);
         }
     }
 
     if(mode == WALK_OPEN || ret != DFS_ESUCCESS)
     {
         /* Restore stack */
-        directory_top = dir_loc;
-        memcpy(directories, dir_stack, sizeof(uint32_t) * MAX_DIRECTORY_DEPTH);
+        mnt->directory_top = dir_loc;
+        memcpy(mnt->directories, dir_stack, sizeof(uint32_t) * MAX_DIRECTORY_DEPTH);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Read a small structure from cartspace
+ *
+ * @param[in]  cart_loc
+ *             Cartridge location
+ * @param[out] ram_loc
+ *             Pointer to RAM buffer
+ * @param[in]  len
+ *             Number of bytes to read
+ */
+static void grab_data(uint32_t cart_loc, void *ram_loc, int len)
+{
+    if ((((uint32_t)ram_loc | len) & 15) == 0)
+        data_cache_hit_invalidate(ram_loc, len);
+    else
+        data_cache_hit_writeback_invalidate(ram_loc, len);
+    dma_read((void *)(((uint32_t)ram_loc) & 0x1FFFFFFF), cart_loc, len);
+}
+
+/**
+ * @brief Look up a file in the path index
+ *
+ * The index can only be used for paths that can be resolved without walking
+ * the directory tree: absolute paths (or relative to the root, when that is
+ * the current directory) not containing "." or ".." components.
+ *
+ * @param[in]  mnt
+ *             Image to search
+ * @param[in]  path
+ *             Path of the file to look up
+ * @param[out] node
+ *             Directory entry of the file (only flags and file pointer are filled)
+ *
+ * @return DFS_ESUCCESS if the file was found, DFS_ENOFILE if the file does
+ *         not exist, or DFS_EBADINPUT if the index cannot be used for this path.
+ */
+static int index_lookup(dfs_mount_t *mnt, const char * const path, directory_entry_t *node)
+{
+    char canon[DFS_INDEX_MAX_PATH];
+    int len = 0;
+    const char *p = path;
+
+    if(!mnt->index_ptr) { return DFS_EBADINPUT; }
+    if(*p != '/' && mnt->directory_top != 0) { return DFS_EBADINPUT; }
+
+    /* Build the canonical path: no leading slash, no repeated slashes */
+    while(*p)
+    {
+        while(*p == '/') { p++; }
+        if(!*p) { break; }
+
+        const char *tok = p;
+        while(*p && *p != '/') { p++; }
+        int toklen = p - tok;
+
+        if((toklen == 1 && tok[0] == '.') || (toklen == 2 && tok[0] == '.' && tok[1] == '.'))
+        {
+            return DFS_EBADINPUT;
+        }
+
+        if(toklen > MAX_FILENAME_LEN || len + toklen + 2 > DFS_INDEX_MAX_PATH)
+        {
+            return DFS_EBADINPUT;
+        }
+
+        if(len) { canon[len++] = '/'; }
+        memcpy(canon + len, tok, toklen);
+        len += toklen;
+    }
+    canon[len] = 0;
+
+    /* Fetch the bucket boundaries */
+    uint32_t hash = dfs_path_hash(canon);
+    uint32_t bucket = hash & (mnt->index_num_buckets - 1);
+    uint32_t range[2] __attribute__((aligned(16)));
+    grab_data(mnt->index_ptr + sizeof(dfs_index_header_t) + bucket * sizeof(uint32_t), range, sizeof(range));
+
+    uint32_t entries = mnt->index_ptr + sizeof(dfs_index_header_t) + (mnt->index_num_buckets + 1) * sizeof(uint32_t);
+
+    for(uint32_t i = range[0]; i < range[1]; i++)
+    {
+        dfs_index_entry_t entry __attribute__((aligned(16)));
+        grab_data(entries + i * sizeof(dfs_index_entry_t), &entry, sizeof(entry));
+
+        if(entry.hash != hash) { continue; }
+
+        /* Same hash: verify the full path. Paths are packed, so they might
+           start at odd addresses: read from the even address before it. */
+        char name[DFS_INDEX_MAX_PATH+2] __attribute__((aligned(16)));
+        uint32_t name_loc = entry.path + mnt->base_ptr;
+        grab_data(name_loc & ~1, name, (name_loc & 1) + len + 1);
+
+        if(memcmp(name + (name_loc & 1), canon, len + 1) == 0)
+        {
+            node->flags = entry.flags;
+            node->file_pointer = entry.file_pointer;
+            return DFS_ESUCCESS;
+        }
+    }
+
+    return DFS_ENOFILE;
+}
+
+/**
+ * @brief Find the directory entry of a file given its path
+ *
+ * Use the path index if available, otherwise walk the directory tree.
+ *
+ * @param[in]  mnt
+ *             Image to search
+ * @param[in]  path
+ *             Path of the file
+ * @param[out] node
+ *             Directory entry of the file
+ *
+ * @return DFS_ESUCCESS on success or a negative error on failure.
+ */
+static int find_file(dfs_mount_t *mnt, const char * const path, directory_entry_t *node)
+{
+    int ret = index_lookup(mnt, path, node);
+
+    if(ret != DFS_EBADINPUT)
+    {
+        return ret;
+    }
+
+    directory_entry_t *dirent;
+    ret = recurse_path(mnt, path, WALK_OPEN, &dirent, TYPE_FILE);
+
+    if(ret == DFS_ESUCCESS)
+    {
+        grab_sector(dirent, node);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Find the image a path refers to
+ *
+ * Paths starting with the prefix of a mounted image (eg: "dlc1:/gfx/hero.sprite")
+ * refer to that image, and are absolute.  All the others refer to the image
+ * passed to #dfs_init.
+ *
+ * @param[in]  path
+ *             Path of a file, optionally with a prefix
+ * @param[out] rest
+ *             Path of the file within the image
+ *
+ * @return The image the file belongs to.
+ */
+static dfs_mount_t *resolve_path(const char * const path, const char **rest)
+{
+    for(int i = 0; i < DFS_MAX_MOUNTS; i++)
+    {
+        int len = strlen(mounts[i].prefix);
+
+        if(mounts[i].base_ptr && len && strncmp(path, mounts[i].prefix, len) == 0)
+        {
+            /* Keep the slash of the prefix, to make the path absolute */
+            *rest = path + len - 1;
+            return &mounts[i];
+        }
     }
 
+    *rest = path;
+    return &mounts[0];
+}
+
+/**
+ * @brief Find the directory entry of a file given its path, from the root of an image
+ *
+ * The current directory of the image is left untouched.
+ *
+ * @param[in]  mnt
+ *             Image to search
+ * @param[in]  path
+ *             Path of the file, relative to the root of the image
+ * @param[out] node
+ *             Directory entry of the file
+ *
+ * @return DFS_ESUCCESS on success or a negative error on failure.
+ */
+static int find_file_from_root(dfs_mount_t *mnt, const char * const path, directory_entry_t *node)
+{
+    uint32_t top = mnt->directory_top;
+
+    /* Paths are walked from the directory on top of the stack, which can be
+       temporarily emptied as walks to open a file restore it */
+    mnt->directory_top = 0;
+    int ret = find_file(mnt, path, node);
+    mnt->directory_top = top;
+
     return ret;
 }
 
+/**
+ * @brief Check a filesystem image, and set up a mount to access it
+ *
+ * @param[out] mnt
+ *             Mount to set up
+ * @param[in]  base_fs_loc
+ *             Location of the filesystem
+ *
+ * @return DFS_ESUCCESS on success, or DFS_EBADFS if there is no valid image at
+ *         the location.
+ */
+static int mount_init(dfs_mount_t *mnt, uint32_t base_fs_loc)
+{
+    /* Check to see if it passes the check */
+    directory_entry_t id_node __attribute__((aligned(16)));
+    grab_sector_uncached((void *)base_fs_loc, &id_node);
+
+    if(id_node.flags != ROOT_FLAGS || id_node.next_entry != ROOT_NEXT_ENTRY ||
+        strcmp(id_node.path, ROOT_PATH))
+    {
+        /* Failed! */
+        return DFS_EBADFS;
+    }
+
+    mnt->base_ptr = base_fs_loc;
+    mnt->next_entry = 0;
+    clear_directory(mnt);
+
+    /* Check for the optional path index */
+    mnt->index_ptr = 0;
+    mnt->index_num_buckets = 0;
+
+    if(id_node.file_pointer)
+    {
+        dfs_index_header_t header __attribute__((aligned(16)));
+        grab_data(base_fs_loc + id_node.file_pointer, &header, sizeof(header));
+
+        if(header.magic == DFS_INDEX_MAGIC && header.num_buckets &&
+            (header.num_buckets & (header.num_buckets - 1)) == 0)
+        {
+            mnt->index_ptr = base_fs_loc + id_node.file_pointer;
+            mnt->index_num_buckets = header.num_buckets;
+        }
+    }
+
+    return DFS_ESUCCESS;
+}
+
 /**
  * @brief Helper functioner to initialize the filesystem
  *
  * @param[in] base_fs_loc
  *            Location of the filesystem
+ * @param[in] cache_sectors
+ *            Number of directory sectors to cache
  *
  * @return DFS_ESUCCESS on successful initialization or a negative error on failure.
  */
-static int __dfs_init(uint32_t base_fs_loc)
+static int __dfs_init(uint32_t base_fs_loc, int cache_sectors)
 {
-    /* Check to see if it passes the check */
-    directory_entry_t id_node;
-    grab_sector((void *)base_fs_loc, &id_node);
+    dfs_mount_t mnt;
 
-    if(id_node.flags == ROOT_FLAGS && id_node.next_entry == ROOT_NEXT_ENTRY && 
-        !strcmp(id_node.path, ROOT_PATH))
+    if(mount_init(&mnt, base_fs_loc) != DFS_ESUCCESS)
     {
-        /* Passes, set up the FS */
-        base_ptr = base_fs_loc;
-        clear_directory();
-
-        memset(open_files, 0, sizeof(open_files));
+        /* Failed! */
+        return DFS_EBADFS;
+    }
 
-        /* Good FS */
-        return DFS_ESUCCESS;
+    /* Passes, set up the FS. Any cached sector refers to the old image. */
+    if(sector_cache_init(cache_sectors) != DFS_ESUCCESS ||
+        open_files_init(open_files_size ? open_files_size : MAX_OPEN_FILES) != DFS_ESUCCESS)
+    {
+        return DFS_ENOMEM;
     }
 
-    /* Failed! */
-    return DFS_EBADFS;
+    memcpy(mnt.prefix, "rom:/", sizeof("rom:/"));
+    mounts[0] = mnt;
+
+    /* Good FS */
+    return DFS_ESUCCESS;
 }
 
 /**
@@ -657,7 +1199,7 @@ static int __dfs_init(uint32_t base_fs_loc)
 int dfs_chdir(const char * const path)
 {
     /* Reset directory listing */
-    next_entry = 0;
+    mounts[0].next_entry = 0;
 
     if(!path)
     {
@@ -665,15 +1207,14 @@ int dfs_chdir(const char * const path)
         return DFS_EBADINPUT;
     }
 
-    return recurse_path(path, WALK_CHDIR, 0, TYPE_ANY);
+    return recurse_path(&mounts[0], path, WALK_CHDIR, 0, TYPE_ANY);
 }
 
 /**
- * @brief Find the first file or directory in a directory listing.
- *
- * Supports absolute and relative.  If the path is invalid, returns a negative DFS_errno.  If
- * a file or directory is found, returns the flags of the entry and copies the name into buf.
+ * @brief Find the first file or directory in a directory listing of an image
  *
+ * @param[in]  mnt
+ *             Image to list
  * @param[in]  path
  *             The path to look for files in
  * @param[out] buf
@@ -681,13 +1222,13 @@ int dfs_chdir(const char * const path)
  *
  * @return The flags (#FLAGS_FILE, #FLAGS_DIR, #FLAGS_EOF) or a negative value on error.
  */
-int dfs_dir_findfirst(const char * const path, char *buf)
+static int mount_findfirst(dfs_mount_t *mnt, const char * const path, char *buf)
 {
     directory_entry_t *dirent;
-    int ret = recurse_path(path, WALK_OPEN, &dirent, TYPE_DIR);
+    int ret = recurse_path(mnt, path, WALK_OPEN, &dirent, TYPE_DIR);
 
     /* Ensure that if this fails, they can't call findnext */
-    next_entry = 0;
+    mnt->next_entry = 0;
 
     if(ret != DFS_ESUCCESS)
     {
@@ -705,24 +1246,24 @@ int dfs_dir_findfirst(const char * const path, char *buf)
     }
     
     /* Set up directory to point to next entry */
-    next_entry = get_next_entry(&t_node);
+    mnt->next_entry = get_next_entry(mnt, &t_node);
 
-    return get_flags(&t_node);
+    return FILETYPE(get_flags(&t_node));
 }
 
 /**
- * @brief Find the next file or directory in a directory listing. 
- *
- * @note Should be called after doing a #dfs_dir_findfirst.
+ * @brief Find the next file or directory in a directory listing of an image
  *
+ * @param[in]  mnt
+ *             Image being listed
  * @param[out] buf
  *             Buffer to place the name of the next file or directory found
  *
  * @return The flags (#FLAGS_FILE, #FLAGS_DIR, #FLAGS_EOF) or a negative value on error.
  */
-int dfs_dir_findnext(char *buf)
+static int mount_findnext(dfs_mount_t *mnt, char *buf)
 {
-    if(!next_entry)
+    if(!mnt->next_entry)
     {
         /* No file found */
         return FLAGS_EOF;
@@ -730,7 +1271,7 @@ int dfs_dir_findnext(char *buf)
 
     /* We already calculated the pointer, just grab the information */
     directory_entry_t t_node;
-    grab_sector(next_entry, &t_node);
+    grab_sector(mnt->next_entry, &t_node);
 
     if(buf)
     {
@@ -738,39 +1279,340 @@ int dfs_dir_findnext(char *buf)
     }
     
     /* Set up directory to point to next entry */
-    next_entry = get_next_entry(&t_node);
+    mnt->next_entry = get_next_entry(mnt, &t_node);
 
-    return get_flags(&t_node);
+    return FILETYPE(get_flags(&t_node));
 }
 
 /**
- * @brief Open a file given a path
+ * @brief Find the first file or directory in a directory listing.
  *
- * Check if we have any free file handles, and if we do, try
- * to open the file specified.  Supports absolute and relative
- * paths
+ * Supports absolute and relative.  If the path is invalid, returns a negative DFS_errno.  If
+ * a file or directory is found, returns the flags of the entry and copies the name into buf.
  *
- * @param[in] path
- *            Path of the file to open
+ * @param[in]  path
+ *             The path to look for files in
+ * @param[out] buf
+ *             Buffer to place the name of the file or directory found
  *
- * @return A valid file handle to reference the file by or a negative error on failure.
+ * @return The flags (#FLAGS_FILE, #FLAGS_DIR, #FLAGS_EOF) or a negative value on error.
  */
-int dfs_open(const char * const path)
+int dfs_dir_findfirst(const char * const path, char *buf)
 {
-    /* Ensure we always open with a unique handle */
-    static uint32_t next_handle = 1;
-
-    /* Try to find a free slot */
-    open_file_t *file = find_free_file();
+    return mount_findfirst(&mounts[0], path, buf);
+}
 
-    if(!file)
+/**
+ * @brief Find the next file or directory in a directory listing. 
+ *
+ * @note Should be called after doing a #dfs_dir_findfirst.
+ *
+ * @param[out] buf
+ *             Buffer to place the name of the next file or directory found
+ *
+ * @return The flags (#FLAGS_FILE, #FLAGS_DIR, #FLAGS_EOF) or a negative value on error.
+ */
+int dfs_dir_findnext(char *buf)
+{
+    return mount_findnext(&mounts[0], buf);
+}
+
+/**
+ * @brief Read a compressed block into a staging buffer
+ *
+ * @param[in] file
+ *            Open compressed file
+ * @param[in] slot
+ *            Staging buffer to use (0 or 1)
+ * @param[in] blk
+ *            Index of the block to read
+ * @param[in] async
+ *            If true, queue the read and return immediately
+ */
+static void comp_stage(open_file_t *file, int slot, int blk, bool async)
+{
+    dfs_compressed_file_t *comp = file->comp;
+    uint32_t rom = file->cart_start_loc + comp->offsets[blk];
+    int len = comp->offsets[blk+1] - comp->offsets[blk];
+
+    /* The buffer might still be the target of a stale prefetch */
+    if(comp->staging_busy[slot])
+    {
+        dma_request_wait(&comp->staging_req[slot]);
+        comp->staging_busy[slot] = false;
+    }
+
+    data_cache_hit_invalidate(comp->staging[slot], comp->block_size + 16);
+
+    if(async)
+    {
+        dma_queue_read(&comp->staging_req[slot], (void *)(((uint32_t)comp->staging[slot]) & 0x1FFFFFFF),
+            rom, len, DMA_PRIORITY_NORMAL, NULL, NULL);
+        comp->staging_busy[slot] = true;
+    }
+    else
+    {
+        dma_read((void *)(((uint32_t)comp->staging[slot]) & 0x1FFFFFFF), rom, len);
+    }
+
+    comp->staged_block[slot] = blk;
+}
+
+/**
+ * @brief Decompress a block of a compressed file
+ *
+ * While the block is being decompressed, the following compressed block is
+ * read in background into the other staging buffer, so that sequential reads
+ * overlap decompression with PI transfers.
+ *
+ * @param[in]  file
+ *             Open compressed file
+ * @param[in]  blk
+ *             Index of the block to decompress
+ * @param[out] dst
+ *             Output buffer (must be large enough for the whole block)
+ *
+ * @return DFS_ESUCCESS on success or DFS_EBADFS if the block is corrupted.
+ */
+static int comp_decode(open_file_t *file, int blk, uint8_t *dst)
+{
+    dfs_compressed_file_t *comp = file->comp;
+    int slot;
+
+    if(comp->staged_block[0] == blk) { slot = 0; }
+    else if(comp->staged_block[1] == blk) { slot = 1; }
+    else
+    {
+        slot = 0;
+        comp_stage(file, slot, blk, false);
+    }
+
+    if(comp->staging_busy[slot])
+    {
+        dma_request_wait(&comp->staging_req[slot]);
+        comp->staging_busy[slot] = false;
+    }
+
+    if(blk+1 < comp->num_blocks && comp->staged_block[slot^1] != blk+1)
+    {
+        comp_stage(file, slot^1, blk+1, true);
+    }
+
+    int blk_len = file->size - blk * comp->block_size;
+    if(blk_len > comp->block_size) { blk_len = comp->block_size; }
+    int comp_len = comp->offsets[blk+1] - comp->offsets[blk];
+
+    if(comp_len >= blk_len)
+    {
+        /* Stored uncompressed */
+        memcpy(dst, comp->staging[slot], blk_len);
+    }
+    else if(dfs_lz4_decompress(comp->staging[slot], comp_len, dst, blk_len) != blk_len)
+    {
+        return DFS_EBADFS;
+    }
+
+    return DFS_ESUCCESS;
+}
+
+/**
+ * @brief Read data from a compressed file, starting at the current location
+ *
+ * @param[in]  file
+ *             Open compressed file
+ * @param[out] data
+ *             Buffer to read into
+ * @param[in]  to_read
+ *             Number of bytes to read (already clamped to the end of file)
+ *
+ * @return The number of bytes read or a negative value on failure.
+ */
+static int comp_read(open_file_t *file, uint8_t *data, int to_read)
+{
+    dfs_compressed_file_t *comp = file->comp;
+    int did_read = 0;
+
+    while(to_read)
+    {
+        int blk = file->loc / comp->block_size;
+        int offset = file->loc % comp->block_size;
+        int blk_len = file->size - blk * comp->block_size;
+        if(blk_len > comp->block_size) { blk_len = comp->block_size; }
+
+        if(blk != comp->decoded_block)
+        {
+            if(offset == 0 && to_read >= blk_len)
+            {
+                /* Whole block requested: decompress straight into the destination */
+                if(comp_decode(file, blk, data) != DFS_ESUCCESS) { return DFS_EBADFS; }
+
+                file->loc += blk_len;
+                data += blk_len;
+                to_read -= blk_len;
+                did_read += blk_len;
+                continue;
+            }
+
+            if(comp_decode(file, blk, comp->decoded) != DFS_ESUCCESS)
+            {
+                comp->decoded_block = -1;
+                return DFS_EBADFS;
+            }
+            comp->decoded_block = blk;
+        }
+
+        int copy = blk_len - offset;
+        if(copy > to_read) { copy = to_read; }
+
+        memcpy(data, comp->decoded + offset, copy);
+
+        file->loc += copy;
+        data += copy;
+        to_read -= copy;
+        did_read += copy;
+    }
+
+    return did_read;
+}
+
+/**
+ * @brief Release the decompression state of a file
+ *
+ * @param[in] file
+ *            Open file structure
+ */
+static void comp_close(open_file_t *file)
+{
+    dfs_compressed_file_t *comp = file->comp;
+
+    if(!comp) { return; }
+
+    for(int i = 0; i < 2; i++)
+    {
+        if(comp->staging_busy[i])
+        {
+            dma_request_wait(&comp->staging_req[i]);
+        }
+        free(comp->staging[i]);
+    }
+
+    free(comp->offsets);
+    free(comp->decoded);
+    free(comp);
+    file->comp = 0;
+}
+
+/**
+ * @brief Set up the decompression state of a compressed file
+ *
+ * @param[in] file
+ *            Open file structure (with the location of the file contents)
+ *
+ * @return DFS_ESUCCESS on success or a negative value on error.
+ */
+static int comp_open(open_file_t *file)
+{
+    dfs_compressed_header_t header __attribute__((aligned(16)));
+    grab_data(file->cart_start_loc, &header, sizeof(header));
+
+    if(!header.block_size || !header.num_blocks ||
+        (uint64_t)header.block_size * header.num_blocks < file->size)
+    {
+        return DFS_EBADFS;
+    }
+
+    dfs_compressed_file_t *comp = calloc(1, sizeof(dfs_compressed_file_t));
+    if(!comp) { return DFS_ENOMEM; }
+    file->comp = comp;
+
+    comp->block_size = header.block_size;
+    comp->num_blocks = header.num_blocks;
+    comp->decoded_block = -1;
+    comp->staged_block[0] = comp->staged_block[1] = -1;
+
+    int offsets_size = (comp->num_blocks + 1) * sizeof(uint32_t);
+    comp->offsets = memalign(16, offsets_size);
+    comp->decoded = malloc(comp->block_size);
+    comp->staging[0] = memalign(16, comp->block_size + 16);
+    comp->staging[1] = memalign(16, comp->block_size + 16);
+
+    if(!comp->offsets || !comp->decoded || !comp->staging[0] || !comp->staging[1])
+    {
+        comp_close(file);
+        return DFS_ENOMEM;
+    }
+
+    grab_data(file->cart_start_loc + sizeof(header), comp->offsets, offsets_size);
+
+    return DFS_ESUCCESS;
+}
+
+/**
+ * @brief Open a file given its directory entry
+ *
+ * @param[in] mnt
+ *            Image the file belongs to
+ * @param[in] node
+ *            Directory entry of the file
+ *
+ * @return A valid file handle to reference the file by or a negative error on failure.
+ */
+static int open_entry(dfs_mount_t *mnt, directory_entry_t *node)
+{
+    open_file_t *file = alloc_file();
+
+    /* Set up file handle */
+    file->size = get_size(node);
+    file->loc = 0;
+    file->cart_start_loc = get_start_location(mnt, node);
+    file->cached_loc = 0xFFFFFFFF;
+    file->cache_buf = file->cached_data;
+    file->cache_size = sizeof(file->cached_data);
+    file->prefetch_buf = 0;
+    file->prefetch_loc = 0xFFFFFFFF;
+    file->comp = 0;
+
+    if(get_flags(node) & FLAGS_COMPRESSED)
+    {
+        int ret = comp_open(file);
+
+        if(ret != DFS_ESUCCESS)
+        {
+            /* Release the handle */
+            release_file(file);
+            return ret;
+        }
+    }
+
+    return file->handle;
+}
+
+/**
+ * @brief Open a file given a path
+ *
+ * Check if we have any free file handles, and if we do, try
+ * to open the file specified.  Supports absolute and relative
+ * paths, and paths prefixed by the prefix of an image mounted
+ * with #dfs_mount.
+ *
+ * @param[in] path
+ *            Path of the file to open
+ *
+ * @return A valid file handle to reference the file by or a negative error on failure.
+ */
+int dfs_open(const char * const path)
+{
+    /* Check that a slot is free before walking the filesystem */
+    if(!free_slots_top)
     {
         return DFS_ENOMEM;        
     }
 
     /* Try to find file */
-    directory_entry_t *dirent;
-    int ret = recurse_path(path, WALK_OPEN, &dirent, TYPE_FILE);
+    const char *rest;
+    dfs_mount_t *mnt = resolve_path(path, &rest);
+    directory_entry_t t_node;
+    int ret = find_file(mnt, rest, &t_node);
 
     if(ret != DFS_ESUCCESS)
     {
@@ -778,18 +1620,41 @@ int dfs_open(const char * const path)
         return ret;
     }
 
-    /* We now have the pointer to the file entry */
-    directory_entry_t t_node;
-    grab_sector(dirent, &t_node);
+    return open_entry(mnt, &t_node);
+}
 
-    /* Set up file handle */
-    file->handle = next_handle++;
-    file->size = get_size(&t_node);
-    file->loc = 0;
-    file->cart_start_loc = get_start_location(&t_node);
-    file->cached_loc = 0xFFFFFFFF;
+/**
+ * @brief Set the maximum number of files that can be open at the same time
+ *
+ * The open file table is allocated by #dfs_init with room for #MAX_OPEN_FILES
+ * files.  Applications streaming many files at once (eg: music, levels and
+ * textures) can raise the limit, so that they do not need to close files only
+ * to open others.  File handles are looked up in constant time, whatever the
+ * size of the table: each file uses about 600 bytes of RAM.
+ *
+ * This function can be called before #dfs_init, or when no file is open.
+ *
+ * @param[in] count
+ *            Number of files that can be open at the same time (1 to #DFS_MAX_OPEN_FILES_LIMIT)
+ *
+ * @return DFS_ESUCCESS on success, DFS_EBADINPUT if the count is invalid or some
+ *         files are open, or DFS_ENOMEM if the table cannot be allocated.
+ */
+int dfs_set_max_open_files(int count)
+{
+    if(count < 1 || count > DFS_MAX_OPEN_FILES_LIMIT || free_slots_top != open_files_size)
+    {
+        return DFS_EBADINPUT;
+    }
 
-    return file->handle;
+    if(!mounts[0].base_ptr)
+    {
+        /* The table will be allocated by dfs_init */
+        open_files_size = count;
+        return DFS_ESUCCESS;
+    }
+
+    return open_files_init(count);
 }
 
 /**
@@ -809,8 +1674,12 @@ int dfs_close(uint32_t handle)
         return DFS_EBADHANDLE;
     }
 
-    /* Closing the handle is easy as zeroing out the file */
-    memset(file, 0, sizeof(open_file_t));
+    /* Do not release the handle while the PI is still writing into the buffers */
+    async_wait(file);
+    prefetch_wait(file);
+    comp_close(file);
+
+    release_file(file);
 
     return DFS_ESUCCESS;
 }
@@ -836,6 +1705,9 @@ int dfs_seek(uint32_t handle, int offset, int origin)
         return DFS_EBADHANDLE;
     }
 
+    /* The current location is updated by the pending asynchronous read */
+    async_wait(file);
+
     switch(origin)
     {
         case SEEK_SET:
@@ -898,38 +1770,468 @@ int dfs_seek(uint32_t handle, int offset, int origin)
  * @param[in] handle
  *            A valid file handle as returned from #dfs_open.
  *
- * @return The current byte offset into a file or a negative error on failure.
+ * @return The current byte offset into a file or a negative error on failure.
+ */
+int dfs_tell(uint32_t handle)
+{
+    /* The good thing is that the location is always in the file structure */
+    open_file_t *file = find_open_file(handle);
+
+    if(!file)
+    {
+        return DFS_EBADHANDLE;
+    }
+
+    async_wait(file);
+    return file->loc;
+}
+
+/**
+ * @brief Refill the read-ahead window of a file so that it contains the current location
+ *
+ * If the file has a prefetch window (see #dfs_set_readahead) that already
+ * contains the current location, the two windows are simply swapped. After the
+ * refill, the window following the current one is prefetched in background.
+ *
+ * @param[in] file
+ *            Open file structure to refill
+ */
+static void cache_fill(open_file_t *file)
+{
+    if(file->prefetch_buf && file->loc >= file->prefetch_loc &&
+        file->loc < file->prefetch_loc + file->cache_size)
+    {
+        /* Hit in the prefetched window: swap */
+        prefetch_wait(file);
+
+        uint8_t *tmp = file->cache_buf;
+        file->cache_buf = file->prefetch_buf;
+        file->prefetch_buf = tmp;
+        file->cached_loc = file->prefetch_loc;
+    }
+    else
+    {
+        /* We need to read from a 8-byte aligned location, so calculate it */
+        file->cached_loc = file->loc & ~7;
+
+        /* Invalidate the cached data. No need to writeback here because
+           the window size is a multiple of 16 bytes and the data is aligned,
+           so the cachelines are not shared with other variables. */
+        data_cache_hit_invalidate(file->cache_buf, file->cache_size);
+
+        dma_read((void *)(((uint32_t)file->cache_buf) & 0x1FFFFFFF),
+            file->cart_start_loc + file->cached_loc, file->cache_size);
+    }
+
+    file->prefetch_loc = 0xFFFFFFFF;
+
+    if(file->prefetch_buf)
+    {
+        uint32_t next = file->cached_loc + file->cache_size;
+
+        /* The prefetch buffer might still be the target of a stale prefetch */
+        prefetch_wait(file);
+
+        if(next < file->size)
+        {
+            data_cache_hit_invalidate(file->prefetch_buf, file->cache_size);
+
+            dma_queue_read(&file->prefetch_req, (void *)(((uint32_t)file->prefetch_buf) & 0x1FFFFFFF),
+                file->cart_start_loc + next, file->cache_size,
+                DMA_PRIORITY_NORMAL, NULL, NULL);
+            file->prefetch_busy = true;
+            file->prefetch_loc = next;
+        }
+    }
+}
+
+/**
+ * @brief Configure the read-ahead window of a file
+ *
+ * Reads that cannot be DMA'd directly into the destination buffer (see
+ * #dfs_read) go through a per-file window, by default a 512-byte internal
+ * buffer. Parsers doing many small, unaligned reads benefit from a larger
+ * window, as each refill costs a full PI transfer setup.
+ *
+ * If prefetch is requested, the buffer is split into two halves: while one
+ * is being consumed, the following part of the file is read into the other
+ * one in background through the DMA queue, so sequential reads rarely wait.
+ *
+ * @param[in] handle
+ *            A valid file handle as returned from #dfs_open.
+ * @param[in] buf
+ *            Buffer to use for the window (16-byte aligned), or NULL to revert
+ *            to the internal buffer. It must stay valid until the file is closed
+ *            or another buffer is configured.
+ * @param[in] size
+ *            Size of the buffer in bytes (multiple of 16, or 32 with prefetch).
+ *            Ignored if buf is NULL.
+ * @param[in] prefetch
+ *            True to split the buffer and prefetch the next window.
+ *
+ * @return DFS_ESUCCESS on success or a negative value on error.
+ */
+int dfs_set_readahead(uint32_t handle, void *buf, int size, bool prefetch)
+{
+    open_file_t *file = find_open_file(handle);
+
+    if(!file)
+    {
+        return DFS_EBADHANDLE;
+    }
+
+    if(!buf)
+    {
+        buf = file->cached_data;
+        size = sizeof(file->cached_data);
+    }
+
+    if(((uint32_t)buf & 15) || size <= 0 || (size & (prefetch ? 31 : 15)))
+    {
+        return DFS_EBADINPUT;
+    }
+
+    /* Nothing must be writing into the old buffers */
+    async_wait(file);
+    prefetch_wait(file);
+
+    if(prefetch)
+    {
+        size /= 2;
+        file->prefetch_buf = (uint8_t *)buf + size;
+    }
+    else
+    {
+        file->prefetch_buf = 0;
+    }
+
+    file->cache_buf = buf;
+    file->cache_size = size;
+    file->cached_loc = 0xFFFFFFFF;
+    file->prefetch_loc = 0xFFFFFFFF;
+
+    return DFS_ESUCCESS;
+}
+
+/**
+ * @brief Read data from a file
+ *
+ * @param[out] buf
+ *             Buffer to read into
+ * @param[in]  size
+ *             Size of each element to read
+ * @param[in]  count
+ *             Number of elements to read
+ * @param[in]  handle
+ *             A valid file handle as returned from #dfs_open.
+ *
+ * @return The actual number of bytes read or a negative value on failure.
+ */
+int dfs_read(void * const buf, int size, int count, uint32_t handle)
+{
+    /* This is where we do all the work */
+    open_file_t *file = find_open_file(handle);
+
+    if(!file)
+    {
+        return DFS_EBADHANDLE;
+    }
+
+    /* What are they doing? */
+    if(!buf)
+    {
+        return DFS_EBADINPUT;
+    }
+
+    /* Serialize with any asynchronous read pending on the same file */
+    async_wait(file);
+
+    int to_read = size * count;
+    int did_read = 0;
+
+    /* Bounds check to make sure we don't read past the end */
+    if(file->loc + to_read > file->size)
+    {
+        /* It will, lets shorten it */
+        to_read = file->size - file->loc;
+    }
+
+    if (!to_read)
+        return 0;
+
+    /* Compressed files are decompressed block by block */
+    if (file->comp)
+        return comp_read(file, buf, to_read);
+
+    /* Fast-path. If possibly, we want to DMA directly into the destination
+     * buffer, without using any intermediate buffers. The rules are convoluted
+     * because we try to squeeze maximum performance here and thus we rely also
+     * on undocumented behaviors of PI DMA.
+     * The rules we follow are:
+     *
+     *   * The RDRAM destination pointer must be 8-bytes aligned.
+     *   * The ROM location must be 2-bytes aligned.
+     *   * The length must be either less than 0x7F (all values accepted),
+     *     or even.
+     */
+    bool rom_aligned = (file->loc & 1) == 0;
+    bool ram_aligned = ((uint32_t)buf & 7) == 0;
+    bool len_aligned = (to_read < 0x7F) || ((to_read & 1) == 0);
+    if (rom_aligned && ram_aligned && len_aligned)
+    {
+        /* 16-byte alignment: we can simply invalidate the buffer.
+         * 8-byte alignment: we need to also writeback in case the partial
+         *  cachelines have hot data to write back. */
+        if ((((uint32_t)buf | to_read) & 15) == 0)
+            data_cache_hit_invalidate(buf, to_read);
+        else
+            data_cache_hit_writeback_invalidate(buf, to_read);
+
+        dma_read((void *)(((uint32_t)buf) & 0x1FFFFFFF),
+            file->cart_start_loc + file->loc, to_read);
+
+        file->loc += to_read;
+        return to_read;
+    }
+
+    /* Something we can actually increment! */
+    uint8_t *data = buf;
+
+    /* Loop in, reading data in the cached buffer */
+    while(to_read)
+    {
+        /* Check if we need to read into the cached buffer */
+        if (file->loc < file->cached_loc || file->loc >= file->cached_loc+file->cache_size)
+        {
+            cache_fill(file);
+        }
+
+        /* Pull as much data as we can from the current buffer */
+        int copy = file->cached_loc+file->cache_size - file->loc;
+        if (copy > to_read)
+            copy = to_read;
+
+        fast_memcpy(data, file->cache_buf + (file->loc - file->cached_loc), copy);
+
+        file->loc += copy;
+        data += copy;
+        to_read -= copy;
+        did_read += copy;
+    }
+
+    return did_read;
+}
+
+/**
+ * @brief Allocate a buffer suitable for direct DMA reads.
+ *
+ * #dfs_read (and fread on a file opened with #dfs_fopen) transfers data directly
+ * from ROM into the destination buffer when it is properly aligned. The buffer
+ * returned by this function is 16-byte aligned and its size is rounded up to
+ * a multiple of 16 bytes, so that reading into it does not even require to
+ * write back the data cache.
+ *
+ * @param[in] size
+ *            Size of the buffer in bytes
+ *
+ * @return The buffer (to be released with free), or NULL if out of memory.
+ */
+void *dfs_alloc_buffer(int size)
+{
+    return memalign(16, (size + 15) & ~15);
+}
+
+/**
+ * @brief Open a file for fread, without any intermediate copy.
+ *
+ * This is the same as calling fopen on the 'rom:/' prefix, but it disables
+ * the newlib buffering of the FILE (as setvbuf with _IONBF would do). newlib
+ * copies buffered reads through its small internal buffer, which prevents
+ * large reads from using the direct DMA path of #dfs_read; without it, each
+ * fread calls #dfs_read straight into the destination buffer. Small reads
+ * remain buffered by DragonFS itself (see #dfs_set_readahead).
+ *
+ * @param[in] path
+ *            Path of the file, without the 'rom:/' prefix
+ * @param[in] mode
+ *            fopen mode (DragonFS is read only)
+ *
+ * @return The FILE or NULL if the file could not be opened (with errno set to
+ *         ENAMETOOLONG if the path is too long).
+ */
+FILE *dfs_fopen(const char *path, const char *mode)
+{
+    char fn[MAX_FILENAME_LEN + 8];
+    int len;
+
+    /* Paths of the images mounted with dfs_mount already have their prefix */
+    if (strstr(path, ":/"))
+        len = snprintf(fn, sizeof(fn), "%s", path);
+    else
+        len = snprintf(fn, sizeof(fn), "rom:/%s", path[0] == '/' ? path + 1 : path);
+
+    /* Do not open another file with the truncated path */
+    if (len < 0 || len >= (int)sizeof(fn))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    FILE *f = fopen(fn, mode);
+    if (f)
+        setvbuf(f, NULL, _IONBF, 0);
+    return f;
+}
+
+static void async_dma_done(dma_request_t *req, void *ctx);
+
+/**
+ * @brief Advance the asynchronous read pending on a file
+ *
+ * Copy as much data as possible out of the cached buffer into the destination,
+ * and then queue the PI transfer required to continue, if any.
+ *
+ * @param[in] file
+ *            Open file structure with a pending asynchronous read
+ *
+ * @return true if a PI transfer was queued, false if the read is complete.
+ */
+static bool async_step(open_file_t *file)
+{
+    if(file->async_direct)
+    {
+        if(!file->async_left)
+        {
+            return false;
+        }
+
+        /* Same cache handling as the fast-path in dfs_read */
+        if((((uint32_t)file->async_buf | file->async_left) & 15) == 0)
+            data_cache_hit_invalidate(file->async_buf, file->async_left);
+        else
+            data_cache_hit_writeback_invalidate(file->async_buf, file->async_left);
+
+        dma_queue_read(&file->async_req, (void *)(((uint32_t)file->async_buf) & 0x1FFFFFFF),
+            file->cart_start_loc + file->loc, file->async_left,
+            DMA_PRIORITY_NORMAL, async_dma_done, file);
+        return true;
+    }
+
+    /* Bounce buffering: drain what is already available in the cached buffer */
+    while(file->async_left)
+    {
+        if(file->loc < file->cached_loc || file->loc >= file->cached_loc+file->cache_size)
+        {
+            /* Refill the cached buffer, the copy will resume on completion.
+               The prefetch window (if any) is left alone, as it might still
+               be the target of a pending prefetch. */
+            file->cached_loc = file->loc & ~7;
+            data_cache_hit_invalidate(file->cache_buf, file->cache_size);
+
+            dma_queue_read(&file->async_req, (void *)(((uint32_t)file->cache_buf) & 0x1FFFFFFF),
+                file->cart_start_loc + file->cached_loc, file->cache_size,
+                DMA_PRIORITY_NORMAL, async_dma_done, file);
+            return true;
+        }
+
+        int copy = file->cached_loc+file->cache_size - file->loc;
+        if(copy > file->async_left)
+            copy = file->async_left;
+
+        memcpy(file->async_buf, file->cache_buf + (file->loc - file->cached_loc), copy);
+
+        file->loc += copy;
+        file->async_buf += copy;
+        file->async_left -= copy;
+        file->async_done += copy;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Terminate the asynchronous read pending on a file and notify the caller
+ *
+ * @param[in] file
+ *            Open file structure whose asynchronous read is complete
+ */
+static void async_finish(open_file_t *file)
+{
+    dfs_read_callback_t cb = file->async_cb;
+    void *ctx = file->async_ctx;
+    int done = file->async_done;
+
+    /* Mark the file as idle before invoking the callback, so that it can
+       immediately issue another read on the same handle. */
+    file->async_busy = false;
+    file->async_cb = 0;
+    file->async_ctx = 0;
+
+    if(cb)
+    {
+        cb(file->handle, done, ctx);
+    }
+}
+
+/**
+ * @brief DMA queue completion callback driving asynchronous reads
+ *
+ * @param[in] req
+ *            The completed request (#open_file::async_req)
+ * @param[in] ctx
+ *            The open file structure
  */
-int dfs_tell(uint32_t handle)
+static void async_dma_done(dma_request_t *req, void *ctx)
 {
-    /* The good thing is that the location is always in the file structure */
-    open_file_t *file = find_open_file(handle);
+    open_file_t *file = ctx;
 
-    if(!file)
+    if(file->async_direct)
     {
-        return DFS_EBADHANDLE;
+        file->loc += file->async_left;
+        file->async_buf += file->async_left;
+        file->async_done += file->async_left;
+        file->async_left = 0;
     }
 
-    return file->loc;
+    if(!async_step(file))
+    {
+        async_finish(file);
+    }
 }
 
 /**
- * @brief Read data from a file
+ * @brief Start reading data from a file, without waiting for completion
+ *
+ * The read is queued on the PI and the function returns immediately. When the
+ * whole read has been transferred into the buffer, the callback is invoked from
+ * within the PI interrupt handler. The buffer must not be accessed until then.
+ *
+ * Multiple asynchronous reads can be pending at the same time, as long as they
+ * are issued on different file handles. Transfers go through the PI DMA queue
+ * (see #dma_queue_read) with normal priority.
+ * Using any other DFS function on a handle with a pending asynchronous read
+ * (eg: #dfs_read or #dfs_seek) will first wait for the read to complete.
+ *
+ * The same alignment rules described in #dfs_read apply: when they are met, the
+ * data is DMA'd straight into the buffer with a single PI transfer; otherwise,
+ * the data is bounced through the per-file cache, one chunk per PI transfer.
  *
- * @param[out] buf
- *             Buffer to read into
- * @param[in]  size
- *             Size of each element to read
- * @param[in]  count
- *             Number of elements to read
  * @param[in]  handle
  *             A valid file handle as returned from #dfs_open.
- *
- * @return The actual number of bytes read or a negative value on failure.
+ * @param[out] buf
+ *             Buffer to read into
+ * @param[in]  len
+ *             Number of bytes to read
+ * @param[in]  cb
+ *             Callback to invoke on completion (can be NULL)
+ * @param[in]  ctx
+ *             Opaque pointer passed to the callback
+ *
+ * @return The number of bytes that will be read (as the read is clamped
+ *         to the end of file) or a negative value on failure.
  */
-int dfs_read(void * const buf, int size, int count, uint32_t handle)
+int dfs_read_async(uint32_t handle, void * const buf, int len, dfs_read_callback_t cb, void *ctx)
 {
-    /* This is where we do all the work */
     open_file_t *file = find_open_file(handle);
 
     if(!file)
@@ -937,92 +2239,84 @@ int dfs_read(void * const buf, int size, int count, uint32_t handle)
         return DFS_EBADHANDLE;
     }
 
-    /* What are they doing? */
-    if(!buf)
+    if(!buf || len < 0)
     {
         return DFS_EBADINPUT;
     }
 
-    int to_read = size * count;
-    int did_read = 0;
+    /* One asynchronous read at a time per handle */
+    async_wait(file);
 
     /* Bounds check to make sure we don't read past the end */
-    if(file->loc + to_read > file->size)
+    if(file->loc + len > file->size)
     {
-        /* It will, lets shorten it */
-        to_read = file->size - file->loc;
+        len = file->size - file->loc;
     }
 
-    if (!to_read)
-        return 0;
-
-    /* Fast-path. If possibly, we want to DMA directly into the destination
-     * buffer, without using any intermediate buffers. The rules are convoluted
-     * because we try to squeeze maximum performance here and thus we rely also
-     * on undocumented behaviors of PI DMA.
-     * The rules we follow are:
-     *
-     *   * The RDRAM destination pointer must be 8-bytes aligned.
-     *   * The ROM location must be 2-bytes aligned.
-     *   * The length must be either less than 0x7F (all values accepted),
-     *     or even.
-     */
-    bool rom_aligned = (file->loc & 1) == 0;
-    bool ram_aligned = ((uint32_t)buf & 7) == 0;
-    bool len_aligned = (to_read < 0x7F) || ((to_read & 1) == 0);
-    if (rom_aligned && ram_aligned && len_aligned)
+    /* Compressed files are decompressed synchronously, there is no PI
+       transfer to wait for once the data is ready */
+    if(file->comp)
     {
-        /* 16-byte alignment: we can simply invalidate the buffer.
-         * 8-byte alignment: we need to also writeback in case the partial
-         *  cachelines have hot data to write back. */
-        if ((((uint32_t)buf | to_read) & 15) == 0)
-            data_cache_hit_invalidate(buf, to_read);
-        else
-            data_cache_hit_writeback_invalidate(buf, to_read);
+        int ret = comp_read(file, buf, len);
 
-        dma_read((void *)(((uint32_t)buf) & 0x1FFFFFFF),
-            file->cart_start_loc + file->loc, to_read);
+        if(ret >= 0 && cb)
+        {
+            cb(file->handle, ret, ctx);
+        }
 
-        file->loc += to_read;
-        return to_read;
+        return ret;
     }
 
-    /* Something we can actually increment! */
-    uint8_t *data = buf;
-    const int CACHED_SIZE = sizeof(file->cached_data);
+    /* Same fast-path rules as dfs_read */
+    bool rom_aligned = (file->loc & 1) == 0;
+    bool ram_aligned = ((uint32_t)buf & 7) == 0;
+    bool len_aligned = (len < 0x7F) || ((len & 1) == 0);
 
-    /* Loop in, reading data in the cached buffer */
-    while(to_read)
+    disable_interrupts();
+
+    file->async_direct = rom_aligned && ram_aligned && len_aligned;
+    file->async_buf = buf;
+    file->async_left = len;
+    file->async_done = 0;
+    file->async_cb = cb;
+    file->async_ctx = ctx;
+    file->async_busy = true;
+
+    if(!async_step(file))
     {
-        /* Check if we need to read into the cached buffer */
-        if (file->loc < file->cached_loc || file->loc >= file->cached_loc+CACHED_SIZE)
-        {
-            /* We need to read from a 8-byte aligned location, so calculate it */
-            file->cached_loc = file->loc & ~7;
+        async_finish(file);
+    }
 
-            /* Invalidate the cached data. No need to writeback here because
-               CACHE_SIZE is a multiple of 16 bytes and the data is aligned,
-               so the cachelines are not shared with other variables. */
-            data_cache_hit_invalidate(file->cached_data, CACHED_SIZE);
+    enable_interrupts();
 
-            dma_read((void *)(((uint32_t)file->cached_data) & 0x1FFFFFFF),
-                file->cart_start_loc + file->cached_loc, CACHED_SIZE);
-        }
+    return len;
+}
 
-        /* Pull as much data as we can from the current buffer */
-        int copy = file->cached_loc+CACHED_SIZE - file->loc;
-        if (copy > to_read)
-            copy = to_read;
+/**
+ * @brief Return whether an asynchronous read is still pending on a file
+ *
+ * @param[in] handle
+ *            A valid file handle as returned from #dfs_open.
+ *
+ * @return true if an asynchronous read issued with #dfs_read_async is still
+ *         in progress, false otherwise (or if the handle is invalid).
+ */
+bool dfs_read_async_busy(uint32_t handle)
+{
+    open_file_t *file = find_open_file(handle);
 
-        memcpy(data, file->cached_data + (file->loc - file->cached_loc), copy);
+    if(!file)
+    {
+        return false;
+    }
 
-        file->loc += copy;
-        data += copy;
-        to_read -= copy;
-        did_read += copy;
+    /* Give a chance to advance even if the PI interrupt cannot fire */
+    if(file->async_busy)
+    {
+        dma_request_done(&file->async_req);
     }
 
-    return did_read;
+    return file->async_busy;
 }
 
 /**
@@ -1061,27 +2355,156 @@ int dfs_size(uint32_t handle)
  *            Name of the file
  *
  * @return A pointer to the physical address of the file body, or 0
- *         if the file was not found.
+ *         if the file was not found or is compressed (#FLAGS_COMPRESSED).
  * 
  */
 uint32_t dfs_rom_addr(const char *path)
 {
     /* Try to find file */
-    directory_entry_t *dirent;
-    int ret = recurse_path(path, WALK_OPEN, &dirent, TYPE_FILE);
+    const char *rest;
+    dfs_mount_t *mnt = resolve_path(path, &rest);
+    directory_entry_t t_node;
+    int ret = find_file(mnt, rest, &t_node);
 
-    if(ret != DFS_ESUCCESS)
+    if(ret != DFS_ESUCCESS || (get_flags(&t_node) & FLAGS_COMPRESSED))
     {
-        /* File not found, or other error */
+        /* File not found, or not directly accessible */
         return 0;
     }
 
-    /* We now have the pointer to the file entry */
+    /* Return the starting location in ROM */
+    return get_start_location(mnt, &t_node);
+}
+
+/**
+ * @brief Return the location and size of a file in ROM space
+ *
+ * The descriptor can be used to access the file contents with #dfs_rom_io_read
+ * or #dfs_rom_dma, without opening the file. This is the preferred way to
+ * stream large immutable tables (eg: waveforms or tile maps) straight into
+ * the buffers where they are consumed.
+ *
+ * @param[in]  path
+ *             Name of the file
+ * @param[out] desc
+ *             Descriptor of the file contents
+ *
+ * @return DFS_ESUCCESS on success, DFS_ENOFILE if the file was not found,
+ *         or DFS_EBADINPUT if the file is compressed (#FLAGS_COMPRESSED).
+ */
+int dfs_rom_desc(const char *path, dfs_rom_desc_t *desc)
+{
+    const char *rest;
+    dfs_mount_t *mnt = resolve_path(path, &rest);
     directory_entry_t t_node;
-    grab_sector(dirent, &t_node);
+    int ret = find_file(mnt, rest, &t_node);
 
-    /* Return the starting location in ROM */
-    return get_start_location(&t_node);
+    if(ret != DFS_ESUCCESS)
+    {
+        return ret;
+    }
+
+    if(get_flags(&t_node) & FLAGS_COMPRESSED)
+    {
+        /* Contents in ROM are not the contents of the file */
+        return DFS_EBADINPUT;
+    }
+
+    desc->rom_addr = get_start_location(mnt, &t_node);
+    desc->size = get_size(&t_node);
+
+    return DFS_ESUCCESS;
+}
+
+/**
+ * @brief Return the location and size in ROM space of an open file
+ *
+ * @param[in]  handle
+ *             A valid file handle as returned from #dfs_open.
+ * @param[out] desc
+ *             Descriptor of the file contents
+ *
+ * @return DFS_ESUCCESS on success, DFS_EBADHANDLE if the handle is invalid,
+ *         or DFS_EBADINPUT if the file is compressed (#FLAGS_COMPRESSED).
+ */
+int dfs_rom_desc_handle(uint32_t handle, dfs_rom_desc_t *desc)
+{
+    open_file_t *file = find_open_file(handle);
+
+    if(!file)
+    {
+        return DFS_EBADHANDLE;
+    }
+
+    if(file->comp)
+    {
+        return DFS_EBADINPUT;
+    }
+
+    desc->rom_addr = file->cart_start_loc;
+    desc->size = file->size;
+
+    return DFS_ESUCCESS;
+}
+
+/**
+ * @brief Read a 32-bit word of a file directly from ROM
+ *
+ * The word is read through a single PI bus access (see io_read), so no DMA
+ * transfer and no RDRAM buffer is involved. This is convenient for sparse
+ * accesses to large tables.
+ *
+ * @param[in] desc
+ *            Descriptor of the file
+ * @param[in] offset
+ *            Offset within the file (must be a multiple of 4)
+ *
+ * @return The word at the specified offset
+ */
+uint32_t dfs_rom_io_read(const dfs_rom_desc_t *desc, uint32_t offset)
+{
+    assertf((offset & 3) == 0, "unaligned ROM word access: %08lx", offset);
+    assertf(offset + 4 <= desc->size, "ROM access out of file bounds: %08lx (size: %08lx)",
+        offset, desc->size);
+
+    return io_read(desc->rom_addr + offset);
+}
+
+/**
+ * @brief Transfer a range of a file from ROM into RDRAM through the DMA queue
+ *
+ * The RSP and the RDP cannot fetch data from the PI bus, so the data they
+ * consume must be in RDRAM. This function queues a single PI transfer
+ * straight into the final buffer (eg: a texture or a buffer later loaded into
+ * DMEM), so that no intermediate copy through a file handle is needed. The
+ * transfer is asynchronous: use #dma_request_wait or the callback to know when
+ * the data is available. The caller is responsible for cache coherency of
+ * the destination buffer.
+ *
+ * @param[out] req
+ *             Request to track the transfer, see #dma_queue_read
+ * @param[in]  desc
+ *             Descriptor of the file
+ * @param[in]  offset
+ *             Offset within the file
+ * @param[out] ram_address
+ *             Destination buffer
+ * @param[in]  len
+ *             Number of bytes to transfer
+ * @param[in]  priority
+ *             Priority of the transfer in the DMA queue
+ * @param[in]  callback
+ *             Optional callback invoked when the transfer is complete
+ * @param[in]  ctx
+ *             Opaque pointer passed to the callback
+ */
+void dfs_rom_dma(dma_request_t *req, const dfs_rom_desc_t *desc, uint32_t offset, void *ram_address,
+    uint32_t len, dma_priority_t priority, dma_callback_t callback, void *ctx)
+{
+    assertf(offset <= desc->size && len <= desc->size - offset,
+        "ROM access out of file bounds: %08lx+%08lx (size: %08lx)", offset, len, desc->size);
+
+    dma_queue_read(req, ram_address, desc->rom_addr + offset, len, priority, callback, ctx);
 }
 
 /**
@@ -1102,6 +2525,8 @@ int dfs_eof(uint32_t handle)
         return DFS_EBADHANDLE;
     }
 
+    async_wait(file);
+
     if(file->loc == file->size)
     {
         /* Yup, eof */
@@ -1115,20 +2540,24 @@ int dfs_eof(uint32_t handle)
 /**
  * @brief Newlib-compatible open
  *
+ * @param[in] mnt
+ *            Image the file belongs to
  * @param[in] name
  *            Absolute path of the file to open
- * @param[in] flags
- *            POSIX file flags
  *
  * @return A newlib-compatible file handle.
  */
-static void *__open( char *name, int flags )
+static void *__open( dfs_mount_t *mnt, char *name )
 {
-    /* Always want a consistent interface */
-    dfs_chdir("/");
+    if( !free_slots_top )
+        return NULL;
 
-    /* We disregard flags here */
-    int handle = dfs_open( name );
+    /* Always want a consistent interface: paths are relative to the root */
+    directory_entry_t t_node;
+    if( find_file_from_root( mnt, name, &t_node ) != DFS_ESUCCESS )
+        return NULL;
+
+    int handle = open_entry( mnt, &t_node );
     if (handle <= 0)
         return NULL;
     return (void *)handle;
@@ -1216,6 +2645,8 @@ static int __close( void *file )
 /**
  * @brief Newlib-compatible findfirst
  *
+ * @param[in]  mnt
+ *             Image to list
  * @param[in]  path
  *             Absolute path of the directory to walk
  * @param[out] dir
@@ -1223,12 +2654,12 @@ static int __close( void *file )
  *
  * @return 0 on success or a negative value on failure.
  */
-static int __findfirst( char *path, dir_t *dir )
+static int __findfirst( dfs_mount_t *mnt, char *path, dir_t *dir )
 {
     if( !path || !dir ) { return -1; }
 
     /* Grab first entry, return if bad */
-    int flags = dfs_dir_findfirst( path, dir->d_name );
+    int flags = mount_findfirst( mnt, path, dir->d_name );
     if( flags < 0 ) { return -1; }
 
     if( flags == FLAGS_FILE )
@@ -1252,17 +2683,19 @@ static int __findfirst( char *path, dir_t *dir )
 /**
  * @brief Newlib-compatible findnext
  *
+ * @param[in]  mnt
+ *             Image being listed
  * @param[out] dir
  *              Directory structure to populate with information on the next entry found
  *
  * @return 0 on success or a negative value on failure.
  */
-static int __findnext( dir_t *dir )
+static int __findnext( dfs_mount_t *mnt, dir_t *dir )
 {
     if( !dir ) { return -1; }
 
     /* Grab first entry, return if bad */
-    int flags = dfs_dir_findnext( dir->d_name );
+    int flags = mount_findnext( mnt, dir->d_name );
     if( flags < 0 ) { return -1; }
 
     if( flags == FLAGS_FILE )
@@ -1284,23 +2717,80 @@ static int __findnext( dir_t *dir )
 }
 
 /**
- * @brief Structure used for hooking DragonFS into newlib
+ * @brief Define the newlib hooks that need to know the image they refer to
+ *
+ * Newlib hooks carry no context, so each mount gets its own set.
+ *
+ * @param[in] n
+ *            Index of the mount
+ */
+#define DFS_MOUNT_HOOKS(n) \
+    static void *__open_##n( char *name, int flags ) { return __open( &mounts[n], name ); } \
+    static int __findfirst_##n( char *path, dir_t *dir ) { return __findfirst( &mounts[n], path, dir ); } \
+    static int __findnext_##n( dir_t *dir ) { return __findnext( &mounts[n], dir ); }
+
+/** @cond */
+DFS_MOUNT_HOOKS(0)
+DFS_MOUNT_HOOKS(1)
+DFS_MOUNT_HOOKS(2)
+DFS_MOUNT_HOOKS(3)
+/** @endcond */
+
+_Static_assert(DFS_MAX_MOUNTS == 4, "a set of newlib hooks must be defined for each mount");
+
+/** @brief Initializer of the newlib hooks of a mount */
+#define DFS_MOUNT_FS(n) { __open_##n, __fstat, __lseek, __read, 0, __close, 0, __findfirst_##n, __findnext_##n }
+
+/**
+ * @brief Structures used for hooking DragonFS into newlib, one per mount
  *
  * The following section of code is for bridging into newlib's filesystem hooks 
  * to allow posix access to DragonFS filesystem.
  */
-static filesystem_t dragon_fs = {
-    __open,
-    __fstat,
-    __lseek,
-    __read,
-    0,
-    __close,
-    0,
-    __findfirst,
-    __findnext
+static filesystem_t dragon_fs[DFS_MAX_MOUNTS] = {
+    DFS_MOUNT_FS(0),
+    DFS_MOUNT_FS(1),
+    DFS_MOUNT_FS(2),
+    DFS_MOUNT_FS(3)
 };
 
+/**
+ * @brief Initialize the filesystem, with a custom directory cache size.
+ *
+ * Same as #dfs_init, but allows to size the cache of directory sectors used to
+ * speed up path lookups. Each cached sector uses #SECTOR_SIZE bytes of RAM.
+ * Applications that open many files in few directories can benefit from a
+ * larger cache; pass 0 to disable caching altogether.
+ *
+ * @param[in] base_fs_loc
+ *            Memory mapped location at which to find the filesystem.
+ * @param[in] cache_sectors
+ *            Number of directory sectors to keep cached.
+ *
+ * @return DFS_ESUCCESS on success or a negative error otherwise.
+ */
+int dfs_init_with_cache(uint32_t base_fs_loc, int cache_sectors)
+{
+    if(cache_sectors < 0)
+    {
+        return DFS_EBADINPUT;
+    }
+
+    /* Try normal (works on doctor v64) */
+    int ret = __dfs_init( base_fs_loc, cache_sectors );
+
+    if( ret != DFS_ESUCCESS )
+    {
+        /* Failed, return so */
+        return ret;
+    }
+
+    /* Succeeded, push our filesystem into newlib */
+    attach_filesystem( "rom:/", &dragon_fs[0] );
+
+    return DFS_ESUCCESS;
+}
+
 /**
  * @brief Initialize the filesystem.
  *
@@ -1309,6 +2799,9 @@ static filesystem_t dragon_fs = {
  * also register DragonFS with newlib so that standard POSIX file operations
  * work with DragonFS.
  *
+ * A cache of #DFS_DEFAULT_DIR_CACHE_SECTORS directory sectors is allocated; use
+ * #dfs_init_with_cache to configure it.
+ *
  * @param[in] base_fs_loc
  *            Memory mapped location at which to find the filesystem.  This is normally
  *            0xB0000000 + the offset used when building your ROM + the size of the header
@@ -1318,19 +2811,108 @@ static filesystem_t dragon_fs = {
  */
 int dfs_init(uint32_t base_fs_loc)
 {
-    /* Try normal (works on doctor v64) */
-    int ret = __dfs_init( base_fs_loc );
+    return dfs_init_with_cache( base_fs_loc, DFS_DEFAULT_DIR_CACHE_SECTORS );
+}
 
-    if( ret != DFS_ESUCCESS )
+/**
+ * @brief Mount an additional filesystem image
+ *
+ * Images built separately with 'mkdfs' (eg: one per DLC or per region) can be
+ * appended to the ROM at any offset, and mounted under their own prefix.  Their
+ * files are then accessed through newlib (eg: fopen("dlc1:/gfx/hero.sprite"))
+ * or through the DFS API calls, using the same prefix.  Each image keeps its
+ * own path index, and they all share the directory sector cache and the open
+ * file table.
+ *
+ * #dfs_init must be called first.  Up to #DFS_MAX_MOUNTS images can be mounted,
+ * including the one passed to #dfs_init.
+ *
+ * @param[in] prefix
+ *            Prefix to register the image with, in the form "name:/"
+ * @param[in] base_fs_loc
+ *            Memory mapped location at which to find the filesystem.
+ *
+ * @return DFS_ESUCCESS on success, DFS_EBADINPUT if the prefix is invalid or
+ *         already in use, DFS_ENOMEM if all the mounts are in use, or DFS_EBADFS
+ *         if there is no valid image at the location.
+ */
+int dfs_mount(const char * const prefix, uint32_t base_fs_loc)
+{
+    assertf(mounts[0].base_ptr, "dfs_init must be called before dfs_mount");
+
+    int len = prefix ? strlen(prefix) : 0;
+
+    if(len < 3 || len >= MOUNT_PREFIX_LEN || prefix[len - 1] != '/' || prefix[len - 2] != ':')
+    {
+        return DFS_EBADINPUT;
+    }
+
+    int slot = -1;
+
+    for(int i = 0; i < DFS_MAX_MOUNTS; i++)
+    {
+        if(mounts[i].base_ptr && strcmp(mounts[i].prefix, prefix) == 0)
+        {
+            return DFS_EBADINPUT;
+        }
+
+        if(!mounts[i].base_ptr && slot < 0)
+        {
+            slot = i;
+        }
+    }
+
+    if(slot < 0)
+    {
+        return DFS_ENOMEM;
+    }
+
+    dfs_mount_t *mnt = &mounts[slot];
+    int ret = mount_init(mnt, base_fs_loc);
+
+    if(ret != DFS_ESUCCESS)
     {
-        /* Failed, return so */
         return ret;
     }
 
-    /* Succeeded, push our filesystem into newlib */
-    attach_filesystem( "rom:/", &dragon_fs );
+    if(attach_filesystem(prefix, &dragon_fs[slot]) != 0)
+    {
+        /* The prefix is used by another filesystem */
+        mnt->base_ptr = 0;
+        return DFS_EBADINPUT;
+    }
+
+    strcpy(mnt->prefix, prefix);
 
     return DFS_ESUCCESS;
 }
 
+/**
+ * @brief Unmount a filesystem image mounted with #dfs_mount
+ *
+ * The files opened through newlib are closed.  Files opened with #dfs_open can
+ * still be read, and must be closed with #dfs_close.
+ *
+ * @param[in] prefix
+ *            Prefix the image was mounted with
+ *
+ * @return DFS_ESUCCESS on success, or DFS_EBADINPUT if no image was mounted
+ *         with this prefix.
+ */
+int dfs_unmount(const char * const prefix)
+{
+    /* The image passed to dfs_init cannot be unmounted */
+    for(int i = 1; i < DFS_MAX_MOUNTS; i++)
+    {
+        if(mounts[i].base_ptr && prefix && strcmp(mounts[i].prefix, prefix) == 0)
+        {
+            detach_filesystem(prefix);
+            memset(&mounts[i], 0, sizeof(dfs_mount_t));
+            return DFS_ESUCCESS;
+        }
+    }
+
+    return DFS_EBADINPUT;
+}
+
 /** @} */
@@ -68,21 +68,114 @@ static eepfs_file_t * eepfs_files = NULL;
 static uint16_t eepfs_files_checksum = 0;
 
 /**
- * @brief Calculates a CRC-16 checksum from an array of bytes.
+ * @brief Minimum time between two background block writes (in milliseconds).
+ * 
+ * An EEPROM block write takes approximately 15 milliseconds.
+ */
+#define EEPFS_WRITE_MS 15
+
+/**
+ * @brief RAM shadow of the entire EEPROM.
+ * 
+ * A `NULL` value means that files are read from and written to
+ * EEPROM directly. Allocated by #eepfs_enable_async.
+ */
+static uint8_t * eepfs_shadow = NULL;
+
+/** @brief Bitmask of the shadow blocks that differ from EEPROM. */
+static uint32_t eepfs_dirty[256 / 32];
+
+/** @brief Number of bits set in #eepfs_dirty. */
+static volatile size_t eepfs_dirty_count = 0;
+
+/** @brief Block being written in the background (-1 if none). */
+static volatile int eepfs_flushing = -1;
+
+/** @brief Tick at which the last background write completed. */
+static volatile uint32_t eepfs_flush_tick = 0;
+
+/** @brief Block to check first for the next background write. */
+static size_t eepfs_flush_next = 0;
+
+/** @brief Output block of the background write. */
+static uint64_t eepfs_flush_output[JOYBUS_BLOCK_DWORDS];
+
+#if EEPFS_CRC16_TABLE
+/**
+ * @brief CRC-16/CCITT-FALSE remainders of each byte value.
+ * 
+ * Generated for poly=0x1021: entry n is the CRC of byte n with a zero initial value.
+ */
+static const uint16_t eepfs_crc16_table[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0,
+};
+#endif
+
+/**
+ * @brief Updates a CRC-16 checksum with an array of bytes.
  * 
  * CRC-16/CCITT-FALSE, CRC-16/IBM-3740:
  * poly=0x1021, init=0xFFFF, xorout=0x0000
  * 
+ * Start from #EEPFS_CRC16_INIT; since there is no final xor, the
+ * checksum of a sequence of buffers can be computed one buffer at a
+ * time by passing the previous result as @p crc.
+ * 
+ * With #EEPFS_CRC16_TABLE, this uses a 512-byte lookup table (one load
+ * per byte); otherwise, the remainder is computed with shifts.
+ * 
  * @see https://stackoverflow.com/a/23726131
+ * 
+ * @param[in] crc
+ *            Checksum of the preceding data (or #EEPFS_CRC16_INIT)
+ * @param[in] data
+ *            Bytes to add to the checksum
+ * @param[in] len
+ *            Number of bytes
+ * 
+ * @return The updated checksum
  */
-static uint16_t calculate_crc16(const uint8_t * data, size_t len)
+uint16_t eepfs_crc16_update(uint16_t crc, const void * data, size_t len)
 {
-    uint8_t x;
-    uint16_t crc = 0xFFFF;
+    const uint8_t * bytes = data;
 
     while ( len-- )
     {
-        x = crc >> 8 ^ *(data++);
+#if EEPFS_CRC16_TABLE
+        crc = (crc << 8) ^ eepfs_crc16_table[(crc >> 8) ^ *(bytes++)];
+#else
+        uint8_t x = crc >> 8 ^ *(bytes++);
         x ^= x>>4;
         crc = (
             (crc << 8) ^ 
@@ -90,6 +183,7 @@ static uint16_t calculate_crc16(const uint8_t * data, size_t len)
             ((uint16_t)(x << 5)) ^ 
             ((uint16_t)x)
         );
+#endif
     }
 
     return crc;
@@ -207,6 +301,50 @@ static const eepfs_file_t * eepfs_get_file(int handle)
     return NULL;
 }
 
+/**
+ * @brief Updates a range of the EEPROM shadow, marking changed blocks as dirty.
+ * 
+ * @param[in] start_bytes
+ *            Byte offset in EEPROM
+ * @param[in] src
+ *            New data, or NULL for zeroes
+ * @param[in] len
+ *            Byte length of the range
+ */
+static void eepfs_shadow_write(size_t start_bytes, const uint8_t * src, size_t len)
+{
+    disable_interrupts();
+
+    for ( size_t i = 0; i < len; ++i )
+    {
+        const size_t addr = start_bytes + i;
+        const uint8_t value = src ? src[i] : 0;
+
+        if ( eepfs_shadow[addr] != value )
+        {
+            const size_t block = addr / EEPROM_BLOCK_SIZE;
+            eepfs_shadow[addr] = value;
+
+            if ( !(eepfs_dirty[block / 32] & (1u << (block % 32))) )
+            {
+                eepfs_dirty[block / 32] |= 1u << (block % 32);
+                eepfs_dirty_count++;
+            }
+        }
+    }
+
+    enable_interrupts();
+}
+
+/**
+ * @brief Completion of a background block write (called by the SI interrupt).
+ */
+static void eepfs_flush_done(void * output)
+{
+    eepfs_flushing = -1;
+    eepfs_flush_tick = TICKS_READ();
+}
+
 /**
  * @brief Initializes the EEPROM filesystem.
  * 
@@ -308,7 +446,7 @@ int eepfs_init(const eepfs_entry_t * entries, size_t count)
 
     /* Calculate and store the CRC-16 checksum for the declared entries */
     const size_t entries_size = sizeof(eepfs_entry_t) * count;
-    eepfs_files_checksum = calculate_crc16((void *)entries, entries_size);
+    eepfs_files_checksum = eepfs_crc16_update(EEPFS_CRC16_INIT, entries, entries_size);
 
     return EEPFS_ESUCCESS;
 }
@@ -330,6 +468,14 @@ int eepfs_close(void)
         return EEPFS_EBADFS;
     }
 
+    /* Write back the pending changes */
+    if ( eepfs_shadow != NULL )
+    {
+        eepfs_flush();
+        free(eepfs_shadow);
+        eepfs_shadow = NULL;
+    }
+
     /* Clear the file descriptor table */
     free(eepfs_files);
     eepfs_files = NULL;
@@ -368,7 +514,15 @@ int eepfs_read(const char * path, void * dest, size_t size)
     }
 
     const size_t start_bytes = file->start_block * EEPROM_BLOCK_SIZE;
-    eeprom_read_bytes(dest, start_bytes, file->num_bytes);
+
+    if ( eepfs_shadow != NULL )
+    {
+        memcpy(dest, &eepfs_shadow[start_bytes], file->num_bytes);
+    }
+    else
+    {
+        eeprom_read_bytes(dest, start_bytes, file->num_bytes);
+    }
 
     return EEPFS_ESUCCESS;
 }
@@ -377,7 +531,9 @@ int eepfs_read(const char * path, void * dest, size_t size)
  * @brief Writes an entire file to the EEPROM filesystem.
  * 
  * Each EEPROM block write takes approximately 15 milliseconds;
- * this operation may block for a while!
+ * this operation may block for a while! With #eepfs_enable_async,
+ * this only updates the shadow, and the blocks that changed are
+ * written in the background.
  *
  * @param[in] path
  *            Path of file in EEPROM filesystem to write to
@@ -405,7 +561,15 @@ int eepfs_write(const char * path, const void * src, size_t size)
     }
 
     const size_t start_bytes = file->start_block * EEPROM_BLOCK_SIZE;
-    eeprom_write_bytes(src, start_bytes, file->num_bytes);
+
+    if ( eepfs_shadow != NULL )
+    {
+        eepfs_shadow_write(start_bytes, src, file->num_bytes);
+    }
+    else
+    {
+        eeprom_write_bytes(src, start_bytes, file->num_bytes);
+    }
 
     return EEPFS_ESUCCESS;
 }
@@ -440,6 +604,12 @@ int eepfs_erase(const char * path)
     const size_t num_blocks = divide_ceil(file->num_bytes, EEPROM_BLOCK_SIZE);
     size_t current_block = file->start_block;
 
+    if ( eepfs_shadow != NULL )
+    {
+        eepfs_shadow_write(current_block * EEPROM_BLOCK_SIZE, NULL, num_blocks * EEPROM_BLOCK_SIZE);
+        return EEPFS_ESUCCESS;
+    }
+
     /* eeprom_buf is initialized to all zeroes */
     const uint8_t eeprom_buf[EEPROM_BLOCK_SIZE] = {0};
 
@@ -482,7 +652,15 @@ bool eepfs_verify_signature(void)
 
     /* Read the signature block out of EEPROM */
     uint8_t eeprom_buf[EEPROM_BLOCK_SIZE];
-    eeprom_read(0, eeprom_buf);
+
+    if ( eepfs_shadow != NULL )
+    {
+        memcpy(eeprom_buf, eepfs_shadow, EEPROM_BLOCK_SIZE);
+    }
+    else
+    {
+        eeprom_read(0, eeprom_buf);
+    }
 
     /* If the signatures don't match, we can be pretty sure
        that the data in EEPROM is not the expected filesystem */
@@ -510,6 +688,14 @@ void eepfs_wipe(void)
 {
     /* Write the filesystem signature into the first block */
     const uint64_t signature = eepfs_generate_signature();
+
+    if ( eepfs_shadow != NULL )
+    {
+        eepfs_shadow_write(0, (uint8_t *)&signature, EEPROM_BLOCK_SIZE);
+        eepfs_shadow_write(EEPROM_BLOCK_SIZE, NULL, (eeprom_total_blocks() - 1) * EEPROM_BLOCK_SIZE);
+        return;
+    }
+
     eeprom_write(0, (uint8_t *)&signature);
 
     /* eeprom_buf is initialized to all zeroes */
@@ -525,3 +711,141 @@ void eepfs_wipe(void)
     }
 }
 
+/**
+ * @brief Switches the EEPROM filesystem to asynchronous writes.
+ * 
+ * The entire EEPROM is read into a RAM shadow: from then on, files
+ * are read from the shadow, and writing a file only updates the
+ * shadow, marking the blocks that actually changed as dirty.
+ * The dirty blocks are written back in the background by
+ * #eepfs_poll, one block at a time, so that saving does not stall
+ * the game for 15 milliseconds per block.
+ * 
+ * #eepfs_close writes back the remaining dirty blocks.
+ * 
+ * @return EEPFS_ESUCCESS on success or a negative error otherwise
+ */
+int eepfs_enable_async(void)
+{
+    if ( eepfs_files == NULL || eepfs_files_count == 0 )
+    {
+        return EEPFS_EBADFS;
+    }
+    if ( eepfs_shadow != NULL )
+    {
+        return EEPFS_ECONFLICT;
+    }
+
+    const size_t eeprom_bytes = eeprom_total_blocks() * EEPROM_BLOCK_SIZE;
+    uint8_t * shadow = malloc(eeprom_bytes);
+
+    if ( shadow == NULL )
+    {
+        return EEPFS_ENOMEM;
+    }
+
+    eeprom_read_bytes(shadow, 0, eeprom_bytes);
+
+    memset(eepfs_dirty, 0, sizeof(eepfs_dirty));
+    eepfs_dirty_count = 0;
+    eepfs_flushing = -1;
+    eepfs_flush_next = 0;
+    eepfs_flush_tick = TICKS_READ() - TICKS_FROM_MS(EEPFS_WRITE_MS);
+    eepfs_shadow = shadow;
+
+    return EEPFS_ESUCCESS;
+}
+
+/**
+ * @brief Writes back one dirty block in the background, if possible.
+ * 
+ * Call this once per frame (or from a timer callback): if no block
+ * is being written and the previous write is complete, this starts
+ * an asynchronous joybus write of the next dirty block, and returns
+ * right away.
+ * 
+ * @return The number of blocks not yet written back to EEPROM
+ */
+int eepfs_poll(void)
+{
+    if ( eepfs_shadow == NULL )
+    {
+        return 0;
+    }
+
+    disable_interrupts();
+
+    if ( eepfs_flushing < 0 && eepfs_dirty_count > 0 &&
+         TICKS_DISTANCE(eepfs_flush_tick, TICKS_READ()) >= (int32_t)TICKS_FROM_MS(EEPFS_WRITE_MS) )
+    {
+        const size_t total_blocks = eeprom_total_blocks();
+        size_t block = eepfs_flush_next;
+
+        /* Find the next dirty block, round-robin */
+        while ( !(eepfs_dirty[block / 32] & (1u << (block % 32))) )
+        {
+            block = (block + 1) % total_blocks;
+        }
+
+        uint8_t send[1 + EEPROM_BLOCK_SIZE];
+        send[0] = block;
+        memcpy(&send[1], &eepfs_shadow[block * EEPROM_BLOCK_SIZE], EEPROM_BLOCK_SIZE);
+
+        /* The cartridge is joybus channel 4 */
+        joybus_cmdlist_t list;
+        joybus_cmdlist_init(&list);
+        joybus_cmdlist_add(&list, 4, 0x05, send, sizeof(send), 1);
+
+        if ( joybus_exec_async(joybus_cmdlist_block(&list), eepfs_flush_output, eepfs_flush_done) == 0 )
+        {
+            eepfs_dirty[block / 32] &= ~(1u << (block % 32));
+            eepfs_dirty_count--;
+            eepfs_flushing = block;
+            eepfs_flush_next = (block + 1) % total_blocks;
+        }
+    }
+
+    const int pending = eepfs_dirty_count + (eepfs_flushing >= 0);
+    enable_interrupts();
+
+    return pending;
+}
+
+/**
+ * @brief Writes back all the dirty blocks, waiting for completion.
+ * 
+ * This does nothing unless #eepfs_enable_async was called.
+ */
+void eepfs_flush(void)
+{
+    if ( eepfs_shadow == NULL )
+    {
+        return;
+    }
+
+    /* Let the background write complete */
+    while ( eepfs_flushing >= 0 ) { ; }
+
+    const size_t total_blocks = eeprom_total_blocks();
+
+    for ( size_t block = 0; block < total_blocks && eepfs_dirty_count > 0; ++block )
+    {
+        uint8_t eeprom_buf[EEPROM_BLOCK_SIZE];
+        bool dirty;
+
+        disable_interrupts();
+        dirty = eepfs_dirty[block / 32] & (1u << (block % 32));
+        if ( dirty )
+        {
+            eepfs_dirty[block / 32] &= ~(1u << (block % 32));
+            eepfs_dirty_count--;
+            memcpy(eeprom_buf, &eepfs_shadow[block * EEPROM_BLOCK_SIZE], EEPROM_BLOCK_SIZE);
+        }
+        enable_interrupts();
+
+        if ( dirty )
+        {
+            eeprom_write(block, eeprom_buf);
+        }
+    }
+}
@@ -6,6 +6,7 @@
 #include "exception.h"
 #include "console.h"
 #include "n64sys.h"
+#include "interrupt.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -23,6 +24,12 @@
  * #register_exception_handler will be passed information regarding the
  * exception type and relevant registers.
  *
+ * Denormalized floating point numbers are not handled by the FPU, which raises
+ * an unimplemented operation exception instead: by default these exceptions are
+ * fatal. Code that can produce tiny values (eg: physics with damping) can select
+ * a different behavior with #exception_set_fpu_denormal_mode, and check with
+ * #exception_fpu_denormal_stats how often the exception handler had to step in.
+ *
  * @{
  */
 
@@ -31,6 +38,18 @@ static void (*__exception_handler)(exception_t*) = exception_default_handler;
 /** @brief Base register offset as defined by the interrupt controller */
 extern const void* __baseRegAddr;
 
+/** @brief Current handling of denormalized numbers */
+static fpu_denormal_mode_t fpu_denormal_mode = FPU_DENORMAL_TRAP;
+/** @brief Statistics of the denormalized inputs flushed by the exception handler */
+static volatile fpu_denormal_stats_t fpu_denormal_stats;
+
+/** @brief COP1 opcode (bits 26-31 of the instruction) */
+#define FPU_OPCODE_COP1		0x11
+/** @brief Single precision format (bits 21-25 of the instruction) */
+#define FPU_FMT_S			16
+/** @brief Double precision format (bits 21-25 of the instruction) */
+#define FPU_FMT_D			17
+
 /**
  * @brief Register an exception handler to handle exceptions
  *
@@ -66,6 +85,119 @@ void register_exception_handler( void (*cb)(exception_t*))
 	__exception_handler = cb;
 }
 
+/**
+ * @brief Select how the FPU handles denormalized numbers
+ *
+ * #FPU_DENORMAL_FLUSH sets the flush-to-zero bit in FCR31, so that operations
+ * producing denormalized results return zero. Operations with denormalized inputs
+ * (which can only come from memory when flushing) still raise an exception.
+ *
+ * #FPU_DENORMAL_EMULATE also makes the exception handler catch these exceptions:
+ * the denormalized inputs of the faulting instruction are replaced with zeros of
+ * the same sign, and the instruction is executed again. Every occurrence costs a
+ * trip through the exception handler, so #exception_fpu_denormal_stats can be used
+ * to find the code where it happens too often.
+ *
+ * The flush-to-zero bit is part of the FPU control register, which is restored to
+ * its previous value when a preempted thread resumes: the mode should be set at
+ * startup, before creating threads.
+ *
+ * @param[in] mode
+ *            Handling of denormalized numbers
+ */
+void exception_set_fpu_denormal_mode( fpu_denormal_mode_t mode )
+{
+	fpu_denormal_mode = mode;
+
+	if( mode == FPU_DENORMAL_TRAP ) {
+		C1_WRITE_FCR31( C1_FCR31() & ~C1_FLUSH_DENORMS_TO_ZERO );
+	} else {
+		C1_WRITE_FCR31( C1_FCR31() | C1_FLUSH_DENORMS_TO_ZERO );
+	}
+}
+
+/**
+ * @brief Get the statistics of the denormalized inputs flushed by the exception handler
+ *
+ * @param[out] stats
+ *             Number of instructions retried in #FPU_DENORMAL_EMULATE mode, and
+ *             address of the last one
+ */
+void exception_fpu_denormal_stats( fpu_denormal_stats_t *stats )
+{
+	disable_interrupts();
+	stats->count = fpu_denormal_stats.count;
+	stats->last_pc = fpu_denormal_stats.last_pc;
+	enable_interrupts();
+}
+
+/**
+ * @brief Flush a denormalized input of a FPU instruction to zero
+ *
+ * @param[in] regs
+ *            Saved registers
+ * @param[in] reg
+ *            FPU register number
+ * @param[in] fmt
+ *            Format of the register (#FPU_FMT_S or #FPU_FMT_D)
+ *
+ * @return True if the register contained a denormalized number
+ */
+static bool __fpu_flush_denormal( volatile reg_block_t *regs, int reg, int fmt )
+{
+	uint64_t value = regs->fpr[reg];
+
+	if( fmt == FPU_FMT_S ) {
+		/* With the FR bit set, single precision values are in the low word */
+		uint32_t bits = value;
+		if( (bits & 0x7F800000) != 0 || (bits & 0x007FFFFF) == 0 ) { return false; }
+		regs->fpr[reg] = (value & 0xFFFFFFFF00000000ull) | (bits & 0x80000000);
+	} else {
+		if( (value & 0x7FF0000000000000ull) != 0 || (value & 0x000FFFFFFFFFFFFFull) == 0 ) { return false; }
+		regs->fpr[reg] = value & 0x8000000000000000ull;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Handle an unimplemented operation exception caused by denormalized inputs
+ *
+ * The saved FPU registers used as inputs by the faulting instruction are flushed
+ * to zero, so that returning from the exception executes the instruction again
+ * on them. Nothing is changed if no input is denormalized, as the exception has
+ * another cause which cannot be fixed here.
+ *
+ * @param[in] regs
+ *            Saved registers
+ *
+ * @return True if the instruction can be executed again
+ */
+static bool __fpu_emulate_denormal( volatile reg_block_t *regs )
+{
+	/* When the exception is in a branch delay slot, EPC points to the branch,
+	   which is executed again as well */
+	uint32_t pc = regs->epc + ((regs->cr & C0_CAUSE_BD) ? 4 : 0);
+	uint32_t op = *(uint32_t *)pc;
+	int fmt = (op >> 21) & 0x1F;
+	int funct = op & 0x3F;
+
+	if( (op >> 26) != FPU_OPCODE_COP1 || (fmt != FPU_FMT_S && fmt != FPU_FMT_D) ) { return false; }
+
+	/* fs is always an input; ft only for add, sub, mul, div and the comparisons,
+	   as it is encoded as zero by the other instructions */
+	bool flushed = __fpu_flush_denormal( regs, (op >> 11) & 0x1F, fmt );
+	if( funct < 4 || funct >= 0x30 ) {
+		flushed |= __fpu_flush_denormal( regs, (op >> 16) & 0x1F, fmt );
+	}
+	if( !flushed ) { return false; }
+
+	regs->fc31 &= ~C1_CAUSE_NOT_IMPLEMENTED;
+	fpu_denormal_stats.count++;
+	fpu_denormal_stats.last_pc = pc;
+	return true;
+}
+
 void exception_default_handler(exception_t* ex) {
 	uint32_t cr = ex->regs->cr;
 	uint32_t sr = ex->regs->sr;
@@ -279,6 +411,10 @@ void __onCriticalException()
 	if(!__exception_handler) { return; }
 
 	__fetch_regs(&e,EXCEPTION_TYPE_CRITICAL);
+
+	if( e.code == EXCEPTION_CODE_FLOATING_POINT && fpu_denormal_mode == FPU_DENORMAL_EMULATE &&
+		(e.regs->fc31 & C1_CAUSE_NOT_IMPLEMENTED) && __fpu_emulate_denormal(e.regs) ) { return; }
+
 	__exception_handler(&e);
 }
 
@@ -8,6 +8,8 @@
 #include <string.h>
 #include "display.h"
 #include "graphics.h"
+#include "rdp.h"
+#include "memops.h"
 #include "font.h"
 
 /**
@@ -37,6 +39,13 @@
  * #graphics_make_color and #graphics_convert_color are also compatible with both
  * hardware and software graphics routines.
  *
+ * Alternatively, the graphics functions can use the RDP themselves: after calling
+ * #graphics_set_backend with #GRAPHICS_BACKEND_RDP, boxes, lines, screen fills and
+ * 16-bit sprites drawn to the display context the RDP is attached to (see
+ * #rdp_attach_display) are turned into RDP fill and texture rectangles.  The other
+ * functions still draw with the CPU, after waiting for the RDP to be done with the
+ * commands issued before, so the drawing order is preserved.
+ *
  * @{
  */
 
@@ -211,6 +220,398 @@ static int __is_transparent( int bitdepth, uint32_t color )
     return 0;
 }
 
+/**
+ * @brief Blend a 32-bit color over a pixel, using its alpha
+ *
+ * Red and blue are blended together with a single multiplication per color, as
+ * two 16-bit lanes of a 32-bit word.  Fully transparent and fully opaque colors
+ * skip the blending altogether.
+ *
+ * @param[in,out] dst
+ *                Pixel to blend the color over
+ * @param[in]     src
+ *                32-bit RGBA color to blend
+ */
+static inline void __blend_pixel_32( uint32_t *dst, uint32_t src )
+{
+    uint32_t st = src & 0xFF;
+
+    if( st == 0x00 ) { return; }
+    if( st == 0xFF ) { *dst = src; return; }
+
+    uint32_t cur = *dst;
+    uint32_t ct = 255 - st;
+
+    /* Each lane is at most 255 * 255, so it does not overflow into the next one */
+    uint32_t rb = ((cur >> 8) & 0x00FF00FF) * ct + ((src >> 8) & 0x00FF00FF) * st;
+    uint32_t g = ((cur >> 16) & 0xFF) * ct + ((src >> 16) & 0xFF) * st;
+
+    /* Since we are doing mixing anyway, the result is opaque */
+    *dst = (rb & 0xFF00FF00) | ((g << 8) & 0x00FF0000) | 0xFF;
+}
+
+/**
+ * @brief Fill a span of 16-bit pixels with a color
+ *
+ * The span is written 64 bits (4 pixels) at a time, 32 bytes per iteration
+ * where possible; the unaligned head and tail are written one pixel at a time.
+ *
+ * @param[out] dst
+ *             First pixel of the span
+ * @param[in]  count
+ *             Number of pixels in the span
+ * @param[in]  color
+ *             16-bit color of the pixels
+ */
+static inline void __fill_span16( uint16_t *dst, int count, uint16_t color )
+{
+    while( count > 0 && ((uintptr_t)dst & 7) ) { *dst++ = color; count--; }
+
+    uint64_t c64 = color * 0x0001000100010001ULL;
+    uint64_t *dst64 = (uint64_t *)dst;
+
+    for( ; count >= 16; count -= 16, dst64 += 4 )
+    {
+        dst64[0] = c64;
+        dst64[1] = c64;
+        dst64[2] = c64;
+        dst64[3] = c64;
+    }
+    for( ; count >= 4; count -= 4 ) { *dst64++ = c64; }
+
+    dst = (uint16_t *)dst64;
+    while( count-- > 0 ) { *dst++ = color; }
+}
+
+/**
+ * @brief Fill a span of 32-bit pixels with a color
+ *
+ * The span is written 64 bits (2 pixels) at a time, 32 bytes per iteration
+ * where possible; the unaligned head and tail are written one pixel at a time.
+ *
+ * @param[out] dst
+ *             First pixel of the span
+ * @param[in]  count
+ *             Number of pixels in the span
+ * @param[in]  color
+ *             32-bit color of the pixels
+ */
+static inline void __fill_span32( uint32_t *dst, int count, uint32_t color )
+{
+    if( count > 0 && ((uintptr_t)dst & 7) ) { *dst++ = color; count--; }
+
+    uint64_t c64 = ((uint64_t)color << 32) | color;
+    uint64_t *dst64 = (uint64_t *)dst;
+
+    for( ; count >= 8; count -= 8, dst64 += 4 )
+    {
+        dst64[0] = c64;
+        dst64[1] = c64;
+        dst64[2] = c64;
+        dst64[3] = c64;
+    }
+    for( ; count >= 2; count -= 2 ) { *dst64++ = c64; }
+
+    if( count > 0 ) { *(uint32_t *)dst64 = color; }
+}
+
+/**
+ * @brief Copy a span of 16-bit pixels
+ *
+ * The destination is written 64 bits (4 pixels) at a time once aligned.  When the
+ * source has a different alignment, each 64-bit store is assembled from narrower loads,
+ * which are cheap compared to stores to the uncached framebuffer.
+ *
+ * @param[out] dst
+ *             First pixel of the destination span
+ * @param[in]  src
+ *             First pixel of the source span
+ * @param[in]  count
+ *             Number of pixels to copy
+ */
+static inline void __copy_span16( uint16_t *dst, const uint16_t *src, int count )
+{
+    while( count > 0 && ((uintptr_t)dst & 7) ) { *dst++ = *src++; count--; }
+
+    uint64_t *dst64 = (uint64_t *)dst;
+
+    if( !((uintptr_t)src & 7) )
+    {
+        const uint64_t *src64 = (const uint64_t *)src;
+
+        for( ; count >= 4; count -= 4 ) { *dst64++ = *src64++; }
+        src = (const uint16_t *)src64;
+    }
+    else if( !((uintptr_t)src & 3) )
+    {
+        const uint32_t *src32 = (const uint32_t *)src;
+
+        for( ; count >= 4; count -= 4, src32 += 2 )
+        {
+            *dst64++ = ((uint64_t)src32[0] << 32) | src32[1];
+        }
+        src = (const uint16_t *)src32;
+    }
+    else
+    {
+        for( ; count >= 4; count -= 4, src += 4 )
+        {
+            *dst64++ = ((uint64_t)src[0] << 48) | ((uint64_t)src[1] << 32) |
+                       ((uint32_t)src[2] << 16) | src[3];
+        }
+    }
+
+    dst = (uint16_t *)dst64;
+    while( count-- > 0 ) { *dst++ = *src++; }
+}
+
+/**
+ * @brief Copy a span of 32-bit pixels
+ *
+ * The destination is written 64 bits (2 pixels) at a time once aligned.
+ *
+ * @param[out] dst
+ *             First pixel of the destination span
+ * @param[in]  src
+ *             First pixel of the source span
+ * @param[in]  count
+ *             Number of pixels to copy
+ */
+static inline void __copy_span32( uint32_t *dst, const uint32_t *src, int count )
+{
+    if( count > 0 && ((uintptr_t)dst & 7) ) { *dst++ = *src++; count--; }
+
+    uint64_t *dst64 = (uint64_t *)dst;
+
+    if( !((uintptr_t)src & 7) )
+    {
+        const uint64_t *src64 = (const uint64_t *)src;
+
+        for( ; count >= 2; count -= 2 ) { *dst64++ = *src64++; }
+        src = (const uint32_t *)src64;
+    }
+    else
+    {
+        for( ; count >= 2; count -= 2, src += 2 )
+        {
+            *dst64++ = ((uint64_t)src[0] << 32) | src[1];
+        }
+    }
+
+    if( count > 0 ) { *(uint32_t *)dst64 = *src; }
+}
+
+/**
+ * @brief Convert a color to 8 bits per component
+ *
+ * @param[in] color
+ *            The 32-bit RGBA color as returned by #graphics_make_color for the current bit depth
+ *
+ * @return The color with 8 bits per component (red in the most significant byte)
+ */
+static uint32_t __rgba32( uint32_t color )
+{
+    if( __bitdepth == 4 ) { return color; }
+
+    uint32_t r = (color >> 11) & 0x1F;
+    uint32_t g = (color >> 6) & 0x1F;
+    uint32_t b = (color >> 1) & 0x1F;
+
+    return (r << 27) | (g << 19) | (b << 11) | ((color & 1) ? 0xFF : 0);
+}
+
+/** @brief Modes of the RDP set up by the graphics functions */
+typedef enum
+{
+    /** @brief Unknown: the mode must be set before drawing */
+    GRAPHICS_RDP_NONE,
+    /** @brief Fill mode, for boxes and lines */
+    GRAPHICS_RDP_FILL,
+    /** @brief Texture copy mode, for sprites */
+    GRAPHICS_RDP_COPY,
+    /** @brief Text mode, for text with a transparent background */
+    GRAPHICS_RDP_TEXT
+} graphics_rdp_mode_t;
+
+/** @brief Backend used by the drawing functions */
+static graphics_backend_t graphics_backend = GRAPHICS_BACKEND_CPU;
+/** @brief Current mode of the RDP */
+static graphics_rdp_mode_t rdp_mode = GRAPHICS_RDP_NONE;
+/** @brief Display context the RDP mode was set up for */
+static display_context_t rdp_disp = 0;
+/** @brief Current fill color of the RDP (valid in #GRAPHICS_RDP_FILL mode) */
+static uint32_t rdp_fill_color = 0;
+/** @brief Current text color of the RDP (valid in #GRAPHICS_RDP_TEXT mode) */
+static uint32_t rdp_text_color = 0;
+/** @brief True if RDP commands were issued since the CPU last drew */
+static int rdp_pending = 0;
+/** @brief Fence of the last fill done by the RSP (see #graphics_fill_screen_async) */
+static rsp_memops_fence_t rsp_fill_fence = 0;
+
+/**
+ * @brief Set the backend used to draw
+ *
+ * With #GRAPHICS_BACKEND_RDP, #graphics_draw_box, #graphics_draw_line, #graphics_fill_screen,
+ * the sprite functions (for 16-bit sprites) and #graphics_draw_text (when the background color
+ * is transparent, see #rdp_enable_text) use the RDP when drawing to the display context
+ * the RDP is attached to.  The first time they draw to a display context, they set the RDP
+ * clipping to the whole screen; they set the RDP mode (fill or texture copy) whenever they need a
+ * different one.  If other code changes the RDP mode while the same display context is attached,
+ * call this function again before calling the graphics functions.  Sprites are loaded into TMEM
+ * in texture slot 0, overwriting the textures previously loaded.
+ *
+ * With the RDP backend, the non-transparent sprite functions skip the transparent pixels of a
+ * sprite, like the transparent ones do.
+ *
+ * @param[in] backend
+ *            Either #GRAPHICS_BACKEND_CPU (the default) or #GRAPHICS_BACKEND_RDP
+ */
+void graphics_set_backend( graphics_backend_t backend )
+{
+    graphics_backend = backend;
+    rdp_mode = GRAPHICS_RDP_NONE;
+    rdp_disp = 0;
+}
+
+/**
+ * @brief Prepare the RDP to draw to a display context, if possible
+ *
+ * @param[in] disp
+ *            The currently active display context.
+ * @param[in] mode
+ *            The mode needed to draw
+ *
+ * @retval 1 if the RDP is ready to draw in the requested mode
+ * @retval 0 if the drawing must be done with the CPU
+ */
+static int __rdp_begin( display_context_t disp, graphics_rdp_mode_t mode )
+{
+    if( graphics_backend != GRAPHICS_BACKEND_RDP ) { return 0; }
+    if( disp == 0 || rdp_get_attached_display() != disp ) { return 0; }
+
+    /* Draw on top of a fill by the RSP */
+    if( rsp_fill_fence ) { rsp_memops_wait( rsp_fill_fence ); rsp_fill_fence = 0; }
+
+    if( disp != rdp_disp )
+    {
+        /* The state set up for another display context can't be trusted */
+        rdp_disp = disp;
+        rdp_mode = GRAPHICS_RDP_NONE;
+        rdp_set_default_clipping();
+    }
+
+    if( mode != rdp_mode )
+    {
+        rdp_sync( SYNC_PIPE );
+
+        if( mode == GRAPHICS_RDP_FILL )
+        {
+            rdp_enable_primitive_fill();
+
+            /* Force the fill color to be set */
+            rdp_fill_color = ~f_color;
+        }
+        else if( mode == GRAPHICS_RDP_TEXT )
+        {
+            rdp_text_color = __rgba32( f_color );
+            rdp_enable_text( rdp_text_color );
+        }
+        else
+        {
+            rdp_enable_texture_copy();
+        }
+
+        rdp_mode = mode;
+    }
+
+    rdp_pending = 1;
+    return 1;
+}
+
+/**
+ * @brief Set the color of the RDP fill rectangles
+ *
+ * @param[in] color
+ *            The 32-bit RGBA color to fill with
+ */
+static void __rdp_fill_color( uint32_t color )
+{
+    /* In 16 bpp mode, the fill color is made of two pixels */
+    if( __bitdepth == 2 ) { color = (color & 0xFFFF) | (color << 16); }
+
+    if( color != rdp_fill_color )
+    {
+        rdp_sync( SYNC_PIPE );
+        rdp_set_primitive_color( color );
+        rdp_fill_color = color;
+    }
+}
+
+/**
+ * @brief Set the color of the RDP text
+ *
+ * @param[in] color
+ *            The 32-bit RGBA color of the text
+ */
+static void __rdp_text_color( uint32_t color )
+{
+    color = __rgba32( color );
+
+    if( color != rdp_text_color )
+    {
+        rdp_sync( SYNC_PIPE );
+        rdp_enable_text( color );
+        rdp_text_color = color;
+    }
+}
+
+/**
+ * @brief Fill a rectangle with the RDP, discarding the part out of the screen
+ *
+ * @param[in] tx
+ *            The x coordinate of the top left of the rectangle
+ * @param[in] ty
+ *            The y coordinate of the top left of the rectangle
+ * @param[in] bx
+ *            The x coordinate of the bottom right of the rectangle (inclusive)
+ * @param[in] by
+ *            The y coordinate of the bottom right of the rectangle (inclusive)
+ */
+static void __rdp_fill( int tx, int ty, int bx, int by )
+{
+    if( bx < tx ) { int t = tx; tx = bx; bx = t; }
+    if( by < ty ) { int t = ty; ty = by; by = t; }
+
+    if( bx < 0 || by < 0 ) { return; }
+    if( tx >= (int)__width || ty >= (int)__height ) { return; }
+    if( bx >= (int)__width ) { bx = __width - 1; }
+    if( by >= (int)__height ) { by = __height - 1; }
+
+    rdp_draw_filled_rectangle( tx, ty, bx, by );
+}
+
+/**
+ * @brief Make sure that the CPU can draw to a display context
+ *
+ * If RDP commands were issued to draw to the display context, wait for the RDP to
+ * execute them, so that the CPU draws on top of them.  The same goes for a fill
+ * done by the RSP.
+ *
+ * @param[in] disp
+ *            The currently active display context.
+ */
+static void __cpu_begin( display_context_t disp )
+{
+    if( rsp_fill_fence ) { rsp_memops_wait( rsp_fill_fence ); rsp_fill_fence = 0; }
+
+    if( rdp_pending && rdp_get_attached_display() == disp )
+    {
+        rdp_wait_idle();
+    }
+
+    rdp_pending = 0;
+}
+
 /**
  * @brief Draw a pixel to a given display context
  *
@@ -231,6 +632,8 @@ void graphics_draw_pixel( display_context_t disp, int x, int y, uint32_t color )
 {
     if( disp == 0 ) { return; }
 
+    __cpu_begin( disp );
+
     if( __bitdepth == 2 )
     {
         __set_pixel( (uint16_t *)__get_buffer( disp ), x, y, color );
@@ -261,6 +664,8 @@ void graphics_draw_pixel_trans( display_context_t disp, int x, int y, uint32_t c
 {
     if( disp == 0 ) { return; }
 
+    __cpu_begin( disp );
+
     if( __bitdepth == 2 )
     {
         /* Only display the pixel if alpha bit is set */
@@ -271,36 +676,86 @@ void graphics_draw_pixel_trans( display_context_t disp, int x, int y, uint32_t c
     }
     else
     {
-        /* Get 32bit representations */
-        uint32_t cur_color = __get_pixel( (uint32_t *)__get_buffer( disp ), x, y );
-
-        /* Get current color */
-        uint32_t cr = (cur_color >> 24) & 0xFF;
-        uint32_t cg = (cur_color >> 16) & 0xFF;
-        uint32_t cb = (cur_color >> 8) & 0xFF;
-
-        /* Get new color */
-        uint32_t sr = (color >> 24) & 0xFF;
-        uint32_t sg = (color >> 16) & 0xFF;
-        uint32_t sb = (color >> 8) & 0xFF;
+        __blend_pixel_32( &__get_pixel( (uint32_t *)__get_buffer( disp ), x, y ), color );
+    }
+}
 
-        /* Transparencies */
-        uint32_t st = color & 0xFF;
-        uint32_t ct = 255 - st;
+/**
+ * @brief Draw a line with the RDP
+ *
+ * The pixels are the same drawn by #graphics_draw_line with the CPU: each run of
+ * pixels along the major axis becomes a fill rectangle.
+ *
+ * @param[in] x0
+ *            The x coordinate of the start of the line.
+ * @param[in] y0
+ *            The y coordinate of the start of the line.
+ * @param[in] x1
+ *            The x coordinate of the end of the line.
+ * @param[in] y1
+ *            The y coordinate of the end of the line.
+ */
+static void __rdp_draw_line( int x0, int y0, int x1, int y1 )
+{
+	int dy = y1 - y0;
+	int dx = x1 - x0;
+	int sx, sy;
 
-        /* Mixed color */
-        uint32_t mixed_color;
-        uint8_t *final_color = (uint8_t *)(&mixed_color);
+	if(dy < 0)
+	{
+		dy = -dy;
+		sy = -1;
+	}
+	else
+		sy = 1;
 
-        final_color[0] = ((cr * ct) + (sr * st)) >> 8;
-        final_color[1] = ((cg * ct) + (sg * st)) >> 8;
-        final_color[2] = ((cb * ct) + (sb * st)) >> 8;
+	if(dx < 0)
+	{
+		dx = -dx;
+		sx = -1;
+	}
+	else
+		sx = 1;
 
-        /* Since we are doing mixing anyway */
-        final_color[3] = 255;
+	dy <<= 1;
+	dx <<= 1;
 
-        __set_pixel( (uint32_t *)__get_buffer( disp ), x, y, mixed_color );
-    }
+	if(dx > dy)
+	{
+		int frac = dy - (dx >> 1);
+		int run = x0;
+		while(x0 != x1)
+		{
+			if(frac >= 0)
+			{
+				__rdp_fill(run, y0, x0, y0);
+				y0 += sy;
+				frac -= dx;
+				run = x0 + sx;
+			}
+			x0 += sx;
+			frac += dy;
+		}
+		__rdp_fill(run, y0, x0, y0);
+	}
+	else
+	{
+		int frac = dx - (dy >> 1);
+		int run = y0;
+		while(y0 != y1)
+		{
+			if(frac >= 0)
+			{
+				__rdp_fill(x0, run, x0, y0);
+				x0 += sx;
+				frac -= dy;
+				run = y0 + sy;
+			}
+			y0 += sy;
+			frac += dx;
+		}
+		__rdp_fill(x0, run, x0, y0);
+	}
 }
 
 /**
@@ -325,6 +780,13 @@ void graphics_draw_pixel_trans( display_context_t disp, int x, int y, uint32_t c
  */
 void graphics_draw_line( display_context_t disp, int x0, int y0, int x1, int y1, uint32_t color )
 {
+	if( __rdp_begin( disp, GRAPHICS_RDP_FILL ) )
+	{
+		__rdp_fill_color( color );
+		__rdp_draw_line( x0, y0, x1, y1 );
+		return;
+	}
+
 	int dy = y1 - y0;
 	int dx = x1 - x0;
 	int sx, sy;
@@ -483,28 +945,40 @@ void graphics_draw_box( display_context_t disp, int x, int y, int width, int hei
 {
     if( disp == 0 ) { return; }
 
+    if( __rdp_begin( disp, GRAPHICS_RDP_FILL ) )
+    {
+        if( width <= 0 || height <= 0 ) { return; }
+
+        __rdp_fill_color( color );
+        __rdp_fill( x, y, x + width - 1, y + height - 1 );
+        return;
+    }
+
+    __cpu_begin( disp );
+
+    /* Clip to the screen */
+    if( x < 0 ) { width += x; x = 0; }
+    if( y < 0 ) { height += y; y = 0; }
+    if( x + width > (int)__width ) { width = __width - x; }
+    if( y + height > (int)__height ) { height = __height - y; }
+    if( width <= 0 || height <= 0 ) { return; }
+
     if( __bitdepth == 2 )
     {
-        uint16_t *buffer16 = (uint16_t *)__get_buffer( disp );
+        uint16_t *buffer16 = (uint16_t *)__get_buffer( disp ) + y * __width + x;
 
-        for(int j = y; j < y + height; j++)
+        for(int j = 0; j < height; j++, buffer16 += __width)
         {
-            for(int i = x; i < x + width; i++)
-            {
-                __set_pixel( buffer16, i, j, color );
-            }
+            __fill_span16( buffer16, width, color );
         }
     }
     else
     {
-        uint32_t *buffer32 = (uint32_t *)__get_buffer( disp );
+        uint32_t *buffer32 = (uint32_t *)__get_buffer( disp ) + y * __width + x;
 
-        for(int j = y; j < y + height; j++)
+        for(int j = 0; j < height; j++, buffer32 += __width)
         {
-            for(int i = x; i < x + width; i++)
-            {
-                __set_pixel( buffer32, i, j, color );
-            }
+            __fill_span32( buffer32, width, color );
         }
     }
 }
@@ -533,19 +1007,20 @@ void graphics_draw_box_trans( display_context_t disp, int x, int y, int width, i
 {
     if( disp == 0 ) { return; }
 
+    __cpu_begin( disp );
+
     if( __bitdepth == 2 )
     {
         uint16_t *buffer16 = (uint16_t *)__get_buffer( disp );
 
+        /* Only display the box if alpha bit is set */
+        if( __is_transparent( 2, color ) ) { return; }
+
         for(int j = y; j < y + height; j++)
         {
             for(int i = x; i < x + width; i++)
             {
-                /* Only display the pixel if alpha bit is set */
-                if( !__is_transparent( 2, color ) )
-                {
-                    __set_pixel( buffer16, i, j, color );
-                }
+                __set_pixel( buffer16, i, j, color );
             }
         }
     }
@@ -557,35 +1032,7 @@ void graphics_draw_box_trans( display_context_t disp, int x, int y, int width, i
         {
             for(int i = x; i < x + width; i++)
             {
-                /* Get 32bit representations */
-                uint32_t cur_color = __get_pixel( buffer32, i, j );
-
-                /* Get current color */
-                uint32_t cr = (cur_color >> 24) & 0xFF;
-                uint32_t cg = (cur_color >> 16) & 0xFF;
-                uint32_t cb = (cur_color >> 8) & 0xFF;
-
-                /* Get new color */
-                uint32_t sr = (color >> 24) & 0xFF;
-                uint32_t sg = (color >> 16) & 0xFF;
-                uint32_t sb = (color >> 8) & 0xFF;
-
-                /* Transparencies */
-                uint32_t st = color & 0xFF;
-                uint32_t ct = 255 - st;
-
-                /* Mixed color */
-                uint32_t mixed_color;
-                uint8_t *final_color = (uint8_t *)(&mixed_color);
-
-                final_color[0] = ((cr * ct) + (sr * st)) >> 8;
-                final_color[1] = ((cg * ct) + (sg * st)) >> 8;
-                final_color[2] = ((cb * ct) + (sb * st)) >> 8;
-
-                /* Since we are doing mixing anyway */
-                final_color[3] = 255;
-
-                __set_pixel( buffer32, i, j, mixed_color );
+                __blend_pixel_32( &__get_pixel( buffer32, i, j ), color );
             }
         }
     }
@@ -607,12 +1054,47 @@ void graphics_fill_screen( display_context_t disp, uint32_t c )
 {
     if( disp == 0 ) { return; }
 
-    int len = (__bitdepth == 2) ? __width * __height / 4 : __width * __height / 2;
+    if( __rdp_begin( disp, GRAPHICS_RDP_FILL ) )
+    {
+        __rdp_fill_color( c );
+        __rdp_fill( 0, 0, __width - 1, __height - 1 );
+        return;
+    }
+
+    __cpu_begin( disp );
+
+    /* In 16 bpp mode, the color is written as a pair of pixels */
+    int len = (__bitdepth == 2) ? __width * __height / 2 : __width * __height;
 
-    uint64_t c64 = ((uint64_t)c << 32) | c;
-    uint64_t *buffer = (uint64_t *)__get_buffer(disp);
-    for( int i = 0; i < len; i++ )
-        buffer[i] = c64;
+    __fill_span32( (uint32_t *)__get_buffer(disp), len, c );
+}
+
+/**
+ * @brief Fill the entire screen with a particular color, using the RSP
+ *
+ * Same as #graphics_fill_screen, but the fill is queued on the RSP (see #rsp_memset32)
+ * and the function returns right away, leaving the CPU free, for instance to run the
+ * game logic while the next frame is cleared.  The graphics functions wait for the
+ * fill to be complete before drawing to any display context; before drawing to the
+ * display context in other ways, or showing it, wait for the returned fence with
+ * #rsp_memops_wait.
+ *
+ * @param[in] disp
+ *            The currently active display context.
+ * @param[in] c
+ *            The 32-bit RGBA color to fill the screen with.
+ *
+ * @return The fence of the fill (0 if there is nothing to fill).
+ */
+rsp_memops_fence_t graphics_fill_screen_async( display_context_t disp, uint32_t c )
+{
+    if( disp == 0 ) { return 0; }
+
+    /* The RDP must not draw to the display context in the meantime */
+    __cpu_begin( disp );
+
+    rsp_fill_fence = rsp_memset32( __get_buffer(disp), c, __width * __height * __bitdepth );
+    return rsp_fill_fence;
 }
 
 /**
@@ -639,6 +1121,8 @@ void graphics_draw_character( display_context_t disp, int x, int y, char ch )
 {
     if( disp == 0 ) { return; }
 
+    __cpu_begin( disp );
+
     int depth = __bitdepth;
 
     /* Figure out if they want the background to be transparent */
@@ -727,6 +1211,13 @@ void graphics_draw_text( display_context_t disp, int x, int y, const char * cons
     if( disp == 0 ) { return; }
     if( msg == 0 ) { return; }
 
+    if( __is_transparent( __bitdepth, b_color ) && __rdp_begin( disp, GRAPHICS_RDP_TEXT ) )
+    {
+        __rdp_text_color( f_color );
+        rdp_draw_text( x, y, msg );
+        return;
+    }
+
     int tx = x;
     int ty = y;
     const char *text = (const char *)msg;
@@ -891,6 +1382,16 @@ void graphics_draw_sprite_stride( display_context_t disp, int x, int y, sprite_t
     }
 
     /* Only display sprite if it matches the bitdepth */
+    if( __bitdepth == 2 && sprite->bitdepth == 2 && __rdp_begin( disp, GRAPHICS_RDP_COPY ) )
+    {
+        rdp_draw_sprite_region( sprite, sx, sy, ex - sx, ey - sy, tx + sx, ty + sy );
+        return;
+    }
+
+    __cpu_begin( disp );
+
+    if( sx >= ex ) { return; }
+
     if( __bitdepth == 2 && sprite->bitdepth == 2 )
     {
         uint16_t *buffer = (uint16_t *)__get_buffer( disp );
@@ -900,10 +1401,7 @@ void graphics_draw_sprite_stride( display_context_t disp, int x, int y, sprite_t
         {
             const register int run = yp * sprite->width;
 
-            for( int xp = sx; xp < ex; xp++ )
-            {
-                __set_pixel( buffer, tx + xp, ty + yp, sp_data[xp + run] );
-            }
+            __copy_span16( &buffer[tx + sx + (ty + yp) * __width], &sp_data[sx + run], ex - sx );
         }
     }
     else if( __bitdepth == 4 && sprite->bitdepth == 4 )
@@ -915,10 +1413,7 @@ void graphics_draw_sprite_stride( display_context_t disp, int x, int y, sprite_t
         {
             const register int run = yp * sprite->width;
 
-            for( int xp = sx; xp < ex; xp++ )
-            {
-                __set_pixel( buffer, tx + xp, ty + yp, sp_data[xp + run] );
-            }
+            __copy_span32( &buffer[tx + sx + (ty + yp) * __width], &sp_data[sx + run], ex - sx );
         }
     }
 }
@@ -1059,6 +1554,14 @@ void graphics_draw_sprite_trans_stride( display_context_t disp, int x, int y, sp
     }
 
     /* Only display sprite if it matches the bitdepth */
+    if( __bitdepth == 2 && sprite->bitdepth == 2 && __rdp_begin( disp, GRAPHICS_RDP_COPY ) )
+    {
+        rdp_draw_sprite_region( sprite, sx, sy, ex - sx, ey - sy, tx + sx, ty + sy );
+        return;
+    }
+
+    __cpu_begin( disp );
+
     if( __bitdepth == 2 && sprite->bitdepth == 2 )
     {
         uint16_t *buffer = (uint16_t *)__get_buffer( disp );
@@ -1066,15 +1569,13 @@ void graphics_draw_sprite_trans_stride( display_context_t disp, int x, int y, sp
 
         for( int yp = sy; yp < ey; yp++ )
         {
-            const register int run = yp * sprite->width;
+            const uint16_t *src = &sp_data[yp * sprite->width];
+            uint16_t *dst = &__get_pixel( buffer, tx, ty + yp );
 
             for( int xp = sx; xp < ex; xp++ )
             {
-                /* Only display the pixel if alpha bit is set */
-                if( !__is_transparent( 2, sp_data[xp + run] ) )
-                {
-                    __set_pixel( buffer, tx + xp, ty + yp, sp_data[xp + run] );
-                }
+                /* Only display the pixel if alpha bit is set: no blending needed */
+                if( src[xp] & 0x1 ) { dst[xp] = src[xp]; }
             }
         }
     }
@@ -1085,40 +1586,12 @@ void graphics_draw_sprite_trans_stride( display_context_t disp, int x, int y, sp
 
         for( int yp = sy; yp < ey; yp++ )
         {
-            const int run = yp * sprite->width;
+            const uint32_t *src = &sp_data[yp * sprite->width];
+            uint32_t *dst = &__get_pixel( buffer, tx, ty + yp );
 
             for( int xp = sx; xp < ex; xp++ )
             {
-                /* Get 32bit representations */
-                uint8_t *new_color = (uint8_t *)(&sp_data[xp + run]);
-                uint32_t cur_color = __get_pixel( buffer, tx + xp, ty + yp );
-
-                /* Get current color */
-                uint32_t cr = (cur_color >> 24) & 0xFF;
-                uint32_t cg = (cur_color >> 16) & 0xFF;
-                uint32_t cb = (cur_color >> 8) & 0xFF;
-
-                /* Get new color */
-                uint32_t sr = new_color[0];
-                uint32_t sg = new_color[1];
-                uint32_t sb = new_color[2];
-
-                /* Transparencies */
-                uint32_t st = new_color[3];
-                uint32_t ct = 255 - st;
-
-                /* Mixed color */
-                uint32_t mixed_color;
-                uint8_t *final_color = (uint8_t *)(&mixed_color);
-
-                final_color[0] = ((cr * ct) + (sr * st)) >> 8;
-                final_color[1] = ((cg * ct) + (sg * st)) >> 8;
-                final_color[2] = ((cb * ct) + (sb * st)) >> 8;
-
-                /* Since we are doing mixing anyway */
-                final_color[3] = 255;
-
-                __set_pixel( buffer, tx + xp, ty + yp, mixed_color );
+                __blend_pixel_32( &dst[xp], src[xp] );
             }
         }
     }
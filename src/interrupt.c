@@ -3,7 +3,7 @@
  * @brief Interrupt Controller
  * @ingroup interrupt
  */
-#include <malloc.h>
+#include <string.h>
 #include "libdragon.h"
 #include "regsinternal.h"
 
@@ -37,6 +37,12 @@
  * In this manner, it is safe to nest calls to disable and enable
  * interrupts.
  *
+ * Handlers are free to use the FPU: the FPU registers of the interrupted
+ * code are saved before calling them.  Since this is a large part of the
+ * cost of an interrupt, handlers that never touch the FPU can be registered
+ * with #register_interrupt_handler_nofpu, and an interrupt whose handlers are
+ * all FPU-free does not save the FPU registers at all.
+ *
  * @{
  */
 
@@ -115,16 +121,35 @@ static int __interrupt_depth = -1;
 /** @brief tick at which interrupts were disabled. */
 uint32_t interrupt_disabled_tick = 0;
 
+/** @brief True if interrupt statistics are collected (see #interrupt_enable_stats) */
+static bool stats_enabled = false;
+/** @brief Collected interrupt statistics */
+static interrupt_stats_t stats;
+/** @brief Caller of #disable_interrupts for the current critical section */
+static void *disabled_caller = 0;
+
 /**
- * @brief Structure of an interrupt callback
+ * @brief Handlers registered for an interrupt source
+ *
+ * Handlers are called from the last registered to the first one.
  */
-typedef struct callback_link
+typedef struct
 {
-    /** @brief Callback function */
-    void (*callback)();
-    /** @brief Pointer to next callback */
-    struct callback_link * next;
-} _callback_link;
+    /** @brief Number of registered handlers */
+    int count;
+    /** @brief Registered handlers and their context */
+    struct
+    {
+        /** @brief Handler function */
+        interrupt_handler_t handler;
+        /** @brief Context passed to the handler */
+        void *ctx;
+        /** @brief True if the handler might use the FPU */
+        bool fpu;
+    } handlers[INTERRUPT_MAX_HANDLERS];
+    /** @brief Number of registered handlers that might use the FPU */
+    int fpu_count;
+} interrupt_table_t;
 
 /** @brief Static structure to address AI registers */
 static volatile struct AI_regs_s * const AI_regs = (struct AI_regs_s *)0xa4500000;
@@ -139,109 +164,253 @@ static volatile struct SI_regs_s * const SI_regs = (struct SI_regs_s *)0xa480000
 /** @brief Static structure to address SP registers */
 static volatile struct SP_regs_s * const SP_regs = (struct SP_regs_s *)0xa4040000;
 
-/** @brief Linked list of AI callbacks */
-struct callback_link * AI_callback = 0;
-/** @brief Linked list of VI callbacks */
-struct callback_link * VI_callback = 0;
-/** @brief Linked list of PI callbacks */
-struct callback_link * PI_callback = 0;
-/** @brief Linked list of DP callbacks */
-struct callback_link * DP_callback = 0;
-/** @brief Linked list of TI callbacks */
-struct callback_link * TI_callback = 0;
-/** @brief Linked list of SI callbacks */
-struct callback_link * SI_callback = 0;
-/** @brief Linked list of SP callbacks */
-struct callback_link * SP_callback = 0;
+/** @brief Handlers of each interrupt source */
+static interrupt_table_t handler_tables[INTERRUPT_NUM_SOURCES];
+
+/** @brief Save the FPU registers of the interrupted code (see inthandler.S) */
+extern void __inthandler_save_fpu( void );
+
+/** @brief No VI interrupt line */
+#define VI_LINE_NONE    0xFFFFFFFFul
+
+/** @brief Scanline handlers (see #register_VI_line_handler), sorted by line */
+static struct
+{
+    /** @brief Line the handler is called at */
+    unsigned long line;
+    /** @brief Handler function */
+    interrupt_handler_t handler;
+    /** @brief Context passed to the handler */
+    void *ctx;
+} vi_lines[INTERRUPT_MAX_VI_LINES];
+/** @brief Number of scanline handlers */
+static int vi_lines_count = 0;
+/** @brief Line of the VI interrupt set by #set_VI_interrupt (or #VI_LINE_NONE) */
+static unsigned long vi_frame_line = VI_LINE_NONE;
+/** @brief Line currently programmed in the VI interrupt register */
+static unsigned long vi_next_line = VI_LINE_NONE;
 
 /** 
- * @brief Call each callback in a linked list of callbacks
+ * @brief Call the handlers registered for an interrupt source
  *
- * @param[in] head
- *            Pointer to the head of a callback linke list
+ * @param[in] table
+ *            Handlers of the interrupt source
  */
-static void __call_callback( struct callback_link * head )
+static inline void __call_callback( interrupt_table_t *table )
 {
-    /* Call each registered callback */
-    while( head )
+    int i = table->count;
+
+    /* Most sources have a single handler */
+    if( __builtin_expect( i == 1, 1 ) )
     {
-        if( head->callback )
-        {
-        	head->callback();
-        }
+        table->handlers[0].handler( table->handlers[0].ctx );
+        return;
+    }
+
+    /* Go backwards, so that a handler can unregister itself */
+    while( i-- > 0 )
+    {
+        table->handlers[i].handler( table->handlers[i].ctx );
+    }
+}
+
+/**
+ * @brief Call the handlers of an interrupt source, measuring them if enabled
+ *
+ * @param[in] source
+ *            Interrupt source
+ */
+static inline void __dispatch( interrupt_source_t source )
+{
+    interrupt_table_t *table = &handler_tables[source];
 
-        /* Go to next */
-	    head=head->next;
+    /* The FPU registers are saved only if a handler might touch them */
+    if( table->fpu_count )
+    {
+        __inthandler_save_fpu();
+    }
+
+    if( __builtin_expect( !stats_enabled, 1 ) )
+    {
+        __call_callback( table );
+        return;
     }
+
+    uint32_t start = TICKS_READ();
+    __call_callback( table );
+    uint32_t ticks = TICKS_READ() - start;
+
+    interrupt_source_stats_t *src = &stats.sources[source];
+    src->count++;
+    src->total_ticks += ticks;
+    if( ticks > src->max_ticks ) { src->max_ticks = ticks; }
 }
 
 /**
- * @brief Add a callback to a linked list of callbacks
+ * @brief Add a handler to the handlers of an interrupt source
  *
- * @param[in,out] head
- *                Pointer to the head of a linked list to add to
- * @param[in]     callback
- *                Function to call when executing callbacks in this linked list
+ * @param[in] source
+ *            Interrupt source
+ * @param[in] handler
+ *            Function to call when the interrupt occurs
+ * @param[in] ctx
+ *            Context passed to the handler
+ * @param[in] fpu
+ *            True if the handler might use the FPU
+ *
+ * @retval 0 on success
+ * @retval -1 if #INTERRUPT_MAX_HANDLERS handlers are already registered
  */
-static void __register_callback( struct callback_link ** head, void (*callback)() )
+static int __register_callback( interrupt_source_t source, interrupt_handler_t handler, void *ctx, bool fpu )
 {
-    if( head )
+    interrupt_table_t *table = &handler_tables[source];
+    int ret = -1;
+
+    disable_interrupts();
+    if( table->count < INTERRUPT_MAX_HANDLERS )
     {
-        /* Add to beginning of linked list */
-        struct callback_link *next = *head;
-        (*head) = malloc(sizeof(struct callback_link));
+        table->handlers[table->count].handler = handler;
+        table->handlers[table->count].ctx = ctx;
+        table->handlers[table->count].fpu = fpu;
+        table->count++;
+        if( fpu ) { table->fpu_count++; }
+        ret = 0;
+    }
+    enable_interrupts();
+
+    return ret;
+}
 
-        if( *head )
+/**
+ * @brief Remove a handler from the handlers of an interrupt source
+ *
+ * @param[in] source
+ *            Interrupt source
+ * @param[in] handler
+ *            Function to search for and remove
+ * @param[in] ctx
+ *            Context the handler was registered with
+ */
+static void __unregister_callback( interrupt_source_t source, interrupt_handler_t handler, void *ctx )
+{
+    interrupt_table_t *table = &handler_tables[source];
+
+    disable_interrupts();
+    for( int i = table->count - 1; i >= 0; i-- )
+    {
+        if( table->handlers[i].handler == handler && table->handlers[i].ctx == ctx )
         {
-            (*head)->next=next;
-            (*head)->callback=callback;
+            if( table->handlers[i].fpu ) { table->fpu_count--; }
+
+            /* Keep the order of the other handlers */
+            for( int j = i + 1; j < table->count; j++ )
+            {
+                table->handlers[j - 1] = table->handlers[j];
+            }
+
+            table->count--;
+            break;
         }
     }
+    enable_interrupts();
 }
 
 /**
- * @brief Remove a callback from a linked list of callbacks
+ * @brief Register a handler without context
  *
- * @param[in,out] head
- *                Pointer to the head of a linked list to remove from
- * @param[in]     callback
- *                Function to search for and remove from callback list
+ * The handler is called with a NULL context, as an additional argument that it
+ * ignores (which is harmless with the MIPS calling convention).
+ *
+ * @param[in] source
+ *            Interrupt source
+ * @param[in] callback
+ *            Function to call when the interrupt occurs
+ */
+static void __register_legacy_callback( interrupt_source_t source, void (*callback)() )
+{
+    int ret = __register_callback( source, (interrupt_handler_t)callback, 0, true );
+    assertf( ret == 0, "too many handlers for interrupt %d", source );
+}
+
+/**
+ * @brief Find the next VI interrupt line after a line
+ *
+ * @param[in] line
+ *            Current line
+ *
+ * @return The first line after it of the VI interrupt or of a scanline handler,
+ *         wrapping around to the first line of the next frame (or #VI_LINE_NONE).
+ */
+static unsigned long __vi_line_after( unsigned long line )
+{
+    unsigned long next = vi_frame_line > line ? vi_frame_line : VI_LINE_NONE;
+    unsigned long first = vi_frame_line;
+
+    for( int i = 0; i < vi_lines_count; i++ )
+    {
+        if( vi_lines[i].line > line && vi_lines[i].line < next ) { next = vi_lines[i].line; }
+        if( vi_lines[i].line < first ) { first = vi_lines[i].line; }
+    }
+
+    return next != VI_LINE_NONE ? next : first;
+}
+
+/**
+ * @brief Program the VI interrupt for the next line that needs it
+ *
+ * Must be called with interrupts disabled.
+ */
+static void __vi_program( void )
+{
+    if( vi_frame_line == VI_LINE_NONE && !vi_lines_count )
+    {
+        vi_next_line = VI_LINE_NONE;
+        MI_regs->mask=MI_MASK_CLR_VI;
+        return;
+    }
+
+    vi_next_line = vi_lines_count ? __vi_line_after( VI_regs->cur_line ) : vi_frame_line;
+    VI_regs->v_int=vi_next_line;
+    MI_regs->mask=MI_MASK_SET_VI;
+}
+
+/**
+ * @brief Handle a VI interrupt, calling the handlers of the line that fired
  */
-static void __unregister_callback( struct callback_link ** head, void (*callback)() )
+static void __vi_dispatch( void )
 {
-    if( head )
+    /* Without scanline handlers, the interrupt stays on the same line */
+    if( __builtin_expect( !vi_lines_count, 1 ) )
     {
-        /* Try to find callback this matches */
-        struct callback_link *last = 0;
-        struct callback_link *cur  = *head;
+        __dispatch(INTERRUPT_VI);
+        return;
+    }
 
-        while( cur )
+    unsigned long line = vi_next_line;
+
+    while( 1 )
+    {
+        if( line == vi_frame_line ) { __dispatch(INTERRUPT_VI); }
+
+        bool saved = false;
+        for( int i = vi_lines_count - 1; i >= 0; i-- )
         {
-            if( cur->callback == callback )
+            if( i < vi_lines_count && vi_lines[i].line == line )
             {
-                /* We found it!  Try to remove it from the list */
-                if( last )
-                {
-                    /* This is somewhere in the linked list */
-                    last->next = cur->next;
-                }
-                else
-                {
-                    /* This is the first node */
-                    *head = cur->next;
-                }
-
-                /* Free memory */
-                free( cur );
-
-                /* Exit early */
-                break;
+                /* Raster effects are user code */
+                if( !saved ) { __inthandler_save_fpu(); saved = true; }
+                vi_lines[i].handler( vi_lines[i].ctx );
             }
-
-            /* Go to next entry */
-            last = cur;
-            cur = cur->next;
         }
+
+        unsigned long next = __vi_line_after( line );
+        vi_next_line = next;
+        VI_regs->v_int=next;
+
+        /* If the handlers ran past the next line, it would not fire until the
+           next frame: call its handlers now, late */
+        if( next == VI_LINE_NONE || next <= line || VI_regs->cur_line < next ) { break; }
+        line = next;
     }
 }
 
@@ -260,7 +429,7 @@ void __MI_handler(void)
         /* Clear interrupt */
         SP_regs->status=SP_CLEAR_INTERRUPT;
 
-        __call_callback(SP_callback);
+        __dispatch(INTERRUPT_SP);
     }
 
     if( status & MI_INTR_SI )
@@ -268,7 +437,7 @@ void __MI_handler(void)
         /* Clear interrupt */
         SI_regs->status=SI_CLEAR_INTERRUPT;
 
-        __call_callback(SI_callback);
+        __dispatch(INTERRUPT_SI);
     }
 
     if( status & MI_INTR_AI )
@@ -276,7 +445,7 @@ void __MI_handler(void)
         /* Clear interrupt */
     	AI_regs->status=AI_CLEAR_INTERRUPT;
 
-	    __call_callback(AI_callback);
+	    __dispatch(INTERRUPT_AI);
     }
 
     if( status & MI_INTR_VI )
@@ -284,7 +453,7 @@ void __MI_handler(void)
         /* Clear interrupt */
     	VI_regs->cur_line=VI_regs->cur_line;
 
-    	__call_callback(VI_callback);
+    	__vi_dispatch();
     }
 
     if( status & MI_INTR_PI )
@@ -292,7 +461,7 @@ void __MI_handler(void)
         /* Clear interrupt */
         PI_regs->status=PI_CLEAR_INTERRUPT;
 
-        __call_callback(PI_callback);
+        __dispatch(INTERRUPT_PI);
     }
 
     if( status & MI_INTR_DP )
@@ -300,7 +469,7 @@ void __MI_handler(void)
         /* Clear interrupt */
         MI_regs->mode=DP_CLEAR_INTERRUPT;
 
-        __call_callback(DP_callback);
+        __dispatch(INTERRUPT_DP);
     }
 }
 
@@ -310,7 +479,7 @@ void __MI_handler(void)
 void __TI_handler(void)
 {
 	/* timer int cleared in int handler */
-    __call_callback(TI_callback);
+    __dispatch(INTERRUPT_TI);
 }
 
 /**
@@ -321,7 +490,7 @@ void __TI_handler(void)
  */
 void register_AI_handler( void (*callback)() )
 {
-    __register_callback(&AI_callback,callback);
+    __register_legacy_callback(INTERRUPT_AI,callback);
 }
 
 /**
@@ -332,7 +501,7 @@ void register_AI_handler( void (*callback)() )
  */
 void unregister_AI_handler( void (*callback)() )
 {
-    __unregister_callback(&AI_callback,callback);
+    __unregister_callback(INTERRUPT_AI,(interrupt_handler_t)callback,0);
 }
 
 /**
@@ -343,7 +512,7 @@ void unregister_AI_handler( void (*callback)() )
  */
 void register_VI_handler( void (*callback)() )
 {
-    __register_callback(&VI_callback,callback);
+    __register_legacy_callback(INTERRUPT_VI,callback);
 }
 
 /**
@@ -354,7 +523,7 @@ void register_VI_handler( void (*callback)() )
  */
 void unregister_VI_handler( void (*callback)() )
 {
-    __unregister_callback(&VI_callback,callback);
+    __unregister_callback(INTERRUPT_VI,(interrupt_handler_t)callback,0);
 }
 
 /**
@@ -365,7 +534,7 @@ void unregister_VI_handler( void (*callback)() )
  */
 void register_PI_handler( void (*callback)() )
 {
-    __register_callback(&PI_callback,callback);
+    __register_legacy_callback(INTERRUPT_PI,callback);
 }
 
 /**
@@ -376,7 +545,7 @@ void register_PI_handler( void (*callback)() )
  */
 void unregister_PI_handler( void (*callback)() )
 {
-    __unregister_callback(&PI_callback,callback);
+    __unregister_callback(INTERRUPT_PI,(interrupt_handler_t)callback,0);
 }
 
 /**
@@ -387,7 +556,7 @@ void unregister_PI_handler( void (*callback)() )
  */
 void register_DP_handler( void (*callback)() )
 {
-    __register_callback(&DP_callback,callback);
+    __register_legacy_callback(INTERRUPT_DP,callback);
 }
 
 /**
@@ -398,7 +567,7 @@ void register_DP_handler( void (*callback)() )
  */
 void unregister_DP_handler( void (*callback)() )
 {
-    __unregister_callback(&DP_callback,callback);
+    __unregister_callback(INTERRUPT_DP,(interrupt_handler_t)callback,0);
 }
 
 /**
@@ -409,7 +578,7 @@ void unregister_DP_handler( void (*callback)() )
  */
 void register_TI_handler( void (*callback)() )
 {
-    __register_callback(&TI_callback,callback);
+    __register_legacy_callback(INTERRUPT_TI,callback);
 }
 
 /**
@@ -420,7 +589,7 @@ void register_TI_handler( void (*callback)() )
  */
 void unregister_TI_handler( void (*callback)() )
 {
-    __unregister_callback(&TI_callback,callback);
+    __unregister_callback(INTERRUPT_TI,(interrupt_handler_t)callback,0);
 }
 
 /**
@@ -431,7 +600,7 @@ void unregister_TI_handler( void (*callback)() )
  */
 void register_SI_handler( void (*callback)() )
 {
-    __register_callback(&SI_callback,callback);
+    __register_legacy_callback(INTERRUPT_SI,callback);
 }
 
 /**
@@ -442,7 +611,7 @@ void register_SI_handler( void (*callback)() )
  */
 void unregister_SI_handler( void (*callback)() )
 {
-    __unregister_callback(&SI_callback,callback);
+    __unregister_callback(INTERRUPT_SI,(interrupt_handler_t)callback,0);
 }
 
 /**
@@ -453,7 +622,7 @@ void unregister_SI_handler( void (*callback)() )
  */
 void register_SP_handler( void (*callback)() )
 {
-    __register_callback(&SP_callback,callback);
+    __register_legacy_callback(INTERRUPT_SP,callback);
 }
 
 /**
@@ -464,7 +633,75 @@ void register_SP_handler( void (*callback)() )
  */
 void unregister_SP_handler( void (*callback)() )
 {
-    __unregister_callback(&SP_callback,callback);
+    __unregister_callback(INTERRUPT_SP,(interrupt_handler_t)callback,0);
+}
+
+/**
+ * @brief Register a handler with a context
+ *
+ * Up to #INTERRUPT_MAX_HANDLERS handlers can be registered for each interrupt
+ * source, without allocating memory.  The handlers of a source are called from the
+ * last registered to the first one, each with the context it was registered with,
+ * so the same function can be registered several times with different contexts.
+ *
+ * @param[in] source
+ *            Interrupt source
+ * @param[in] handler
+ *            Function to call when the interrupt occurs
+ * @param[in] ctx
+ *            Context passed to the handler
+ *
+ * @retval 0 on success
+ * @retval -1 if too many handlers are registered for this source
+ */
+int register_interrupt_handler( interrupt_source_t source, interrupt_handler_t handler, void *ctx )
+{
+    assertf( source >= 0 && source < INTERRUPT_NUM_SOURCES, "invalid interrupt source: %d", source );
+    return __register_callback( source, handler, ctx, true );
+}
+
+/**
+ * @brief Register a handler that does not use the FPU
+ *
+ * This is like #register_interrupt_handler, but declares that the handler never
+ * touches the FPU registers, not even through the functions it calls.  When all the
+ * handlers of an interrupt are FPU-free, the interrupt handler does not save and
+ * restore the 32 FPU registers of the interrupted code, which is a large part of
+ * the cost of servicing an interrupt.
+ *
+ * @note Handlers that call user callbacks cannot know whether they use the FPU,
+ *       so they should be registered with #register_interrupt_handler instead.
+ *
+ * @param[in] source
+ *            Interrupt source
+ * @param[in] handler
+ *            Function to call when the interrupt occurs
+ * @param[in] ctx
+ *            Context passed to the handler
+ *
+ * @retval 0 on success
+ * @retval -1 if too many handlers are registered for this source
+ */
+int register_interrupt_handler_nofpu( interrupt_source_t source, interrupt_handler_t handler, void *ctx )
+{
+    assertf( source >= 0 && source < INTERRUPT_NUM_SOURCES, "invalid interrupt source: %d", source );
+    return __register_callback( source, handler, ctx, false );
+}
+
+/**
+ * @brief Unregister a handler registered with #register_interrupt_handler
+ *
+ * @param[in] source
+ *            Interrupt source
+ * @param[in] handler
+ *            Function that should no longer be called
+ * @param[in] ctx
+ *            Context the handler was registered with
+ */
+void unregister_interrupt_handler( interrupt_source_t source, interrupt_handler_t handler, void *ctx )
+{
+    assertf( source >= 0 && source < INTERRUPT_NUM_SOURCES, "invalid interrupt source: %d", source );
+    __unregister_callback( source, handler, ctx );
 }
 
 /**
@@ -496,15 +733,89 @@ void set_AI_interrupt(int active)
  */
 void set_VI_interrupt(int active, unsigned long line)
 {
-    if( active )
+    disable_interrupts();
+    vi_frame_line = active ? line : VI_LINE_NONE;
+    __vi_program();
+    enable_interrupts();
+}
+
+/**
+ * @brief Register a handler called when the VI reaches a line
+ *
+ * Scanline handlers allow raster effects, like changing VI registers for a split
+ * screen, or running code at the point of the frame where it is cheapest, without
+ * polling the current line.  The VI interrupt is reprogrammed after each line that
+ * fires, going through all the lines of the handlers in order, together with the
+ * line set by #set_VI_interrupt (whose handlers are called only at that line).
+ *
+ * If the handlers of a line take so long that the VI goes past the next line, the
+ * handlers of the next line are called late, right away.
+ *
+ * @param[in] line
+ *            The vertical line, in the same units of the VI current line register
+ *            (half-lines: the visible area of a non-interlaced screen spans even lines)
+ * @param[in] handler
+ *            Function to call when the line is reached
+ * @param[in] ctx
+ *            Context passed to the handler
+ *
+ * @retval 0 on success
+ * @retval -1 if #INTERRUPT_MAX_VI_LINES handlers are already registered
+ */
+int register_VI_line_handler( unsigned long line, interrupt_handler_t handler, void *ctx )
+{
+    int ret = -1;
+
+    disable_interrupts();
+    if( vi_lines_count < INTERRUPT_MAX_VI_LINES )
     {
-    	MI_regs->mask=MI_MASK_SET_VI;
-	    VI_regs->v_int=line;
+        /* Keep the handlers sorted by line */
+        int i = vi_lines_count++;
+        while( i > 0 && vi_lines[i - 1].line > line )
+        {
+            vi_lines[i] = vi_lines[i - 1];
+            i--;
+        }
+
+        vi_lines[i].line = line;
+        vi_lines[i].handler = handler;
+        vi_lines[i].ctx = ctx;
+        __vi_program();
+        ret = 0;
     }
-    else
+    enable_interrupts();
+
+    return ret;
+}
+
+/**
+ * @brief Unregister a handler registered with #register_VI_line_handler
+ *
+ * @param[in] line
+ *            Line the handler was registered for
+ * @param[in] handler
+ *            Function that should no longer be called
+ * @param[in] ctx
+ *            Context the handler was registered with
+ */
+void unregister_VI_line_handler( unsigned long line, interrupt_handler_t handler, void *ctx )
+{
+    disable_interrupts();
+    for( int i = 0; i < vi_lines_count; i++ )
     {
-        MI_regs->mask=MI_MASK_CLR_VI;
+        if( vi_lines[i].line == line && vi_lines[i].handler == handler && vi_lines[i].ctx == ctx )
+        {
+            for( int j = i + 1; j < vi_lines_count; j++ )
+            {
+                vi_lines[j - 1] = vi_lines[j];
+            }
+
+            vi_lines_count--;
+            __vi_program();
+            break;
+        }
     }
+    enable_interrupts();
 }
 
 /**
@@ -616,6 +927,8 @@ void disable_interrupts()
         /* Interrupts are enabled, so its safe to disable them */
         C0_WRITE_STATUS(C0_STATUS() & ~C0_STATUS_IE);
         interrupt_disabled_tick = TICKS_READ();
+
+        if( stats_enabled ) { disabled_caller = __builtin_return_address(0); }
     }
 
     /* Ensure that we remember nesting levels */
@@ -642,6 +955,17 @@ void enable_interrupts()
 
     if( __interrupt_depth == 0 )
     {
+        if( stats_enabled )
+        {
+            uint32_t ticks = TICKS_READ() - interrupt_disabled_tick;
+
+            if( ticks > stats.max_disabled_ticks )
+            {
+                stats.max_disabled_ticks = ticks;
+                stats.max_disabled_caller = disabled_caller;
+            }
+        }
+
         C0_WRITE_STATUS(C0_STATUS() | C0_STATUS_IE);
     }
 }
@@ -669,4 +993,74 @@ interrupt_state_t get_interrupts_state()
     }
 }
 
+/**
+ * @brief Enable or disable the collection of interrupt statistics
+ *
+ * When enabled, the number of interrupts and the time spent in their handlers are
+ * counted for each source, as well as the longest time spent with interrupts
+ * disabled by #disable_interrupts, with the address it was called from.  Those
+ * are typically what delays the handling of an interrupt, and makes audio pop for
+ * instance.  Collecting statistics slightly slows down the interrupt handlers and
+ * the critical sections.  This also resets the statistics.
+ *
+ * @param[in] enable
+ *            True to collect statistics
+ */
+void interrupt_enable_stats( bool enable )
+{
+    disable_interrupts();
+    interrupt_reset_stats();
+    stats_enabled = enable;
+    disabled_caller = __builtin_return_address(0);
+    enable_interrupts();
+}
+
+/**
+ * @brief Get the interrupt statistics collected since #interrupt_enable_stats
+ *        or #interrupt_reset_stats
+ *
+ * @param[out] out
+ *             Structure filled with the current statistics
+ */
+void interrupt_get_stats( interrupt_stats_t *out )
+{
+    disable_interrupts();
+    *out = stats;
+    enable_interrupts();
+}
+
+/**
+ * @brief Reset the interrupt statistics
+ */
+void interrupt_reset_stats( void )
+{
+    disable_interrupts();
+    memset( &stats, 0, sizeof(stats) );
+    enable_interrupts();
+}
+
+/**
+ * @brief Print the interrupt statistics on the debug output (see #debugf)
+ */
+void interrupt_dump_stats( void )
+{
+    static const char *names[INTERRUPT_NUM_SOURCES] = { "SP", "SI", "AI", "VI", "PI", "DP", "TI" };
+    interrupt_stats_t cur;
+
+    interrupt_get_stats( &cur );
+    debugf( "interrupts: count, average and max handler ticks\n" );
+
+    for( int i = 0; i < INTERRUPT_NUM_SOURCES; i++ )
+    {
+        interrupt_source_stats_t *src = &cur.sources[i];
+        if( !src->count ) { continue; }
+
+        debugf( "  %s: %lu, %lu, %lu\n", names[i], (unsigned long)src->count,
+                (unsigned long)(src->total_ticks / src->count), (unsigned long)src->max_ticks );
+    }
+
+    debugf( "longest critical section: %lu ticks, disabled at %p\n",
+            (unsigned long)cur.max_disabled_ticks, cur.max_disabled_caller );
+}
+
 /** @} */
@@ -56,6 +56,41 @@ static volatile struct SI_regs_s * const SI_regs = (struct SI_regs_s *)0xa480000
  */
 static void * const PIF_RAM = (void *)0x1fc007c0;
 
+/** @brief State of the asynchronous transactions */
+typedef enum
+{
+    /** @brief No transaction in progress */
+    JOYBUS_IDLE,
+    /** @brief Writing the input block of a transaction to PIF RAM */
+    JOYBUS_WRITING,
+    /** @brief Reading the output block of a transaction from PIF RAM */
+    JOYBUS_READING
+} joybus_state_t;
+
+/** @brief A transaction queued by #joybus_exec_async */
+typedef struct
+{
+    /** @brief Copy of the input block */
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+    /** @brief Destination buffer of the output block */
+    void *output;
+    /** @brief Callback called once the output block is read */
+    joybus_callback_t callback;
+} joybus_request_t;
+
+/** @brief Input block of the asynchronous transaction in progress */
+static uint64_t async_input[JOYBUS_BLOCK_DWORDS] __attribute__((aligned(16)));
+/** @brief Output block of the asynchronous transaction in progress */
+static uint64_t async_output[JOYBUS_BLOCK_DWORDS] __attribute__((aligned(16)));
+/** @brief State of the asynchronous transaction in progress */
+static volatile joybus_state_t async_state = JOYBUS_IDLE;
+/** @brief Queue of the asynchronous transactions, the first one being in progress */
+static joybus_request_t async_queue[JOYBUS_ASYNC_QUEUE_SIZE];
+/** @brief Index of the first transaction in the queue, and number of queued transactions */
+static int async_head = 0, async_count = 0;
+/** @brief True once the SI interrupt handler is registered */
+static bool async_initialized = false;
+
 /**
  * @brief Wait until the SI is finished with a DMA request
  */
@@ -64,6 +99,68 @@ static void __SI_DMA_wait( void )
     while (SI_regs->status & (SI_STATUS_DMA_BUSY | SI_STATUS_IO_BUSY)) ;
 }
 
+/**
+ * @brief Start the SI DMA that writes the first queued transaction to PIF RAM
+ *
+ * @note This function must be called with interrupts disabled.
+ */
+static void __joybus_async_start( void )
+{
+    joybus_request_t *req = &async_queue[async_head];
+
+    data_cache_hit_writeback_invalidate(async_input, JOYBUS_BLOCK_SIZE);
+    memcpy(UncachedAddr(async_input), req->input, JOYBUS_BLOCK_SIZE);
+
+    async_state = JOYBUS_WRITING;
+    SI_regs->DRAM_addr = async_input; // only cares about 23:0
+    MEMORY_BARRIER();
+    SI_regs->PIF_addr_write = PIF_RAM;
+    MEMORY_BARRIER();
+}
+
+/**
+ * @brief SI interrupt handler, chaining the DMAs of the asynchronous transactions
+ */
+static void __joybus_si_handler( void *ctx )
+{
+    switch( async_state )
+    {
+        case JOYBUS_WRITING:
+            /* The PIF processed the input block, read back the result */
+            data_cache_hit_writeback_invalidate(async_output, JOYBUS_BLOCK_SIZE);
+
+            async_state = JOYBUS_READING;
+            SI_regs->DRAM_addr = async_output;
+            MEMORY_BARRIER();
+            SI_regs->PIF_addr_read = PIF_RAM;
+            MEMORY_BARRIER();
+            break;
+
+        case JOYBUS_READING:
+        {
+            joybus_request_t *req = &async_queue[async_head];
+            void *output = req->output;
+            joybus_callback_t callback = req->callback;
+
+            memcpy(output, UncachedAddr(async_output), JOYBUS_BLOCK_SIZE);
+
+            async_head = (async_head + 1) % JOYBUS_ASYNC_QUEUE_SIZE;
+            async_count--;
+            async_state = JOYBUS_IDLE;
+
+            /* The callback can queue another transaction */
+            if( callback ) { callback( output ); }
+
+            if( async_count && async_state == JOYBUS_IDLE ) { __joybus_async_start(); }
+            break;
+        }
+
+        default:
+            /* End of a synchronous transaction */
+            break;
+    }
+}
+
 /**
  * @brief Write a 64-byte block of data to the PIF and read the 64-byte result.
  * 
@@ -73,6 +170,10 @@ static void __SI_DMA_wait( void )
  * The usage of this function will likely change as a result of the ongoing
  * effort to integrate the multitasking kernel with asynchronous operations.
  *
+ * If asynchronous transactions are in progress (see #joybus_exec_async), they
+ * are completed first, calling their callbacks: this does not rely on the SI
+ * interrupt, so it can be called from interrupt handlers too.
+ *
  * @param[in]  input
  *             Source buffer for the input block to send to the PIF
  *
@@ -90,6 +191,16 @@ void joybus_exec( const void * input, void * output )
     /* Be sure another thread doesn't get into a resource fight */
     disable_interrupts();
 
+    /* Complete the asynchronous transactions here, polling the SI rather than
+       waiting for its interrupt: this might be called from an interrupt handler
+       or with interrupts disabled, where the SI interrupt would never come */
+    while( async_state != JOYBUS_IDLE )
+    {
+        __SI_DMA_wait();
+        SI_regs->status = 0;
+        __joybus_si_handler( 0 );
+    }
+
     __SI_DMA_wait();
 
     SI_regs->DRAM_addr = input_aligned; // only cares about 23:0
@@ -108,12 +219,215 @@ void joybus_exec( const void * input, void * output )
 
     __SI_DMA_wait();
 
+    /* Acknowledge the SI interrupt of this transaction, so that it doesn't reach
+       the asynchronous handler */
+    if( async_initialized ) { SI_regs->status = 0; }
+
     /* Now that we've copied, its safe to let other threads go */
     enable_interrupts();
 
     memcpy(output, UncachedAddr(output_aligned), JOYBUS_BLOCK_SIZE);
 }
 
+/**
+ * @brief Write a 64-byte block of data to the PIF and read the 64-byte result,
+ *        in the background.
+ *
+ * Instead of waiting for the SI like #joybus_exec, this starts the DMA writing the
+ * input block to PIF RAM, and returns right away.  The SI interrupt then starts the
+ * DMA reading back the output block and, once it is complete, calls the callback
+ * (from the interrupt handler).  Transactions started while another one is in
+ * progress are queued, up to #JOYBUS_ASYNC_QUEUE_SIZE.
+ *
+ * The input block is copied, so it does not need to be kept around.
+ *
+ * @param[in]  input
+ *             Source buffer for the input block to send to the PIF
+ * @param[out] output
+ *             Destination buffer of the output block, which must stay valid until
+ *             the callback is called
+ * @param[in]  callback
+ *             Function called with output once it is filled (can be NULL)
+ *
+ * @retval 0 if the transaction was started or queued
+ * @retval -1 if the queue is full
+ */
+int joybus_exec_async( const void * input, void * output, joybus_callback_t callback )
+{
+    disable_interrupts();
+
+    if( !async_initialized )
+    {
+        register_interrupt_handler( INTERRUPT_SI, __joybus_si_handler, 0 );
+        set_SI_interrupt( 1 );
+        async_initialized = true;
+    }
+
+    if( async_count == JOYBUS_ASYNC_QUEUE_SIZE )
+    {
+        enable_interrupts();
+        return -1;
+    }
+
+    joybus_request_t *req = &async_queue[(async_head + async_count) % JOYBUS_ASYNC_QUEUE_SIZE];
+    memcpy(req->input, input, JOYBUS_BLOCK_SIZE);
+    req->output = output;
+    req->callback = callback;
+    async_count++;
+
+    if( async_state == JOYBUS_IDLE )
+    {
+        /* A synchronous transaction may have just completed */
+        __SI_DMA_wait();
+        __joybus_async_start();
+    }
+
+    enable_interrupts();
+    return 0;
+}
+
+/**
+ * @brief Return true if asynchronous transactions are in progress
+ *
+ * @see #joybus_exec_async
+ */
+bool joybus_async_busy( void )
+{
+    return async_state != JOYBUS_IDLE;
+}
+
+/**
+ * @brief Initialize a list of Joybus commands
+ *
+ * Instead of building a full input block for each command, and executing each of
+ * them with its own SI round-trip, a command for each of the channels can be
+ * packed in a single block with #joybus_cmdlist_add.  The block returned by
+ * #joybus_cmdlist_block is then executed with #joybus_exec or #joybus_exec_async,
+ * and the result of each command is found in the output block with
+ * #joybus_cmdlist_result.
+ *
+ * @param[out] list
+ *             The list to initialize, without commands
+ */
+void joybus_cmdlist_init( joybus_cmdlist_t * list )
+{
+    memset( list->block, 0, JOYBUS_BLOCK_SIZE );
+    list->length = 0;
+    list->channel = -1;
+
+    for( int i = 0; i < JOYBUS_NUM_CHANNELS; i++ )
+    {
+        list->result[i] = -1;
+    }
+}
+
+/**
+ * @brief Add a command to a list of Joybus commands
+ *
+ * The PIF runs a single command per channel, in order of channel, so commands must
+ * be added by increasing channel.
+ *
+ * @param[in,out] list
+ *                The list of commands
+ * @param[in]     channel
+ *                Channel of the command (0-3 for the controller ports, 4 for the
+ *                cartridge)
+ * @param[in]     command
+ *                Command byte
+ * @param[in]     send
+ *                Parameter bytes of the command (can be NULL if send_len is 0)
+ * @param[in]     send_len
+ *                Number of parameter bytes
+ * @param[in]     recv_len
+ *                Number of bytes the command returns
+ *
+ * @retval 0 if the command was added
+ * @retval -1 if the channel is invalid, or not after the channel of the previous command
+ * @retval -2 if the command does not fit in the block
+ */
+int joybus_cmdlist_add( joybus_cmdlist_t * list, int channel, uint8_t command, const void * send, int send_len, int recv_len )
+{
+    if( channel <= list->channel || channel >= JOYBUS_NUM_CHANNELS ) { return -1; }
+
+    /* Skip the channels without commands, then the lengths, the command, the
+       parameters and the result, and keep room for the end marker and the
+       control byte */
+    int skip = channel - list->channel - 1;
+    int size = skip + 3 + send_len + recv_len;
+    if( list->length + size + 2 > JOYBUS_BLOCK_SIZE ) { return -2; }
+
+    uint8_t *data = &list->block[list->length];
+    memset( data, 0x00, skip );
+    data += skip;
+
+    data[0] = send_len + 1;
+    data[1] = recv_len;
+    data[2] = command;
+    if( send_len ) { memcpy( &data[3], send, send_len ); }
+    memset( &data[3 + send_len], 0xFF, recv_len );
+
+    list->result[channel] = list->length + skip + 1;
+    list->length += size;
+    list->channel = channel;
+    return 0;
+}
+
+/**
+ * @brief Return the input block of a list of Joybus commands
+ *
+ * @param[in,out] list
+ *                The list of commands
+ *
+ * @return The input block, to be passed to #joybus_exec or #joybus_exec_async
+ */
+const void * joybus_cmdlist_block( joybus_cmdlist_t * list )
+{
+    /* End of the commands, and let the PIF process them */
+    list->block[list->length] = 0xFE;
+    list->block[JOYBUS_BLOCK_SIZE - 1] = 0x01;
+    return list->block;
+}
+
+/**
+ * @brief Find the result of a command in the output block of a list of commands
+ *
+ * @param[in]  list
+ *             The list of commands
+ * @param[in]  outblock
+ *             Output block of the execution of the list
+ * @param[in]  channel
+ *             Channel of the command
+ * @param[out] err
+ *             If not NULL, set to the error flags of the command (0 if the command
+ *             was successful, see #ERROR_NOT_PRESENT in controller.h)
+ *
+ * @return The bytes returned by the command, or NULL if there is no command for the channel
+ */
+const uint8_t * joybus_cmdlist_result( const joybus_cmdlist_t * list, const void * outblock, int channel, int * err )
+{
+    if( channel < 0 || channel >= JOYBUS_NUM_CHANNELS || list->result[channel] < 0 ) { return 0; }
+
+    const uint8_t *data = (const uint8_t *)outblock + list->result[channel];
+
+    /* The PIF reports errors in the top bits of the receive length */
+    if( err ) { *err = data[0] >> 6; }
+
+    /* Skip the receive length, the command and its parameters */
+    return data + 1 + list->block[list->result[channel] - 1];
+}
+
+/** @brief EEPROM type detected by #eeprom_present (EEPROM_NONE until detected) */
+static eeprom_type_t eeprom_type = EEPROM_NONE;
+
+/** @brief An output block of the EEPROM reads queued by #eeprom_read_bytes */
+typedef struct
+{
+    /** @brief Output block (first, so that the callback can find the slot from it) */
+    uint64_t output[JOYBUS_BLOCK_DWORDS];
+    /** @brief Set by the SI interrupt once the output block is filled */
+    volatile bool done;
+} eeprom_read_slot_t;
+
 /**
  * @brief Read the status of the EEPROM.
  *
@@ -159,12 +473,19 @@ static uint32_t eeprom_status( void )
  */
 eeprom_type_t eeprom_present( void )
 {
-    switch( eeprom_status() >> 8 )
+    /* The save memory of the cartridge does not change: once an EEPROM has been
+       found, skip the SI round-trip of the status command */
+    if( eeprom_type == EEPROM_NONE )
     {
-        case 0xC000: return EEPROM_16K;
-        case 0x8000: return EEPROM_4K;
-        default: return EEPROM_NONE;
+        switch( eeprom_status() >> 8 )
+        {
+            case 0xC000: eeprom_type = EEPROM_16K; break;
+            case 0x8000: eeprom_type = EEPROM_4K; break;
+            default: break;
+        }
     }
+
+    return eeprom_type;
 }
 
 /**
@@ -184,17 +505,16 @@ size_t eeprom_total_blocks( void )
 }
 
 /**
- * @brief Read a block from EEPROM.
+ * @brief Build the input block of an EEPROM block read
  *
+ * @param[out] input
+ *             Input block
  * @param[in]  block
- *             Block to read data from. Joybus accesses EEPROM in 8-byte blocks.
- *
- * @param[out] dest
- *             Destination buffer for the eight bytes read from EEPROM.
+ *             Block to read
  */
-void eeprom_read( uint8_t block, uint8_t * dest )
+static void __eeprom_read_input( uint64_t * input, uint8_t block )
 {
-    const uint64_t input[JOYBUS_BLOCK_DWORDS] =
+    const uint64_t read[JOYBUS_BLOCK_DWORDS] =
     {
         0x0000000002080400 | block,
         0xffffffffffffffff,
@@ -205,8 +525,59 @@ void eeprom_read( uint8_t block, uint8_t * dest )
         0,
         1
     };
+
+    memcpy( input, read, JOYBUS_BLOCK_SIZE );
+}
+
+/**
+ * @brief SI interrupt callback of the EEPROM reads queued by #eeprom_read_bytes
+ *
+ * @param[in] output
+ *            Output block, the first member of its #eeprom_read_slot_t
+ */
+static void __eeprom_read_done( void * output )
+{
+    ((eeprom_read_slot_t *)output)->done = true;
+}
+
+/**
+ * @brief Copy the requested bytes of an EEPROM block read by #eeprom_read_bytes
+ *
+ * @param[out] dest
+ *             Destination buffer of the whole read
+ * @param[in]  start
+ *             Byte offset in EEPROM of the whole read
+ * @param[in]  len
+ *             Byte length of the whole read
+ * @param[in]  block
+ *             Block that was read
+ * @param[in]  data
+ *             The eight bytes of the block
+ */
+static void __eeprom_copy_block( uint8_t * dest, size_t start, size_t len, size_t block, const uint8_t * data )
+{
+    const size_t block_start = block * EEPROM_BLOCK_SIZE;
+    const size_t from = start > block_start ? start : block_start;
+    const size_t to = start + len < block_start + EEPROM_BLOCK_SIZE ? start + len : block_start + EEPROM_BLOCK_SIZE;
+
+    memcpy( dest + (from - start), data + (from - block_start), to - from );
+}
+
+/**
+ * @brief Read a block from EEPROM.
+ *
+ * @param[in]  block
+ *             Block to read data from. Joybus accesses EEPROM in 8-byte blocks.
+ *
+ * @param[out] dest
+ *             Destination buffer for the eight bytes read from EEPROM.
+ */
+void eeprom_read( uint8_t block, uint8_t * dest )
+{
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
     uint64_t output[JOYBUS_BLOCK_DWORDS];
 
+    __eeprom_read_input( input, block );
     joybus_exec( input, output );
 
     memcpy( dest, &output[1], EEPROM_BLOCK_SIZE );
@@ -251,7 +622,12 @@ uint8_t eeprom_write( uint8_t block, const uint8_t * src )
  * This is a high-level convenience helper that abstracts away the
  * one-at-a-time EEPROM block access pattern.
  *
- * @param[out] buf
+ * The PIF runs a single command per channel, so each block still needs its own
+ * transaction: the block reads are queued with #joybus_exec_async, which lets
+ * the SI interrupt start each transaction as soon as the previous one is
+ * complete. If interrupts are disabled, the blocks are read one at a time.
+ *
+ * @param[out] dest
  *             Destination buffer to read data into
  *
  * @param[in]  start
@@ -262,33 +638,50 @@ uint8_t eeprom_write( uint8_t block, const uint8_t * src )
  */
 void eeprom_read_bytes( uint8_t * dest, size_t start, size_t len )
 {
-    size_t bytes_left = len;
-	uint8_t buf[EEPROM_BLOCK_SIZE];
-	uint8_t current_block = start / EEPROM_BLOCK_SIZE;
-	// If we need to read a partial block to start off...
-	size_t block_offset = start % EEPROM_BLOCK_SIZE;
-	if (block_offset)
-	{
-		eeprom_read( current_block++, buf );
-		bytes_left -= (EEPROM_BLOCK_SIZE - block_offset);
-		while (block_offset < EEPROM_BLOCK_SIZE)
-		{
-			*dest++ = buf[block_offset++];
-		}
-	}
-	// Read whole blocks at a time
-	while ( bytes_left >= EEPROM_BLOCK_SIZE )
-	{
-		eeprom_read( current_block++, dest );
-		dest += EEPROM_BLOCK_SIZE;
-		bytes_left -= EEPROM_BLOCK_SIZE;
-	}
-	// If we need to read a partial block at the end...
-	if (bytes_left)
-	{
-		eeprom_read( current_block, buf );
-		memcpy( dest, buf, bytes_left );
-	}
+    if( len == 0 ) { return; }
+
+    const size_t first = start / EEPROM_BLOCK_SIZE;
+    const size_t count = (start + len - 1) / EEPROM_BLOCK_SIZE - first + 1;
+
+    /* The queued reads are chained by the SI interrupt */
+    if( get_interrupts_state() != INTERRUPTS_ENABLED )
+    {
+        uint8_t buf[EEPROM_BLOCK_SIZE];
+
+        for( size_t i = 0; i < count; i++ )
+        {
+            eeprom_read( first + i, buf );
+            __eeprom_copy_block( dest, start, len, first + i, buf );
+        }
+        return;
+    }
+
+    eeprom_read_slot_t slots[JOYBUS_ASYNC_QUEUE_SIZE] __attribute__((aligned(8)));
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+    size_t issued = 0, copied = 0;
+
+    while( copied < count )
+    {
+        /* Keep the queue full, so that there is no gap between the transactions */
+        while( issued < count && issued - copied < JOYBUS_ASYNC_QUEUE_SIZE )
+        {
+            eeprom_read_slot_t *slot = &slots[issued % JOYBUS_ASYNC_QUEUE_SIZE];
+
+            slot->done = false;
+            __eeprom_read_input( input, first + issued );
+            /* The queue may be shared with other asynchronous transactions */
+            if( joybus_exec_async( input, slot->output, __eeprom_read_done ) < 0 ) { break; }
+            issued++;
+        }
+
+        /* Transactions complete in order */
+        eeprom_read_slot_t *slot = &slots[copied % JOYBUS_ASYNC_QUEUE_SIZE];
+        if( copied < issued && slot->done )
+        {
+            __eeprom_copy_block( dest, start, len, first + copied, (const uint8_t *)&slot->output[1] );
+            copied++;
+        }
+    }
 }
 
 /**
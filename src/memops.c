@@ -0,0 +1,620 @@
+/**
+ * @file memops.c
+ * @brief Optimized memory copy and fill
+ * @ingroup memops
+ */
+#include <stdint.h>
+#include <assert.h>
+#include "memops.h"
+#include "n64sys.h"
+#include "rsp.h"
+
+/**
+ * @defgroup memops Optimized memory copy and fill
+ * @ingroup lowlevel
+ * @brief Replacements of memcpy and memset tuned for the VR4300.
+ *
+ * The VR4300 has 64-bit registers and a data cache with 16-byte lines,
+ * while RDRAM has a high latency and a good bandwidth for sequential
+ * accesses.  #fast_memcpy and #fast_memset move 8 bytes per load/store and
+ * are unrolled over two cache lines; a source that is not aligned like the
+ * destination is read with unaligned loads (ldl/ldr) rather than byte by byte.
+ * They work on both cached and uncached memory, and on uncached memory they
+ * are much faster than a byte loop, as each access goes to RDRAM.
+ *
+ * On cached memory, the first store to a line which is not in the cache
+ * reads the whole line from RDRAM (write allocate), even if it is going to be
+ * overwritten. #fast_memcpy_overwrite and #fast_memset_overwrite avoid
+ * this by allocating the lines that are fully overwritten with the
+ * "create dirty exclusive" cache op; the partial lines at both ends are
+ * written normally.  They must be used only when the destination is not
+ * going to be read by the RCP before being written back: as for any cached
+ * write, call #data_cache_hit_writeback before handing the buffer to a DMA.
+ *
+ * Large copies, fills and color conversions can also be run by the RSP, with
+ * #rsp_memcpy, #rsp_memset32, #rsp_convert_16to32 and #rsp_convert_32to16.
+ * These functions queue an RSP task (see #rsp_task_submit) and return a fence
+ * right away, so that the CPU can do other work while the RSP moves the data
+ * via DMA; use #rsp_memops_done or #rsp_memops_wait on the fence to know when
+ * the destination is ready.
+ * @{
+ */
+
+/** @brief Size of a data cache line */
+#define DCACHE_LINESIZE  16
+
+/** @brief 64-bit type for unaligned loads */
+typedef uint64_t u_uint64_t __attribute__((aligned(1)));
+
+/** @brief Return true if an address is in KSEG0 (cached, non-mapped) */
+#define IS_KSEG0(p)   (((uint32_t)(p) & 0xE0000000) == 0x80000000)
+
+/** @brief Allocate a cache line for an address without reading it from RDRAM */
+#define create_dirty_exclusive(p)   asm volatile ("\tcache 0x0D,(%0)\n"::"r" (p))
+
+/** @brief Copy bytes one at a time (for the unaligned head and tail) */
+static inline uint8_t *copy_bytes(uint8_t *d, const uint8_t *s, size_t n)
+{
+    while( n-- )
+    {
+        *d++ = *s++;
+    }
+
+    return d;
+}
+
+/** @brief Fill bytes one at a time (for the unaligned head and tail) */
+static inline uint8_t *fill_bytes(uint8_t *d, uint8_t c, size_t n)
+{
+    while( n-- )
+    {
+        *d++ = c;
+    }
+
+    return d;
+}
+
+/**
+ * @brief Copy 64-bit words to an aligned destination
+ *
+ * @param[in] d
+ *            Destination (8-byte aligned)
+ * @param[in] s
+ *            Source (any alignment)
+ * @param[in] n
+ *            Number of bytes (multiple of 8)
+ * @param[in] cde
+ *            Use create dirty exclusive on each 16-byte line (d must be 16-byte aligned)
+ */
+static inline void copy_words(uint64_t *d, const uint8_t *s, size_t n, const int cde)
+{
+    if( ((uint32_t)s & 7) == 0 )
+    {
+        const uint64_t *s64 = (const uint64_t *)s;
+
+        for( ; n >= 32; n -= 32, d += 4, s64 += 4 )
+        {
+            /* Load everything first so that the loads are not stalled by the stores */
+            uint64_t a = s64[0], b = s64[1], c = s64[2], e = s64[3];
+            if( cde ) { create_dirty_exclusive(d); create_dirty_exclusive(d + 2); }
+            d[0] = a; d[1] = b; d[2] = c; d[3] = e;
+        }
+
+        for( ; n >= 8; n -= 8 )
+        {
+            *d++ = *s64++;
+        }
+    }
+    else
+    {
+        const u_uint64_t *s64 = (const u_uint64_t *)s;
+
+        for( ; n >= 32; n -= 32, d += 4, s64 += 4 )
+        {
+            uint64_t a = s64[0], b = s64[1], c = s64[2], e = s64[3];
+            if( cde ) { create_dirty_exclusive(d); create_dirty_exclusive(d + 2); }
+            d[0] = a; d[1] = b; d[2] = c; d[3] = e;
+        }
+
+        for( ; n >= 8; n -= 8 )
+        {
+            *d++ = *s64++;
+        }
+    }
+}
+
+/**
+ * @brief Fill 64-bit words of an aligned destination
+ *
+ * @param[in] d
+ *            Destination (8-byte aligned)
+ * @param[in] v
+ *            64-bit pattern
+ * @param[in] n
+ *            Number of bytes (multiple of 8)
+ * @param[in] cde
+ *            Use create dirty exclusive on each 16-byte line (d must be 16-byte aligned)
+ */
+static inline void fill_words(uint64_t *d, uint64_t v, size_t n, const int cde)
+{
+    for( ; n >= 32; n -= 32, d += 4 )
+    {
+        if( cde ) { create_dirty_exclusive(d); create_dirty_exclusive(d + 2); }
+        d[0] = v; d[1] = v; d[2] = v; d[3] = v;
+    }
+
+    for( ; n >= 8; n -= 8 )
+    {
+        *d++ = v;
+    }
+}
+
+/**
+ * @brief Copy a memory region
+ *
+ * Same as memcpy, using 64-bit loads and stores.  The copy is done
+ * forward, so it can also be used to move data to a lower address within
+ * the same buffer.
+ *
+ * @param[out] dst
+ *             Destination buffer
+ * @param[in]  src
+ *             Source buffer
+ * @param[in]  n
+ *             Number of bytes to copy
+ *
+ * @return dst
+ */
+void *fast_memcpy(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    if( n >= 16 )
+    {
+        size_t head = -(uint32_t)d & 7;
+        d = copy_bytes(d, s, head);
+        s += head;
+        n -= head;
+
+        size_t words = n & ~7;
+        copy_words((uint64_t *)d, s, words, 0);
+        d += words;
+        s += words;
+        n -= words;
+    }
+
+    copy_bytes(d, s, n);
+    return dst;
+}
+
+/**
+ * @brief Fill a memory region with a byte
+ *
+ * Same as memset, using 64-bit stores.
+ *
+ * @param[out] dst
+ *             Destination buffer
+ * @param[in]  c
+ *             Byte value to fill with
+ * @param[in]  n
+ *             Number of bytes to fill
+ *
+ * @return dst
+ */
+void *fast_memset(void *dst, int c, size_t n)
+{
+    uint8_t *d = dst;
+
+    if( n >= 16 )
+    {
+        size_t head = -(uint32_t)d & 7;
+        d = fill_bytes(d, c, head);
+        n -= head;
+
+        size_t words = n & ~7;
+        fill_words((uint64_t *)d, (uint8_t)c * 0x0101010101010101ull, words, 0);
+        d += words;
+        n -= words;
+    }
+
+    fill_bytes(d, c, n);
+    return dst;
+}
+
+/**
+ * @brief Copy a memory region, without reading the overwritten cache lines
+ *
+ * Same as #fast_memcpy, but the cache lines fully covered by the destination
+ * are allocated with "create dirty exclusive" instead of being read from RDRAM.
+ * It falls back to #fast_memcpy if the destination is not cached (KSEG0).
+ * The destination must not overlap the source.
+ *
+ * @param[out] dst
+ *             Destination buffer
+ * @param[in]  src
+ *             Source buffer
+ * @param[in]  n
+ *             Number of bytes to copy
+ *
+ * @return dst
+ */
+void *fast_memcpy_overwrite(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    if( !IS_KSEG0(d) || n < 2 * DCACHE_LINESIZE )
+    {
+        return fast_memcpy(dst, src, n);
+    }
+
+    /* Partial first line */
+    size_t head = -(uint32_t)d & (DCACHE_LINESIZE - 1);
+    fast_memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    /* Full lines: in pairs, then the last one (if odd) */
+    size_t lines = n & ~(2 * DCACHE_LINESIZE - 1);
+    copy_words((uint64_t *)d, s, lines, 1);
+    d += lines;
+    s += lines;
+    n -= lines;
+
+    if( n >= DCACHE_LINESIZE )
+    {
+        create_dirty_exclusive(d);
+        copy_words((uint64_t *)d, s, DCACHE_LINESIZE, 0);
+        d += DCACHE_LINESIZE;
+        s += DCACHE_LINESIZE;
+        n -= DCACHE_LINESIZE;
+    }
+
+    /* Partial last line */
+    fast_memcpy(d, s, n);
+    return dst;
+}
+
+/**
+ * @brief Fill a memory region with a byte, without reading the overwritten cache lines
+ *
+ * Same as #fast_memset, but the cache lines fully covered by the destination
+ * are allocated with "create dirty exclusive" instead of being read from RDRAM.
+ * It falls back to #fast_memset if the destination is not cached (KSEG0).
+ *
+ * @param[out] dst
+ *             Destination buffer
+ * @param[in]  c
+ *             Byte value to fill with
+ * @param[in]  n
+ *             Number of bytes to fill
+ *
+ * @return dst
+ */
+void *fast_memset_overwrite(void *dst, int c, size_t n)
+{
+    uint8_t *d = dst;
+
+    if( !IS_KSEG0(d) || n < 2 * DCACHE_LINESIZE )
+    {
+        return fast_memset(dst, c, n);
+    }
+
+    uint64_t v = (uint8_t)c * 0x0101010101010101ull;
+
+    size_t head = -(uint32_t)d & (DCACHE_LINESIZE - 1);
+    fast_memset(d, c, head);
+    d += head;
+    n -= head;
+
+    size_t lines = n & ~(2 * DCACHE_LINESIZE - 1);
+    fill_words((uint64_t *)d, v, lines, 1);
+    d += lines;
+    n -= lines;
+
+    if( n >= DCACHE_LINESIZE )
+    {
+        create_dirty_exclusive(d);
+        fill_words((uint64_t *)d, v, DCACHE_LINESIZE, 0);
+        d += DCACHE_LINESIZE;
+        n -= DCACHE_LINESIZE;
+    }
+
+    fast_memset(d, c, n);
+    return dst;
+}
+
+/**
+ * @brief RSP memory operations ucode (rsp_memops.S)
+ */
+DEFINE_RSP_UCODE(rsp_memops);
+
+/** @brief Number of RSP memory operations that can be queued at the same time */
+#define RSP_MEMOPS_QUEUE_SIZE   8
+
+/**
+ * @brief Operations of the RSP memory operations ucode
+ *
+ * NOTE: keep this in sync with rsp_memops.S
+ */
+typedef enum
+{
+    RSP_MEMOPS_COPY = 0,
+    RSP_MEMOPS_FILL = 1,
+    RSP_MEMOPS_16TO32 = 2,
+    RSP_MEMOPS_32TO16 = 3,
+} rsp_memops_op_t;
+
+/**
+ * @brief Input of the RSP memory operations ucode, copied into DMEM when the task starts
+ *
+ * NOTE: keep this in sync with rsp_memops.S
+ */
+typedef struct
+{
+    /** @brief Operation (see #rsp_memops_op_t) */
+    uint32_t op;
+    /** @brief Physical address of the destination */
+    uint32_t dst;
+    /** @brief Physical address of the source, or value to fill with */
+    uint32_t src;
+    /** @brief Number of bytes (copy and fill) or of pixels (conversions) */
+    uint32_t size;
+} rsp_memops_input_t;
+
+/** @brief A queued RSP memory operation */
+typedef struct
+{
+    /** @brief Task running the operation */
+    rsp_task_t task;
+    /** @brief Input of the task */
+    rsp_memops_input_t input;
+    /** @brief Fence of the operation */
+    rsp_memops_fence_t fence;
+} rsp_memops_slot_t;
+
+/** @brief Queued RSP memory operations, reused in a round robin */
+static rsp_memops_slot_t memops_slots[RSP_MEMOPS_QUEUE_SIZE];
+
+/** @brief Fence of the last operation submitted */
+static rsp_memops_fence_t memops_submitted = 0;
+
+/** @brief Fence of the last operation completed */
+static volatile rsp_memops_fence_t memops_completed = 0;
+
+/**
+ * @brief Copy the input of a memory operation into DMEM
+ *
+ * @param[in] task
+ *            The memory operation task
+ */
+static void __rsp_memops_setup(rsp_task_t *task)
+{
+    rsp_memops_slot_t *slot = task->ctx;
+    uint32_t *input = (uint32_t *)&slot->input;
+
+    for (int i = 0; i < sizeof(slot->input) / 4; i++)
+    {
+        SP_DMEM[i] = input[i];
+    }
+}
+
+/**
+ * @brief Record the completion of a memory operation
+ *
+ * @param[in] task
+ *            The memory operation task
+ */
+static void __rsp_memops_done(rsp_task_t *task)
+{
+    rsp_memops_slot_t *slot = task->ctx;
+
+    /* Tasks complete in submission order */
+    memops_completed = slot->fence;
+}
+
+/**
+ * @brief Queue a memory operation on the RSP
+ *
+ * @param[in] op
+ *            Operation
+ * @param[in] dst
+ *            Destination buffer
+ * @param[in] src
+ *            Physical address of the source, or value to fill with
+ * @param[in] size
+ *            Number of bytes or pixels
+ *
+ * @return The fence of the operation.
+ */
+static rsp_memops_fence_t __rsp_memops_submit(rsp_memops_op_t op, void *dst, uint32_t src, uint32_t size)
+{
+    /* Fence 0 is never returned, so that it can be used as "nothing pending" */
+    rsp_memops_fence_t fence = ++memops_submitted;
+    if (fence == 0)
+    {
+        fence = ++memops_submitted;
+    }
+
+    /* Reuse the slot of an operation RSP_MEMOPS_QUEUE_SIZE fences ago */
+    rsp_memops_slot_t *slot = &memops_slots[fence % RSP_MEMOPS_QUEUE_SIZE];
+    rsp_memops_wait(slot->fence);
+
+    slot->input.op = op;
+    slot->input.dst = (uint32_t)dst & 0x1FFFFFFF;
+    slot->input.src = src;
+    slot->input.size = size;
+    slot->fence = fence;
+
+    slot->task.ucode = &rsp_memops;
+    slot->task.setup = __rsp_memops_setup;
+    slot->task.done = __rsp_memops_done;
+    slot->task.ctx = slot;
+    rsp_task_submit(&slot->task);
+
+    return fence;
+}
+
+/**
+ * @brief Make sure the RSP reads the source and writes the destination in RDRAM
+ *
+ * @param[in] dst
+ *            Destination buffer
+ * @param[in] dst_size
+ *            Size of the destination in bytes
+ * @param[in] src
+ *            Source buffer (or NULL)
+ * @param[in] src_size
+ *            Size of the source in bytes
+ */
+static void __rsp_memops_flush(void *dst, int dst_size, const void *src, int src_size)
+{
+    if (src && IS_KSEG0(src))
+    {
+        data_cache_hit_writeback(src, src_size);
+    }
+
+    if (IS_KSEG0(dst))
+    {
+        data_cache_hit_writeback_invalidate(dst, dst_size);
+    }
+}
+
+/**
+ * @brief Copy a memory region with the RSP
+ *
+ * The copy is queued on the RSP, and the function returns right away. The
+ * source must not be changed, and the destination must not be accessed, until
+ * the operation is complete (see #rsp_memops_wait).  For cached buffers, the
+ * cache is written back (source) or written back and invalidated (destination)
+ * before queuing the copy: a cached destination should not share cachelines
+ * with other data.
+ *
+ * @param[out] dst
+ *             Destination buffer (8-byte aligned)
+ * @param[in]  src
+ *             Source buffer (8-byte aligned)
+ * @param[in]  size
+ *             Number of bytes to copy (multiple of 8)
+ *
+ * @return The fence of the operation.
+ */
+rsp_memops_fence_t rsp_memcpy(void *dst, const void *src, int size)
+{
+    assert((((uint32_t)dst | (uint32_t)src | size) & 7) == 0);
+
+    __rsp_memops_flush(dst, size, src, size);
+    return __rsp_memops_submit(RSP_MEMOPS_COPY, dst, (uint32_t)src & 0x1FFFFFFF, size);
+}
+
+/**
+ * @brief Fill a memory region with a 32-bit value with the RSP
+ *
+ * This is useful for clearing framebuffers and depth buffers: in 16 bpp mode,
+ * pass a pair of pixels as value.  See #rsp_memcpy for the synchronization
+ * requirements.
+ *
+ * @param[out] dst
+ *             Destination buffer (8-byte aligned)
+ * @param[in]  value
+ *             Value to fill with
+ * @param[in]  size
+ *             Number of bytes to fill (multiple of 4)
+ *
+ * @return The fence of the operation.
+ */
+rsp_memops_fence_t rsp_memset32(void *dst, uint32_t value, int size)
+{
+    assert(((uint32_t)dst & 7) == 0 && (size & 3) == 0);
+
+    __rsp_memops_flush(dst, size, NULL, 0);
+
+    /* The RSP fills 8 bytes at a time: write the last word, if any, through the
+     * uncached segment, so that no cacheline overlaps the RSP writes */
+    if (size & 4)
+    {
+        size -= 4;
+        *(volatile uint32_t *)UncachedAddr((uint8_t *)dst + size) = value;
+    }
+
+    return __rsp_memops_submit(RSP_MEMOPS_FILL, dst, value, size);
+}
+
+/**
+ * @brief Convert pixels from RGBA5551 to RGBA8888 with the RSP
+ *
+ * The 5-bit channels are expanded to 8 bits, replicating their top bits, and the
+ * alpha channel is set to either 0 or 255.  See #rsp_memcpy for the synchronization
+ * requirements.
+ *
+ * @param[out] dst
+ *             Destination buffer (8-byte aligned), num_pixels * 4 bytes
+ * @param[in]  src
+ *             Source buffer (8-byte aligned), num_pixels * 2 bytes
+ * @param[in]  num_pixels
+ *             Number of pixels to convert (multiple of 4)
+ *
+ * @return The fence of the operation.
+ */
+rsp_memops_fence_t rsp_convert_16to32(void *dst, const void *src, int num_pixels)
+{
+    assert((((uint32_t)dst | (uint32_t)src) & 7) == 0 && (num_pixels & 3) == 0);
+
+    __rsp_memops_flush(dst, num_pixels * 4, src, num_pixels * 2);
+    return __rsp_memops_submit(RSP_MEMOPS_16TO32, dst, (uint32_t)src & 0x1FFFFFFF, num_pixels);
+}
+
+/**
+ * @brief Convert pixels from RGBA8888 to RGBA5551 with the RSP
+ *
+ * The channels are truncated to 5 bits, and the alpha bit is set if alpha is at
+ * least 128.  See #rsp_memcpy for the synchronization requirements.
+ *
+ * @param[out] dst
+ *             Destination buffer (8-byte aligned), num_pixels * 2 bytes
+ * @param[in]  src
+ *             Source buffer (8-byte aligned), num_pixels * 4 bytes
+ * @param[in]  num_pixels
+ *             Number of pixels to convert (multiple of 4)
+ *
+ * @return The fence of the operation.
+ */
+rsp_memops_fence_t rsp_convert_32to16(void *dst, const void *src, int num_pixels)
+{
+    assert((((uint32_t)dst | (uint32_t)src) & 7) == 0 && (num_pixels & 3) == 0);
+
+    __rsp_memops_flush(dst, num_pixels * 2, src, num_pixels * 4);
+    return __rsp_memops_submit(RSP_MEMOPS_32TO16, dst, (uint32_t)src & 0x1FFFFFFF, num_pixels);
+}
+
+/**
+ * @brief Check whether an RSP memory operation is complete
+ *
+ * @param[in] fence
+ *            Fence returned by the operation (0 is always complete)
+ *
+ * @return true if the operation (and all the ones queued before it) is complete.
+ */
+bool rsp_memops_done(rsp_memops_fence_t fence)
+{
+    return (int32_t)(memops_completed - fence) >= 0;
+}
+
+/**
+ * @brief Wait until an RSP memory operation is complete
+ *
+ * @param[in] fence
+ *            Fence returned by the operation (0 returns immediately)
+ */
+void rsp_memops_wait(rsp_memops_fence_t fence)
+{
+    while (!rsp_memops_done(fence))
+    {
+        /* If the slot has been reused, its task comes after the fence anyway */
+        rsp_task_wait(&memops_slots[fence % RSP_MEMOPS_QUEUE_SIZE].task);
+    }
+}
+
+/** @} */ /* memops */
@@ -4,6 +4,7 @@
  * @ingroup mempak
  */
 #include <string.h>
+#include <malloc.h>
 #include "libdragon.h"
 #include "regsinternal.h"
 
@@ -27,6 +28,15 @@
  * first using #delete_mempak_entry.  Code should be careful to check how many blocks
  * are free before writing using #get_mempak_free_space.
  *
+ * Each of these functions reads the header and the TOC of the mempak, and each sector
+ * takes 8 SI transactions.  To list notes or save repeatedly, mount the mempak with
+ * #mempak_mount: the header, the TOCs and the note table are then kept in RAM, and
+ * only the blocks that change are written back.  The mempak is checked with a few SI
+ * transactions at the start of each function, and the cache is reloaded when the
+ * controller reports that the mempak was changed, or a different mempak (or no mempak)
+ * is found.  While a mempak is mounted, its first
+ * #MEMPAK_CACHED_SECTORS sectors must only be written through this module.
+ *
  * @{
  */
 
@@ -45,6 +55,187 @@
 #define BLOCK_VALID_LAST    0x7F
 /** @} */
 
+/** @brief Cache of the metadata of a mounted mempak */
+typedef struct
+{
+    /** @brief True if data holds the contents of the inserted mempak */
+    bool valid;
+    /** @brief Header, TOCs and note table */
+    uint8_t data[MEMPAK_CACHED_SECTORS * MEMPAK_BLOCK_SIZE];
+} mempak_cache_t;
+
+/** @brief Cache of each controller (NULL if not mounted) */
+static mempak_cache_t *pak_cache[4] = { 0 };
+
+/**
+ * @brief Return the valid cache of the block at an address, if any
+ */
+static uint8_t *__get_cached_block( int controller, uint16_t address )
+{
+    if( controller < 0 || controller > 3 ) { return 0; }
+
+    mempak_cache_t *cache = pak_cache[controller];
+    if( !cache || !cache->valid || address >= MEMPAK_CACHED_SECTORS * MEMPAK_BLOCK_SIZE ) { return 0; }
+
+    return &cache->data[address & ~0x1F];
+}
+
+/**
+ * @brief Read a 32-byte block of a mempak, from the cache if possible
+ *
+ * @see #read_mempak_address
+ */
+static int __read_mempak_block( int controller, uint16_t address, uint8_t *data )
+{
+    uint8_t *cached = __get_cached_block( controller, address );
+
+    if( cached )
+    {
+        memcpy( data, cached, 32 );
+        return 0;
+    }
+
+    return read_mempak_address( controller, address, data );
+}
+
+/**
+ * @brief Write a 32-byte block of a mempak, skipping it if the cache shows it is unchanged
+ *
+ * @see #write_mempak_address
+ */
+static int __write_mempak_block( int controller, uint16_t address, uint8_t *data )
+{
+    uint8_t *cached = __get_cached_block( controller, address );
+
+    if( cached && !memcmp( cached, data, 32 ) )
+    {
+        /* Not dirty */
+        return 0;
+    }
+
+    int ret = write_mempak_address( controller, address, data );
+
+    if( cached )
+    {
+        if( ret ) { pak_cache[controller]->valid = false; }
+        else { memcpy( cached, data, 32 ); }
+    }
+
+    return ret;
+}
+
+static int __validate_toc( uint8_t *sector );
+
+/**
+ * @brief Check that the cache of a mounted mempak is up to date, and reload it if not
+ *
+ * The accessory status tells whether a mempak is inserted, and whether it was removed
+ * or replaced since the last check: the change bit stays set until the controller is
+ * reset, which this function does to clear it.  Since another module could also reset
+ * the controller, the identifier block (which contains a serial number) and the first
+ * block of the TOC are compared too, although two freshly formatted mempaks only differ
+ * by the change bit.
+ *
+ * The cache is marked valid only if the reloaded metadata contains a TOC with a
+ * correct checksum: otherwise (eg: an unformatted or corrupted mempak), the metadata
+ * is read from the mempak every time.
+ *
+ * @param[in] controller
+ *            The controller (0-3) of the mempak
+ */
+static void __check_mempak_cache( int controller )
+{
+    if( controller < 0 || controller > 3 || !pak_cache[controller] ) { return; }
+
+    mempak_cache_t *cache = pak_cache[controller];
+    uint8_t status[3], block[32];
+
+    /* The third byte of the status is 0x01 when an accessory is inserted, and
+     * 0x02 when the accessory changed since the controller was last reset */
+    execute_raw_command( controller, 0x00, 0, 3, block, status );
+
+    if( status[2] & 0x02 )
+    {
+        /* Reset the controller to clear the change bit (it replies with the
+         * same status) */
+        cache->valid = false;
+        execute_raw_command( controller, 0xFF, 0, 3, block, status );
+    }
+
+    if( !(status[2] & 0x01) )
+    {
+        cache->valid = false;
+        return;
+    }
+
+    if( cache->valid )
+    {
+        if( read_mempak_address( controller, 0x20, block ) || memcmp( block, &cache->data[0x20], 32 ) ||
+            read_mempak_address( controller, MEMPAK_BLOCK_SIZE, block ) || memcmp( block, &cache->data[MEMPAK_BLOCK_SIZE], 32 ) )
+        {
+            cache->valid = false;
+        }
+    }
+
+    if( cache->valid ) { return; }
+
+    /* Reload the metadata of the inserted mempak */
+    for( int i = 0; i < MEMPAK_CACHED_SECTORS * MEMPAK_BLOCK_SIZE; i += 32 )
+    {
+        if( read_mempak_address( controller, i, &cache->data[i] ) ) { return; }
+    }
+
+    /* Cache the metadata only if it can be trusted */
+    if( __validate_toc( &cache->data[1 * MEMPAK_BLOCK_SIZE] ) && __validate_toc( &cache->data[2 * MEMPAK_BLOCK_SIZE] ) ) { return; }
+
+    cache->valid = true;
+}
+
+/**
+ * @brief Mount a mempak, caching its metadata in RAM
+ *
+ * See the introduction of the @ref mempak "mempak module".
+ *
+ * @param[in] controller
+ *            The controller (0-3) of the mempak
+ *
+ * @retval 0 if the mempak was mounted
+ * @retval -1 if the controller is out of range, or there is not enough memory
+ * @retval -2 if the mempak is not present, couldn't be read or has no valid TOC (it
+ *            is mounted anyway, and cached once a formatted mempak is inserted)
+ */
+int mempak_mount( int controller )
+{
+    if( controller < 0 || controller > 3 ) { return -1; }
+
+    if( !pak_cache[controller] )
+    {
+        pak_cache[controller] = malloc( sizeof(mempak_cache_t) );
+        if( !pak_cache[controller] ) { return -1; }
+    }
+
+    pak_cache[controller]->valid = false;
+    __check_mempak_cache( controller );
+
+    return pak_cache[controller]->valid ? 0 : -2;
+}
+
+/**
+ * @brief Unmount a mempak mounted by #mempak_mount
+ *
+ * Since writes go to the mempak right away, this just releases the cache.
+ *
+ * @param[in] controller
+ *            The controller (0-3) of the mempak
+ */
+void mempak_unmount( int controller )
+{
+    if( controller < 0 || controller > 3 ) { return; }
+
+    free( pak_cache[controller] );
+    pak_cache[controller] = 0;
+}
+
 /**
  * @brief Read a sector from a mempak
  *
@@ -67,10 +258,16 @@ int read_mempak_sector( int controller, int sector, uint8_t *sector_data )
     if( sector < 0 || sector >= 128 ) { return -1; }
     if( sector_data == 0 ) { return -1; }
 
+    /* Data sectors are never cached */
+    if( sector >= MEMPAK_CACHED_SECTORS )
+    {
+        return read_mempak_range( controller, sector * MEMPAK_BLOCK_SIZE, sector_data, MEMPAK_BLOCK_SIZE ) ? -2 : 0;
+    }
+
     /* Sectors are 256 bytes, a mempak reads 32 bytes at a time */
     for( int i = 0; i < 8; i++ )
     {
-        if( read_mempak_address( controller, (sector * MEMPAK_BLOCK_SIZE) + (i * 32), sector_data + (i * 32) ) )
+        if( __read_mempak_block( controller, (sector * MEMPAK_BLOCK_SIZE) + (i * 32), sector_data + (i * 32) ) )
         {
             /* Failed to read a block */
             return -2;
@@ -102,10 +299,16 @@ int write_mempak_sector( int controller, int sector, uint8_t *sector_data )
     if( sector < 0 || sector >= 128 ) { return -1; }
     if( sector_data == 0 ) { return -1; }
 
+    /* Data sectors are never cached */
+    if( sector >= MEMPAK_CACHED_SECTORS )
+    {
+        return write_mempak_range( controller, sector * MEMPAK_BLOCK_SIZE, sector_data, MEMPAK_BLOCK_SIZE ) ? -2 : 0;
+    }
+
     /* Sectors are 256 bytes, a mempak writes 32 bytes at a time */
     for( int i = 0; i < 8; i++ )
     {
-        if( write_mempak_address( controller, (sector * MEMPAK_BLOCK_SIZE) + (i * 32), sector_data + (i * 32) ) )
+        if( __write_mempak_block( controller, (sector * MEMPAK_BLOCK_SIZE) + (i * 32), sector_data + (i * 32) ) )
         {
             /* Failed to read a block */
             return -2;
@@ -720,6 +923,8 @@ static int __get_valid_toc( int controller )
  */
 int validate_mempak( int controller )
 {
+    __check_mempak_cache( controller );
+
     int toc = __get_valid_toc( controller );
 
     if( toc == 1 || toc == 2 )
@@ -753,6 +958,8 @@ int validate_mempak( int controller )
  */
 int get_mempak_entry( int controller, int entry, entry_structure_t *entry_data )
 {
+    __check_mempak_cache( controller );
+
     uint8_t data[MEMPAK_BLOCK_SIZE];
     int toc;
 
@@ -768,7 +975,7 @@ int get_mempak_entry( int controller, int entry, entry_structure_t *entry_data )
 
     /* Entries are spread across two sectors, but we can luckly grab just one
        with a single mempak read */
-    if( read_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry * 32), data ) )
+    if( __read_mempak_block( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry * 32), data ) )
     {
         /* Couldn't read note database */
         return -2;
@@ -818,6 +1025,8 @@ int get_mempak_entry( int controller, int entry, entry_structure_t *entry_data )
  */
 int get_mempak_free_space( int controller )
 {
+    __check_mempak_cache( controller );
+
     uint8_t data[MEMPAK_BLOCK_SIZE];
     int toc;
 
@@ -852,6 +1061,8 @@ int get_mempak_free_space( int controller )
  */
 int format_mempak( int controller )
 {
+    __check_mempak_cache( controller );
+
     /* Many mempak dumps exist online for users of emulated games to get
        saves that have all unlocks.  Every beginning sector on all these
        was the same, so this is the data I use to initialize the first
@@ -948,6 +1159,8 @@ int format_mempak( int controller )
  */
 int read_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *data )
 {
+    __check_mempak_cache( controller );
+
     int toc;
     uint8_t tocdata[MEMPAK_BLOCK_SIZE];
 
@@ -1011,6 +1224,8 @@ int read_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *d
  */
 int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *data )
 {
+    __check_mempak_cache( controller );
+
     uint8_t sector[MEMPAK_BLOCK_SIZE];
     uint8_t tmp_data[32];
     int toc;
@@ -1097,7 +1312,7 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
     {
         entry_structure_t tmp_entry;
 
-        if( read_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (i * 32), tmp_data ) )
+        if( __read_mempak_block( controller, (3 * MEMPAK_BLOCK_SIZE) + (i * 32), tmp_data ) )
         {
             /* Couldn't read note database */
             return -2;
@@ -1140,7 +1355,7 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
     __write_note( entry, tmp_data );
 
     /* Store entry to empty slot on mempak */
-    if( write_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), tmp_data ) )
+    if( __write_mempak_block( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), tmp_data ) )
     {
         /* Couldn't update note database */
         return -2;
@@ -1166,6 +1381,8 @@ int write_mempak_entry_data( int controller, entry_structure_t *entry, uint8_t *
  */
 int delete_mempak_entry( int controller, entry_structure_t *entry )
 {
+    __check_mempak_cache( controller );
+
     entry_structure_t tmp_entry;
     uint8_t data[MEMPAK_BLOCK_SIZE];
     int toc;
@@ -1177,7 +1394,7 @@ int delete_mempak_entry( int controller, entry_structure_t *entry )
     if( entry->inode < BLOCK_VALID_FIRST || entry->inode > BLOCK_VALID_LAST ) { return -1; }
 
     /* Ensure that the entry passed in matches what's on the mempak */
-    if( read_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), data ) )
+    if( __read_mempak_block( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), data ) )
     {
         /* Couldn't read note database */
         return -2;
@@ -1197,7 +1414,7 @@ int delete_mempak_entry( int controller, entry_structure_t *entry )
 
     /* The entry matches, so blank it */
     memset( data, 0, 32 );
-    if( write_mempak_address( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), data ) )
+    if( __write_mempak_block( controller, (3 * MEMPAK_BLOCK_SIZE) + (entry->entry_id * 32), data ) )
     {
         /* Couldn't update note database */
         return -2;
@@ -6,7 +6,9 @@
 
 #include <stdint.h>
 #include <assert.h>
+#include <malloc.h>
 #include "n64sys.h"
+#include "system.h"
 
 /**
  * @defgroup n64sys N64 System Interface
@@ -33,6 +35,22 @@
  */
 int __bootcic = 6102;
 
+/** @brief Size of the VR4300 data cache */
+#define DCACHE_SIZE         (8*1024)
+
+/** @brief Size of the VR4300 instruction cache */
+#define ICACHE_SIZE         (16*1024)
+
+/**
+ * @brief Region size above which the whole data cache is written back with index ops
+ *
+ * A hit op costs one cache op per line of the region, while writing back
+ * the whole cache costs one op per line of the cache (512 lines), plus the
+ * misses needed to reload the lines that were hot.  Above this size, the
+ * index ops are cheaper.
+ */
+#define DCACHE_INDEX_THRESHOLD  (2*DCACHE_SIZE)
+
 /**
  * @brief Return the boot CIC
  *
@@ -75,7 +93,8 @@ void sys_set_boot_cic(int bc)
 /**
  * @brief Force a data cache writeback over a memory region
  *
- * Use this to force cached memory to be written to RDRAM.
+ * Use this to force cached memory to be written to RDRAM.  For large
+ * regions, the whole data cache is written back and invalidated instead.
  *
  * @param[in] addr
  *            Pointer to memory in question
@@ -84,6 +103,14 @@ void sys_set_boot_cic(int bc)
  */
 void data_cache_hit_writeback(volatile const void * addr, unsigned long length)
 {
+    if (length >= DCACHE_INDEX_THRESHOLD)
+    {
+        /* There is no index writeback without invalidate, but invalidating
+         * clean lines is harmless */
+        data_cache_writeback_invalidate_all();
+        return;
+    }
+
     cache_op(0x19, 16);
 }
 
@@ -97,6 +124,7 @@ void __data_cache_hit_invalidate(volatile void * addr, unsigned long length)
  * @brief Force a data cache writeback invalidate over a memory region
  *
  * Use this to force cached memory to be written to RDRAM and then cache updated.
+ * For large regions, the whole data cache is written back and invalidated instead.
  *
  * @param[in] addr
  *            Pointer to memory in question
@@ -105,6 +133,12 @@ void __data_cache_hit_invalidate(volatile void * addr, unsigned long length)
  */
 void data_cache_hit_writeback_invalidate(volatile void * addr, unsigned long length)
 {
+    if (length >= DCACHE_INDEX_THRESHOLD)
+    {
+        data_cache_writeback_invalidate_all();
+        return;
+    }
+
     cache_op(0x15, 16);
 }
 
@@ -129,8 +163,7 @@ void data_cache_index_writeback_invalidate(volatile void * addr, unsigned long l
  */
 void data_cache_writeback_invalidate_all(void)
 {
-    // TODO: do an index op instead for better performance
-    data_cache_hit_writeback_invalidate(KSEG0_START_ADDR, get_memory_size());
+    data_cache_index_writeback_invalidate(KSEG0_START_ADDR, DCACHE_SIZE);
 }
 
 /**
@@ -184,11 +217,54 @@ void inst_cache_index_invalidate(volatile void * addr, unsigned long length)
  */
 void inst_cache_invalidate_all(void)
 {
-    // TODO: do an index op instead for better performance
-    inst_cache_hit_invalidate(KSEG0_START_ADDR, get_memory_size());
+    inst_cache_index_invalidate(KSEG0_START_ADDR, ICACHE_SIZE);
 }
 
 
+/**
+ * @brief Allocate a buffer to be accessed through uncached memory
+ *
+ * The buffer is 16-byte aligned and its size is rounded up to a multiple
+ * of 16 bytes, so that it does not share any cacheline with other data, and its
+ * lines are evicted from the data cache.  The returned pointer is an uncached
+ * address: it can be written by the CPU and read by DMA (or vice versa) without
+ * any cache maintenance.  Release it with #free_uncached.
+ *
+ * @param[in] size
+ *            Size of the buffer in bytes
+ *
+ * @return The uncached address of the buffer, or NULL if out of memory.
+ */
+void *malloc_uncached(size_t size)
+{
+    size = (size + 15) & ~15;
+
+    void *mem = memalign(16, size);
+    if (!mem)
+    {
+        return NULL;
+    }
+
+    /* The heap might have left dirty lines in the cache, that would be
+     * written back later over data written through the uncached address */
+    data_cache_hit_invalidate(mem, size);
+    return UncachedAddr(mem);
+}
+
+/**
+ * @brief Free a buffer allocated with #malloc_uncached
+ *
+ * @param[in] buf
+ *            Uncached address returned by #malloc_uncached (or NULL)
+ */
+void free_uncached(void *buf)
+{
+    if (buf)
+    {
+        free(CachedAddr(buf));
+    }
+}
+
 /**
  * @brief Get amount of available memory.
  *
@@ -211,6 +287,245 @@ bool is_memory_expanded()
     return get_memory_size() == 0x800000;
 }
 
+/** @brief Maximum number of RDRAM banks (with the expansion pak) */
+#define RDRAM_MAX_BANKS 8
+
+/** @brief Top of the memory that can be reserved for video buffers (0 until the first one) */
+static char *video_limit = 0;
+/** @brief Lowest address reserved from the heap for video buffers */
+static char *video_bottom = 0;
+/** @brief Free memory left at the top of each RDRAM bank, below this address */
+static char *video_top[RDRAM_MAX_BANKS];
+/** @brief Number of video buffers in each RDRAM bank */
+static int video_count[RDRAM_MAX_BANKS];
+
+/**
+ * @brief Get the RDRAM bank of an address
+ *
+ * @param[in] addr
+ *            Cached or uncached address
+ *
+ * @return The RDRAM bank (0-3, or 0-7 with the expansion pak).
+ */
+int rdram_get_bank(const void *addr)
+{
+    return ((uint32_t)addr & 0x1FFFFFFF) / RDRAM_BANK_SIZE;
+}
+
+/**
+ * @brief Free memory at the top of a bank, once it has no video buffers
+ */
+static char *__video_bank_top(int bank)
+{
+    char *end = (char *)KSEG0_START_ADDR + (bank + 1) * RDRAM_BANK_SIZE;
+
+    return end < video_limit ? end : video_limit;
+}
+
+/**
+ * @brief Address a video buffer would have in a bank
+ *
+ * @return The address, or NULL if the buffer does not fit in the bank
+ */
+static char *__video_place(int bank, size_t size)
+{
+    uint32_t start = (uint32_t)KSEG0_START_ADDR + bank * RDRAM_BANK_SIZE;
+    uint32_t top = (uint32_t)video_top[bank];
+
+    if (top < start + size)
+    {
+        return NULL;
+    }
+
+    uint32_t place = (top - size) & ~(RDRAM_PAGE_SIZE - 1);
+
+    return place >= start ? (char *)place : NULL;
+}
+
+/**
+ * @brief Choose the bank of a video buffer
+ *
+ * The bank where the buffer would be the highest comes first, which packs it next to
+ * the buffers placed so far and takes the least memory from the heap.  With
+ * #RDRAM_BANK_SPREAD and the expansion pak, its bank with the fewest buffers comes
+ * first instead.
+ *
+ * @param[in] bank
+ *            Requested bank, #RDRAM_BANK_ANY or #RDRAM_BANK_SPREAD
+ * @param[in] size
+ *            Size of the buffer in bytes
+ * @param[in] skip
+ *            Mask of the banks not to choose
+ *
+ * @return The bank, or -1 if the buffer does not fit in any bank
+ */
+static int __video_pick(int bank, size_t size, uint32_t skip)
+{
+    int num_banks = get_memory_size() / RDRAM_BANK_SIZE;
+    int best = -1;
+
+    if (bank >= 0 && bank < num_banks && !(skip & (1 << bank)) && __video_place(bank, size))
+    {
+        return bank;
+    }
+
+    /* Banks of the expansion pak */
+    for (int i = num_banks - 1; i >= 4 && bank == RDRAM_BANK_SPREAD; i--)
+    {
+        char *place = __video_place(i, size);
+
+        if (!place || (skip & (1 << i)))
+        {
+            continue;
+        }
+
+        if (best < 0 || video_count[i] < video_count[best] ||
+            (video_count[i] == video_count[best] && place > __video_place(best, size)))
+        {
+            best = i;
+        }
+    }
+
+    if (best >= 0)
+    {
+        return best;
+    }
+
+    for (int i = num_banks - 1; i >= 0; i--)
+    {
+        char *place = __video_place(i, size);
+
+        if (place && !(skip & (1 << i)) && (best < 0 || place > __video_place(best, size)))
+        {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * @brief Allocate a buffer accessed by the video hardware (framebuffers, Z-buffers, audio buffers...)
+ *
+ * Each RDRAM bank keeps a single page open at a time, so accesses alternating between
+ * two buffers of the same bank (like the RDP reading and writing the color buffer and
+ * the Z-buffer, while the VI reads the displayed buffer) reopen pages all the time.
+ * This allocator places the buffers at the top of the banks, starting right below the
+ * stack, away from the code and the data of the program at the bottom of RDRAM.  The
+ * buffers start at an RDRAM page boundary.
+ *
+ * Buffers allocated with #RDRAM_BANK_ANY are packed next to each other at the top
+ * of RDRAM, so they only take the memory they use from the heap.  With the expansion
+ * pak, buffers allocated with #RDRAM_BANK_SPREAD are spread across its banks instead, so
+ * that for instance the Z-buffer ends up in a different bank than the framebuffers.
+ * This is opt-in because it is costly: the heap is contiguous, so everything between
+ * the lowest buffer and the stack is reserved, up to a whole bank per spread buffer.
+ * The memory left below a buffer in a bank is used by the following buffers allocated
+ * there.
+ *
+ * The memory is reserved from the top of the heap (see #sbrk_top) and is never given
+ * back to it: the space of the buffers released with #free_video is reused once all
+ * the buffers of a bank are released.  If no bank has room, the buffer is allocated
+ * from the heap.
+ *
+ * @param[in] size
+ *            Size of the buffer in bytes
+ * @param[in] bank
+ *            RDRAM bank to place the buffer in, #RDRAM_BANK_ANY or #RDRAM_BANK_SPREAD.
+ *            If the buffer does not fit in the requested bank, it is placed elsewhere.
+ *
+ * @return The cached address of the buffer, or NULL if out of memory.
+ */
+void *malloc_video(size_t size, int bank)
+{
+    uint32_t skip = 0;
+    char *mem = NULL;
+    int best;
+
+    size = (size + 15) & ~15;
+
+    if (video_limit == 0)
+    {
+        video_limit = video_bottom = sbrk_top(0);
+
+        for (int i = 0; i < RDRAM_MAX_BANKS; i++)
+        {
+            video_top[i] = __video_bank_top(i);
+        }
+    }
+
+    while ((best = __video_pick(bank, size, skip)) >= 0)
+    {
+        mem = __video_place(best, size);
+
+        /* Take the memory below the buffers placed so far from the heap */
+        if (mem >= video_bottom || sbrk_top(video_bottom - mem) != (void *)-1)
+        {
+            break;
+        }
+
+        /* The heap is using it */
+        skip |= 1 << best;
+        mem = NULL;
+    }
+
+    if (mem)
+    {
+        if (mem < video_bottom)
+        {
+            video_bottom = mem;
+        }
+
+        video_top[best] = mem;
+        video_count[best]++;
+    }
+    else
+    {
+        mem = memalign(RDRAM_PAGE_SIZE, size);
+
+        if (!mem)
+        {
+            return NULL;
+        }
+    }
+
+    /* The memory might have left dirty lines in the cache, that would be
+     * written back later over data written through the uncached address */
+    data_cache_hit_invalidate(mem, size);
+    return mem;
+}
+
+/**
+ * @brief Free a buffer allocated with #malloc_video
+ *
+ * @param[in] buf
+ *            Address returned by #malloc_video (or NULL)
+ */
+void free_video(void *buf)
+{
+    char *mem = CachedAddr(buf);
+
+    if (!buf)
+    {
+        return;
+    }
+
+    if (mem < video_bottom || mem >= video_limit)
+    {
+        free(mem);
+        return;
+    }
+
+    int bank = rdram_get_bank(mem);
+
+    assert(video_count[bank] > 0);
+
+    if (--video_count[bank] == 0)
+    {
+        video_top[bank] = __video_bank_top(bank);
+    }
+}
+
 /** @brief Memory location to read which determines the TV type. */
 #define TV_TYPE_LOC  0x80000300
 
@@ -0,0 +1,271 @@
+/**
+ * @file overlay.c
+ * @brief Code and data overlays
+ * @ingroup overlay
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include "libdragon.h"
+
+/**
+ * @defgroup overlay Overlays
+ * @ingroup lowlevel
+ * @brief Code and data loaded from ROM only when needed, mapped via the TLB.
+ *
+ * The program image is copied from ROM to RDRAM at boot, in its entirety.
+ * Overlays are a way to keep parts of the program that are used only in some
+ * moments (a level, a menu, the credits) out of RDRAM until they are needed.
+ *
+ * Functions and variables are assigned to one of #OVERLAY_MAX overlays with the
+ * #OVERLAY_TEXT, #OVERLAY_RODATA and #OVERLAY_DATA attributes. Each overlay is
+ * linked at a fixed address in mapped kernel memory (#OVERLAY_BASE_ADDR plus a
+ * #OVERLAY_MAX_SIZE slot per overlay), and it is stored in the ROM right after
+ * the program data, so n64tool packs it with the rest of the program image.
+ * Overlays just make the image larger, so the DragonFS offset given to n64tool
+ * must leave room for them.
+ *
+ * Calling #overlay_load allocates RDRAM for the overlay, reads it from ROM and
+ * maps it at its link address via the TLB, after which its functions can be
+ * called and its variables accessed. #overlay_unload releases the memory; the
+ * contents of the overlay data are lost, and they will be reset to their
+ * initial values by the next #overlay_load.
+ *
+ * Each overlay uses four TLB entries (eight pages): the page size is chosen,
+ * depending on the size of the overlay, as the smallest one (4 KiB to 256 KiB)
+ * that covers it, so the allocated memory is aligned to the page size.
+ * Accessing an overlay which is not loaded causes a TLB miss exception.
+ * @{
+ */
+
+/** @brief Number of TLB entries (each mapping a pair of pages) */
+#define TLB_ENTRIES             32
+/** @brief Number of TLB entries reserved to each overlay */
+#define OVERLAY_TLB_ENTRIES     (TLB_ENTRIES / OVERLAY_MAX)
+
+/** @brief Minimum alignment of the overlay memory, to avoid cache aliasing */
+#define OVERLAY_MIN_ALIGN       (16 * 1024)
+
+/** @brief EntryLo bits of a valid, dirty (writable), cached and global page */
+#define TLB_ENTRYLO_FLAGS       ((3 << 3) | (1 << 2) | (1 << 1) | (1 << 0))
+
+/** @brief Address of the raw image in the cartridge (after the ROM header) */
+#define ROM_IMAGE_ADDR          0x10001000
+
+/** @brief Magic word of a compressed program image (see entrypoint.S) */
+#define BOOT_COMPRESSED_MAGIC   0x4C5A3442
+
+/** @cond */
+#define OVERLAY_SYMBOLS(n) \
+    extern char __overlay##n##_start[], __overlay##n##_end[], __overlay##n##_load[];
+OVERLAY_SYMBOLS(0) OVERLAY_SYMBOLS(1) OVERLAY_SYMBOLS(2) OVERLAY_SYMBOLS(3)
+OVERLAY_SYMBOLS(4) OVERLAY_SYMBOLS(5) OVERLAY_SYMBOLS(6) OVERLAY_SYMBOLS(7)
+#define OVERLAY_ENTRY(n)  { __overlay##n##_start, __overlay##n##_end, __overlay##n##_load }
+/** @endcond */
+
+extern char __libdragon_text_start[], __text_start[], __data_end[];
+
+/** @brief Linker information on an overlay */
+typedef struct
+{
+    /** @brief Link address */
+    char *start;
+    /** @brief End of the overlay */
+    char *end;
+    /** @brief Load address (position in the raw image) */
+    char *load;
+} overlay_info_t;
+
+/** @brief Overlays defined by the linker script */
+static const overlay_info_t overlay_info[OVERLAY_MAX] = {
+    OVERLAY_ENTRY(0), OVERLAY_ENTRY(1), OVERLAY_ENTRY(2), OVERLAY_ENTRY(3),
+    OVERLAY_ENTRY(4), OVERLAY_ENTRY(5), OVERLAY_ENTRY(6), OVERLAY_ENTRY(7),
+};
+
+/** @brief Memory of the loaded overlays (NULL if not loaded) */
+static void *overlay_mem[OVERLAY_MAX];
+
+/** @brief True once the TLB has been set to a known state */
+static bool tlb_initialized = false;
+
+/**
+ * @brief Write a TLB entry
+ *
+ * @param[in] index
+ *            Index of the TLB entry
+ * @param[in] hi
+ *            EntryHi (virtual address of the pair of pages)
+ * @param[in] lo0
+ *            EntryLo0 (even page)
+ * @param[in] lo1
+ *            EntryLo1 (odd page)
+ * @param[in] mask
+ *            PageMask
+ */
+static void tlb_write( int index, uint32_t hi, uint32_t lo0, uint32_t lo1, uint32_t mask )
+{
+    asm volatile(
+        "mtc0 %0,$0\n\t"
+        "mtc0 %1,$10\n\t"
+        "mtc0 %2,$2\n\t"
+        "mtc0 %3,$3\n\t"
+        "mtc0 %4,$5\n\t"
+        "nop\n\t"
+        "tlbwi\n\t"
+        "nop\n\t"
+        "nop\n\t"
+        :: "r"(index), "r"(hi), "r"(lo0), "r"(lo1), "r"(mask));
+}
+
+/**
+ * @brief Invalidate a TLB entry
+ *
+ * The entry is pointed to an address in KSEG0, which is never translated via
+ * the TLB: a different address is used for each entry, as two entries matching
+ * the same address would shut down the TLB.
+ *
+ * @param[in] index
+ *            Index of the TLB entry
+ */
+static void tlb_invalidate( int index )
+{
+    tlb_write( index, (uint32_t)KSEG0_START_ADDR + index * 0x2000, 0, 0, 0 );
+}
+
+/**
+ * @brief Return the ROM address of the overlays
+ *
+ * The overlays follow the program data in the ROM. If the program image is
+ * compressed, they follow the compressed data instead, which is padded to
+ * 16 bytes after its 16-byte header.
+ *
+ * @return The PI address of the start of the first overlay
+ */
+static uint32_t overlay_rom_base( void )
+{
+    uint32_t rom = ROM_IMAGE_ADDR + (__text_start - __libdragon_text_start);
+
+    if( io_read( rom ) == BOOT_COMPRESSED_MAGIC )
+    {
+        return rom + 16 + ((io_read( rom + 8 ) + 15) & ~15);
+    }
+
+    return rom + (__data_end - __text_start);
+}
+
+/**
+ * @brief Return the size of an overlay
+ *
+ * @param[in] n
+ *            Overlay number
+ *
+ * @return The size in bytes of the overlay (0 if there is nothing in it)
+ */
+int overlay_size( int n )
+{
+    assertf( n >= 0 && n < OVERLAY_MAX, "invalid overlay: %d", n );
+    return overlay_info[n].end - overlay_info[n].start;
+}
+
+/**
+ * @brief Check whether an overlay is loaded
+ *
+ * @param[in] n
+ *            Overlay number
+ *
+ * @return True if the overlay is loaded and mapped
+ */
+bool overlay_loaded( int n )
+{
+    assertf( n >= 0 && n < OVERLAY_MAX, "invalid overlay: %d", n );
+    return overlay_mem[n] != NULL;
+}
+
+/**
+ * @brief Load an overlay from ROM and map it at its link address
+ *
+ * Loading an overlay which is already loaded does nothing.
+ *
+ * @param[in] n
+ *            Overlay number
+ *
+ * @return 0 on success, or a negative value if there is not enough memory
+ */
+int overlay_load( int n )
+{
+    assertf( n >= 0 && n < OVERLAY_MAX, "invalid overlay: %d", n );
+
+    if( overlay_mem[n] ) { return 0; }
+
+    const overlay_info_t *ovl = &overlay_info[n];
+    uint32_t size = ovl->end - ovl->start;
+    if( size == 0 ) { return 0; }
+
+    /* Smallest page size such that the reserved entries cover the overlay */
+    uint32_t page = 4 * 1024;
+    while( page * 2 * OVERLAY_TLB_ENTRIES < size ) { page *= 4; }
+
+    void *mem = memalign( page > OVERLAY_MIN_ALIGN ? page : OVERLAY_MIN_ALIGN, size );
+    if( !mem ) { return -1; }
+
+    /* Read the overlay from ROM, right after the program data */
+    data_cache_hit_writeback_invalidate( mem, size );
+    dma_read( mem, overlay_rom_base() + (ovl->load - __data_end), size );
+
+    disable_interrupts();
+
+    if( !tlb_initialized )
+    {
+        /* The TLB contents are undefined at boot */
+        for( int i = 0; i < TLB_ENTRIES; i++ ) { tlb_invalidate( i ); }
+        tlb_initialized = true;
+    }
+
+    uint32_t phys = (uint32_t)mem & 0x1FFFFFFF;
+    uint32_t mask = (page * 2 - 1) & ~0x1FFF;
+    for( int i = 0; i < OVERLAY_TLB_ENTRIES; i++ )
+    {
+        uint32_t off = i * 2 * page;
+        uint32_t lo0 = off < size ? (((phys + off) >> 12) << 6) | TLB_ENTRYLO_FLAGS : 0;
+        uint32_t lo1 = off + page < size ? (((phys + off + page) >> 12) << 6) | TLB_ENTRYLO_FLAGS : 0;
+
+        if( lo0 ) { tlb_write( n * OVERLAY_TLB_ENTRIES + i, (uint32_t)ovl->start + off, lo0, lo1, mask ); }
+        else { tlb_invalidate( n * OVERLAY_TLB_ENTRIES + i ); }
+    }
+
+    overlay_mem[n] = mem;
+
+    enable_interrupts();
+
+    /* The instruction cache may still hold code of the previous load */
+    inst_cache_hit_invalidate( ovl->start, size );
+    return 0;
+}
+
+/**
+ * @brief Unmap an overlay and release its memory
+ *
+ * No code of the overlay must be running, or called afterwards, and no pointer
+ * to the overlay data must be used afterwards.
+ *
+ * @param[in] n
+ *            Overlay number
+ */
+void overlay_unload( int n )
+{
+    assertf( n >= 0 && n < OVERLAY_MAX, "invalid overlay: %d", n );
+
+    if( !overlay_mem[n] ) { return; }
+
+    /* Flush the cache while the mapping still exists */
+    data_cache_hit_writeback_invalidate( overlay_info[n].start, overlay_size( n ) );
+
+    disable_interrupts();
+    for( int i = 0; i < OVERLAY_TLB_ENTRIES; i++ ) { tlb_invalidate( n * OVERLAY_TLB_ENTRIES + i ); }
+    enable_interrupts();
+
+    free( overlay_mem[n] );
+    overlay_mem[n] = NULL;
+}
+
+/** @} */ /* overlay */
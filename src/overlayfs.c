@@ -0,0 +1,545 @@
+/**
+ * @file overlayfs.c
+ * @brief Filesystem overlays
+ * @ingroup system
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include "system.h"
+#include "overlayfs.h"
+
+/**
+ * @addtogroup system
+ * @{
+ *
+ * An overlay serves the files of a filesystem prefix from a directory of
+ * another filesystem when they exist there, and falls back to the original
+ * filesystem otherwise. During development, this allows to override the assets
+ * stored in the ROM with the files on the SD card of the development cartridge,
+ * so that iterating on them does not require to rebuild and reflash the ROM:
+ *
+ * @code{.c}
+ *     dfs_init(DFS_DEFAULT_LOCATION);
+ *     debug_init_sdfs("sd:/", -1);
+ *     overlayfs_attach("rom:/", "sd:/assets", OVERLAYFS_DEFAULT_CACHE_SIZE);
+ *
+ *     // Opens sd:/assets/level1.dat if it exists, rom:/level1.dat otherwise
+ *     FILE *f = fopen("rom:/level1.dat", "rb");
+ * @endcode
+ *
+ * The files served from the overlay directory are read through a large read
+ * cache, as small reads from a SD card are very slow. The outcome of each
+ * lookup in the overlay directory is cached as well, together with the size of
+ * the file, so that opening a file that is not overridden (and thus calling
+ * stat) does not pay a directory scan on the SD card every time.
+ *
+ * When the files of the overlay directory change while the overlay is attached,
+ * call #overlayfs_invalidate so that the next open looks them up again.
+ *
+ * Only files opened in read-only mode are looked up in the overlay directory.
+ * Directory listings show the contents of the original filesystem.
+ */
+
+/** @brief Number of entries of the lookup cache (must be a power of two) */
+#define OVERLAY_STAT_CACHE_SIZE     256
+
+/** @brief The file has not been looked up in the overlay directory yet */
+#define OVERLAY_SIZE_UNKNOWN        (-2)
+/** @brief The file does not exist in the overlay directory */
+#define OVERLAY_SIZE_MISSING        (-1)
+
+/** @brief Outcome of a lookup in the overlay directory */
+typedef struct
+{
+    /** @brief Path relative to the prefix, or NULL if the entry is free */
+    char *name;
+    /** @brief Size of the file in the overlay directory (or OVERLAY_SIZE_*) */
+    int size;
+} overlay_stat_t;
+
+/** @brief File opened through the overlay */
+typedef struct
+{
+    /** @brief Filesystem the file has been opened from */
+    filesystem_t *fs;
+    /** @brief Handle returned by the filesystem */
+    void *handle;
+    /** @brief Size of the file (overlay directory only) */
+    int size;
+    /** @brief Current position (overlay directory only) */
+    int pos;
+    /** @brief Position of the underlying handle (overlay directory only) */
+    int fs_pos;
+    /** @brief Read cache (overlay directory only) */
+    uint8_t *cache;
+    /** @brief Position in the file of the first byte of the cache */
+    int cache_pos;
+    /** @brief Number of valid bytes in the cache */
+    int cache_len;
+} overlay_file_t;
+
+/** @brief State of the overlay */
+static struct
+{
+    /** @brief Prefix the overlay is attached to (NULL if not attached) */
+    char *prefix;
+    /** @brief Original filesystem of the prefix */
+    filesystem_t *lower;
+    /** @brief Filesystem of the overlay directory */
+    filesystem_t *upper;
+    /** @brief Path of the overlay directory within its filesystem (with trailing slash) */
+    char *upper_dir;
+    /** @brief Size of the read cache of each file */
+    int cache_size;
+    /** @brief Number of used entries in #stats */
+    int num_stats;
+    /** @brief Lookup cache, indexed by hash of the path */
+    overlay_stat_t stats[OVERLAY_STAT_CACHE_SIZE];
+} overlay;
+
+/**
+ * @brief Find the lookup cache entry of a file
+ *
+ * @param[in] name
+ *            Path relative to the prefix
+ *
+ * @return The entry (with size #OVERLAY_SIZE_UNKNOWN if new), or NULL if the
+ *         cache is full.
+ */
+static overlay_stat_t *__overlay_stat( const char *name )
+{
+    /* FNV-1a hash of the path, with linear probing */
+    uint32_t hash = 0x811C9DC5;
+    for( const char *c = name; *c; c++ )
+    {
+        hash = (hash ^ (uint8_t)*c) * 0x01000193;
+    }
+
+    for( int i = 0; i < OVERLAY_STAT_CACHE_SIZE; i++ )
+    {
+        overlay_stat_t *st = &overlay.stats[(hash + i) & (OVERLAY_STAT_CACHE_SIZE - 1)];
+
+        if( !st->name )
+        {
+            /* Keep some free entries, so that probing stays short */
+            if( overlay.num_stats >= OVERLAY_STAT_CACHE_SIZE * 3 / 4 )
+            {
+                return 0;
+            }
+
+            st->name = strdup( name );
+            if( !st->name )
+            {
+                return 0;
+            }
+
+            st->size = OVERLAY_SIZE_UNKNOWN;
+            overlay.num_stats++;
+            return st;
+        }
+
+        if( strcmp( st->name, name ) == 0 )
+        {
+            return st;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Open a file in the overlay directory
+ *
+ * @param[in] f
+ *            File structure to fill
+ * @param[in] name
+ *            Path relative to the prefix
+ * @param[in] flags
+ *            Open flags
+ * @param[in] st
+ *            Lookup cache entry of the file (can be NULL)
+ *
+ * @return Nonzero if the file exists in the overlay directory.
+ */
+static int __overlay_open_upper( overlay_file_t *f, const char *name, int flags, overlay_stat_t *st )
+{
+    char *path = malloc( strlen( overlay.upper_dir ) + strlen( name ) + 1 );
+    if( !path )
+    {
+        return 0;
+    }
+
+    strcpy( path, overlay.upper_dir );
+    strcat( path, name );
+    void *handle = overlay.upper->open( path, flags );
+    free( path );
+
+    if( !handle )
+    {
+        if( st ) { st->size = OVERLAY_SIZE_MISSING; }
+        return 0;
+    }
+
+    if( st && st->size >= 0 )
+    {
+        f->size = st->size;
+    }
+    else
+    {
+        struct stat fst;
+        memset( &fst, 0, sizeof(fst) );
+        if( overlay.upper->fstat ) { overlay.upper->fstat( handle, &fst ); }
+        f->size = fst.st_size;
+        if( st ) { st->size = f->size; }
+    }
+
+    f->fs = overlay.upper;
+    f->handle = handle;
+    f->cache = malloc( overlay.cache_size );
+    return 1;
+}
+
+/** @brief Overlay open (see #filesystem_t::open) */
+static void *__overlay_open( char *name, int flags )
+{
+    overlay_file_t *f = calloc( 1, sizeof(overlay_file_t) );
+    if( !f )
+    {
+        return 0;
+    }
+
+    if( (flags & O_ACCMODE) == O_RDONLY )
+    {
+        overlay_stat_t *st = __overlay_stat( name );
+
+        if( (!st || st->size != OVERLAY_SIZE_MISSING) && __overlay_open_upper( f, name, flags, st ) )
+        {
+            return f;
+        }
+    }
+
+    f->handle = overlay.lower->open ? overlay.lower->open( name, flags ) : 0;
+    if( !f->handle )
+    {
+        free( f );
+        return 0;
+    }
+
+    f->fs = overlay.lower;
+    return f;
+}
+
+/** @brief Overlay fstat (see #filesystem_t::fstat) */
+static int __overlay_fstat( void *file, struct stat *st )
+{
+    overlay_file_t *f = file;
+
+    if( f->fs == overlay.lower )
+    {
+        return f->fs->fstat ? f->fs->fstat( f->handle, st ) : -1;
+    }
+
+    memset( st, 0, sizeof(struct stat) );
+    st->st_mode = S_IFREG | 0444;
+    st->st_nlink = 1;
+    st->st_size = f->size;
+    return 0;
+}
+
+/** @brief Overlay lseek (see #filesystem_t::lseek) */
+static int __overlay_lseek( void *file, int ptr, int dir )
+{
+    overlay_file_t *f = file;
+
+    if( f->fs == overlay.lower )
+    {
+        return f->fs->lseek ? f->fs->lseek( f->handle, ptr, dir ) : -1;
+    }
+
+    /* Seeking is deferred to the next read that misses the cache */
+    int pos;
+    switch( dir )
+    {
+        case SEEK_SET: pos = ptr; break;
+        case SEEK_CUR: pos = f->pos + ptr; break;
+        case SEEK_END: pos = f->size + ptr; break;
+        default: return -1;
+    }
+
+    if( pos < 0 )
+    {
+        return -1;
+    }
+
+    f->pos = pos;
+    return pos;
+}
+
+/** @brief Overlay read (see #filesystem_t::read) */
+static int __overlay_read( void *file, uint8_t *ptr, int len )
+{
+    overlay_file_t *f = file;
+
+    if( f->fs == overlay.lower )
+    {
+        return f->fs->read ? f->fs->read( f->handle, ptr, len ) : -1;
+    }
+
+    int total = 0;
+
+    while( len > 0 && f->pos < f->size )
+    {
+        /* Serve as much as possible from the cache */
+        if( f->pos >= f->cache_pos && f->pos < f->cache_pos + f->cache_len )
+        {
+            int n = f->cache_pos + f->cache_len - f->pos;
+            if( n > len ) { n = len; }
+
+            memcpy( ptr, f->cache + (f->pos - f->cache_pos), n );
+            ptr += n;
+            len -= n;
+            f->pos += n;
+            total += n;
+            continue;
+        }
+
+        if( f->fs_pos != f->pos )
+        {
+            if( f->fs->lseek( f->handle, f->pos, SEEK_SET ) < 0 )
+            {
+                break;
+            }
+            f->fs_pos = f->pos;
+        }
+
+        /* Large reads go straight into the caller buffer */
+        if( !f->cache || len >= overlay.cache_size )
+        {
+            int n = f->fs->read( f->handle, ptr, len );
+            if( n <= 0 ) { break; }
+
+            ptr += n;
+            len -= n;
+            f->pos += n;
+            f->fs_pos += n;
+            total += n;
+            continue;
+        }
+
+        int n = f->fs->read( f->handle, f->cache, overlay.cache_size );
+        if( n <= 0 ) { break; }
+
+        f->cache_pos = f->pos;
+        f->cache_len = n;
+        f->fs_pos += n;
+    }
+
+    return total;
+}
+
+/** @brief Overlay write (see #filesystem_t::write) */
+static int __overlay_write( void *file, uint8_t *ptr, int len )
+{
+    overlay_file_t *f = file;
+
+    /* Files in the overlay directory are read-only */
+    if( f->fs != overlay.lower || !f->fs->write )
+    {
+        return -1;
+    }
+
+    return f->fs->write( f->handle, ptr, len );
+}
+
+/** @brief Overlay close (see #filesystem_t::close) */
+static int __overlay_close( void *file )
+{
+    overlay_file_t *f = file;
+    int ret = f->fs->close ? f->fs->close( f->handle ) : 0;
+
+    free( f->cache );
+    free( f );
+    return ret;
+}
+
+/** @brief Overlay unlink (see #filesystem_t::unlink) */
+static int __overlay_unlink( char *name )
+{
+    return overlay.lower->unlink ? overlay.lower->unlink( name ) : -1;
+}
+
+/** @brief Overlay findfirst (see #filesystem_t::findfirst) */
+static int __overlay_findfirst( char *path, dir_t *dir )
+{
+    return overlay.lower->findfirst ? overlay.lower->findfirst( path, dir ) : -1;
+}
+
+/** @brief Overlay findnext (see #filesystem_t::findnext) */
+static int __overlay_findnext( dir_t *dir )
+{
+    return overlay.lower->findnext ? overlay.lower->findnext( dir ) : -1;
+}
+
+/** @brief Structure used for hooking the overlay into newlib */
+static filesystem_t overlay_fs = {
+    __overlay_open,
+    __overlay_fstat,
+    __overlay_lseek,
+    __overlay_read,
+    __overlay_write,
+    __overlay_close,
+    __overlay_unlink,
+    __overlay_findfirst,
+    __overlay_findnext
+};
+
+/**
+ * @brief Serve the files of a filesystem from a directory of another one
+ *
+ * After this call, files opened in read-only mode under prefix are looked up
+ * first in upper_dir, and then in the filesystem originally attached to
+ * prefix. Only one overlay can be attached at a time.
+ *
+ * @note Files of the original filesystem that are open when the overlay is
+ *       attached get closed.
+ *
+ * @param[in] prefix
+ *            Prefix of an attached filesystem (eg: "rom:/")
+ * @param[in] upper_dir
+ *            Directory of another attached filesystem, including its prefix
+ *            (eg: "sd:/assets")
+ * @param[in] cache_size
+ *            Size of the read cache of each file opened from upper_dir (eg:
+ *            #OVERLAYFS_DEFAULT_CACHE_SIZE)
+ *
+ * @retval -1 if the parameters were invalid or an overlay is already attached
+ * @retval -2 if one of the filesystems couldn't be found
+ * @retval -3 if there was not enough memory
+ * @retval 0 if the overlay was successfully attached
+ */
+int overlayfs_attach( const char * const prefix, const char * const upper_dir, int cache_size )
+{
+    if( overlay.prefix || !prefix || !upper_dir || cache_size <= 0 )
+    {
+        return -1;
+    }
+
+    /* Split the prefix of the overlay directory from its path */
+    const char *sep = strstr( upper_dir, ":/" );
+    if( !sep )
+    {
+        return -1;
+    }
+
+    int upper_prefix_len = sep + 2 - upper_dir;
+    char upper_prefix[upper_prefix_len + 1];
+    memcpy( upper_prefix, upper_dir, upper_prefix_len );
+    upper_prefix[upper_prefix_len] = 0;
+
+    filesystem_t *lower = get_filesystem( prefix );
+    filesystem_t *upper = get_filesystem( upper_prefix );
+    if( !lower || !upper || lower == &overlay_fs || !upper->open )
+    {
+        return -2;
+    }
+
+    /* Path of the directory within its filesystem, with a trailing slash */
+    const char *dir = upper_dir + upper_prefix_len;
+    int dir_len = strlen( dir );
+    overlay.upper_dir = malloc( dir_len + 2 );
+    overlay.prefix = strdup( prefix );
+    if( !overlay.upper_dir || !overlay.prefix )
+    {
+        free( overlay.upper_dir );
+        free( overlay.prefix );
+        overlay.upper_dir = overlay.prefix = 0;
+        return -3;
+    }
+
+    strcpy( overlay.upper_dir, dir );
+    if( dir_len > 0 && dir[dir_len - 1] != '/' )
+    {
+        strcat( overlay.upper_dir, "/" );
+    }
+
+    overlay.lower = lower;
+    overlay.upper = upper;
+    overlay.cache_size = cache_size;
+    overlay.num_stats = 0;
+
+    detach_filesystem( prefix );
+    attach_filesystem( prefix, &overlay_fs );
+    return 0;
+}
+
+/**
+ * @brief Detach the overlay attached by #overlayfs_attach
+ *
+ * The original filesystem is attached again to the prefix. Files opened
+ * through the overlay get closed.
+ *
+ * @retval -1 if no overlay is attached
+ * @retval 0 if the overlay was successfully detached
+ */
+int overlayfs_detach( void )
+{
+    if( !overlay.prefix )
+    {
+        return -1;
+    }
+
+    detach_filesystem( overlay.prefix );
+    attach_filesystem( overlay.prefix, overlay.lower );
+
+    for( int i = 0; i < OVERLAY_STAT_CACHE_SIZE; i++ )
+    {
+        free( overlay.stats[i].name );
+        overlay.stats[i].name = 0;
+    }
+
+    free( overlay.prefix );
+    free( overlay.upper_dir );
+    memset( &overlay, 0, sizeof(overlay) );
+    return 0;
+}
+
+/**
+ * @brief Forget the cached lookup of a file in the overlay directory
+ *
+ * The outcome of the lookups in the overlay directory is cached, so a file
+ * that is added to the overlay directory (or that changes size) after it has
+ * been opened once is not noticed. Call this function after changing such a
+ * file, so that the next open looks it up again. Files currently open are not
+ * affected.
+ *
+ * @param[in] name
+ *            Path of the file relative to the prefix (eg: "level1.dat"), or
+ *            NULL to forget the lookups of all files
+ */
+void overlayfs_invalidate( const char * const name )
+{
+    if( !overlay.prefix )
+    {
+        return;
+    }
+
+    if( !name )
+    {
+        for( int i = 0; i < OVERLAY_STAT_CACHE_SIZE; i++ )
+        {
+            overlay.stats[i].size = OVERLAY_SIZE_UNKNOWN;
+        }
+        return;
+    }
+
+    overlay_stat_t *st = __overlay_stat( name );
+    if( st )
+    {
+        st->size = OVERLAY_SIZE_UNKNOWN;
+    }
+}
+
+/** @} */ /* system */
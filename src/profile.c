@@ -0,0 +1,784 @@
+/**
+ * @file profile.c
+ * @brief Frame profiler
+ * @ingroup profile
+ */
+#include <string.h>
+#include <stdlib.h>
+#include "libdragon.h"
+#include "usb.h"
+
+/**
+ * @defgroup profile Frame profiler
+ * @ingroup libdragon
+ * @brief Per-frame statistics of the CPU, RSP and RDP.
+ *
+ * The profiler tells whether a frame is bound by the CPU, the RSP or the RDP.
+ * After #profile_init, it time-stamps every RSP task run through #rsp_task_submit,
+ * and samples the RDP performance counters (clock, command buffer busy, pipeline busy
+ * and TMEM busy) each time the RDP completes a full sync (see #rdp_sync), for
+ * instance in #rdp_detach_display.  Call #profile_next_frame once per frame to
+ * collect the statistics of the frame that just ended, and optionally #profile_draw to
+ * show them as an on-screen bar graph.
+ *
+ * The RDP counters are 24-bit counters of RCP cycles: full syncs must be less than a
+ * quarter of second apart for them to be accurate.
+ *
+ * The CPU time of the frame can be broken down by marking blocks of code with
+ * #PROFILE_SCOPE: the start and duration of each scope are recorded in a RAM
+ * buffer, and returned with the statistics of the frame.  #profile_export_usb
+ * sends a frame through USB in a compact binary format (see #profile_export),
+ * that the profile2json tool converts to the Chrome trace format, for viewing in
+ * chrome://tracing or Perfetto.
+ *
+ * To find hot spots without instrumenting the code, #profile_sampling_start
+ * samples the program counter of the interrupted code at a fixed rate, from a
+ * timer interrupt, into a histogram of the text section.  #profile_sampling_export_usb
+ * sends the histogram through USB, and the profsym tool attributes the samples to
+ * the functions of the ELF file.
+ *
+ * Stalls caused by DMA engines competing for RDRAM can be found with
+ * #profile_bus_start, which samples from a timer interrupt whether the PI, the
+ * SI, the SP DMA and the RDP are busy, and adds a per-frame utilization
+ * breakdown to the statistics of #profile_next_frame.
+ *
+ * @{
+ */
+
+/** @brief RDP clock counter */
+#define DP_CLOCK      (((volatile uint32_t *)0xA4100000)[4])
+/** @brief RDP command buffer busy counter */
+#define DP_BUFBUSY    (((volatile uint32_t *)0xA4100000)[5])
+/** @brief RDP pipeline busy counter */
+#define DP_PIPEBUSY   (((volatile uint32_t *)0xA4100000)[6])
+/** @brief RDP TMEM busy counter */
+#define DP_TMEM       (((volatile uint32_t *)0xA4100000)[7])
+/** @brief RDP status register (DP_STATUS) */
+#define DP_STATUS     (((volatile uint32_t *)0xA4100000)[3])
+
+/** @brief PI status register */
+#define PI_STATUS     (((volatile uint32_t *)0xA4600000)[4])
+/** @brief SI status register */
+#define SI_STATUS     (((volatile uint32_t *)0xA4800000)[6])
+
+/** @brief PI_STATUS / SI_STATUS: a DMA or an I/O access is in progress */
+#define XI_STATUS_BUSY              0x3
+/** @brief DP_STATUS: the RDP pipeline is busy */
+#define DP_STATUS_PIPE_BUSY         0x20
+/** @brief DP_STATUS: the RDP command buffer is busy */
+#define DP_STATUS_CMD_BUSY          0x40
+
+/** @brief DP_STATUS write: clear the TMEM, pipeline, command buffer and clock counters */
+#define DP_WSTATUS_CLEAR_COUNTERS   0x3C0
+/** @brief Mask of the bits of the RDP counters */
+#define DP_COUNTER_MASK             0xFFFFFF
+
+/** @brief Minimum of two values */
+#define MIN(a,b)        ({ typeof(a) _a = a; typeof(b) _b = b; _a < _b ? _a : _b; })
+/** @brief Round n up to the next multiple of d */
+#define ROUND_UP(n, d)  (((n) + (d) - 1) / (d) * (d))
+
+/** @brief True if the profiler is running */
+static volatile bool profiling = false;
+/** @brief Statistics of the current frame */
+static profile_frame_t current;
+/** @brief Tick when the current frame started */
+static uint32_t frame_start = 0;
+/** @brief Scopes of the current and of the previous frame */
+static profile_scope_t scopes[2][PROFILE_MAX_SCOPES];
+/** @brief Buffer of #scopes being filled by the current frame */
+static int scope_buf = 0;
+/** @brief Number of scopes currently open */
+static uint32_t scope_depth = 0;
+
+/** @brief Bit set in scope handles that refer to the second buffer of #scopes */
+#define SCOPE_BUF_BIT       0x10000
+/** @brief Mask of the index in a scope handle */
+#define SCOPE_INDEX_MASK    0xFFFF
+
+/** @brief Size of the header of an exported frame */
+#define EXPORT_HEADER_SIZE  24
+/** @brief Size of the header of exported samples */
+#define SAMPLING_HEADER_SIZE    28
+
+/** @brief Registers saved by the interrupt handler (see inthandler.S) */
+extern const void* __baseRegAddr;
+/** @brief Start of the text section (see n64.ld) */
+extern char __text_start[];
+/** @brief End of the text section (see n64.ld) */
+extern char __text_end[];
+
+/** @brief Timer taking the samples, or NULL if sampling is stopped */
+static timer_link_t *sample_timer = NULL;
+/** @brief Sample rate in Hz */
+static int sample_rate = 0;
+/** @brief Histogram of the samples, one bucket per (1 << sample_shift) bytes of text */
+static uint32_t *sample_buckets = NULL;
+/** @brief Number of buckets of the histogram */
+static int sample_num_buckets = 0;
+/** @brief Log2 of the size in bytes of a bucket */
+static int sample_shift = 0;
+/** @brief Number of samples taken */
+static volatile uint32_t sample_total = 0;
+/** @brief Number of samples outside of the text section */
+static volatile uint32_t sample_outside = 0;
+
+/** @brief Timer sampling the status of the buses, or NULL if the bus monitor is stopped */
+static timer_link_t *bus_timer = NULL;
+
+/**
+ * @brief Open a scope
+ *
+ * Called by #PROFILE_SCOPE.
+ *
+ * @param[in] name
+ *            Name of the scope
+ *
+ * @return Handle of the scope to pass to #__profile_scope_end, or -1 if the profiler is not running
+ */
+int __profile_scope_begin( const char *name )
+{
+    if( !profiling ) { return -1; }
+
+    uint32_t index = current.num_scopes++;
+    int handle = scope_buf ? SCOPE_BUF_BIT : 0;
+
+    scope_depth++;
+
+    /* Scopes beyond the buffer are counted, but not recorded */
+    if( index >= PROFILE_MAX_SCOPES ) { return handle | PROFILE_MAX_SCOPES; }
+
+    profile_scope_t *scope = &scopes[scope_buf][index];
+    scope->name = name;
+    scope->depth = scope_depth - 1;
+    scope->ticks = 0;
+    scope->start = TICKS_READ() - frame_start;
+
+    return handle | index;
+}
+
+/**
+ * @brief Close a scope
+ *
+ * Called at the end of the block of #PROFILE_SCOPE.
+ *
+ * @param[in] scope
+ *            Pointer to the handle returned by #__profile_scope_begin
+ */
+void __profile_scope_end( int *scope )
+{
+    if( *scope < 0 ) { return; }
+
+    uint32_t now = TICKS_READ();
+    int index = *scope & SCOPE_INDEX_MASK;
+
+    if( scope_depth ) { scope_depth--; }
+
+    /* Scopes still open at the end of their frame keep a duration of 0 */
+    if( index < PROFILE_MAX_SCOPES && (*scope & SCOPE_BUF_BIT ? 1 : 0) == scope_buf )
+    {
+        profile_scope_t *s = &scopes[scope_buf][index];
+        s->ticks = now - frame_start - s->start;
+    }
+}
+
+/**
+ * @brief Sample the RDP counters after a full sync
+ *
+ * Called by the RDP interrupt handler.
+ */
+void __profile_rdp_sync( void )
+{
+    if( !profiling ) { return; }
+
+    current.rdp_syncs++;
+    current.rdp_clock += DP_CLOCK & DP_COUNTER_MASK;
+    current.rdp_buffer_busy += DP_BUFBUSY & DP_COUNTER_MASK;
+    current.rdp_pipe_busy += DP_PIPEBUSY & DP_COUNTER_MASK;
+    current.rdp_tmem_busy += DP_TMEM & DP_COUNTER_MASK;
+
+    /* Count the next sync from here */
+    DP_STATUS = DP_WSTATUS_CLEAR_COUNTERS;
+}
+
+/**
+ * @brief Record an RSP task that completed
+ *
+ * Called by the RSP task queue, usually from the SP interrupt handler.
+ *
+ * @param[in] start_tick
+ *            Tick when the task was started
+ * @param[in] ticks
+ *            Duration of the task in ticks
+ */
+void __profile_rsp_task( uint32_t start_tick, uint32_t ticks )
+{
+    if( !profiling ) { return; }
+
+    if( current.num_rsp_tasks < PROFILE_MAX_RSP_TASKS )
+    {
+        current.rsp_tasks[current.num_rsp_tasks].start = start_tick - frame_start;
+        current.rsp_tasks[current.num_rsp_tasks].ticks = ticks;
+    }
+
+    current.num_rsp_tasks++;
+    current.rsp_ticks += ticks;
+}
+
+/**
+ * @brief Start profiling
+ *
+ * The first frame starts now.
+ */
+void profile_init( void )
+{
+    disable_interrupts();
+
+    memset( &current, 0, sizeof(current) );
+    frame_start = TICKS_READ();
+    scope_depth = 0;
+    DP_STATUS = DP_WSTATUS_CLEAR_COUNTERS;
+    profiling = true;
+
+    enable_interrupts();
+}
+
+/**
+ * @brief Stop profiling
+ */
+void profile_close( void )
+{
+    profiling = false;
+}
+
+/**
+ * @brief End the current frame and start the next one
+ *
+ * Call this once per frame, at the same point of the main loop (for instance, right
+ * before #display_lock).  The scopes of the frame stay valid until the next call.
+ *
+ * @param[out] frame
+ *             Structure to fill with the statistics of the frame that just ended
+ */
+void profile_next_frame( profile_frame_t *frame )
+{
+    disable_interrupts();
+
+    uint32_t now = TICKS_READ();
+
+    *frame = current;
+    frame->frame_ticks = now - frame_start;
+    frame->scopes = scopes[scope_buf];
+
+    memset( &current, 0, sizeof(current) );
+    frame_start = now;
+    scope_buf ^= 1;
+
+    enable_interrupts();
+}
+
+/**
+ * @brief Draw a bar of the graph drawn by #profile_draw
+ *
+ * @param[in] disp
+ *            Display context to draw on
+ * @param[in] x
+ *            Pixel X location of the left of the bar
+ * @param[in] y
+ *            Pixel Y location of the top of the bar
+ * @param[in] ticks
+ *            Time measured
+ * @param[in] budget
+ *            Time of a whole frame, drawn as the whole width of the graph
+ * @param[in] color
+ *            Color of the bar within the budget
+ */
+static void __profile_draw_bar( display_context_t disp, int x, int y, uint32_t ticks, uint32_t budget, uint32_t color )
+{
+    int width = (uint64_t)ticks * 128 / budget;
+
+    if( width > 128 )
+    {
+        /* Over budget */
+        width = 128;
+        color = graphics_make_color( 0xFF, 0x20, 0x20, 0xFF );
+    }
+
+    if( width > 0 ) { graphics_draw_box( disp, x, y, width, 6, color ); }
+}
+
+/**
+ * @brief Draw the statistics of a frame as a bar graph
+ *
+ * The graph is 160x36 pixels.  It has a bar for the length of the frame (CPU), for
+ * the time spent running RSP tasks, and for the time the RDP pipeline was busy.  The
+ * whole width of a bar is one frame at the refresh rate of the TV (50 or 60 Hz): the
+ * longest bar shows which processor limits the frame rate.
+ *
+ * This uses the graphics functions, so the graph is drawn by the RDP if the graphics
+ * backend is #GRAPHICS_BACKEND_RDP.  The text color is changed to draw the labels.
+ *
+ * @param[in] disp
+ *            Display context to draw on
+ * @param[in] x
+ *            Pixel X location of the top left of the graph
+ * @param[in] y
+ *            Pixel Y location of the top left of the graph
+ * @param[in] frame
+ *            Statistics of the frame, as returned by #profile_next_frame
+ */
+void profile_draw( display_context_t disp, int x, int y, const profile_frame_t *frame )
+{
+    uint32_t budget = TICKS_PER_SECOND / ((get_tv_type() == TV_PAL) ? 50 : 60);
+
+    graphics_draw_box( disp, x, y, 160, 36, graphics_make_color( 0x00, 0x00, 0x00, 0xFF ) );
+    graphics_set_color( graphics_make_color( 0xFF, 0xFF, 0xFF, 0xFF ), 0 );
+
+    graphics_draw_text( disp, x + 2, y + 2, "CPU" );
+    graphics_draw_text( disp, x + 2, y + 13, "RSP" );
+    graphics_draw_text( disp, x + 2, y + 24, "RDP" );
+
+    __profile_draw_bar( disp, x + 30, y + 3, frame->frame_ticks, budget, graphics_make_color( 0x20, 0xC0, 0x20, 0xFF ) );
+    __profile_draw_bar( disp, x + 30, y + 14, frame->rsp_ticks, budget, graphics_make_color( 0x20, 0x80, 0xFF, 0xFF ) );
+    __profile_draw_bar( disp, x + 30, y + 25, PROFILE_RCP_TO_TICKS( frame->rdp_pipe_busy ), budget, graphics_make_color( 0xFF, 0xC0, 0x20, 0xFF ) );
+}
+
+/**
+ * @brief Store a 16-bit big-endian value of an exported frame
+ *
+ * @param[in] p
+ *            Pointer to the buffer (not necessarily aligned)
+ * @param[in] value
+ *            Value to store
+ *
+ * @return Pointer past the stored value
+ */
+static uint8_t *__profile_put16( uint8_t *p, uint32_t value )
+{
+    p[0] = value >> 8;
+    p[1] = value;
+    return p + 2;
+}
+
+/**
+ * @brief Store a 32-bit big-endian value of an exported frame
+ *
+ * @param[in] p
+ *            Pointer to the buffer (not necessarily aligned)
+ * @param[in] value
+ *            Value to store
+ *
+ * @return Pointer past the stored value
+ */
+static uint8_t *__profile_put32( uint8_t *p, uint32_t value )
+{
+    return __profile_put16( __profile_put16( p, value >> 16 ), value & 0xFFFF );
+}
+
+/**
+ * @brief Export the statistics of a frame in a compact binary format
+ *
+ * All values are big-endian:
+ *
+ *   - header: uint32 #PROFILE_EXPORT_MAGIC, uint32 frame ticks, uint32 RSP ticks,
+ *     uint32 RDP pipeline busy (converted to CPU ticks), uint16 number of RSP tasks,
+ *     uint16 number of names, uint16 number of scopes, uint16 padding
+ *   - RSP tasks: uint32 start, uint32 ticks
+ *   - names: uint8 length, followed by the characters, without terminator; the
+ *     table is padded to a multiple of 4 bytes
+ *   - scopes: uint16 name index, uint16 depth, uint32 start, uint32 ticks
+ *
+ * Many frames can be concatenated in a single file: the tools/profile2json tool
+ * lays them out one after another when converting them.
+ *
+ * @param[in]  frame
+ *             Statistics of the frame, as returned by #profile_next_frame
+ * @param[out] buf
+ *             Buffer to write to, or NULL to only compute the size
+ * @param[in]  size
+ *             Size of the buffer in bytes
+ *
+ * @return The size of the exported frame in bytes, or -1 if it does not fit the buffer
+ */
+int profile_export( const profile_frame_t *frame, void *buf, int size )
+{
+    int num_rsp_tasks = MIN( (int)frame->num_rsp_tasks, PROFILE_MAX_RSP_TASKS );
+    int num_scopes = frame->scopes ? MIN( (int)frame->num_scopes, PROFILE_MAX_SCOPES ) : 0;
+    const char *names[PROFILE_MAX_SCOPES];
+    uint16_t name_index[PROFILE_MAX_SCOPES];
+    int num_names = 0;
+    int names_size = 0;
+
+    /* Scopes are named by string literals, so identical names usually share a pointer */
+    for( int i = 0; i < num_scopes; i++ )
+    {
+        int j;
+
+        for( j = 0; j < num_names; j++ )
+        {
+            if( names[j] == frame->scopes[i].name ) { break; }
+        }
+
+        if( j == num_names )
+        {
+            names[num_names++] = frame->scopes[i].name;
+            names_size += 1 + MIN( (int)strlen( frame->scopes[i].name ), 255 );
+        }
+
+        name_index[i] = j;
+    }
+
+    int total = EXPORT_HEADER_SIZE + num_rsp_tasks * 8 + ROUND_UP( names_size, 4 ) + num_scopes * 12;
+
+    if( !buf ) { return total; }
+    if( size < total ) { return -1; }
+
+    uint8_t *p = buf;
+
+    p = __profile_put32( p, PROFILE_EXPORT_MAGIC );
+    p = __profile_put32( p, frame->frame_ticks );
+    p = __profile_put32( p, frame->rsp_ticks );
+    p = __profile_put32( p, PROFILE_RCP_TO_TICKS( frame->rdp_pipe_busy ) );
+    p = __profile_put16( p, num_rsp_tasks );
+    p = __profile_put16( p, num_names );
+    p = __profile_put16( p, num_scopes );
+    p = __profile_put16( p, 0 );
+
+    for( int i = 0; i < num_rsp_tasks; i++ )
+    {
+        p = __profile_put32( p, frame->rsp_tasks[i].start );
+        p = __profile_put32( p, frame->rsp_tasks[i].ticks );
+    }
+
+    for( int i = 0; i < num_names; i++ )
+    {
+        int len = MIN( (int)strlen( names[i] ), 255 );
+
+        *p++ = len;
+        memcpy( p, names[i], len );
+        p += len;
+    }
+
+    for( int i = names_size; i < ROUND_UP( names_size, 4 ); i++ ) { *p++ = 0; }
+
+    for( int i = 0; i < num_scopes; i++ )
+    {
+        p = __profile_put16( p, name_index[i] );
+        p = __profile_put16( p, frame->scopes[i].depth );
+        p = __profile_put32( p, frame->scopes[i].start );
+        p = __profile_put32( p, frame->scopes[i].ticks );
+    }
+
+    return total;
+}
+
+/**
+ * @brief Send exported data through USB as binary data
+ *
+ * @param[in] buf
+ *            Data to send
+ * @param[in] size
+ *            Size of the data in bytes
+ *
+ * @return true if the data was sent, false if there is no USB cart
+ */
+static bool __profile_usb_write( const void *buf, int size )
+{
+    static bool usb_init = false;
+    static bool usb_ok = false;
+
+    if( !usb_init )
+    {
+        usb_init = true;
+        usb_ok = usb_getcart() != CART_NONE || usb_initialize();
+    }
+
+    if( !usb_ok ) { return false; }
+
+    usb_write( DATATYPE_RAWBINARY, buf, size );
+
+    return true;
+}
+
+/**
+ * @brief Send the statistics of a frame through USB
+ *
+ * The frame is exported with #profile_export and sent as binary data to
+ * UNFLoader on the PC, which saves it to a file.  Frames are sent synchronously,
+ * so this takes a small part of the next frame: export one frame every few, or
+ * only the frames that go over budget.
+ *
+ * @param[in] frame
+ *            Statistics of the frame, as returned by #profile_next_frame
+ *
+ * @return true if the frame was sent, false if there is no USB cart or not enough memory
+ */
+bool profile_export_usb( const profile_frame_t *frame )
+{
+    int size = profile_export( frame, NULL, 0 );
+    void *buf = malloc( size );
+
+    if( !buf ) { return false; }
+
+    profile_export( frame, buf, size );
+
+    bool ok = __profile_usb_write( buf, size );
+    free( buf );
+
+    return ok;
+}
+
+/**
+ * @brief Take a sample of the interrupted program counter
+ *
+ * Called by the sampling timer, under interrupt.
+ *
+ * @param[in] ovfl
+ *            Ticks elapsed since the timer expired (unused)
+ */
+static void __profile_sample( int ovfl )
+{
+    uint32_t pc = ((reg_block_t*)&__baseRegAddr)->epc;
+
+    sample_total++;
+
+    if( pc >= (uint32_t)__text_start && pc < (uint32_t)__text_end )
+    {
+        sample_buckets[(pc - (uint32_t)__text_start) >> sample_shift]++;
+    }
+    else
+    {
+        sample_outside++;
+    }
+}
+
+/**
+ * @brief Start sampling the program counter
+ *
+ * A timer interrupt samples the address of the code it interrupted and counts
+ * it in a histogram of the text section.  The histogram has at most num_buckets
+ * buckets, each covering the same power of two number of bytes: 4 bytes per bucket
+ * gives a per-instruction histogram, while larger buckets use less memory and
+ * are usually enough to tell the functions apart (they are 32-byte aligned).
+ *
+ * Code that runs with interrupts disabled cannot be sampled: its time is counted
+ * where interrupts are enabled again.  Interrupt handlers are not sampled either.
+ *
+ * The timer subsystem must be initialized (see #timer_init).
+ *
+ * @param[in] rate_hz
+ *            Number of samples per second
+ * @param[in] num_buckets
+ *            Maximum number of buckets of the histogram
+ *
+ * @return true if sampling started, false if the histogram could not be allocated
+ */
+bool profile_sampling_start( int rate_hz, int num_buckets )
+{
+    uint32_t text_size = __text_end - __text_start;
+
+    assertf( rate_hz > 0 && rate_hz <= 100000, "invalid sample rate: %d", rate_hz );
+    assertf( num_buckets > 0, "invalid number of buckets: %d", num_buckets );
+
+    profile_sampling_stop();
+
+    /* Smallest bucket size that covers the whole text section */
+    sample_shift = 2;
+    while( (text_size >> sample_shift) >= num_buckets ) { sample_shift++; }
+    sample_num_buckets = (text_size >> sample_shift) + 1;
+
+    sample_buckets = calloc( sample_num_buckets, sizeof(uint32_t) );
+    if( !sample_buckets ) { return false; }
+
+    sample_total = 0;
+    sample_outside = 0;
+    sample_rate = rate_hz;
+    sample_timer = new_timer( TICKS_PER_SECOND / rate_hz, TF_CONTINUOUS, __profile_sample );
+
+    return true;
+}
+
+/**
+ * @brief Stop sampling the program counter and free the histogram
+ */
+void profile_sampling_stop( void )
+{
+    if( sample_timer )
+    {
+        delete_timer( sample_timer );
+        sample_timer = NULL;
+    }
+
+    free( sample_buckets );
+    sample_buckets = NULL;
+    sample_num_buckets = 0;
+}
+
+/**
+ * @brief Clear the histogram of the samples, to profile a new part of the program
+ */
+void profile_sampling_reset( void )
+{
+    disable_interrupts();
+
+    if( sample_buckets ) { memset( sample_buckets, 0, sample_num_buckets * sizeof(uint32_t) ); }
+    sample_total = 0;
+    sample_outside = 0;
+
+    enable_interrupts();
+}
+
+/**
+ * @brief Return the number of samples taken since sampling started or was reset
+ */
+uint32_t profile_sampling_count( void )
+{
+    return sample_total;
+}
+
+/**
+ * @brief Export the histogram of the samples in a compact binary format
+ *
+ * Only the buckets with samples are written.  All values are big-endian:
+ *
+ *   - header: uint32 #PROFILE_SAMPLING_MAGIC, uint32 sample rate in Hz, uint32 start
+ *     of the text section, uint32 log2 of the bucket size, uint32 number of samples,
+ *     uint32 number of samples outside of the text section, uint32 number of buckets
+ *   - buckets: uint32 address of the start of the bucket, uint32 number of samples
+ *
+ * @param[out] buf
+ *             Buffer to write to, or NULL to only compute the size
+ * @param[in]  size
+ *             Size of the buffer in bytes
+ *
+ * @return The size of the exported samples in bytes, or -1 if they do not fit the buffer
+ */
+int profile_sampling_export( void *buf, int size )
+{
+    int num_entries = 0;
+
+    for( int i = 0; i < sample_num_buckets; i++ )
+    {
+        if( sample_buckets[i] ) { num_entries++; }
+    }
+
+    int total = SAMPLING_HEADER_SIZE + num_entries * 8;
+
+    if( !buf ) { return total; }
+    if( size < total ) { return -1; }
+
+    uint8_t *p = buf;
+
+    /* Samples keep coming in: only the buckets counted above are written */
+    p = __profile_put32( p, PROFILE_SAMPLING_MAGIC );
+    p = __profile_put32( p, sample_rate );
+    p = __profile_put32( p, (uint32_t)__text_start );
+    p = __profile_put32( p, sample_shift );
+    p = __profile_put32( p, sample_total );
+    p = __profile_put32( p, sample_outside );
+    p = __profile_put32( p, num_entries );
+
+    for( int i = 0; i < sample_num_buckets && num_entries > 0; i++ )
+    {
+        uint32_t count = sample_buckets[i];
+
+        if( !count ) { continue; }
+
+        p = __profile_put32( p, (uint32_t)__text_start + (i << sample_shift) );
+        p = __profile_put32( p, count );
+        num_entries--;
+    }
+
+    /* Pad with empty buckets if the histogram was reset meanwhile */
+    while( num_entries-- > 0 )
+    {
+        p = __profile_put32( p, (uint32_t)__text_start );
+        p = __profile_put32( p, 0 );
+    }
+
+    return total;
+}
+
+/**
+ * @brief Send the histogram of the samples through USB
+ *
+ * See #profile_sampling_export for the format.  Sampling continues meanwhile.
+ *
+ * @return true if the samples were sent, false if there is no USB cart or not enough memory
+ */
+bool profile_sampling_export_usb( void )
+{
+    int size = profile_sampling_export( NULL, 0 );
+    void *buf = malloc( size );
+
+    if( !buf ) { return false; }
+
+    profile_sampling_export( buf, size );
+
+    bool ok = __profile_usb_write( buf, size );
+    free( buf );
+
+    return ok;
+}
+
+/**
+ * @brief Sample the status of the buses
+ *
+ * Called by the bus monitor timer, under interrupt.
+ *
+ * @param[in] ovfl
+ *            Ticks elapsed since the timer expired (unused)
+ */
+static void __profile_bus_sample( int ovfl )
+{
+    uint32_t pi = PI_STATUS;
+    uint32_t si = SI_STATUS;
+    uint32_t sp = *SP_STATUS;
+    uint32_t dp = DP_STATUS;
+
+    current.bus_samples++;
+    current.pi_busy += (pi & XI_STATUS_BUSY) != 0;
+    current.si_busy += (si & XI_STATUS_BUSY) != 0;
+    current.sp_dma_busy += (sp & SP_STATUS_DMA_BUSY) != 0;
+    current.rdp_busy += (dp & (DP_STATUS_PIPE_BUSY | DP_STATUS_CMD_BUSY)) != 0;
+}
+
+/**
+ * @brief Start monitoring the utilization of the buses
+ *
+ * A timer interrupt samples the status registers of the PI, the SI, the SP DMA
+ * and the RDP, and counts the samples during which each of them was busy in the
+ * statistics returned by #profile_next_frame: the ratio to the number of
+ * samples is the fraction of the frame the bus was busy (see #PROFILE_BUS_PERCENT).
+ * When a frame is slow while a bus is busy most of the time, the transfers on that
+ * bus are the ones to rebalance (eg: streaming less from ROM, or splitting RSP DMAs).
+ *
+ * A few thousand samples per second are enough for a breakdown at the percent
+ * level; each sample costs four uncached register reads plus the interrupt.
+ *
+ * The timer subsystem must be initialized (see #timer_init).
+ *
+ * @param[in] rate_hz
+ *            Number of samples per second
+ */
+void profile_bus_start( int rate_hz )
+{
+    assertf( rate_hz > 0 && rate_hz <= 100000, "invalid sample rate: %d", rate_hz );
+
+    profile_bus_stop();
+    bus_timer = new_timer( TICKS_PER_SECOND / rate_hz, TF_CONTINUOUS, __profile_bus_sample );
+}
+
+/**
+ * @brief Stop monitoring the utilization of the buses
+ */
+void profile_bus_stop( void )
+{
+    if( bus_timer )
+    {
+        delete_timer( bus_timer );
+        bus_timer = NULL;
+    }
+}
+
+/** @} */ /* profile */
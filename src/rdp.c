@@ -5,8 +5,12 @@
  */
 #include <stdint.h>
 #include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include "libdragon.h"
+#include "font.h"
+#include "system.h"
 
 /**
  * @defgroup rdp Hardware Display Interface
@@ -61,19 +65,43 @@
  */
 #define __get_buffer( x ) __safe_buffer[(x)-1]
 
-/** @brief Size of the internal ringbuffer that holds pending RDP commands */
-#define RINGBUFFER_SIZE  4096
+/** @brief Size of the default ringbuffer that holds pending RDP commands */
+#define RINGBUFFER_SIZE  8192
 
 /** 
  * @brief Size of the slack are of the ring buffer
  *
  * Data can be written into the slack area of the ring buffer by functions creating RDP commands.
  * However, when sending a completed command to the RDP, if the buffer has advanced into the slack,
- * it will be cleared and the pointer reset to start.  This is to stop any commands from being
- * split in the middle during wraparound.
+ * the commands are submitted and the next ones are written from the start of the buffer (while the
+ * RDP might still be reading the end).  This is to stop any commands from being split in the middle
+ * during wraparound.
  */
 #define RINGBUFFER_SLACK 1024
 
+/** @brief RDP command start register (DP_START) */
+#define DP_START    (((volatile uint32_t *)0xA4100000)[0])
+/** @brief RDP command end register (DP_END) */
+#define DP_END      (((volatile uint32_t *)0xA4100000)[1])
+/** @brief RDP command current register (DP_CURRENT) */
+#define DP_CURRENT  (((volatile uint32_t *)0xA4100000)[2])
+/** @brief RDP status register (DP_STATUS) */
+#define DP_STATUS   (((volatile uint32_t *)0xA4100000)[3])
+
+/** @brief DP_STATUS: a DP_START write is pending */
+#define DP_STATUS_START_VALID  0x400
+/** @brief DP_STATUS: a DP_END write is pending */
+#define DP_STATUS_END_VALID    0x200
+/** @brief DP_STATUS: write to clear the TMEM, pipe, command buffer and clock counters */
+#define DP_STATUS_CLR_COUNTERS 0x3C0
+
+/** @brief RDP command buffer busy counter (DP_BUFBUSY), in RCP cycles */
+#define DP_BUFBUSY  (((volatile uint32_t *)0xA4100000)[5])
+/** @brief Mask of the valid bits of the RDP counters, which are 24-bit wide */
+#define DP_COUNTER_MASK        0xFFFFFF
+/** @brief Frequency of the RCP, which clocks the RDP counters */
+#define RCP_FREQUENCY          62500000
+
 /**
  * @brief Cached sprite structure
  * */
@@ -96,14 +124,39 @@ typedef struct
 extern uint32_t __bitdepth;
 extern uint32_t __width;
 extern uint32_t __height;
+extern uint32_t __buffers;
 extern void *__safe_buffer[];
+extern void __profile_rdp_sync( void );
 
+/** @brief Default ringbuffer, used unless another one is set with #rdp_set_command_buffer */
+static uint32_t rdp_default_ringbuffer[RINGBUFFER_SIZE / 4] __attribute__((aligned(8)));
 /** @brief Ringbuffer where partially assembled commands will be placed before sending to the RDP */
-static uint32_t rdp_ringbuffer[RINGBUFFER_SIZE / 4];
-/** @brief Start of the command in the ringbuffer */
+static uint32_t *rdp_ringbuffer = rdp_default_ringbuffer;
+/** @brief Size of the ringbuffer in bytes */
+static uint32_t rdp_ringbuffer_size = RINGBUFFER_SIZE;
+/** @brief Start of the commands in the ringbuffer not yet submitted to the RDP */
 static uint32_t rdp_start = 0;
 /** @brief End of the command in the ringbuffer */
 static uint32_t rdp_end = 0;
+/** @brief True if the next submission must program DP_START (otherwise, only DP_END is moved) */
+static bool rdp_restart = true;
+/** @brief End of the previous lap of the ringbuffer, which the RDP might still be reading (0 if none) */
+static uint32_t rdp_lap_end = 0;
+
+/** @brief Display list being recorded (NULL if none) */
+static rdp_display_list_t *recording_list = 0;
+/** @brief True if the display list being recorded ran out of space */
+static bool recording_overflow = false;
+/** @brief State of the ring buffer saved while recording a display list */
+static struct
+{
+    uint32_t *buffer;
+    uint32_t size, start, end, lap_end;
+    bool restart;
+} recording_ring;
+
+/** @brief The current command submission strategy */
+static submit_t submit_strategy = SUBMIT_STRATEGY_IMMEDIATE;
 
 /** @brief The current cache flushing strategy */
 static flush_t flush_strategy = FLUSH_STRATEGY_AUTOMATIC;
@@ -111,19 +164,147 @@ static flush_t flush_strategy = FLUSH_STRATEGY_AUTOMATIC;
 /** @brief Interrupt wait flag */
 static volatile uint32_t wait_intr = 0;
 
+/** @brief True if textures are looked up in the palette (see #rdp_enable_palette) */
+static bool palette_enabled = false;
+
+/** @brief Display context the RDP is attached to (0 if none) */
+static display_context_t attached_display = 0;
+
+/** @brief Z-buffer attached with #rdp_attach_zbuffer, cleared by #rdp_clear (0 if none) */
+static void *attached_zbuffer = 0;
+
+/** @brief True once a clipping boundary has been set with #rdp_set_clipping */
+static bool clipping_set = false;
+
+/** @brief Farthest depth, to which #rdp_clear sets the Z-buffer */
+#define ZBUFFER_FAR  0xFFFC
+
 /** @brief Array of cached textures in RDP TMEM indexed by the RDP texture slot */
 static sprite_cache cache[8];
 
+/** @brief Size of the RDP texture memory (TMEM) in bytes */
+#define TMEM_SIZE  4096
+
+/**
+ * @brief Texture resident in TMEM, managed by the texture cache
+ *
+ * The texture cache uses one texture slot per texture, so its entries are
+ * indexed by texture slot like #cache.
+ */
+typedef struct
+{
+    /** @brief Sprite the texture was loaded from (NULL if the entry is free) */
+    sprite_t *sprite;
+    /** @brief Slice of the sprite (see #rdp_load_texture_stride), or -1 for the whole sprite */
+    int offset;
+    /** @brief True if the texture was loaded with mirroring enabled */
+    bool mirror;
+    /** @brief True if the texture relies on its palette being loaded in TMEM */
+    bool palette;
+    /** @brief Start of the TMEM range used by the texture */
+    uint16_t tmem_start;
+    /** @brief End of the TMEM range used by the texture (exclusive) */
+    uint16_t tmem_end;
+    /** @brief Value of #texcache_clock when the texture was last used */
+    uint32_t last_use;
+} texcache_entry_t;
+
+/** @brief Textures managed by the texture cache, indexed by texture slot */
+static texcache_entry_t texcache[8];
+/** @brief Counter of texture cache lookups, used to find the least recently used texture */
+static uint32_t texcache_clock = 0;
+/** @brief Texture cache statistics */
+static rdp_texture_cache_stats_t texcache_stats;
+
+/** @brief Sprite batch being sorted by #rdp_draw_sprite_batch */
+static const rdp_sprite_t *batch_sprites;
+
+/** @brief Scratch memory of #rdp_draw_sprite_batch, reset by each call */
+static arena_t batch_arena;
+
+/** @brief Number of glyphs in a page of the font atlas (a page fills TMEM) */
+#define FONT_PAGE_GLYPHS  128
+/** @brief Size of a page of the font atlas in bytes: 16x8 glyphs of 8x8 I4 pixels */
+#define FONT_PAGE_SIZE    (FONT_PAGE_GLYPHS * 8 * 8 / 2)
+/** @brief Texture slot used to load the font atlas */
+#define FONT_LOAD_SLOT    7
+/** @brief Texture slot used to draw text */
+#define FONT_TEXSLOT      6
+
+/** @brief Font atlas built from the built-in font, as I4 textures (allocated on first use) */
+static uint8_t *font_atlas = 0;
+/** @brief Page of the font atlas currently loaded in TMEM (-1 if none) */
+static int font_page = -1;
+
+/** @brief Sprite atlas with a page currently loaded in TMEM (NULL if none) */
+static const rdp_atlas_t *resident_atlas = 0;
+/** @brief Page of #resident_atlas currently loaded in TMEM */
+static int resident_page = -1;
+
+_Static_assert(sizeof(rdp_atlas_entry_t) == 32, "atlas entries must match the mkatlas file format");
+
+/**
+ * @brief RSP geometry ucode (rsp_geom.S)
+ */
+DEFINE_RSP_UCODE(rsp_geom);
+
+/**
+ * @brief Input of the geometry ucode, copied into DMEM when the task starts
+ *
+ * NOTE: keep this in sync with rsp_geom.S
+ */
+typedef struct
+{
+    /** @brief Integer (first four rows) and fractional parts of the matrix, one row per input coordinate */
+    int16_t matrix[8][8];
+    /** @brief Physical address of the vertices */
+    uint32_t vertices;
+    /** @brief Number of vertices */
+    uint32_t num_vertices;
+    /** @brief Physical address of the vertex indices */
+    uint32_t indices;
+    /** @brief Number of triangles */
+    uint32_t num_triangles;
+    /** @brief Scissor rectangle (x0, y0, x1, y1) */
+    int16_t scissor[4];
+    /** @brief Physical address of the transformed vertices, when transforming without drawing (0 otherwise) */
+    uint32_t output;
+} geom_input_t;
+
+/** @brief Input of the next geometry task */
+static geom_input_t geom_input __attribute__((aligned(8)));
+
+/** @brief Task running the geometry ucode */
+static rsp_task_t geom_task;
+
+/** @brief True while the geometry ucode is feeding the RDP */
+static volatile bool geom_busy = false;
+
+/** @brief Frame time budget of the dynamic resolution (0 if disabled), in ticks */
+static uint32_t dynres_budget = 0;
+/** @brief Smallest fraction of the framebuffer size used by the dynamic resolution */
+static float dynres_min_scale = 1.0f;
+/** @brief Fraction of the framebuffer size used for the next frame */
+static float dynres_scale = 1.0f;
+/** @brief Number of display contexts that still have to be set back to full size */
+static uint32_t dynres_reset = 0;
+/** @brief Resolution of the frame being drawn */
+static uint32_t rdp_width = 0, rdp_height = 0;
+/** @brief Time the RDP was busy drawing the last frame, in ticks */
+static uint32_t frame_ticks = 0;
+
 /**
  * @brief RDP interrupt handler
  *
  * This interrupt is called when a Sync Full operation has completed and it is safe to
  * use the output buffer with software
  */
-static void __rdp_interrupt()
+static void __rdp_interrupt( void *ctx )
 {
     /* Flag that the interrupt happened */
     wait_intr++;
+
+    __profile_rdp_sync();
 }
 
 /**
@@ -178,9 +359,9 @@ static inline uint32_t __rdp_log2( uint32_t number )
 }
 
 /**
- * @brief Return the size of the current command buffered in the ring buffer
+ * @brief Return the size of the commands buffered in the ring buffer and not yet submitted
  *
- * @return The size of the command in bytes
+ * @return The size of the commands in bytes
  */
 static inline uint32_t __rdp_ringbuffer_size( void )
 {
@@ -188,6 +369,40 @@ static inline uint32_t __rdp_ringbuffer_size( void )
     return rdp_end - rdp_start;
 }
 
+/**
+ * @brief Wait until the RDP has read the commands of the previous lap that are about to be overwritten
+ *
+ * After a wraparound, new commands are written at the start of the ring buffer while the RDP
+ * might still be reading the commands at the end of the buffer.  This waits until the RDP is past
+ * the position where the next command word will be written, or has moved on to the new lap.
+ */
+static void __rdp_ringbuffer_wait( void )
+{
+    /* The RDP is reading commands from the RSP */
+    if( geom_busy ) { rsp_task_wait( &geom_task ); }
+
+    uint32_t base = (uint32_t)rdp_ringbuffer | 0xA0000000;
+
+    while( 1 )
+    {
+        uint32_t status = DP_STATUS;
+
+        /* Once the DP_START of the new lap has been taken, the previous lap has been fully read */
+        if( !rdp_restart && !(status & DP_STATUS_START_VALID) ) { break; }
+
+        /* Before it is taken, the RDP is working on the previous lap (unless an even older range
+         * is still pending, which is the case if the previous lap start is pending) */
+        if( rdp_restart && (status & DP_STATUS_START_VALID) ) { continue; }
+
+        uint32_t current = (DP_CURRENT | 0xA0000000) - base;
+        if( current == rdp_lap_end ) { break; }
+        if( current >= rdp_end + sizeof(uint32_t) ) { return; }
+    }
+
+    /* The previous lap is not being read anymore */
+    rdp_lap_end = 0;
+}
+
 /**
  * @brief Queue 32 bits of a command to the ring buffer
  *
@@ -197,7 +412,14 @@ static inline uint32_t __rdp_ringbuffer_size( void )
 static void __rdp_ringbuffer_queue( uint32_t data )
 {
     /* Only add commands if we have room */
-    if( __rdp_ringbuffer_size() + sizeof(uint32_t) >= RINGBUFFER_SIZE ) { return; }
+    if( rdp_end + sizeof(uint32_t) > rdp_ringbuffer_size )
+    {
+        if( recording_list ) { recording_overflow = true; }
+        return;
+    }
+
+    /* Don't overwrite commands that the RDP still has to read */
+    if( rdp_lap_end ) { __rdp_ringbuffer_wait(); }
 
     /* Add data to queue to be sent to RDP */
     rdp_ringbuffer[rdp_end / 4] = data;
@@ -205,52 +427,73 @@ static void __rdp_ringbuffer_queue( uint32_t data )
 }
 
 /**
- * @brief Send a completed command to the RDP that is queued in the ring buffer
+ * @brief Submit all the commands queued in the ring buffer to the RDP
  *
- * Given a validly constructred command in the ring buffer, this command will prepare the
- * memory region in the ring buffer to be sent to the RDP and then start a DMA transfer,
- * kicking off execution of the command in the RDP.  After calling this function, it is
- * safe to start writing to the ring buffer again.
+ * Commands that follow the ones submitted previously are submitted by just moving DP_END forward,
+ * which the RDP picks up while it is running.  DP_START is only programmed (in a critical section)
+ * at the start of each lap of the ring buffer.  After calling this function, it is safe to start
+ * writing to the ring buffer again.
  */
-static void __rdp_ringbuffer_send( void )
+static void __rdp_ringbuffer_submit( void )
 {
-    /* Don't send nothingness */
-    if( __rdp_ringbuffer_size() == 0 ) { return; }
+    /* Don't send nothingness, and keep the commands of a display list being recorded */
+    if( __rdp_ringbuffer_size() == 0 || recording_list ) { return; }
 
-    /* Ensure the cache is fixed up */
-    data_cache_hit_writeback_invalidate(&rdp_ringbuffer[rdp_start / 4], __rdp_ringbuffer_size());
-    
-    /* Best effort to be sure we can write once we disable interrupts */
-    while( (((volatile uint32_t *)0xA4100000)[3] & 0x600) ) ;
+    /* The RDP is reading commands from the RSP */
+    if( geom_busy ) { rsp_task_wait( &geom_task ); }
 
-    /* Make sure another thread doesn't attempt to render */
-    disable_interrupts();
+    uint32_t base = (uint32_t)rdp_ringbuffer | 0xA0000000;
 
-    /* Clear XBUS/Flush/Freeze */
-    ((uint32_t *)0xA4100000)[3] = 0x15;
-    MEMORY_BARRIER();
+    /* Ensure the cache is fixed up. The RDP only reads the ring buffer,
+     * so there is no need to invalidate it. */
+    data_cache_hit_writeback(&rdp_ringbuffer[rdp_start / 4], __rdp_ringbuffer_size());
 
-    /* Don't saturate the RDP command buffer.  Another command could have been written
-     * since we checked before disabling interrupts, but it is unlikely, so we probably
-     * won't stall in this critical section long. */
-    while( (((volatile uint32_t *)0xA4100000)[3] & 0x600) ) ;
+    if( rdp_restart )
+    {
+        /* Best effort to be sure we can write once we disable interrupts */
+        while( DP_STATUS & (DP_STATUS_START_VALID | DP_STATUS_END_VALID) ) ;
 
-    /* Send start and end of buffer location to kick off the command transfer */
-    MEMORY_BARRIER();
-    ((volatile uint32_t *)0xA4100000)[0] = ((uint32_t)rdp_ringbuffer | 0xA0000000) + rdp_start;
-    MEMORY_BARRIER();
-    ((volatile uint32_t *)0xA4100000)[1] = ((uint32_t)rdp_ringbuffer | 0xA0000000) + rdp_end;
-    MEMORY_BARRIER();
+        /* Make sure another thread doesn't attempt to render */
+        disable_interrupts();
 
-    /* We are good now */
-    enable_interrupts();
+        /* Clear XBUS/Flush/Freeze */
+        DP_STATUS = 0x15;
+        MEMORY_BARRIER();
+
+        /* Don't saturate the RDP command buffer.  Another command could have been written
+         * since we checked before disabling interrupts, but it is unlikely, so we probably
+         * won't stall in this critical section long. */
+        while( DP_STATUS & (DP_STATUS_START_VALID | DP_STATUS_END_VALID) ) ;
+
+        /* Send start and end of buffer location to kick off the command transfer */
+        MEMORY_BARRIER();
+        DP_START = base + rdp_start;
+        MEMORY_BARRIER();
+        DP_END = base + rdp_end;
+        MEMORY_BARRIER();
+
+        /* We are good now */
+        enable_interrupts();
+
+        rdp_restart = false;
+    }
+    else
+    {
+        /* The commands follow the ones already submitted: just extend the range */
+        MEMORY_BARRIER();
+        DP_END = base + rdp_end;
+        MEMORY_BARRIER();
+    }
 
     /* Commands themselves can't wrap around */
-    if( rdp_end > (RINGBUFFER_SIZE - RINGBUFFER_SLACK) )
+    if( rdp_end > (rdp_ringbuffer_size - RINGBUFFER_SLACK) )
     {
-        /* Wrap around before a command can be split */
+        /* Wrap around before a command can be split.  The RDP might still be reading the
+         * end of the buffer, so remember where it ends */
+        rdp_lap_end = rdp_end;
         rdp_start = 0;
         rdp_end = 0;
+        rdp_restart = true;
     }
     else
     {
@@ -259,6 +502,24 @@ static void __rdp_ringbuffer_send( void )
     }
 }
 
+/**
+ * @brief Send a completed command to the RDP that is queued in the ring buffer
+ *
+ * With #SUBMIT_STRATEGY_IMMEDIATE, the command is submitted to the RDP right away.  With
+ * #SUBMIT_STRATEGY_DEFERRED, it is left in the ring buffer until #rdp_flush is called
+ * (or the end of the ring buffer is reached).  After calling this function, it is safe to
+ * start writing the next command to the ring buffer.
+ */
+static void __rdp_ringbuffer_send( void )
+{
+    if( recording_list ) { return; }
+
+    if( submit_strategy == SUBMIT_STRATEGY_IMMEDIATE || rdp_end > (rdp_ringbuffer_size - RINGBUFFER_SLACK) )
+    {
+        __rdp_ringbuffer_submit();
+    }
+}
+
 /**
  * @brief Initialize the RDP system
  */
@@ -270,9 +531,17 @@ void rdp_init( void )
     /* Set the ringbuffer up */
     rdp_start = 0;
     rdp_end = 0;
+    rdp_restart = true;
+    rdp_lap_end = 0;
+
+    /* Nothing is known to be in TMEM */
+    memset( texcache, 0, sizeof(texcache) );
+    memset( &texcache_stats, 0, sizeof(texcache_stats) );
+    font_page = -1;
+    resident_atlas = 0;
 
     /* Set up interrupt for SYNC_FULL */
-    register_DP_handler( __rdp_interrupt );
+    register_interrupt_handler_nofpu( INTERRUPT_DP, __rdp_interrupt, 0 );
     set_DP_interrupt( 1 );
 }
 
@@ -285,603 +554,2645 @@ void rdp_init( void )
 void rdp_close( void )
 {
     set_DP_interrupt( 0 );
-    unregister_DP_handler( __rdp_interrupt );
+    unregister_interrupt_handler( INTERRUPT_DP, __rdp_interrupt, 0 );
+
+    free( font_atlas );
+    font_atlas = 0;
+    font_page = -1;
 }
 
 /**
- * @brief Attach the RDP to a display context
+ * @brief Set the buffer used to hold RDP commands
  *
- * This function allows the RDP to operate on display contexts fetched with #display_lock.
- * This should be performed before any other operations to ensure that the RDP has a valid
- * output buffer to operate on.
+ * By default, RDP commands are built in an internal ring buffer of 8 KiB.  For scenes with
+ * many primitives, a larger buffer lets the CPU queue more commands while the RDP is still
+ * executing the previous ones.  The buffer is used as a ring: when the end is reached, new
+ * commands are written from the start while the RDP finishes reading the end, waiting for the
+ * RDP only if it is a whole buffer behind.  This gives the same overlap between CPU and RDP
+ * as double buffering, without splitting the buffer in two.
  *
- * @param[in] disp
- *            A display context as returned by #display_lock
+ * This must only be called while the RDP is idle, for instance right after #rdp_init
+ * or after #rdp_detach_display.
+ *
+ * @param[in] buffer
+ *            Buffer to use (8-byte aligned), or NULL to go back to the internal buffer
+ * @param[in] size
+ *            Size of the buffer in bytes.  Must be a multiple of 8, and at least 4 KiB.
  */
-void rdp_attach_display( display_context_t disp )
+void rdp_set_command_buffer( void *buffer, uint32_t size )
 {
-    if( disp == 0 ) { return; }
+    if( buffer )
+    {
+        assert( ((uint32_t)buffer & 7) == 0 );
+        assert( (size & 7) == 0 && size >= RINGBUFFER_SLACK * 4 );
+        rdp_ringbuffer = buffer;
+        rdp_ringbuffer_size = size;
+    }
+    else
+    {
+        rdp_ringbuffer = rdp_default_ringbuffer;
+        rdp_ringbuffer_size = RINGBUFFER_SIZE;
+    }
 
-    /* Set the rasterization buffer */
-    __rdp_ringbuffer_queue( 0xFF000000 | ((__bitdepth == 2) ? 0x00100000 : 0x00180000) | (__width - 1) );
-    __rdp_ringbuffer_queue( (uint32_t)__get_buffer( disp ) );
-    __rdp_ringbuffer_send();
+    rdp_start = 0;
+    rdp_end = 0;
+    rdp_restart = true;
+    rdp_lap_end = 0;
 }
 
 /**
- * @brief Detach the RDP from a display context
+ * @brief Set the submission strategy for RDP commands
  *
- * @note This function requires interrupts to be enabled to operate properly.
+ * With #SUBMIT_STRATEGY_IMMEDIATE (the default), each command is submitted to the RDP as
+ * soon as it is built.  With #SUBMIT_STRATEGY_DEFERRED, commands accumulate in the command
+ * buffer and are submitted together by #rdp_flush (or #rdp_detach_display), or when the end of
+ * the command buffer is reached.  Either way, only DP_END is updated for commands that follow
+ * the ones already submitted.
  *
- * This function will ensure that all hardware operations have completed on an output buffer
- * before detaching the display context.  This should be performed before displaying the finished
- * output using #display_show
+ * @param[in] submit
+ *            The submission strategy, either #SUBMIT_STRATEGY_IMMEDIATE or
+ *            #SUBMIT_STRATEGY_DEFERRED.
  */
-void rdp_detach_display( void )
+void rdp_set_submit_strategy( submit_t submit )
 {
-    /* Wait for SYNC_FULL to finish */
-    wait_intr = 0;
-
-    /* Force the RDP to rasterize everything and then interrupt us */
-    rdp_sync( SYNC_FULL );
-
-    if( INTERRUPTS_ENABLED == get_interrupts_state() )
-    {
-        /* Only wait if interrupts are enabled */
-        while( !wait_intr ) { ; }
-    }
+    submit_strategy = submit;
+    if( submit == SUBMIT_STRATEGY_IMMEDIATE ) { rdp_flush(); }
+}
 
-    /* Set back to zero for next detach */
-    wait_intr = 0;
+/**
+ * @brief Submit all the pending commands to the RDP
+ *
+ * This is only needed with #SUBMIT_STRATEGY_DEFERRED, to start execution of the commands
+ * built so far.  #rdp_detach_display does it automatically.
+ */
+void rdp_flush( void )
+{
+    __rdp_ringbuffer_submit();
 }
 
 /**
- * @brief Perform a sync operation
+ * @brief Send raw RDP commands
  *
- * Do not use excessive sync operations between commands as this can
- * cause the RDP to stall.  If the RDP stalls due to too many sync
- * operations, graphics may not be displayed until the next render
- * cycle, causing bizarre artifacts.  The rule of thumb is to only add
- * a sync operation if the data you need is not yet available in the
- * pipeline.
+ * The commands, usually built at compile time with the macros of rdp_commands.h
+ * (see #RDP_SEND), are copied to the command buffer at once, checking for room only
+ * once.  They are recorded when a display list is being recorded, like the commands
+ * built by the other functions.  Only commands made of a single 64-bit word can be
+ * sent this way.
  *
- * @param[in] sync
- *            The sync operation to perform on the RDP
+ * @param[in] commands
+ *            RDP commands
+ * @param[in] count
+ *            Number of commands
  */
-void rdp_sync( sync_t sync )
+void rdp_send_raw( const uint64_t *commands, int count )
 {
-    switch( sync )
+    uint32_t size = count * sizeof(uint64_t);
+
+    /* Commands can't wrap around the ring buffer */
+    assertf( recording_list || size <= RINGBUFFER_SLACK, "too many RDP commands at once: %d", count );
+
+    /* Only add commands if we have room */
+    if( rdp_end + size > rdp_ringbuffer_size )
     {
-        case SYNC_FULL:
-            __rdp_ringbuffer_queue( 0xE9000000 );
-            break;
-        case SYNC_PIPE:
-            __rdp_ringbuffer_queue( 0xE7000000 );
-            break;
-        case SYNC_TILE:
-            __rdp_ringbuffer_queue( 0xE8000000 );
-            break;
-        case SYNC_LOAD:
-            __rdp_ringbuffer_queue( 0xE6000000 );
-            break;
+        if( recording_list ) { recording_overflow = true; }
+        return;
     }
-    __rdp_ringbuffer_queue( 0x00000000 );
+
+    if( rdp_lap_end )
+    {
+        /* Don't overwrite commands that the RDP still has to read */
+        for( int i = 0; i < count; i++ )
+        {
+            __rdp_ringbuffer_queue( commands[i] >> 32 );
+            __rdp_ringbuffer_queue( commands[i] );
+        }
+    }
+    else
+    {
+        memcpy( &rdp_ringbuffer[rdp_end / 4], commands, size );
+        rdp_end += size;
+    }
+
     __rdp_ringbuffer_send();
 }
 
 /**
- * @brief Set the hardware clipping boundary
+ * @brief Forget what is known to be in TMEM
  *
- * @param[in] tx
- *            Top left X coordinate in pixels
- * @param[in] ty
- *            Top left Y coordinate in pixels
- * @param[in] bx
- *            Bottom right X coordinate in pixels
- * @param[in] by
- *            Bottom right Y coordinate in pixels
+ * Used around display lists: the loads of a display list being recorded are not executed,
+ * and replaying it can overwrite anything.
  */
-void rdp_set_clipping( uint32_t tx, uint32_t ty, uint32_t bx, uint32_t by )
+static void __rdp_tmem_forget( void )
 {
-    /* Convert pixel space to screen space in command */
-    __rdp_ringbuffer_queue( 0xED000000 | (tx << 14) | (ty << 2) );
-    __rdp_ringbuffer_queue( (bx << 14) | (by << 2) );
-    __rdp_ringbuffer_send();
+    rdp_texture_cache_invalidate( 0 );
+    font_page = -1;
+    resident_atlas = 0;
 }
 
 /**
- * @brief Set the hardware clipping boundary to the entire screen
+ * @brief Start recording a display list
+ *
+ * Until #rdp_display_list_end, RDP commands are not sent to the RDP, but recorded into
+ * the buffer, so that they can be replayed with #rdp_display_list_replay.  Replaying a
+ * display list costs a single submission to the RDP, rather than building all its commands
+ * again, which makes it a good fit for the parts of a frame that don't change, such as the
+ * layers of a user interface.  All the drawing functions can be recorded, except for
+ * #rdp_geom_draw_triangles: the RSP sends those commands to the RDP directly.  Functions that
+ * wait for the RDP, such as #rdp_wait_idle and #rdp_detach_display, must not be called while
+ * recording.
+ *
+ * Since the recorded commands are not executed, the textures they load are not considered
+ * resident in TMEM: the display list loads all the textures it uses, and the TMEM
+ * contents must be considered lost after replaying it.  The buffer the textures are loaded
+ * from must stay valid as long as the display list is used.
+ *
+ * @param[out] list
+ *             Display list to record
+ * @param[in]  buffer
+ *             Buffer to record the commands into (8-byte aligned)
+ * @param[in]  size
+ *             Size of the buffer in bytes
  */
-void rdp_set_default_clipping( void )
+void rdp_display_list_begin( rdp_display_list_t *list, void *buffer, uint32_t size )
 {
-    /* Clip box is the whole screen */
-    rdp_set_clipping( 0, 0, __width, __height );
+    assertf( !recording_list, "a display list is already being recorded" );
+    assertf( buffer && !((uint32_t)buffer & 7), "display list buffer must be 8-byte aligned" );
+
+    /* Commands built before must not end up in the display list */
+    __rdp_ringbuffer_submit();
+    __rdp_tmem_forget();
+
+    list->commands = buffer;
+    list->size = size & ~7;
+    list->length = 0;
+
+    /* Build the commands in the buffer of the display list rather than in the ring buffer */
+    recording_ring.buffer = rdp_ringbuffer;
+    recording_ring.size = rdp_ringbuffer_size;
+    recording_ring.start = rdp_start;
+    recording_ring.end = rdp_end;
+    recording_ring.lap_end = rdp_lap_end;
+    recording_ring.restart = rdp_restart;
+
+    rdp_ringbuffer = buffer;
+    rdp_ringbuffer_size = list->size;
+    rdp_start = 0;
+    rdp_end = 0;
+    rdp_lap_end = 0;
+
+    recording_list = list;
+    recording_overflow = false;
 }
 
 /**
- * @brief Enable display of 2D filled (untextured) rectangles
+ * @brief Return the position of the next command of the display list being recorded
  *
- * This must be called before using #rdp_draw_filled_rectangle.
+ * Used to remember where commands were recorded, to move them later with
+ * #rdp_display_list_translate.
+ *
+ * @return The offset of the next command in bytes
  */
-void rdp_enable_primitive_fill( void )
+uint32_t rdp_display_list_position( void )
 {
-    /* Set other modes to fill and other defaults */
-    __rdp_ringbuffer_queue( 0xEFB000FF );
-    __rdp_ringbuffer_queue( 0x00004000 );
-    __rdp_ringbuffer_send();
+    assertf( recording_list, "no display list is being recorded" );
+
+    return rdp_end;
 }
 
 /**
- * @brief Enable display of 2D filled (untextured) triangles
+ * @brief Stop recording a display list
  *
- * This must be called before using #rdp_draw_filled_triangle.
+ * The display list can then be replayed with #rdp_display_list_replay, and commands are
+ * sent to the RDP again.
  */
-void rdp_enable_blend_fill( void )
+void rdp_display_list_end( void )
 {
-    __rdp_ringbuffer_queue( 0xEF0000FF );
-    __rdp_ringbuffer_queue( 0x80000000 );
-    __rdp_ringbuffer_send();
+    assertf( recording_list, "no display list is being recorded" );
+    assertf( !recording_overflow, "display list buffer too small (%lu bytes)", recording_list->size );
+
+    recording_list->length = rdp_end;
+    data_cache_hit_writeback_invalidate( recording_list->commands, recording_list->length );
+
+    rdp_ringbuffer = recording_ring.buffer;
+    rdp_ringbuffer_size = recording_ring.size;
+    rdp_start = recording_ring.start;
+    rdp_end = recording_ring.end;
+    rdp_lap_end = recording_ring.lap_end;
+    rdp_restart = recording_ring.restart;
+
+    recording_list = 0;
+    __rdp_tmem_forget();
 }
 
 /**
- * @brief Enable display of 2D sprites
+ * @brief Return the size of an RDP command
  *
- * This must be called before using #rdp_draw_textured_rectangle_scaled,
- * #rdp_draw_textured_rectangle, #rdp_draw_sprite or #rdp_draw_sprite_scaled.
+ * @param[in] command
+ *            First word of the command
+ *
+ * @return The size of the command in bytes
  */
-void rdp_enable_texture_copy( void )
+static uint32_t __rdp_command_size( uint32_t command )
 {
-    /* Set other modes to copy and other defaults */
-    __rdp_ringbuffer_queue( 0xEFA000FF );
-    __rdp_ringbuffer_queue( 0x00004001 );
-    __rdp_ringbuffer_send();
+    uint32_t id = (command >> 24) & 0x3F;
+
+    if( id >= 0x08 && id <= 0x0F )
+    {
+        /* Triangles: edge coefficients, then shade, texture and Z-buffer coefficients */
+        return 32 + ((id & 0x4) ? 64 : 0) + ((id & 0x2) ? 64 : 0) + ((id & 0x1) ? 16 : 0);
+    }
+
+    /* Texture rectangles */
+    if( id == 0x24 || id == 0x25 ) { return 16; }
+
+    return 8;
 }
 
 /**
- * @brief Load a texture from RDRAM into RDP TMEM
+ * @brief Move the rectangles of a display list
  *
- * This function will take a texture from a sprite and place it into RDP TMEM at the offset and 
- * texture slot specified.  It is capable of pulling out a smaller texture from a larger sprite
- * map.
+ * This patches the position of the rectangles (filled and textured) recorded between two
+ * positions returned by #rdp_display_list_position, so that a display list can be drawn
+ * somewhere else without recording it again.  The rectangles must stay within the screen.
+ * Other commands, such as triangles, are left untouched.
  *
- * @param[in] texslot
- *            The texture slot (0-7) to assign this texture to
- * @param[in] texloc
- *            The offset in RDP TMEM to place this texture
- * @param[in] mirror_enabled
- *            Whether to mirror this texture when displaying
- * @param[in] sprite
- *            Pointer to the sprite structure to load the texture out of
- * @param[in] sl
- *            The pixel offset S of the top left of the texture relative to sprite space
- * @param[in] tl
- *            The pixel offset T of the top left of the texture relative to sprite space
- * @param[in] sh
- *            The pixel offset S of the bottom right of the texture relative to sprite space
- * @param[in] th
- *            The pixel offset T of the bottom right of the texture relative to sprite space
+ * The display list must not be in use by the RDP: patch it after #rdp_detach_display, or
+ * before replaying it for the first time in a frame.
  *
- * @return The amount of texture memory in bytes that was consumed by this texture.
+ * @param[in] list
+ *            Display list to patch
+ * @param[in] start
+ *            Position of the first command to move
+ * @param[in] end
+ *            Position after the last command to move
+ * @param[in] dx
+ *            Horizontal offset in pixels
+ * @param[in] dy
+ *            Vertical offset in pixels
  */
-static uint32_t __rdp_load_texture( uint32_t texslot, uint32_t texloc, mirror_t mirror_enabled, sprite_t *sprite, int sl, int tl, int sh, int th )
+void rdp_display_list_translate( rdp_display_list_t *list, uint32_t start, uint32_t end, int dx, int dy )
 {
-    /* Invalidate data associated with sprite in cache */
-    if( flush_strategy == FLUSH_STRATEGY_AUTOMATIC )
+    assertf( start <= end && end <= list->length, "invalid display list range" );
+
+    /* Rectangle coordinates are in 10.2 fixed point */
+    uint32_t offset = ((dx << 2) & 0xFFF) << 12 | ((dy << 2) & 0xFFF);
+    uint32_t *patched = &list->commands[start / 4];
+
+    for( uint32_t pos = start; pos < end; pos += __rdp_command_size( list->commands[pos / 4] ) )
     {
-        data_cache_hit_writeback_invalidate( sprite->data, sprite->width * sprite->height * sprite->bitdepth );
+        uint32_t *cmd = &list->commands[pos / 4];
+        uint32_t id = (cmd[0] >> 24) & 0x3F;
+
+        if( id == 0x24 || id == 0x25 || id == 0x36 )
+        {
+            /* Both corners are packed as 12-bit values in the same positions of the two words */
+            cmd[0] = (cmd[0] & 0xFF000000) | ((((cmd[0] & 0xFFF000) + (offset & 0xFFF000)) & 0xFFF000) | (((cmd[0] & 0xFFF) + (offset & 0xFFF)) & 0xFFF));
+            cmd[1] = (cmd[1] & 0xFF000000) | ((((cmd[1] & 0xFFF000) + (offset & 0xFFF000)) & 0xFFF000) | (((cmd[1] & 0xFFF) + (offset & 0xFFF)) & 0xFFF));
+        }
     }
 
-    /* Point the RDP at the actual sprite data */
-    __rdp_ringbuffer_queue( 0xFD000000 | ((sprite->bitdepth == 2) ? 0x00100000 : 0x00180000) | (sprite->width - 1) );
-    __rdp_ringbuffer_queue( (uint32_t)sprite->data );
-    __rdp_ringbuffer_send();
+    data_cache_hit_writeback( patched, end - start );
+}
 
-    /* Figure out the s,t coordinates of the sprite we are copying out of */
-    int twidth = sh - sl + 1;
-    int theight = th - tl + 1;
+/**
+ * @brief Replay a display list
+ *
+ * The commands recorded in the display list are submitted to the RDP at once, after the
+ * commands built before.  The same display list can be replayed many times, in the same
+ * frame or across frames, as long as its buffer is left untouched.
+ *
+ * @param[in] list
+ *            Display list recorded with #rdp_display_list_begin and #rdp_display_list_end
+ */
+void rdp_display_list_replay( const rdp_display_list_t *list )
+{
+    assertf( !recording_list, "cannot replay a display list while recording one" );
 
-    /* Figure out the power of two this sprite fits into */
-    uint32_t real_width  = __rdp_round_to_power( twidth );
-    uint32_t real_height = __rdp_round_to_power( theight );
-    uint32_t wbits = __rdp_log2( real_width );
-    uint32_t hbits = __rdp_log2( real_height );
+    if( list->length == 0 ) { return; }
 
-    /* Because we are dividing by 8, we want to round up if we have a remainder */
-    int round_amount = (real_width % 8) ? 1 : 0;
+    /* The commands built before go first */
+    __rdp_ringbuffer_submit();
 
-    /* Instruct the RDP to copy the sprite data out */
-    __rdp_ringbuffer_queue( 0xF5000000 | ((sprite->bitdepth == 2) ? 0x00100000 : 0x00180000) | 
-                                       (((((real_width / 8) + round_amount) * sprite->bitdepth) & 0x1FF) << 9) | ((texloc / 8) & 0x1FF) );
-    __rdp_ringbuffer_queue( ((texslot & 0x7) << 24) | (mirror_enabled != MIRROR_DISABLED ? 0x40100 : 0) | (hbits << 14 ) | (wbits << 4) );
-    __rdp_ringbuffer_send();
+    /* The RDP is reading commands from the RSP */
+    if( geom_busy ) { rsp_task_wait( &geom_task ); }
 
-    /* Copying out only a chunk this time */
-    __rdp_ringbuffer_queue( 0xF4000000 | (((sl << 2) & 0xFFF) << 12) | ((tl << 2) & 0xFFF) );
-    __rdp_ringbuffer_queue( (((sh << 2) & 0xFFF) << 12) | ((th << 2) & 0xFFF) );
-    __rdp_ringbuffer_send();
+    /* Best effort to be sure we can write once we disable interrupts */
+    while( DP_STATUS & (DP_STATUS_START_VALID | DP_STATUS_END_VALID) ) ;
 
-    /* Save sprite width and height for managed sprite commands */
-    cache[texslot & 0x7].width = twidth - 1;
+    disable_interrupts();
+
+    /* Clear XBUS/Flush/Freeze */
+    DP_STATUS = 0x15;
+    MEMORY_BARRIER();
+
+    while( DP_STATUS & (DP_STATUS_START_VALID | DP_STATUS_END_VALID) ) ;
+
+    MEMORY_BARRIER();
+    DP_START = (uint32_t)list->commands | 0xA0000000;
+    MEMORY_BARRIER();
+    DP_END = ((uint32_t)list->commands | 0xA0000000) + list->length;
+    MEMORY_BARRIER();
+
+    enable_interrupts();
+
+    if( rdp_lap_end )
+    {
+        /* The RDP moves on to the display list only once past the end of the previous
+         * lap of the ring buffer, which can then be written over */
+        while( DP_STATUS & DP_STATUS_START_VALID ) ;
+        rdp_lap_end = 0;
+    }
+
+    /* The next commands of the ring buffer start a new range after the display list */
+    rdp_restart = true;
+
+    __rdp_tmem_forget();
+}
+
+/**
+ * @brief Set the image the RDP draws to
+ *
+ * @param[in] bpp
+ *            Bytes per pixel (2 or 4)
+ * @param[in] image
+ *            Image with the width of the display
+ */
+static void __rdp_set_color_image( uint32_t bpp, void *image )
+{
+    __rdp_ringbuffer_queue( 0xFF000000 | ((bpp == 2) ? 0x00100000 : 0x00180000) | (__width - 1) );
+    __rdp_ringbuffer_queue( (uint32_t)image );
+    __rdp_ringbuffer_send();
+}
+
+/**
+ * @brief Attach the RDP to a display context
+ *
+ * This function allows the RDP to operate on display contexts fetched with #display_lock.
+ * This should be performed before any other operations to ensure that the RDP has a valid
+ * output buffer to operate on.
+ *
+ * @param[in] disp
+ *            A display context as returned by #display_lock
+ */
+void rdp_attach_display( display_context_t disp )
+{
+    if( disp == 0 ) { return; }
+
+    /* Set the rasterization buffer */
+    __rdp_set_color_image( __bitdepth, __get_buffer( disp ) );
+
+    attached_display = disp;
+    rdp_width = __width;
+    rdp_height = __height;
+
+    if( dynres_budget )
+    {
+        /* Draw the frame in the top left part of the framebuffer, scaled by the VI */
+        rdp_width = ((uint32_t)(__width * dynres_scale)) & ~3;
+        rdp_height = (uint32_t)(__height * dynres_scale);
+        if( rdp_width < 4 ) { rdp_width = 4; }
+        if( rdp_height < 1 ) { rdp_height = 1; }
+
+        display_set_viewport( disp, rdp_width, rdp_height );
+        rdp_set_default_clipping();
+    }
+    else if( dynres_reset )
+    {
+        /* Dynamic resolution was disabled: display the whole framebuffer again */
+        display_set_viewport( disp, rdp_width, rdp_height );
+        rdp_set_default_clipping();
+        dynres_reset--;
+    }
+
+    /* Count the busy time of the RDP from here (see #rdp_detach_display) */
+    DP_STATUS = DP_STATUS_CLR_COUNTERS;
+}
+
+/**
+ * @brief Return the display context the RDP is attached to
+ *
+ * @return The display context passed to #rdp_attach_display, or 0 if the RDP
+ *         is not attached to any display context
+ */
+display_context_t rdp_get_attached_display( void )
+{
+    return attached_display;
+}
+
+/**
+ * @brief Attach a Z-buffer to the RDP
+ *
+ * This function sets the Z-buffer used by Z-buffered triangles (see #TRIANGLE_ZBUFFER).  The
+ * Z-buffer is an array of 16-bit values with the same size of the display context attached
+ * with #rdp_attach_display.  It must be 8-byte aligned, and it should be cleared to the
+ * farthest depth (0xFFFC) before drawing each frame, which #rdp_clear does.  Allocate it
+ * with #malloc_video and #RDRAM_BANK_SPREAD, so that it is placed in a different RDRAM bank
+ * than the framebuffers when the expansion pak is present.
+ *
+ * @param[in] zbuffer
+ *            Pointer to the Z-buffer, or 0 so that #rdp_clear stops clearing it
+ */
+void rdp_attach_zbuffer( void *zbuffer )
+{
+    attached_zbuffer = zbuffer;
+
+    if( zbuffer == 0 ) { return; }
+
+    /* Set the Z buffer image */
+    __rdp_ringbuffer_queue( 0xFE000000 );
+    __rdp_ringbuffer_queue( (uint32_t)zbuffer );
+    __rdp_ringbuffer_send();
+}
+
+/**
+ * @brief Detach the RDP from a display context
+ *
+ * @note This function requires interrupts to be enabled to operate properly.
+ *
+ * This function will ensure that all hardware operations have completed on an output buffer
+ * before detaching the display context.  This should be performed before displaying the finished
+ * output using #display_show
+ */
+void rdp_detach_display( void )
+{
+    rdp_wait_idle();
+    attached_display = 0;
+
+    /* Only the time the RDP was processing commands counts: the time spent by the CPU
+     * building them, during which the RDP is idle, does not depend on the resolution */
+    uint32_t busy = DP_BUFBUSY & DP_COUNTER_MASK;
+    frame_ticks = (uint32_t)((uint64_t)busy * TICKS_PER_SECOND / RCP_FREQUENCY);
+
+    if( dynres_budget && frame_ticks > 0 )
+    {
+        /* The RDP time is roughly proportional to the number of pixels, that is to the
+         * square of the scale: move halfway towards the scale that fits the budget */
+        float target = dynres_scale * sqrtf( (float)dynres_budget / frame_ticks );
+
+        dynres_scale += (target - dynres_scale) * 0.5f;
+        if( dynres_scale > 1.0f ) { dynres_scale = 1.0f; }
+        if( dynres_scale < dynres_min_scale ) { dynres_scale = dynres_min_scale; }
+    }
+}
+
+/**
+ * @brief Wait until the RDP has executed all the commands submitted so far
+ *
+ * @note This function requires interrupts to be enabled to operate properly.
+ *
+ * This is needed before the CPU accesses a buffer the RDP is drawing to, for instance to
+ * mix software and hardware drawing on the same display context.  The RDP stays attached
+ * to the display context.
+ */
+void rdp_wait_idle( void )
+{
+    assertf( !recording_list, "cannot wait for the RDP while recording a display list" );
+
+    /* Wait for SYNC_FULL to finish */
+    wait_intr = 0;
+
+    /* Force the RDP to rasterize everything and then interrupt us */
+    rdp_sync( SYNC_FULL );
+    rdp_flush();
+
+    if( INTERRUPTS_ENABLED == get_interrupts_state() )
+    {
+        /* Only wait if interrupts are enabled */
+        while( !wait_intr ) { ; }
+    }
+
+    /* Set back to zero for next detach */
+    wait_intr = 0;
+}
+
+/**
+ * @brief Enable dynamic resolution
+ *
+ * With dynamic resolution, each frame is drawn in the top left part of the framebuffer, which
+ * the VI scales to the whole screen (see #display_set_viewport).  The size of this part is
+ * chosen by #rdp_attach_display from the time the RDP was busy drawing the previous frames
+ * (see #rdp_get_frame_ticks), so that a frame stays within the budget.  The aspect ratio is preserved.  Use
+ * #rdp_get_resolution to know the resolution to draw the current frame at.
+ *
+ * @param[in] budget_us
+ *            Time budget for the RDP to draw a frame in microseconds (for example 16666 for
+ *            60 fps), or 0 to disable dynamic resolution and always use the whole framebuffer
+ * @param[in] min_scale
+ *            Smallest fraction of the size of the framebuffer that can be used (0 to 1)
+ */
+void rdp_set_dynamic_resolution( uint32_t budget_us, float min_scale )
+{
+    if( dynres_budget && !budget_us ) { dynres_reset = __buffers; }
+
+    dynres_budget = (uint32_t)((uint64_t)budget_us * TICKS_PER_SECOND / 1000000);
+    dynres_min_scale = (min_scale > 0.0f && min_scale < 1.0f) ? min_scale : 1.0f;
+    dynres_scale = 1.0f;
+}
+
+/**
+ * @brief Get the resolution of the frame being drawn
+ *
+ * This is the size of the framebuffer, or the size selected by the dynamic resolution
+ * (see #rdp_set_dynamic_resolution) for the frame since #rdp_attach_display.
+ *
+ * @param[out] width
+ *             Width in pixels
+ * @param[out] height
+ *             Height in pixels
+ */
+void rdp_get_resolution( uint32_t *width, uint32_t *height )
+{
+    *width = rdp_width ? rdp_width : __width;
+    *height = rdp_height ? rdp_height : __height;
+}
+
+/**
+ * @brief Get the time taken by the RDP to draw the last frame
+ *
+ * This is measured by the busy counter of the RDP, which is cleared by #rdp_attach_display
+ * and read by #rdp_detach_display: the time the RDP sits idle waiting for the CPU to send
+ * commands does not count.  The counter is 24-bit wide, so frames that keep the RDP busy
+ * for longer than ~268 ms are not measured correctly.
+ *
+ * @return Time in ticks the RDP was busy processing the commands of the last frame
+ */
+uint32_t rdp_get_frame_ticks( void )
+{
+    return frame_ticks;
+}
+
+/**
+ * @brief Perform a sync operation
+ *
+ * Do not use excessive sync operations between commands as this can
+ * cause the RDP to stall.  If the RDP stalls due to too many sync
+ * operations, graphics may not be displayed until the next render
+ * cycle, causing bizarre artifacts.  The rule of thumb is to only add
+ * a sync operation if the data you need is not yet available in the
+ * pipeline.
+ *
+ * @param[in] sync
+ *            The sync operation to perform on the RDP
+ */
+void rdp_sync( sync_t sync )
+{
+    switch( sync )
+    {
+        case SYNC_FULL:
+            __rdp_ringbuffer_queue( 0xE9000000 );
+            break;
+        case SYNC_PIPE:
+            __rdp_ringbuffer_queue( 0xE7000000 );
+            break;
+        case SYNC_TILE:
+            __rdp_ringbuffer_queue( 0xE8000000 );
+            break;
+        case SYNC_LOAD:
+            __rdp_ringbuffer_queue( 0xE6000000 );
+            break;
+    }
+    __rdp_ringbuffer_queue( 0x00000000 );
+    __rdp_ringbuffer_send();
+}
+
+/**
+ * @brief Set the hardware clipping boundary
+ *
+ * @param[in] tx
+ *            Top left X coordinate in pixels
+ * @param[in] ty
+ *            Top left Y coordinate in pixels
+ * @param[in] bx
+ *            Bottom right X coordinate in pixels
+ * @param[in] by
+ *            Bottom right Y coordinate in pixels
+ */
+void rdp_set_clipping( uint32_t tx, uint32_t ty, uint32_t bx, uint32_t by )
+{
+    /* Triangles drawn by the RSP, and rectangles drawn by the CPU, outside of this are rejected */
+    geom_input.scissor[0] = tx;
+    geom_input.scissor[1] = ty;
+    geom_input.scissor[2] = bx;
+    geom_input.scissor[3] = by;
+    clipping_set = true;
+
+    /* Convert pixel space to screen space in command */
+    __rdp_ringbuffer_queue( 0xED000000 | (tx << 14) | (ty << 2) );
+    __rdp_ringbuffer_queue( (bx << 14) | (by << 2) );
+    __rdp_ringbuffer_send();
+}
+
+/**
+ * @brief Get the area that rectangles are clipped to
+ *
+ * Rectangles recorded in a display list can be moved afterwards (see
+ * #rdp_display_list_translate), so they are only clipped to the screen.
+ *
+ * @param[out] clip
+ *             Top left X and Y, and bottom right X and Y (exclusive) of the area in pixels
+ */
+static void __rdp_get_clip_area( int clip[4] )
+{
+    if( clipping_set && !recording_list )
+    {
+        for( int i = 0; i < 4; i++ ) { clip[i] = geom_input.scissor[i]; }
+    }
+    else
+    {
+        clip[0] = 0;
+        clip[1] = 0;
+        clip[2] = 0x1000;
+        clip[3] = 0x1000;
+    }
+}
+
+/**
+ * @brief Check whether a rectangle is at least partially inside the clipping boundary
+ *
+ * @param[in] tx
+ *            Pixel X location of the top left of the rectangle
+ * @param[in] ty
+ *            Pixel Y location of the top left of the rectangle
+ * @param[in] bx
+ *            Pixel X location of the bottom right of the rectangle (inclusive)
+ * @param[in] by
+ *            Pixel Y location of the bottom right of the rectangle (inclusive)
+ *
+ * @return True if the rectangle must be drawn
+ */
+static bool __rdp_rectangle_visible( int tx, int ty, int bx, int by )
+{
+    int clip[4];
+
+    __rdp_get_clip_area( clip );
+    return bx >= clip[0] && by >= clip[1] && tx < clip[2] && ty < clip[3] && tx <= bx && ty <= by;
+}
+
+/**
+ * @brief Set the hardware clipping boundary to the entire screen
+ */
+void rdp_set_default_clipping( void )
+{
+    /* Clip box is the whole screen, or the part of it used by the dynamic resolution */
+    if( rdp_width && rdp_height )
+    {
+        rdp_set_clipping( 0, 0, rdp_width, rdp_height );
+    }
+    else
+    {
+        rdp_set_clipping( 0, 0, __width, __height );
+    }
+}
+
+/**
+ * @brief Enable display of 2D filled (untextured) rectangles
+ *
+ * This must be called before using #rdp_draw_filled_rectangle.
+ */
+void rdp_enable_primitive_fill( void )
+{
+    /* Set other modes to fill and other defaults */
+    __rdp_ringbuffer_queue( 0xEFB000FF );
+    __rdp_ringbuffer_queue( 0x00004000 );
+    __rdp_ringbuffer_send();
+}
+
+/**
+ * @brief Enable display of 2D filled (untextured) triangles
+ *
+ * This must be called before using #rdp_draw_filled_triangle.
+ */
+void rdp_enable_blend_fill( void )
+{
+    __rdp_ringbuffer_queue( 0xEF0000FF );
+    __rdp_ringbuffer_queue( 0x80000000 );
+    __rdp_ringbuffer_send();
+}
+
+/**
+ * @brief Enable display of 2D sprites
+ *
+ * This must be called before using #rdp_draw_textured_rectangle_scaled,
+ * #rdp_draw_textured_rectangle, #rdp_draw_sprite or #rdp_draw_sprite_scaled.
+ */
+void rdp_enable_texture_copy( void )
+{
+    /* Set other modes to copy and other defaults */
+    __rdp_ringbuffer_queue( 0xEFA000FF | (palette_enabled ? 0x00008000 : 0) );
+    __rdp_ringbuffer_queue( 0x00004001 );
+    __rdp_ringbuffer_send();
+}
+
+/**
+ * @brief Enable the palette lookup of color index textures
+ *
+ * Color index textures (#SPRITE_FORMAT_CI4 and #SPRITE_FORMAT_CI8 sprites) are drawn
+ * through the palette loaded with them, which must be enabled in the RDP mode: this setting
+ * is used by the following calls to #rdp_enable_texture_copy and #rdp_enable_triangle_mode.
+ * While it is enabled, other textures can't be drawn.
+ *
+ * @param[in] enable
+ *            True to draw color index textures, false for the other formats (default)
+ */
+void rdp_enable_palette( bool enable )
+{
+    palette_enabled = enable;
+}
+
+/**
+ * @brief Enable display of shaded, textured and/or Z-buffered triangles
+ *
+ * This must be called before using #rdp_draw_triangle, with the same flags used
+ * to draw the triangles.  Shaded triangles are drawn with the vertex colors,
+ * textured triangles with the texture (bilinear filtered), and shaded textured
+ * triangles with the texture modulated by the vertex colors.  Triangles which are
+ * neither shaded nor textured are drawn with the primitive color (see
+ * #rdp_set_primitive_color).  Z-buffered triangles are compared against the
+ * Z-buffer (see #rdp_attach_zbuffer), which is then updated.
+ *
+ * @param[in] flags
+ *            Type of triangles to draw: a combination of #TRIANGLE_SHADE,
+ *            #TRIANGLE_TEXTURE and #TRIANGLE_ZBUFFER
+ */
+void rdp_enable_triangle_mode( uint32_t flags )
+{
+    /* Color combiner inputs of the (A - B) * C + D equation, for color and alpha.  The
+     * same equation is used by both cycles. */
+    uint32_t a = 15, b = 15, c = 31, d = 3;
+    uint32_t aa = 7, ab = 7, ac = 7, ad = 3;
+
+    if( (flags & TRIANGLE_SHADE) && (flags & TRIANGLE_TEXTURE) )
+    {
+        /* TEXEL0 * SHADE */
+        a = 1; c = 4; d = 7;
+        aa = 1; ac = 4; ad = 7;
+    }
+    else if( flags & TRIANGLE_TEXTURE )
+    {
+        /* TEXEL0 */
+        d = 1; ad = 1;
+    }
+    else if( flags & TRIANGLE_SHADE )
+    {
+        /* SHADE */
+        d = 4; ad = 4;
+    }
+
+    __rdp_ringbuffer_queue( 0xFC000000 | (a << 20) | (c << 15) | (aa << 12) | (ac << 9) | (a << 5) | c );
+    __rdp_ringbuffer_queue( (b << 28) | (b << 24) | (aa << 21) | (ac << 18) | (d << 15) | (ab << 12) | (ad << 9) | (d << 6) | (ab << 3) | ad );
+
+    /* Set other modes to 1 cycle, bilinear filtering for textures and Z compare/update
+     * for Z-buffered triangles */
+    __rdp_ringbuffer_queue( 0xEF0000FF | ((flags & TRIANGLE_TEXTURE) ? 0x00002C00 : 0) | (palette_enabled ? 0x00008000 : 0) );
+    __rdp_ringbuffer_queue( (flags & TRIANGLE_ZBUFFER) ? 0x00000030 : 0 );
+    __rdp_ringbuffer_send();
+}
+
+/**
+ * @name RDP texture formats
+ * @{
+ */
+/** @brief RGBA texels */
+#define RDP_FORMAT_RGBA  0
+/** @brief Color index texels, looked up in the palette (TLUT) */
+#define RDP_FORMAT_CI    2
+/** @brief Intensity and alpha texels */
+#define RDP_FORMAT_IA    3
+/** @brief Intensity texels */
+#define RDP_FORMAT_I     4
+/** @} */
+
+/** @brief TMEM address of the palette of color index textures */
+#define TLUT_ADDRESS     2048
+
+/**
+ * @brief Get the RDP texture format of a sprite
+ *
+ * @param[in]  sprite
+ *             Pointer to the sprite structure
+ * @param[out] size
+ *             Size of the texels: 0 for 4 bits, 1 for 8 bits, 2 for 16 bits and 3 for 32 bits
+ *
+ * @return The RDP texture format (one of the RDP_FORMAT_* values)
+ */
+static uint32_t __rdp_sprite_format( sprite_t *sprite, uint32_t *size )
+{
+    switch( sprite->format )
+    {
+        case SPRITE_FORMAT_CI4: *size = 0; return RDP_FORMAT_CI;
+        case SPRITE_FORMAT_CI8: *size = 1; return RDP_FORMAT_CI;
+        case SPRITE_FORMAT_I4:  *size = 0; return RDP_FORMAT_I;
+        case SPRITE_FORMAT_I8:  *size = 1; return RDP_FORMAT_I;
+        case SPRITE_FORMAT_IA4: *size = 0; return RDP_FORMAT_IA;
+        case SPRITE_FORMAT_IA8: *size = 1; return RDP_FORMAT_IA;
+        default:
+            *size = (sprite->bitdepth == 2) ? 2 : 3;
+            return RDP_FORMAT_RGBA;
+    }
+}
+
+/**
+ * @brief Get the size of the pixels of a sprite, without the palette
+ *
+ * @param[in] sprite
+ *            Pointer to the sprite structure
+ *
+ * @return The size of the pixel data in bytes, rounded up to 8 bytes
+ */
+static uint32_t __rdp_sprite_pixels_size( sprite_t *sprite )
+{
+    uint32_t size;
+    __rdp_sprite_format( sprite, &size );
+
+    return (((sprite->width * sprite->height) << size) / 2 + 7) & ~7;
+}
+
+/**
+ * @brief Get the size of the data of a sprite, including the palette
+ *
+ * @param[in] sprite
+ *            Pointer to the sprite structure
+ *
+ * @return The size of the sprite data in bytes
+ */
+static uint32_t __rdp_sprite_data_size( sprite_t *sprite )
+{
+    uint32_t size;
+    uint32_t format = __rdp_sprite_format( sprite, &size );
+    uint32_t data_size = __rdp_sprite_pixels_size( sprite );
+
+    if( format == RDP_FORMAT_CI )
+    {
+        /* 16 or 256 16-bit colors */
+        data_size += (size ? 256 : 16) * 2;
+    }
+
+    return data_size;
+}
+
+/**
+ * @brief Calculate the size of a line of a texture in TMEM
+ *
+ * @param[in] real_width
+ *            Width of the texture, rounded up to a power of two
+ * @param[in] bits
+ *            Bits per texel
+ *
+ * @return The size of a line in 64-bit words
+ */
+static uint32_t __rdp_texture_line( uint32_t real_width, uint32_t bits )
+{
+    if( bits >= 16 )
+    {
+        /* Because we are dividing by 8, we want to round up if we have a remainder */
+        int round_amount = (real_width % 8) ? 1 : 0;
+
+        return ((real_width / 8) + round_amount) * (bits / 8);
+    }
+
+    return (real_width * bits / 8 + 7) / 8;
+}
+
+/**
+ * @brief Load the palette of a color index sprite into TMEM
+ *
+ * The palette is stored after the pixels of the sprite, and loaded in the upper half of
+ * TMEM.
+ *
+ * @param[in] texslot
+ *            The texture slot (0-7) used to load the palette
+ * @param[in] sprite
+ *            Pointer to the sprite structure
+ * @param[in] size
+ *            Size of the texels: 0 for 4 bits (16 colors), 1 for 8 bits (256 colors)
+ */
+static void __rdp_load_palette( uint32_t texslot, sprite_t *sprite, uint32_t size )
+{
+    uint32_t colors = size ? 256 : 16;
+    uint8_t *palette = (uint8_t *)sprite->data + __rdp_sprite_pixels_size( sprite );
+
+    __rdp_ringbuffer_queue( 0xFD100000 | (colors - 1) );
+    __rdp_ringbuffer_queue( (uint32_t)palette );
+    __rdp_ringbuffer_queue( 0xF5000000 | ((TLUT_ADDRESS / 8) & 0x1FF) );
+    __rdp_ringbuffer_queue( (texslot & 0x7) << 24 );
+    __rdp_ringbuffer_queue( 0xF0000000 );
+    __rdp_ringbuffer_queue( ((texslot & 0x7) << 24) | (((colors - 1) << 2) << 12) );
+    __rdp_ringbuffer_queue( 0xE6000000 );
+    __rdp_ringbuffer_queue( 0x00000000 );
+}
+
+/**
+ * @brief Remove from the texture cache the textures overwritten by a texture load
+ *
+ * Color index textures are removed when the palette is loaded again, and also when a
+ * load writes anywhere in the upper half of TMEM, where the palette is.
+ *
+ * @param[in] texslot
+ *            The texture slot (0-7) used by the load
+ * @param[in] start
+ *            Start of the TMEM range written by the load
+ * @param[in] end
+ *            End of the TMEM range written by the load (exclusive)
+ * @param[in] palette
+ *            True if the load writes the palette of color index textures
+ */
+static void __rdp_texcache_evict( uint32_t texslot, uint32_t start, uint32_t end, bool palette )
+{
+    if( end > TLUT_ADDRESS ) { palette = true; }
+
+    for( int i = 0; i < 8; i++ )
+    {
+        if( !texcache[i].sprite ) { continue; }
+
+        if( i == (texslot & 0x7) || (start < texcache[i].tmem_end && texcache[i].tmem_start < end) ||
+            (palette && texcache[i].palette) )
+        {
+            texcache[i].sprite = 0;
+        }
+    }
+}
+
+/**
+ * @brief Load a texture from RDRAM into RDP TMEM
+ *
+ * This function will take a texture from a sprite and place it into RDP TMEM at the offset and 
+ * texture slot specified.  It is capable of pulling out a smaller texture from a larger sprite
+ * map.  All the sprite formats are supported; the palette of color index sprites is loaded in
+ * the upper half of TMEM, so their texels must fit in the lower 2 KiB.
+ *
+ * @param[in] texslot
+ *            The texture slot (0-7) to assign this texture to
+ * @param[in] texloc
+ *            The offset in RDP TMEM to place this texture
+ * @param[in] mirror_enabled
+ *            Whether to mirror this texture when displaying
+ * @param[in] sprite
+ *            Pointer to the sprite structure to load the texture out of
+ * @param[in] sl
+ *            The pixel offset S of the top left of the texture relative to sprite space
+ * @param[in] tl
+ *            The pixel offset T of the top left of the texture relative to sprite space
+ * @param[in] sh
+ *            The pixel offset S of the bottom right of the texture relative to sprite space
+ * @param[in] th
+ *            The pixel offset T of the bottom right of the texture relative to sprite space
+ *
+ * @return The amount of texture memory in bytes that was consumed by this texture.
+ */
+static uint32_t __rdp_load_texture( uint32_t texslot, uint32_t texloc, mirror_t mirror_enabled, sprite_t *sprite, int sl, int tl, int sh, int th )
+{
+    uint32_t size;
+    uint32_t format = __rdp_sprite_format( sprite, &size );
+
+    /* Invalidate data associated with sprite in cache */
+    if( flush_strategy == FLUSH_STRATEGY_AUTOMATIC )
+    {
+        data_cache_hit_writeback_invalidate( sprite->data, __rdp_sprite_data_size( sprite ) );
+    }
+
+    /* The font and sprite atlases will be overwritten */
+    font_page = -1;
+    resident_atlas = 0;
+
+    if( format == RDP_FORMAT_CI )
+    {
+        __rdp_load_palette( texslot, sprite, size );
+    }
+
+    /* 4-bit textures can't be loaded with load tile: load them as 8-bit textures of half the width */
+    uint32_t load_size = size ? size : 1;
+    int sdiv = size ? 1 : 2;
+    assertf( size || !(sl & 1), "4-bit textures must start at an even column" );
+
+    /* Point the RDP at the actual sprite data */
+    __rdp_ringbuffer_queue( 0xFD000000 | (format << 21) | (load_size << 19) | (sprite->width / sdiv - 1) );
+    __rdp_ringbuffer_queue( (uint32_t)sprite->data );
+
+    /* Figure out the s,t coordinates of the sprite we are copying out of */
+    int twidth = sh - sl + 1;
+    int theight = th - tl + 1;
+
+    /* Figure out the power of two this sprite fits into */
+    uint32_t real_width  = __rdp_round_to_power( twidth );
+    uint32_t real_height = __rdp_round_to_power( theight );
+    uint32_t wbits = __rdp_log2( real_width );
+    uint32_t hbits = __rdp_log2( real_height );
+    uint32_t line = __rdp_texture_line( real_width, 4 << size );
+    uint32_t tile = ((texslot & 0x7) << 24) | (mirror_enabled != MIRROR_DISABLED ? 0x40100 : 0) | (hbits << 14 ) | (wbits << 4);
+
+    /* Instruct the RDP to copy the sprite data out */
+    __rdp_ringbuffer_queue( 0xF5000000 | (format << 21) | (load_size << 19) | ((line & 0x1FF) << 9) | ((texloc / 8) & 0x1FF) );
+    __rdp_ringbuffer_queue( tile );
+
+    /* Copying out only a chunk this time */
+    __rdp_ringbuffer_queue( 0xF4000000 | ((((sl / sdiv) << 2) & 0xFFF) << 12) | ((tl << 2) & 0xFFF) );
+    __rdp_ringbuffer_queue( (((texslot & 0x7) << 24)) | ((((sh / sdiv) << 2) & 0xFFF) << 12) | ((th << 2) & 0xFFF) );
+
+    if( !size )
+    {
+        /* Now describe the loaded data as a 4-bit texture */
+        __rdp_ringbuffer_queue( 0xE8000000 );
+        __rdp_ringbuffer_queue( 0x00000000 );
+        __rdp_ringbuffer_queue( 0xF5000000 | (format << 21) | ((line & 0x1FF) << 9) | ((texloc / 8) & 0x1FF) );
+        __rdp_ringbuffer_queue( tile );
+        __rdp_ringbuffer_queue( 0xF2000000 | (((sl << 2) & 0xFFF) << 12) | ((tl << 2) & 0xFFF) );
+        __rdp_ringbuffer_queue( ((texslot & 0x7) << 24) | (((sh << 2) & 0xFFF) << 12) | ((th << 2) & 0xFFF) );
+    }
+
+    /* Textures of the cache that were loaded over are not resident anymore */
+    __rdp_texcache_evict( texslot, texloc, texloc + line * 8 * real_height, false );
+    if( format == RDP_FORMAT_CI )
+    {
+        /* Each color of the palette takes 8 bytes of TMEM */
+        __rdp_texcache_evict( texslot, TLUT_ADDRESS, TLUT_ADDRESS + (size ? 256 : 16) * 8, true );
+    }
+
+    /* Save sprite width and height for managed sprite commands */
+    cache[texslot & 0x7].width = twidth - 1;
     cache[texslot & 0x7].height = theight - 1;
     cache[texslot & 0x7].s = sl;
     cache[texslot & 0x7].t = tl;
     cache[texslot & 0x7].real_width = real_width;
     cache[texslot & 0x7].real_height = real_height;
     
-    /* Return the amount of texture memory consumed by this texture */
-    return ((real_width / 8) + round_amount) * 8 * real_height * sprite->bitdepth;
+    /* Return the amount of texture memory consumed by this texture */
+    return line * 8 * real_height;
+}
+
+/**
+ * @brief Calculate the amount of RDP TMEM that a texture would consume
+ *
+ * This matches the value returned by #__rdp_load_texture for the same texture.
+ *
+ * @param[in] sprite
+ *            Pointer to the sprite structure to load the texture out of
+ * @param[in] sl
+ *            The pixel offset S of the top left of the texture relative to sprite space
+ * @param[in] tl
+ *            The pixel offset T of the top left of the texture relative to sprite space
+ * @param[in] sh
+ *            The pixel offset S of the bottom right of the texture relative to sprite space
+ * @param[in] th
+ *            The pixel offset T of the bottom right of the texture relative to sprite space
+ *
+ * @return The amount of texture memory in bytes that would be consumed by this texture.
+ */
+static uint32_t __rdp_texture_size( sprite_t *sprite, int sl, int tl, int sh, int th )
+{
+    uint32_t size;
+    __rdp_sprite_format( sprite, &size );
+
+    uint32_t real_width  = __rdp_round_to_power( sh - sl + 1 );
+    uint32_t real_height = __rdp_round_to_power( th - tl + 1 );
+
+    return __rdp_texture_line( real_width, 4 << size ) * 8 * real_height;
+}
+
+/**
+ * @brief Calculate the sprite space coordinates of a slice of a sprite
+ *
+ * See #rdp_load_texture_stride for the definition of the slices.
+ *
+ * @param[in] sprite
+ *            Pointer to the sprite structure
+ * @param[in] offset
+ *            Offset of the slice, or -1 for the whole sprite
+ * @param[out] sl
+ *            The pixel offset S of the top left of the slice
+ * @param[out] tl
+ *            The pixel offset T of the top left of the slice
+ * @param[out] sh
+ *            The pixel offset S of the bottom right of the slice
+ * @param[out] th
+ *            The pixel offset T of the bottom right of the slice
+ */
+static void __rdp_texture_slice( sprite_t *sprite, int offset, int *sl, int *tl, int *sh, int *th )
+{
+    if( offset < 0 )
+    {
+        *sl = 0;
+        *tl = 0;
+        *sh = sprite->width - 1;
+        *th = sprite->height - 1;
+        return;
+    }
+
+    /* Figure out the s,t coordinates of the sprite we are copying out of */
+    int twidth = sprite->width / sprite->hslices;
+    int theight = sprite->height / sprite->vslices;
+
+    *sl = (offset % sprite->hslices) * twidth;
+    *tl = (offset / sprite->hslices) * theight;
+    *sh = *sl + twidth - 1;
+    *th = *tl + theight - 1;
+}
+
+/**
+ * @brief Load a sprite into RDP TMEM
+ *
+ * Besides 16-bit and 32-bit RGBA sprites, the sprite can use any of the texture formats
+ * created by mksprite (see #SPRITE_FORMAT_CI4 and following): 4-bit and 8-bit formats take
+ * a quarter and a half of the TMEM of a 16-bit texture.  Color index sprites also load their
+ * palette in the upper half of TMEM (see #rdp_enable_palette).  Intensity formats are meant
+ * for textured triangles (see #rdp_enable_triangle_mode), since texture copy mode copies
+ * texels without converting them.
+ *
+ * @param[in] texslot
+ *            The RDP texture slot to load this sprite into (0-7)
+ * @param[in] texloc
+ *            The RDP TMEM offset to place the texture at
+ * @param[in] mirror
+ *            Whether the sprite should be mirrored when displaying past boundaries
+ * @param[in] sprite
+ *            Pointer to sprite structure to load the texture from
+ *
+ * @return The number of bytes consumed in RDP TMEM by loading this sprite
+ */
+uint32_t rdp_load_texture( uint32_t texslot, uint32_t texloc, mirror_t mirror, sprite_t *sprite )
+{
+    if( !sprite ) { return 0; }
+
+    uint32_t size = __rdp_load_texture( texslot, texloc, mirror, sprite, 0, 0, sprite->width - 1, sprite->height - 1 );
+    __rdp_ringbuffer_send();
+    return size;
+}
+
+/**
+ * @brief Load part of a sprite into RDP TMEM
+ *
+ * Given a sprite with vertical and horizontal slices defined, this function will load the slice specified in
+ * offset into texture memory.  This is usefl for treating a large sprite as a tilemap.
+ *
+ * Given a sprite with 3 horizontal slices and two vertical slices, the offsets are as follows:
+ *
+ * <pre>
+ * *---*---*---*
+ * | 0 | 1 | 2 |
+ * *---*---*---*
+ * | 3 | 4 | 5 |
+ * *---*---*---*
+ * </pre>
+ *
+ * @param[in] texslot
+ *            The RDP texture slot to load this sprite into (0-7)
+ * @param[in] texloc
+ *            The RDP TMEM offset to place the texture at
+ * @param[in] mirror
+ *            Whether the sprite should be mirrored when displaying past boundaries
+ * @param[in] sprite
+ *            Pointer to sprite structure to load the texture from
+ * @param[in] offset
+ *            Offset of the particular slice to load into RDP TMEM.
+ *
+ * @return The number of bytes consumed in RDP TMEM by loading this sprite
+ */
+uint32_t rdp_load_texture_stride( uint32_t texslot, uint32_t texloc, mirror_t mirror, sprite_t *sprite, int offset )
+{
+    if( !sprite ) { return 0; }
+
+    int sl, tl, sh, th;
+    __rdp_texture_slice( sprite, offset, &sl, &tl, &sh, &th );
+
+    uint32_t size = __rdp_load_texture( texslot, texloc, mirror, sprite, sl, tl, sh, th );
+    __rdp_ringbuffer_send();
+    return size;
+}
+
+/**
+ * @brief Return the end of the TMEM area available to a texture of the texture cache
+ *
+ * While a color index texture is resident, the upper half of TMEM holds its palette,
+ * so no other texture can be loaded there.
+ *
+ * @param[in] palette
+ *            True if the texture is a color index texture
+ *
+ * @return The end of the TMEM area the texture must fit in
+ */
+static uint32_t __rdp_texcache_limit( bool palette )
+{
+    for( int i = 0; i < 8 && !palette; i++ )
+    {
+        if( texcache[i].sprite && texcache[i].palette ) { palette = true; }
+    }
+
+    return palette ? TLUT_ADDRESS : TMEM_SIZE;
+}
+
+/**
+ * @brief Find a free range of TMEM for the texture cache
+ *
+ * @param[in]  size
+ *             Size of the range in bytes
+ * @param[in]  limit
+ *             End of the TMEM area the range must fit in
+ * @param[out] texloc
+ *             Start of the range
+ *
+ * @return A free texture slot to load the texture into, or -1 if either no texture slot
+ *         or no range of TMEM is free.
+ */
+static int __rdp_texcache_alloc( uint32_t size, uint32_t limit, uint32_t *texloc )
+{
+    int slot = -1;
+
+    for( int i = 0; i < 8 && slot < 0; i++ )
+    {
+        if( !texcache[i].sprite ) { slot = i; }
+    }
+
+    if( slot < 0 ) { return -1; }
+
+    /* A free range starts either at the start of TMEM or right after a resident texture:
+     * take the lowest one that fits */
+    uint32_t best = TMEM_SIZE;
+
+    for( int i = -1; i < 8; i++ )
+    {
+        if( i >= 0 && !texcache[i].sprite ) { continue; }
+
+        uint32_t start = (i < 0) ? 0 : texcache[i].tmem_end;
+        bool fits = start + size <= limit && start < best;
+
+        for( int j = 0; j < 8 && fits; j++ )
+        {
+            if( texcache[j].sprite && start < texcache[j].tmem_end && texcache[j].tmem_start < start + size ) { fits = false; }
+        }
+
+        if( fits ) { best = start; }
+    }
+
+    if( best == TMEM_SIZE ) { return -1; }
+
+    *texloc = best;
+    return slot;
+}
+
+/**
+ * @brief Make a texture resident in TMEM through the texture cache
+ *
+ * Same as #rdp_texture_cache_load, but the commands are only queued in the ring buffer,
+ * and not sent to the RDP.
+ *
+ * @param[in] sprite
+ *            Pointer to sprite structure to load the texture from
+ * @param[in] offset
+ *            Slice of the sprite (see #rdp_load_texture_stride), or -1 for the whole sprite
+ * @param[in] mirror
+ *            Whether the sprite should be mirrored when displaying past boundaries
+ *
+ * @return The texture slot holding the texture
+ */
+static uint32_t __rdp_texcache_load( sprite_t *sprite, int offset, mirror_t mirror )
+{
+    bool mirrored = mirror != MIRROR_DISABLED;
+
+    texcache_clock++;
+
+    for( int i = 0; i < 8; i++ )
+    {
+        if( texcache[i].sprite == sprite && texcache[i].offset == offset && texcache[i].mirror == mirrored )
+        {
+            texcache[i].last_use = texcache_clock;
+            texcache_stats.hits++;
+            return i;
+        }
+    }
+
+    texcache_stats.misses++;
+
+    int sl, tl, sh, th;
+    __rdp_texture_slice( sprite, offset, &sl, &tl, &sh, &th );
+
+    /* The texels of color index textures must leave room for the palette */
+    uint32_t texel_size;
+    bool palette = __rdp_sprite_format( sprite, &texel_size ) == RDP_FORMAT_CI;
+    uint32_t size = __rdp_texture_size( sprite, sl, tl, sh, th );
+    assertf( size <= (palette ? TLUT_ADDRESS : TMEM_SIZE), "texture too large for TMEM: %lu bytes", size );
+
+    int slot;
+    uint32_t texloc;
+
+    while( (slot = __rdp_texcache_alloc( size, __rdp_texcache_limit( palette ), &texloc )) < 0 )
+    {
+        /* Evict the least recently used texture until there is room.  Since the whole TMEM
+         * is free when no texture is resident (and no palette is reserved), this always
+         * terminates. */
+        int lru = -1;
+
+        for( int i = 0; i < 8; i++ )
+        {
+            if( texcache[i].sprite && (lru < 0 || texcache[i].last_use < texcache[lru].last_use) ) { lru = i; }
+        }
+
+        texcache[lru].sprite = 0;
+        texcache_stats.evictions++;
+    }
+
+    /* Rectangles using the evicted textures must be drawn before loading over them */
+    __rdp_ringbuffer_queue( 0xE7000000 );
+    __rdp_ringbuffer_queue( 0x00000000 );
+
+    __rdp_load_texture( slot, texloc, mirror, sprite, sl, tl, sh, th );
+
+    texcache[slot].sprite = sprite;
+    texcache[slot].offset = offset;
+    texcache[slot].mirror = mirrored;
+    texcache[slot].palette = palette;
+    texcache[slot].tmem_start = texloc;
+    texcache[slot].tmem_end = texloc + size;
+    texcache[slot].last_use = texcache_clock;
+
+    return slot;
+}
+
+/**
+ * @brief Load a sprite into RDP TMEM through the texture cache
+ *
+ * Rather than having the caller pick a texture slot and a TMEM offset as in
+ * #rdp_load_texture_stride, the texture cache allocates them, and keeps track of the
+ * textures resident in TMEM across calls and frames: if the same slice of the same sprite
+ * is still resident, nothing is loaded.  When TMEM or the texture slots are exhausted, the
+ * least recently used textures are evicted.
+ *
+ * Loading textures into TMEM by other means (#rdp_load_texture, #rdp_draw_sprite_region,
+ * sprite atlases and text) evicts the cached textures they overwrite, so the cache always
+ * knows what is resident.  However, the cache cannot know when the pixels of a sprite
+ * change: call #rdp_texture_cache_invalidate after modifying a sprite.  Note also that
+ * when a texture is found resident, its data is not flushed from the CPU cache.
+ *
+ * @param[in] sprite
+ *            Pointer to sprite structure to load the texture from
+ * @param[in] offset
+ *            Slice of the sprite (see #rdp_load_texture_stride), or -1 for the whole sprite
+ * @param[in] mirror
+ *            Whether the sprite should be mirrored when displaying past boundaries
+ *
+ * @return The texture slot (0-7) holding the texture, to be used with #rdp_draw_sprite and
+ *         the other drawing functions.
+ */
+uint32_t rdp_texture_cache_load( sprite_t *sprite, int offset, mirror_t mirror )
+{
+    assertf( sprite, "invalid sprite" );
+
+    uint32_t slot = __rdp_texcache_load( sprite, offset, mirror );
+    __rdp_ringbuffer_send();
+    return slot;
+}
+
+/**
+ * @brief Forget the textures of a sprite resident in TMEM
+ *
+ * The next time the sprite is loaded with #rdp_texture_cache_load, its texture will be
+ * loaded again from RDRAM.
+ *
+ * @param[in] sprite
+ *            The sprite whose pixels changed, or NULL to forget all the textures
+ */
+void rdp_texture_cache_invalidate( sprite_t *sprite )
+{
+    for( int i = 0; i < 8; i++ )
+    {
+        if( !sprite || texcache[i].sprite == sprite ) { texcache[i].sprite = 0; }
+    }
+}
+
+/**
+ * @brief Get the statistics of the texture cache
+ *
+ * The counters are reset by #rdp_init.  Comparing them across frames gives the number
+ * of texture loads done and saved by #rdp_texture_cache_load and #rdp_draw_sprite_batch.
+ *
+ * @param[out] stats
+ *             Structure to fill with the statistics
+ */
+void rdp_texture_cache_get_stats( rdp_texture_cache_stats_t *stats )
+{
+    *stats = texcache_stats;
+}
+
+/**
+ * @brief Draw a textured rectangle with a scaled texture
+ *
+ * Same as #rdp_draw_textured_rectangle_scaled, but the command is only queued
+ * in the ring buffer, and not sent to the RDP.
+ *
+ * @param[in] texslot
+ *            The texture slot that the texture was previously loaded into (0-7)
+ * @param[in] tx
+ *            The pixel X location of the top left of the rectangle
+ * @param[in] ty
+ *            The pixel Y location of the top left of the rectangle
+ * @param[in] bx
+ *            The pixel X location of the bottom right of the rectangle
+ * @param[in] by
+ *            The pixel Y location of the bottom right of the rectangle
+ * @param[in] x_scale
+ *            Horizontal scaling factor
+ * @param[in] y_scale
+ *            Vertical scaling factor
+ * @param[in] mirror
+ *            Whether the texture should be mirrored
+ */
+static void __rdp_draw_textured_rectangle_scaled( uint32_t texslot, int tx, int ty, int bx, int by, double x_scale, double y_scale, mirror_t mirror )
+{
+    uint16_t s = cache[texslot & 0x7].s << 5;
+    uint16_t t = cache[texslot & 0x7].t << 5;
+    uint32_t width = cache[texslot & 0x7].width;
+    uint32_t height = cache[texslot & 0x7].height;
+    int clip[4];
+
+    /* Rectangles entirely outside of the clipping boundary cost no RDP time */
+    if( !__rdp_rectangle_visible( tx, ty, bx, by ) ) { return; }
+    __rdp_get_clip_area( clip );
+
+    /* Clip the size, moving the S,T coords of the top left corner accordingly */
+    if( tx < clip[0] )
+    {
+        s += (int)(((double)((clip[0] - tx) << 5)) * (1.0 / x_scale));
+        tx = clip[0];
+    }
+
+    if( ty < clip[1] )
+    {
+        t += (int)(((double)((clip[1] - ty) << 5)) * (1.0 / y_scale));
+        ty = clip[1];
+    }
+
+    if( bx >= clip[2] ) { bx = clip[2] - 1; }
+    if( by >= clip[3] ) { by = clip[3] - 1; }
+
+     // mirror horizontally or vertically
+    if (mirror != MIRROR_DISABLED)
+    {	
+        if (mirror == MIRROR_X || mirror == MIRROR_XY)
+            s += ( (width+1) + ((cache[texslot & 0x7].real_width-(width+1))<<1) ) << 5;
+	
+        if (mirror == MIRROR_Y || mirror == MIRROR_XY)
+            t += ( (height+1) + ((cache[texslot & 0x7].real_height-(height+1))<<1) ) << 5;	
+    }	
+
+    /* Calculate the scaling constants based on a 6.10 fixed point system */
+    int xs = (int)((1.0 / x_scale) * 4096.0);
+    int ys = (int)((1.0 / y_scale) * 1024.0);
+
+    /* Set up rectangle position in screen space */
+    __rdp_ringbuffer_queue( 0xE4000000 | (bx << 14) | (by << 2) );
+    __rdp_ringbuffer_queue( ((texslot & 0x7) << 24) | (tx << 14) | (ty << 2) );
+
+    /* Set up texture position and scaling to 1:1 copy */
+    __rdp_ringbuffer_queue( (s << 16) | t );
+    __rdp_ringbuffer_queue( (xs & 0xFFFF) << 16 | (ys & 0xFFFF) );
+}
+
+/**
+ * @brief Draw a textured rectangle with a scaled texture
+ *
+ * Given an already loaded texture, this function will draw a rectangle textured with the loaded texture
+ * at a scale other than 1.  This allows rectangles to be drawn with stretched or squashed textures.
+ * If the rectangle is larger than the texture after scaling, it will be tiled or mirrored based on the
+ * mirror setting given in the load texture command.
+ *
+ * The rectangle is clipped to the boundary set with #rdp_set_clipping, adjusting the texture
+ * coordinates accordingly, and nothing is sent to the RDP if it is entirely outside of it.
+ *
+ * Before using this command to draw a textured rectangle, use #rdp_enable_texture_copy to set the RDP
+ * up in texture mode.
+ *
+ * @param[in] texslot
+ *            The texture slot that the texture was previously loaded into (0-7)
+ * @param[in] tx
+ *            The pixel X location of the top left of the rectangle
+ * @param[in] ty
+ *            The pixel Y location of the top left of the rectangle
+ * @param[in] bx
+ *            The pixel X location of the bottom right of the rectangle
+ * @param[in] by
+ *            The pixel Y location of the bottom right of the rectangle
+ * @param[in] x_scale
+ *            Horizontal scaling factor
+ * @param[in] y_scale
+ *            Vertical scaling factor
+ * @param[in] mirror
+ *            Whether the texture should be mirrored
+ */
+void rdp_draw_textured_rectangle_scaled( uint32_t texslot, int tx, int ty, int bx, int by, double x_scale, double y_scale,  mirror_t mirror)
+{
+    __rdp_draw_textured_rectangle_scaled( texslot, tx, ty, bx, by, x_scale, y_scale, mirror );
+    __rdp_ringbuffer_send();
+}
+
+/**
+ * @brief Draw a textured rectangle
+ *
+ * Given an already loaded texture, this function will draw a rectangle textured with the loaded texture.
+ * If the rectangle is larger than the texture, it will be tiled or mirrored based on the* mirror setting
+ * given in the load texture command.
+ *
+ * Before using this command to draw a textured rectangle, use #rdp_enable_texture_copy to set the RDP
+ * up in texture mode.
+ *
+ * @param[in] texslot
+ *            The texture slot that the texture was previously loaded into (0-7)
+ * @param[in] tx
+ *            The pixel X location of the top left of the rectangle
+ * @param[in] ty
+ *            The pixel Y location of the top left of the rectangle
+ * @param[in] bx
+ *            The pixel X location of the bottom right of the rectangle
+ * @param[in] by
+ *            The pixel Y location of the bottom right of the rectangle
+ * @param[in] mirror
+ *            Whether the texture should be mirrored
+ */
+void rdp_draw_textured_rectangle( uint32_t texslot, int tx, int ty, int bx, int by, mirror_t mirror )
+{
+    /* Simple wrapper */
+    rdp_draw_textured_rectangle_scaled( texslot, tx, ty, bx, by, 1.0, 1.0, mirror );
+}
+
+/**
+ * @brief Draw a texture to the screen as a sprite
+ *
+ * Given an already loaded texture, this function will draw a rectangle textured with the loaded texture.
+ *
+ * Before using this command to draw a textured rectangle, use #rdp_enable_texture_copy to set the RDP
+ * up in texture mode.
+ *
+ * @param[in] texslot
+ *            The texture slot that the texture was previously loaded into (0-7)
+ * @param[in] x
+ *            The pixel X location of the top left of the sprite
+ * @param[in] y
+ *            The pixel Y location of the top left of the sprite
+ * @param[in] mirror
+ *            Whether the texture should be mirrored
+ */
+void rdp_draw_sprite( uint32_t texslot, int x, int y, mirror_t mirror )
+{
+    /* Just draw a rectangle the size of the sprite */
+    rdp_draw_textured_rectangle_scaled( texslot, x, y, x + cache[texslot & 0x7].width, y + cache[texslot & 0x7].height, 1.0, 1.0, mirror );
+}
+
+/**
+ * @brief Draw a texture to the screen as a scaled sprite
+ *
+ * Given an already loaded texture, this function will draw a rectangle textured with the loaded texture.
+ *
+ * Before using this command to draw a textured rectangle, use #rdp_enable_texture_copy to set the RDP
+ * up in texture mode.
+ *
+ * @param[in] texslot
+ *            The texture slot that the texture was previously loaded into (0-7)
+ * @param[in] x
+ *            The pixel X location of the top left of the sprite
+ * @param[in] y
+ *            The pixel Y location of the top left of the sprite
+ * @param[in] x_scale
+ *            Horizontal scaling factor
+ * @param[in] y_scale
+ *            Vertical scaling factor
+ * @param[in] mirror
+ *            Whether the texture should be mirrored
+ */
+void rdp_draw_sprite_scaled( uint32_t texslot, int x, int y, double x_scale, double y_scale, mirror_t mirror )
+{
+    /* Since we want to still view the whole sprite, we must resize the rectangle area too */
+    int new_width = (int)(((double)cache[texslot & 0x7].width * x_scale) + 0.5);
+    int new_height = (int)(((double)cache[texslot & 0x7].height * y_scale) + 0.5);
+    
+    /* Draw a rectangle the size of the new sprite */
+    rdp_draw_textured_rectangle_scaled( texslot, x, y, x + new_width, y + new_height, x_scale, y_scale, mirror );
+}
+
+/**
+ * @brief Compare two sprites of a batch by layer and texture
+ *
+ * Used by #rdp_draw_sprite_batch to sort the indices of the sprites in #batch_sprites.
+ * Sprites sharing the same texture keep their submission order.
+ *
+ * @param[in] a
+ *            Pointer to the index of the first sprite
+ * @param[in] b
+ *            Pointer to the index of the second sprite
+ *
+ * @return A negative value if the first sprite must be drawn first, a positive value otherwise.
+ */
+static int __rdp_sprite_compare( const void *a, const void *b )
+{
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+    const rdp_sprite_t *sa = &batch_sprites[ia];
+    const rdp_sprite_t *sb = &batch_sprites[ib];
+    int ma = sa->mirror != MIRROR_DISABLED;
+    int mb = sb->mirror != MIRROR_DISABLED;
+
+    if( sa->layer != sb->layer ) { return sa->layer < sb->layer ? -1 : 1; }
+    if( sa->sprite != sb->sprite ) { return (uint32_t)sa->sprite < (uint32_t)sb->sprite ? -1 : 1; }
+    if( sa->offset != sb->offset ) { return sa->offset < sb->offset ? -1 : 1; }
+    if( ma != mb ) { return ma - mb; }
+
+    return ia - ib;
+}
+
+/**
+ * @brief Draw a batch of sprites
+ *
+ * This function draws a set of sprites, each one with its own texture, position, scale
+ * and mirror settings.  Compared to loading and drawing each sprite with #rdp_load_texture
+ * and #rdp_draw_sprite_scaled, the sprites are sorted by texture so that each texture is
+ * loaded only once per layer, and textures are loaded through the texture cache (see
+ * #rdp_texture_cache_load), so that a texture used again in a later layer, or in a later
+ * frame, does not need to be loaded again while it is still in TMEM.  All the commands are
+ * then sent to the RDP as a single contiguous command stream.
+ *
+ * Sprites are drawn in order of layer.  Within the same layer, sprites using the same
+ * texture are drawn in the order they appear in the array, but there is no guarantee on
+ * the order between sprites using different textures: use different layers for sprites
+ * that overlap each other.
+ *
+ * The batch is drawn using all the texture slots and the whole TMEM, so textures loaded
+ * with #rdp_load_texture must be considered lost after calling this function.
+ *
+ * Before calling this function, use #rdp_enable_texture_copy to set the RDP up in
+ * texture mode.
+ *
+ * @param[in] sprites
+ *            Array of sprites to draw
+ * @param[in] count
+ *            Number of sprites in the array
+ */
+void rdp_draw_sprite_batch( const rdp_sprite_t *sprites, int count )
+{
+    if( !sprites || count <= 0 ) { return; }
+
+    /* Sort the sprites by layer and texture, reusing the scratch memory of the previous batch */
+    arena_reset( &batch_arena );
+    int *order = arena_alloc( &batch_arena, count * sizeof(int) );
+    if( !order )
+    {
+        arena_close( &batch_arena );
+        if( arena_init( &batch_arena, NULL, count * sizeof(int) ) ) { return; }
+        order = arena_alloc( &batch_arena, count * sizeof(int) );
+    }
+
+    for( int i = 0; i < count; i++ ) { order[i] = i; }
+
+    batch_sprites = sprites;
+    qsort( order, count, sizeof(int), __rdp_sprite_compare );
+
+    for( int i = 0; i < count; i++ )
+    {
+        const rdp_sprite_t *spr = &sprites[order[i]];
+
+        if( !spr->sprite ) { continue; }
+
+        /* Skip sprites outside of the clipping boundary before loading their texture */
+        int sl, tl, sh, th;
+        __rdp_texture_slice( spr->sprite, spr->offset, &sl, &tl, &sh, &th );
+        if( !__rdp_rectangle_visible( spr->x, spr->y,
+                                      spr->x + (int)(((double)(sh - sl) * spr->x_scale) + 0.5),
+                                      spr->y + (int)(((double)(th - tl) * spr->y_scale) + 0.5) ) ) { continue; }
+
+        /* Only textures not resident yet, or evicted by previous sprites, are loaded */
+        uint32_t slot = __rdp_texcache_load( spr->sprite, spr->offset, spr->mirror );
+
+        /* Since we want to still view the whole sprite, we must resize the rectangle area too */
+        int new_width = (int)(((double)cache[slot].width * spr->x_scale) + 0.5);
+        int new_height = (int)(((double)cache[slot].height * spr->y_scale) + 0.5);
+
+        __rdp_draw_textured_rectangle_scaled( slot, spr->x, spr->y, spr->x + new_width, spr->y + new_height, spr->x_scale, spr->y_scale, spr->mirror );
+
+        /* Wrap around the ring buffer if needed before the next sprite, which might be
+         * split otherwise */
+        if( rdp_end > (rdp_ringbuffer_size - RINGBUFFER_SLACK) ) { __rdp_ringbuffer_submit(); }
+    }
+
+    __rdp_ringbuffer_send();
 }
 
 /**
- * @brief Load a sprite into RDP TMEM
+ * @brief Set the primitive draw color for subsequent filled primitive operations
  *
- * @param[in] texslot
- *            The RDP texture slot to load this sprite into (0-7)
- * @param[in] texloc
- *            The RDP TMEM offset to place the texture at
- * @param[in] mirror
- *            Whether the sprite should be mirrored when displaying past boundaries
- * @param[in] sprite
- *            Pointer to sprite structure to load the texture from
+ * This function sets the color of all #rdp_draw_filled_rectangle operations that follow.
+ * Note that in 16 bpp mode, the color must be a packed color.  This means that the high
+ * 16 bits and the low 16 bits must both be the same color.  Use #graphics_make_color or
+ * #graphics_convert_color to generate valid colors.
  *
- * @return The number of bytes consumed in RDP TMEM by loading this sprite
+ * @param[in] color
+ *            Color to draw primitives in
  */
-uint32_t rdp_load_texture( uint32_t texslot, uint32_t texloc, mirror_t mirror, sprite_t *sprite )
+void rdp_set_primitive_color( uint32_t color )
 {
-    if( !sprite ) { return 0; }
+    /* Set packed color */
+    __rdp_ringbuffer_queue( 0xF7000000 );
+    __rdp_ringbuffer_queue( color );
+    __rdp_ringbuffer_send();
+}
 
-    return __rdp_load_texture( texslot, texloc, mirror, sprite, 0, 0, sprite->width - 1, sprite->height - 1 );
+/**
+ * @brief Set the blend draw color for subsequent filled primitive operations
+ *
+ * This function sets the color of all #rdp_draw_filled_triangle operations that follow.
+ *
+ * @param[in] color
+ *            Color to draw primitives in
+ */
+void rdp_set_blend_color( uint32_t color )
+{
+    __rdp_ringbuffer_queue( 0xF9000000 );
+    __rdp_ringbuffer_queue( color );
+    __rdp_ringbuffer_send();
 }
 
 /**
- * @brief Load part of a sprite into RDP TMEM
+ * @brief Draw a filled rectangle
  *
- * Given a sprite with vertical and horizontal slices defined, this function will load the slice specified in
- * offset into texture memory.  This is usefl for treating a large sprite as a tilemap.
+ * Given a color set with #rdp_set_primitive_color, this will draw a filled rectangle
+ * to the screen.  This is most often useful for erasing a buffer before drawing to it
+ * by displaying a black rectangle the size of the screen.  This is much faster than
+ * setting the buffer blank in software.  However, if you are planning on drawing to
+ * the entire screen, blanking may be unnecessary.  
  *
- * Given a sprite with 3 horizontal slices and two vertical slices, the offsets are as follows:
+ * Before calling this function, make sure that the RDP is set to primitive mode by
+ * calling #rdp_enable_primitive_fill.
  *
- * <pre>
- * *---*---*---*
- * | 0 | 1 | 2 |
- * *---*---*---*
- * | 3 | 4 | 5 |
- * *---*---*---*
- * </pre>
+ * @param[in] tx
+ *            Pixel X location of the top left of the rectangle
+ * @param[in] ty
+ *            Pixel Y location of the top left of the rectangle
+ * @param[in] bx
+ *            Pixel X location of the bottom right of the rectangle
+ * @param[in] by
+ *            Pixel Y location of the bottom right of the rectangle
+ */
+void rdp_draw_filled_rectangle( int tx, int ty, int bx, int by )
+{
+    if( tx < 0 ) { tx = 0; }
+    if( ty < 0 ) { ty = 0; }
+
+    __rdp_ringbuffer_queue( 0xF6000000 | ( bx << 14 ) | ( by << 2 ) ); 
+    __rdp_ringbuffer_queue( ( tx << 14 ) | ( ty << 2 ) );
+    __rdp_ringbuffer_send();
+}
+
+/**
+ * @brief Clear the attached display context and Z-buffer
+ *
+ * Queue fill mode rectangles that set the display context attached with #rdp_attach_display
+ * to a color and, if one is attached with #rdp_attach_zbuffer, the Z-buffer to the farthest
+ * depth.  The RDP fills 64 bits per cycle, and the CPU goes on while the clear happens, so
+ * this is much faster than #graphics_fill_screen.  Only the area being drawn (see
+ * #rdp_set_dynamic_resolution) within the clipping boundary is cleared.
+ *
+ * This leaves the RDP in fill mode, as #rdp_enable_primitive_fill.
+ *
+ * @param[in] color
+ *            Color to clear the display context to.  Use #graphics_convert_color or
+ *            #graphics_make_color to generate this value.
+ */
+void rdp_clear( uint32_t color )
+{
+    if( attached_display == 0 ) { return; }
+
+    rdp_sync( SYNC_PIPE );
+    rdp_enable_primitive_fill();
+
+    if( attached_zbuffer )
+    {
+        /* The Z-buffer is filled as a 16-bit color image, two pixels per fill color */
+        __rdp_set_color_image( 2, attached_zbuffer );
+        rdp_set_primitive_color( (ZBUFFER_FAR << 16) | ZBUFFER_FAR );
+        rdp_draw_filled_rectangle( 0, 0, rdp_width - 1, rdp_height - 1 );
+
+        /* Draw to the display context again once the Z-buffer is filled */
+        rdp_sync( SYNC_PIPE );
+        __rdp_set_color_image( __bitdepth, __get_buffer( attached_display ) );
+    }
+
+    rdp_set_primitive_color( color );
+    rdp_draw_filled_rectangle( 0, 0, rdp_width - 1, rdp_height - 1 );
+}
+
+/**
+ * @brief Convert a float to a signed fixed point value with 16 fractional bits
+ */
+#define __rdp_fx16( f )  ((int32_t)((f) * 65536.0f))
+
+/**
+ * @brief Compute the coefficients of an attribute of a triangle (color, texture or depth)
+ *
+ * The attribute is interpolated over the plane defined by the three vertices.  All the
+ * values are in 16.16 fixed point, and positions in the format used by #rdp_draw_triangle
+ * (X in 16.16, Y in 11.2).
+ *
+ * @param[in] a1
+ *            Value of the attribute at the top vertex
+ * @param[in] a2
+ *            Value of the attribute at the middle vertex
+ * @param[in] a3
+ *            Value of the attribute at the bottom vertex
+ * @param[in] geom
+ *            Edge vectors and slope of the triangle
+ * @param[out] coeffs
+ *            Value at the start of the major edge, and derivatives along X, along the major edge and along Y
+ */
+static void __rdp_triangle_attribute( int32_t a1, int32_t a2, int32_t a3, const int64_t geom[7], int32_t coeffs[4] )
+{
+    int64_t hx = geom[0], hy = geom[1], mx = geom[2], my = geom[3], nz = geom[4];
+    int64_t dxhdy = geom[5], fy = geom[6];
+    int64_t ha = (int64_t)a3 - a1;
+    int64_t ma = (int64_t)a2 - a1;
+
+    /* Degenerate triangles have no plane: keep the attribute constant */
+    if( nz == 0 )
+    {
+        coeffs[0] = a1;
+        coeffs[1] = coeffs[2] = coeffs[3] = 0;
+        return;
+    }
+
+    /* Solve the plane equation through the three vertices.  Y is in 11.2, so the
+     * cross product is four times the one in pixels. */
+    int32_t dadx = ((hy * ma - my * ha) * 65536) / nz;
+    int32_t dady = ((mx * ha - hx * ma) * 4) / nz;
+    int32_t dade = dady + ((dadx * dxhdy) >> 16);
+
+    /* The major edge starts at the top of the scanline of the top vertex */
+    coeffs[0] = a1 + ((dade * fy) >> 2);
+    coeffs[1] = dadx;
+    coeffs[2] = dade;
+    coeffs[3] = dady;
+}
+
+/**
+ * @brief Queue the coefficients of a group of four attributes of a triangle
+ *
+ * This is the layout of the shade (R, G, B, A) and texture (S, T, W) coefficients
+ * of a triangle command: integer parts come first, followed by fractional parts.
  *
+ * @param[in] coeffs
+ *            Coefficients of the four attributes, as computed by #__rdp_triangle_attribute
+ */
+static void __rdp_triangle_queue_attributes( int32_t coeffs[4][4] )
+{
+    /* Values and X derivatives first, then edge and Y derivatives */
+    for( int k = 0; k < 4; k += 2 )
+    {
+        /* Integer parts */
+        for( int i = k; i < k + 2; i++ )
+        {
+            __rdp_ringbuffer_queue( (coeffs[0][i] & 0xFFFF0000) | ((uint32_t)coeffs[1][i] >> 16) );
+            __rdp_ringbuffer_queue( (coeffs[2][i] & 0xFFFF0000) | ((uint32_t)coeffs[3][i] >> 16) );
+        }
+
+        /* Fractional parts */
+        for( int i = k; i < k + 2; i++ )
+        {
+            __rdp_ringbuffer_queue( ((uint32_t)coeffs[0][i] << 16) | (coeffs[1][i] & 0xFFFF) );
+            __rdp_ringbuffer_queue( ((uint32_t)coeffs[2][i] << 16) | (coeffs[3][i] & 0xFFFF) );
+        }
+    }
+}
+
+/**
+ * @brief Queue a triangle command
+ *
+ * The edges and the attributes of the triangle are computed in fixed point, with
+ * the same precision used by the RDP, so that adjacent triangles share their edges
+ * exactly.
+ *
+ * @param[in] flags
+ *            Attributes of the triangle: a combination of #TRIANGLE_SHADE,
+ *            #TRIANGLE_TEXTURE and #TRIANGLE_ZBUFFER
  * @param[in] texslot
- *            The RDP texture slot to load this sprite into (0-7)
- * @param[in] texloc
- *            The RDP TMEM offset to place the texture at
- * @param[in] mirror
- *            Whether the sprite should be mirrored when displaying past boundaries
+ *            The texture slot that the texture was loaded into (0-7)
+ * @param[in] v1
+ *            First vertex
+ * @param[in] v2
+ *            Second vertex
+ * @param[in] v3
+ *            Third vertex
+ */
+static void __rdp_draw_triangle( uint32_t flags, uint32_t texslot, const rdp_vertex_t *v1, const rdp_vertex_t *v2, const rdp_vertex_t *v3 )
+{
+    const rdp_vertex_t *temp;
+
+    /* sort vertices by Y ascending to find the major, mid and low edges */
+    if( v1->y > v2->y ) { temp = v1; v1 = v2; v2 = temp; }
+    if( v2->y > v3->y ) { temp = v2; v2 = v3; v3 = temp; }
+    if( v1->y > v2->y ) { temp = v1; v1 = v2; v2 = temp; }
+
+    /* Y coordinates in 11.2 fixed format, X coordinates in 16.16 fixed format */
+    int32_t y1 = (int32_t)(v1->y * 4.0f), y2 = (int32_t)(v2->y * 4.0f), y3 = (int32_t)(v3->y * 4.0f);
+    int32_t x1 = __rdp_fx16( v1->x ), x2 = __rdp_fx16( v2->x ), x3 = __rdp_fx16( v3->x );
+
+    /* Major (high) and mid edge vectors */
+    int64_t hx = (int64_t)x3 - x1, hy = y3 - y1;
+    int64_t mx = (int64_t)x2 - x1, my = y2 - y1;
+    int64_t lx = (int64_t)x3 - x2, ly = y3 - y2;
+
+    /* inverse slopes in 16.16 fixed format */
+    int32_t dxhdy = hy ? (int32_t)((hx * 4) / hy) : 0;
+    int32_t dxmdy = my ? (int32_t)((mx * 4) / my) : 0;
+    int32_t dxldy = ly ? (int32_t)((lx * 4) / ly) : 0;
+
+    /* determine the winding of the triangle: the major edge is on the left
+     * if the mid vertex is on its right */
+    int64_t nz = mx * hy - hx * my;
+    uint32_t lft = (nz > 0) ? 1 : 0;
+
+    /* The RDP starts walking the edges from the top of the scanline containing the
+     * top vertex: move the start of the major and mid edges there */
+    int64_t fy = (int64_t)(y1 & ~3) - y1;
+    int32_t xh = x1 + (int32_t)((dxhdy * fy) / 4);
+    int32_t xm = x1 + (int32_t)((dxmdy * fy) / 4);
+    int32_t xl = x2;
+
+    uint32_t cmd = 0xC8 | (flags & (TRIANGLE_SHADE | TRIANGLE_TEXTURE | TRIANGLE_ZBUFFER));
+
+    __rdp_ringbuffer_queue( (cmd << 24) | (lft << 23) | ((texslot & 0x7) << 16) | (y3 & 0x3FFF) );
+    __rdp_ringbuffer_queue( ((y2 & 0x3FFF) << 16) | (y1 & 0x3FFF) );
+    __rdp_ringbuffer_queue( xl );
+    __rdp_ringbuffer_queue( dxldy );
+    __rdp_ringbuffer_queue( xh );
+    __rdp_ringbuffer_queue( dxhdy );
+    __rdp_ringbuffer_queue( xm );
+    __rdp_ringbuffer_queue( dxmdy );
+
+    if( !(flags & (TRIANGLE_SHADE | TRIANGLE_TEXTURE | TRIANGLE_ZBUFFER)) ) { return; }
+
+    const int64_t geom[7] = { hx, hy, mx, my, nz, dxhdy, fy };
+    int32_t coeffs[4][4];
+
+    if( flags & TRIANGLE_SHADE )
+    {
+        __rdp_triangle_attribute( __rdp_fx16( v1->r ), __rdp_fx16( v2->r ), __rdp_fx16( v3->r ), geom, coeffs[0] );
+        __rdp_triangle_attribute( __rdp_fx16( v1->g ), __rdp_fx16( v2->g ), __rdp_fx16( v3->g ), geom, coeffs[1] );
+        __rdp_triangle_attribute( __rdp_fx16( v1->b ), __rdp_fx16( v2->b ), __rdp_fx16( v3->b ), geom, coeffs[2] );
+        __rdp_triangle_attribute( __rdp_fx16( v1->a ), __rdp_fx16( v2->a ), __rdp_fx16( v3->a ), geom, coeffs[3] );
+        __rdp_triangle_queue_attributes( coeffs );
+    }
+
+    if( flags & TRIANGLE_TEXTURE )
+    {
+        /* Texture coordinates are in 10.5 format, relative to the original texture.  There
+         * is no perspective correction, so W is left to zero. */
+        float s = cache[texslot & 0x7].s, t = cache[texslot & 0x7].t;
+
+        __rdp_triangle_attribute( __rdp_fx16( (v1->s + s) * 32.0f ), __rdp_fx16( (v2->s + s) * 32.0f ), __rdp_fx16( (v3->s + s) * 32.0f ), geom, coeffs[0] );
+        __rdp_triangle_attribute( __rdp_fx16( (v1->t + t) * 32.0f ), __rdp_fx16( (v2->t + t) * 32.0f ), __rdp_fx16( (v3->t + t) * 32.0f ), geom, coeffs[1] );
+        memset( coeffs[2], 0, sizeof(coeffs[2]) * 2 );
+        __rdp_triangle_queue_attributes( coeffs );
+    }
+
+    if( flags & TRIANGLE_ZBUFFER )
+    {
+        /* Depth is in the range [0..1], mapped to the 15-bit integer part */
+        __rdp_triangle_attribute( __rdp_fx16( v1->z * 0x7FFF ), __rdp_fx16( v2->z * 0x7FFF ), __rdp_fx16( v3->z * 0x7FFF ), geom, coeffs[0] );
+        __rdp_ringbuffer_queue( coeffs[0][0] );
+        __rdp_ringbuffer_queue( coeffs[0][1] );
+        __rdp_ringbuffer_queue( coeffs[0][2] );
+        __rdp_ringbuffer_queue( coeffs[0][3] );
+    }
+}
+
+/**
+ * @brief Draw a triangle with shading, texturing and/or Z-buffering
+ *
+ * This will draw a triangle to the screen, interpolating the attributes specified in
+ * the vertices across the triangle.  Vertex order is not important.
+ *
+ * Before calling this function, make sure that the RDP is set to triangle mode by
+ * calling #rdp_enable_triangle_mode with the same flags.  If the triangle is textured,
+ * the texture must be loaded into texslot with #rdp_load_texture; if it is Z-buffered,
+ * a Z-buffer must be attached with #rdp_attach_zbuffer.
+ *
+ * @param[in] flags
+ *            Attributes of the triangle: a combination of #TRIANGLE_SHADE,
+ *            #TRIANGLE_TEXTURE and #TRIANGLE_ZBUFFER
+ * @param[in] texslot
+ *            The texture slot that the texture was loaded into (0-7)
+ * @param[in] v1
+ *            First vertex
+ * @param[in] v2
+ *            Second vertex
+ * @param[in] v3
+ *            Third vertex
+ */
+void rdp_draw_triangle( uint32_t flags, uint32_t texslot, const rdp_vertex_t *v1, const rdp_vertex_t *v2, const rdp_vertex_t *v3 )
+{
+    __rdp_draw_triangle( flags, texslot, v1, v2, v3 );
+    __rdp_ringbuffer_send();
+}
+
+/**
+ * @brief Draw a filled triangle
+ *
+ * Given a color set with #rdp_set_blend_color, this will draw a filled triangle
+ * to the screen. Vertex order is not important.
+ *
+ * Before calling this function, make sure that the RDP is set to blend mode by
+ * calling #rdp_enable_blend_fill.
+ *
+ * @param[in] x1
+ *            Pixel X1 location of triangle
+ * @param[in] y1
+ *            Pixel Y1 location of triangle
+ * @param[in] x2
+ *            Pixel X2 location of triangle
+ * @param[in] y2
+ *            Pixel Y2 location of triangle
+ * @param[in] x3
+ *            Pixel X3 location of triangle
+ * @param[in] y3
+ *            Pixel Y3 location of triangle
+ */
+void rdp_draw_filled_triangle( float x1, float y1, float x2, float y2, float x3, float y3 )
+{
+    rdp_vertex_t v1 = { .x = x1, .y = y1 };
+    rdp_vertex_t v2 = { .x = x2, .y = y2 };
+    rdp_vertex_t v3 = { .x = x3, .y = y3 };
+
+    rdp_draw_triangle( 0, 0, &v1, &v2, &v3 );
+}
+
+/**
+ * @brief Set the flush strategy for texture loads
+ *
+ * If textures are guaranteed to be in uncached RDRAM or the cache
+ * is flushed before calling load operations, the RDP can be told
+ * to skip flushing the cache.  This affords a good speedup.  However,
+ * if you are changing textures in memory on the fly or otherwise do
+ * not want to deal with cache coherency, set the cache strategy to
+ * automatic to have the RDP flush cache before texture loads.
+ *
+ * @param[in] flush
+ *            The cache strategy, either #FLUSH_STRATEGY_NONE or
+ *            #FLUSH_STRATEGY_AUTOMATIC.
+ */
+void rdp_set_texture_flush( flush_t flush )
+{
+    flush_strategy = flush;
+}
+
+/**
+ * @brief Copy a region of a sprite to the screen
+ *
+ * The region is loaded into TMEM and drawn in horizontal strips, so, unlike the
+ * textures loaded with #rdp_load_texture, it can be larger than TMEM.  This uses
+ * texture slot 0 and all of TMEM, so textures previously loaded must be loaded
+ * again afterwards.
+ *
+ * Before calling this function, make sure that the RDP is set to texture mode
+ * by calling #rdp_enable_texture_copy.  Only 16-bit sprites can be drawn this way.
+ *
  * @param[in] sprite
- *            Pointer to sprite structure to load the texture from
- * @param[in] offset
- *            Offset of the particular slice to load into RDP TMEM.
+ *            Pointer to the sprite structure to copy the region out of
+ * @param[in] sx
+ *            The pixel X location of the top left of the region in the sprite
+ * @param[in] sy
+ *            The pixel Y location of the top left of the region in the sprite
+ * @param[in] width
+ *            Width of the region in pixels
+ * @param[in] height
+ *            Height of the region in pixels
+ * @param[in] x
+ *            The pixel X location where to draw the top left of the region
+ * @param[in] y
+ *            The pixel Y location where to draw the top left of the region
+ */
+void rdp_draw_sprite_region( sprite_t *sprite, int sx, int sy, int width, int height, int x, int y )
+{
+    if( sprite == 0 || width <= 0 || height <= 0 ) { return; }
+
+    /* Only load the part of the region inside of the clipping boundary */
+    int clip[4];
+    __rdp_get_clip_area( clip );
+
+    if( x < clip[0] ) { sx += clip[0] - x; width -= clip[0] - x; x = clip[0]; }
+    if( y < clip[1] ) { sy += clip[1] - y; height -= clip[1] - y; y = clip[1]; }
+    if( x + width > clip[2] ) { width = clip[2] - x; }
+    if( y + height > clip[3] ) { height = clip[3] - y; }
+    if( width <= 0 || height <= 0 ) { return; }
+
+    /* Find the largest strip that fits TMEM: texture sizes are rounded up to powers of two */
+    uint32_t row_size = __rdp_texture_size( sprite, 0, 0, width - 1, 0 );
+    assertf( row_size <= TMEM_SIZE, "sprite region too wide: %d pixels", width );
+
+    int strip = 1;
+    while( strip * 2 * row_size <= TMEM_SIZE ) { strip *= 2; }
+
+    /* Flush the sprite once rather than for every strip */
+    flush_t flush = flush_strategy;
+    if( flush == FLUSH_STRATEGY_AUTOMATIC )
+    {
+        data_cache_hit_writeback_invalidate( sprite->data, sprite->width * sprite->height * sprite->bitdepth );
+    }
+    flush_strategy = FLUSH_STRATEGY_NONE;
+
+    for( int ty = 0; ty < height; ty += strip )
+    {
+        int h = (height - ty < strip) ? height - ty : strip;
+
+        /* The previous strip must be drawn before loading over it */
+        __rdp_ringbuffer_queue( 0xE7000000 );
+        __rdp_ringbuffer_queue( 0x00000000 );
+
+        __rdp_load_texture( 0, 0, MIRROR_DISABLED, sprite, sx, sy + ty, sx + width - 1, sy + ty + h - 1 );
+        __rdp_draw_textured_rectangle_scaled( 0, x, y + ty, x + width - 1, y + ty + h - 1, 1.0, 1.0, MIRROR_DISABLED );
+        __rdp_ringbuffer_send();
+    }
+
+    flush_strategy = flush;
+}
+
+/**
+ * @brief Load a sprite atlas from the DragonFS filesystem
+ *
+ * Sprite atlases are created by the mkatlas tool, which packs many images into pages
+ * that fit TMEM, and also generates a header with the index of each image.  The whole atlas
+ * is loaded in RDRAM.
+ *
+ * @param[in] fn
+ *            Filename of the atlas (on DragonFS)
+ *
+ * @return The atlas, to be freed with #rdp_atlas_free
+ */
+rdp_atlas_t *rdp_atlas_load( const char *fn )
+{
+    int fh = dfs_open( fn );
+    assertf( fh >= 0, "file does not exist: %s", fn );
+    int size = dfs_size( fh );
+    assertf( size > 8, "atlas %s: invalid file size: %d", fn, size );
+
+    /* Load the whole file: the pages are used in place */
+    uint8_t *data = memalign( 8, size );
+    assert( data );
+    dfs_read( data, 1, size, fh );
+    dfs_close( fh );
+
+    assertf( !memcmp( data, "ATLS", 4 ), "atlas %s: invalid file", fn );
+
+    rdp_atlas_t *atlas = malloc( sizeof(rdp_atlas_t) );
+    assert( atlas );
+    atlas->num_pages = *(uint16_t *)(data + 4);
+    atlas->num_entries = *(uint16_t *)(data + 6);
+    atlas->entries = (rdp_atlas_entry_t *)(data + 8);
+    atlas->pages = malloc( atlas->num_pages * sizeof(sprite_t *) );
+    assert( atlas->pages );
+
+    uint8_t *page = data + 8 + atlas->num_entries * sizeof(rdp_atlas_entry_t);
+
+    for( int i = 0; i < atlas->num_pages; i++ )
+    {
+        atlas->pages[i] = (sprite_t *)page;
+        page += sizeof(sprite_t) + atlas->pages[i]->width * atlas->pages[i]->height * atlas->pages[i]->bitdepth;
+        assertf( page <= data + size, "atlas %s: truncated file", fn );
+    }
+
+    return atlas;
+}
+
+/**
+ * @brief Find an image of a sprite atlas by name
+ *
+ * The index of the images can also be taken from the header generated by mkatlas,
+ * which avoids looking them up at runtime.
+ *
+ * @param[in] atlas
+ *            The sprite atlas
+ * @param[in] name
+ *            Name of the image (its file name without extension)
+ *
+ * @return The index of the image, or -1 if not found
+ */
+int rdp_atlas_find( const rdp_atlas_t *atlas, const char *name )
+{
+    for( int i = 0; i < atlas->num_entries; i++ )
+    {
+        if( !strncmp( atlas->entries[i].name, name, sizeof(atlas->entries[i].name) ) )
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Draw an image of a sprite atlas to the screen
  *
- * @return The number of bytes consumed in RDP TMEM by loading this sprite
+ * The page holding the image is loaded in TMEM (texture slot 0) only if it isn't already
+ * there, so drawing images of the same page one after the other costs a single texture
+ * load.  Loading other textures evicts the page.
+ *
+ * Before calling this function, make sure that the RDP is set to texture mode by calling
+ * #rdp_enable_texture_copy.
+ *
+ * @param[in] atlas
+ *            The sprite atlas
+ * @param[in] index
+ *            Index of the image
+ * @param[in] x
+ *            The pixel X location of the top left of the image
+ * @param[in] y
+ *            The pixel Y location of the top left of the image
  */
-uint32_t rdp_load_texture_stride( uint32_t texslot, uint32_t texloc, mirror_t mirror, sprite_t *sprite, int offset )
+void rdp_draw_atlas_sprite( const rdp_atlas_t *atlas, int index, int x, int y )
 {
-    if( !sprite ) { return 0; }
+    assertf( index >= 0 && index < atlas->num_entries, "invalid atlas image: %d", index );
+    const rdp_atlas_entry_t *entry = &atlas->entries[index];
 
-    /* Figure out the s,t coordinates of the sprite we are copying out of */
-    int twidth = sprite->width / sprite->hslices;
-    int theight = sprite->height / sprite->vslices;
+    if( resident_atlas != atlas || resident_page != entry->page )
+    {
+        /* Whatever used TMEM must be drawn before loading over it */
+        __rdp_ringbuffer_queue( 0xE7000000 );
+        __rdp_ringbuffer_queue( 0x00000000 );
+
+        sprite_t *page = atlas->pages[entry->page];
+        __rdp_load_texture( 0, 0, MIRROR_DISABLED, page, 0, 0, page->width - 1, page->height - 1 );
 
-    int sl = (offset % sprite->hslices) * twidth;
-    int tl = (offset / sprite->hslices) * theight;
-    int sh = sl + twidth - 1;
-    int th = tl + theight - 1;
+        resident_atlas = atlas;
+        resident_page = entry->page;
+    }
+
+    /* Point the texture slot at the image within the page */
+    cache[0].s = entry->x;
+    cache[0].t = entry->y;
+    cache[0].width = entry->width - 1;
+    cache[0].height = entry->height - 1;
 
-    return __rdp_load_texture( texslot, texloc, mirror, sprite, sl, tl, sh, th );
+    __rdp_draw_textured_rectangle_scaled( 0, x, y, x + entry->width - 1, y + entry->height - 1, 1.0, 1.0, MIRROR_DISABLED );
+    __rdp_ringbuffer_send();
 }
 
 /**
- * @brief Draw a textured rectangle with a scaled texture
+ * @brief Free a sprite atlas
  *
- * Given an already loaded texture, this function will draw a rectangle textured with the loaded texture
- * at a scale other than 1.  This allows rectangles to be drawn with stretched or squashed textures.
- * If the rectangle is larger than the texture after scaling, it will be tiled or mirrored based on the
- * mirror setting given in the load texture command.
- *
- * Before using this command to draw a textured rectangle, use #rdp_enable_texture_copy to set the RDP
- * up in texture mode.
+ * @param[in] atlas
+ *            The sprite atlas loaded with #rdp_atlas_load
+ */
+void rdp_atlas_free( rdp_atlas_t *atlas )
+{
+    if( !atlas ) { return; }
+
+    if( resident_atlas == atlas ) { resident_atlas = 0; }
+
+    free( (uint8_t *)atlas->entries - 8 );
+    free( atlas->pages );
+    free( atlas );
+}
+
+/**
+ * @brief Build the font atlas from the built-in font
  *
- * @param[in] texslot
- *            The texture slot that the texture was previously loaded into (0-7)
- * @param[in] tx
- *            The pixel X location of the top left of the rectangle
- * @param[in] ty
- *            The pixel Y location of the top left of the rectangle
- * @param[in] bx
- *            The pixel X location of the bottom right of the rectangle
- * @param[in] by
- *            The pixel Y location of the bottom right of the rectangle
- * @param[in] x_scale
- *            Horizontal scaling factor
- * @param[in] y_scale
- *            Vertical scaling factor
- * @param[in] mirror
- *            Whether the texture should be mirrored
+ * Each page of the atlas is a 128x64 I4 texture holding 16x8 glyphs, so that a page
+ * fills TMEM.  The glyph bitmaps are expanded to fully opaque or fully transparent texels.
  */
-void rdp_draw_textured_rectangle_scaled( uint32_t texslot, int tx, int ty, int bx, int by, double x_scale, double y_scale,  mirror_t mirror)
+static void __rdp_build_font_atlas( void )
 {
-    uint16_t s = cache[texslot & 0x7].s << 5;
-    uint16_t t = cache[texslot & 0x7].t << 5;
-    uint32_t width = cache[texslot & 0x7].width;
-    uint32_t height = cache[texslot & 0x7].height;
-   
-    /* Cant display < 0, so must clip size and move S,T coord accordingly */
-    if( tx < 0 )
-    {
-        if ( tx < -(width * x_scale) ) { return; }
-        s += (int)(((double)((-tx) << 5)) * (1.0 / x_scale));
-        tx = 0;
-    }
+    font_atlas = memalign( 8, FONT_PAGE_SIZE * 256 / FONT_PAGE_GLYPHS );
+    assertf( font_atlas, "cannot allocate the font atlas" );
 
-    if( ty < 0 )
+    for( int ch = 0; ch < 256; ch++ )
     {
-        if ( ty < -(height * y_scale) ) { return; }
-        t += (int)(((double)((-ty) << 5)) * (1.0 / y_scale));
-        ty = 0;
+        uint8_t *page = font_atlas + (ch / FONT_PAGE_GLYPHS) * FONT_PAGE_SIZE;
+        int glyph = ch % FONT_PAGE_GLYPHS;
+
+        for( int row = 0; row < 8; row++ )
+        {
+            /* Each row of the page is 128 texels, 64 bytes */
+            uint8_t *dst = page + ((glyph / 16) * 8 + row) * 64 + (glyph % 16) * 4;
+            uint8_t bits = __font_data[ch * 8 + row];
+
+            for( int col = 0; col < 8; col += 2, bits <<= 2 )
+            {
+                *dst++ = ((bits & 0x80) ? 0xF0 : 0) | ((bits & 0x40) ? 0x0F : 0);
+            }
+        }
     }
 
-     // mirror horizontally or vertically
-    if (mirror != MIRROR_DISABLED)
-    {	
-        if (mirror == MIRROR_X || mirror == MIRROR_XY)
-            s += ( (width+1) + ((cache[texslot & 0x7].real_width-(width+1))<<1) ) << 5;
-	
-        if (mirror == MIRROR_Y || mirror == MIRROR_XY)
-            t += ( (height+1) + ((cache[texslot & 0x7].real_height-(height+1))<<1) ) << 5;	
-    }	
-
-    /* Calculate the scaling constants based on a 6.10 fixed point system */
-    int xs = (int)((1.0 / x_scale) * 4096.0);
-    int ys = (int)((1.0 / y_scale) * 1024.0);
+    data_cache_hit_writeback( font_atlas, FONT_PAGE_SIZE * 256 / FONT_PAGE_GLYPHS );
+}
 
-    /* Set up rectangle position in screen space */
-    __rdp_ringbuffer_queue( 0xE4000000 | (bx << 14) | (by << 2) );
-    __rdp_ringbuffer_queue( ((texslot & 0x7) << 24) | (tx << 14) | (ty << 2) );
+/**
+ * @brief Load a page of the font atlas into TMEM
+ *
+ * @param[in] page
+ *            Page to load
+ */
+static void __rdp_load_font_page( int page )
+{
+    /* The glyphs of the previous page must be drawn before loading over it */
+    __rdp_ringbuffer_queue( 0xE7000000 );
+    __rdp_ringbuffer_queue( 0x00000000 );
 
-    /* Set up texture position and scaling to 1:1 copy */
-    __rdp_ringbuffer_queue( (s << 16) | t );
-    __rdp_ringbuffer_queue( (xs & 0xFFFF) << 16 | (ys & 0xFFFF) );
+    /* 4-bit textures can't be loaded with load tile: load the page as a 32x64 16-bit texture */
+    __rdp_ringbuffer_queue( 0xFD100000 | (32 - 1) );
+    __rdp_ringbuffer_queue( (uint32_t)(font_atlas + page * FONT_PAGE_SIZE) );
+    __rdp_ringbuffer_queue( 0xF5100000 | ((64 / 8) << 9) );
+    __rdp_ringbuffer_queue( FONT_LOAD_SLOT << 24 );
+    __rdp_ringbuffer_queue( 0xE6000000 );
+    __rdp_ringbuffer_queue( 0x00000000 );
+    __rdp_ringbuffer_queue( 0xF4000000 );
+    __rdp_ringbuffer_queue( (FONT_LOAD_SLOT << 24) | ((31 << 2) << 12) | (63 << 2) );
+    __rdp_ringbuffer_queue( 0xE7000000 );
+    __rdp_ringbuffer_queue( 0x00000000 );
 
-    /* Send command */
-    __rdp_ringbuffer_send();
+    /* Draw from it as a 128x64 I4 texture */
+    __rdp_ringbuffer_queue( 0xF5800000 | ((64 / 8) << 9) );
+    __rdp_ringbuffer_queue( FONT_TEXSLOT << 24 );
+    __rdp_ringbuffer_queue( 0xF2000000 );
+    __rdp_ringbuffer_queue( (FONT_TEXSLOT << 24) | ((127 << 2) << 12) | (63 << 2) );
+
+    /* The page fills TMEM */
+    __rdp_texcache_evict( FONT_LOAD_SLOT, 0, TMEM_SIZE, true );
+    __rdp_texcache_evict( FONT_TEXSLOT, 0, TMEM_SIZE, true );
+    resident_atlas = 0;
+    font_page = page;
 }
 
 /**
- * @brief Draw a textured rectangle
- *
- * Given an already loaded texture, this function will draw a rectangle textured with the loaded texture.
- * If the rectangle is larger than the texture, it will be tiled or mirrored based on the* mirror setting
- * given in the load texture command.
+ * @brief Enable display of text
  *
- * Before using this command to draw a textured rectangle, use #rdp_enable_texture_copy to set the RDP
- * up in texture mode.
+ * This must be called before using #rdp_draw_text.  Text is drawn with the built-in font
+ * in the given color, leaving the background of the glyphs untouched.  The font is
+ * uploaded to TMEM as an I4 texture atlas of up to two pages (characters 0-127 and
+ * 128-255) and kept there, so drawing text costs one textured rectangle per glyph.  Text
+ * drawing uses texture slots 6 and 7 and all of TMEM: textures loaded before must be
+ * loaded again afterwards.
  *
- * @param[in] texslot
- *            The texture slot that the texture was previously loaded into (0-7)
- * @param[in] tx
- *            The pixel X location of the top left of the rectangle
- * @param[in] ty
- *            The pixel Y location of the top left of the rectangle
- * @param[in] bx
- *            The pixel X location of the bottom right of the rectangle
- * @param[in] by
- *            The pixel Y location of the bottom right of the rectangle
- * @param[in] mirror
- *            Whether the texture should be mirrored
+ * @param[in] color
+ *            Color of the text, as a 32-bit RGBA value (8 bits per component, red in the
+ *            most significant byte)
  */
-void rdp_draw_textured_rectangle( uint32_t texslot, int tx, int ty, int bx, int by, mirror_t mirror )
+void rdp_enable_text( uint32_t color )
 {
-    /* Simple wrapper */
-    rdp_draw_textured_rectangle_scaled( texslot, tx, ty, bx, by, 1.0, 1.0, mirror );
+    if( !font_atlas ) { __rdp_build_font_atlas(); }
+
+    /* Color combiner: PRIM color, TEXEL0 alpha, in both cycles */
+    __rdp_ringbuffer_queue( 0xFC000000 | (15 << 20) | (31 << 15) | (7 << 12) | (7 << 9) | (15 << 5) | 31 );
+    __rdp_ringbuffer_queue( (15 << 28) | (15 << 24) | (7 << 21) | (7 << 18) | (3 << 15) | (7 << 12) | (1 << 9) | (3 << 6) | (7 << 3) | 1 );
+
+    /* Set other modes to 1 cycle, point sampled textures and alpha compare */
+    __rdp_ringbuffer_queue( 0xEF000CFF );
+    __rdp_ringbuffer_queue( 0x00000001 );
+
+    /* Alpha compare threshold and text color */
+    __rdp_ringbuffer_queue( 0xF9000000 );
+    __rdp_ringbuffer_queue( 0x0000007F );
+    __rdp_ringbuffer_queue( 0xFA000000 );
+    __rdp_ringbuffer_queue( color );
+    __rdp_ringbuffer_send();
 }
 
 /**
- * @brief Draw a texture to the screen as a sprite
+ * @brief Draw text to the screen with the built-in font
  *
- * Given an already loaded texture, this function will draw a rectangle textured with the loaded texture.
+ * Text is laid out as with #graphics_draw_text: glyphs are 8x8 pixels, '\n' and '\r'
+ * go back to the start of the next line and tabs are 5 characters wide.
  *
- * Before using this command to draw a textured rectangle, use #rdp_enable_texture_copy to set the RDP
- * up in texture mode.
+ * Before calling this function, make sure that the RDP is set to text mode by calling
+ * #rdp_enable_text.
  *
- * @param[in] texslot
- *            The texture slot that the texture was previously loaded into (0-7)
  * @param[in] x
- *            The pixel X location of the top left of the sprite
+ *            The pixel X location of the top left of the text
  * @param[in] y
- *            The pixel Y location of the top left of the sprite
- * @param[in] mirror
- *            Whether the texture should be mirrored
+ *            The pixel Y location of the top left of the text
+ * @param[in] text
+ *            Text to draw (NULL terminated)
  */
-void rdp_draw_sprite( uint32_t texslot, int x, int y, mirror_t mirror )
+void rdp_draw_text( int x, int y, const char *text )
 {
-    /* Just draw a rectangle the size of the sprite */
-    rdp_draw_textured_rectangle_scaled( texslot, x, y, x + cache[texslot & 0x7].width, y + cache[texslot & 0x7].height, 1.0, 1.0, mirror );
+    if( !text || !font_atlas ) { return; }
+
+    int tx = x;
+    int ty = y;
+
+    for( ; *text; text++ )
+    {
+        uint8_t ch = *text;
+
+        switch( ch )
+        {
+            case '\r':
+            case '\n':
+                tx = x;
+                ty += 8;
+                continue;
+            case ' ':
+                tx += 8;
+                continue;
+            case '\t':
+                tx += 8 * 5;
+                continue;
+        }
+
+        int gx = tx;
+        int gy = ty;
+        tx += 8;
+
+        /* Skip glyphs completely out of the screen, clip the ones partially out */
+        if( gx <= -8 || gy <= -8 || gx >= 1024 - 8 || gy >= 1024 - 8 ) { continue; }
+
+        int page = ch / FONT_PAGE_GLYPHS;
+        int glyph = ch % FONT_PAGE_GLYPHS;
+        if( page != font_page ) { __rdp_load_font_page( page ); }
+
+        /* Texture coordinates are in 10.5 format */
+        uint32_t s = ((glyph % 16) * 8) << 5;
+        uint32_t t = ((glyph / 16) * 8) << 5;
+
+        if( gx < 0 ) { s -= gx << 5; gx = 0; }
+        if( gy < 0 ) { t -= gy << 5; gy = 0; }
+
+        /* In 1 cycle mode, the bottom right of texture rectangles is exclusive */
+        __rdp_ringbuffer_queue( 0xE4000000 | (tx << 14) | ((ty + 8) << 2) );
+        __rdp_ringbuffer_queue( (FONT_TEXSLOT << 24) | (gx << 14) | (gy << 2) );
+        __rdp_ringbuffer_queue( (s << 16) | t );
+        __rdp_ringbuffer_queue( (1 << 10) << 16 | (1 << 10) );
+        __rdp_ringbuffer_send();
+    }
 }
 
 /**
- * @brief Draw a texture to the screen as a scaled sprite
+ * @brief Copy the input of the geometry task into DMEM
  *
- * Given an already loaded texture, this function will draw a rectangle textured with the loaded texture.
- *
- * Before using this command to draw a textured rectangle, use #rdp_enable_texture_copy to set the RDP
- * up in texture mode.
- *
- * @param[in] texslot
- *            The texture slot that the texture was previously loaded into (0-7)
- * @param[in] x
- *            The pixel X location of the top left of the sprite
- * @param[in] y
- *            The pixel Y location of the top left of the sprite
- * @param[in] x_scale
- *            Horizontal scaling factor
- * @param[in] y_scale
- *            Vertical scaling factor
- * @param[in] mirror
- *            Whether the texture should be mirrored
+ * @param[in] task
+ *            The geometry task
  */
-void rdp_draw_sprite_scaled( uint32_t texslot, int x, int y, double x_scale, double y_scale, mirror_t mirror )
+static void __rdp_geom_setup( rsp_task_t *task )
 {
-    /* Since we want to still view the whole sprite, we must resize the rectangle area too */
-    int new_width = (int)(((double)cache[texslot & 0x7].width * x_scale) + 0.5);
-    int new_height = (int)(((double)cache[texslot & 0x7].height * y_scale) + 0.5);
-    
-    /* Draw a rectangle the size of the new sprite */
-    rdp_draw_textured_rectangle_scaled( texslot, x, y, x + new_width, y + new_height, x_scale, y_scale, mirror );
+    uint32_t *input = (uint32_t *)&geom_input;
+
+    for( int i = 0; i < sizeof(geom_input) / 4; i++ )
+    {
+        SP_DMEM[i] = input[i];
+    }
 }
 
 /**
- * @brief Set the primitive draw color for subsequent filled primitive operations
- *
- * This function sets the color of all #rdp_draw_filled_rectangle operations that follow.
- * Note that in 16 bpp mode, the color must be a packed color.  This means that the high
- * 16 bits and the low 16 bits must both be the same color.  Use #graphics_make_color or
- * #graphics_convert_color to generate valid colors.
+ * @brief Resume the command ring buffer after the geometry task
  *
- * @param[in] color
- *            Color to draw primitives in
+ * @param[in] task
+ *            The geometry task
  */
-void rdp_set_primitive_color( uint32_t color )
+static void __rdp_geom_done( rsp_task_t *task )
 {
-    /* Set packed color */
-    __rdp_ringbuffer_queue( 0xF7000000 );
-    __rdp_ringbuffer_queue( color );
-    __rdp_ringbuffer_send();
+    /* The RDP is back to reading from RDRAM, and it has read all the commands
+     * submitted before the task: DP_START must be set again. */
+    rdp_restart = true;
+    rdp_lap_end = 0;
+    geom_busy = false;
 }
 
 /**
- * @brief Set the blend draw color for subsequent filled primitive operations
+ * @brief Set the matrix used to transform the vertices drawn by #rdp_geom_draw_triangles
  *
- * This function sets the color of all #rdp_draw_filled_triangle operations that follow.
+ * The matrix transforms a vertex (x, y, z, 1) into a clip space position (X, Y, Z, W),
+ * as in m * v, and the vertex is drawn at the pixel position (X/W, Y/W).  So the matrix
+ * is the product of the viewport, projection and modelview matrices.  Vertices with
+ * W < 1 are considered behind the camera, and triangles are clipped at W = 1.
  *
- * @param[in] color
- *            Color to draw primitives in
+ * The matrix is converted to fixed point (16.16), so its elements must be in the
+ * range [-32768, 32768).
+ *
+ * @param[in] m
+ *            Matrix, by rows
  */
-void rdp_set_blend_color( uint32_t color )
+void rdp_geom_set_matrix( const float m[4][4] )
 {
-    __rdp_ringbuffer_queue( 0xF9000000 );
-    __rdp_ringbuffer_queue( color );
-    __rdp_ringbuffer_send();
+    /* Wait for the RSP to be done with the previous matrix */
+    rdp_geom_wait();
+
+    mat4_to_rsp( geom_input.matrix, (const mat4_t *)m );
 }
 
 /**
- * @brief Draw a filled rectangle
+ * @brief Draw a batch of filled triangles, transforming the vertices on the RSP
  *
- * Given a color set with #rdp_set_primitive_color, this will draw a filled rectangle
- * to the screen.  This is most often useful for erasing a buffer before drawing to it
- * by displaying a black rectangle the size of the screen.  This is much faster than
- * setting the buffer blank in software.  However, if you are planning on drawing to
- * the entire screen, blanking may be unnecessary.  
+ * This is the equivalent of calling #rdp_draw_filled_triangle on each triangle, but
+ * the vertices are transformed by the matrix set with #rdp_geom_set_matrix, and the
+ * triangle setup is done by an RSP ucode, which sends the triangles directly to the
+ * RDP.  The function returns right away, leaving the CPU free while the RSP works.
  *
- * Before calling this function, make sure that the RDP is set to primitive mode by
- * calling #rdp_enable_primitive_fill.
+ * Triangles completely outside of the clipping rectangle (see #rdp_set_clipping) are
+ * discarded, as well as triangles with a vertex more than 1023 pixels off the origin.
+ * Triangles crossing the plane W = 1 are clipped against it by the RSP, so that only
+ * their part in front of the camera is drawn.
  *
- * @param[in] tx
- *            Pixel X location of the top left of the rectangle
- * @param[in] ty
- *            Pixel Y location of the top left of the rectangle
- * @param[in] bx
- *            Pixel X location of the bottom right of the rectangle
- * @param[in] by
- *            Pixel Y location of the bottom right of the rectangle
+ * Before calling this function, make sure that the RDP is set to blend mode by
+ * calling #rdp_enable_blend_fill, and that #rdp_set_clipping was called.  The arrays
+ * are read by the RSP, so they must not be changed until the batch is complete
+ * (see #rdp_geom_wait).  Other RDP functions can be called in the meantime: the
+ * commands are queued after the triangles, waiting for the batch if they need to
+ * be submitted.
+ *
+ * @param[in] vertices
+ *            Array of vertices (8-byte aligned)
+ * @param[in] num_vertices
+ *            Number of vertices, at most #RDP_GEOM_MAX_VERTICES
+ * @param[in] indices
+ *            Array of triangles, as triplets of indices into the vertices (8-byte aligned)
+ * @param[in] num_triangles
+ *            Number of triangles
  */
-void rdp_draw_filled_rectangle( int tx, int ty, int bx, int by )
+void rdp_geom_draw_triangles( const rdp_geom_vertex_t *vertices, int num_vertices, const uint16_t *indices, int num_triangles )
 {
-    if( tx < 0 ) { tx = 0; }
-    if( ty < 0 ) { ty = 0; }
+    assertf( num_vertices >= 0 && num_vertices <= RDP_GEOM_MAX_VERTICES, "invalid number of vertices: %d", num_vertices );
+    assert( ((uint32_t)vertices & 7) == 0 && ((uint32_t)indices & 7) == 0 );
+    assertf( !recording_list, "RSP triangles cannot be recorded in a display list" );
 
-    __rdp_ringbuffer_queue( 0xF6000000 | ( bx << 14 ) | ( by << 2 ) ); 
-    __rdp_ringbuffer_queue( ( tx << 14 ) | ( ty << 2 ) );
-    __rdp_ringbuffer_send();
+    if( num_vertices == 0 || num_triangles <= 0 ) { return; }
+
+    /* The input of the previous batch is still in use */
+    rdp_geom_wait();
+
+    /* The RSP reads the arrays via DMA */
+    data_cache_hit_writeback( vertices, num_vertices * sizeof(rdp_geom_vertex_t) );
+    data_cache_hit_writeback( indices, num_triangles * 3 * sizeof(uint16_t) );
+
+    geom_input.vertices = (uint32_t)vertices & 0x1FFFFFFF;
+    geom_input.num_vertices = num_vertices;
+    geom_input.indices = (uint32_t)indices & 0x1FFFFFFF;
+    geom_input.num_triangles = num_triangles;
+    geom_input.output = 0;
+
+    /* Commands queued so far must be drawn before the triangles */
+    __rdp_ringbuffer_submit();
+
+    geom_task.ucode = &rsp_geom;
+    geom_task.setup = __rdp_geom_setup;
+    geom_task.done = __rdp_geom_done;
+    geom_busy = true;
+    rsp_task_submit( &geom_task );
 }
 
 /**
- * @brief Draw a filled triangle
+ * @brief Mark the end of a transform task
  *
- * Given a color set with #rdp_set_blend_color, this will draw a filled triangle
- * to the screen. Vertex order is not important.
+ * @param[in] task
+ *            The geometry task
+ */
+static void __rdp_geom_transform_done( rsp_task_t *task )
+{
+    geom_busy = false;
+}
+
+/**
+ * @brief Transform a batch of vertices on the RSP, without drawing them
  *
- * Before calling this function, make sure that the RDP is set to blend mode by
- * calling #rdp_enable_blend_fill.
+ * The vertices are transformed by the matrix set with #rdp_geom_set_matrix, as
+ * #rdp_geom_draw_triangles would do, and written to @p out: this offloads the
+ * transform of vertices that are drawn by the CPU, or used for other purposes
+ * (eg: picking or culling). The function returns right away: the result is
+ * ready after #rdp_geom_wait.
  *
- * @param[in] x1
- *            Pixel X1 location of triangle
- * @param[in] y1
- *            Pixel Y1 location of triangle
- * @param[in] x2
- *            Pixel X2 location of triangle
- * @param[in] y2
- *            Pixel Y2 location of triangle
- * @param[in] x3
- *            Pixel X3 location of triangle
- * @param[in] y3
- *            Pixel Y3 location of triangle
+ * @param[in]  vertices
+ *             Array of vertices (8-byte aligned)
+ * @param[in]  num_vertices
+ *             Number of vertices, at most #RDP_GEOM_MAX_VERTICES
+ * @param[out] out
+ *             Transformed vertices (16-byte aligned)
  */
-void rdp_draw_filled_triangle( float x1, float y1, float x2, float y2, float x3, float y3 )
+void rdp_geom_transform_vertices( const rdp_geom_vertex_t *vertices, int num_vertices, rdp_geom_tvertex_t *out )
 {
-    float temp_x, temp_y;
-    const float to_fixed_11_2 = 4.0f;
-    const float to_fixed_16_16 = 65536.0f;
-    
-    /* sort vertices by Y ascending to find the major, mid and low edges */
-    if( y1 > y2 ) { temp_x = x2, temp_y = y2; y2 = y1; y1 = temp_y; x2 = x1; x1 = temp_x; }
-    if( y2 > y3 ) { temp_x = x3, temp_y = y3; y3 = y2; y2 = temp_y; x3 = x2; x2 = temp_x; }
-    if( y1 > y2 ) { temp_x = x2, temp_y = y2; y2 = y1; y1 = temp_y; x2 = x1; x1 = temp_x; }
-
-    /* calculate Y edge coefficients in 11.2 fixed format */
-    int yh = y1 * to_fixed_11_2;
-    int ym = (int)( y2 * to_fixed_11_2 ) << 16; // high word
-    int yl = y3 * to_fixed_11_2;
-    
-    /* calculate X edge coefficients in 16.16 fixed format */
-    int xh = x1 * to_fixed_16_16;
-    int xm = x1 * to_fixed_16_16;
-    int xl = x2 * to_fixed_16_16;
-    
-    /* calculate inverse slopes in 16.16 fixed format */
-    int dxhdy = ( y3 == y1 ) ? 0 : ( ( x3 - x1 ) / ( y3 - y1 ) ) * to_fixed_16_16;
-    int dxmdy = ( y2 == y1 ) ? 0 : ( ( x2 - x1 ) / ( y2 - y1 ) ) * to_fixed_16_16;
-    int dxldy = ( y3 == y2 ) ? 0 : ( ( x3 - x2 ) / ( y3 - y2 ) ) * to_fixed_16_16;
-    
-    /* determine the winding of the triangle */
-    int winding = ( x1 * y2 - x2 * y1 ) + ( x2 * y3 - x3 * y2 ) + ( x3 * y1 - x1 * y3 );
-    int flip = ( winding > 0 ? 1 : 0 ) << 23;
-    
-    __rdp_ringbuffer_queue( 0xC8000000 | flip | yl );
-    __rdp_ringbuffer_queue( ym | yh );
-    __rdp_ringbuffer_queue( xl );
-    __rdp_ringbuffer_queue( dxldy );
-    __rdp_ringbuffer_queue( xh );
-    __rdp_ringbuffer_queue( dxhdy );
-    __rdp_ringbuffer_queue( xm );
-    __rdp_ringbuffer_queue( dxmdy );
-    __rdp_ringbuffer_send();
+    assertf( num_vertices >= 0 && num_vertices <= RDP_GEOM_MAX_VERTICES, "invalid number of vertices: %d", num_vertices );
+    assert( ((uint32_t)vertices & 7) == 0 && ((uint32_t)out & 15) == 0 );
+
+    if( num_vertices == 0 ) { return; }
+
+    /* The input of the previous batch is still in use */
+    rdp_geom_wait();
+
+    /* The RSP reads and writes the arrays via DMA. The output is aligned to
+     * cachelines, so it can be just invalidated. */
+    data_cache_hit_writeback( vertices, num_vertices * sizeof(rdp_geom_vertex_t) );
+    data_cache_hit_invalidate( out, num_vertices * sizeof(rdp_geom_tvertex_t) );
+
+    geom_input.vertices = (uint32_t)vertices & 0x1FFFFFFF;
+    geom_input.num_vertices = num_vertices;
+    geom_input.indices = 0;
+    geom_input.num_triangles = 0;
+    geom_input.output = (uint32_t)out & 0x1FFFFFFF;
+
+    geom_task.ucode = &rsp_geom;
+    geom_task.setup = __rdp_geom_setup;
+    geom_task.done = __rdp_geom_transform_done;
+    geom_busy = true;
+    rsp_task_submit( &geom_task );
 }
 
 /**
- * @brief Set the flush strategy for texture loads
- *
- * If textures are guaranteed to be in uncached RDRAM or the cache
- * is flushed before calling load operations, the RDP can be told
- * to skip flushing the cache.  This affords a good speedup.  However,
- * if you are changing textures in memory on the fly or otherwise do
- * not want to deal with cache coherency, set the cache strategy to
- * automatic to have the RDP flush cache before texture loads.
+ * @brief Wait until the triangles submitted with #rdp_geom_draw_triangles have been sent to the RDP
  *
- * @param[in] flush
- *            The cache strategy, either #FLUSH_STRATEGY_NONE or
- *            #FLUSH_STRATEGY_AUTOMATIC.
+ * After this, the arrays passed to #rdp_geom_draw_triangles can be reused. This
+ * also waits for the vertices submitted with #rdp_geom_transform_vertices.
  */
-void rdp_set_texture_flush( flush_t flush )
+void rdp_geom_wait( void )
 {
-    flush_strategy = flush;
+    if( geom_busy ) { rsp_task_wait( &geom_task ); }
 }
 
 /** @} */
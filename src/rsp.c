@@ -13,13 +13,42 @@ static volatile struct SP_regs_s * const SP_regs = (struct SP_regs_s *)0xa404000
 /** @brief Current ucode being loaded */
 static rsp_ucode_t *cur_ucode = NULL;
 
-/**
- * @brief Wait until the SI is finished with a DMA request
- */
-static void __SP_DMA_wait(void)
-{
-    while (SP_regs->status & (SP_STATUS_DMA_BUSY | SP_STATUS_IO_BUSY)) ;
-}
+/** @brief Queue of submitted tasks (the head is the one running) */
+static rsp_task_t *task_head = NULL;
+/** @brief Last task in the queue */
+static rsp_task_t *task_tail = NULL;
+/** @brief Number of tasks in the queue */
+static int task_count = 0;
+/** @brief Completed tasks whose notify callback is still to be called */
+static rsp_task_t *notify_head = NULL;
+/** @brief Last task in the notify list */
+static rsp_task_t *notify_tail = NULL;
+
+/** @brief Number of SP DMA transfers that can be queued */
+#define RSP_DMA_QUEUE_SIZE  16
+
+/** @brief A queued SP DMA transfer */
+typedef struct {
+    /** @brief RDRAM address */
+    void *dram;
+    /** @brief IMEM/DMEM address */
+    volatile uint32_t *sp;
+    /** @brief Length register value (size - 1) */
+    uint32_t length;
+    /** @brief True for SP -> RDRAM transfers */
+    bool write;
+} rsp_dma_entry_t;
+
+/** @brief Ring buffer of the SP DMA transfers not yet issued to the engine */
+static rsp_dma_entry_t dma_queue[RSP_DMA_QUEUE_SIZE];
+/** @brief Number of transfers queued so far (the fence of the last one) */
+static uint32_t dma_submitted = 0;
+/** @brief Number of transfers issued to the DMA engine */
+static uint32_t dma_issued = 0;
+/** @brief Number of transfers completed */
+static uint32_t dma_completed = 0;
+
+extern void __profile_rsp_task(uint32_t start_tick, uint32_t ticks);
 
 void rsp_init(void)
 {
@@ -28,104 +57,337 @@ void rsp_init(void)
     SP_regs->status = SP_WSTATUS_SET_HALT;
 }
 
-void rsp_load(rsp_ucode_t *ucode) {
+/** @brief Load a ucode into IMEM/DMEM, unless it is already resident */
+static void __rsp_load(rsp_ucode_t *ucode) {
     if (cur_ucode != ucode) {
-        rsp_load_code(ucode->code, (uint8_t*)ucode->code_end - ucode->code, 0);
+        /* The code and data are queued together, so that the data transfer
+         * is issued while the code one runs */
+        rsp_load_code_async(ucode->code, (uint8_t*)ucode->code_end - ucode->code, 0);
         rsp_load_data(ucode->data, (uint8_t*)ucode->data_end - ucode->data, 0);
         cur_ucode = ucode;
     }
 }
 
-void rsp_load_code(void* start, unsigned long size, unsigned int imem_offset)
-{
-    assert(((uint32_t)start % 8) == 0);
-    assert((imem_offset % 8) == 0);
+void rsp_load(rsp_ucode_t *ucode) {
+    rsp_task_wait_all();
+    __rsp_load(ucode);
+}
 
-    disable_interrupts();
-    __SP_DMA_wait();
+/**
+ * @brief Issue the queued SP DMA transfers, and account for the completed ones
+ *
+ * The SP DMA engine executes one transfer while holding another one: transfers
+ * are issued as soon as there is room in the engine, and they complete in order.
+ *
+ * @note This function must be called with interrupts disabled.
+ */
+static void __rsp_dma_poll(void)
+{
+    for (;;) {
+        /* Transfers still in the engine: the running one, and the pending one */
+        int inflight = SP_regs->rsp_dma_full ? 2 : (SP_regs->rsp_dma_busy ? 1 : 0);
+        if (inflight <= (int)(dma_issued - dma_completed))
+            dma_completed = dma_issued - inflight;
 
-    SP_regs->DRAM_addr = start;
-    MEMORY_BARRIER();
-    SP_regs->RSP_addr = SP_IMEM + imem_offset/4;
-    MEMORY_BARRIER();
-    SP_regs->rsp_read_length = size - 1;
-    MEMORY_BARRIER();
+        if (dma_issued == dma_submitted || inflight == 2)
+            break;
 
-    __SP_DMA_wait();
-    enable_interrupts();
+        rsp_dma_entry_t *e = &dma_queue[dma_issued % RSP_DMA_QUEUE_SIZE];
+        SP_regs->DRAM_addr = e->dram;
+        MEMORY_BARRIER();
+        SP_regs->RSP_addr = e->sp;
+        MEMORY_BARRIER();
+        if (e->write)
+            SP_regs->rsp_write_length = e->length;
+        else
+            SP_regs->rsp_read_length = e->length;
+        MEMORY_BARRIER();
+        dma_issued++;
+    }
 }
 
-void rsp_load_data(void* start, unsigned long size, unsigned int dmem_offset)
+/**
+ * @brief Queue a SP DMA transfer
+ *
+ * @param[in] dram
+ *            RDRAM buffer (8-byte aligned)
+ * @param[in] sp
+ *            IMEM/DMEM address
+ * @param[in] size
+ *            Size of the transfer (multiple of 8)
+ * @param[in] write
+ *            True for SP -> RDRAM transfers, false for RDRAM -> SP
+ *
+ * @return The fence of the transfer
+ */
+static uint32_t __rsp_dma_queue(void *dram, volatile uint32_t *sp, unsigned long size, bool write)
 {
-    assert(((uint32_t)start % 8) == 0);
-    assert((dmem_offset % 8) == 0);
+    assert(((uint32_t)dram % 8) == 0);
+    assert(((uint32_t)sp % 8) == 0);
 
     disable_interrupts();
-    __SP_DMA_wait();
 
-    SP_regs->DRAM_addr = start;
-    MEMORY_BARRIER();
-    SP_regs->RSP_addr = SP_DMEM + dmem_offset/4;
-    MEMORY_BARRIER();
-    SP_regs->rsp_read_length = size - 1;
-    MEMORY_BARRIER();
+    /* Wait for room in the queue */
+    while (dma_submitted - dma_issued >= RSP_DMA_QUEUE_SIZE)
+        __rsp_dma_poll();
 
-    __SP_DMA_wait();
+    rsp_dma_entry_t *e = &dma_queue[dma_submitted % RSP_DMA_QUEUE_SIZE];
+    e->dram = dram;
+    e->sp = sp;
+    e->length = size - 1;
+    e->write = write;
+    uint32_t fence = ++dma_submitted;
+
+    __rsp_dma_poll();
     enable_interrupts();
+    return fence;
 }
 
-void rsp_read_code(void* start, unsigned long size, unsigned int imem_offset)
+uint32_t rsp_load_code_async(void* start, unsigned long size, unsigned int imem_offset)
+{
+    assert((imem_offset % 8) == 0);
+    return __rsp_dma_queue(start, SP_IMEM + imem_offset/4, size, false);
+}
+
+uint32_t rsp_load_data_async(void* start, unsigned long size, unsigned int dmem_offset)
+{
+    assert((dmem_offset % 8) == 0);
+    return __rsp_dma_queue(start, SP_DMEM + dmem_offset/4, size, false);
+}
+
+uint32_t rsp_read_code_async(void* start, unsigned long size, unsigned int imem_offset)
 {
-    assert(((uint32_t)start % 8) == 0);
     assert((imem_offset % 8) == 0);
     data_cache_hit_writeback_invalidate(start, size);
+    return __rsp_dma_queue(start, SP_IMEM + imem_offset/4, size, true);
+}
 
-    disable_interrupts();
-    __SP_DMA_wait();
+uint32_t rsp_read_data_async(void* start, unsigned long size, unsigned int dmem_offset)
+{
+    assert((dmem_offset % 8) == 0);
+    data_cache_hit_writeback_invalidate(start, size);
+    return __rsp_dma_queue(start, SP_DMEM + dmem_offset/4, size, true);
+}
 
-    SP_regs->DRAM_addr = start;
-    MEMORY_BARRIER();
-    SP_regs->RSP_addr = SP_IMEM + imem_offset/4;
-    MEMORY_BARRIER();
-    SP_regs->rsp_write_length = size - 1;
-    MEMORY_BARRIER();
-    __SP_DMA_wait();
+uint32_t rsp_load_async(rsp_ucode_t *ucode)
+{
+    rsp_task_wait_all();
+
+    if (cur_ucode == ucode)
+        return dma_submitted;
 
+    cur_ucode = ucode;
+    rsp_load_code_async(ucode->code, (uint8_t*)ucode->code_end - ucode->code, 0);
+    return rsp_load_data_async(ucode->data, (uint8_t*)ucode->data_end - ucode->data, 0);
+}
+
+void rsp_ucode_set_overlays(rsp_ucode_t *kernel, rsp_ucode_t * const *overlays, int num_overlays)
+{
+    /* The table starts with its capacity and the index of the current overlay */
+    uint32_t *header = (uint32_t*)kernel->data;
+    uint32_t *table = header + 2;
+
+    assertf((uint8_t*)kernel->data_end - kernel->data >= 8 &&
+        (uint8_t*)kernel->data_end - kernel->data >= (header[0] * 2 + 2) * 4,
+        "%s has no overlay table", kernel->name);
+    int capacity = header[0];
+    assertf(num_overlays > 0 && num_overlays <= capacity,
+        "invalid number of overlays for %s: %d (max %d)", kernel->name, num_overlays, capacity);
+
+    for (int i = 0; i < num_overlays; i++) {
+        table[i*2+0] = (uint32_t)overlays[i]->code & 0x1FFFFFFF;
+        table[i*2+1] = (uint8_t*)overlays[i]->code_end - overlays[i]->code;
+        assertf((table[i*2+0] % 8) == 0, "overlay %s is not aligned", overlays[i]->name);
+    }
+    data_cache_hit_writeback(table, num_overlays * 8);
+
+    /* Make sure the next load fetches the new table */
+    if (cur_ucode == kernel)
+        cur_ucode = NULL;
+}
+
+bool rsp_dma_done(uint32_t fence)
+{
+    disable_interrupts();
+    __rsp_dma_poll();
+    bool done = (int32_t)(dma_completed - fence) >= 0;
     enable_interrupts();
+    return done;
 }
 
+void rsp_dma_wait(uint32_t fence)
+{
+    while (!rsp_dma_done(fence)) ;
+}
 
-void rsp_read_data(void* start, unsigned long size, unsigned int dmem_offset)
+void rsp_load_code(void* start, unsigned long size, unsigned int imem_offset)
 {
-    assert(((uint32_t)start % 8) == 0);
-    assert((dmem_offset % 8) == 0);
-    data_cache_hit_writeback_invalidate(start, size);
+    rsp_dma_wait(rsp_load_code_async(start, size, imem_offset));
+}
 
-    disable_interrupts();
-    __SP_DMA_wait();
+void rsp_load_data(void* start, unsigned long size, unsigned int dmem_offset)
+{
+    rsp_dma_wait(rsp_load_data_async(start, size, dmem_offset));
+}
 
-    SP_regs->DRAM_addr = start;
-    MEMORY_BARRIER();
-    SP_regs->RSP_addr = SP_DMEM + dmem_offset/4;
-    MEMORY_BARRIER();
-    SP_regs->rsp_write_length = size - 1;
-    MEMORY_BARRIER();
-    __SP_DMA_wait();
+void rsp_read_code(void* start, unsigned long size, unsigned int imem_offset)
+{
+    rsp_dma_wait(rsp_read_code_async(start, size, imem_offset));
+}
 
-    enable_interrupts();
+void rsp_read_data(void* start, unsigned long size, unsigned int dmem_offset)
+{
+    rsp_dma_wait(rsp_read_data_async(start, size, dmem_offset));
 }
 
-void rsp_run_async(void)
+/** @brief Start the RSP at the entry point of the current ucode */
+static void __rsp_run_async(void)
 {
+    /* The ucode and its data must be fully loaded */
+    rsp_dma_wait(dma_submitted);
+
     // set RSP program counter
     *SP_PC = cur_ucode ? cur_ucode->start_pc : 0;
     MEMORY_BARRIER();
     *SP_STATUS = SP_WSTATUS_CLEAR_HALT | SP_WSTATUS_SET_INTR_BREAK;
 }
 
+void rsp_run_async(void)
+{
+    rsp_task_wait_all();
+    __rsp_run_async();
+}
+
+/**
+ * @brief Advance the RSP task queue
+ *
+ * Complete the running task if the RSP halted, and start the next one.
+ *
+ * @note This function must be called with interrupts disabled.
+ */
+static void __rsp_task_poll(void)
+{
+    static bool polling = false;
+
+    /* Completion callbacks may submit new tasks: the loop below will pick them up */
+    if (polling) return;
+    polling = true;
+
+    while (task_head && (*SP_STATUS & SP_STATUS_HALTED)) {
+        rsp_task_t *task = task_head;
+
+        if (task->start_tick) {
+            /* The running task is complete. The ucode might have halted with
+             * its last DMA transfers still in flight (eg: writing its output
+             * back to RDRAM): let them finish, before the done callback reads
+             * DMEM and the next task uploads its input over it. */
+            while (SP_regs->rsp_dma_busy || SP_regs->rsp_dma_full) ;
+
+            task->rsp_ticks = TICKS_READ() - task->start_tick;
+            __profile_rsp_task(task->start_tick, task->rsp_ticks);
+            task_head = task->next;
+            if (!task_head) task_tail = NULL;
+            task_count--;
+
+            if (task->done) task->done(task);
+            task->complete = true;
+
+            if (task->notify) {
+                task->next = NULL;
+                if (notify_tail) notify_tail->next = task;
+                else notify_head = task;
+                notify_tail = task;
+            }
+            continue;
+        }
+
+        /* Start the task at the head of the queue */
+        __rsp_load(task->ucode);
+        if (task->setup) task->setup(task);
+        task->start_tick = TICKS_READ() | 1;
+        __rsp_run_async();
+    }
+
+    polling = false;
+
+    /* Notify the completed tasks, now that the queue is consistent: the
+     * callbacks can submit new tasks, which are started right away */
+    while (notify_head) {
+        rsp_task_t *task = notify_head;
+        notify_head = task->next;
+        if (!notify_head) notify_tail = NULL;
+        task->notify(task);
+    }
+}
+
+/** @brief SP interrupt handler advancing the task queue */
+static void __rsp_task_sp_handler(void)
+{
+    __rsp_task_poll();
+}
+
+void rsp_task_submit(rsp_task_t *task)
+{
+    static bool sp_handler_registered = false;
+
+    assert(task->ucode);
+
+    disable_interrupts();
+
+    if (!sp_handler_registered) {
+        register_SP_handler(__rsp_task_sp_handler);
+        set_SP_interrupt(1);
+        sp_handler_registered = true;
+    }
+
+    task->complete = false;
+    task->rsp_ticks = 0;
+    task->start_tick = 0;
+    task->next = NULL;
+
+    if (task_tail) task_tail->next = task;
+    else task_head = task;
+    task_tail = task;
+    task_count++;
+
+    __rsp_task_poll();
+    enable_interrupts();
+}
+
+void rsp_task_wait(rsp_task_t *task)
+{
+    disable_interrupts();
+    while (!task->complete) {
+        __rsp_task_poll();
+        /* Let other interrupts and threads through while spinning */
+        enable_interrupts();
+        thread_yield();
+        disable_interrupts();
+    }
+    enable_interrupts();
+}
+
+void rsp_task_wait_all(void)
+{
+    disable_interrupts();
+    while (task_head) {
+        __rsp_task_poll();
+        enable_interrupts();
+        thread_yield();
+        disable_interrupts();
+    }
+    enable_interrupts();
+}
+
+int rsp_task_pending(void)
+{
+    return task_count;
+}
+
 void rsp_wait(void)
 {
-    while (!(*SP_STATUS & SP_STATUS_HALTED)) {}
+    /* Let other threads run meanwhile (see #thread_yield) */
+    while (!(*SP_STATUS & SP_STATUS_HALTED)) thread_yield();
 }
 
 void rsp_run(void)
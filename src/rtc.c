@@ -166,6 +166,45 @@
  */
 static int64_t rtc_get_cache_ticks = 0;
 
+/**
+ * @brief Most-recent RTC time read by #rtc_get (or by a background refresh).
+ *
+ * This should be overwritten the first time #rtc_get is called.
+ */
+static rtc_time_t rtc_cache_time = { 2000, 0, 1, 0, 0, 0, 6 };
+
+/**
+ * @brief Longest supported period of the background refresh (in milliseconds).
+ *
+ * Timer periods are signed 32-bit tick counts, which cover about 45 seconds.
+ * This also keeps the 32-bit COP0 timestamp of a background read valid.
+ */
+#define RTC_REFRESH_MAX_PERIOD_MS 45000
+
+/** @brief Timer of the background refresh (NULL if not enabled). */
+static timer_link_t * rtc_refresh_timer = NULL;
+
+/** @brief Whether a background read is in progress. */
+static volatile bool rtc_refresh_busy = false;
+
+/** @brief Whether background reads are suspended while #rtc_set writes the RTC. */
+static volatile bool rtc_refresh_paused = false;
+
+/** @brief Whether a background read completed since #rtc_get last checked. */
+static volatile bool rtc_refresh_ready = false;
+
+/** @brief Time read by the last background read. */
+static rtc_time_t rtc_refresh_time;
+
+/** @brief COP0 counter value when the last background read completed. */
+static volatile uint32_t rtc_refresh_ticks;
+
+/** @brief Output block of the background read. */
+static uint64_t rtc_refresh_output[JOYBUS_BLOCK_DWORDS];
+
+/** @brief #rtc_cache_time as seconds since the epoch, for extrapolation. */
+static time_t rtc_cache_epoch = 0;
+
 /**
  * @brief Real-time clock detection values.
  * @see #rtc_present
@@ -261,24 +300,20 @@ static uint32_t joybus_rtc_status( void )
 }
 
 /**
- * @brief Read a block of data from the Joybus real-time clock.
+ * @brief Build the input block of a Joybus real-time clock read.
  *
- * This is a low-level utility function that is used by
- * #joybus_rtc_read_control and #rtc_get.
+ * The block data is returned in the second double-word of the output block,
+ * followed by the status byte.
  *
  * @param[in]   block
  *              Which RTC block to read from (0-2)
  *
- * @param[out]  data
- *              Destination pointer for the RTC block data
- *
- * @return the status byte from the Joybus real-time clock
+ * @param[out]  input
+ *              Destination for the input block
  */
-static uint8_t joybus_rtc_read( uint8_t block, uint64_t * data )
+static void joybus_rtc_read_input( uint8_t block, uint64_t * input )
 {
-    assert(block <= 2);
-
-    uint64_t input[JOYBUS_BLOCK_DWORDS] =
+    const uint64_t read_block[JOYBUS_BLOCK_DWORDS] =
     {
         0x0000000002090700 | block,
         0xffffffffffffffff,
@@ -289,8 +324,33 @@ static uint8_t joybus_rtc_read( uint8_t block, uint64_t * data )
         0,
         1
     };
+
+    memcpy( input, read_block, sizeof(read_block) );
+}
+
+/**
+ * @brief Read a block of data from the Joybus real-time clock.
+ *
+ * This is a low-level utility function that is used by
+ * #joybus_rtc_read_control and #rtc_get.
+ *
+ * @param[in]   block
+ *              Which RTC block to read from (0-2)
+ *
+ * @param[out]  data
+ *              Destination pointer for the RTC block data
+ *
+ * @return the status byte from the Joybus real-time clock
+ */
+static uint8_t joybus_rtc_read( uint8_t block, uint64_t * data )
+{
+    assert(block <= 2);
+
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
     uint64_t output[JOYBUS_BLOCK_DWORDS];
 
+    joybus_rtc_read_input( block, input );
+
     joybus_exec( input, output );
 
     *data = output[1];
@@ -379,6 +439,8 @@ static void joybus_rtc_read_control( uint16_t * control, uint32_t * calibration
     if( calibration != NULL ) *calibration = data;
 }
 
+static void joybus_rtc_decode_time( uint64_t data, rtc_time_t * rtc_time );
+
 /**
  * @brief Read the current date/time from the Joybus real-time clock.
  *
@@ -393,7 +455,20 @@ static void joybus_rtc_read_time( rtc_time_t * rtc_time )
 {
     uint64_t data;
     joybus_rtc_read( 2, &data );
+    joybus_rtc_decode_time( data, rtc_time );
+}
 
+/**
+ * @brief Decode the date/time block of the Joybus real-time clock.
+ *
+ * @param[in]   data
+ *              RTC block 2 data
+ *
+ * @param[out]  rtc_time
+ *              Destination pointer for the RTC time data structure
+ */
+static void joybus_rtc_decode_time( uint64_t data, rtc_time_t * rtc_time )
+{
     uint8_t * bytes = (uint8_t *)&data;
 
     rtc_time->sec = bcd_to_byte(bytes[0]);
@@ -522,6 +597,88 @@ static rtc_type_t rtc_present( void )
     }
 }
 
+/**
+ * @brief Convert an RTC date/time to seconds since the epoch.
+ *
+ * @param[in]   rtc_time
+ *              Source pointer for the RTC time data structure
+ *
+ * @return the timestamp in seconds
+ */
+static time_t rtc_time_to_epoch( const rtc_time_t * rtc_time )
+{
+    struct tm time;
+    time.tm_sec = rtc_time->sec;
+    time.tm_min = rtc_time->min;
+    time.tm_hour = rtc_time->hour;
+    time.tm_mday = rtc_time->day;
+    time.tm_mon = rtc_time->month;
+    time.tm_year = rtc_time->year - 1900;
+    time.tm_isdst = -1; /* Auto-detect Daylight Saving Time */
+
+    return mktime( &time );
+}
+
+/**
+ * @brief Convert seconds since the epoch to an RTC date/time.
+ *
+ * This is the inverse of #rtc_time_to_epoch.
+ *
+ * @param[in]   epoch
+ *              The timestamp in seconds
+ *
+ * @param[out]  rtc_time
+ *              Destination pointer for the RTC time data structure
+ */
+static void rtc_epoch_to_time( time_t epoch, rtc_time_t * rtc_time )
+{
+    struct tm time;
+    localtime_r( &epoch, &time );
+
+    rtc_time->sec = time.tm_sec;
+    rtc_time->min = time.tm_min;
+    rtc_time->hour = time.tm_hour;
+    rtc_time->day = time.tm_mday;
+    rtc_time->week_day = time.tm_wday;
+    rtc_time->month = time.tm_mon;
+    rtc_time->year = time.tm_year + 1900;
+}
+
+/**
+ * @brief Completion of a background RTC read (called by the SI interrupt).
+ *
+ * @param[in]   output
+ *              The output block of the read
+ */
+static void rtc_refresh_done( void * output )
+{
+    joybus_rtc_decode_time( ((uint64_t *)output)[1], &rtc_refresh_time );
+    rtc_refresh_ticks = TICKS_READ();
+    rtc_refresh_ready = true;
+    rtc_refresh_busy = false;
+}
+
+/**
+ * @brief Timer callback that starts a background RTC read.
+ *
+ * @param[in]   ovfl
+ *              Number of overflows (unused)
+ */
+static void rtc_refresh_callback( int ovfl )
+{
+    if( rtc_refresh_busy || rtc_refresh_paused ) return;
+
+    uint64_t input[JOYBUS_BLOCK_DWORDS];
+    joybus_rtc_read_input( 2, input );
+
+    rtc_refresh_busy = true;
+    if( joybus_exec_async( input, rtc_refresh_output, rtc_refresh_done ) )
+    {
+        /* The joybus queue is full: try again at the next period */
+        rtc_refresh_busy = false;
+    }
+}
+
 /**
  * @brief Hook function for newlib gettimeofday to get the current date/time.
  *
@@ -532,16 +689,7 @@ static time_t newlib_time_hook( void )
     static rtc_time_t rtc_time;
     if( !rtc_get( &rtc_time ) ) return -1;
 
-    struct tm time;
-    time.tm_sec = rtc_time.sec;
-    time.tm_min = rtc_time.min;
-    time.tm_hour = rtc_time.hour;
-    time.tm_mday = rtc_time.day;
-    time.tm_mon = rtc_time.month;
-    time.tm_year = rtc_time.year - 1900;
-    time.tm_isdst = -1; /* Auto-detect Daylight Saving Time */
-
-    return mktime( &time );
+    return rtc_time_to_epoch( &rtc_time );
 }
 
 /**
@@ -599,6 +747,7 @@ bool rtc_init( void )
  */
 void rtc_close( void )
 {
+    rtc_disable_background_refresh();
     /* Disable newlib `gettimeofday` integration */
     unhook_time_call( &newlib_time_hook );
     /* Invalidate the #rtc_get cache */
@@ -683,7 +832,9 @@ void rtc_normalize_time( rtc_time_t * rtc_time )
  * Calling #rtc_set will also invalidate the cache.
  *
  * If an actual RTC read command is needed, this function can take
- * a few milliseconds to complete.
+ * a few milliseconds to complete. This can be avoided with
+ * #rtc_enable_background_refresh, which extrapolates the time from
+ * the tick counter instead.
  *
  * @param[out]  rtc_time
  *              Destination pointer for the RTC time data structure
@@ -695,26 +846,114 @@ bool rtc_get( rtc_time_t * rtc_time )
     /* libdragon currently only supports getting the time for Joybus RTC! */
     if( rtc_present() != RTC_JOYBUS ) return false;
 
-    /* This should be overwritten the first time this function is called */
-    static rtc_time_t cache_time = { 2000, 0, 1, 0, 0, 0, 6 };
+    int64_t now = timer_ticks();
+
+    if( rtc_refresh_timer != NULL )
+    {
+        /* Pick up the result of the last background read */
+        disable_interrupts();
+        bool refreshed = rtc_refresh_ready;
+        if( refreshed )
+        {
+            rtc_cache_time = rtc_refresh_time;
+            rtc_get_cache_ticks = now - (uint32_t)(TICKS_READ() - rtc_refresh_ticks);
+            rtc_refresh_ready = false;
+        }
+        enable_interrupts();
+
+        if( rtc_get_cache_ticks == 0 ) /* cache manually invalidated */
+        {
+            joybus_rtc_read_time( &rtc_cache_time );
+            rtc_get_cache_ticks = now;
+            refreshed = true;
+        }
+        if( refreshed ) rtc_cache_epoch = rtc_time_to_epoch( &rtc_cache_time );
+
+        /* Extrapolate from the tick counter */
+        time_t elapsed = (now - rtc_get_cache_ticks) / TICKS_PER_SECOND;
+        rtc_epoch_to_time( rtc_cache_epoch + elapsed, rtc_time );
+        return true;
+    }
 
     /* Check if the cached time is still valid */
-    int64_t now = timer_ticks();
     if(
         rtc_get_cache_ticks == 0 || /* cache manually invalidated */
         (now - rtc_get_cache_ticks) > RTC_GET_CACHE_INVALIDATE_TICKS
     )
     {
         /* Update the cache */
-        joybus_rtc_read_time( &cache_time );
+        joybus_rtc_read_time( &rtc_cache_time );
         rtc_get_cache_ticks = now;
     }
 
-    memcpy( rtc_time, &cache_time, sizeof(rtc_time_t) );
+    memcpy( rtc_time, &rtc_cache_time, sizeof(rtc_time_t) );
+
+    return true;
+}
+
+/**
+ * @brief Stop reading the RTC for every #rtc_get, and refresh it in the background.
+ *
+ * The RTC is read once (synchronously, on the next #rtc_get); afterwards,
+ * #rtc_get and the ISO C time functions extrapolate the time from the tick
+ * counter, so they never wait for the joybus. The RTC is read again every
+ * period_ms milliseconds with asynchronous joybus transactions, resynchronizing
+ * the extrapolated time: this corrects the drift between the N64 clock and the
+ * RTC, as well as the sub-second phase of the first read.
+ *
+ * @param[in]   period_ms
+ *              Refresh period in milliseconds (at most 45 seconds)
+ *
+ * @return whether the RTC is present and supported by the RTC Subsystem.
+ */
+bool rtc_enable_background_refresh( int period_ms )
+{
+    assertf( period_ms > 0 && period_ms <= RTC_REFRESH_MAX_PERIOD_MS,
+        "invalid RTC refresh period: %d ms", period_ms );
+
+    if( rtc_present() != RTC_JOYBUS ) return false;
+
+    rtc_disable_background_refresh();
+
+    /* Invalidate the #rtc_get cache */
+    rtc_get_cache_ticks = 0;
+    rtc_refresh_ready = false;
+    rtc_refresh_timer = new_timer( TIMER_TICKS( period_ms * 1000LL ), TF_CONTINUOUS, rtc_refresh_callback );
 
     return true;
 }
 
+/**
+ * @brief Go back to reading the RTC in #rtc_get once its cache invalidates.
+ */
+void rtc_disable_background_refresh( void )
+{
+    if( rtc_refresh_timer == NULL ) return;
+
+    delete_timer( rtc_refresh_timer );
+    rtc_refresh_timer = NULL;
+
+    /* Let the background read complete, since it writes to static data */
+    while( rtc_refresh_busy ) { /* Spinloop */ }
+    rtc_refresh_ready = false;
+    rtc_get_cache_ticks = 0;
+}
+
+/**
+ * @brief Resume the background refresh suspended by #rtc_set.
+ *
+ * A read that completed before the time was written is stale, so it is
+ * discarded along with the #rtc_get cache.
+ */
+static void rtc_refresh_resume( void )
+{
+    disable_interrupts();
+    rtc_refresh_ready = false;
+    rtc_get_cache_ticks = 0;
+    rtc_refresh_paused = false;
+    enable_interrupts();
+}
+
 /**
  * @brief High-level convenience helper to set the RTC date/time.
  *
@@ -726,6 +965,9 @@ bool rtc_get( rtc_time_t * rtc_time )
  * actually finished is by waiting for a fixed duration. Emulators may not
  * accurately reflect this, but this delay is necessary on real hardware.
  *
+ * The background refresh (see #rtc_enable_background_refresh) is suspended
+ * while the time is written, so that it never reads a stopped clock.
+ *
  * @param[in]   rtc_time
  *              Source pointer for the RTC time data structure
  *
@@ -736,6 +978,10 @@ bool rtc_set( rtc_time_t * write_time )
     /* libdragon currently only supports setting the time for Joybus RTC! */
     if( rtc_present() != RTC_JOYBUS ) return false;
 
+    /* Keep the background refresh from reading the RTC while it is written */
+    rtc_refresh_paused = true;
+    while( rtc_refresh_busy ) { /* Spinloop */ }
+
     uint32_t calibration;
     /* Read the calibration data from the control block */
     joybus_rtc_read_control( NULL, &calibration );
@@ -743,7 +989,11 @@ bool rtc_set( rtc_time_t * write_time )
     joybus_rtc_write_control( JOYBUS_RTC_CONTROL_MODE_SET, calibration );
     wait_ms( JOYBUS_RTC_WRITE_BLOCK_DELAY );
     /* Check the RTC status to make sure RTC "set mode" is supported */
-    if( !joybus_rtc_is_stopped() ) return false;
+    if( !joybus_rtc_is_stopped() )
+    {
+        rtc_refresh_resume();
+        return false;
+    }
     /* Ensure write_time is a valid RTC date/time */
     rtc_normalize_time( write_time );
     /* Write the updated time to RTC block 2 */
@@ -756,7 +1006,7 @@ bool rtc_set( rtc_time_t * write_time )
     while( joybus_rtc_is_stopped() ) { /* Spinloop */ }
     wait_ms( JOYBUS_RTC_WRITE_FINISHED_DELAY );
     /* Invalidate the #rtc_get cache */
-    rtc_get_cache_ticks = 0;
+    rtc_refresh_resume();
     return true;
 }
 
@@ -0,0 +1,659 @@
+/**
+ * @file save.c
+ * @brief Cartridge save memory
+ * @ingroup save
+ */
+#include <string.h>
+#include <stdint.h>
+#include <malloc.h>
+#include "libdragon.h"
+#include "regsinternal.h"
+
+/** @brief Minimum of two values */
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/**
+ * @defgroup save Save memory
+ * @ingroup libdragon
+ * @brief Raw access to the save memory of the cartridge (EEPROM, SRAM and FlashRAM).
+ *
+ * A cartridge contains one type of save memory, which cannot be reliably detected,
+ * so it must be selected with #save_init. The contents are then accessed as an
+ * array of bytes with #save_read and #save_write, whatever the type:
+ *
+ * * EEPROM is accessed on the joybus, 8 bytes at a time, and it is very slow to
+ *   write (about 15 ms per block). The operations here are always synchronous;
+ *   see @ref eepfs for a filesystem on EEPROM which can write in the background.
+ * * SRAM is accessed through PI DMA, and it is as fast as reading the ROM. The
+ *   96 KiB SRAM is made of three banks of 32 KiB, which are mapped transparently.
+ * * FlashRAM is read through PI DMA, but it is written by erasing whole sectors
+ *   of #FLASHRAM_SECTOR_SIZE bytes, and then programming them one page of
+ *   #FLASHRAM_PAGE_SIZE bytes at a time; each erase takes tens of milliseconds,
+ *   and each page about one millisecond. Writes can have any size and offset:
+ *   the rest of the sectors that are only partially written is preserved.
+ *
+ * #save_read_async and #save_write_async start an operation and return at once.
+ * SRAM transfers and FlashRAM reads are queued on the DMA queue (see
+ * #dma_queue_read), so they complete in background; FlashRAM writes advance a
+ * step at a time when #save_poll is called (eg: once per frame), so that the
+ * game does not stall while the FlashRAM is busy. Only one operation can be in
+ * progress at a time.
+ *
+ * PI DMA has alignment constraints, which apply to SRAM and to FlashRAM reads:
+ * reads need the buffer and the offset to have the same 1-bit misalignment for
+ * SRAM, while FlashRAM reads and SRAM writes need an 8-byte aligned buffer and
+ * an even length and offset (SRAM writes need an 8-byte aligned offset).
+ * Operations not respecting these constraints fail with #SAVE_EBADINPUT.
+ * @{
+ */
+
+/** @brief Address of the SRAM on the PI bus */
+#define SRAM_ADDR                   0x08000000
+/** @brief Size of each SRAM bank */
+#define SRAM_BANK_SIZE              0x8000
+/** @brief Distance between two SRAM banks on the PI bus */
+#define SRAM_BANK_STRIDE            0x40000
+/** @brief Maximum number of SRAM banks */
+#define SRAM_BANKS                  3
+
+/** @brief Address of the FlashRAM data and status on the PI bus */
+#define FLASHRAM_ADDR               0x08000000
+/** @brief Address of the FlashRAM command register on the PI bus */
+#define FLASHRAM_CMD_ADDR           0x08010000
+/** @brief First word of the FlashRAM silicon ID */
+#define FLASHRAM_ID                 0x11118001
+
+/**
+ * @name FlashRAM commands
+ * @{
+ */
+/** @brief Select the sector (by the number of its first page) to erase */
+#define FLASHRAM_CMD_ERASE_SECTOR   0x4B000000
+/** @brief Start erasing the selected sector */
+#define FLASHRAM_CMD_EXECUTE_ERASE  0x78000000
+/** @brief Start programming a page (by number) from the page buffer */
+#define FLASHRAM_CMD_EXECUTE_WRITE  0xA5000000
+/** @brief Switch to page buffer mode: DMA writes fill the page buffer */
+#define FLASHRAM_CMD_PAGE_BUFFER    0xB4000000
+/** @brief Switch to status mode: reads return the status register */
+#define FLASHRAM_CMD_STATUS         0xD2000000
+/** @brief Switch to silicon ID mode: reads return the ID of the chip */
+#define FLASHRAM_CMD_READ_ID        0xE1000000
+/** @brief Switch to read mode: reads return the contents */
+#define FLASHRAM_CMD_READ_ARRAY     0xF0000000
+/** @} */
+
+/** @brief FlashRAM status bit: a page is being programmed */
+#define FLASHRAM_STATUS_WRITE_BUSY  0x01
+/** @brief FlashRAM status bit: a sector is being erased */
+#define FLASHRAM_STATUS_ERASE_BUSY  0x02
+
+/** @brief Number of pages in each FlashRAM sector */
+#define FLASHRAM_SECTOR_PAGES       (FLASHRAM_SECTOR_SIZE / FLASHRAM_PAGE_SIZE)
+/** @brief Time after which a busy FlashRAM is considered broken */
+#define FLASHRAM_TIMEOUT_MS         2000
+
+/** @brief Structure used to interact with the PI registers */
+static volatile struct PI_regs_s * const PI_regs = (struct PI_regs_s *)0xa4600000;
+
+/** @brief Type of the save memory selected by #save_init */
+static save_type_t save_cur_type = SAVE_TYPE_NONE;
+
+/** @brief PI DMA requests of the asynchronous operation in progress (one per SRAM bank) */
+static dma_request_t save_dma[SRAM_BANKS];
+/** @brief Number of PI DMA requests of the asynchronous operation in progress */
+static int save_dma_count = 0;
+/** @brief Result of the last asynchronous operation */
+static int save_result = SAVE_ESUCCESS;
+
+/**
+ * @brief State of a FlashRAM write in progress
+ *
+ * The data is written one sector at a time, by collecting its new contents
+ * in a buffer, erasing it and programming its pages from the buffer.
+ */
+static struct
+{
+    /** @brief Buffer with the new contents of the sector (NULL if no write is in progress) */
+    uint8_t * sector;
+    /** @brief Offset of the sector being written */
+    size_t sector_offset;
+    /** @brief Next page of the sector to program (-1 to start the next sector) */
+    int page;
+    /** @brief True while waiting for the FlashRAM to be ready */
+    bool busy;
+    /** @brief Tick at which the FlashRAM command being waited was issued */
+    uint32_t busy_tick;
+    /** @brief Data still to be copied in the sector buffer */
+    const uint8_t * src;
+    /** @brief Offset of the data still to be written */
+    size_t offset;
+    /** @brief Length of the data still to be written */
+    size_t len;
+} flashram_write;
+
+/**
+ * @brief Set the timings of the cartridge domain 2 on the PI
+ *
+ * @param[in] latency
+ *            Latency in RCP clock cycles
+ * @param[in] pulse_width
+ *            Pulse width in RCP clock cycles
+ * @param[in] page_size
+ *            Page size
+ * @param[in] release
+ *            Release duration
+ */
+static void save_set_pi_timings(uint32_t latency, uint32_t pulse_width, uint32_t page_size, uint32_t release)
+{
+    dma_wait();
+
+    disable_interrupts();
+    PI_regs->dom2_latency = latency;
+    PI_regs->dom2_pulse_width = pulse_width;
+    PI_regs->dom2_page_size = page_size;
+    PI_regs->dom2_release = release;
+    enable_interrupts();
+}
+
+/**
+ * @brief Read the FlashRAM status register
+ *
+ * @return The low byte of the status register
+ */
+static uint32_t flashram_status(void)
+{
+    io_write(FLASHRAM_CMD_ADDR, FLASHRAM_CMD_STATUS);
+    return io_read(FLASHRAM_ADDR) & 0xFF;
+}
+
+/** @brief Clear the FlashRAM status register */
+static void flashram_clear_status(void)
+{
+    io_write(FLASHRAM_CMD_ADDR, FLASHRAM_CMD_STATUS);
+    io_write(FLASHRAM_ADDR, 0);
+}
+
+/**
+ * @brief Queue a read of the FlashRAM contents
+ *
+ * In read mode the FlashRAM is addressed by halfwords: the PI address of a
+ * byte offset is the base address plus half the offset.
+ *
+ * @param[out] req
+ *             DMA request to queue
+ * @param[out] dest
+ *             Destination buffer (8-byte aligned)
+ * @param[in]  offset
+ *             Byte offset in FlashRAM (even)
+ * @param[in]  len
+ *             Length in bytes (even)
+ */
+static void flashram_queue_read(dma_request_t * req, void * dest, size_t offset, size_t len)
+{
+    io_write(FLASHRAM_CMD_ADDR, FLASHRAM_CMD_READ_ARRAY);
+    data_cache_hit_writeback_invalidate(dest, len);
+    dma_queue_read(req, dest, FLASHRAM_ADDR + offset / 2, len, DMA_PRIORITY_NORMAL, NULL, NULL);
+}
+
+/**
+ * @brief Check whether the FlashRAM silicon ID can be read
+ *
+ * @return true if a FlashRAM is present
+ */
+static bool flashram_present(void)
+{
+    uint32_t id[2] __attribute__((aligned(8)));
+
+    flashram_status();
+    io_write(FLASHRAM_CMD_ADDR, FLASHRAM_CMD_READ_ID);
+    data_cache_hit_writeback_invalidate(id, sizeof(id));
+    dma_read(id, FLASHRAM_ADDR, sizeof(id));
+
+    return id[0] == FLASHRAM_ID;
+}
+
+/**
+ * @brief Terminate the FlashRAM write in progress
+ *
+ * @param[in] result
+ *            Result of the write
+ *
+ * @return The result of the write
+ */
+static int flashram_write_done(int result)
+{
+    free(flashram_write.sector);
+    flashram_write.sector = NULL;
+    save_result = result;
+    return result;
+}
+
+/**
+ * @brief Advance the FlashRAM write in progress
+ *
+ * Each call issues at most one FlashRAM command, after the previous one
+ * completed. Pages which are entirely erased (0xFF) are not programmed.
+ *
+ * @return 1 if the write is still in progress, or its result when complete
+ */
+static int flashram_write_poll(void)
+{
+    if ( flashram_write.busy )
+    {
+        if ( flashram_status() & (FLASHRAM_STATUS_WRITE_BUSY | FLASHRAM_STATUS_ERASE_BUSY) )
+        {
+            if ( TICKS_DISTANCE(flashram_write.busy_tick, TICKS_READ()) > (int32_t)TICKS_FROM_MS(FLASHRAM_TIMEOUT_MS) )
+            {
+                flashram_write.busy = false;
+                return flashram_write_done(SAVE_EIO);
+            }
+            return 1;
+        }
+
+        flashram_clear_status();
+        flashram_write.busy = false;
+    }
+
+    uint8_t * sector = flashram_write.sector;
+
+    if ( flashram_write.page < 0 )
+    {
+        if ( flashram_write.len == 0 )
+        {
+            return flashram_write_done(SAVE_ESUCCESS);
+        }
+
+        /* Collect the new contents of the next sector */
+        const size_t sector_offset = flashram_write.offset & ~(FLASHRAM_SECTOR_SIZE - 1);
+        const size_t start = flashram_write.offset - sector_offset;
+        const size_t count = MIN(flashram_write.len, FLASHRAM_SECTOR_SIZE - start);
+
+        if ( count < FLASHRAM_SECTOR_SIZE )
+        {
+            dma_request_t req;
+            flashram_queue_read(&req, sector, sector_offset, FLASHRAM_SECTOR_SIZE);
+            dma_request_wait(&req);
+        }
+        memcpy(sector + start, flashram_write.src, count);
+
+        flashram_write.src += count;
+        flashram_write.offset += count;
+        flashram_write.len -= count;
+        flashram_write.sector_offset = sector_offset;
+        flashram_write.page = 0;
+
+        io_write(FLASHRAM_CMD_ADDR, FLASHRAM_CMD_ERASE_SECTOR | (sector_offset / FLASHRAM_PAGE_SIZE));
+        io_write(FLASHRAM_CMD_ADDR, FLASHRAM_CMD_EXECUTE_ERASE);
+    }
+    else
+    {
+        /* Erased pages already read as 0xFF */
+        while ( flashram_write.page < FLASHRAM_SECTOR_PAGES )
+        {
+            const uint64_t * page = (const uint64_t *)(sector + flashram_write.page * FLASHRAM_PAGE_SIZE);
+            int i = 0;
+            while ( i < FLASHRAM_PAGE_SIZE / 8 && page[i] == ~0ull ) { i++; }
+            if ( i < FLASHRAM_PAGE_SIZE / 8 ) { break; }
+            flashram_write.page++;
+        }
+
+        if ( flashram_write.page == FLASHRAM_SECTOR_PAGES )
+        {
+            flashram_write.page = -1;
+            return flashram_write_poll();
+        }
+
+        uint8_t * page = sector + flashram_write.page * FLASHRAM_PAGE_SIZE;
+        data_cache_hit_writeback(page, FLASHRAM_PAGE_SIZE);
+        io_write(FLASHRAM_CMD_ADDR, FLASHRAM_CMD_PAGE_BUFFER);
+        dma_write(page, FLASHRAM_ADDR, FLASHRAM_PAGE_SIZE);
+        io_write(FLASHRAM_CMD_ADDR, FLASHRAM_CMD_EXECUTE_WRITE |
+            (flashram_write.sector_offset / FLASHRAM_PAGE_SIZE + flashram_write.page));
+        flashram_write.page++;
+    }
+
+    flashram_write.busy = true;
+    flashram_write.busy_tick = TICKS_READ();
+    return 1;
+}
+
+/**
+ * @brief Select the save memory of the cartridge
+ *
+ * EEPROM and FlashRAM are checked for presence, while SRAM cannot be detected.
+ * The PI timings required by SRAM and FlashRAM are configured.
+ *
+ * @param[in] type
+ *            Type of the save memory
+ *
+ * @return #SAVE_ESUCCESS, #SAVE_ENODEVICE if the save memory is not present,
+ *         or #SAVE_EBUSY if an asynchronous operation is in progress
+ */
+int save_init( save_type_t type )
+{
+    if ( save_poll() > 0 )
+    {
+        return SAVE_EBUSY;
+    }
+
+    save_cur_type = SAVE_TYPE_NONE;
+
+    switch ( type )
+    {
+        case SAVE_TYPE_NONE:
+            break;
+        case SAVE_TYPE_EEPROM_4K:
+        case SAVE_TYPE_EEPROM_16K:
+            if ( eeprom_present() != (type == SAVE_TYPE_EEPROM_4K ? EEPROM_4K : EEPROM_16K) )
+            {
+                return SAVE_ENODEVICE;
+            }
+            break;
+        case SAVE_TYPE_SRAM_256K:
+        case SAVE_TYPE_SRAM_768K:
+            save_set_pi_timings(0x05, 0x0C, 0x0D, 0x02);
+            break;
+        case SAVE_TYPE_FLASHRAM_1M:
+            save_set_pi_timings(0x05, 0x0C, 0x0F, 0x02);
+            if ( !flashram_present() )
+            {
+                return SAVE_ENODEVICE;
+            }
+            break;
+        default:
+            return SAVE_EBADINPUT;
+    }
+
+    save_cur_type = type;
+    return SAVE_ESUCCESS;
+}
+
+/**
+ * @brief Return the type of the save memory selected by #save_init
+ *
+ * @return The type of save memory
+ */
+save_type_t save_type( void )
+{
+    return save_cur_type;
+}
+
+/**
+ * @brief Return the size of the save memory
+ *
+ * @return The size in bytes of the save memory (0 if none was selected)
+ */
+size_t save_size( void )
+{
+    switch ( save_cur_type )
+    {
+        case SAVE_TYPE_EEPROM_4K:     return 512;
+        case SAVE_TYPE_EEPROM_16K:    return 2048;
+        case SAVE_TYPE_SRAM_256K:     return SRAM_BANK_SIZE;
+        case SAVE_TYPE_SRAM_768K:     return SRAM_BANK_SIZE * SRAM_BANKS;
+        case SAVE_TYPE_FLASHRAM_1M:   return 128 * 1024;
+        default:                      return 0;
+    }
+}
+
+/**
+ * @brief Queue the PI DMA requests of a SRAM transfer, one per bank
+ *
+ * @param[in] buf
+ *            RDRAM buffer
+ * @param[in] offset
+ *            Byte offset in SRAM
+ * @param[in] len
+ *            Length in bytes
+ * @param[in] write
+ *            True to write to SRAM
+ */
+static void sram_queue(void * buf, size_t offset, size_t len, bool write)
+{
+    uint8_t * ram = buf;
+
+    while ( len > 0 )
+    {
+        const size_t bank = offset / SRAM_BANK_SIZE;
+        const size_t count = MIN(len, SRAM_BANK_SIZE - offset % SRAM_BANK_SIZE);
+        const uint32_t pi_address = SRAM_ADDR + bank * SRAM_BANK_STRIDE + offset % SRAM_BANK_SIZE;
+        dma_request_t * req = &save_dma[save_dma_count++];
+
+        if ( write )
+        {
+            dma_queue_write(req, ram, pi_address, count, DMA_PRIORITY_NORMAL, NULL, NULL);
+        }
+        else
+        {
+            dma_queue_read(req, ram, pi_address, count, DMA_PRIORITY_NORMAL, NULL, NULL);
+        }
+
+        ram += count;
+        offset += count;
+        len -= count;
+    }
+}
+
+/**
+ * @brief Start reading from the save memory
+ *
+ * Use #save_poll or #save_wait to know when the data is available. EEPROM is
+ * read synchronously.
+ *
+ * @param[out] dest
+ *             Destination buffer
+ * @param[in]  offset
+ *             Byte offset in the save memory
+ * @param[in]  len
+ *             Length in bytes
+ *
+ * @return #SAVE_ESUCCESS if the read was started, or a negative error code
+ */
+int save_read_async( void * dest, size_t offset, size_t len )
+{
+    if ( save_cur_type == SAVE_TYPE_NONE )
+    {
+        return SAVE_ENODEVICE;
+    }
+    if ( dest == NULL || offset > save_size() || len > save_size() - offset )
+    {
+        return SAVE_EBADINPUT;
+    }
+    if ( save_poll() > 0 )
+    {
+        return SAVE_EBUSY;
+    }
+
+    save_result = SAVE_ESUCCESS;
+    if ( len == 0 )
+    {
+        return SAVE_ESUCCESS;
+    }
+
+    switch ( save_cur_type )
+    {
+        case SAVE_TYPE_EEPROM_4K:
+        case SAVE_TYPE_EEPROM_16K:
+            eeprom_read_bytes(dest, offset, len);
+            break;
+        case SAVE_TYPE_SRAM_256K:
+        case SAVE_TYPE_SRAM_768K:
+            if ( (((uint32_t)dest ^ offset) & 1) != 0 )
+            {
+                return SAVE_EBADINPUT;
+            }
+            data_cache_hit_writeback_invalidate(dest, len);
+            sram_queue(dest, offset, len, false);
+            break;
+        case SAVE_TYPE_FLASHRAM_1M:
+            if ( ((uint32_t)dest & 7) != 0 || ((offset | len) & 1) != 0 )
+            {
+                return SAVE_EBADINPUT;
+            }
+            flashram_queue_read(&save_dma[save_dma_count++], dest, offset, len);
+            break;
+        default:
+            break;
+    }
+
+    return SAVE_ESUCCESS;
+}
+
+/**
+ * @brief Start writing to the save memory
+ *
+ * Use #save_poll or #save_wait to know when the data has been written; for
+ * FlashRAM, #save_poll must be called to make progress. The source buffer must
+ * not be modified until then. EEPROM is written synchronously.
+ *
+ * @param[in] src
+ *            Source buffer
+ * @param[in] offset
+ *            Byte offset in the save memory
+ * @param[in] len
+ *            Length in bytes
+ *
+ * @return #SAVE_ESUCCESS if the write was started, or a negative error code
+ */
+int save_write_async( const void * src, size_t offset, size_t len )
+{
+    if ( save_cur_type == SAVE_TYPE_NONE )
+    {
+        return SAVE_ENODEVICE;
+    }
+    if ( src == NULL || offset > save_size() || len > save_size() - offset )
+    {
+        return SAVE_EBADINPUT;
+    }
+    if ( save_poll() > 0 )
+    {
+        return SAVE_EBUSY;
+    }
+
+    save_result = SAVE_ESUCCESS;
+    if ( len == 0 )
+    {
+        return SAVE_ESUCCESS;
+    }
+
+    switch ( save_cur_type )
+    {
+        case SAVE_TYPE_EEPROM_4K:
+        case SAVE_TYPE_EEPROM_16K:
+            eeprom_write_bytes(src, offset, len);
+            break;
+        case SAVE_TYPE_SRAM_256K:
+        case SAVE_TYPE_SRAM_768K:
+            if ( (((uint32_t)src | offset) & 7) != 0 || (len & 1) != 0 )
+            {
+                return SAVE_EBADINPUT;
+            }
+            data_cache_hit_writeback(src, len);
+            sram_queue((void *)src, offset, len, true);
+            break;
+        case SAVE_TYPE_FLASHRAM_1M:
+            /* The FlashRAM is read into the sector buffer through PI DMA */
+            flashram_write.sector = memalign(16, FLASHRAM_SECTOR_SIZE);
+            if ( flashram_write.sector == NULL )
+            {
+                return SAVE_ENOMEM;
+            }
+            flashram_write.src = src;
+            flashram_write.offset = offset;
+            flashram_write.len = len;
+            flashram_write.page = -1;
+            flashram_write.busy = false;
+            flashram_write_poll();
+            break;
+        default:
+            break;
+    }
+
+    return SAVE_ESUCCESS;
+}
+
+/**
+ * @brief Check the progress of the asynchronous operation, and advance it
+ *
+ * Call this regularly (eg: once per frame) while a FlashRAM write is in
+ * progress, as every call issues the next FlashRAM command when the previous
+ * one is complete.
+ *
+ * @return A positive value if the operation is still in progress, otherwise
+ *         the result of the last operation (#SAVE_ESUCCESS or a negative error code)
+ */
+int save_poll( void )
+{
+    if ( flashram_write.sector != NULL )
+    {
+        return flashram_write_poll();
+    }
+
+    while ( save_dma_count > 0 )
+    {
+        if ( !dma_request_done(&save_dma[save_dma_count - 1]) )
+        {
+            return 1;
+        }
+        save_dma_count--;
+    }
+
+    return save_result;
+}
+
+/**
+ * @brief Wait for the completion of the asynchronous operation
+ *
+ * @return The result of the operation (#SAVE_ESUCCESS or a negative error code)
+ */
+int save_wait( void )
+{
+    int result;
+
+    /* Let other threads run meanwhile (see #thread_yield) */
+    while ( (result = save_poll()) > 0 )
+    {
+        thread_yield();
+    }
+
+    return result;
+}
+
+/**
+ * @brief Read from the save memory, waiting for completion
+ *
+ * @param[out] dest
+ *             Destination buffer
+ * @param[in]  offset
+ *             Byte offset in the save memory
+ * @param[in]  len
+ *             Length in bytes
+ *
+ * @return #SAVE_ESUCCESS or a negative error code
+ */
+int save_read( void * dest, size_t offset, size_t len )
+{
+    const int result = save_read_async(dest, offset, len);
+    return result < 0 ? result : save_wait();
+}
+
+/**
+ * @brief Write to the save memory, waiting for completion
+ *
+ * @param[in] src
+ *            Source buffer
+ * @param[in] offset
+ *            Byte offset in the save memory
+ * @param[in] len
+ *            Length in bytes
+ *
+ * @return #SAVE_ESUCCESS or a negative error code
+ */
+int save_write( const void * src, size_t offset, size_t len )
+{
+    const int result = save_write_async(src, offset, len);
+    return result < 0 ? result : save_wait();
+}
+
+/** @} */ /* save */
@@ -0,0 +1,195 @@
+/**
+ * @file sprite.c
+ * @brief Sprite loading
+ * @ingroup graphics
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <malloc.h>
+#include <string.h>
+#include "dragonfs.h"
+#include "graphics.h"
+#include "debug.h"
+
+/**
+ * @addtogroup graphics
+ * @{
+ */
+
+/** @brief Size of the header of a sprite file (the fields of #sprite_t before the data) */
+#define SPRITE_HEADER_SIZE  8
+
+/**
+ * @brief Decompress the pixels of a compressed sprite
+ *
+ * The stream is a sequence of LZ77 blocks, written by mksprite --compress.
+ * Each block starts with a token byte: its high nibble is the number of
+ * literals that follow, and its low nibble is the length of the match minus
+ * 3.  A nibble of 15 is extended by the bytes after the token (before the
+ * literals for the literal count, after them for the match length), each
+ * one added to it until one is not 255.  The literals are followed by the
+ * big-endian 16-bit distance of the match.  The last block only has literals.
+ *
+ * @param[out] dst
+ *             Buffer for the pixels
+ * @param[in]  size
+ *             Size of the pixels in bytes
+ * @param[in]  src
+ *             Compressed stream
+ * @param[in]  src_size
+ *             Size of the compressed stream in bytes
+ *
+ * @return True on success, false if the stream is corrupted
+ */
+static bool __sprite_decompress( uint8_t *dst, int size, const uint8_t *src, int src_size )
+{
+    uint8_t *out = dst;
+    uint8_t *out_end = dst + size;
+    const uint8_t *in_end = src + src_size;
+
+    while( src < in_end )
+    {
+        int token = *src++;
+        int len = token >> 4;
+
+        if( len == 15 )
+        {
+            int b;
+
+            do
+            {
+                if( src == in_end ) { return false; }
+                b = *src++;
+                len += b;
+            } while( b == 255 );
+        }
+
+        if( len > in_end - src || len > out_end - out ) { return false; }
+        memcpy( out, src, len );
+        out += len;
+        src += len;
+
+        /* The last block has no match */
+        if( out == out_end ) { break; }
+
+        if( in_end - src < 2 ) { return false; }
+        int dist = (src[0] << 8) | src[1];
+        src += 2;
+
+        len = (token & 0xF) + 3;
+
+        if( (token & 0xF) == 15 )
+        {
+            int b;
+
+            do
+            {
+                if( src == in_end ) { return false; }
+                b = *src++;
+                len += b;
+            } while( b == 255 );
+        }
+
+        if( dist == 0 || dist > out - dst || len > out_end - out ) { return false; }
+
+        /* Byte by byte, as the match can overlap the bytes it produces */
+        const uint8_t *match = out - dist;
+
+        while( len-- )
+        {
+            *out++ = *match++;
+        }
+    }
+
+    return out == out_end;
+}
+
+/**
+ * @brief Load a sprite from DragonFS
+ *
+ * Loads a sprite written by mksprite, uncompressing its pixels if it was converted
+ * with --compress: compressed sprites take less space in the ROM and, as reading the
+ * ROM is slow, they are often quicker to load than the uncompressed ones.  The sprite
+ * is 8-byte aligned, so that it can be loaded as a texture by the RDP.
+ *
+ * @param[in] fn
+ *            Path of the sprite in DragonFS
+ *
+ * @return The sprite, to be freed with free(), or NULL if the file cannot be read
+ *         or is corrupted
+ */
+sprite_t *sprite_load( const char * const fn )
+{
+    int fh = dfs_open( fn );
+
+    if( fh < 0 )
+    {
+        return NULL;
+    }
+
+    int size = dfs_size( fh );
+
+    if( size < SPRITE_HEADER_SIZE )
+    {
+        dfs_close( fh );
+        return NULL;
+    }
+
+    uint8_t *data = memalign( 8, size );
+
+    if( !data )
+    {
+        dfs_close( fh );
+        return NULL;
+    }
+
+    int read = dfs_read( data, 1, size, fh );
+    dfs_close( fh );
+
+    if( read != size )
+    {
+        free( data );
+        return NULL;
+    }
+
+    sprite_t *sprite = (sprite_t *)data;
+
+    if( !(sprite->format & SPRITE_FLAGS_COMPRESSED) )
+    {
+        return sprite;
+    }
+
+    /* A compressed sprite stores the size of the pixels before the stream */
+    if( size < SPRITE_HEADER_SIZE + 4 )
+    {
+        free( data );
+        return NULL;
+    }
+
+    const uint8_t *stream = data + SPRITE_HEADER_SIZE;
+    int pixels = (stream[0] << 24) | (stream[1] << 16) | (stream[2] << 8) | stream[3];
+    sprite_t *out = pixels >= 0 ? memalign( 8, SPRITE_HEADER_SIZE + pixels ) : NULL;
+
+    if( !out )
+    {
+        free( data );
+        return NULL;
+    }
+
+    memcpy( out, sprite, SPRITE_HEADER_SIZE );
+    out->format &= ~SPRITE_FLAGS_COMPRESSED;
+
+    bool ok = __sprite_decompress( (uint8_t *)out->data, pixels, stream + 4, size - SPRITE_HEADER_SIZE - 4 );
+    free( data );
+
+    if( !ok )
+    {
+        debugf( "sprite %s: corrupted compressed data\n", fn );
+        free( out );
+        return NULL;
+    }
+
+    return out;
+}
+
+/** @} */ /* graphics */
@@ -38,6 +38,11 @@
  * you already.  If you are using a 6105 for some reason, you will need to use
  * #sys_set_boot_cic to notify libdragon or malloc will not work properly!
  *
+ * For memory with a known lifetime, #arena_init provides bump allocators whose
+ * allocations are released at once (for example each frame), and #pool_init
+ * provides pools of fixed-size objects; both avoid the cost and fragmentation of
+ * malloc.  #sys_get_heap_stats reports how much of the heap is used.
+ *
  * libdragon has defined a custom callback structure for filesystems to use.
  * Providing relevant hooks for calls that your filesystem supports and passing
  * the resulting structure to #attach_filesystem will hook your filesystem into
@@ -122,6 +127,8 @@ typedef struct
      * (eg. 'rom:/' or 'cf:/') 
      */
     char *prefix;
+    /** @brief Length of the prefix, cached for lookups */
+    int prefix_len;
     /** @brief Filesystem callback pointers */
     filesystem_t *fs;
 } fs_mapping_t;
@@ -142,14 +149,21 @@ typedef struct
     void *handle;
     /** @brief The handle assigned by the filesystem code that will be returned
      *         to newlib.  All subsequent newlib calls will use this handle which
-     *         will be used to look up the internal reference. */
+     *         will be used to look up the internal reference.  This is
+     *         #FIRST_FILENO plus the index of the entry in #handles, or 0 if
+     *         the entry is free. */
     int fileno;
 } fs_handle_t;
 
+/** @brief File handle of the first entry of #handles (past STDIN, STDOUT, STDERR) */
+#define FIRST_FILENO    3
+
 /** @brief Array of filesystems registered */
 static fs_mapping_t filesystems[MAX_FILESYSTEMS] = { { 0 } };
 /** @brief Array of open handles tracked */
 static fs_handle_t handles[MAX_OPEN_HANDLES] = { { 0 } };
+/** @brief Index of the filesystem that matched the last lookup by name (-1 if none) */
+static int last_fs_link = -1;
 /** @brief Current stdio hook structure */
 static stdio_t stdio_hooks = { 0 };
 /** @brief Function to provide the current time */
@@ -272,27 +286,6 @@ static int __strcmp( const char * const a, const char * const b )
     return __strncmp( a, b, -1 );
 }
 
-/**
- * @brief Return a unique filesystem handle
- *
- * @return A unique 32-bit value usable as a filesystem handle
- */
-static int __get_new_handle()
-{
-    /* Start past STDIN, STDOUT, STDERR file handles */
-    static int handle = 3;
-    int newhandle;
-
-    disable_interrupts();
-
-    /* Always give out a nonzero handle unique to the system */
-    newhandle = handle++;
-
-    enable_interrupts();
-
-    return newhandle;
-}
-
 /**
  * @brief Register a filesystem with newlib
  *
@@ -370,6 +363,7 @@ int attach_filesystem( const char * const prefix, filesystem_t *filesystem )
 
     /* Attach the prefix */
     filesystems[handle].prefix = __strdup( prefix );
+    filesystems[handle].prefix_len = len;
 
     /* Attach the inputted filesystem */
     filesystems[handle].fs = filesystem;
@@ -378,6 +372,32 @@ int attach_filesystem( const char * const prefix, filesystem_t *filesystem )
     return 0;
 }
 
+/**
+ * @brief Return the filesystem registered under a prefix
+ *
+ * @param[in] prefix
+ *            The prefix that was used to register the filesystem
+ *
+ * @return The filesystem passed to #attach_filesystem, or NULL if not found.
+ */
+filesystem_t *get_filesystem( const char * const prefix )
+{
+    if( !prefix )
+    {
+        return 0;
+    }
+
+    for( int i = 0; i < MAX_FILESYSTEMS; i++ )
+    {
+        if( filesystems[i].prefix && __strcmp( filesystems[i].prefix, prefix ) == 0 )
+        {
+            return filesystems[i].fs;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * @brief Unregister a filesystem from newlib
  *
@@ -418,7 +438,9 @@ int detach_filesystem( const char * const prefix )
                 /* Now free the memory associated with the prefix and zero out the filesystem */
                 free( filesystems[i].prefix );
                 filesystems[i].prefix = 0;
+                filesystems[i].prefix_len = 0;
                 filesystems[i].fs = 0;
+                last_fs_link = -1;
 
                 /* All went well */
                 return 0;
@@ -431,6 +453,29 @@ int detach_filesystem( const char * const prefix )
     return -2;
 }
 
+/**
+ * @brief Get the open handle structure of a file handle
+ *
+ * File handles index #handles directly.
+ *
+ * @param[in] fileno
+ *            File handle
+ *
+ * @return Pointer to the open handle structure or null if not found.
+ */
+static fs_handle_t *__get_handle( int fileno )
+{
+    unsigned int index = fileno - FIRST_FILENO;
+
+    if( index >= MAX_OPEN_HANDLES || handles[index].fileno != fileno )
+    {
+        /* Invalid or not open */
+        return 0;
+    }
+
+    return &handles[index];
+}
+
 /**
  * @brief Get a filesystem pointer by handle
  *
@@ -443,23 +488,28 @@ int detach_filesystem( const char * const prefix )
  */
 static filesystem_t *__get_fs_pointer_by_handle( int fileno )
 {
-    /* Invalid */
-    if( fileno <= 0 )
-    {
-        return 0;
-    }
+    fs_handle_t *handle = __get_handle( fileno );
 
-    for( int i = 0; i < MAX_OPEN_HANDLES; i++ )
-    {
-        if( handles[i].fileno == fileno )
-        {
-            /* Found it */
-            return filesystems[handles[i].fs_mapping].fs;
-        }
-    }
+    return handle ? filesystems[handle->fs_mapping].fs : 0;
+}
 
-    /* Couldn't find it */
-    return 0;
+/**
+ * @brief Check whether a filename starts with the prefix of a registered filesystem
+ *
+ * @param[in] fs
+ *            Index of the filesystem
+ * @param[in] name
+ *            The filename of the file being opened including the prefix
+ *
+ * @return Nonzero if the filename starts with the prefix.
+ */
+static int __fs_prefix_matches( int fs, const char * const name )
+{
+    const char *prefix = filesystems[fs].prefix;
+
+    /* Reject most mismatches on the first character */
+    return prefix && prefix[0] == name[0] &&
+           __strncmp( prefix, name, filesystems[fs].prefix_len ) == 0;
 }
 
 /**
@@ -478,15 +528,20 @@ static int __get_fs_link_by_name( const char * const name )
         return -1;
     }
 
+    /* Files are usually opened from the same filesystem over and over */
+    int last = last_fs_link;
+    if( last >= 0 && __fs_prefix_matches( last, name ) )
+    {
+        return last;
+    }
+
     for( int i = 0; i < MAX_FILESYSTEMS; i++ )
     {
-        if( filesystems[i].prefix )
+        if( __fs_prefix_matches( i, name ) )
         {
-            if( __strncmp( filesystems[i].prefix, name, __strlen( filesystems[i].prefix ) ) == 0 )
-            {
-                /* Found it */
-                return i;
-            }
+            /* Found it */
+            last_fs_link = i;
+            return i;
         }
     }
 
@@ -527,23 +582,9 @@ static filesystem_t *__get_fs_pointer_by_name( const char * const name )
  */
 static void *__get_fs_handle( int fileno )
 {
-    /* Invalid */
-    if( fileno <= 0 )
-    {
-        return 0;
-    }
-
-    for( int i = 0; i < MAX_OPEN_HANDLES; i++ )
-    {
-        if( handles[i].fileno == fileno )
-        {
-            /* Found it */
-            return handles[i].handle;
-        }
-    }
+    fs_handle_t *handle = __get_handle( fileno );
 
-    /* Couldn't find it */
-    return 0;
+    return handle ? handle->handle : 0;
 }
 
 /**
@@ -587,15 +628,10 @@ int close( int fildes )
     }
 
     /* Free the open file handle */
-    for( int i = 0; i < MAX_OPEN_HANDLES; i++)
-    {
-        if( handles[i].fileno == fildes )
-        {
-            handles[i].fs_mapping = 0;
-            handles[i].handle = NULL;
-            handles[i].fileno = 0;
-        }
-    }
+    fs_handle_t *entry = __get_handle( fildes );
+    entry->fs_mapping = 0;
+    entry->handle = NULL;
+    entry->fileno = 0;
 
     if( fs->close == 0 )
     {
@@ -854,14 +890,16 @@ int lseek( int file, int ptr, int dir )
  */
 int open( char *file, int flags, int mode )
 {
-    filesystem_t *fs = __get_fs_pointer_by_name( file );
+    int mapping = __get_fs_link_by_name( file );
 
-    if( fs == 0 )
+    if( mapping < 0 )
     {
         errno = EINVAL;
         return -1;
     }
 
+    filesystem_t *fs = filesystems[mapping].fs;
+
     if( fs->open == 0 )
     {
         /* Filesystem doesn't support open */
@@ -875,20 +913,12 @@ int open( char *file, int flags, int mode )
         if( handles[i].fileno == 0 )
         {
             /* Yes, we have room, try the open */
-            int mapping = __get_fs_link_by_name( file );
-
-            if( mapping < 0 )
-            {
-                errno = ENOMEM;
-                return -1;
-            }
- 
-            void *ptr = fs->open( file + __strlen( filesystems[mapping].prefix ), flags );
+            void *ptr = fs->open( file + filesystems[mapping].prefix_len, flags );
 
             if( ptr )
             {
                 /* Create new internal handle */
-                handles[i].fileno = __get_new_handle();
+                handles[i].fileno = FIRST_FILENO + i;
                 handles[i].handle = ptr;
                 handles[i].fs_mapping = mapping;
 
@@ -990,6 +1020,17 @@ int readlink( const char *path, char *buf, size_t bufsize )
 // Do not allow this in small data or it will seem larger than it actually is
 extern char end __attribute__((section (".data"))); /* Set by linker.  */
 
+/** @brief Current end of the heap (set by the first call to #sbrk) */
+static char * heap_end = 0;
+/** @brief Highest address the heap can grow to */
+static char * heap_top = 0;
+/** @brief Highest end of the heap so far */
+static char * heap_high_water = 0;
+/** @brief Memory accounted to each tag */
+static mem_tag_stats_t mem_tags[MEM_TAG_COUNT];
+/** @brief True if the unused stack was painted by #sys_stack_paint */
+static bool stack_painted = false;
+
 /**
  * @brief Return a new chunk of memory to be used as heap
  *
@@ -1000,8 +1041,6 @@ extern char end __attribute__((section (".data"))); /* Set by linker.  */
  */
 void *sbrk( int incr )
 {
-    static char * heap_end = 0;
-    static char * heap_top = 0;
     char *        prev_heap_end;
 
     disable_interrupts();
@@ -1010,6 +1049,7 @@ void *sbrk( int incr )
     {
         heap_end = &end;
         heap_top = (char*)KSEG0_START_ADDR + get_memory_size() - STACK_SIZE;
+        heap_high_water = heap_end;
     }
 
     prev_heap_end = heap_end;
@@ -1023,11 +1063,506 @@ void *sbrk( int incr )
         errno = ENOMEM;
     }
 
+    if( heap_end > heap_high_water )
+    {
+        heap_high_water = heap_end;
+    }
+
     enable_interrupts();
 
     return (void *)prev_heap_end;
 }
 
+/**
+ * @brief Reserve memory at the top of the heap
+ *
+ * The memory is taken away from the heap for good, starting right below the
+ * stack, and each call reserves the memory right below the previous one.
+ *
+ * @param[in] incr
+ *            The amount of memory to reserve in bytes (0 to just get the top of the heap)
+ *
+ * @return A pointer to the start of the reserved memory (the new top of the heap),
+ *         or (void*)-1 if the heap already uses it.
+ */
+void *sbrk_top( int incr )
+{
+    char *ret;
+
+    /* Let the heap initialize, if malloc was never called */
+    sbrk( 0 );
+
+    disable_interrupts();
+
+    if( heap_top - incr < heap_end )
+    {
+        ret = (char *)-1;
+        errno = ENOMEM;
+    }
+    else
+    {
+        heap_top -= incr;
+        ret = heap_top;
+    }
+
+    enable_interrupts();
+
+    return (void *)ret;
+}
+
+/**
+ * @brief Return statistics on the heap
+ *
+ * The heap spans from the end of the program to #STACK_SIZE bytes below the
+ * top of RDRAM: this takes into account whether the expansion pak is present.
+ *
+ * @param[out] stats
+ *             Structure to fill with the statistics
+ */
+void sys_get_heap_stats( heap_stats_t *stats )
+{
+    /* Let the heap initialize, if malloc was never called */
+    sbrk( 0 );
+
+    struct mallinfo info = mallinfo();
+
+    disable_interrupts();
+    stats->total = heap_top - &end;
+    stats->reserved = heap_end - &end;
+    stats->high_water = heap_high_water - &end;
+    enable_interrupts();
+
+    stats->used = info.uordblks;
+    stats->free = (stats->total - stats->reserved) + info.fordblks;
+}
+
+/**
+ * @brief Account memory to a tag
+ *
+ * Use this for the memory that is not allocated with #malloc_tagged (eg:
+ * buffers allocated with #malloc_video or #malloc_uncached).  The same size
+ * must be passed to #sys_mem_tag_free when the memory is released.
+ *
+ * @param[in] tag
+ *            Subsystem that uses the memory
+ * @param[in] size
+ *            Size of the memory in bytes
+ */
+void sys_mem_tag_alloc( mem_tag_t tag, size_t size )
+{
+    assertf( tag >= 0 && tag < MEM_TAG_COUNT, "invalid memory tag: %d", tag );
+
+    disable_interrupts();
+
+    mem_tag_stats_t *stats = &mem_tags[tag];
+    stats->live += size;
+    stats->count++;
+
+    if( stats->live > stats->peak )
+    {
+        stats->peak = stats->live;
+    }
+
+    enable_interrupts();
+}
+
+/**
+ * @brief Release memory accounted to a tag with #sys_mem_tag_alloc
+ *
+ * @param[in] tag
+ *            Subsystem that used the memory
+ * @param[in] size
+ *            Size of the memory in bytes
+ */
+void sys_mem_tag_free( mem_tag_t tag, size_t size )
+{
+    assertf( tag >= 0 && tag < MEM_TAG_COUNT, "invalid memory tag: %d", tag );
+
+    disable_interrupts();
+
+    mem_tag_stats_t *stats = &mem_tags[tag];
+    assertf( stats->live >= size && stats->count > 0, "memory tag %d released more than allocated", tag );
+    stats->live -= size;
+    stats->count--;
+
+    enable_interrupts();
+}
+
+/**
+ * @brief Allocate memory from the heap, and account it to a tag
+ *
+ * The accounted size is the actual size of the block handed out by malloc,
+ * so that the per-tag statistics add up to the memory that is really used.
+ *
+ * @param[in] tag
+ *            Subsystem that uses the memory
+ * @param[in] size
+ *            Size of the memory in bytes
+ *
+ * @return The memory, to be freed with #free_tagged, or NULL if out of memory.
+ */
+void *malloc_tagged( mem_tag_t tag, size_t size )
+{
+    void *ptr = malloc( size );
+
+    if( ptr )
+    {
+        sys_mem_tag_alloc( tag, malloc_usable_size( ptr ) );
+    }
+
+    return ptr;
+}
+
+/**
+ * @brief Allocate aligned memory from the heap, and account it to a tag
+ *
+ * @param[in] tag
+ *            Subsystem that uses the memory
+ * @param[in] align
+ *            Alignment of the memory in bytes (a power of two)
+ * @param[in] size
+ *            Size of the memory in bytes
+ *
+ * @return The memory, to be freed with #free_tagged, or NULL if out of memory.
+ */
+void *memalign_tagged( mem_tag_t tag, size_t align, size_t size )
+{
+    void *ptr = memalign( align, size );
+
+    if( ptr )
+    {
+        sys_mem_tag_alloc( tag, malloc_usable_size( ptr ) );
+    }
+
+    return ptr;
+}
+
+/**
+ * @brief Free memory allocated with #malloc_tagged or #memalign_tagged
+ *
+ * @param[in] tag
+ *            Tag the memory was allocated with
+ * @param[in] ptr
+ *            Memory to free (or NULL)
+ */
+void free_tagged( mem_tag_t tag, void *ptr )
+{
+    if( ptr )
+    {
+        sys_mem_tag_free( tag, malloc_usable_size( ptr ) );
+        free( ptr );
+    }
+}
+
+/**
+ * @brief Return the memory accounted to a tag
+ *
+ * Together with #sys_get_heap_stats, this tells where the memory goes: the
+ * peak of each subsystem is the budget it actually needs.
+ *
+ * @param[in]  tag
+ *             Subsystem to query
+ * @param[out] stats
+ *             Structure to fill with the statistics
+ */
+void sys_get_mem_tag_stats( mem_tag_t tag, mem_tag_stats_t *stats )
+{
+    assertf( tag >= 0 && tag < MEM_TAG_COUNT, "invalid memory tag: %d", tag );
+
+    disable_interrupts();
+    *stats = mem_tags[tag];
+    enable_interrupts();
+}
+
+/**
+ * @brief Fill the unused part of the main stack with #STACK_PAINT_PATTERN
+ *
+ * Call this once, early in main: #sys_get_stack_high_water then finds the
+ * deepest point the stack reached by looking for the first overwritten word.
+ * The stack is #STACK_SIZE bytes, right below the top of RDRAM.
+ */
+void sys_stack_paint( void )
+{
+    uint32_t *bottom = (uint32_t *)(KSEG0_START_ADDR + get_memory_size() - STACK_SIZE);
+    uint32_t *sp;
+
+    __asm__ volatile( "move %0, $sp" : "=r"(sp) );
+
+    /* Interrupt handlers run on this stack: keep them from pushing a frame
+     * into the area being painted, and leave some room below our own */
+    disable_interrupts();
+
+    for( uint32_t *p = bottom; p < sp - 64; p++ )
+    {
+        *p = STACK_PAINT_PATTERN;
+    }
+
+    stack_painted = true;
+
+    enable_interrupts();
+}
+
+/**
+ * @brief Return the highest amount of main stack used so far
+ *
+ * Only available after #sys_stack_paint.  The result is a lower bound: a
+ * function that reserved stack space without writing it is not detected.
+ *
+ * @return Bytes of stack used at the deepest point, or 0 if the stack was
+ *         not painted.
+ */
+size_t sys_get_stack_high_water( void )
+{
+    if( !stack_painted )
+    {
+        return 0;
+    }
+
+    uint32_t *top = (uint32_t *)(KSEG0_START_ADDR + get_memory_size());
+    uint32_t *p = top - STACK_SIZE / sizeof(uint32_t);
+
+    while( p < top && *p == STACK_PAINT_PATTERN )
+    {
+        p++;
+    }
+
+    return (top - p) * sizeof(uint32_t);
+}
+
+/**
+ * @brief Initialize an arena
+ *
+ * An arena is a bump allocator: allocating only advances a pointer, and all
+ * the allocations are released at once by #arena_reset, for example at the
+ * end of each frame.  This is much faster than malloc, and does not fragment
+ * the heap.
+ *
+ * The arena functions can be called from interrupt handlers.
+ *
+ * @param[out] arena
+ *             Arena to initialize
+ * @param[in]  buffer
+ *             Memory of the arena, or NULL to allocate it from the heap
+ * @param[in]  size
+ *             Size of the arena in bytes
+ *
+ * @return 0 on success or a negative value if the memory could not be allocated.
+ */
+int arena_init( arena_t *arena, void *buffer, size_t size )
+{
+    arena->owned = buffer == NULL;
+    arena->base = arena->owned ? memalign( ARENA_ALIGN, size ) : buffer;
+    arena->size = arena->base ? size : 0;
+    arena->used = 0;
+    arena->high_water = 0;
+
+    return arena->base ? 0 : -1;
+}
+
+/**
+ * @brief Allocate memory from an arena, with a specific alignment
+ *
+ * @param[in] arena
+ *            Arena to allocate from
+ * @param[in] size
+ *            Size of the allocation in bytes
+ * @param[in] align
+ *            Alignment of the allocation (a power of two)
+ *
+ * @return A pointer to the memory, or NULL if the arena is full.
+ */
+void *arena_alloc_aligned( arena_t *arena, size_t size, size_t align )
+{
+    void *ptr = NULL;
+
+    disable_interrupts();
+
+    uintptr_t start = ((uintptr_t)arena->base + arena->used + align - 1) & ~(uintptr_t)(align - 1);
+    size_t used = start - (uintptr_t)arena->base + size;
+
+    if( arena->base && used <= arena->size )
+    {
+        ptr = (void *)start;
+        arena->used = used;
+
+        if( used > arena->high_water )
+        {
+            arena->high_water = used;
+        }
+    }
+
+    enable_interrupts();
+
+    return ptr;
+}
+
+/**
+ * @brief Allocate memory from an arena
+ *
+ * The memory is aligned to #ARENA_ALIGN bytes.
+ *
+ * @param[in] arena
+ *            Arena to allocate from
+ * @param[in] size
+ *            Size of the allocation in bytes
+ *
+ * @return A pointer to the memory, or NULL if the arena is full.
+ */
+void *arena_alloc( arena_t *arena, size_t size )
+{
+    return arena_alloc_aligned( arena, size, ARENA_ALIGN );
+}
+
+/**
+ * @brief Release all the allocations of an arena
+ *
+ * @param[in] arena
+ *            Arena to reset
+ */
+void arena_reset( arena_t *arena )
+{
+    arena->used = 0;
+}
+
+/**
+ * @brief Release the memory of an arena
+ *
+ * The memory is freed only if it was allocated by #arena_init.
+ *
+ * @param[in] arena
+ *            Arena to close
+ */
+void arena_close( arena_t *arena )
+{
+    if( arena->owned )
+    {
+        free( arena->base );
+    }
+
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+/**
+ * @brief Initialize a pool of fixed-size objects
+ *
+ * Allocating from and releasing to a pool take constant time, since the free
+ * objects are kept in a linked list.  The pool functions can be called from
+ * interrupt handlers.
+ *
+ * @param[out] pool
+ *             Pool to initialize
+ * @param[in]  buffer
+ *             Memory of the pool (count * the aligned object size), or NULL to
+ *             allocate it from the heap
+ * @param[in]  object_size
+ *             Size of each object in bytes
+ * @param[in]  count
+ *             Number of objects in the pool
+ *
+ * @return 0 on success or a negative value if the memory could not be allocated.
+ */
+int pool_init( pool_t *pool, void *buffer, size_t object_size, int count )
+{
+    /* A free object stores the pointer to the next one */
+    if( object_size < sizeof(void *) )
+    {
+        object_size = sizeof(void *);
+    }
+    object_size = (object_size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    pool->owned = buffer == NULL;
+    pool->base = pool->owned ? memalign( ARENA_ALIGN, object_size * count ) : buffer;
+    pool->object_size = object_size;
+    pool->count = pool->base ? count : 0;
+    pool->used = 0;
+    pool->high_water = 0;
+    pool->free_list = NULL;
+
+    /* Chain the objects so that they are allocated in order */
+    for( int i = pool->count - 1; i >= 0; i-- )
+    {
+        void **object = (void **)(pool->base + i * object_size);
+        *object = pool->free_list;
+        pool->free_list = object;
+    }
+
+    return pool->base ? 0 : -1;
+}
+
+/**
+ * @brief Allocate an object from a pool
+ *
+ * @param[in] pool
+ *            Pool to allocate from
+ *
+ * @return A pointer to the object, or NULL if all the objects are in use.
+ */
+void *pool_alloc( pool_t *pool )
+{
+    disable_interrupts();
+
+    void **object = pool->free_list;
+
+    if( object )
+    {
+        pool->free_list = *object;
+        pool->used++;
+
+        if( pool->used > pool->high_water )
+        {
+            pool->high_water = pool->used;
+        }
+    }
+
+    enable_interrupts();
+
+    return object;
+}
+
+/**
+ * @brief Release an object to its pool
+ *
+ * @param[in] pool
+ *            Pool the object was allocated from
+ * @param[in] ptr
+ *            Object to release (NULL is ignored)
+ */
+void pool_free( pool_t *pool, void *ptr )
+{
+    if( !ptr ) { return; }
+
+    disable_interrupts();
+
+    void **object = ptr;
+    *object = pool->free_list;
+    pool->free_list = object;
+    pool->used--;
+
+    enable_interrupts();
+}
+
+/**
+ * @brief Release the memory of a pool
+ *
+ * The memory is freed only if it was allocated by #pool_init.
+ *
+ * @param[in] pool
+ *            Pool to close
+ */
+void pool_close( pool_t *pool )
+{
+    if( pool->owned )
+    {
+        free( pool->base );
+    }
+
+    pool->base = NULL;
+    pool->free_list = NULL;
+    pool->count = 0;
+}
+
 /**
  * @brief Return file stats based on a file name
  *
@@ -1119,7 +1654,7 @@ int unlink( char *name )
     }
 
     /* Must offset past the prefix */
-    return fs->unlink( name + __strlen( filesystems[mapping].prefix ) );
+    return fs->unlink( name + filesystems[mapping].prefix_len );
 }
 
 /**
@@ -1237,7 +1772,7 @@ int dir_findfirst( const char * const path, dir_t *dir )
         return -1;
     }
 
-    return fs->findfirst( (char *)path + + __strlen( filesystems[mapping].prefix ), dir );
+    return fs->findfirst( (char *)path + filesystems[mapping].prefix_len, dir );
 }
 
 /**
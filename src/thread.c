@@ -0,0 +1,890 @@
+/**
+ * @file thread.c
+ * @brief Threads
+ * @ingroup thread
+ */
+#include <malloc.h>
+#include <string.h>
+#include "libdragon.h"
+#include "system.h"
+
+/**
+ * @defgroup thread Threads
+ * @ingroup libdragon
+ * @brief Lightweight threads with priorities, optionally preemptive.
+ *
+ * Work that has to be interleaved with the game loop, such as streaming data from
+ * DragonFS or refilling audio buffers, can instead run in its own thread, with its
+ * own stack, written as straight-line code.  By default threads are cooperative: a
+ * thread runs until it calls #thread_yield, #thread_wait_event, #thread_join,
+ * #thread_exit or waits on a mutex or semaphore, and the next ready thread then runs.
+ * Since a thread is never interrupted by another thread, data shared between threads
+ * needs no locking.
+ *
+ * Each thread has a priority (#THREAD_PRIORITY_NORMAL by default, see
+ * #thread_set_priority): the ready thread with the highest priority runs first, and
+ * threads of the same priority run in round-robin order.  Note that a thread that
+ * yields is run again right away if no thread of the same or higher priority is ready.
+ *
+ * After #thread_init, the code calling it becomes the main thread, and new threads
+ * can be started with #thread_create.  The functions of libdragon that wait for the
+ * hardware, such as #dma_wait, #rsp_wait and #rsp_task_wait, yield to the other
+ * threads while they wait, so that the CPU is not left spinning while there is work
+ * to do.  A thread can also wait for an interrupt with #thread_wait_event: when all the
+ * threads are waiting, the CPU idles until an interrupt wakes one of them up.
+ *
+ * Threads only switch with interrupts enabled and outside of interrupt handlers:
+ * yielding with interrupts disabled does nothing.
+ *
+ * With #thread_enable_preemption, threads are also switched by interrupts: when an
+ * interrupt handler wakes up a thread with a higher priority than the running one
+ * (for instance a thread waiting in #thread_wait_event, or on a semaphore posted by
+ * the handler), that thread runs as soon as the handler returns.  Optionally, threads
+ * of the same priority also share the CPU in time slices, driven by the COP0 timer
+ * (see #timer_init).  Data shared between preemptive threads must then be protected
+ * with a #mutex_t, or by disabling interrupts.  For instance, audio can be refilled
+ * by a high-priority thread woken up by the AI interrupt, so that it keeps playing
+ * even when a frame of the main loop takes longer than expected:
+ *
+ * @code
+ * void audio_thread(void *arg) {
+ *     while (1) {
+ *         while (!audio_can_write()) thread_wait_event(THREAD_EVENT_AI);
+ *         mutex_lock(&mixer_mutex);
+ *         mixer_poll(audio_write_begin(), audio_get_buffer_length());
+ *         mutex_unlock(&mixer_mutex);
+ *         audio_write_end();
+ *     }
+ * }
+ *
+ * thread_init();
+ * thread_set_priority(thread_create(audio_thread, NULL, 0), THREAD_PRIORITY_NORMAL + 1);
+ * thread_enable_preemption(0);
+ * @endcode
+ *
+ * where the main loop also locks mixer_mutex around its calls to the mixer.
+ *
+ * @{
+ */
+
+/** @brief Registers of a thread saved by __thread_switch (see thread_switch.S) */
+typedef struct
+{
+    /** @brief s0-s7, gp, sp, fp and ra */
+    uint64_t gpr[12];
+    /** @brief f20-f31 */
+    uint64_t fpr[12];
+} thread_context_t;
+
+_Static_assert(sizeof(thread_context_t) == 192, "thread_context_t must match thread_switch.S");
+
+/** @brief State of a thread */
+typedef enum
+{
+    /** @brief The thread is running */
+    THREAD_RUNNING,
+    /** @brief The thread is in the ready queue */
+    THREAD_READY,
+    /** @brief The thread is waiting for an event or for another thread */
+    THREAD_WAITING,
+    /** @brief The thread has exited, and waits to be joined */
+    THREAD_FINISHED
+} thread_state_t;
+
+/** @brief A thread */
+struct thread_s
+{
+    /** @brief Saved registers, while the thread is not running */
+    thread_context_t ctx;
+    /** @brief Stack of the thread (NULL for the main thread) */
+    void *stack;
+    /** @brief Size of the stack in bytes */
+    uint32_t stack_size;
+    /** @brief Entry point */
+    thread_entry_t entry;
+    /** @brief Argument of the entry point */
+    void *arg;
+    /** @brief Current state */
+    thread_state_t state;
+    /** @brief Priority (see #thread_set_priority) */
+    int priority;
+    /** @brief Next thread in the ready queue or in a wait list */
+    thread_t *next;
+    /** @brief Thread waiting for this one to exit in #thread_join (NULL if none) */
+    thread_t *joiner;
+};
+
+extern void __thread_switch( thread_context_t *save, thread_context_t *load );
+extern void __thread_start( void );
+extern void __thread_preempt_entry( void );
+
+/** @brief The thread that called #thread_init */
+static thread_t main_thread;
+/** @brief The running thread (NULL if #thread_init was not called) */
+static thread_t *th_current = 0;
+/** @brief Queue of the threads ready to run, by decreasing priority */
+static thread_t *ready_head = 0;
+/** @brief Threads waiting for each event */
+static thread_t *event_waiters[THREAD_NUM_EVENTS];
+/** @brief True if threads are switched by interrupts (see #thread_enable_preemption) */
+static bool preempt_enabled = false;
+/** @brief True if a ready thread must preempt the running one */
+static volatile bool preempt_pending = false;
+/** @brief True while __thread_schedule waits for a thread to become ready */
+static volatile bool th_idle = false;
+/** @brief Timer of the time slices (NULL if disabled) */
+static timer_link_t *timeslice_timer = 0;
+/** @brief Address the preempted thread was interrupted at, for __thread_preempt_entry */
+uint32_t __thread_preempt_epc;
+
+/**
+ * @brief Insert a thread in a queue, after the threads with the same or a higher priority
+ *
+ * @note This function must be called with interrupts disabled.
+ */
+static void __thread_enqueue( thread_t **queue, thread_t *thread )
+{
+    while( *queue && (*queue)->priority >= thread->priority ) { queue = &(*queue)->next; }
+
+    thread->next = *queue;
+    *queue = thread;
+}
+
+/**
+ * @brief Remove a thread from a queue
+ *
+ * @note This function must be called with interrupts disabled.
+ *
+ * @return true if the thread was in the queue
+ */
+static bool __thread_dequeue( thread_t **queue, thread_t *thread )
+{
+    while( *queue && *queue != thread ) { queue = &(*queue)->next; }
+    if( !*queue ) { return false; }
+
+    *queue = thread->next;
+    return true;
+}
+
+/**
+ * @brief Put a thread in the ready queue
+ *
+ * @note This function must be called with interrupts disabled.
+ */
+static void __thread_ready( thread_t *thread )
+{
+    thread->state = THREAD_READY;
+    __thread_enqueue( &ready_head, thread );
+}
+
+/**
+ * @brief Wake up a waiting thread
+ *
+ * With preemption, the running thread is preempted if the woken thread has a
+ * higher priority.
+ *
+ * @note This function must be called with interrupts disabled.
+ */
+static void __thread_wake_thread( thread_t *thread )
+{
+    __thread_ready( thread );
+
+    if( preempt_enabled && th_current && thread->priority > th_current->priority )
+    {
+        preempt_pending = true;
+    }
+}
+
+/**
+ * @brief Make a thread wait on a queue
+ *
+ * @note This function must be called with interrupts disabled.
+ */
+static void __thread_wait( thread_t **queue, thread_t *thread )
+{
+    thread->state = THREAD_WAITING;
+    __thread_enqueue( queue, thread );
+}
+
+/**
+ * @brief Switch to the next ready thread
+ *
+ * The running thread must have been queued or made to wait before calling this.
+ * If no thread is ready, interrupts are let in until one becomes ready.
+ *
+ * @note This function must be called with interrupts disabled, exactly once.
+ */
+static void __thread_schedule( void )
+{
+    thread_t *prev = th_current;
+    thread_t *next;
+
+    while( !(next = ready_head) )
+    {
+        /* Every thread is waiting for an interrupt */
+        th_idle = true;
+        enable_interrupts();
+        disable_interrupts();
+        th_idle = false;
+    }
+
+    ready_head = next->next;
+    preempt_pending = false;
+
+    next->state = THREAD_RUNNING;
+    if( next == prev ) { return; }
+
+    th_current = next;
+    __thread_switch( &prev->ctx, &next->ctx );
+}
+
+/**
+ * @brief Return true if the running thread can switch to another one
+ *
+ * That is, interrupts are enabled and we are not in an interrupt handler.
+ */
+static inline bool __thread_can_switch( void )
+{
+    return th_current && (C0_STATUS() & C0_STATUS_IE) && get_interrupts_state() == INTERRUPTS_ENABLED;
+}
+
+/**
+ * @brief Wake up the threads waiting for an event
+ *
+ * Called by the interrupt handlers.
+ */
+static void __thread_wake( thread_event_t event )
+{
+    thread_t *thread = event_waiters[event];
+    event_waiters[event] = 0;
+
+    while( thread )
+    {
+        thread_t *next = thread->next;
+        __thread_wake_thread( thread );
+        thread = next;
+    }
+}
+
+/**
+ * @brief Let a thread woken up outside of interrupt handlers preempt the running one
+ */
+static inline void __thread_preempt_point( void )
+{
+    if( preempt_pending ) { thread_yield(); }
+}
+
+/** @brief SP interrupt handler */
+static void __thread_sp_handler( void *ctx ) { __thread_wake( THREAD_EVENT_SP ); }
+/** @brief SI interrupt handler */
+static void __thread_si_handler( void *ctx ) { __thread_wake( THREAD_EVENT_SI ); }
+/** @brief AI interrupt handler */
+static void __thread_ai_handler( void *ctx ) { __thread_wake( THREAD_EVENT_AI ); }
+/** @brief VI interrupt handler */
+static void __thread_vi_handler( void *ctx ) { __thread_wake( THREAD_EVENT_VI ); }
+/** @brief PI interrupt handler */
+static void __thread_pi_handler( void *ctx ) { __thread_wake( THREAD_EVENT_PI ); }
+/** @brief DP interrupt handler */
+static void __thread_dp_handler( void *ctx ) { __thread_wake( THREAD_EVENT_DP ); }
+
+/**
+ * @brief Timer callback ending the time slice of the running thread
+ */
+static void __thread_timeslice( int ovfl )
+{
+    if( th_current && ready_head && ready_head->priority >= th_current->priority )
+    {
+        preempt_pending = true;
+    }
+}
+
+/**
+ * @brief Check whether the interrupted thread must be preempted
+ *
+ * Called by the interrupt handler (see inthandler.S) once the interrupt has been
+ * handled.  If this returns true, the handler returns to __thread_preempt_entry
+ * with interrupts disabled, instead of __thread_preempt_epc.  Since interrupts
+ * only happen while they are enabled, the interrupted thread can always switch,
+ * unless it was waiting in __thread_schedule.
+ *
+ * @return true if the interrupted thread must be preempted
+ */
+bool __thread_preempt_check( void )
+{
+    if( !preempt_pending || !th_current || th_idle ) { return false; }
+
+    preempt_pending = false;
+    return true;
+}
+
+/**
+ * @brief Preempt the running thread
+ *
+ * Called by __thread_preempt_entry (see thread_switch.S), which saved the registers
+ * of the interrupted code on its stack.  Interrupts are disabled, but outside of
+ * disable_interrupts.
+ */
+void __thread_preempt( void )
+{
+    disable_interrupts();
+    __thread_ready( th_current );
+    __thread_schedule();
+    enable_interrupts();
+}
+
+/**
+ * @brief Run a new thread
+ *
+ * Called by __thread_start, the first time the thread is switched to.
+ */
+void __thread_entry( thread_t *thread )
+{
+    /* Interrupts were disabled by the thread that switched to this one */
+    enable_interrupts();
+
+    thread->entry( thread->arg );
+    thread_exit();
+}
+
+/**
+ * @brief Initialize the thread subsystem
+ *
+ * The calling code becomes the main thread.
+ */
+void thread_init( void )
+{
+    assertf( !th_current, "thread module already initialized" );
+
+    memset( &main_thread, 0, sizeof(main_thread) );
+    memset( event_waiters, 0, sizeof(event_waiters) );
+    main_thread.state = THREAD_RUNNING;
+    main_thread.priority = THREAD_PRIORITY_NORMAL;
+    ready_head = 0;
+    preempt_enabled = false;
+    preempt_pending = false;
+
+    register_interrupt_handler_nofpu( INTERRUPT_SP, __thread_sp_handler, 0 );
+    register_interrupt_handler_nofpu( INTERRUPT_SI, __thread_si_handler, 0 );
+    register_interrupt_handler_nofpu( INTERRUPT_AI, __thread_ai_handler, 0 );
+    register_interrupt_handler_nofpu( INTERRUPT_VI, __thread_vi_handler, 0 );
+    register_interrupt_handler_nofpu( INTERRUPT_PI, __thread_pi_handler, 0 );
+    register_interrupt_handler_nofpu( INTERRUPT_DP, __thread_dp_handler, 0 );
+
+    th_current = &main_thread;
+}
+
+/**
+ * @brief Close the thread subsystem
+ *
+ * This must be called from the main thread, once the other threads have exited
+ * and been joined.
+ */
+void thread_close( void )
+{
+    assertf( th_current == &main_thread, "thread_close must be called from the main thread" );
+    assertf( !ready_head, "threads are still running" );
+
+    thread_disable_preemption();
+    unregister_interrupt_handler( INTERRUPT_SP, __thread_sp_handler, 0 );
+    unregister_interrupt_handler( INTERRUPT_SI, __thread_si_handler, 0 );
+    unregister_interrupt_handler( INTERRUPT_AI, __thread_ai_handler, 0 );
+    unregister_interrupt_handler( INTERRUPT_VI, __thread_vi_handler, 0 );
+    unregister_interrupt_handler( INTERRUPT_PI, __thread_pi_handler, 0 );
+    unregister_interrupt_handler( INTERRUPT_DP, __thread_dp_handler, 0 );
+
+    th_current = 0;
+}
+
+/**
+ * @brief Create a new thread
+ *
+ * The thread is ready to run, with priority #THREAD_PRIORITY_NORMAL: it will start
+ * the next time the running thread yields.  When the entry point returns, the thread exits (see #thread_exit).
+ *
+ * @param[in] entry
+ *            Entry point of the thread
+ * @param[in] arg
+ *            Argument passed to the entry point
+ * @param[in] stack_size
+ *            Size of the stack of the thread in bytes, or 0 for
+ *            #THREAD_DEFAULT_STACK_SIZE
+ *
+ * @return The new thread, to be freed by #thread_join
+ */
+thread_t *thread_create( thread_entry_t entry, void *arg, uint32_t stack_size )
+{
+    assertf( th_current, "thread module not initialized" );
+
+    if( !stack_size ) { stack_size = THREAD_DEFAULT_STACK_SIZE; }
+
+    thread_t *thread = malloc( sizeof(thread_t) );
+    if( !thread ) { return 0; }
+
+    memset( thread, 0, sizeof(thread_t) );
+    thread->stack = memalign( 16, stack_size );
+    if( !thread->stack )
+    {
+        free( thread );
+        return 0;
+    }
+
+    /* Paint the stack, to find out how much of it is used (see #thread_get_stack_high_water) */
+    for( uint32_t i = 0; i < stack_size / sizeof(uint32_t); i++ )
+    {
+        ((uint32_t *)thread->stack)[i] = STACK_PAINT_PATTERN;
+    }
+
+    thread->stack_size = stack_size;
+    thread->entry = entry;
+    thread->arg = arg;
+    thread->priority = THREAD_PRIORITY_NORMAL;
+
+    /* The first switch to the thread "returns" to __thread_start, with the stack
+     * pointer at the top of the stack (leaving room for the arguments) and the
+     * thread in s0 */
+    uint32_t gp;
+    __asm__ volatile( "move %0, $gp" : "=r"(gp) );
+
+    thread->ctx.gpr[0] = (uint32_t)thread;
+    thread->ctx.gpr[8] = gp;
+    thread->ctx.gpr[9] = (((uint32_t)thread->stack + stack_size) & ~15) - 32;
+    thread->ctx.gpr[11] = (uint32_t)__thread_start;
+
+    disable_interrupts();
+    __thread_ready( thread );
+    enable_interrupts();
+
+    return thread;
+}
+
+/**
+ * @brief Return the running thread
+ *
+ * @return The running thread, or NULL if #thread_init was not called
+ */
+thread_t *thread_current( void )
+{
+    return th_current;
+}
+
+/**
+ * @brief Change the priority of a thread
+ *
+ * Threads with a higher priority run first.  If the thread is waiting on a mutex or
+ * a semaphore, the new priority applies the next time it waits.
+ *
+ * @param[in] thread
+ *            The thread, or NULL for the running thread
+ * @param[in] priority
+ *            The new priority (#THREAD_PRIORITY_NORMAL is the default)
+ */
+void thread_set_priority( thread_t *thread, int priority )
+{
+    assertf( th_current, "thread module not initialized" );
+    if( !thread ) { thread = th_current; }
+
+    disable_interrupts();
+    thread->priority = priority;
+
+    if( thread->state == THREAD_READY )
+    {
+        /* Keep the ready queue sorted */
+        __thread_dequeue( &ready_head, thread );
+        __thread_enqueue( &ready_head, thread );
+    }
+
+    if( preempt_enabled && ready_head && ready_head->priority > th_current->priority )
+    {
+        preempt_pending = true;
+    }
+    enable_interrupts();
+
+    __thread_preempt_point();
+}
+
+/**
+ * @brief Return the priority of a thread
+ *
+ * @param[in] thread
+ *            The thread, or NULL for the running thread
+ *
+ * @return The priority of the thread
+ */
+int thread_get_priority( thread_t *thread )
+{
+    assertf( th_current, "thread module not initialized" );
+    return thread ? thread->priority : th_current->priority;
+}
+
+/**
+ * @brief Return the highest amount of stack used so far by a thread
+ *
+ * The stack of each thread is painted by #thread_create, so that the deepest
+ * point it reached can be found by looking for the first overwritten word.
+ * Use this to size the stacks passed to #thread_create.
+ *
+ * @param[in] thread
+ *            The thread, or NULL for the running thread
+ *
+ * @return Bytes of stack used at the deepest point.  For the main thread,
+ *         see #sys_get_stack_high_water.
+ */
+size_t thread_get_stack_high_water( thread_t *thread )
+{
+    assertf( th_current, "thread module not initialized" );
+    if( !thread ) { thread = th_current; }
+
+    if( !thread->stack )
+    {
+        return sys_get_stack_high_water();
+    }
+
+    uint32_t *p = thread->stack;
+    uint32_t *top = p + thread->stack_size / sizeof(uint32_t);
+
+    while( p < top && *p == STACK_PAINT_PATTERN )
+    {
+        p++;
+    }
+
+    return (top - p) * sizeof(uint32_t);
+}
+
+/**
+ * @brief Let interrupts switch threads
+ *
+ * After this call, a thread woken up by an interrupt runs as soon as the interrupt
+ * handler returns, if it has a higher priority than the running thread.  A thread that
+ * wakes up another one with a higher priority, for instance by unlocking a mutex, also
+ * switches to it right away.
+ *
+ * If timeslice is not 0, ready threads with the same priority as the running thread
+ * also run in turns, every timeslice ticks.  This uses a timer, so #timer_init must
+ * have been called.
+ *
+ * @param[in] timeslice
+ *            Length of the time slice in ticks (see #TIMER_TICKS), or 0 to only switch
+ *            to threads with a higher priority
+ */
+void thread_enable_preemption( int timeslice )
+{
+    assertf( th_current, "thread module not initialized" );
+    assertf( timeslice >= 0, "invalid time slice: %d", timeslice );
+
+    thread_disable_preemption();
+
+    if( timeslice )
+    {
+        timeslice_timer = new_timer( timeslice, TF_CONTINUOUS, __thread_timeslice );
+    }
+
+    disable_interrupts();
+    preempt_enabled = true;
+    if( ready_head && ready_head->priority > th_current->priority ) { preempt_pending = true; }
+    enable_interrupts();
+
+    __thread_preempt_point();
+}
+
+/**
+ * @brief Go back to cooperative threads
+ *
+ * Threads only switch when the running thread yields or waits.
+ */
+void thread_disable_preemption( void )
+{
+    disable_interrupts();
+    preempt_enabled = false;
+    preempt_pending = false;
+    enable_interrupts();
+
+    if( timeslice_timer )
+    {
+        delete_timer( timeslice_timer );
+        timeslice_timer = 0;
+    }
+}
+
+/**
+ * @brief Let the other ready threads run
+ *
+ * The calling thread goes to the end of the ready threads with its priority.  This does nothing if
+ * the thread subsystem is not initialized, if interrupts are disabled, or when called
+ * from an interrupt handler.
+ */
+void thread_yield( void )
+{
+    if( !__thread_can_switch() ) { return; }
+
+    disable_interrupts();
+    __thread_ready( th_current );
+    __thread_schedule();
+    enable_interrupts();
+}
+
+/**
+ * @brief Wait for an interrupt
+ *
+ * The calling thread sleeps until the next interrupt of the given kind, while the
+ * other threads run.  The interrupt must be enabled (for instance with
+ * #set_PI_interrupt), otherwise the thread waits forever.  Since only the
+ * interrupts that happen after calling this function wake the thread up, check
+ * the condition being waited for in a loop.
+ *
+ * If threads cannot switch (see #thread_yield), this returns right away.
+ *
+ * @param[in] event
+ *            The interrupt to wait for
+ */
+void thread_wait_event( thread_event_t event )
+{
+    assertf( event >= 0 && event < THREAD_NUM_EVENTS, "invalid event: %d", event );
+    if( !__thread_can_switch() ) { return; }
+
+    disable_interrupts();
+    __thread_wait( &event_waiters[event], th_current );
+    __thread_schedule();
+    enable_interrupts();
+}
+
+/**
+ * @brief Exit the running thread
+ *
+ * The thread stops running, and its resources are released by #thread_join.
+ * The main thread cannot exit.
+ */
+void thread_exit( void )
+{
+    assertf( th_current && th_current != &main_thread, "the main thread cannot exit" );
+    assertf( __thread_can_switch(), "cannot exit a thread with interrupts disabled" );
+
+    disable_interrupts();
+    th_current->state = THREAD_FINISHED;
+    if( th_current->joiner ) { __thread_wake_thread( th_current->joiner ); }
+    __thread_schedule();
+
+    /* A finished thread is never switched to */
+    while( 1 ) { ; }
+}
+
+/**
+ * @brief Wait for a thread to exit, and free it
+ *
+ * @param[in] thread
+ *            Thread returned by #thread_create
+ */
+void thread_join( thread_t *thread )
+{
+    assertf( thread && thread != th_current && thread != &main_thread, "invalid thread to join" );
+    assertf( !thread->joiner, "thread already being joined" );
+    assertf( __thread_can_switch(), "cannot join a thread with interrupts disabled" );
+
+    disable_interrupts();
+    while( thread->state != THREAD_FINISHED )
+    {
+        thread->joiner = th_current;
+        th_current->state = THREAD_WAITING;
+        __thread_schedule();
+    }
+    enable_interrupts();
+
+    free( thread->stack );
+    free( thread );
+}
+
+/**
+ * @brief Initialize a mutex
+ *
+ * @param[out] mutex
+ *             The mutex, initially unlocked
+ */
+void mutex_init( mutex_t *mutex )
+{
+    mutex->owner = 0;
+    mutex->waiters = 0;
+}
+
+/**
+ * @brief Lock a mutex
+ *
+ * If the mutex is locked by another thread, the calling thread waits until it is
+ * unlocked.  Threads waiting for a mutex get it in order of priority.  Mutexes cannot
+ * be locked recursively, nor from interrupt handlers.
+ *
+ * @param[in] mutex
+ *            The mutex to lock
+ */
+void mutex_lock( mutex_t *mutex )
+{
+    assertf( th_current, "thread module not initialized" );
+    bool can_switch = __thread_can_switch();
+
+    disable_interrupts();
+    if( mutex->owner )
+    {
+        assertf( mutex->owner != th_current, "mutex already locked by this thread" );
+        assertf( can_switch, "cannot wait for a mutex with interrupts disabled" );
+
+        /* The thread unlocking the mutex gives it to us */
+        __thread_wait( &mutex->waiters, th_current );
+        __thread_schedule();
+    }
+    else
+    {
+        mutex->owner = th_current;
+    }
+    enable_interrupts();
+}
+
+/**
+ * @brief Lock a mutex, if it is not locked already
+ *
+ * @param[in] mutex
+ *            The mutex to lock
+ *
+ * @return true if the mutex was locked by the calling thread
+ */
+bool mutex_try_lock( mutex_t *mutex )
+{
+    assertf( th_current, "thread module not initialized" );
+    bool locked = false;
+
+    disable_interrupts();
+    if( !mutex->owner )
+    {
+        mutex->owner = th_current;
+        locked = true;
+    }
+    enable_interrupts();
+
+    return locked;
+}
+
+/**
+ * @brief Unlock a mutex
+ *
+ * The mutex goes to the waiting thread with the highest priority, if any.
+ *
+ * @param[in] mutex
+ *            The mutex to unlock, which must be locked by the calling thread
+ */
+void mutex_unlock( mutex_t *mutex )
+{
+    assertf( mutex->owner == th_current, "mutex not locked by this thread" );
+
+    disable_interrupts();
+    thread_t *next = mutex->waiters;
+    mutex->owner = next;
+
+    if( next )
+    {
+        mutex->waiters = next->next;
+        __thread_wake_thread( next );
+    }
+    enable_interrupts();
+
+    __thread_preempt_point();
+}
+
+/**
+ * @brief Initialize a semaphore
+ *
+ * @param[out] sem
+ *             The semaphore
+ * @param[in]  count
+ *             Initial count
+ */
+void semaphore_init( semaphore_t *sem, int count )
+{
+    assertf( count >= 0, "invalid semaphore count: %d", count );
+
+    sem->count = count;
+    sem->waiters = 0;
+}
+
+/**
+ * @brief Wait for a semaphore
+ *
+ * If the count of the semaphore is 0, the calling thread waits for another thread
+ * or an interrupt handler to call #semaphore_post.  Then the count is decremented.
+ * This cannot be called from interrupt handlers.
+ *
+ * @param[in] sem
+ *            The semaphore
+ */
+void semaphore_wait( semaphore_t *sem )
+{
+    assertf( th_current, "thread module not initialized" );
+    bool can_switch = __thread_can_switch();
+
+    disable_interrupts();
+    if( sem->count > 0 )
+    {
+        sem->count--;
+    }
+    else
+    {
+        assertf( can_switch, "cannot wait for a semaphore with interrupts disabled" );
+
+        /* The thread or handler posting the semaphore gives its count to us */
+        __thread_wait( &sem->waiters, th_current );
+        __thread_schedule();
+    }
+    enable_interrupts();
+}
+
+/**
+ * @brief Decrement the count of a semaphore, if it is not 0
+ *
+ * This can be called from interrupt handlers.
+ *
+ * @param[in] sem
+ *            The semaphore
+ *
+ * @return true if the count was decremented
+ */
+bool semaphore_try_wait( semaphore_t *sem )
+{
+    bool taken = false;
+
+    disable_interrupts();
+    if( sem->count > 0 )
+    {
+        sem->count--;
+        taken = true;
+    }
+    enable_interrupts();
+
+    return taken;
+}
+
+/**
+ * @brief Increment the count of a semaphore
+ *
+ * The waiting thread with the highest priority, if any, is woken up instead.  This
+ * can be called from interrupt handlers, for instance to wake up a thread that
+ * processes the data of an interrupt.
+ *
+ * @param[in] sem
+ *            The semaphore
+ */
+void semaphore_post( semaphore_t *sem )
+{
+    disable_interrupts();
+    thread_t *next = sem->waiters;
+
+    if( next )
+    {
+        sem->waiters = next->next;
+        __thread_wake_thread( next );
+    }
+    else
+    {
+        sem->count++;
+    }
+    enable_interrupts();
+
+    __thread_preempt_point();
+}
+
+/** @} */ /* thread */
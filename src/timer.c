@@ -29,6 +29,13 @@
  * responsibility of the calling code to be freed, regardless of a call to
  * #timer_close.
  *
+ * Started timers are kept in a pairing heap ordered by expiry, linked through
+ * the timer structures themselves: there is no limit to the number of started
+ * timers, and starting or stopping a timer never allocates memory, so it can
+ * be done from interrupts too.  Starting a timer takes O(1) time, and
+ * stopping and firing a timer take O(log n) amortized time; the timer
+ * interrupt only looks at the timers that expired.
+ *
  * Because the MIPS internal counter wraps around after ~90 seconds (see
  * TICKS_READ), it's not possible to schedule a timer more than 90 seconds
  * in the future.
@@ -36,36 +43,199 @@
  * @{
  */
 
-/** @brief Internal linked list of timers */
-static timer_link_t *TI_timers = 0;
+/** @brief Root of the pairing heap of the started timers, ordered by expiry */
+static timer_link_t *TI_root = 0;
+/** @brief True if the timer module is initialized */
+static bool TI_initialized = false;
+
+/** @brief Size of the queue of expired deferred timers (must be a power of two) */
+#define TI_DEFERRED_SIZE 64
+
+/** @brief An expiration of a deferred timer, waiting for #timer_poll */
+typedef struct {
+	/** @brief Timer that expired (NULL if stopped since) */
+	timer_link_t *timer;
+	/** @brief Ticks elapsed since the deadline, when the timer expired */
+	int ovfl;
+} timer_deferred_t;
+
+/** @brief Single-producer (timer interrupt), single-consumer (#timer_poll) ring
+ * of expired deferred timers */
+static timer_deferred_t TI_deferred[TI_DEFERRED_SIZE];
+/** @brief Number of expirations written to the ring by the timer interrupt */
+static volatile uint32_t TI_deferred_head = 0;
+/** @brief Number of expirations read from the ring by #timer_poll */
+static volatile uint32_t TI_deferred_tail = 0;
+
+/** @brief Number of half periods (2**31 ticks) of the hardware counter elapsed
+ * since #timer_init, that is bits 31-62 of the 64-bit tick counter. It is
+ * updated by the timer interrupt, which is always scheduled at the beginning of
+ * each half period, and by #timer_ticks when it sees that a new half period has
+ * started, so it is at most one half period behind the counter. */
+static volatile uint32_t ticks64_halves;
+
+/** @brief Return the current half period, given the last one seen by the timer
+ * interrupt and the current value of the hardware counter. The two are read in
+ * this order, so the counter can be ahead but never behind: if the lowest bit
+ * of the half periods does not match the top bit of the counter, a new half
+ * period has started in the meantime. */
+static inline uint32_t ticks64_current_halves(uint32_t halves, uint32_t low) {
+	return halves + ((halves ^ (low >> 31)) & 1);
+}
+
+/* @brief Return true if timer a expires before timer b. Deadlines are compared
+ * with a signed distance, which is safe with overflows since a timer cannot be
+ * scheduled more than 2**31 ticks in the future. */
+static inline bool timer_before(timer_link_t *a, timer_link_t *b) {
+	return TICKS_DISTANCE(a->left, b->left) > 0;
+}
+
+/* @brief Meld two heaps, returning the root of the result. The roots must
+ * not have siblings; the root of the result is not linked to a parent. */
+static timer_link_t *heap_meld(timer_link_t *a, timer_link_t *b) {
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+
+	if (timer_before(b, a))
+	{
+		timer_link_t *tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	/* b becomes the first child of a */
+	b->prev = a;
+	b->next = a->child;
+	if (a->child)
+		a->child->prev = b;
+	a->child = b;
+	return a;
+}
+
+/* @brief Meld a list of sibling heaps into a single heap, with the usual
+ * two passes: siblings are melded in pairs from left to right, then the pairs
+ * are melded from right to left. This is what keeps the heap balanced. */
+static timer_link_t *heap_meld_pairs(timer_link_t *first) {
+	/* Stack of melded pairs, linked through next, the last pair on top */
+	timer_link_t *pairs = NULL;
+
+	while (first)
+	{
+		timer_link_t *a = first;
+		timer_link_t *b = a->next;
+		first = b ? b->next : NULL;
 
-/** @brief Higher-part of 64-bit tick counter */
-volatile uint32_t ticks64_high;
+		a->next = NULL;
+		if (b)
+			b->next = NULL;
 
-/** @brief Time at which interrupts were disabled */
-extern volatile uint32_t interrupt_disabled_tick;
+		timer_link_t *pair = heap_meld(a, b);
+		pair->next = pairs;
+		pairs = pair;
+	}
 
-/* @brief Timer is the special overflow timer. */
-#define TF_OVERFLOW    0x40
+	timer_link_t *root = NULL;
+	while (pairs)
+	{
+		timer_link_t *pair = pairs;
+		pairs = pair->next;
+		pair->next = NULL;
+		root = heap_meld(pair, root);
+	}
+
+	if (root)
+		root->prev = NULL;
+	return root;
+}
+
+/* @brief Return true if the timer is in the heap. A timer in the heap is either
+ * the root, or is pointed to by its previous sibling or its parent. The links of
+ * timers that were never started are not trusted, since the structure might be
+ * uninitialized: they are only followed if they point to RDRAM. */
+static inline bool heap_contains(timer_link_t *timer) {
+	if (timer == TI_root)
+		return true;
+
+	timer_link_t *prev = timer->prev;
+	if (((uint32_t)prev & 0xC0000003) != 0x80000000 ||
+		((uint32_t)prev & 0x1FFFFFFF) >= get_memory_size())
+		return false;
+
+	return prev->child == timer || prev->next == timer;
+}
+
+/* @brief Add a timer to the heap. Must be called with interrupts disabled. */
+static void heap_insert(timer_link_t *timer) {
+	timer->child = timer->next = timer->prev = NULL;
+	TI_root = heap_meld(TI_root, timer);
+	TI_root->prev = NULL;
+}
+
+/* @brief Remove a timer from the heap. Must be called with interrupts disabled. */
+static void heap_remove(timer_link_t *timer) {
+	if (timer == TI_root)
+	{
+		TI_root = heap_meld_pairs(timer->child);
+	}
+	else
+	{
+		/* Cut the subtree of the timer, and meld its children back */
+		if (timer->prev->child == timer)
+			timer->prev->child = timer->next;
+		else
+			timer->prev->next = timer->next;
+		if (timer->next)
+			timer->next->prev = timer->prev;
+
+		TI_root = heap_meld(TI_root, heap_meld_pairs(timer->child));
+	}
+
+	timer->child = timer->next = timer->prev = NULL;
+}
 
-/* @brief Timer has been called once in this interrupt. */
-#define TF_CALLED      0x80
+/* @brief Queue an expiration of a deferred timer. Called by the timer interrupt.
+ * If the ring is full, the expiration is dropped. */
+static void deferred_push(timer_link_t *timer) {
+	uint32_t head = TI_deferred_head;
+
+	if (head - TI_deferred_tail == TI_DEFERRED_SIZE)
+		return;
+
+	TI_deferred[head % TI_DEFERRED_SIZE].timer = timer;
+	TI_deferred[head % TI_DEFERRED_SIZE].ovfl = timer->ovfl;
+
+	/* Publish the entry only once it is written */
+	MEMORY_BARRIER();
+	TI_deferred_head = head + 1;
+}
+
+/* @brief Forget the queued expirations of a timer that is being stopped.
+ * Must be called with interrupts disabled. */
+static void deferred_cancel(timer_link_t *timer) {
+	for (uint32_t i = TI_deferred_tail; i != TI_deferred_head; i++)
+	{
+		if (TI_deferred[i % TI_DEFERRED_SIZE].timer == timer)
+			TI_deferred[i % TI_DEFERRED_SIZE].timer = NULL;
+	}
+}
 
 /* @brief Update the compare register to match the first expiring timer. */
-static void timer_update_compare(timer_link_t *head) {
+static void timer_update_compare(void) {
 	uint32_t now = TICKS_READ();
-	uint32_t smallest = 0xFFFFFFFF;
 
-	while (head)
+	/* The start of the next half period of the counter is always scheduled,
+	   to keep the 64-bit tick counter */
+	uint32_t smallest = 0x80000000 - (now & 0x7FFFFFFF);
+
+	if (TI_root)
 	{
-		/* See how much time is left before the timer expires. Notice that
+		/* See how much time is left before the first timer expires. Notice that
 		   the subtraction is also safe with overflows. */
-		uint32_t left = head->left - now;
+		uint32_t left = TI_root->left - now;
 		if (left < smallest)
 			smallest = left;
-
-		/* Go to next */
-		head = head->next;
 	}
 
 	/* set compare to shortest time left */
@@ -73,120 +243,64 @@ static void timer_update_compare(timer_link_t *head) {
 }
 
 /**
- * @brief Process linked list of timers
- *
- * Walk the linked list of timers and call the callbacks of any that
- * have expired.
- *
- * @note This function will remove one-shot timers from the list after
- *       they have fired.
+ * @brief Timer callback function
  *
- * @param[in] head
- *            Head of the linked list of timers
+ * This function is called by the interrupt controller whenever 
+ * compare == count. It calls the callbacks of the timers that have expired,
+ * which are at the top of the heap.
  *
- * @retval 1 The list needs reprocessing
- * @retval 0 All timer operations were handled successfully
+ * @note One-shot timers are removed from the heap before their callback is
+ *       called, and continuous timers are rescheduled, so that callbacks can
+ *       start or stop any timer, including their own.
  */
-static int __proc_timers(timer_link_t * thead)
+static void timer_callback(void)
 {
-	timer_link_t *head = thead;
-	timer_link_t *last = 0;
-	uint32_t start = C0_COMPARE();
-	uint32_t now = TICKS_READ();
+	/* Catch up with the counter, in case a new half period has started. This
+	 * is idempotent, so it does not matter which interrupt does it. */
+	ticks64_halves = ticks64_current_halves(ticks64_halves, TICKS_READ());
 
-	while (head)
+	while (1)
 	{
-		/* Consider a timer as expired if its deadline is at the
-		 * COMPARE value (time at which the interrupt triggered) or up to 5
-		 * microseconds after. This 5 microseconds window is useful to cluster
-		 * timers that expire close to each other; eg: if the client creates
-		 * many timers with the same period, they will be created in a fast
-		 * sequence and have a little delay between each other. */
-		if (!(head->flags & TF_CALLED) && 
-			!(head->flags & TF_DISABLED) &&
-			TICKS_DISTANCE(start, head->left) >= 0 && 
-			TICKS_DISTANCE(head->left, now+TIMER_TICKS(5)) >= 0)
+		uint32_t now = TICKS_READ();
+
+		/* Consider a timer as expired if its deadline is before the current
+		 * time or up to 5 microseconds after. This 5 microseconds window is
+		 * useful to cluster timers that expire close to each other; eg: if
+		 * the client creates many timers with the same period, they will be
+		 * created in a fast sequence and have a little delay between each other. */
+		if (!TI_root)
+			break;
+
+		timer_link_t *head = TI_root;
+		if (TICKS_DISTANCE(head->left, now+TIMER_TICKS(5)) < 0)
+			break;
+
+		/* yes - timed out */
+		head->ovfl = TICKS_DISTANCE(head->left, now);
+
+		if (head->flags & TF_CONTINUOUS)
 		{
-			/* yes - timed out, do callback */
-			head->ovfl = TICKS_DISTANCE(head->left, now);
-			if (head->callback)
-				head->callback(head->ovfl);
-
-			/* reset ticks if continuous */
-			if (head->flags & TF_CONTINUOUS)
-			{
-				head->left += head->set;
-				last = head;
-
-				/* Special case: the internal overflow timer has a period
-				 * of 2**32, so next occurrence will look exactly like the
-				 * current one. Since we're going to reprocess the list, we
-				 * would keep executing it many times until we eventually
-				 * exit the 5 microseconds window.
-				 * So we mark this timer as already called (TF_CALLED) and
-				 * avoid calling it again. 
-				 *
-				 * Notice that we do this only for overflow because other timers
-				 * with a short period might actually be called multiple times
-				 * under interrupt. For instance, if a continuous timer with
-				 * a short period is followed by a very slow one-shot timer,
-				 * when the latter is finished the former might need to fire again.
-				 */
-				if (head->flags & TF_OVERFLOW)
-					head->flags |= TF_CALLED;
-			}
-			else
-			{
-				/* one-shot, remove from list */
-				if (last)
-					last->next = head->next;
-				else
-					TI_timers = head->next;
-			}
-
-			/* Go through timer list again. If the callback was slow, maybe
-			   other timers have expired. */
-			return 1;
+			/* reset ticks if continuous. If the callback is slow, the timer
+			 * might expire again right away: the loop will take care of it. */
+			head->left += head->set;
+			heap_remove(head);
+			heap_insert(head);
+		}
+		else
+		{
+			/* one-shot, remove from heap */
+			heap_remove(head);
 		}
 
-		/* Go to next */
-		last = head;
-		head = head->next;
-	}
-
-	/* Clear the TF_CALLED flag from the overflow timer (if any) */
-	while (thead) {
-		thead->flags &= ~TF_CALLED;
-		thead = thead->next;
+		/* do callback, or leave it to timer_poll() */
+		if (head->flags & TF_DEFERRED)
+			deferred_push(head);
+		else if (head->callback)
+			head->callback(head->ovfl);
 	}
-	return 0;							// exit timer callback
-}
-
-/**
- * @brief Timer callback function
- *
- * This function is called by the interrupt controller whenever 
- * compare == count.
- */
-static void timer_callback(void)
-{
-	while (__proc_timers(TI_timers))
-		{}
 
 	// Update counter for next interrupt.
-	timer_update_compare(TI_timers);
-}
-
-/**
- * @brief Timer callback overflow function
- *
- * This function is the callback of the internal overflow timer, which
- * is configured by timer_init() and is used to create a 64-bit timer
- * accessed by timer_ticks().
- */
-static void timer_callback_overflow(int ovfl)
-{
-	ticks64_high++;
+	timer_update_compare();
 }
 
 /**
@@ -201,35 +315,24 @@ static void timer_callback_overflow(int ovfl)
  */
 void timer_init(void)
 {
-	assertf(!TI_timers, "timer module already initialized");
-	/* Create first timer for overflows: expires when counter is 0 and
-	 * has a period of 2**32. */
-	timer_link_t *timer = malloc(sizeof(timer_link_t));
-	if (timer)
-	{
-		timer->left = 0;
-		timer->set = 0;
-		timer->flags = TF_CONTINUOUS | TF_OVERFLOW;
-		timer->callback = timer_callback_overflow;
-		timer->next = NULL;
-
-		TI_timers = timer;
-	}
+	assertf(!TI_initialized, "timer module already initialized");
+	TI_initialized = true;
+	TI_root = 0;
 
 	/* Reset the count and compare registers. Avoid to accidentally trigger
-	   an interrupt by setting count to 1 and compare to 0. Also enable
-	   timer interrupts in COP0. */
+	   an interrupt by setting count to 1, and set compare to the start of the
+	   next half period. Also enable timer interrupts in COP0. */
 	disable_interrupts();
-	ticks64_high = 0;
+	ticks64_halves = 0;
 	C0_WRITE_COUNT(1);
-	C0_WRITE_COMPARE(0);
+	C0_WRITE_COMPARE(0x80000000);
 	C0_WRITE_STATUS(C0_STATUS() | C0_INTERRUPT_TIMER);
 	register_TI_handler(timer_callback);
 	enable_interrupts();
 }
 
 /**
- * @brief Create a new timer and add to list
+ * @brief Create a new timer and start it
  *
  * @param[in] ticks
  *            Number of ticks before the timer should fire
@@ -242,34 +345,23 @@ void timer_init(void)
  */
 timer_link_t *new_timer(int ticks, int flags, void (*callback)(int ovfl))
 {
-	assertf(TI_timers, "timer module not initialized");
+	assertf(TI_initialized, "timer module not initialized");
 	timer_link_t *timer = malloc(sizeof(timer_link_t));
 	if (timer)
 	{
-		timer->left = TICKS_READ() + (int32_t)ticks;
-		timer->set = ticks;
-		timer->flags = flags;
-		timer->callback = callback;
-
-		if (flags & TF_DISABLED)
-			return timer;
-
-		disable_interrupts();
-
-		timer->next = TI_timers;
-		TI_timers = timer;
-		timer_update_compare(TI_timers);
-
-		enable_interrupts();
+		timer->prev = NULL;
+		start_timer(timer, ticks, flags, callback);
 	}
 	return timer;
 }
 
 /**
- * @brief Start a timer not currently in the list
+ * @brief Start a timer
+ *
+ * If the timer is already started, it is started again with the new settings.
  *
  * @param[in] timer
- *            Pointer to timer structure to reinsert and start
+ *            Pointer to timer structure to start
  * @param[in] ticks
  *            Number of ticks before the timer should fire
  * @param[in] flags
@@ -279,99 +371,89 @@ timer_link_t *new_timer(int ticks, int flags, void (*callback)(int ovfl))
  */
 void start_timer(timer_link_t *timer, int ticks, int flags, void (*callback)(int ovfl))
 {
-	assertf(TI_timers, "timer module not initialized");
+	assertf(TI_initialized, "timer module not initialized");
 	if (timer)
 	{
+		disable_interrupts();
+
+		if (heap_contains(timer))
+			heap_remove(timer);
+
 		timer->left = TICKS_READ() + (int32_t)ticks;
 		timer->set = ticks;
 		timer->flags = flags;
 		timer->callback = callback;
 
-		if (flags & TF_DISABLED)
-			return;
-
-		disable_interrupts();
-
-		timer->next = TI_timers;
-		TI_timers = timer;
-		timer_update_compare(TI_timers);
+		if (!(flags & TF_DISABLED))
+		{
+			heap_insert(timer);
+			timer_update_compare();
+		}
 
 		enable_interrupts();
 	}
 }
 
 /**
- * @brief Reset a timer and add to list
+ * @brief Reset a timer and start it
  *
  * @param[in] timer
- *            Pointer to timer structure to reinsert and start
+ *            Pointer to timer structure to restart
  */
 void restart_timer(timer_link_t *timer)
 {
+	assertf(TI_initialized, "timer module not initialized");
 	if (timer)
 	{
+		disable_interrupts();
+
+		if (heap_contains(timer))
+			heap_remove(timer);
+
 		timer->left = TICKS_READ() + (int32_t)timer->set;
 		timer->flags &= ~TF_DISABLED;
 
-		disable_interrupts();
-
-		timer->next = TI_timers;
-		TI_timers = timer;
-		timer_update_compare(TI_timers);
+		heap_insert(timer);
+		timer_update_compare();
 
 		enable_interrupts();
 	}
 }
 
 /**
- * @brief Stop a timer and remove it from the list
+ * @brief Stop a timer
  *
  * @note This function does not free a timer structure, use #delete_timer
  *       to do this.
  *
  * @param[in] timer
- *            Timer structure to stop and remove
+ *            Timer structure to stop
  */
 void stop_timer(timer_link_t *timer)
 {
-	timer_link_t *head;
-	timer_link_t *last = 0;
-
-	assertf(TI_timers, "timer module not initialized");
+	assertf(TI_initialized, "timer module not initialized");
 	if (timer)
 	{
 		disable_interrupts();
-		head = TI_timers;
-		while (head)
+		if (heap_contains(timer))
 		{
-			if (head == timer)
-			{
-				/* remove from list */
-				if (last)
-					last->next = head->next;
-				else
-					TI_timers = head->next;
-
-				break;
-			}
-
-			last = head;
-			head = head->next;
+			heap_remove(timer);
+			timer_update_compare();
 		}
-		timer_update_compare(TI_timers);
+		deferred_cancel(timer);
 		enable_interrupts();
 	}
 }
 
 /**
- * @brief Remove a timer from the list and delete it
+ * @brief Stop a timer and delete it
  *
  * @param[in] timer
- *            Timer structure to stop, remove and free
+ *            Timer structure to stop and free
  */
 void delete_timer(timer_link_t *timer)
 {
-	assertf(TI_timers, "timer module not initialized");
+	assertf(TI_initialized, "timer module not initialized");
 	if (timer)
 	{
 		stop_timer(timer);
@@ -382,13 +464,13 @@ void delete_timer(timer_link_t *timer)
 /**
  * @brief Free and close the timer subsystem
  *
- * This function will ensure all recurring timers are deleted from the list 
- * before closing.  One-shot timers that have expired will need to be
+ * This function will ensure all recurring timers are deleted before
+ * closing.  One-shot timers that have expired will need to be
  * manually deleted with #delete_timer.
  */
 void timer_close(void)
 {
-	assertf(TI_timers, "timer module not initialized");
+	assertf(TI_initialized, "timer module not initialized");
 	disable_interrupts();
 	
 	/* Disable generation of timer interrupt. */
@@ -396,13 +478,12 @@ void timer_close(void)
 
 	unregister_TI_handler(timer_callback);
 
-	timer_link_t *head = TI_timers;
-	while (head)
+	while (TI_root)
 	{
-		timer_link_t *last = head;
-		head = head->next;
+		timer_link_t *timer = TI_root;
+		heap_remove(timer);
 
-		if (last->flags & TF_CONTINUOUS)
+		if (timer->flags & TF_CONTINUOUS)
 		{
 			/* Only free if it is a continuous timer as one-shot timers are
 			 * freed by the user.  If we free a timer here, the user will
@@ -411,55 +492,85 @@ void timer_close(void)
 			 * condition by ensuring that the timer system never frees a 
 			 * one shot timer.
 			 */
-			free(last);
+			free(timer);
 		}
 	}
-	TI_timers = 0;
+
+	TI_deferred_head = TI_deferred_tail = 0;
+
+	TI_initialized = false;
 	enable_interrupts();
 }
 
+/**
+ * @brief Call the callbacks of the expired deferred timers
+ *
+ * Timers started with #TF_DEFERRED don't call their callback from the timer
+ * interrupt: the interrupt only queues the expiration, and the callback is called
+ * by this function, which should be called regularly from the main loop (for
+ * instance once per frame).  This keeps the timer interrupt short, so that it
+ * does not delay other interrupts such as audio and video, even when the
+ * callbacks are slow.  Callbacks are called in order of expiration, with
+ * interrupts enabled, and receive the ticks elapsed between the deadline and the
+ * expiration under interrupt.
+ *
+ * Up to 64 expirations can be queued between two calls: further expirations are
+ * dropped.  Stopping a timer also drops its queued expirations.
+ *
+ * @return The number of callbacks called
+ */
+int timer_poll(void)
+{
+	assertf(TI_initialized, "timer module not initialized");
+	int called = 0;
+
+	while (TI_deferred_tail != TI_deferred_head)
+	{
+		/* Read the entry before releasing it to the interrupt, which is the
+		 * only writer of the ring: no lock is needed */
+		timer_deferred_t entry = TI_deferred[TI_deferred_tail % TI_DEFERRED_SIZE];
+		MEMORY_BARRIER();
+		TI_deferred_tail++;
+
+		if (entry.timer && entry.timer->callback)
+		{
+			entry.timer->callback(entry.ovfl);
+			called++;
+		}
+	}
+
+	return called;
+}
+
 /**
  * @brief Return total ticks since timer was initialized, as a 64-bit counter.
  *
+ * This is wait-free: it never disables interrupts and never retries, so it is
+ * cheap enough to be called very often (eg: for profiling), and it can be
+ * called from interrupts or with interrupts disabled. The result is correct as
+ * long as interrupts are not kept disabled for more than 2**31 ticks (~45
+ * seconds) without calling this function.
+ *
  * @return Then number of ticks since the timer was initialized
  *
  */
 long long timer_ticks(void)
 {
-	uint32_t low, high;
-	assertf(TI_timers, "timer module not initialized");
-
-	/* Check whether interrupts are enabled or not. We need a different strategy
-	 * to account for race conditions. */
-	if (C0_STATUS() & C0_STATUS_IE) {
-		/* Read the hardware counter twice, and fetch the high part counter
-		 * in between. In the unlikely case that the counter overflows exactly
-		 * during the sequence, it means that there's a race condition and
-		 * we can't really know whether high and low are coherent -- but in
-		 * that case, we just repeat the sequence again to avoid the ambiguity. */
-		uint32_t pre;
-		do {
-			pre = TICKS_READ();
-			MEMORY_BARRIER();
-			high = ticks64_high;
-			MEMORY_BARRIER();
-			low = TICKS_READ();
-		} while ((int32_t)pre < 0 && (int32_t)low >= 0);
-
-	} else {
-		/* Interrupts are currently disabled. If they've been disabled for more
-		 * than 2**32 ticks, it's game over because we can't know how many times
-		 * the counter has overflown.
-		 * So assuming they were disabled for not too long, check whether there
-		 * was a counter overflow between now and when they were disabled. 
-		 * If there was, increment high. */
-		low = TICKS_READ();
-		high = ticks64_high;
-		if (interrupt_disabled_tick > low)
-			high++;
-	}
+	assertf(TI_initialized, "timer module not initialized");
+
+	uint32_t halves = ticks64_halves;
+	MEMORY_BARRIER();
+	uint32_t low = TICKS_READ();
+
+	/* If a new half period has started but the interrupt did not run yet (eg:
+	 * interrupts are disabled), record it, unless the interrupt got there first
+	 * in the meantime. The compare-and-swap is a ll/sc pair, which fails if an
+	 * interrupt ran in between, so this never overwrites a newer value. */
+	uint32_t cur = ticks64_current_halves(halves, low);
+	if (cur != halves)
+		__sync_bool_compare_and_swap(&ticks64_halves, halves, cur);
 
-	return ((uint64_t)high << 32) + low;
+	return ((uint64_t)(cur >> 1) << 32) + low;
 }
 
 /** @} */
@@ -6,6 +6,7 @@
 
 #include "libdragon.h"
 #include <string.h>
+#include <stddef.h>
 
 /**
  * @defgroup transferpak Transfer Pak interface
@@ -21,6 +22,11 @@
  * Pass this through to #tpak_check_header to verify that the header checksum adds up and the data have been read correctly.
  * 
  * #tpak_read and #tpak_write do what you expect, switching banks as needed.
+ *
+ * To dump a whole cartridge ROM or Save RAM, call #tpak_stream_rom or #tpak_stream_ram: these switch
+ * the cartridge banks themselves, and read the cartridge with asynchronous joybus transactions into
+ * a ring buffer, from which #tpak_stream_read copies the data as it arrives. The data can thus be
+ * written out (for example to the SD card) while the next blocks are being read.
  * 
  * Whenever not using the transfer pak, it's recommended to power it off by calling #tpak_set_power(false).
  */
@@ -37,6 +43,17 @@
 #define BLOCK_SIZE 0x20
 #define BANK_SIZE 0x4000
 
+#define TPAK_STREAM_RETRIES 3
+
+#define MBC_NONE 0
+#define MBC_1 1
+#define MBC_2 2
+#define MBC_3 3
+#define MBC_5 5
+
+extern uint16_t __calc_address_crc( uint16_t address );
+extern uint8_t __calc_data_crc( uint8_t *data );
+
 
 /**
  * @brief Set transfer pak or gb cartridge controls/flags.
@@ -309,4 +326,401 @@ bool tpak_check_header(struct gameboy_cartridge_header* header)
     }
 
     return sum == header->header_checksum;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Memory bank controller of a cartridge type (as found in the header).
+ *
+ * @return One of the MBC_ values, or -1 if the type is not supported.
+ */
+static int tpak_get_mbc(uint8_t cartridge_type)
+{
+    switch (cartridge_type)
+    {
+        case 0x00: case 0x08: case 0x09:
+            return MBC_NONE;
+        case 0x01: case 0x02: case 0x03:
+            return MBC_1;
+        case 0x05: case 0x06:
+            return MBC_2;
+        case 0x0F: case 0x10: case 0x11: case 0x12: case 0x13:
+            return MBC_3;
+        case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E:
+            return MBC_5;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief Queue a control write of a stream.
+ *
+ * @param[in] stream
+ *            The stream.
+ * @param[in] address
+ *            Transfer pak address to write.
+ * @param[in] value
+ *            The value (written 32 times, like #tpak_set_value).
+ */
+static void tpak_stream_add_write(tpak_stream_t* stream, uint16_t address, uint8_t value)
+{
+    stream->writes[stream->num_writes][0] = address;
+    stream->writes[stream->num_writes][1] = value;
+    stream->num_writes++;
+}
+
+/**
+ * @brief Prepare the control writes and the reads of the current step of a stream.
+ *
+ * A ROM step maps a 16KB ROM bank in gameboy space 0x4000-0x7FFF (bank 0 is read at 0x0000), and a
+ * RAM step maps a Save RAM bank in gameboy space 0xA000-0xBFFF. A RAM dump ends with an extra step
+ * that disables the Save RAM again.
+ */
+static void tpak_stream_setup_step(tpak_stream_t* stream)
+{
+    const int bank = stream->bank;
+
+    stream->num_writes = 0;
+    stream->write_index = 0;
+
+    if (!stream->ram)
+    {
+        if (bank == 0)
+        {
+            tpak_stream_add_write(stream, TPAK_BANK_ADDRESS, 0);
+        }
+        else
+        {
+            if (stream->mbc != MBC_NONE)
+            {
+                // ROM bank number at gameboy 0x2100 (transfer pak bank 0).
+                tpak_stream_add_write(stream, TPAK_BANK_ADDRESS, 0);
+                tpak_stream_add_write(stream, TPAK_DATA_ADDRESS + 0x2100, bank & 0xFF);
+
+                if (stream->mbc == MBC_5)
+                {
+                    tpak_stream_add_write(stream, TPAK_DATA_ADDRESS + 0x3000, bank >> 8);
+                }
+                else if (stream->mbc == MBC_1)
+                {
+                    // Upper bits at gameboy 0x4000 (transfer pak bank 1).
+                    tpak_stream_add_write(stream, TPAK_BANK_ADDRESS, 1);
+                    tpak_stream_add_write(stream, TPAK_DATA_ADDRESS, (bank >> 5) & 0x03);
+                }
+            }
+
+            tpak_stream_add_write(stream, TPAK_BANK_ADDRESS, 1);
+        }
+
+        stream->address = TPAK_DATA_ADDRESS;
+        stream->end_address = TPAK_DATA_ADDRESS + BANK_SIZE;
+        return;
+    }
+
+    const uint32_t ram_bank_size = stream->total < 0x2000 ? stream->total : 0x2000;
+
+    // Save RAM enable at gameboy 0x0000 (transfer pak bank 0).
+    tpak_stream_add_write(stream, TPAK_BANK_ADDRESS, 0);
+
+    if (bank == stream->num_steps - 1)
+    {
+        // Last step: disable the Save RAM to protect it.
+        tpak_stream_add_write(stream, TPAK_DATA_ADDRESS, 0x00);
+        stream->address = stream->end_address = 0;
+        return;
+    }
+
+    tpak_stream_add_write(stream, TPAK_DATA_ADDRESS, 0x0A);
+
+    if (stream->mbc == MBC_1 || stream->mbc == MBC_3 || stream->mbc == MBC_5)
+    {
+        // RAM bank number at gameboy 0x4000, MBC1 banking mode at 0x6000 (transfer pak bank 1).
+        tpak_stream_add_write(stream, TPAK_BANK_ADDRESS, 1);
+        if (stream->mbc == MBC_1)
+        {
+            tpak_stream_add_write(stream, TPAK_DATA_ADDRESS + 0x2000, 1);
+        }
+        tpak_stream_add_write(stream, TPAK_DATA_ADDRESS, bank);
+    }
+
+    // Save RAM at gameboy 0xA000 (transfer pak bank 2).
+    tpak_stream_add_write(stream, TPAK_BANK_ADDRESS, 2);
+    stream->address = TPAK_DATA_ADDRESS + 0x2000;
+    stream->end_address = stream->address + ram_bank_size;
+}
+
+static void tpak_stream_callback(void* output);
+
+/**
+ * @brief Start the next transaction of a stream.
+ *
+ * Called with interrupts disabled. The stream stalls (stops being busy) when it is complete, when
+ * the ring buffer is full, or when there is no room in the joybus queue; #tpak_stream_read restarts it.
+ */
+static void tpak_stream_next(tpak_stream_t* stream)
+{
+    uint8_t send[2 + BLOCK_SIZE];
+
+    stream->busy = false;
+
+    while (!stream->error && stream->write_index == stream->num_writes && stream->address == stream->end_address)
+    {
+        // Current step complete.
+        if (stream->bank + 1 >= stream->num_steps)
+        {
+            stream->bank = stream->num_steps;
+            return;
+        }
+
+        stream->bank++;
+        tpak_stream_setup_step(stream);
+    }
+
+    if (stream->error)
+    {
+        return;
+    }
+
+    joybus_cmdlist_init(&stream->list);
+
+    if (stream->write_index < stream->num_writes)
+    {
+        uint16_t address = __calc_address_crc(stream->writes[stream->write_index][0]);
+        send[0] = address >> 8;
+        send[1] = address & 0xFF;
+        memset(&send[2], stream->writes[stream->write_index][1], BLOCK_SIZE);
+
+        joybus_cmdlist_add(&stream->list, stream->controller, 0x03, send, sizeof(send), 1);
+        stream->reading = false;
+    }
+    else
+    {
+        if (stream->head - stream->tail + BLOCK_SIZE > stream->ring_size)
+        {
+            // Ring buffer full.
+            return;
+        }
+
+        uint16_t address = __calc_address_crc(stream->address);
+        send[0] = address >> 8;
+        send[1] = address & 0xFF;
+
+        joybus_cmdlist_add(&stream->list, stream->controller, 0x02, send, 2, BLOCK_SIZE + 1);
+        stream->reading = true;
+    }
+
+    stream->busy = joybus_exec_async(joybus_cmdlist_block(&stream->list), stream->output, tpak_stream_callback) == 0;
+}
+
+/**
+ * @brief Completion of a stream transaction (called by the SI interrupt).
+ */
+static void tpak_stream_callback(void* output)
+{
+    tpak_stream_t* stream = (tpak_stream_t*)((uint8_t*)output - offsetof(tpak_stream_t, output));
+    int err;
+    const uint8_t* recv = joybus_cmdlist_result(&stream->list, output, stream->controller, &err);
+    bool valid = false;
+
+    if (stream->reading)
+    {
+        if (!err && __calc_data_crc((uint8_t*)recv) == recv[BLOCK_SIZE])
+        {
+            memcpy(&stream->ring[stream->head % stream->ring_size], recv, BLOCK_SIZE);
+            stream->head += BLOCK_SIZE;
+            stream->address += BLOCK_SIZE;
+            valid = true;
+        }
+    }
+    else
+    {
+        uint8_t block[BLOCK_SIZE];
+        memset(block, stream->writes[stream->write_index][1], BLOCK_SIZE);
+
+        if (!err && __calc_data_crc(block) == recv[0])
+        {
+            stream->write_index++;
+            valid = true;
+        }
+    }
+
+    if (valid)
+    {
+        stream->retries = 0;
+    }
+    else if (++stream->retries == TPAK_STREAM_RETRIES)
+    {
+        stream->error = err ? TPAK_ERROR_NO_TPAK : TPAK_ERROR_UNKNOWN_BEHAVIOUR;
+    }
+
+    tpak_stream_next(stream);
+}
+
+/**
+ * @brief Start a stream.
+ */
+static int tpak_stream_start(tpak_stream_t* stream, int controller, bool ram, int mbc, int num_steps, uint32_t total, uint8_t* ring, uint32_t ring_size)
+{
+    if (controller < 0 || controller > 3 || ring == NULL || ring_size < BLOCK_SIZE || ring_size % BLOCK_SIZE)
+    {
+        return TPAK_ERROR_INVALID_ARGUMENT;
+    }
+
+    memset(stream, 0, sizeof(*stream));
+    stream->total = total;
+    stream->controller = controller;
+    stream->mbc = mbc;
+    stream->ram = ram;
+    stream->num_steps = num_steps;
+    stream->ring = ring;
+    stream->ring_size = ring_size;
+    tpak_stream_setup_step(stream);
+
+    disable_interrupts();
+    tpak_stream_next(stream);
+    enable_interrupts();
+
+    return 0;
+}
+
+/**
+ * @brief Start dumping a whole gameboy cartridge ROM.
+ *
+ * The ROM banks are read in order, switching them through the cartridge's memory bank controller
+ * (none, MBC1, MBC2, MBC3 or MBC5), as described by the cartridge header. Blocks are read in the
+ * background, as fast as the joybus allows, until the ring buffer is full; call #tpak_stream_read
+ * to consume the data, until #tpak_stream_done.
+ *
+ * The transfer pak must have been initialized with #tpak_init. The stream and the ring buffer must
+ * remain valid until #tpak_stream_done, and the transfer pak must not be accessed in the meantime.
+ *
+ * @param[out] stream
+ *             The stream to start.
+ * @param[in]  controller
+ *             The controller (0-3) with transfer pak connected.
+ * @param[in]  header
+ *             The cartridge header (see #tpak_get_cartridge_header).
+ * @param[in]  ring
+ *             Ring buffer for the data read.
+ * @param[in]  ring_size
+ *             Size of the ring buffer, multiple of 32 bytes (a few KB keep the joybus busy).
+ * @return TPAK_ERROR code or 0 if successful.
+ */
+int tpak_stream_rom(tpak_stream_t* stream, int controller, struct gameboy_cartridge_header* header, uint8_t* ring, uint32_t ring_size)
+{
+    int mbc = tpak_get_mbc(header->cartridge_type);
+
+    if (mbc < 0 || header->rom_size_code > 8)
+    {
+        return TPAK_ERROR_INVALID_ARGUMENT;
+    }
+
+    int num_banks = 2 << header->rom_size_code;
+    return tpak_stream_start(stream, controller, false, mbc, num_banks, num_banks * BANK_SIZE, ring, ring_size);
+}
+
+/**
+ * @brief Start dumping the whole Save RAM of a gameboy cartridge.
+ *
+ * Works like #tpak_stream_rom, for the RAM banks. The Save RAM is disabled again at the end.
+ *
+ * @param[out] stream
+ *             The stream to start.
+ * @param[in]  controller
+ *             The controller (0-3) with transfer pak connected.
+ * @param[in]  header
+ *             The cartridge header (see #tpak_get_cartridge_header).
+ * @param[in]  ring
+ *             Ring buffer for the data read.
+ * @param[in]  ring_size
+ *             Size of the ring buffer, multiple of 32 bytes.
+ * @return TPAK_ERROR code or 0 if successful.
+ */
+int tpak_stream_ram(tpak_stream_t* stream, int controller, struct gameboy_cartridge_header* header, uint8_t* ring, uint32_t ring_size)
+{
+    static const uint32_t ram_sizes[] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+    int mbc = tpak_get_mbc(header->cartridge_type);
+
+    if (mbc < 0 || header->ram_size_code >= sizeof(ram_sizes) / sizeof(ram_sizes[0]))
+    {
+        return TPAK_ERROR_INVALID_ARGUMENT;
+    }
+
+    // MBC2 has 512 4-bit values built in.
+    uint32_t total = mbc == MBC_2 ? 0x200 : ram_sizes[header->ram_size_code];
+    if (total == 0)
+    {
+        return TPAK_ERROR_INVALID_ARGUMENT;
+    }
+
+    int num_banks = (total + 0x1FFF) / 0x2000;
+    return tpak_stream_start(stream, controller, true, mbc, num_banks + 1, total, ring, ring_size);
+}
+
+/**
+ * @brief Copy the data read by a stream so far.
+ *
+ * Frees room in the ring buffer, and resumes reading if the stream was stalled.
+ *
+ * @param[in]  stream
+ *             The stream.
+ * @param[out] buffer
+ *             Buffer to copy to.
+ * @param[in]  size
+ *             Size of the buffer.
+ * @return Number of bytes copied (possibly 0), or a TPAK_ERROR code.
+ */
+int tpak_stream_read(tpak_stream_t* stream, uint8_t* buffer, uint32_t size)
+{
+    if (stream->error)
+    {
+        return stream->error;
+    }
+
+    // Only the SI interrupt moves the head, so the data up to it can be copied as is.
+    uint32_t available = stream->head - stream->tail;
+    if (size > available)
+    {
+        size = available;
+    }
+
+    for (uint32_t copied = 0; copied < size; )
+    {
+        uint32_t offset = (stream->tail + copied) % stream->ring_size;
+        uint32_t len = stream->ring_size - offset;
+        if (len > size - copied)
+        {
+            len = size - copied;
+        }
+
+        memcpy(buffer + copied, &stream->ring[offset], len);
+        copied += len;
+    }
+
+    disable_interrupts();
+    stream->tail += size;
+    if (!stream->busy && stream->bank < stream->num_steps)
+    {
+        tpak_stream_next(stream);
+    }
+    enable_interrupts();
+
+    return size;
+}
+
+/**
+ * @brief Check whether a stream is over.
+ *
+ * @param[in] stream
+ *            The stream.
+ * @return True if all the data was read and consumed, or if the stream failed (see #tpak_stream_read).
+ */
+bool tpak_stream_done(tpak_stream_t* stream)
+{
+    if (stream->error)
+    {
+        return !stream->busy;
+    }
+
+    return stream->bank >= stream->num_steps && stream->head == stream->tail && !stream->busy;
+}
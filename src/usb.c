@@ -28,6 +28,12 @@ https://github.com/buu342/N64-UNFLoader
 // Data header related
 #define USBHEADER_CREATE(type, left) (((type<<24) | (left & 0x00FFFFFF)))
 
+// Asynchronous transfer states
+#define USB_ASYNC_IDLE  0 // No transfer in progress
+#define USB_ASYNC_WRITE 1 // Caller's data is being DMA'd to the cart's SDRAM
+#define USB_ASYNC_SEND  2 // The cart is sending the data through USB
+#define USB_ASYNC_READ  3 // Received data is being DMA'd to the caller's buffer
+
 
 /*********************************
    Libultra macros for libdragon
@@ -247,6 +253,14 @@ static void usb_everdrive_writereg(u64 reg, u32 value);
 static void usb_sc64_write(int datatype, const void* data, int size);
 static u32  usb_sc64_poll();
 static void usb_sc64_read();
+#ifdef LIBDRAGON
+    static char usb_read_direct(void* buffer, int nbytes);
+    static char usb_64drive_write_async(int datatype, const void* data, int size);
+    static char usb_sc64_write_async(int datatype, const void* data, int size);
+    static u32  usb_sc64_read_usb_scr(void);
+    static void usb_sc64_setwritable(u8 enable);
+    void usb_64drive_setwritable(u8 enable);
+#endif
 
 
 /*********************************
@@ -266,6 +280,14 @@ int usb_datasize = 0;
 int usb_dataleft = 0;
 int usb_readblock = -1;
 
+#ifdef LIBDRAGON
+    // Asynchronous transfer globals
+    static dma_request_t usb_async_req;
+    static u8 usb_async_state = USB_ASYNC_IDLE;
+    static int usb_async_datatype;
+    static int usb_async_size;
+#endif
+
 #ifndef LIBDRAGON
 // Message globals
     #if !USE_OSRAW
@@ -428,6 +450,11 @@ void usb_write(int datatype, const void* data, int size)
     if (usb_dataleft != 0)
         return;
         
+    // Finish any asynchronous transfer, as it shares the cart's buffer
+    #ifdef LIBDRAGON
+        usb_async_wait();
+    #endif
+        
     // Call the correct write function
     funcPointer_write(datatype, data, size);
 }
@@ -459,6 +486,11 @@ u32 usb_poll()
     if (usb_dataleft != 0)
         return USBHEADER_CREATE(usb_datatype, usb_dataleft);
         
+    // Incoming data would overwrite the buffer of an asynchronous write
+    #ifdef LIBDRAGON
+        usb_async_wait();
+    #endif
+        
     // Call the correct read function
     return funcPointer_poll();
 }
@@ -487,6 +519,16 @@ void usb_read(void* buffer, int nbytes)
     // If there's no data to read, stop
     if (usb_dataleft == 0)
         return;
+        
+    // Large reads skip the global buffer and DMA straight into the caller's buffer
+    #ifdef LIBDRAGON
+        usb_async_wait();
+        if (nbytes >= BUFFER_SIZE && usb_read_direct(buffer, nbytes))
+        {
+            usb_async_wait();
+            return;
+        }
+    #endif
 
     // Read chunks from ROM
     while (left > 0)
@@ -562,6 +604,204 @@ void usb_purge()
 }
 
 
+#ifdef LIBDRAGON
+
+/*********************************
+      Asynchronous functions
+*********************************/
+
+/*==============================
+    usb_getbase
+    Returns the PI address of the USB I/O area of the current flashcart
+    @return The PI address of the data received or sent through USB
+==============================*/
+
+static u32 usb_getbase()
+{
+    switch (usb_cart)
+    {
+        case CART_64DRIVE:
+            return D64_BASE_ADDRESS + DEBUG_ADDRESS;
+        case CART_EVERDRIVE:
+            return ED_BASE + DEBUG_ADDRESS;
+        default:
+            return SC64_SDRAM_BASE + DEBUG_ADDRESS;
+    }
+}
+
+
+/*==============================
+    usb_read_direct
+    Queues a DMA of the received data from the cart straight into the provided buffer
+    @param The buffer to put the read data in
+    @param The number of bytes to read
+    @return 1 if the DMA was queued, 0 if the buffer is not suitable for it
+==============================*/
+
+static char usb_read_direct(void* buffer, int nbytes)
+{
+    u32 offset = usb_datasize-usb_dataleft;
+    
+    // Ensure we don't read too much data
+    if (nbytes > usb_dataleft)
+        nbytes = usb_dataleft;
+    
+    // The PI can only transfer between addresses with the same 2-byte alignment
+    if (nbytes <= 0 || (((u32)buffer ^ offset) & 1))
+        return 0;
+    
+    // The CPU must not touch the buffer until the DMA is done
+    data_cache_hit_writeback_invalidate(buffer, nbytes);
+    dma_queue_read(&usb_async_req, buffer, usb_getbase() + offset, nbytes, DMA_PRIORITY_NORMAL, NULL, NULL);
+    usb_async_state = USB_ASYNC_READ;
+    usb_dataleft -= nbytes;
+    return 1;
+}
+
+
+/*==============================
+    usb_write_async
+    Starts writing data to the USB without waiting for it to be sent
+    @param The DATATYPE that is being sent
+    @param A buffer with the data to send
+    @param The size of the data being sent
+    @return 1 if the write was started, 0 if not
+==============================*/
+
+char usb_write_async(int datatype, const void* data, int size)
+{
+    // If no debug cart exists, stop
+    if (usb_cart == CART_NONE)
+        return 0;
+        
+    // If there's data to read first, stop
+    if (usb_dataleft != 0)
+        return 0;
+        
+    // Only one transfer can be in progress at a time
+    usb_async_wait();
+    
+    // Data that is not 8 byte aligned cannot be DMA'd directly, so send it the slow way
+    if (((u32)data & 7) != 0 || size < 8)
+    {
+        funcPointer_write(datatype, data, size);
+        return 1;
+    }
+    
+    // Call the correct write function
+    switch (usb_cart)
+    {
+        case CART_64DRIVE:
+            return usb_64drive_write_async(datatype, data, size);
+        case CART_SC64:
+            return usb_sc64_write_async(datatype, data, size);
+        default:
+            // The EverDrive can only send through its 512 byte FPGA buffer
+            funcPointer_write(datatype, data, size);
+            return 1;
+    }
+}
+
+
+/*==============================
+    usb_read_async
+    Starts reading bytes received from USB into the provided buffer
+    @param The buffer to put the read data in
+    @param The number of bytes to read
+    @return 1 if the read was started, 0 if there's no data to read
+==============================*/
+
+char usb_read_async(void* buffer, int nbytes)
+{
+    // If no debug cart exists, or there's no data to read, stop
+    if (usb_cart == CART_NONE || usb_dataleft == 0)
+        return 0;
+        
+    // Only one transfer can be in progress at a time
+    usb_async_wait();
+    
+    // Fall back to a synchronous read if the buffer cannot be DMA'd to
+    if (!usb_read_direct(buffer, nbytes))
+        usb_read(buffer, nbytes);
+    return 1;
+}
+
+
+/*==============================
+    usb_async_done
+    Advances the asynchronous transfer in progress
+    @return 1 if there's no transfer in progress, 0 if not
+==============================*/
+
+char usb_async_done()
+{
+    u32 status;
+    
+    switch (usb_async_state)
+    {
+        case USB_ASYNC_WRITE:
+            if (!dma_request_done(&usb_async_req))
+                return 0;
+                
+            // The data is in SDRAM, have the cart send it
+            if (usb_cart == CART_64DRIVE)
+            {
+                io_write(D64_CIBASE_ADDRESS + D64_REGISTER_USBP0R0, (DEBUG_ADDRESS) >> 1);
+                io_write(D64_CIBASE_ADDRESS + D64_REGISTER_USBP1R1, (usb_async_size & 0xFFFFFF) | (usb_async_datatype << 24));
+                io_write(D64_CIBASE_ADDRESS + D64_REGISTER_USBCOMSTAT, D64_COMMAND_WRITE);
+            }
+            else
+            {
+                usb_sc64_setwritable(FALSE);
+                io_write(SC64_REG_USB_DMA_ADDR, SC64_USB_BANK_ADDR(SC64_BANK_ROM, DEBUG_ADDRESS));
+                io_write(SC64_REG_USB_DMA_LEN, SC64_USB_LENGTH(usb_async_size));
+                io_write(SC64_REG_USB_SCR, SC64_USB_CONTROL_START);
+            }
+            usb_async_state = USB_ASYNC_SEND;
+            // Fallthrough
+        case USB_ASYNC_SEND:
+            if (usb_cart == CART_64DRIVE)
+            {
+                status = io_read(D64_CIBASE_ADDRESS + D64_REGISTER_USBCOMSTAT);
+                if (((status >> 4) & D64_USB_BUSY) != D64_USB_IDLE)
+                    return 0;
+                usb_64drive_setwritable(FALSE);
+            }
+            else if (usb_cart == CART_SC64)
+            {
+                status = usb_sc64_read_usb_scr();
+                if (!(status & SC64_USB_STATUS_READY))
+                    usb_cart = CART_NONE; // USB cable disconnected
+                else if (status & SC64_USB_STATUS_BUSY)
+                    return 0;
+            }
+            usb_async_state = USB_ASYNC_IDLE;
+            return 1;
+        case USB_ASYNC_READ:
+            if (!dma_request_done(&usb_async_req))
+                return 0;
+            usb_async_state = USB_ASYNC_IDLE;
+            return 1;
+        default:
+            return 1;
+    }
+}
+
+
+/*==============================
+    usb_async_wait
+    Waits until the asynchronous transfer in progress is done
+==============================*/
+
+void usb_async_wait()
+{
+    while (!usb_async_done())
+        ;
+}
+
+#endif
+
+
 /*********************************
         64Drive functions
 *********************************/
@@ -792,6 +1032,54 @@ static void usb_64drive_write(int datatype, const void* data, int size)
 }
 
 
+#ifdef LIBDRAGON
+/*==============================
+    usb_64drive_write_async
+    Starts DMAing data straight from the caller's buffer to the 64Drive's SDRAM
+    The transfer is finished by usb_async_done
+    @param The DATATYPE that is being sent
+    @param An 8 byte aligned buffer with the data to send
+    @param The size of the data being sent
+    @return 1 if the write was started, 0 if not
+==============================*/
+
+static char usb_64drive_write_async(int datatype, const void* data, int size)
+{
+    int direct = size & ~7;
+    int tail = size - direct;
+    
+    // Larger writes don't fit the debug area, send them the slow way
+    if (size > DEBUG_ADDRESS_SIZE)
+    {
+        usb_64drive_write(datatype, data, size);
+        return 1;
+    }
+    
+    // Spin until the write buffer is free and then set the cartridge to write mode
+    if (!usb_64drive_waitidle())
+        return 0;
+    usb_64drive_setwritable(TRUE);
+    
+    // The last bytes go through the global buffer, padded to 32 bits
+    if (tail != 0)
+    {
+        memset(usb_buffer, 0, 8);
+        memcpy(usb_buffer, (char*)data+direct, tail);
+        data_cache_hit_writeback(usb_buffer, 8);
+        dma_write(usb_buffer, D64_BASE_ADDRESS + DEBUG_ADDRESS + direct, ALIGN(tail, 4));
+    }
+    
+    // Queue the DMA of the rest of the data
+    data_cache_hit_writeback(data, direct);
+    dma_queue_write(&usb_async_req, data, D64_BASE_ADDRESS + DEBUG_ADDRESS, direct, DMA_PRIORITY_NORMAL, NULL, NULL);
+    usb_async_datatype = datatype;
+    usb_async_size = ALIGN(size, 4);
+    usb_async_state = USB_ASYNC_WRITE;
+    return 1;
+}
+#endif
+
+
 /*==============================
     usb_64drive_arm
     Arms the 64Drive's USB
@@ -1565,6 +1853,65 @@ static void usb_sc64_write(int datatype, const void* data, int size)
 }
 
 
+#ifdef LIBDRAGON
+/*==============================
+    usb_sc64_write_async
+    Starts DMAing data straight from the caller's buffer to the SummerCart64's SDRAM
+    The transfer is finished by usb_async_done
+    @param The DATATYPE that is being sent
+    @param An 8 byte aligned buffer with the data to send
+    @param The size of the data being sent
+    @return 1 if the write was started, 0 if not
+==============================*/
+
+static char usb_sc64_write_async(int datatype, const void* data, int size)
+{
+    u8 dma[4] = {'D', 'M', 'A', '@'};
+    u32 header = USBHEADER_CREATE(datatype, size);
+    u8 cmp[4] = {'C', 'M', 'P', 'H'};
+    u32 sdram_address = SC64_SDRAM_BASE + DEBUG_ADDRESS;
+    int direct = size & ~7;
+    int tail = size - direct;
+    
+    // Writes that need more than one USB transfer are sent the slow way
+    if (sizeof(dma) + sizeof(header) + size + sizeof(cmp) > MIN(DEBUG_ADDRESS_SIZE, SC64_USB_DMA_MAX_LEN))
+    {
+        usb_sc64_write(datatype, data, size);
+        return 1;
+    }
+    
+    // Wait until ready
+    if (usb_sc64_waitidle())
+    {
+        // Do nothing if USB cable is not connected
+        return 0;
+    }
+
+    // Enable SDRAM writes
+    usb_sc64_setwritable(TRUE);
+    
+    // Write the transfer header before the data
+    memcpy(usb_buffer, dma, sizeof(dma));
+    memcpy(usb_buffer + sizeof(dma), &header, sizeof(header));
+    data_cache_hit_writeback(usb_buffer, 8);
+    dma_write(usb_buffer, sdram_address, 8);
+    
+    // Write the last bytes followed by CMPH after the data
+    memcpy(usb_buffer, (char*)data+direct, tail);
+    memcpy(usb_buffer + tail, cmp, sizeof(cmp));
+    data_cache_hit_writeback(usb_buffer, 16);
+    dma_write(usb_buffer, sdram_address + 8 + direct, ALIGN(tail + sizeof(cmp), 4));
+    
+    // Queue the DMA of the rest of the data
+    data_cache_hit_writeback(data, direct);
+    dma_queue_write(&usb_async_req, data, sdram_address + 8, direct, DMA_PRIORITY_NORMAL, NULL, NULL);
+    usb_async_size = sizeof(dma) + sizeof(header) + size + sizeof(cmp);
+    usb_async_state = USB_ASYNC_WRITE;
+    return 1;
+}
+#endif
+
+
 /*==============================
     usb_sc64_poll
     Returns the header of data being received via USB on the SummerCart64
@@ -0,0 +1,570 @@
+/**
+ * @file video.c
+ * @brief Full-motion video playback
+ * @ingroup video
+ */
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <assert.h>
+#include "libdragon.h"
+#include "video.h"
+
+/**
+ * @defgroup video Full-motion video playback
+ * @ingroup display
+ * @brief Streaming of video files from DragonFS, decoded by the RSP.
+ *
+ * Video files are created from a sequence of PNG frames with the mkvideo tool.
+ * A frame is made of 16x16 macroblocks in YUV 4:2:0, each one made of four 8x8
+ * luma blocks and two 8x8 chroma blocks. Macroblocks are either intra coded,
+ * predicted from the previous frame (with a motion vector), or skipped (copied
+ * from the previous frame as they are). The difference from the prediction is
+ * coded with the DCT: the coefficients are quantized and run-length coded, and
+ * blocks where all of them are zero are not stored at all.
+ *
+ * The player streams the frames with asynchronous reads (see #dfs_read_async):
+ * the next frame is read from ROM while the current one is displayed. The CPU
+ * only parses the frame record into a list of macroblocks with dequantized
+ * coefficients. The RSP (see rsp_video.S) fetches the prediction from the
+ * previous frame, runs the IDCT of the coded blocks and reconstructs the frame;
+ * then it converts the frame to RGB, straight into a framebuffer obtained with
+ * #display_lock, which is passed to #display_show when the frame is due.
+ *
+ * To play a video, open it with #video_open and call #video_update in the main
+ * loop until it returns false, then #video_close. The display must be
+ * initialized, with a resolution at least as large as the video (which is
+ * centered on the screen). When a waveform is attached to the video with
+ * #video_set_audio, it is played on the given mixer channel, and the video
+ * follows its playback position, so that they stay in sync even when frames
+ * have to be skipped; the application must keep feeding the audio as usual.
+ * @{
+ */
+
+/** @brief Identifier of video files */
+#define VIDEO_ID            "VD64"
+/** @brief Version of the video file format */
+#define VIDEO_FILE_VERSION  2
+/** @brief Size of a macroblock in pixels */
+#define VIDEO_MB_SIZE       16
+
+/** @brief Macroblock mode: copied from the previous frame */
+#define VIDEO_MB_SKIP       0
+/** @brief Macroblock mode: predicted from the previous frame, plus coded blocks */
+#define VIDEO_MB_INTER      1
+/** @brief Macroblock mode: coded blocks only */
+#define VIDEO_MB_INTRA      2
+
+/** @brief Flag of an intra macroblock in #video_rsp_mb_t (predicted as gray) */
+#define VIDEO_RSP_MB_INTRA  0x8000
+
+/**
+ * @brief Header of a video file (see mkvideo)
+ *
+ * It is followed by the frame records. Each record is a multiple of 8 bytes:
+ * the size of the next record (0 for the last one), the quantizer scale of the
+ * frame (one byte, padded to 8 bytes), and then the macroblocks in raster order.
+ *
+ * Each macroblock starts with its mode byte (VIDEO_MB_*). Inter macroblocks
+ * follow it with the motion vector (two signed bytes, x and y, even and
+ * pointing inside the frame) and with the coded block pattern; intra ones with
+ * the coded block pattern only. Its bits 0-5 tell which blocks are coded:
+ * the four luma blocks in raster order, then U and V.
+ *
+ * Each coded block is a sequence of 16-bit tokens, one per non-zero coefficient
+ * in zigzag order: the number of zero coefficients before it (bits 9-14), its
+ * quantized value (signed, bits 0-8), and bit 15 set for the last one.
+ */
+typedef struct
+{
+    /** @brief Identifier (#VIDEO_ID) */
+    char id[4];
+    /** @brief Version (#VIDEO_FILE_VERSION) */
+    uint16_t version;
+    /** @brief Unused flags */
+    uint16_t flags;
+    /** @brief Width in pixels (multiple of 16) */
+    uint16_t width;
+    /** @brief Height in pixels (multiple of 16) */
+    uint16_t height;
+    /** @brief Frame rate in 16.16 fixed point */
+    uint32_t fps;
+    /** @brief Number of frames */
+    uint32_t num_frames;
+    /** @brief Size of the largest frame record */
+    uint32_t max_record_size;
+    /** @brief Size of the first frame record */
+    uint32_t first_record_size;
+    /** @brief Largest number of coded blocks in a frame */
+    uint32_t max_blocks;
+} video_header_t;
+
+_Static_assert(sizeof(video_header_t) == 32, "invalid video header size");
+
+/**
+ * @brief Command of the RSP decoding of a macroblock (see rsp_video.S)
+ *
+ * It is followed by the coefficients of the coded blocks, 64 for each one in
+ * rows of 8, with 3 fractional bits.
+ */
+typedef struct
+{
+    /** @brief Physical address of the luma prediction in the reference frame */
+    uint32_t ref_y;
+    /** @brief Physical address of the chroma prediction in the reference frame */
+    uint32_t ref_uv;
+    /** @brief Physical address of the macroblock in the luma plane */
+    uint32_t dst_y;
+    /** @brief Physical address of the macroblock in the chroma plane */
+    uint32_t dst_uv;
+    /** @brief Coded block pattern, and #VIDEO_RSP_MB_INTRA */
+    uint16_t flags;
+    /** @brief Number of coded blocks */
+    uint16_t num_blocks;
+    /** @brief Padding to a multiple of 8 bytes */
+    uint32_t padding;
+} video_rsp_mb_t;
+
+_Static_assert(sizeof(video_rsp_mb_t) == 24, "invalid video macroblock command size");
+
+/** @brief Operation of the RSP: decode a frame */
+#define VIDEO_RSP_OP_DECODE 1
+
+/** @brief Position in the block of each coefficient, in zigzag order (keep in sync with mkvideo) */
+static const uint8_t __video_zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+/**
+ * @brief Quantizer step of a coefficient, before the scale of the frame
+ *
+ * 32 for the DC coefficient, and 16 + 4 * (u + v) for the others (keep in sync
+ * with mkvideo), in units of coefficient / 8.
+ */
+static inline int __video_quant(int pos)
+{
+    return pos ? 16 + 4 * ((pos & 7) + (pos >> 3)) : 32;
+}
+
+DEFINE_RSP_UCODE(rsp_video);
+
+/** @brief Bit depth of the display (see display.c) */
+extern uint32_t __bitdepth;
+/** @brief Width of the display (see display.c) */
+extern uint32_t __width;
+/** @brief Height of the display (see display.c) */
+extern uint32_t __height;
+/** @brief Framebuffers of the display (see display.c) */
+extern void *__safe_buffer[];
+
+/**
+ * @brief Copy the input of a frame decoding or conversion into DMEM
+ *
+ * @param[in] task
+ *            The task, whose context is its #video_rsp_input_t
+ */
+static void __video_rsp_setup(rsp_task_t *task)
+{
+    uint32_t *input = task->ctx;
+
+    for (int i = 0; i < sizeof(video_rsp_input_t) / 4; i++)
+    {
+        SP_DMEM[i] = input[i];
+    }
+}
+
+/**
+ * @brief Open a video file for playback from the DragonFS filesystem
+ *
+ * The first frame record is read right away in background.
+ *
+ * @param[out] video
+ *             Video player to initialize
+ * @param[in]  fn
+ *             Filename of the video (on DragonFS)
+ */
+void video_open(video_t *video, const char *fn)
+{
+    memset(video, 0, sizeof(*video));
+
+    int fh = dfs_open(fn);
+    assertf(fh >= 0, "file does not exist: %s", fn);
+
+    video_header_t head;
+    dfs_read(&head, 1, sizeof(head), fh);
+    assertf(strncmp(head.id, VIDEO_ID, 4) == 0, "video %s: invalid ID: %02x%02x%02x%02x\n",
+        fn, head.id[0], head.id[1], head.id[2], head.id[3]);
+    assertf(head.version == VIDEO_FILE_VERSION, "video %s: invalid version: %02x\n",
+        fn, head.version);
+    assertf(head.width % VIDEO_MB_SIZE == 0 && head.height % VIDEO_MB_SIZE == 0,
+        "video %s: invalid size: %dx%d\n", fn, head.width, head.height);
+
+    video->width = head.width;
+    video->height = head.height;
+    video->num_frames = head.num_frames;
+    video->fps = head.fps;
+    video->handle = fh;
+
+    int num_mbs = (video->width / VIDEO_MB_SIZE) * (video->height / VIDEO_MB_SIZE);
+    int plane_size = video->width * video->height;
+
+    video->record = dfs_alloc_buffer(head.max_record_size);
+    video->mbs = memalign(16, num_mbs * sizeof(video_rsp_mb_t) + head.max_blocks * 64 * sizeof(int16_t) + 16);
+    assert(video->record && video->mbs);
+
+    for (int i = 0; i < 2; i++)
+    {
+        /* The RSP fetches the predictions in rows of 24 bytes, which might
+           go 8 bytes past the end of the plane */
+        video->y_plane[i] = memalign(16, plane_size + 16);
+        video->uv_plane[i] = memalign(16, plane_size / 2 + 16);
+        assert(video->y_plane[i] && video->uv_plane[i]);
+
+        /* The planes are only accessed by the RSP from now on */
+        memset(video->y_plane[i], 0, plane_size + 16);
+        memset(video->uv_plane[i], 0x80, plane_size / 2 + 16);
+        data_cache_hit_writeback_invalidate(video->y_plane[i], plane_size + 16);
+        data_cache_hit_writeback_invalidate(video->uv_plane[i], plane_size / 2 + 16);
+    }
+
+    video->task.ucode = &rsp_video;
+    video->task.setup = __video_rsp_setup;
+    video->task.ctx = &video->input;
+    video->decode_task.ucode = &rsp_video;
+    video->decode_task.setup = __video_rsp_setup;
+    video->decode_task.ctx = &video->decode_input;
+
+    if (video->num_frames)
+    {
+        dfs_read_async(fh, video->record, head.first_record_size, NULL, NULL);
+    }
+}
+
+/**
+ * @brief Play a waveform along with a video
+ *
+ * The waveform starts playing with the first frame, and the playback position
+ * of the channel is used as the clock of the video, so that they stay in sync.
+ * It must be called before the first #video_update.
+ *
+ * @param[in] video
+ *            Video player
+ * @param[in] wav
+ *            Waveform to play (or NULL to play the video alone)
+ * @param[in] ch
+ *            Mixer channel to play it on
+ */
+void video_set_audio(video_t *video, wav64_t *wav, int ch)
+{
+    assert(!video->started);
+
+    video->audio = wav;
+    video->audio_ch = ch;
+}
+
+/**
+ * @brief Update the playback clock
+ *
+ * @param[in] video
+ *            Video player
+ *
+ * @return The index of the frame that should be on screen now.
+ */
+static int __video_clock(video_t *video)
+{
+    uint32_t now = TICKS_READ();
+
+    video->time += TICKS_DISTANCE(video->last_ticks, now);
+    video->last_ticks = now;
+
+    /* Follow the audio while it plays, and go on with the CPU clock afterwards */
+    if (video->audio && mixer_ch_playing(video->audio_ch))
+    {
+        video->time = (int64_t)(mixer_ch_get_pos(video->audio_ch) *
+            ((float)TICKS_PER_SECOND / video->audio->wave.frequency));
+    }
+
+    return video->time * video->fps / ((int64_t)TICKS_PER_SECOND << 16);
+}
+
+/**
+ * @brief Parse the coefficients of a coded block
+ *
+ * @param[in]  p
+ *             First token of the block
+ * @param[out] coef
+ *             Dequantized coefficients, in rows of 8
+ * @param[in]  qscale
+ *             Quantizer scale of the frame
+ *
+ * @return The data that follows the block.
+ */
+static const uint8_t *__video_parse_block(const uint8_t *p, int16_t *coef, int qscale)
+{
+    memset(coef, 0, 64 * sizeof(int16_t));
+
+    for (int i = 0; ; i++)
+    {
+        uint16_t token = (p[0] << 8) | p[1];
+        p += 2;
+
+        i += (token >> 9) & 0x3F;
+        if (i < 64)
+        {
+            int pos = __video_zigzag[i];
+            int value = ((int16_t)(token << 7) >> 7) * __video_quant(pos) * qscale;
+            coef[pos] = value < -32768 ? -32768 : value > 32767 ? 32767 : value;
+        }
+
+        if (token & 0x8000)
+        {
+            return p;
+        }
+    }
+}
+
+/**
+ * @brief Parse the current record into macroblock commands, queue the RSP
+ *        decoding of the frame, and start reading the next record
+ *
+ * @param[in] video
+ *            Video player
+ */
+static void __video_decode(video_t *video)
+{
+    const uint32_t *head = (const uint32_t *)video->record;
+    const uint8_t *p = video->record + 8;
+    uint32_t next_size = head[0];
+    int qscale = video->record[4];
+    int ref = video->plane, cur = video->plane ^ 1;
+
+    /* The previous decoding might still be reading the commands */
+    if (video->frame)
+    {
+        rsp_task_wait(&video->decode_task);
+    }
+
+    uint8_t *mb = video->mbs;
+    int num_mbs = 0;
+
+    for (int y = 0; y < video->height; y += VIDEO_MB_SIZE)
+    {
+        for (int x = 0; x < video->width; x += VIDEO_MB_SIZE, num_mbs++)
+        {
+            video_rsp_mb_t *cmd = (video_rsp_mb_t *)mb;
+            int16_t *coef = (int16_t *)(cmd + 1);
+            int mode = *p++;
+            int mvx = 0, mvy = 0, cbp = 0, flags = 0;
+
+            if (mode == VIDEO_MB_INTER)
+            {
+                mvx = (int8_t)p[0];
+                mvy = (int8_t)p[1];
+                cbp = p[2];
+                p += 3;
+            }
+            else if (mode == VIDEO_MB_INTRA)
+            {
+                cbp = *p++;
+                flags = VIDEO_RSP_MB_INTRA;
+            }
+
+            cmd->ref_y = (uint32_t)(video->y_plane[ref] + (y + mvy) * video->width + x + mvx) & 0x1FFFFFFF;
+            cmd->ref_uv = (uint32_t)(video->uv_plane[ref] + ((y + mvy) / 2) * video->width + x + mvx) & 0x1FFFFFFF;
+            cmd->dst_y = (uint32_t)(video->y_plane[cur] + y * video->width + x) & 0x1FFFFFFF;
+            cmd->dst_uv = (uint32_t)(video->uv_plane[cur] + (y / 2) * video->width + x) & 0x1FFFFFFF;
+            cmd->flags = flags | cbp;
+            cmd->num_blocks = 0;
+
+            for (int b = 0; b < 6; b++)
+            {
+                if (cbp & (1 << b))
+                {
+                    p = __video_parse_block(p, coef, qscale);
+                    coef += 64;
+                    cmd->num_blocks++;
+                }
+            }
+
+            mb = (uint8_t *)coef;
+        }
+    }
+
+    data_cache_hit_writeback(video->mbs, (mb - video->mbs + 15) & ~15);
+
+    video->decode_input.y = (uint32_t)video->y_plane[cur] & 0x1FFFFFFF;
+    video->decode_input.uv = (uint32_t)video->uv_plane[cur] & 0x1FFFFFFF;
+    video->decode_input.width = video->width;
+    video->decode_input.height = video->height;
+    video->decode_input.op = VIDEO_RSP_OP_DECODE;
+    video->decode_input.mbs = (uint32_t)video->mbs & 0x1FFFFFFF;
+    video->decode_input.num_mbs = num_mbs;
+
+    rsp_task_submit(&video->decode_task);
+    video->plane = cur;
+
+    if (next_size)
+    {
+        dfs_read_async(video->handle, video->record, next_size, NULL, NULL);
+    }
+}
+
+/**
+ * @brief Queue the RSP conversion of the planes into a framebuffer
+ *
+ * @param[in] video
+ *            Video player
+ * @param[in] disp
+ *            Framebuffer, as returned by #display_lock
+ */
+static void __video_convert(video_t *video, display_context_t disp)
+{
+    uint8_t *fb = __safe_buffer[disp - 1];
+    int x = ((__width - video->width) / 2) & ~3;
+    int y = (__height - video->height) / 2;
+
+    assertf(video->width <= __width && video->height <= __height,
+        "video larger than the display: %dx%d", video->width, video->height);
+
+    /* Clear the borders, if any. RSP tasks run in order, so this is done before
+       the conversion. */
+    if (video->width < __width || video->height < __height)
+    {
+        rsp_memset32(fb, 0, __width * __height * __bitdepth);
+    }
+
+    /* The planes of the frame are decoded by the previous task */
+    video->input.y = (uint32_t)video->y_plane[video->plane] & 0x1FFFFFFF;
+    video->input.uv = (uint32_t)video->uv_plane[video->plane] & 0x1FFFFFFF;
+    video->input.dst = (uint32_t)(fb + (y * __width + x) * __bitdepth) & 0x1FFFFFFF;
+    video->input.width = video->width;
+    video->input.height = video->height;
+    video->input.stride = __width * __bitdepth;
+    video->input.bpp_shift = (__bitdepth == 2) ? 1 : 2;
+
+    rsp_task_submit(&video->task);
+}
+
+/**
+ * @brief Advance the playback of a video
+ *
+ * Call this function in the main loop, as often as possible (at least once per
+ * frame of the video). It never blocks: it displays the next frame when it is
+ * due, and prepares the following one in the meantime (if a framebuffer is
+ * available). Frames that are already late are decoded but not converted nor
+ * displayed, so that the video catches up with the clock.
+ *
+ * @param[in] video
+ *            Video player
+ *
+ * @return false once the last frame has been displayed, true otherwise.
+ */
+bool video_update(video_t *video)
+{
+    if (!video->started)
+    {
+        if (video->audio)
+        {
+            wav64_play(video->audio, video->audio_ch);
+        }
+
+        video->last_ticks = TICKS_READ();
+        video->started = true;
+    }
+
+    int due = __video_clock(video);
+
+    /* Show the frame converted in advance, once it is due */
+    if (video->disp)
+    {
+        if (!video->task.complete || video->disp_frame > due)
+        {
+            return true;
+        }
+
+        display_show(video->disp);
+        video->disp = 0;
+    }
+
+    while (video->frame < video->num_frames)
+    {
+        if (dfs_read_async_busy(video->handle))
+        {
+            return true;
+        }
+
+        /* The last frame is always displayed */
+        bool late = video->frame < due && video->frame + 1 < video->num_frames;
+        display_context_t disp = 0;
+
+        if (!late)
+        {
+            disp = display_lock();
+
+            if (!disp)
+            {
+                return true;
+            }
+        }
+
+        __video_decode(video);
+
+        if (late)
+        {
+            video->frame++;
+            video->skipped++;
+            continue;
+        }
+
+        __video_convert(video, disp);
+        video->disp = disp;
+        video->disp_frame = video->frame++;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Stop the playback of a video and release its resources
+ *
+ * @param[in] video
+ *            Video player
+ */
+void video_close(video_t *video)
+{
+    if (video->disp)
+    {
+        rsp_task_wait(&video->task);
+        display_show(video->disp);
+        video->disp = 0;
+    }
+
+    if (video->frame)
+    {
+        rsp_task_wait(&video->decode_task);
+    }
+
+    if (video->audio && video->started)
+    {
+        mixer_ch_stop(video->audio_ch);
+    }
+
+    /* Waits for the pending read, if any */
+    dfs_close(video->handle);
+
+    free(video->record);
+    free(video->mbs);
+
+    for (int i = 0; i < 2; i++)
+    {
+        free(video->y_plane[i]);
+        free(video->uv_plane[i]);
+    }
+    memset(video, 0, sizeof(*video));
+}
+
+/** @} */ /* video */
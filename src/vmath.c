@@ -0,0 +1,614 @@
+/**
+ * @file vmath.c
+ * @brief Vector and matrix math
+ * @ingroup vmath
+ */
+#include <math.h>
+#include <string.h>
+#include "libdragon.h"
+
+/**
+ * @defgroup vmath Vector and matrix math
+ * @ingroup libdragon
+ * @brief 3D math for transforms: vectors, 4x4 matrices and quaternions.
+ *
+ * The float routines work on single precision values only: the VR4300 FPU
+ * executes double precision multiplications in twice the time, so constants
+ * are single precision as well. The FPU has no multiply-add, and one addition
+ * must wait for the result of the previous one: sums of products are computed
+ * as two independent halves that are added at the end, so that the pipeline
+ * is kept busy with the other half in the meantime.
+ *
+ * Matrices follow the layout of #rdp_geom_set_matrix (see #mat4_t), so that
+ * a projection matrix built with #mat4_viewport, #mat4_perspective and
+ * #mat4_mul can be used directly to draw triangles on the RSP, or to
+ * transform batches of vertices with #rdp_geom_transform_vertices. Batches
+ * can also be transformed on the CPU with #mat4_transform_points.
+ *
+ * The fixed point variants use the s15.16 format, which is the one of the
+ * RSP geometry ucode and of the X coordinates and slopes of the RDP triangle
+ * commands (see #fix16_to_rdp_y for the Y coordinates). #mat4_to_rsp
+ * converts a matrix into the layout expected by the RSP vector unit.
+ * @{
+ */
+
+/**
+ * @brief Cross product of two 3D vectors
+ *
+ * @param[out] out
+ *             Result (can be one of the inputs)
+ * @param[in]  a
+ *             First vector
+ * @param[in]  b
+ *             Second vector
+ */
+void vec3_cross( vec3_t *out, const vec3_t *a, const vec3_t *b )
+{
+    float x = a->y * b->z - a->z * b->y;
+    float y = a->z * b->x - a->x * b->z;
+    float z = a->x * b->y - a->y * b->x;
+
+    out->x = x;
+    out->y = y;
+    out->z = z;
+}
+
+/**
+ * @brief Length of a 3D vector
+ *
+ * @param[in] v
+ *            Vector
+ *
+ * @return The length of the vector
+ */
+float vec3_length( const vec3_t *v )
+{
+    return sqrtf( vec3_dot( v, v ) );
+}
+
+/**
+ * @brief Normalize a 3D vector
+ *
+ * @param[out] out
+ *             Vector with the same direction and length 1 (can be the input)
+ * @param[in]  v
+ *             Vector (not zero)
+ */
+void vec3_normalize( vec3_t *out, const vec3_t *v )
+{
+    float inv = 1.0f / vec3_length( v );
+
+    out->x = v->x * inv;
+    out->y = v->y * inv;
+    out->z = v->z * inv;
+}
+
+/**
+ * @brief Set a matrix to the identity
+ *
+ * @param[out] out
+ *             Matrix
+ */
+void mat4_identity( mat4_t *out )
+{
+    memset( out, 0, sizeof(mat4_t) );
+    out->m[0][0] = out->m[1][1] = out->m[2][2] = out->m[3][3] = 1.0f;
+}
+
+/**
+ * @brief Multiply two matrices
+ *
+ * The result transforms a vector as b first, and then a.
+ *
+ * @param[out] out
+ *             Result (can be one of the inputs)
+ * @param[in]  a
+ *             Left matrix
+ * @param[in]  b
+ *             Right matrix
+ */
+void mat4_mul( mat4_t *out, const mat4_t *a, const mat4_t *b )
+{
+    mat4_t res;
+
+    for( int r = 0; r < 4; r++ )
+    {
+        float a0 = a->m[r][0], a1 = a->m[r][1], a2 = a->m[r][2], a3 = a->m[r][3];
+
+        for( int c = 0; c < 4; c++ )
+        {
+            float s0 = a0 * b->m[0][c] + a1 * b->m[1][c];
+            float s1 = a2 * b->m[2][c] + a3 * b->m[3][c];
+            res.m[r][c] = s0 + s1;
+        }
+    }
+
+    *out = res;
+}
+
+/**
+ * @brief Transpose a matrix
+ *
+ * @param[out] out
+ *             Result (can be the input)
+ * @param[in]  m
+ *             Matrix
+ */
+void mat4_transpose( mat4_t *out, const mat4_t *m )
+{
+    mat4_t res;
+
+    for( int r = 0; r < 4; r++ )
+    {
+        for( int c = 0; c < 4; c++ ) { res.m[r][c] = m->m[c][r]; }
+    }
+
+    *out = res;
+}
+
+/**
+ * @brief Build a translation matrix
+ *
+ * @param[out] out
+ *             Matrix
+ * @param[in]  x
+ *             Translation along X
+ * @param[in]  y
+ *             Translation along Y
+ * @param[in]  z
+ *             Translation along Z
+ */
+void mat4_translation( mat4_t *out, float x, float y, float z )
+{
+    mat4_identity( out );
+    out->m[0][3] = x;
+    out->m[1][3] = y;
+    out->m[2][3] = z;
+}
+
+/**
+ * @brief Build a scaling matrix
+ *
+ * @param[out] out
+ *             Matrix
+ * @param[in]  x
+ *             Scale along X
+ * @param[in]  y
+ *             Scale along Y
+ * @param[in]  z
+ *             Scale along Z
+ */
+void mat4_scaling( mat4_t *out, float x, float y, float z )
+{
+    mat4_identity( out );
+    out->m[0][0] = x;
+    out->m[1][1] = y;
+    out->m[2][2] = z;
+}
+
+/**
+ * @brief Build a rotation matrix from a quaternion
+ *
+ * @param[out] out
+ *             Matrix
+ * @param[in]  q
+ *             Rotation (unit quaternion)
+ */
+void mat4_rotation( mat4_t *out, const quat_t *q )
+{
+    float x2 = q->x + q->x, y2 = q->y + q->y, z2 = q->z + q->z;
+    float xx = q->x * x2, yy = q->y * y2, zz = q->z * z2;
+    float xy = q->x * y2, xz = q->x * z2, yz = q->y * z2;
+    float wx = q->w * x2, wy = q->w * y2, wz = q->w * z2;
+
+    mat4_identity( out );
+    out->m[0][0] = 1.0f - (yy + zz);
+    out->m[0][1] = xy - wz;
+    out->m[0][2] = xz + wy;
+    out->m[1][0] = xy + wz;
+    out->m[1][1] = 1.0f - (xx + zz);
+    out->m[1][2] = yz - wx;
+    out->m[2][0] = xz - wy;
+    out->m[2][1] = yz + wx;
+    out->m[2][2] = 1.0f - (xx + yy);
+}
+
+/**
+ * @brief Build a perspective projection matrix
+ *
+ * The camera looks towards -Z. The result is in clip space, with X, Y and Z in
+ * [-W, W] for visible points, and W equal to the distance from the camera.
+ *
+ * @param[out] out
+ *             Matrix
+ * @param[in]  fovy
+ *             Vertical field of view, in radians
+ * @param[in]  aspect
+ *             Aspect ratio (width / height)
+ * @param[in]  near
+ *             Distance of the near plane
+ * @param[in]  far
+ *             Distance of the far plane
+ */
+void mat4_perspective( mat4_t *out, float fovy, float aspect, float near, float far )
+{
+    float f = 1.0f / tanf( fovy * 0.5f );
+    float inv_depth = 1.0f / (near - far);
+
+    memset( out, 0, sizeof(mat4_t) );
+    out->m[0][0] = f / aspect;
+    out->m[1][1] = f;
+    out->m[2][2] = (far + near) * inv_depth;
+    out->m[2][3] = 2.0f * far * near * inv_depth;
+    out->m[3][2] = -1.0f;
+}
+
+/**
+ * @brief Build an orthographic projection matrix
+ *
+ * The box is mapped to X, Y and Z in [-1, 1], with W equal to 1.
+ *
+ * @param[out] out
+ *             Matrix
+ * @param[in]  left
+ *             X of the left plane
+ * @param[in]  right
+ *             X of the right plane
+ * @param[in]  bottom
+ *             Y of the bottom plane
+ * @param[in]  top
+ *             Y of the top plane
+ * @param[in]  near
+ *             Distance of the near plane
+ * @param[in]  far
+ *             Distance of the far plane
+ */
+void mat4_ortho( mat4_t *out, float left, float right, float bottom, float top, float near, float far )
+{
+    float inv_w = 1.0f / (right - left);
+    float inv_h = 1.0f / (top - bottom);
+    float inv_d = 1.0f / (far - near);
+
+    mat4_identity( out );
+    out->m[0][0] = 2.0f * inv_w;
+    out->m[1][1] = 2.0f * inv_h;
+    out->m[2][2] = -2.0f * inv_d;
+    out->m[0][3] = -(right + left) * inv_w;
+    out->m[1][3] = -(top + bottom) * inv_h;
+    out->m[2][3] = -(far + near) * inv_d;
+}
+
+/**
+ * @brief Build a viewport matrix
+ *
+ * The matrix maps clip space X and Y in [-W, W] to the screen rectangle (scaled
+ * by W, which is divided out when drawing), with Y pointing down. Multiplied by
+ * a projection matrix, it gives the matrix for #rdp_geom_set_matrix.
+ *
+ * @param[out] out
+ *             Matrix
+ * @param[in]  x
+ *             Left edge of the viewport, in pixels
+ * @param[in]  y
+ *             Top edge of the viewport, in pixels
+ * @param[in]  width
+ *             Width of the viewport, in pixels
+ * @param[in]  height
+ *             Height of the viewport, in pixels
+ */
+void mat4_viewport( mat4_t *out, float x, float y, float width, float height )
+{
+    mat4_identity( out );
+    out->m[0][0] = width * 0.5f;
+    out->m[1][1] = -height * 0.5f;
+    out->m[0][3] = x + width * 0.5f;
+    out->m[1][3] = y + height * 0.5f;
+}
+
+/**
+ * @brief Transform a vector by a matrix
+ *
+ * @param[out] out
+ *             Result (can be the input)
+ * @param[in]  m
+ *             Matrix
+ * @param[in]  v
+ *             Vector
+ */
+void mat4_transform( vec4_t *out, const mat4_t *m, const vec4_t *v )
+{
+    float res[4];
+
+    for( int r = 0; r < 4; r++ )
+    {
+        float s0 = m->m[r][0] * v->x + m->m[r][1] * v->y;
+        float s1 = m->m[r][2] * v->z + m->m[r][3] * v->w;
+        res[r] = s0 + s1;
+    }
+
+    out->x = res[0];
+    out->y = res[1];
+    out->z = res[2];
+    out->w = res[3];
+}
+
+/**
+ * @brief Transform a batch of points by a matrix
+ *
+ * Each point (x, y, z, 1) is transformed into homogeneous coordinates. The
+ * matrix is kept in registers for the whole batch. To do the same on the RSP
+ * (with the perspective divide), see #rdp_geom_transform_vertices.
+ *
+ * @param[out] out
+ *             Transformed points
+ * @param[in]  m
+ *             Matrix
+ * @param[in]  in
+ *             Points
+ * @param[in]  count
+ *             Number of points
+ */
+void mat4_transform_points( vec4_t *out, const mat4_t *m, const vec3_t *in, int count )
+{
+    const float m00 = m->m[0][0], m01 = m->m[0][1], m02 = m->m[0][2], m03 = m->m[0][3];
+    const float m10 = m->m[1][0], m11 = m->m[1][1], m12 = m->m[1][2], m13 = m->m[1][3];
+    const float m20 = m->m[2][0], m21 = m->m[2][1], m22 = m->m[2][2], m23 = m->m[2][3];
+    const float m30 = m->m[3][0], m31 = m->m[3][1], m32 = m->m[3][2], m33 = m->m[3][3];
+
+    for( int i = 0; i < count; i++ )
+    {
+        float x = in[i].x, y = in[i].y, z = in[i].z;
+
+        /* Interleave the rows, so that consecutive operations are independent */
+        float x0 = m00 * x + m03, y0 = m10 * x + m13, z0 = m20 * x + m23, w0 = m30 * x + m33;
+        float x1 = m01 * y + m02 * z, y1 = m11 * y + m12 * z;
+        float z1 = m21 * y + m22 * z, w1 = m31 * y + m32 * z;
+
+        out[i].x = x0 + x1;
+        out[i].y = y0 + y1;
+        out[i].z = z0 + z1;
+        out[i].w = w0 + w1;
+    }
+}
+
+/**
+ * @brief Set a quaternion to the identity (no rotation)
+ *
+ * @param[out] out
+ *             Quaternion
+ */
+void quat_identity( quat_t *out )
+{
+    out->x = out->y = out->z = 0.0f;
+    out->w = 1.0f;
+}
+
+/**
+ * @brief Build a quaternion from a rotation around an axis
+ *
+ * @param[out] out
+ *             Quaternion
+ * @param[in]  axis
+ *             Rotation axis (unit vector)
+ * @param[in]  angle
+ *             Rotation angle, in radians (counterclockwise looking from
+ *             the tip of the axis)
+ */
+void quat_from_axis_angle( quat_t *out, const vec3_t *axis, float angle )
+{
+    float s = sinf( angle * 0.5f );
+
+    out->x = axis->x * s;
+    out->y = axis->y * s;
+    out->z = axis->z * s;
+    out->w = cosf( angle * 0.5f );
+}
+
+/**
+ * @brief Multiply two quaternions
+ *
+ * The result rotates a vector as b first, and then a.
+ *
+ * @param[out] out
+ *             Result (can be one of the inputs)
+ * @param[in]  a
+ *             Left quaternion
+ * @param[in]  b
+ *             Right quaternion
+ */
+void quat_mul( quat_t *out, const quat_t *a, const quat_t *b )
+{
+    float x = (a->w * b->x + a->x * b->w) + (a->y * b->z - a->z * b->y);
+    float y = (a->w * b->y + a->y * b->w) + (a->z * b->x - a->x * b->z);
+    float z = (a->w * b->z + a->z * b->w) + (a->x * b->y - a->y * b->x);
+    float w = (a->w * b->w - a->x * b->x) - (a->y * b->y + a->z * b->z);
+
+    out->x = x;
+    out->y = y;
+    out->z = z;
+    out->w = w;
+}
+
+/**
+ * @brief Normalize a quaternion
+ *
+ * @param[out] out
+ *             Unit quaternion (can be the input)
+ * @param[in]  q
+ *             Quaternion (not zero)
+ */
+void quat_normalize( quat_t *out, const quat_t *q )
+{
+    float len2 = (q->x * q->x + q->y * q->y) + (q->z * q->z + q->w * q->w);
+    float inv = 1.0f / sqrtf( len2 );
+
+    out->x = q->x * inv;
+    out->y = q->y * inv;
+    out->z = q->z * inv;
+    out->w = q->w * inv;
+}
+
+/**
+ * @brief Interpolate between two rotations
+ *
+ * This is a normalized linear interpolation, which is much cheaper than a
+ * spherical one, and close enough for animations. It always takes the
+ * shortest path between the rotations.
+ *
+ * @param[out] out
+ *             Result (can be one of the inputs)
+ * @param[in]  a
+ *             Rotation at t = 0 (unit quaternion)
+ * @param[in]  b
+ *             Rotation at t = 1 (unit quaternion)
+ * @param[in]  t
+ *             Interpolation factor
+ */
+void quat_nlerp( quat_t *out, const quat_t *a, const quat_t *b, float t )
+{
+    float dot = (a->x * b->x + a->y * b->y) + (a->z * b->z + a->w * b->w);
+    float ta = 1.0f - t;
+    float tb = dot < 0.0f ? -t : t;
+
+    quat_t q = {
+        .x = a->x * ta + b->x * tb,
+        .y = a->y * ta + b->y * tb,
+        .z = a->z * ta + b->z * tb,
+        .w = a->w * ta + b->w * tb,
+    };
+    quat_normalize( out, &q );
+}
+
+/**
+ * @brief Rotate a vector by a quaternion
+ *
+ * @param[out] out
+ *             Rotated vector (can be the input)
+ * @param[in]  q
+ *             Rotation (unit quaternion)
+ * @param[in]  v
+ *             Vector
+ */
+void quat_rotate( vec3_t *out, const quat_t *q, const vec3_t *v )
+{
+    /* v + 2w (u x v) + 2 u x (u x v), with u the vector part of q */
+    vec3_t u = { q->x, q->y, q->z };
+    vec3_t t;
+
+    vec3_cross( &t, &u, v );
+    t.x += t.x; t.y += t.y; t.z += t.z;
+
+    vec3_t c;
+    vec3_cross( &c, &u, &t );
+
+    out->x = v->x + (q->w * t.x + c.x);
+    out->y = v->y + (q->w * t.y + c.y);
+    out->z = v->z + (q->w * t.z + c.z);
+}
+
+/**
+ * @brief Convert a matrix to s15.16 fixed point
+ *
+ * @param[out] out
+ *             Fixed point matrix
+ * @param[in]  m
+ *             Matrix (elements in the range [-32768, 32768))
+ */
+void mat4_to_fix16( mat4x_t *out, const mat4_t *m )
+{
+    for( int r = 0; r < 4; r++ )
+    {
+        for( int c = 0; c < 4; c++ ) { out->m[r][c] = fix16_from_float( m->m[r][c] ); }
+    }
+}
+
+/**
+ * @brief Multiply two fixed point matrices
+ *
+ * @param[out] out
+ *             Result (can be one of the inputs)
+ * @param[in]  a
+ *             Left matrix
+ * @param[in]  b
+ *             Right matrix
+ */
+void mat4x_mul( mat4x_t *out, const mat4x_t *a, const mat4x_t *b )
+{
+    mat4x_t res;
+
+    for( int r = 0; r < 4; r++ )
+    {
+        for( int c = 0; c < 4; c++ )
+        {
+            int64_t sum = 0;
+            for( int k = 0; k < 4; k++ ) { sum += (int64_t)a->m[r][k] * b->m[k][c]; }
+            res.m[r][c] = sum >> 16;
+        }
+    }
+
+    *out = res;
+}
+
+/**
+ * @brief Transform a batch of fixed point points by a fixed point matrix
+ *
+ * Each point (x, y, z, 1) is transformed into homogeneous coordinates.
+ *
+ * @param[out] out
+ *             Transformed points
+ * @param[in]  m
+ *             Matrix
+ * @param[in]  in
+ *             Points
+ * @param[in]  count
+ *             Number of points
+ */
+void mat4x_transform_points( vec4x_t *out, const mat4x_t *m, const vec3x_t *in, int count )
+{
+    for( int i = 0; i < count; i++ )
+    {
+        fix16_t res[4];
+
+        for( int r = 0; r < 4; r++ )
+        {
+            int64_t sum = (int64_t)m->m[r][0] * in[i].x + (int64_t)m->m[r][1] * in[i].y +
+                          (int64_t)m->m[r][2] * in[i].z;
+            res[r] = (sum >> 16) + m->m[r][3];
+        }
+
+        out[i].x = res[0];
+        out[i].y = res[1];
+        out[i].z = res[2];
+        out[i].w = res[3];
+    }
+}
+
+/**
+ * @brief Convert a matrix to the layout of the RSP vector unit
+ *
+ * This is the matrix format of the RSP geometry ucode (see #rdp_geom_set_matrix):
+ * each element is converted to s15.16, and split into a vector of integer parts
+ * (rows 0-3) and a vector of fractional parts (rows 4-7). Row N holds the
+ * coefficients of the input coordinate N for the four output coordinates, twice
+ * (once per half of the vector register, to transform two vertices at a time).
+ *
+ * @param[out] out
+ *             RSP matrix (8-byte aligned, to be loaded in DMEM)
+ * @param[in]  m
+ *             Matrix (elements in the range [-32768, 32768))
+ */
+void mat4_to_rsp( int16_t out[8][8], const mat4_t *m )
+{
+    for( int c = 0; c < 4; c++ )
+    {
+        for( int r = 0; r < 4; r++ )
+        {
+            fix16_t fx = fix16_from_float( m->m[r][c] );
+
+            out[c][r] = out[c][r + 4] = fx >> 16;
+            out[c + 4][r] = out[c + 4][r + 4] = fx & 0xFFFF;
+        }
+    }
+}
+
+/** @} */ /* vmath */
@@ -0,0 +1,31 @@
+void bench_dfs_read(BenchContext *ctx) {
+	static uint8_t buf[8192+16] __attribute__((aligned(16)));
+	const int size = 8192 - 16;
+
+	int fh = dfs_open("random.dat");
+	assertf(fh >= 0, "cannot open random.dat");
+
+	// Buffer and file offset with the same alignment: the data is DMA'd directly
+	BENCH_LOOP(ctx) {
+		dfs_seek(fh, 0, SEEK_SET);
+		dfs_read(buf, 1, size, fh);
+	}
+	bench_report(ctx, "aligned", size, "B/s");
+
+	// Odd offset between buffer and file: the data must be copied by the CPU
+	BENCH_LOOP(ctx) {
+		dfs_seek(fh, 0, SEEK_SET);
+		dfs_read(buf+3, 1, size, fh);
+	}
+	bench_report(ctx, "unaligned", size, "B/s");
+
+	// Small reads, as done by parsers
+	BENCH_LOOP(ctx) {
+		dfs_seek(fh, 0, SEEK_SET);
+		for (int i=0; i<256; i++)
+			dfs_read(buf, 1, 16, fh);
+	}
+	bench_report(ctx, "16B", 256, "reads/s");
+
+	dfs_close(fh);
+}
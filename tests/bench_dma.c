@@ -0,0 +1,24 @@
+void bench_dma_read(BenchContext *ctx) {
+	const int size = 64*1024;
+	uint8_t *buf = memalign(16, size);
+	assertf(buf, "cannot allocate the DMA buffer");
+
+	uint32_t rom = dfs_rom_addr("random.dat");
+	assertf(rom, "cannot find random.dat");
+
+	// Latency of a minimal transfer
+	BENCH_LOOP(ctx) {
+		data_cache_hit_writeback_invalidate(buf, 8);
+		dma_read(buf, rom, 8);
+	}
+	bench_report(ctx, "8B", 1, "reads/s");
+
+	// Throughput of a large transfer (the ROM past the file is fine to read)
+	BENCH_LOOP(ctx) {
+		data_cache_hit_writeback_invalidate(buf, size);
+		dma_read(buf, rom, size);
+	}
+	bench_report(ctx, "64KB", size, "B/s");
+
+	free(buf);
+}
@@ -0,0 +1,51 @@
+void bench_graphics_draw(BenchContext *ctx) {
+	static const char text[] = "The quick brown fox jumps over the lazy";
+	display_context_t disp;
+
+	// 32x32 16-bit sprite
+	sprite_t *sprite = memalign(16, sizeof(sprite_t) + 32*32*2);
+	assertf(sprite, "cannot allocate the sprite");
+	sprite->width = 32;
+	sprite->height = 32;
+	sprite->bitdepth = 2;
+	sprite->format = SPRITE_FORMAT_RGBA;
+	sprite->hslices = 1;
+	sprite->vslices = 1;
+	uint16_t *pixels = (uint16_t*)sprite->data;
+	for (int i=0; i<32*32; i++)
+		pixels[i] = rand();
+
+	while (!(disp = display_lock())) {}
+	graphics_set_backend(GRAPHICS_BACKEND_CPU);
+
+	BENCH_LOOP(ctx) {
+		graphics_fill_screen(disp, graphics_make_color(0x20, 0x40, 0x80, 0xFF));
+	}
+	bench_report(ctx, "fill_screen", 320*240, "pixels/s");
+
+	BENCH_LOOP(ctx) {
+		graphics_draw_box(disp, 16, 16, 288, 208, graphics_make_color(0x80, 0x40, 0x20, 0xFF));
+	}
+	bench_report(ctx, "draw_box", 288*208, "pixels/s");
+
+	BENCH_LOOP(ctx) {
+		graphics_draw_box_trans(disp, 16, 16, 288, 208, graphics_make_color(0x80, 0x40, 0x20, 0x80));
+	}
+	bench_report(ctx, "draw_box_trans", 288*208, "pixels/s");
+
+	BENCH_LOOP(ctx) {
+		for (int y=0; y<224; y+=32)
+			for (int x=0; x<320; x+=32)
+				graphics_draw_sprite(disp, x, y, sprite);
+	}
+	bench_report(ctx, "draw_sprite", 10*7*32*32, "pixels/s");
+
+	BENCH_LOOP(ctx) {
+		for (int y=0; y<240; y+=8)
+			graphics_draw_text(disp, 0, y, text);
+	}
+	bench_report(ctx, "draw_text", 30*(sizeof(text)-1), "chars/s");
+
+	display_show(disp);
+	free(sprite);
+}
@@ -0,0 +1,25 @@
+void bench_joybus_exec(BenchContext *ctx) {
+	joybus_cmdlist_t list;
+	uint8_t out[JOYBUS_BLOCK_SIZE] __attribute__((aligned(8)));
+
+	// Read the buttons of the first controller, as controller_scan does
+	joybus_cmdlist_init(&list);
+	joybus_cmdlist_add(&list, 0, 0x01, NULL, 0, 4);
+	const void *block = joybus_cmdlist_block(&list);
+
+	BENCH_LOOP(ctx) {
+		joybus_exec(block, out);
+	}
+	bench_report(ctx, "read_buttons", 1, "transactions/s");
+
+	// Same transaction polling all four controllers
+	joybus_cmdlist_init(&list);
+	for (int ch=0; ch<4; ch++)
+		joybus_cmdlist_add(&list, ch, 0x01, NULL, 0, 4);
+	block = joybus_cmdlist_block(&list);
+
+	BENCH_LOOP(ctx) {
+		joybus_exec(block, out);
+	}
+	bench_report(ctx, "read_buttons_4ch", 1, "transactions/s");
+}
@@ -0,0 +1,49 @@
+// Looping 8-bit waveform generated in RAM
+#define BENCH_WAVE_LEN  1024
+static int8_t bench_wave_data[BENCH_WAVE_LEN + MIXER_LOOP_OVERREAD];
+
+static void bench_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
+	wpos %= BENCH_WAVE_LEN;
+	if (wlen > BENCH_WAVE_LEN + MIXER_LOOP_OVERREAD - wpos)
+		wlen = BENCH_WAVE_LEN + MIXER_LOOP_OVERREAD - wpos;
+	memcpy(samplebuffer_append(sbuf, wlen), bench_wave_data + wpos, wlen);
+}
+
+void bench_mixer_poll(BenchContext *ctx) {
+	static const int channels[] = { 1, 4, 8, 16, 32 };
+	static int16_t out[1024*2] __attribute__((aligned(16)));
+
+	audio_init(44100, 4);
+	mixer_init(32);
+
+	for (int i=0; i<BENCH_WAVE_LEN + MIXER_LOOP_OVERREAD; i++)
+		bench_wave_data[i] = (int8_t)(rand() >> 24);
+
+	waveform_t wave = {
+		.name = "bench", .bits = 8, .channels = 1, .frequency = 22050,
+		.len = BENCH_WAVE_LEN, .loop_len = BENCH_WAVE_LEN,
+		.read = bench_wave_read, .ctx = NULL,
+	};
+
+	for (int c=0; c<sizeof(channels)/sizeof(channels[0]); c++) {
+		char variant[16];
+
+		// Each channel plays at a different frequency, so that they all resample
+		for (int ch=0; ch<channels[c]; ch++) {
+			mixer_ch_play(ch, &wave);
+			mixer_ch_set_freq(ch, 11025 + ch * 1000);
+		}
+
+		BENCH_LOOP(ctx) {
+			mixer_poll(out, 1024);
+		}
+		snprintf(variant, sizeof(variant), "%dch", channels[c]);
+		bench_report(ctx, variant, 1024, "samples/s");
+
+		for (int ch=0; ch<channels[c]; ch++)
+			mixer_ch_stop(ch);
+	}
+
+	mixer_close();
+	audio_close();
+}
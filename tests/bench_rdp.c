@@ -0,0 +1,63 @@
+void bench_rdp_fill(BenchContext *ctx) {
+	display_context_t disp;
+
+	rdp_init();
+
+	// Only time the RDP work: waiting for a free framebuffer depends on the VI
+	while (!(disp = display_lock())) {}
+	rdp_attach_display(disp);
+
+	BENCH_LOOP(ctx) {
+		rdp_enable_primitive_fill();
+		rdp_set_primitive_color(graphics_make_color(0x20, 0x40, 0x80, 0xFF));
+		for (int i=0; i<4; i++)
+			rdp_draw_filled_rectangle(0, 0, 319, 239);
+		rdp_wait_idle();
+	}
+
+	rdp_detach_display();
+	display_show(disp);
+	bench_report(ctx, "fill", 320*240*4, "pixels/s");
+
+	rdp_close();
+}
+
+void bench_rdp_texture(BenchContext *ctx) {
+	display_context_t disp;
+
+	// 32x32 16-bit sprite, which fits TMEM
+	sprite_t *sprite = memalign(16, sizeof(sprite_t) + 32*32*2);
+	assertf(sprite, "cannot allocate the sprite");
+	sprite->width = 32;
+	sprite->height = 32;
+	sprite->bitdepth = 2;
+	sprite->format = SPRITE_FORMAT_RGBA;
+	sprite->hslices = 1;
+	sprite->vslices = 1;
+	uint16_t *pixels = (uint16_t*)sprite->data;
+	for (int i=0; i<32*32; i++)
+		pixels[i] = rand() | 1;
+	data_cache_hit_writeback(sprite, sizeof(sprite_t) + 32*32*2);
+
+	rdp_init();
+
+	while (!(disp = display_lock())) {}
+	rdp_attach_display(disp);
+
+	// Texture loads and copies of the sprite covering the screen
+	BENCH_LOOP(ctx) {
+		rdp_enable_texture_copy();
+		rdp_load_texture(0, 0, MIRROR_DISABLED, sprite);
+		for (int y=0; y<224; y+=32)
+			for (int x=0; x<320; x+=32)
+				rdp_draw_sprite(0, x, y, MIRROR_DISABLED);
+		rdp_wait_idle();
+	}
+
+	rdp_detach_display();
+	display_show(disp);
+	bench_report(ctx, "copy", 10*7*32*32, "pixels/s");
+
+	rdp_close();
+	free(sprite);
+}
@@ -0,0 +1,34 @@
+static volatile int bench_timer_count;
+
+static void bench_timer_callback(int ovfl) {
+	bench_timer_count++;
+}
+
+// Fixed amount of CPU work, that interrupts make longer
+static void __attribute__((noinline)) bench_timer_work(void) {
+	for (volatile int i=0; i<20000; i++) {}
+}
+
+void bench_timer_interrupt(BenchContext *ctx) {
+	timer_init();
+
+	BENCH_LOOP(ctx) {
+		bench_timer_work();
+	}
+	uint32_t base = bench_median(ctx);
+
+	// Same work, interrupted by a timer at 10 kHz
+	bench_timer_count = 0;
+	timer_link_t *t = new_timer(TIMER_TICKS(100), TF_CONTINUOUS, bench_timer_callback);
+	BENCH_LOOP(ctx) {
+		bench_timer_work();
+	}
+	delete_timer(t);
+
+	float interrupts = (float)bench_timer_count / (BENCH_ITERATIONS + 1);
+	uint32_t loaded = bench_median(ctx);
+	float overhead = loaded > base ? TICKS_TO_US(loaded - base) / interrupts : 0;
+	bench_result(ctx, "overhead", overhead, "us/interrupt");
+
+	timer_close();
+}
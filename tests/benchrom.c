@@ -0,0 +1,132 @@
+#include <libdragon.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+/**********************************************************************
+ * SIMPLE BENCHMARK FRAMEWORK
+ **********************************************************************/
+
+// Number of measured runs of each benchmark (after a warm-up run)
+#define BENCH_ITERATIONS  16
+
+typedef struct {
+	const char *name;
+	uint32_t ticks[BENCH_ITERATIONS];
+	int count;
+} BenchContext;
+
+typedef void (*BenchFunc)(BenchContext *ctx);
+
+// BENCH_LOOP(ctx): run the following block once to warm up the caches, then
+// BENCH_ITERATIONS more times, measuring the ticks of each run.
+#define BENCH_LOOP(ctx) \
+	for (int __iter = ((ctx)->count = 0, -1); __iter < BENCH_ITERATIONS; __iter++) \
+		for (uint32_t __start = TICKS_READ(), __once = 1; __once; __once = 0, \
+			__iter >= 0 ? (void)((ctx)->ticks[(ctx)->count++] = TICKS_READ() - __start) : (void)0)
+
+// Convert CPU ticks to microseconds, keeping the fractional part
+#define TICKS_TO_US(t)  ((float)(t) * 1000000.0f / (float)TICKS_PER_SECOND)
+
+static int cmp_ticks(const void *a, const void *b) {
+	uint32_t ta = *(const uint32_t*)a, tb = *(const uint32_t*)b;
+	return ta < tb ? -1 : ta > tb;
+}
+
+// Median ticks of the runs of the last BENCH_LOOP
+static uint32_t bench_median(BenchContext *ctx) {
+	uint32_t sorted[BENCH_ITERATIONS];
+	memcpy(sorted, ctx->ticks, ctx->count * sizeof(uint32_t));
+	qsort(sorted, ctx->count, sizeof(uint32_t), cmp_ticks);
+	return sorted[ctx->count / 2];
+}
+
+// Print a result line, in CSV format:
+//   BENCH,name,variant,iterations,min_us,median_us,max_us,value,unit
+static void bench_result(BenchContext *ctx, const char *variant, float value, const char *unit) {
+	uint32_t sorted[BENCH_ITERATIONS];
+	memcpy(sorted, ctx->ticks, ctx->count * sizeof(uint32_t));
+	qsort(sorted, ctx->count, sizeof(uint32_t), cmp_ticks);
+
+	char line[160];
+	snprintf(line, sizeof(line), "BENCH,%s,%s,%d,%.2f,%.2f,%.2f,%.2f,%s\n",
+		ctx->name, variant, ctx->count, TICKS_TO_US(sorted[0]),
+		TICKS_TO_US(sorted[ctx->count / 2]), TICKS_TO_US(sorted[ctx->count - 1]),
+		value, unit);
+	printf("%s", line);
+	debugf("%s", line);
+}
+
+// Report the rate of the last BENCH_LOOP: "work" units were processed by each run
+static void bench_report(BenchContext *ctx, const char *variant, float work, const char *unit) {
+	bench_result(ctx, variant, work / (TICKS_TO_US(bench_median(ctx)) / 1000000.0f), unit);
+}
+
+/**********************************************************************
+ * BENCHMARK FILES
+ **********************************************************************/
+
+#include "bench_dfs.c"
+#include "bench_dma.c"
+#include "bench_mixer.c"
+#include "bench_rdp.c"
+#include "bench_graphics.c"
+#include "bench_joybus.c"
+#include "bench_timer.c"
+
+/**********************************************************************
+ * MAIN
+ **********************************************************************/
+
+#define BENCH_FUNC(fn)   { #fn, fn }
+static const struct Benchsuite
+{
+	const char *name;
+	BenchFunc fn;
+} benchmarks[] = {
+	BENCH_FUNC(bench_dfs_read),
+	BENCH_FUNC(bench_dma_read),
+	BENCH_FUNC(bench_mixer_poll),
+	BENCH_FUNC(bench_rdp_fill),
+	BENCH_FUNC(bench_rdp_texture),
+	BENCH_FUNC(bench_graphics_draw),
+	BENCH_FUNC(bench_joybus_exec),
+	BENCH_FUNC(bench_timer_interrupt),
+};
+
+int main() {
+	init_interrupts();
+
+	// 16-bit, so that the RDP can copy 16-bit textures to the framebuffer
+	display_init(RESOLUTION_320x240, DEPTH_16_BPP, 3, GAMMA_NONE, ANTIALIAS_RESAMPLE);
+	console_init();
+	console_set_debug(false);
+	debug_init_isviewer();
+	debug_init_usblog();
+
+	if (dfs_init( DFS_DEFAULT_LOCATION ) != DFS_ESUCCESS) {
+		printf("Invalid ROM: cannot initialize DFS\n");
+		return 0;
+	}
+
+	printf("libdragon benchmarks\n\n");
+	printf("BENCH,name,variant,iterations,min_us,median_us,max_us,value,unit\n");
+	debugf("BENCH,name,variant,iterations,min_us,median_us,max_us,value,unit\n");
+
+	const int NUM_BENCHMARKS = sizeof(benchmarks) / sizeof(benchmarks[0]);
+	for (int i=0; i < NUM_BENCHMARKS; i++) {
+		BenchContext ctx;
+		ctx.name = benchmarks[i].name + strlen("bench_");
+		ctx.count = 0;
+
+		// Start each benchmark with the same cache state
+		data_cache_writeback_invalidate_all();
+		inst_cache_invalidate_all();
+
+		benchmarks[i].fn(&ctx);
+	}
+
+	printf("\nBenchmarks finished\n");
+	debugf("BENCH,done\n");
+}
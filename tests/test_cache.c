@@ -56,3 +56,39 @@ void test_cache_invalidate(TestContext *ctx) {
 		}
 	}
 }
+
+void test_cache_malloc_uncached(TestContext *ctx) {
+	// Leave dirty lines in the cache for the memory that malloc_uncached
+	// is likely to return.
+	uint8_t *cached = malloc(64);
+	memset(cached, 0x55, 64);
+	free(cached);
+
+	uint8_t *buf = malloc_uncached(40);
+	ASSERT(buf != NULL, "malloc_uncached failed");
+	DEFER(free_uncached(buf));
+	ASSERT_EQUAL_HEX((uint32_t)buf & 0xE000000F, 0xA0000000, "buffer is not uncached and aligned");
+
+	memset(buf, 0xAA, 40);
+
+	// Writing back the whole cache must not overwrite the buffer.
+	data_cache_writeback_invalidate_all();
+	for (int i=0;i<40;i++)
+		ASSERT_EQUAL_HEX(buf[i], 0xAA, "buffer overwritten by the cache at %d", i);
+}
+
+void test_cache_writeback_large(TestContext *ctx) {
+	// Large enough to go through the index ops
+	const int size = 32*1024;
+	uint8_t *buf = memalign(16, size);
+	DEFER(free(buf));
+
+	for (int i=0;i<size;i++) buf[i] = i ^ (i >> 8);
+	data_cache_hit_writeback(buf, size);
+
+	uint8_t *ubuf = UncachedAddr(buf);
+	for (int i=0;i<size;i++) {
+		if (ubuf[i] != (uint8_t)(i ^ (i >> 8)))
+			ASSERT_EQUAL_HEX(ubuf[i], (uint8_t)(i ^ (i >> 8)), "data not written back at %d", i);
+	}
+}
@@ -0,0 +1,41 @@
+void test_controller_pack(TestContext *ctx) {
+	struct controller_data data;
+	controller_packed_t packed;
+
+	memset(&data, 0, sizeof(data));
+	data.c[0].A = 1;
+	data.c[0].start = 1;
+	data.c[0].x = -100;
+	data.c[0].y = 50;
+	data.c[1].R = 1;
+	data.c[1].C_right = 1;
+	// A controller that did not answer is packed as released
+	data.c[2].err = ERROR_NOT_PRESENT;
+	data.c[2].data = 0xFFFFFFFF;
+	data.c[3].Z = 1;
+	data.c[3].left = 1;
+
+	controller_pack(&data, &packed);
+	ASSERT_EQUAL_HEX(CONTROLLER_PACKED_PORT(packed.buttons, 0), CONTROLLER_BUTTON_A | CONTROLLER_BUTTON_START, "wrong buttons of controller 0");
+	ASSERT_EQUAL_HEX(CONTROLLER_PACKED_PORT(packed.buttons, 1), CONTROLLER_BUTTON_R | CONTROLLER_BUTTON_C_RIGHT, "wrong buttons of controller 1");
+	ASSERT_EQUAL_HEX(CONTROLLER_PACKED_PORT(packed.buttons, 2), 0, "missing controller not released");
+	ASSERT_EQUAL_HEX(CONTROLLER_PACKED_PORT(packed.buttons, 3), CONTROLLER_BUTTON_Z | CONTROLLER_BUTTON_LEFT, "wrong buttons of controller 3");
+	ASSERT_EQUAL_HEX(packed.buttons & CONTROLLER_PACKED_ALL(CONTROLLER_BUTTON_A),
+		(uint64_t)CONTROLLER_BUTTON_A << CONTROLLER_PACKED_SHIFT(0), "wrong A buttons of all controllers");
+	ASSERT_EQUAL_SIGNED(packed.x[0], -100, "wrong stick X");
+	ASSERT_EQUAL_SIGNED(packed.y[0], 50, "wrong stick Y");
+	ASSERT_EQUAL_SIGNED(packed.x[2], 0, "missing controller has a stick X");
+	ASSERT_EQUAL_SIGNED(packed.y[2], 0, "missing controller has a stick Y");
+
+	// Whatever the controllers connected, the packed changes split the current buttons
+	controller_init();
+	controller_scan();
+	controller_scan();
+	get_keys_packed(&packed);
+	uint64_t down = get_keys_down_packed();
+	uint64_t up = get_keys_up_packed();
+	uint64_t held = get_keys_held_packed();
+	ASSERT_EQUAL_HEX(down | held, packed.buttons, "pressed buttons neither down nor held");
+	ASSERT_EQUAL_HEX(down & held, 0, "buttons both down and held");
+	ASSERT_EQUAL_HEX(up & packed.buttons, 0, "pressed buttons released");
+}
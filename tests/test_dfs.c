@@ -88,3 +88,335 @@ void test_dfs_rom_addr(TestContext *ctx) {
 
 	ASSERT_EQUAL_MEM(buf1, buf2, 128, "DMA ROM access is different");
 }
+
+void test_dfs_rom_desc(TestContext *ctx) {
+	int fh = dfs_open("counter.dat");
+	ASSERT(fh >= 0, "counter.dat not found");
+	DEFER(dfs_close(fh));
+
+	uint8_t buf1[128] __attribute__((aligned(16)));
+	uint8_t buf2[128] __attribute__((aligned(16)));
+
+	dfs_seek(fh, 256, SEEK_SET);
+	dfs_read(buf1, 1, 128, fh);
+
+	dfs_rom_desc_t desc, desc2;
+	ASSERT_EQUAL_SIGNED(dfs_rom_desc("counter.dat", &desc), DFS_ESUCCESS, "dfs_rom_desc failed");
+	ASSERT_EQUAL_HEX(desc.rom_addr, dfs_rom_addr("counter.dat"), "invalid ROM address");
+	ASSERT_EQUAL_UNSIGNED(desc.size, 4096, "invalid size");
+
+	ASSERT_EQUAL_SIGNED(dfs_rom_desc_handle(fh, &desc2), DFS_ESUCCESS, "dfs_rom_desc_handle failed");
+	ASSERT_EQUAL_HEX(desc2.rom_addr, desc.rom_addr, "invalid ROM address from handle");
+	ASSERT_EQUAL_UNSIGNED(desc2.size, desc.size, "invalid size from handle");
+
+	ASSERT_EQUAL_SIGNED(dfs_rom_desc("notfound.dat", &desc2), DFS_ENOFILE, "missing file found");
+
+	ASSERT_EQUAL_HEX(dfs_rom_io_read(&desc, 256), *(uint32_t*)buf1, "direct ROM word is different");
+	ASSERT_EQUAL_HEX(dfs_rom_io_read(&desc, 256+124), *(uint32_t*)(buf1+124), "direct ROM word is different");
+
+	dma_request_t req;
+	data_cache_hit_writeback_invalidate(buf2, sizeof(buf2));
+	dfs_rom_dma(&req, &desc, 256, buf2, 128, DMA_PRIORITY_NORMAL, NULL, NULL);
+	dma_request_wait(&req);
+
+	ASSERT_EQUAL_MEM(buf1, buf2, 128, "DMA from descriptor is different");
+}
+
+void test_dfs_read_async(TestContext *ctx) {
+	int fh = dfs_open("counter.dat");
+	ASSERT(fh >= 0, "counter.dat not found");
+	DEFER(dfs_close(fh));
+
+	uint8_t exp[256] __attribute__((aligned(16)));
+	uint8_t buf[256+16] __attribute__((aligned(16)));
+	volatile int done;
+
+	void cb(uint32_t handle, int read, void *arg) {
+		ASSERT_EQUAL_SIGNED(handle, fh, "invalid handle in callback");
+		*(volatile int*)arg = read;
+	}
+
+	dfs_read(exp, 1, sizeof(exp), fh);
+
+	// Aligned read: direct DMA. Unaligned read: bounced through the file cache.
+	for (int misalign=0; misalign<2; misalign++) {
+		uint8_t *dst = buf + misalign*3;
+		memset(buf, 0xAA, sizeof(buf));
+
+		dfs_seek(fh, 0, SEEK_SET);
+		done = -1;
+		int ret = dfs_read_async(fh, dst, 256, cb, (void*)&done);
+		ASSERT_EQUAL_SIGNED(ret, 256, "invalid async read length");
+
+		while (dfs_read_async_busy(fh)) {}
+		ASSERT_EQUAL_SIGNED(done, 256, "callback not called (misalign:%d)", misalign);
+		ASSERT_EQUAL_MEM(dst, exp, 256, "invalid async read data (misalign:%d)", misalign);
+		ASSERT_EQUAL_SIGNED(dfs_tell(fh), 256, "invalid position after async read");
+	}
+}
+
+void test_dfs_dir_cache(TestContext *ctx) {
+	// Restore the default configuration at the end of the test
+	DEFER(dfs_init(DFS_DEFAULT_LOCATION));
+
+	uint32_t exp = dfs_rom_addr("counter.dat");
+	ASSERT(exp != 0, "counter.dat not found");
+
+	// Uncached, tiny cache (heavy eviction), large cache
+	static const int sizes[] = { 0, 1, 64 };
+	for (int i=0; i<3; i++) {
+		int ret = dfs_init_with_cache(DFS_DEFAULT_LOCATION, sizes[i]);
+		ASSERT_EQUAL_SIGNED(ret, DFS_ESUCCESS, "dfs_init_with_cache failed (%d)", sizes[i]);
+
+		for (int j=0; j<4; j++) {
+			ASSERT_EQUAL_HEX(dfs_rom_addr("counter.dat"), exp, "invalid lookup (%d/%d)", sizes[i], j);
+			ASSERT(dfs_rom_addr("random.dat") != 0, "random.dat not found (%d/%d)", sizes[i], j);
+			ASSERT(dfs_rom_addr("missing.dat") == 0, "missing.dat found (%d/%d)", sizes[i], j);
+		}
+	}
+}
+
+void test_dfs_index(TestContext *ctx) {
+	// "./" forces a directory walk, while plain paths go through the
+	// path index (testrom.dfs is built with mkdfs --index).
+	static const char *files[] = { "counter.dat", "random.dat" };
+	for (int i=0; i<2; i++) {
+		char walk[64];
+		sprintf(walk, "./%s", files[i]);
+
+		uint32_t rom_index = dfs_rom_addr(files[i]);
+		uint32_t rom_walk = dfs_rom_addr(walk);
+		ASSERT(rom_walk != 0, "%s not found", walk);
+		ASSERT_EQUAL_HEX(rom_index, rom_walk, "index lookup mismatch for %s", files[i]);
+
+		char abs[64];
+		sprintf(abs, "//%s", files[i]);
+		ASSERT_EQUAL_HEX(dfs_rom_addr(abs), rom_walk, "index lookup mismatch for %s", abs);
+	}
+
+	ASSERT(dfs_rom_addr("missing.dat") == 0, "missing.dat found");
+	ASSERT(dfs_rom_addr("counter.dat/x") == 0, "counter.dat/x found");
+}
+
+void test_dfs_order(TestContext *ctx) {
+	// testrom.dfs is built with mkdfs --order testrom.order, which places
+	// random.dat and then counter.dat before the directory tree. The walk
+	// from the root must still find every file.
+	uint32_t rom_random = dfs_rom_addr("./random.dat");
+	uint32_t rom_counter = dfs_rom_addr("./counter.dat");
+	ASSERT(rom_random != 0, "random.dat not found");
+	ASSERT(rom_counter != 0, "counter.dat not found");
+	ASSERT_EQUAL_HEX(rom_counter, rom_random + 8192, "manifest files are not contiguous");
+
+	ASSERT(dfs_rom_addr("./assets.bundle") != 0, "assets.bundle not found");
+
+	int fh = dfs_open("./counter.dat");
+	ASSERT(fh >= 0, "counter.dat not found");
+	DEFER(dfs_close(fh));
+
+	uint8_t buf[16] __attribute__((aligned(16)));
+	dfs_seek(fh, 256+4, SEEK_SET);
+	dfs_read(buf, 1, 8, fh);
+	ASSERT_EQUAL_MEM(buf, (uint8_t*)"\x04\x05\x06\x07\x08\x09\x0a\x0b", 8, "invalid read");
+}
+
+void test_dfs_readahead(TestContext *ctx) {
+	int fh = dfs_open("random.dat");
+	ASSERT(fh >= 0, "random.dat not found");
+	DEFER(dfs_close(fh));
+
+	static uint8_t exp[8192] __attribute__((aligned(16)));
+	static uint8_t window[4096] __attribute__((aligned(16)));
+	dfs_read(exp, 1, sizeof(exp), fh);
+
+	ASSERT_EQUAL_SIGNED(dfs_set_readahead(fh, window+8, 1024, false), DFS_EBADINPUT, "misaligned buffer accepted");
+	ASSERT_EQUAL_SIGNED(dfs_set_readahead(fh, window, 1040, true), DFS_EBADINPUT, "invalid prefetch size accepted");
+
+	for (int prefetch=0; prefetch<2; prefetch++) {
+		ASSERT_EQUAL_SIGNED(dfs_set_readahead(fh, window, sizeof(window), prefetch), DFS_ESUCCESS,
+			"dfs_set_readahead failed");
+
+		// Sequential small reads at odd offsets (never on the direct DMA path)
+		dfs_seek(fh, 1, SEEK_SET);
+		for (int pos=1; pos<8192-16; pos+=13) {
+			uint8_t buf[16];
+			ASSERT_EQUAL_SIGNED(dfs_read(buf, 1, 13, fh), 13, "short read");
+			ASSERT_EQUAL_MEM(buf, exp+pos, 13, "invalid data at %d (prefetch:%d)", pos, prefetch);
+		}
+
+		// Random seeks
+		for (int i=0; i<64; i++) {
+			uint8_t buf[16];
+			int pos = RANDN(8192-16) | 1;
+			dfs_seek(fh, pos, SEEK_SET);
+			dfs_read(buf, 1, 7, fh);
+			ASSERT_EQUAL_MEM(buf, exp+pos, 7, "invalid data at %d (prefetch:%d)", pos, prefetch);
+		}
+	}
+
+	ASSERT_EQUAL_SIGNED(dfs_set_readahead(fh, NULL, 0, false), DFS_ESUCCESS, "cannot revert to internal buffer");
+}
+
+void test_dfs_fopen(TestContext *ctx) {
+	int fh = dfs_open("random.dat");
+	ASSERT(fh >= 0, "random.dat not found");
+	static uint8_t exp[8192] __attribute__((aligned(16)));
+	dfs_read(exp, 1, sizeof(exp), fh);
+	dfs_close(fh);
+
+	FILE *f = dfs_fopen("random.dat", "rb");
+	ASSERT(f != NULL, "dfs_fopen failed");
+	DEFER(fclose(f));
+
+	uint8_t *buf = dfs_alloc_buffer(4095);
+	ASSERT(buf != NULL, "dfs_alloc_buffer failed");
+	DEFER(free(buf));
+	ASSERT(((uint32_t)buf & 15) == 0, "misaligned buffer");
+
+	// Small read, then a large read straight into the aligned buffer
+	uint8_t head[6];
+	ASSERT_EQUAL_UNSIGNED(fread(head, 1, sizeof(head), f), sizeof(head), "short read");
+	ASSERT_EQUAL_MEM(head, exp, sizeof(head), "invalid data");
+	ASSERT_EQUAL_UNSIGNED(fread(buf, 1, 4090, f), 4090, "short read");
+	ASSERT_EQUAL_MEM(buf, exp+6, 4090, "invalid data");
+	ASSERT_EQUAL_SIGNED(ftell(f), 4096, "wrong position");
+}
+
+void test_dfs_bundle(TestContext *ctx) {
+	int size = bundle_size("assets.bundle");
+	ASSERT(size > 0, "assets.bundle not found");
+
+	bundle_t *b = bundle_load("assets.bundle", NULL);
+	ASSERT(b != NULL, "bundle_load failed");
+	DEFER(free(b));
+	ASSERT_EQUAL_UNSIGNED(b->num_files, 2, "wrong number of files");
+	ASSERT_EQUAL_UNSIGNED(b->size, size, "wrong bundle size");
+
+	uint32_t len;
+	const char *a = bundle_get(b, "a.txt", &len);
+	ASSERT(a != NULL, "a.txt not found");
+	ASSERT(((uint32_t)a & 15) == 0, "misaligned member");
+	ASSERT_EQUAL_UNSIGNED(len, 13, "wrong size of a.txt");
+	ASSERT_EQUAL_MEM((uint8_t*)a, (uint8_t*)"first member\n", 13, "invalid data in a.txt");
+
+	const char *sub = bundle_get(b, "sub/b.txt", &len);
+	ASSERT(sub != NULL, "sub/b.txt not found");
+	ASSERT(((uint32_t)sub & 15) == 0, "misaligned member");
+	ASSERT_EQUAL_UNSIGNED(len, 33, "wrong size of sub/b.txt");
+	ASSERT_EQUAL_MEM((uint8_t*)sub, (uint8_t*)"second member, in a subdirectory\n", 33, "invalid data in sub/b.txt");
+
+	ASSERT(bundle_get(b, "missing.txt", NULL) == NULL, "missing file found");
+
+	// Load it again from an arena
+	arena_t arena;
+	ASSERT_EQUAL_SIGNED(arena_init(&arena, NULL, size + 16), 0, "arena_init failed");
+	DEFER(arena_close(&arena));
+	arena_alloc(&arena, 1);
+
+	bundle_t *b2 = bundle_load("assets.bundle", &arena);
+	ASSERT(b2 != NULL, "bundle_load from an arena failed");
+	ASSERT(((uint32_t)b2 & 15) == 0, "misaligned bundle");
+	ASSERT(bundle_get(b2, "sub/b.txt", &len) != NULL, "sub/b.txt not found");
+	ASSERT_EQUAL_UNSIGNED(len, 33, "wrong size of sub/b.txt");
+}
+
+void test_dfs_asset(TestContext *ctx) {
+	asset_init(8192 + 4096);
+	DEFER(asset_close());
+
+	// Concurrent requests of the same file share the asset
+	asset_t *a = asset_get("counter.dat");
+	asset_t *b = asset_get("counter.dat");
+	ASSERT(a != NULL && a == b, "requests not deduplicated");
+	asset_t *r = asset_get("random.dat");
+	asset_t *m = asset_get("missing.dat");
+
+	ASSERT_EQUAL_SIGNED(asset_wait(a), DFS_ESUCCESS, "counter.dat not loaded");
+	ASSERT_EQUAL_SIGNED(asset_wait(r), DFS_ESUCCESS, "random.dat not loaded");
+	ASSERT_EQUAL_SIGNED(asset_wait(m), DFS_ENOFILE, "missing.dat loaded");
+	asset_release(m);
+
+	int size;
+	uint8_t *data = asset_data(a, &size);
+	ASSERT_EQUAL_SIGNED(size, 4096, "wrong size of counter.dat");
+	ASSERT(((uint32_t)data & 15) == 0, "misaligned asset");
+	ASSERT_EQUAL_MEM(data, (uint8_t*)"\x00\x01\x02\x03\x04\x05\x06\x07", 8, "invalid data in counter.dat");
+
+	// Unreferenced assets are kept within the budget
+	asset_release(a);
+	asset_release(b);
+	asset_release(r);
+	asset_stats_t stats;
+	asset_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.count, 2, "unreferenced assets dropped");
+	ASSERT_EQUAL_UNSIGNED(stats.cached, 8192 + 4096, "wrong cached size");
+
+	a = asset_get("counter.dat");
+	ASSERT(asset_ready(a), "cached asset not ready");
+	asset_release(a);
+
+	// Loading another file evicts the least recently released one (random.dat)
+	asset_t *c = asset_get("assets.bundle");
+	ASSERT_EQUAL_SIGNED(asset_wait(c), DFS_ESUCCESS, "assets.bundle not loaded");
+	asset_release(c);
+	asset_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.evictions, 1, "wrong number of evictions");
+	a = asset_get("counter.dat");
+	ASSERT(asset_ready(a), "most recently used asset evicted");
+	asset_release(a);
+}
+
+void test_dfs_open_files(TestContext *ctx) {
+	DEFER(dfs_set_max_open_files(MAX_OPEN_FILES));
+	ASSERT_EQUAL_SIGNED(dfs_set_max_open_files(16), DFS_ESUCCESS, "dfs_set_max_open_files failed");
+
+	int fh[17];
+	for (int i=0; i<16; i++) {
+		fh[i] = dfs_open("counter.dat");
+		ASSERT(fh[i] > 0, "cannot open file %d", i);
+	}
+	fh[16] = dfs_open("counter.dat");
+	ASSERT_EQUAL_SIGNED(fh[16], DFS_ENOMEM, "too many files open");
+	ASSERT_EQUAL_SIGNED(dfs_set_max_open_files(4), DFS_EBADINPUT, "table resized with open files");
+
+	uint8_t buf[4];
+	dfs_seek(fh[9], 12, SEEK_SET);
+	dfs_read(buf, 1, 4, fh[9]);
+	ASSERT_EQUAL_MEM(buf, (uint8_t*)"\x0c\x0d\x0e\x0f", 4, "invalid data read");
+
+	// A closed handle is not valid anymore, even once its slot is reused
+	int stale = fh[3];
+	dfs_close(stale);
+	fh[3] = dfs_open("counter.dat");
+	ASSERT(fh[3] > 0 && fh[3] != stale, "invalid handle of a reused slot");
+	ASSERT_EQUAL_SIGNED(dfs_size(stale), DFS_EBADHANDLE, "stale handle accepted");
+
+	for (int i=0; i<16; i++)
+		dfs_close(fh[i]);
+}
+
+void test_dfs_mount(TestContext *ctx) {
+	// Mount the test image a second time, as if it were a DLC
+	ASSERT_EQUAL_SIGNED(dfs_mount("dlc:/", DFS_DEFAULT_LOCATION), DFS_ESUCCESS, "dfs_mount failed");
+	DEFER(dfs_unmount("dlc:/"));
+	ASSERT_EQUAL_SIGNED(dfs_mount("dlc:/", DFS_DEFAULT_LOCATION), DFS_EBADINPUT, "prefix mounted twice");
+	ASSERT_EQUAL_SIGNED(dfs_mount("bad:/", DFS_DEFAULT_LOCATION + 256), DFS_EBADFS, "invalid image mounted");
+
+	ASSERT_EQUAL_HEX(dfs_rom_addr("dlc:/counter.dat"), dfs_rom_addr("counter.dat"), "invalid lookup in mount");
+	ASSERT(dfs_rom_addr("dlc:/missing.dat") == 0, "missing.dat found in mount");
+
+	int fh = dfs_open("dlc:/counter.dat");
+	ASSERT(fh > 0, "cannot open file in mount");
+	DEFER(dfs_close(fh));
+	uint8_t buf[4];
+	dfs_seek(fh, 4, SEEK_SET);
+	dfs_read(buf, 1, 4, fh);
+	ASSERT_EQUAL_MEM(buf, (uint8_t*)"\x04\x05\x06\x07", 4, "invalid data read from mount");
+
+	FILE *f = fopen("dlc:/counter.dat", "rb");
+	ASSERT(f != NULL, "cannot fopen file in mount");
+	fseek(f, 8, SEEK_SET);
+	fread(buf, 1, 4, f);
+	fclose(f);
+	ASSERT_EQUAL_MEM(buf, (uint8_t*)"\x08\x09\x0a\x0b", 4, "invalid data read through newlib");
+}
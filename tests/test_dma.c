@@ -25,3 +25,53 @@ void test_dma_read_misalign(TestContext *ctx) {
 		}
 	}
 }
+
+void test_dma_queue(TestContext *ctx) {
+	uint32_t rom = dfs_rom_addr("random.dat");
+	ASSERT(rom != 0, "random.dat not found");
+
+	static uint8_t exp[8192] __attribute__((aligned(16)));
+	static uint8_t big[8192] __attribute__((aligned(16)));
+	static uint8_t small[64] __attribute__((aligned(16)));
+	static uint8_t scratch[4096] __attribute__((aligned(16)));
+
+	data_cache_hit_writeback_invalidate(exp, sizeof(exp));
+	dma_read(exp, rom, sizeof(exp));
+
+	int order = 0, big_done = 0, small_done = 0;
+	void cb(dma_request_t *req, void *arg) {
+		*(int*)arg = ++order;
+	}
+
+	dma_queue_reset_stats();
+	memset(big, 0xAA, sizeof(big));
+	memset(small, 0xAA, sizeof(small));
+	data_cache_hit_writeback_invalidate(big, sizeof(big));
+	data_cache_hit_writeback_invalidate(small, sizeof(small));
+
+	// Keep the PI busy with a raw transfer while queueing a large normal-priority
+	// request and a small high-priority one, so that neither can start before
+	// both are queued.
+	dma_request_t rbig, rsmall;
+	disable_interrupts();
+	dma_read_raw_async(UncachedAddr(scratch), rom, sizeof(scratch));
+	dma_queue_read(&rbig, big, rom, sizeof(big), DMA_PRIORITY_NORMAL, cb, &big_done);
+	dma_queue_read(&rsmall, small, rom+0x1000, sizeof(small), DMA_PRIORITY_HIGH, cb, &small_done);
+	ASSERT_EQUAL_SIGNED(dma_queue_depth(), 2, "invalid queue depth");
+	enable_interrupts();
+
+	dma_request_wait(&rbig);
+	dma_request_wait(&rsmall);
+	ASSERT(rbig.done && rsmall.done, "requests not complete");
+	ASSERT_EQUAL_SIGNED(dma_queue_depth(), 0, "queue not empty");
+	ASSERT(small_done > 0 && big_done > 0, "callbacks not called");
+	ASSERT(small_done < big_done, "high priority request did not complete first");
+
+	ASSERT_EQUAL_MEM(big, exp, sizeof(big), "invalid data (normal priority)");
+	ASSERT_EQUAL_MEM(small, exp+0x1000, sizeof(small), "invalid data (high priority)");
+
+	dma_queue_stats_t stats;
+	dma_queue_get_stats(&stats);
+	ASSERT_EQUAL_UNSIGNED(stats.requests[DMA_PRIORITY_HIGH], 1, "invalid stats");
+	ASSERT_EQUAL_UNSIGNED(stats.requests[DMA_PRIORITY_NORMAL], 1, "invalid stats");
+}
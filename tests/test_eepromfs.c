@@ -99,3 +99,90 @@ void test_eepromfs(TestContext *ctx) {
     eepfs_wipe();
     ASSERT(eepfs_verify_signature() == true, "expected valid eepfs signature"); 
 }
+
+void test_eepromfs_async(TestContext *ctx) {
+    // Skip these tests if no EEPROM is present
+    if (eeprom_total_blocks() == 0) {
+        SKIP("EEPROM not found; skipping eepfs tests");
+    }
+
+    uint8_t file_src[64] = {0};
+    uint8_t file_dst[64] = {0};
+
+    const eepfs_entry_t eeprom_files[] = {
+        { "/file1", sizeof(file_src) },
+    };
+
+    int result;
+
+    result = eepfs_init(eeprom_files, 1);
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs init failed");
+    DEFER(eepfs_close());
+    eepfs_wipe();
+
+    result = eepfs_enable_async();
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs async failed");
+
+    // Rewriting the same contents must not dirty any block
+    result = eepfs_write("file1", file_src, sizeof(file_src));
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs write failed");
+    ASSERT_EQUAL_SIGNED(eepfs_poll(), 0, "unchanged blocks were dirtied");
+
+    // Change only two of the eight blocks of the file
+    file_src[3] = 0x55;
+    file_src[40] = 0xAA;
+    result = eepfs_write("file1", file_src, sizeof(file_src));
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs write failed");
+    result = eepfs_read("file1", file_dst, sizeof(file_dst));
+    ASSERT_EQUAL_SIGNED(result, EEPFS_ESUCCESS, "eepfs read failed");
+    ASSERT_EQUAL_SIGNED(memcmp(file_src, file_dst, sizeof(file_src)), 0, "shadow write/read mismatch");
+
+    // Drain the writes in the background
+    unsigned long start = get_ticks_ms();
+    while ((result = eepfs_poll()) > 0) {
+        ASSERT(get_ticks_ms() - start < 1000, "background flush timed out");
+    }
+    ASSERT_EQUAL_SIGNED(result, 0, "background flush did not complete");
+
+    // Check that EEPROM has the new contents
+    uint8_t eeprom_buf[EEPROM_BLOCK_SIZE];
+    eeprom_read(1, eeprom_buf);
+    ASSERT_EQUAL_UNSIGNED(eeprom_buf[3], 0x55, "block 1 was not written");
+    eeprom_read(6, eeprom_buf);
+    ASSERT_EQUAL_UNSIGNED(eeprom_buf[0], 0xAA, "block 6 was not written");
+}
+
+void test_eepromfs_crc16(TestContext *ctx) {
+    const char check[] = "123456789";
+
+    // CRC-16/CCITT-FALSE check value
+    uint16_t crc = eepfs_crc16_update(EEPFS_CRC16_INIT, check, 9);
+    ASSERT_EQUAL_HEX(crc, 0x29B1, "invalid CRC-16");
+
+    // Incremental updates give the same checksum
+    crc = eepfs_crc16_update(EEPFS_CRC16_INIT, check, 4);
+    crc = eepfs_crc16_update(crc, check + 4, 5);
+    ASSERT_EQUAL_HEX(crc, 0x29B1, "invalid incremental CRC-16");
+}
+
+void test_eeprom_read_bytes(TestContext *ctx) {
+    if (eeprom_total_blocks() == 0) {
+        SKIP("EEPROM not found; skipping EEPROM read tests");
+    }
+
+    // Read the first 16 blocks one at a time
+    uint8_t blocks[16 * EEPROM_BLOCK_SIZE];
+    for (int i = 0; i < 16; i++)
+        eeprom_read(i, &blocks[i * EEPROM_BLOCK_SIZE]);
+
+    // Queued reads of unaligned ranges return the same bytes
+    uint8_t buf[16 * EEPROM_BLOCK_SIZE];
+    const size_t ranges[][2] = { { 0, 128 }, { 3, 2 }, { 5, 100 }, { 8, 8 }, { 17, 111 } };
+
+    for (int i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+        memset(buf, 0, sizeof(buf));
+        eeprom_read_bytes(buf, ranges[i][0], ranges[i][1]);
+        ASSERT_EQUAL_MEM(buf, &blocks[ranges[i][0]], ranges[i][1],
+            "mismatch reading %d bytes at %d", (int)ranges[i][1], (int)ranges[i][0]);
+    }
+}
@@ -327,4 +327,27 @@ void test_exception(TestContext *ctx) {
 #undef ASSERT_REG_GP
 #undef ASSERT_REG_FP_HANDLER
 #undef ASSERT_REG_GP_HANDLER
-#undef ASSERT_REG
\ No newline at end of file
+#undef ASSERT_REG
+
+void test_exception_fpu_denormal(TestContext *ctx) {
+    fpu_denormal_stats_t before, after;
+
+    exception_set_fpu_denormal_mode(FPU_DENORMAL_EMULATE);
+    DEFER(exception_set_fpu_denormal_mode(FPU_DENORMAL_TRAP));
+
+    // A denormalized input is flushed to zero by the exception handler
+    volatile float tiny = 0x1p-140f;
+    volatile float result;
+    exception_fpu_denormal_stats(&before);
+    result = tiny * 2.0f;
+    exception_fpu_denormal_stats(&after);
+    ASSERT(result == 0.0f, "denormalized input not flushed to zero");
+    ASSERT_EQUAL_UNSIGNED(after.count, before.count + 1, "denormalized input not counted");
+
+    // A denormalized result is flushed to zero by the FPU, without exceptions
+    volatile float small = 0x1p-70f;
+    result = small * small;
+    exception_fpu_denormal_stats(&before);
+    ASSERT(result == 0.0f, "denormalized result not flushed to zero");
+    ASSERT_EQUAL_UNSIGNED(before.count, after.count, "denormalized result raised an exception");
+}
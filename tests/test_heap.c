@@ -0,0 +1,96 @@
+
+void test_heap_arena(TestContext *ctx) {
+	uint8_t buf[256] __attribute__((aligned(8)));
+	arena_t arena;
+
+	int ret = arena_init(&arena, buf, sizeof(buf));
+	ASSERT_EQUAL_SIGNED(ret, 0, "arena_init failed");
+	DEFER(arena_close(&arena));
+
+	uint8_t *a = arena_alloc(&arena, 3);
+	uint8_t *b = arena_alloc(&arena, 5);
+	ASSERT(a == buf, "first allocation not at the start of the arena");
+	ASSERT(b == buf + ARENA_ALIGN, "allocation not aligned");
+
+	uint8_t *c = arena_alloc_aligned(&arena, 16, 64);
+	ASSERT(((uint32_t)c & 63) == 0, "aligned allocation not aligned");
+
+	ASSERT(arena_alloc(&arena, sizeof(buf)) == NULL, "allocation larger than the arena");
+	size_t high_water = arena.high_water;
+
+	// After a reset, the memory is reused
+	arena_reset(&arena);
+	ASSERT(arena_alloc(&arena, 3) == buf, "arena not reset");
+	ASSERT_EQUAL_UNSIGNED(arena.high_water, high_water, "high water mark lost by reset");
+}
+
+void test_heap_pool(TestContext *ctx) {
+	pool_t pool;
+
+	int ret = pool_init(&pool, NULL, 12, 4);
+	ASSERT_EQUAL_SIGNED(ret, 0, "pool_init failed");
+	DEFER(pool_close(&pool));
+	ASSERT_EQUAL_UNSIGNED(pool.object_size, 16, "object size not rounded up");
+
+	void *objs[4];
+	for (int i = 0; i < 4; i++) {
+		objs[i] = pool_alloc(&pool);
+		ASSERT(objs[i] != NULL, "pool_alloc failed");
+		ASSERT(((uint32_t)objs[i] & (ARENA_ALIGN-1)) == 0, "object not aligned");
+	}
+	ASSERT(pool_alloc(&pool) == NULL, "allocation from an empty pool");
+
+	pool_free(&pool, objs[2]);
+	ASSERT(pool_alloc(&pool) == objs[2], "released object not reused");
+	ASSERT_EQUAL_SIGNED(pool.high_water, 4, "wrong high water mark");
+}
+
+void test_heap_stats(TestContext *ctx) {
+	heap_stats_t before, after;
+
+	sys_get_heap_stats(&before);
+	ASSERT(before.total > 0 && before.total < get_memory_size(), "wrong heap size");
+
+	void *ptr = malloc(64*1024);
+	ASSERT(ptr != NULL, "malloc failed");
+	sys_get_heap_stats(&after);
+	free(ptr);
+
+	ASSERT(after.used >= before.used + 64*1024, "malloc not accounted for");
+	ASSERT(after.free <= before.free - 64*1024, "free bytes not updated");
+	ASSERT(after.high_water >= after.reserved, "high water mark below the heap end");
+}
+
+void test_heap_tags(TestContext *ctx) {
+	mem_tag_stats_t before, during, after;
+
+	sys_get_mem_tag_stats(MEM_TAG_USER, &before);
+	void *ptr = malloc_tagged(MEM_TAG_USER, 1000);
+	ASSERT(ptr != NULL, "malloc_tagged failed");
+	sys_get_mem_tag_stats(MEM_TAG_USER, &during);
+	free_tagged(MEM_TAG_USER, ptr);
+	sys_get_mem_tag_stats(MEM_TAG_USER, &after);
+
+	ASSERT(during.live >= before.live + 1000, "allocation not accounted for");
+	ASSERT_EQUAL_SIGNED(during.count, before.count + 1, "wrong number of allocations");
+	ASSERT(during.peak >= during.live, "peak below the live bytes");
+	ASSERT_EQUAL_UNSIGNED(after.live, before.live, "release not accounted for");
+	ASSERT_EQUAL_UNSIGNED(after.peak, during.peak, "peak not kept");
+}
+
+static __attribute__((noinline)) void __stack_use(int n) {
+	volatile uint8_t buf[1024];
+	buf[0] = n;
+	if (n > 0)
+		__stack_use(n-1);
+	buf[1] = buf[0];
+}
+
+void test_heap_stack_watermark(TestContext *ctx) {
+	sys_stack_paint();
+	size_t base = sys_get_stack_high_water();
+	ASSERT(base > 0 && base < 0x10000, "wrong stack usage after painting");
+
+	__stack_use(8);
+	ASSERT(sys_get_stack_high_water() >= base + 8*1024, "stack usage not detected");
+}
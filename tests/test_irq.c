@@ -43,3 +43,123 @@ void test_irq_reentrancy(TestContext *ctx) {
 	ASSERT(!fail_order, "invalid order of call of callbacks");
 	ASSERT(!fail_reentrant, "interrupt called while another interrupt was in progress");
 }
+
+void test_irq_handler_ctx(TestContext *ctx) {
+	volatile int calls[2] = {0};
+	volatile int order[2] = {0};
+	volatile int idx = 0;
+
+	void handler(void *arg) {
+		int i = (int*)arg - (int*)calls;
+		calls[i]++;
+		if (idx < 2) order[idx++] = i;
+	}
+
+	timer_init();
+	DEFER(timer_close());
+
+	// The same function can be registered with different contexts
+	ASSERT_EQUAL_SIGNED(register_interrupt_handler(INTERRUPT_TI, handler, (void*)&calls[0]), 0, "cannot register handler");
+	DEFER(unregister_interrupt_handler(INTERRUPT_TI, handler, (void*)&calls[0]));
+	ASSERT_EQUAL_SIGNED(register_interrupt_handler(INTERRUPT_TI, handler, (void*)&calls[1]), 0, "cannot register handler");
+
+	void cb(int ovfl) {}
+	timer_link_t *t = new_timer(TICKS_FROM_MS(1), TF_ONE_SHOT, cb);
+	DEFER(delete_timer(t));
+	wait_ms(3);
+
+	ASSERT(calls[0] > 0 && calls[1] > 0, "handlers not called (%d, %d)", calls[0], calls[1]);
+	ASSERT_EQUAL_SIGNED(order[0], 1, "last registered handler not called first");
+	ASSERT_EQUAL_SIGNED(order[1], 0, "first registered handler not called last");
+
+	// After unregistering, the handler with this context is not called anymore
+	unregister_interrupt_handler(INTERRUPT_TI, handler, (void*)&calls[1]);
+	int before = calls[1];
+	restart_timer(t);
+	wait_ms(3);
+	ASSERT_EQUAL_SIGNED(calls[1], before, "unregistered handler called");
+}
+
+void test_irq_stats(TestContext *ctx) {
+	volatile bool called = false;
+	void cb(int ovfl) { called = true; }
+
+	timer_init();
+	DEFER(timer_close());
+	interrupt_enable_stats(true);
+	DEFER(interrupt_enable_stats(false));
+
+	timer_link_t *t = new_timer(TICKS_FROM_MS(1), TF_ONE_SHOT, cb);
+	DEFER(delete_timer(t));
+	while (!called) {}
+
+	// A long critical section
+	disable_interrupts();
+	wait_ms(2);
+	enable_interrupts();
+
+	interrupt_stats_t stats;
+	interrupt_get_stats(&stats);
+
+	ASSERT(stats.sources[INTERRUPT_TI].count > 0, "timer interrupt not counted");
+	ASSERT(stats.sources[INTERRUPT_TI].max_ticks > 0, "timer handler not measured");
+	ASSERT(stats.max_disabled_ticks >= TICKS_FROM_MS(2), "critical section not measured: %lu", (unsigned long)stats.max_disabled_ticks);
+	ASSERT(stats.max_disabled_caller >= (void*)test_irq_stats, "invalid caller of the critical section");
+}
+
+void test_irq_fpu(TestContext *ctx) {
+	volatile bool called = false;
+	uint32_t fpr = 0x3F800000, fcr = 0;
+
+	// A handler that clobbers a caller-saved FPU register and the rounding mode
+	void cb(int ovfl) {
+		asm volatile ("mtc1 $0, $f4; ctc1 %0, $31" :: "r"(1));
+		called = true;
+	}
+
+	timer_init();
+	DEFER(timer_close());
+
+	uint32_t fcr_before;
+	asm volatile ("cfc1 %0, $31" : "=r"(fcr_before));
+	asm volatile ("mtc1 %0, $f4" :: "r"(fpr) : "$f4");
+
+	timer_link_t *t = new_timer(TICKS_FROM_MS(1), TF_ONE_SHOT, cb);
+	DEFER(delete_timer(t));
+	while (!called) {}
+
+	asm volatile ("mfc1 %0, $f4" : "=r"(fpr));
+	asm volatile ("cfc1 %0, $31" : "=r"(fcr));
+	ASSERT_EQUAL_HEX(fpr, 0x3F800000, "FPU register not preserved across the interrupt");
+	ASSERT_EQUAL_HEX(fcr, fcr_before, "FPU control register not preserved across the interrupt");
+}
+
+void test_irq_vi_line(TestContext *ctx) {
+	volatile int calls[2] = {0};
+	volatile uint32_t lines[2] = {0};
+	volatile int frames = 0;
+
+	void handler(void *arg) {
+		int i = (int*)arg - (int*)calls;
+		calls[i]++;
+		lines[i] = *(volatile uint32_t*)0xA4400010 & ~1;
+	}
+	void vblank(void *arg) { frames++; }
+
+	// The console keeps the VI running, with its interrupt at vblank
+	register_interrupt_handler_nofpu(INTERRUPT_VI, vblank, 0);
+	DEFER(unregister_interrupt_handler(INTERRUPT_VI, vblank, 0));
+	ASSERT_EQUAL_SIGNED(register_VI_line_handler(300, handler, (void*)&calls[1]), 0, "cannot register line handler");
+	DEFER(unregister_VI_line_handler(300, handler, (void*)&calls[1]));
+	ASSERT_EQUAL_SIGNED(register_VI_line_handler(100, handler, (void*)&calls[0]), 0, "cannot register line handler");
+	DEFER(unregister_VI_line_handler(100, handler, (void*)&calls[0]));
+
+	wait_ms(100);
+
+	ASSERT(calls[0] >= 3 && calls[1] >= 3, "line handlers not called (%d, %d)", calls[0], calls[1]);
+	ASSERT(lines[0] >= 100 && lines[0] < 300, "handler of line 100 called at line %lu", (unsigned long)lines[0]);
+	ASSERT(lines[1] >= 300, "handler of line 300 called at line %lu", (unsigned long)lines[1]);
+
+	// The handlers of the VI interrupt are still called once per frame
+	ASSERT(frames >= calls[0] - 1 && frames <= calls[0] + 1, "VI handlers called %d times in %d frames", frames, calls[0]);
+}
@@ -0,0 +1,129 @@
+
+static void memops_check(TestContext *ctx, void *(*cpy)(void*, const void*, size_t),
+	void *(*set)(void*, int, size_t), const char *name) {
+	static uint8_t src[160] __attribute__((aligned(16)));
+	static uint8_t dst[160] __attribute__((aligned(16)));
+	static uint8_t ref[160] __attribute__((aligned(16)));
+
+	for (int i=0;i<sizeof(src);i++) src[i] = i*7+3;
+
+	for (int s=0;s<16;s++) {
+		for (int d=0;d<16;d++) {
+			for (int n=0;n<=112;n++) {
+				// The guard bytes around the destination must be preserved,
+				// including those in the partial cachelines.
+				memset(dst, 0xEE, sizeof(dst));
+				memset(ref, 0xEE, sizeof(ref));
+				memcpy(ref+d, src+s, n);
+				void *ret = cpy(dst+d, src+s, n);
+				ASSERT(ret == dst+d, "%s: wrong return value", name);
+				ASSERT_EQUAL_MEM(dst, ref, sizeof(dst), "%s: copy %d bytes from %d to %d", name, n, s, d);
+			}
+		}
+	}
+
+	for (int d=0;d<16;d++) {
+		for (int n=0;n<=112;n++) {
+			memset(dst, 0xEE, sizeof(dst));
+			memset(ref, 0xEE, sizeof(ref));
+			memset(ref+d, 0x5A, n);
+			void *ret = set(dst+d, 0x125A, n);
+			ASSERT(ret == dst+d, "%s: wrong return value", name);
+			ASSERT_EQUAL_MEM(dst, ref, sizeof(dst), "%s: fill %d bytes at %d", name, n, d);
+		}
+	}
+}
+
+void test_memops(TestContext *ctx) {
+	memops_check(ctx, fast_memcpy, fast_memset, "fast");
+	if (ctx->result == TEST_FAILED) return;
+
+	memops_check(ctx, fast_memcpy_overwrite, fast_memset_overwrite, "overwrite");
+}
+
+void test_memops_overwrite_cache(TestContext *ctx) {
+	// No other code must run between the fill and the invalidation,
+	// otherwise the lines could be evicted and written back.
+	disable_interrupts();
+	DEFER(enable_interrupts());
+
+	uint8_t buf[64] __attribute__((aligned(16)));
+
+	// Put known data in RDRAM, and evict buf from the cache.
+	memset(buf, 0xAA, sizeof(buf));
+	data_cache_hit_writeback_invalidate(buf, sizeof(buf));
+
+	// Fill bytes [4..60): lines 1 and 2 are fully overwritten and must be
+	// created in the cache, while lines 0 and 3 are read from RDRAM.
+	fast_memset_overwrite(buf+4, 0x55, 56);
+	for (int i=0;i<sizeof(buf);i++) {
+		uint8_t exp = (i >= 4 && i < 60) ? 0x55 : 0xAA;
+		if (buf[i] != exp)
+			ASSERT_EQUAL_HEX(buf[i], exp, "wrong data in cache at %d", i);
+	}
+
+	// After invalidating without writeback, RDRAM must still hold the old data.
+	data_cache_hit_invalidate(buf, sizeof(buf));
+	for (int i=0;i<sizeof(buf);i++) {
+		if (buf[i] != 0xAA)
+			ASSERT_EQUAL_HEX(buf[i], 0xAA, "RDRAM was modified at %d", i);
+	}
+}
+
+void test_rsp_memops(TestContext *ctx) {
+	// More than one chunk of the ucode, and not a multiple of it
+	const int size = 7000;
+	const int npix = 1540;
+
+	uint8_t *src = malloc_uncached(size);
+	DEFER(free_uncached(src));
+	uint8_t *dst = malloc_uncached(size + 16);
+	DEFER(free_uncached(dst));
+
+	for (int i=0;i<size;i++) src[i] = i*13 + (i>>8);
+
+	memset(dst, 0xEE, size + 16);
+	rsp_memops_wait(rsp_memcpy(dst, src, size));
+	ASSERT_EQUAL_MEM(dst, src, size, "rsp_memcpy: wrong data");
+	ASSERT_EQUAL_HEX(dst[size], 0xEE, "rsp_memcpy: overflow");
+
+	// Cached destination (flushed by rsp_memset32)
+	uint32_t *cached = memalign(16, size);
+	DEFER(free(cached));
+	memset(cached, 0, size);
+	rsp_memops_fence_t fence = rsp_memset32(cached, 0x12345678, size);
+	rsp_memops_wait(fence);
+	ASSERT(rsp_memops_done(fence), "fence not done after wait");
+	for (int i=0;i<size/4;i++)
+		ASSERT_EQUAL_HEX(cached[i], 0x12345678, "rsp_memset32: wrong data at %d", i);
+
+	// Size not multiple of 8: the last word is written by the CPU
+	memset(cached, 0, size);
+	rsp_memops_wait(rsp_memset32(cached, 0x9ABCDEF0, size - 12));
+	for (int i=0;i<(size-12)/4;i++)
+		ASSERT_EQUAL_HEX(cached[i], 0x9ABCDEF0, "rsp_memset32: wrong data at %d", i);
+	ASSERT_EQUAL_HEX(cached[(size-12)/4], 0, "rsp_memset32: overflow");
+
+	// 16 to 32 bits, checked against the expected expansion
+	uint16_t *pix16 = (uint16_t*)src;
+	uint32_t *pix32 = (uint32_t*)dst;
+	rsp_memops_wait(rsp_convert_16to32(pix32, pix16, npix));
+	for (int i=0;i<npix;i++) {
+		uint16_t p = pix16[i];
+		int r = (p >> 11) & 0x1F, g = (p >> 6) & 0x1F, b = (p >> 1) & 0x1F;
+		uint32_t exp = ((r << 3 | r >> 2) << 24) | ((g << 3 | g >> 2) << 16) |
+			((b << 3 | b >> 2) << 8) | ((p & 1) ? 0xFF : 0);
+		ASSERT_EQUAL_HEX(pix32[i], exp, "rsp_convert_16to32: wrong pixel %d (%04x)", i, p);
+	}
+
+	// 32 to 16 bits, as graphics_convert_color
+	uint32_t *rgba = (uint32_t*)src;
+	uint16_t *out16 = (uint16_t*)dst;
+	rsp_memops_wait(rsp_convert_32to16(out16, rgba, npix));
+	for (int i=0;i<npix;i++) {
+		uint32_t c = rgba[i];
+		uint16_t exp = ((c >> 27) << 11) | (((c >> 19) & 0x1F) << 6) |
+			(((c >> 11) & 0x1F) << 1) | ((c >> 7) & 1);
+		ASSERT_EQUAL_HEX(out16[i], exp, "rsp_convert_32to16: wrong pixel %d (%08lx)", i, c);
+	}
+}
@@ -0,0 +1,179 @@
+// Looping 8-bit waveform holding a constant value, so that the output of the
+// mixer only depends on the volumes of the channel
+#define TEST_WAVE_LEN  256
+static int8_t test_wave_data[TEST_WAVE_LEN + MIXER_LOOP_OVERREAD];
+
+static void test_wave_read(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
+	wpos %= TEST_WAVE_LEN;
+	if (wlen > TEST_WAVE_LEN + MIXER_LOOP_OVERREAD - wpos)
+		wlen = TEST_WAVE_LEN + MIXER_LOOP_OVERREAD - wpos;
+	memcpy(samplebuffer_append(sbuf, wlen), test_wave_data + wpos, wlen);
+}
+
+void test_mixer_spatial(TestContext *ctx) {
+	static int16_t out[2][256*2] __attribute__((aligned(16)));
+
+	audio_init(44100, 4);
+	DEFER(audio_close());
+	mixer_init(1);
+	DEFER(mixer_close());
+
+	memset(test_wave_data, 64, sizeof(test_wave_data));
+	waveform_t wave = {
+		.name = "test", .bits = 8, .channels = 1, .frequency = 11025,
+		.len = TEST_WAVE_LEN, .loop_len = TEST_WAVE_LEN,
+		.read = test_wave_read, .ctx = NULL,
+	};
+
+	mixer_listener_t listener = {
+		.pos = { 0, 0, 0 }, .vel = { 0, 0, 0 }, .right = { 1, 0, 0 },
+		.ref_dist = 1, .max_dist = 100, .rolloff = 1, .speed_of_sound = 0,
+	};
+	mixer_emitter_t emitter = {
+		.ch = 0, .pos = { 10, 0, 0 }, .vel = { 0, 0, 0 }, .vol = 1, .frequency = 11025,
+	};
+
+	// An emitter on the right at 10 times the reference distance: the same as
+	// setting a tenth of the volume, panned right
+	mixer_ch_play(0, &wave);
+	mixer_spatial_update(&listener, &emitter, 1);
+	mixer_poll(out[0], 256);
+	float pos = mixer_ch_get_pos(0);
+
+	mixer_ch_play(0, &wave);
+	mixer_ch_set_vol_pan(0, 0.1f, 1.0f);
+	mixer_ch_set_freq(0, 11025);
+	mixer_poll(out[1], 256);
+
+	ASSERT_EQUAL_MEM((uint8_t*)out[0], (uint8_t*)out[1], sizeof(out[0]), "spatial update differs from mixer_ch_set_vol_pan");
+	ASSERT(out[0][256*2-1] != 0 && out[0][256*2-2] == 0, "emitter not panned right");
+
+	// Approaching at a tenth of the speed of sound: the frequency is 1 / (1 - 0.1) times higher
+	listener.speed_of_sound = 343;
+	emitter.vel.x = -34.3f;
+	mixer_ch_play(0, &wave);
+	mixer_spatial_update(&listener, &emitter, 1);
+	mixer_poll(out[0], 256);
+	float ratio = mixer_ch_get_pos(0) / pos;
+	ASSERT(ratio > 1.10f && ratio < 1.12f, "wrong Doppler shift: %d/1000", (int)(ratio * 1000));
+
+	// Beyond the maximum distance, the emitter is silent
+	emitter.pos.x = 200;
+	mixer_ch_play(0, &wave);
+	mixer_spatial_update(&listener, &emitter, 1);
+	mixer_poll(out[0], 256);
+	for (int i=0; i<256*2; i++)
+		ASSERT_EQUAL_SIGNED(out[0][i], 0, "emitter beyond the maximum distance not silent at %d", i);
+}
+
+static int test_event_order[8];
+static int test_event_count;
+
+static int test_event_cb(void *ctx) {
+	test_event_order[test_event_count++] = (int)ctx;
+	return 0;
+}
+
+void test_mixer_event_order(TestContext *ctx) {
+	static int16_t out[256*2] __attribute__((aligned(16)));
+
+	audio_init(44100, 4);
+	DEFER(audio_close());
+	mixer_init(1);
+	DEFER(mixer_close());
+
+	// Events due on the same sample trigger in the order they were added,
+	// whatever their position in the heap
+	test_event_count = 0;
+	mixer_add_event(100, test_event_cb, (void*)5);
+	mixer_add_event(64, test_event_cb, (void*)0);
+	for (int i=1; i<5; i++)
+		mixer_add_event(100, test_event_cb, (void*)i);
+	mixer_add_event(200, test_event_cb, (void*)6);
+
+	mixer_poll(out, 256);
+
+	ASSERT_EQUAL_SIGNED(test_event_count, 7, "wrong number of events triggered");
+	static const int expected[7] = { 0, 5, 1, 2, 3, 4, 6 };
+	for (int i=0; i<7; i++)
+		ASSERT_EQUAL_SIGNED(test_event_order[i], expected[i], "wrong event order at %d", i);
+}
+
+static void test_wave_read_stereo(void *ctx, samplebuffer_t *sbuf, int wpos, int wlen, bool seeking) {
+	wpos %= TEST_WAVE_LEN/2;
+	if (wlen > (TEST_WAVE_LEN + MIXER_LOOP_OVERREAD)/2 - wpos)
+		wlen = (TEST_WAVE_LEN + MIXER_LOOP_OVERREAD)/2 - wpos;
+	memcpy(samplebuffer_append(sbuf, wlen), test_wave_data + wpos*2, wlen*2);
+}
+
+void test_mixer_voice_pool(TestContext *ctx) {
+	audio_init(44100, 4);
+	DEFER(audio_close());
+	mixer_init(4);
+	DEFER(mixer_close());
+
+	memset(test_wave_data, 64, sizeof(test_wave_data));
+	waveform_t wave = {
+		.name = "test", .bits = 8, .channels = 1, .frequency = 11025,
+		.len = TEST_WAVE_LEN, .loop_len = TEST_WAVE_LEN,
+		.read = test_wave_read, .ctx = NULL,
+	};
+	waveform_t wave_stereo = {
+		.name = "test_stereo", .bits = 8, .channels = 2, .frequency = 11025,
+		.len = TEST_WAVE_LEN/2, .loop_len = TEST_WAVE_LEN/2,
+		.read = test_wave_read_stereo, .ctx = NULL,
+	};
+
+	// A stereo waveform played directly on the channel right before the pool:
+	// the pool must never touch it.
+	mixer_ch_play(0, &wave_stereo);
+	mixer_voice_pool_init(1, 2);
+
+	// Priority stealing: the lowest priority voice is stolen, and a voice
+	// less important than all the playing ones is dropped
+	mixer_voice_t v1 = mixer_voice_play(&wave, 1);
+	mixer_voice_t v2 = mixer_voice_play(&wave, 2);
+	ASSERT(mixer_voice_channel(v1) >= 1 && mixer_voice_channel(v2) >= 1, "voices not started in the pool");
+	ASSERT(mixer_voice_channel(v1) != mixer_voice_channel(v2), "voices on the same channel");
+	int ch1 = mixer_voice_channel(v1);
+
+	ASSERT_EQUAL_SIGNED(mixer_voice_play(&wave, 0), MIXER_VOICE_NONE, "less important voice played");
+
+	mixer_voice_t v3 = mixer_voice_play(&wave, 3);
+	ASSERT_EQUAL_SIGNED(mixer_voice_channel(v3), ch1, "lowest priority voice not stolen");
+	ASSERT_EQUAL_SIGNED(mixer_voice_channel(v1), -1, "stolen voice still valid");
+	ASSERT(mixer_voice_channel(v2) >= 0, "higher priority voice stolen");
+
+	mixer_voice_stop(v2);
+	mixer_voice_stop(v3);
+	ASSERT_EQUAL_SIGNED(mixer_voice_channel(v2), -1, "stopped voice still valid");
+
+	// Equal priority: the quietest voice is stolen, then the oldest one
+	// among equally loud voices
+	mixer_voice_t a = mixer_voice_play(&wave, 1);
+	mixer_voice_t b = mixer_voice_play(&wave, 1);
+	mixer_ch_set_vol(mixer_voice_channel(a), 0.8f, 0.8f);
+	mixer_ch_set_vol(mixer_voice_channel(b), 0.2f, 0.2f);
+	int chb = mixer_voice_channel(b);
+
+	mixer_voice_t c = mixer_voice_play(&wave, 1);
+	ASSERT_EQUAL_SIGNED(mixer_voice_channel(c), chb, "quietest voice not stolen");
+	ASSERT(mixer_voice_channel(a) >= 0, "louder voice stolen");
+
+	mixer_ch_set_vol(mixer_voice_channel(c), 0.8f, 0.8f);
+	int cha = mixer_voice_channel(a);
+	mixer_voice_t d = mixer_voice_play(&wave, 1);
+	ASSERT_EQUAL_SIGNED(mixer_voice_channel(d), cha, "oldest voice not stolen");
+	ASSERT(mixer_voice_channel(c) >= 0, "newer voice stolen");
+
+	// A stereo voice in the pool only takes its own channel
+	mixer_ch_set_vol(mixer_voice_channel(d), 0.8f, 0.8f);
+	int chc = mixer_voice_channel(c);
+	mixer_voice_t e = mixer_voice_play(&wave_stereo, 1);
+	ASSERT_EQUAL_SIGNED(mixer_voice_channel(e), chc, "oldest voice not stolen by the stereo voice");
+	ASSERT(mixer_voice_channel(d) >= 0, "stereo voice stole two channels");
+
+	for (int i=0; i<8; i++)
+		mixer_voice_play(i & 1 ? &wave_stereo : &wave, 5);
+	ASSERT(mixer_ch_playing(0), "channel outside the pool stopped by a voice");
+}
@@ -0,0 +1,97 @@
+static void test_profile_inner(void) {
+	PROFILE_SCOPE("inner");
+	wait_ticks(100);
+}
+
+void test_profile_scopes(TestContext *ctx) {
+	profile_frame_t frame;
+
+	profile_init();
+	DEFER(profile_close());
+
+	{
+		PROFILE_SCOPE("outer");
+		test_profile_inner();
+		test_profile_inner();
+	}
+
+	profile_next_frame(&frame);
+	ASSERT_EQUAL_UNSIGNED(frame.num_scopes, 3, "wrong number of scopes");
+	ASSERT(strcmp(frame.scopes[0].name, "outer") == 0, "wrong name of outer scope");
+	ASSERT(strcmp(frame.scopes[2].name, "inner") == 0, "wrong name of inner scope");
+	ASSERT_EQUAL_UNSIGNED(frame.scopes[0].depth, 0, "wrong depth of outer scope");
+	ASSERT_EQUAL_UNSIGNED(frame.scopes[1].depth, 1, "wrong depth of inner scope");
+	ASSERT(frame.scopes[1].ticks >= 100, "inner scope too short");
+	ASSERT(frame.scopes[0].ticks >= frame.scopes[1].ticks + frame.scopes[2].ticks, "outer scope shorter than inner scopes");
+	ASSERT(frame.scopes[2].start >= frame.scopes[1].start + frame.scopes[1].ticks, "inner scopes overlap");
+
+	// Names are shared in the export: header, 2 names ("outer", "inner" padded to 12 bytes), 3 scopes
+	uint8_t buf[128];
+	int size = profile_export(&frame, buf, sizeof(buf));
+	ASSERT_EQUAL_SIGNED(size, 24 + 12 + 3*12, "wrong export size");
+	ASSERT_EQUAL_SIGNED(profile_export(&frame, NULL, 0), size, "wrong computed export size");
+	ASSERT_EQUAL_SIGNED(profile_export(&frame, buf, size-1), -1, "export overflowed the buffer");
+	ASSERT_EQUAL_MEM(buf, (uint8_t*)"PRF1", 4, "wrong export magic");
+
+	// A new frame starts with no scopes
+	profile_next_frame(&frame);
+	ASSERT_EQUAL_UNSIGNED(frame.num_scopes, 0, "scopes not reset by the next frame");
+}
+
+void test_profile_sampling(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+
+	bool ok = profile_sampling_start(10000, 1024);
+	ASSERT(ok, "profile_sampling_start failed");
+	DEFER(profile_sampling_stop());
+
+	// 10ms at 10kHz: about 100 samples, all within the text section
+	wait_ms(10);
+	uint32_t count = profile_sampling_count();
+	ASSERT(count >= 50 && count <= 150, "wrong number of samples: %lu", count);
+
+	int size = profile_sampling_export(NULL, 0);
+	ASSERT(size > 28, "no buckets exported");
+
+	uint8_t *buf = malloc(size);
+	DEFER(free(buf));
+	ASSERT_EQUAL_SIGNED(profile_sampling_export(buf, size), size, "wrong export size");
+	ASSERT_EQUAL_MEM(buf, (uint8_t*)"PRS1", 4, "wrong export magic");
+	ASSERT_EQUAL_UNSIGNED((buf[20]<<24)|(buf[21]<<16)|(buf[22]<<8)|buf[23], 0, "samples outside of the text section");
+
+	profile_sampling_reset();
+	ASSERT_EQUAL_UNSIGNED(profile_sampling_count(), 0, "samples not reset");
+}
+
+void test_profile_bus(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+
+	profile_frame_t frame;
+	profile_init();
+	DEFER(profile_close());
+
+	profile_bus_start(10000);
+	DEFER(profile_bus_stop());
+
+	// Keep the PI busy with ROM reads for 10ms
+	static uint8_t buf[32768] __attribute__((aligned(16)));
+	profile_next_frame(&frame);
+	uint32_t start = TICKS_READ();
+	while (TICKS_READ() - start < TICKS_FROM_MS(10)) {
+		data_cache_hit_writeback_invalidate(buf, sizeof(buf));
+		dma_read(buf, 0x10001000, sizeof(buf));
+	}
+	profile_next_frame(&frame);
+
+	ASSERT(frame.bus_samples >= 50 && frame.bus_samples <= 150, "wrong number of samples: %lu", frame.bus_samples);
+	ASSERT(frame.pi_busy > 0, "PI activity not detected");
+	ASSERT(PROFILE_BUS_PERCENT(frame, pi_busy) <= 100, "wrong PI percentage");
+
+	profile_bus_stop();
+	profile_next_frame(&frame);
+	wait_ms(1);
+	profile_next_frame(&frame);
+	ASSERT_EQUAL_UNSIGNED(frame.bus_samples, 0, "samples after the monitor was stopped");
+}
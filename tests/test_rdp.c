@@ -0,0 +1,23 @@
+void test_rdp_commands(TestContext *ctx) {
+	// Reference words built by hand from the RDP command layout
+	ASSERT_EQUAL_HEX(RDP_CMD_SET_OTHER_MODES(RDP_SOM_CYCLE_FILL), 0xEF3000FF00000000ULL, "invalid other modes");
+	ASSERT_EQUAL_HEX(RDP_CMD_SET_OTHER_MODES(RDP_SOM_CYCLE_1 | RDP_SOM_Z_COMPARE | RDP_SOM_Z_UPDATE),
+		0xEF0000FF00000030ULL, "invalid other modes");
+	ASSERT_EQUAL_HEX(RDP_CMD_SET_PRIM_COLOR(0x204080FF), 0xFA000000204080FFULL, "invalid primitive color");
+	ASSERT_EQUAL_HEX(RDP_CMD_SET_SCISSOR(0, 0, 320, 240), 0xED000000005003C0ULL, "invalid scissor");
+	ASSERT_EQUAL_HEX(RDP_CMD_FILL_RECTANGLE(0, 0, 319, 239), 0xF64FC3BC00000000ULL, "invalid fill rectangle");
+
+	// (TEX0 - 0) * SHADE + 0 for the color and the alpha
+	ASSERT_EQUAL_HEX(RDP_CMD_SET_COMBINE_1CYCLE(
+		RDP_COMBINE_TEX0, RDP_COMBINE_ZERO, RDP_COMBINE_SHADE, RDP_COMBINE_ZERO,
+		RDP_COMBINE_TEX0, RDP_COMBINE_ZERO, RDP_COMBINE_SHADE, RDP_COMBINE_ZERO),
+		0xFC121824FF33FFFFULL, "invalid 1 cycle combiner");
+
+	// TEX0 * PRIM, then COMBINED * SHADE
+	ASSERT_EQUAL_HEX(RDP_CMD_SET_COMBINE(
+		RDP_COMBINE_TEX0, RDP_COMBINE_ZERO, RDP_COMBINE_PRIM, RDP_COMBINE_ZERO,
+		RDP_COMBINE_TEX0, RDP_COMBINE_ZERO, RDP_COMBINE_PRIM, RDP_COMBINE_ZERO,
+		RDP_COMBINE_COMBINED, RDP_COMBINE_ZERO, RDP_COMBINE_SHADE, RDP_COMBINE_ZERO,
+		RDP_COMBINE_COMBINED, RDP_COMBINE_ZERO, RDP_COMBINE_SHADE, RDP_COMBINE_ZERO),
+		0xFC119604FF13FFFFULL, "invalid 2 cycles combiner");
+}
@@ -0,0 +1,50 @@
+
+void test_rsp_dma_async(TestContext *ctx) {
+	// DMEM is shared with the ucode currently loaded: save and restore it,
+	// so that it can still be used by the next tasks.
+	rsp_task_wait_all();
+	static uint8_t dmem_save[4096] __attribute__((aligned(16)));
+	rsp_read_data(dmem_save, sizeof(dmem_save), 0);
+	data_cache_hit_writeback(dmem_save, sizeof(dmem_save));
+	DEFER(rsp_load_data(dmem_save, sizeof(dmem_save), 0));
+
+	static uint8_t seg0[64] __attribute__((aligned(16)));
+	static uint8_t seg1[256] __attribute__((aligned(16)));
+	static uint8_t out[320] __attribute__((aligned(16)));
+	for (int i=0;i<sizeof(seg0);i++) seg0[i] = i ^ 0x5A;
+	for (int i=0;i<sizeof(seg1);i++) seg1[i] = i * 3;
+	data_cache_hit_writeback(seg0, sizeof(seg0));
+	data_cache_hit_writeback(seg1, sizeof(seg1));
+
+	// Scatter the two segments in DMEM, then read them back at once
+	uint32_t f0 = rsp_load_data_async(seg0, sizeof(seg0), 0);
+	uint32_t f1 = rsp_load_data_async(seg1, sizeof(seg1), sizeof(seg0));
+	uint32_t f2 = rsp_read_data_async(out, sizeof(out), 0);
+	ASSERT((int32_t)(f1 - f0) > 0 && (int32_t)(f2 - f1) > 0, "fences are not increasing");
+
+	rsp_dma_wait(f2);
+	ASSERT(rsp_dma_done(f0) && rsp_dma_done(f1), "earlier transfers not complete");
+	ASSERT_EQUAL_MEM(out, seg0, sizeof(seg0), "wrong data in first segment");
+	ASSERT_EQUAL_MEM(out + sizeof(seg0), seg1, sizeof(seg1), "wrong data in second segment");
+}
+
+DEFINE_RSP_UCODE(rsp_test_kernel);
+DEFINE_RSP_OVERLAY(rsp_test_overlay0);
+DEFINE_RSP_OVERLAY(rsp_test_overlay1);
+
+void test_rsp_overlay(TestContext *ctx) {
+	// NOTE: keep this in sync with rsp_test_kernel.S
+	const int TEST_RESULTS = 0x100;
+
+	static rsp_ucode_t * const overlays[] = { &rsp_test_overlay0, &rsp_test_overlay1 };
+	rsp_ucode_set_overlays(&rsp_test_kernel, overlays, 2);
+
+	rsp_load(&rsp_test_kernel);
+	rsp_run();
+
+	static uint32_t results[4] __attribute__((aligned(16)));
+	rsp_read_data(results, sizeof(results), TEST_RESULTS);
+	ASSERT_EQUAL_HEX(results[0], 0x11111111, "first overlay not run");
+	ASSERT_EQUAL_HEX(results[1], 0x22222222, "second overlay not run");
+	ASSERT_EQUAL_SIGNED(results[2], 2, "first overlay not reloaded");
+}
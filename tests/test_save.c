@@ -0,0 +1,37 @@
+void test_save(TestContext *ctx) {
+    static uint8_t src[FLASHRAM_SECTOR_SIZE + 256] __attribute__((aligned(8)));
+    static uint8_t dst[FLASHRAM_SECTOR_SIZE + 256] __attribute__((aligned(8)));
+    int result;
+
+    // Without a save memory, every access fails
+    ASSERT_EQUAL_SIGNED(save_init(SAVE_TYPE_NONE), SAVE_ESUCCESS, "cannot select no save memory");
+    ASSERT_EQUAL_UNSIGNED(save_size(), 0, "invalid size of no save memory");
+    ASSERT_EQUAL_SIGNED(save_read(dst, 0, 16), SAVE_ENODEVICE, "read without save memory");
+
+    if (save_init(SAVE_TYPE_FLASHRAM_1M) != SAVE_ESUCCESS) {
+        SKIP("FlashRAM not found; skipping save tests");
+    }
+    DEFER(save_init(SAVE_TYPE_NONE));
+
+    ASSERT_EQUAL_UNSIGNED(save_size(), 128*1024, "invalid FlashRAM size");
+    ASSERT_EQUAL_SIGNED(save_read(dst, save_size() - 8, 16), SAVE_EBADINPUT, "read out of range");
+    ASSERT_EQUAL_SIGNED(save_read(dst + 1, 0, 16), SAVE_EBADINPUT, "misaligned read");
+
+    // Write across a sector boundary, at unaligned offsets, so that both the
+    // sectors are only partially written and must preserve the rest
+    const size_t offset = FLASHRAM_SECTOR_SIZE - 1000;
+    for (int i = 0; i < sizeof(src); i++)
+        src[i] = i * 7 + 3;
+
+    result = save_write(src, FLASHRAM_SECTOR_SIZE - 2000, 1000);
+    ASSERT_EQUAL_SIGNED(result, SAVE_ESUCCESS, "first write failed");
+    result = save_write_async(src + 1, offset + 1, 1999);
+    ASSERT_EQUAL_SIGNED(result, SAVE_ESUCCESS, "second write failed to start");
+    ASSERT_EQUAL_SIGNED(save_read(dst, 0, 16), SAVE_EBUSY, "read during a write");
+    ASSERT_EQUAL_SIGNED(save_wait(), SAVE_ESUCCESS, "second write failed");
+
+    result = save_read(dst, FLASHRAM_SECTOR_SIZE - 2000, 3000);
+    ASSERT_EQUAL_SIGNED(result, SAVE_ESUCCESS, "read failed");
+    ASSERT_EQUAL_MEM(dst, src, 1000, "first write not preserved");
+    ASSERT_EQUAL_MEM(dst + 1001, src + 1, 1999, "second write mismatch");
+}
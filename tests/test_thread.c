@@ -0,0 +1,132 @@
+void test_thread_yield(TestContext *ctx) {
+	thread_init();
+	DEFER(thread_close());
+
+	volatile uint8_t order[16] = {0};
+	volatile int idx = 0;
+
+	void worker(void *arg) {
+		for (int i=0; i<3; i++) {
+			order[idx++] = (int)arg;
+			thread_yield();
+		}
+	}
+
+	thread_t *t1 = thread_create(worker, (void*)1, 0);
+	thread_t *t2 = thread_create(worker, (void*)2, 0);
+	ASSERT(t1 && t2, "cannot create threads");
+
+	// Threads don't run until the main thread yields
+	ASSERT_EQUAL_SIGNED(idx, 0, "threads run before yielding");
+
+	thread_join(t1);
+	thread_join(t2);
+
+	uint8_t expected[] = { 1, 2, 1, 2, 1, 2, 0 };
+	ASSERT_EQUAL_MEM((uint8_t*)order, expected, sizeof(expected), "invalid order of threads");
+}
+
+void test_thread_priority(TestContext *ctx) {
+	thread_init();
+	DEFER(thread_close());
+
+	volatile uint8_t order[16] = {0};
+	volatile int idx = 0;
+
+	void worker(void *arg) {
+		order[idx++] = (int)arg;
+	}
+
+	thread_t *t1 = thread_create(worker, (void*)1, 0);
+	thread_t *t2 = thread_create(worker, (void*)2, 0);
+	thread_t *t3 = thread_create(worker, (void*)3, 0);
+	ASSERT(t1 && t2 && t3, "cannot create threads");
+	thread_set_priority(t3, THREAD_PRIORITY_NORMAL + 1);
+
+	thread_join(t1);
+	thread_join(t2);
+	thread_join(t3);
+
+	// The thread with a higher priority runs first
+	uint8_t expected[] = { 3, 1, 2, 0 };
+	ASSERT_EQUAL_MEM((uint8_t*)order, expected, sizeof(expected), "invalid order of threads");
+}
+
+void test_thread_semaphore(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+	thread_init();
+	DEFER(thread_close());
+
+	semaphore_t sem;
+	semaphore_init(&sem, 0);
+	volatile int woken = 0;
+
+	void cb(int ovfl) {
+		semaphore_post(&sem);
+	}
+
+	void worker(void *arg) {
+		for (int i=0; i<3; i++) {
+			semaphore_wait(&sem);
+			woken++;
+		}
+	}
+
+	thread_t *t = thread_create(worker, NULL, 0);
+	ASSERT(t, "cannot create thread");
+	thread_set_priority(t, THREAD_PRIORITY_NORMAL + 1);
+	thread_enable_preemption(0);
+
+	// The thread waits for the semaphore, posted by the timer interrupt
+	ASSERT_EQUAL_SIGNED(woken, 0, "thread woken up without semaphore");
+	timer_link_t *tt = new_timer(TIMER_TICKS(2000), TF_CONTINUOUS, cb);
+	DEFER(delete_timer(tt));
+
+	// The main thread never yields: the thread preempts it when woken up
+	unsigned long start = get_ticks_ms();
+	while (woken < 3 && get_ticks_ms() - start < 100) {}
+	ASSERT_EQUAL_SIGNED(woken, 3, "thread not woken up by the semaphore");
+
+	thread_join(t);
+}
+
+void test_thread_preempt(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+	thread_init();
+	DEFER(thread_close());
+
+	volatile int counter[2] = {0};
+	volatile bool stop = false;
+	mutex_t mutex;
+	mutex_init(&mutex);
+	volatile int shared = 0;
+
+	void worker(void *arg) {
+		while (!stop) {
+			mutex_lock(&mutex);
+			int v = shared;
+			counter[(int)arg]++;
+			shared = v + 1;
+			mutex_unlock(&mutex);
+		}
+	}
+
+	thread_t *t1 = thread_create(worker, (void*)0, 0);
+	thread_t *t2 = thread_create(worker, (void*)1, 0);
+	ASSERT(t1 && t2, "cannot create threads");
+	thread_enable_preemption(TIMER_TICKS(1000));
+
+	// None of the threads yield: they are switched by the time slices
+	unsigned long start = get_ticks_ms();
+	while (get_ticks_ms() - start < 20) {}
+	stop = true;
+
+	thread_join(t1);
+	thread_join(t2);
+	thread_disable_preemption();
+
+	ASSERT(counter[0] > 0 && counter[1] > 0, "threads not preempted (%d, %d)", counter[0], counter[1]);
+	ASSERT_EQUAL_SIGNED(shared, counter[0] + counter[1], "mutex did not protect shared data");
+}
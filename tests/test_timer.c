@@ -315,3 +315,89 @@ void test_timer_disabled_start(TestContext *ctx) {
 		2+3+3+2+3+3,
 		"invalid timer_ticks");
 }
+
+void test_timer_deferred(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+
+	volatile int cb1_called = 0;
+	void cb1(int ovlf) {
+		cb1_called++;
+	}
+
+	timer_link_t *tt1 = new_timer(TICKS_FROM_MS(2), TF_CONTINUOUS | TF_DEFERRED, cb1);
+	DEFER(delete_timer(tt1));
+
+	// The callback must not run under interrupt
+	wait_ms(5);
+	ASSERT_EQUAL_SIGNED(cb1_called, 0, "deferred timer called under interrupt");
+
+	// Both expirations are run by timer_poll
+	ASSERT_EQUAL_SIGNED(timer_poll(), 2, "invalid number of deferred callbacks");
+	ASSERT_EQUAL_SIGNED(cb1_called, 2, "deferred timer not called");
+	ASSERT_EQUAL_SIGNED(timer_poll(), 0, "deferred timer called again?");
+
+	// Stopping the timer drops the pending expirations
+	wait_ms(3);
+	stop_timer(tt1);
+	ASSERT_EQUAL_SIGNED(timer_poll(), 0, "stopped deferred timer called");
+	ASSERT_EQUAL_SIGNED(cb1_called, 2, "stopped deferred timer called");
+}
+
+void test_timer_many(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+
+	#define NUM_TIMERS 200
+
+	volatile int cb1_called = 0;
+	void cb1(int ovlf) {
+		cb1_called++;
+	}
+
+	// Timer structures that were never started can hold garbage
+	timer_link_t tt[NUM_TIMERS];
+	memset(tt, 0xAA, sizeof(tt));
+
+	// Start many more timers than the old fixed-size heap could hold, with
+	// deadlines in reverse order of start
+	for (int i = 0; i < NUM_TIMERS; i++)
+		start_timer(&tt[i], TIMER_TICKS(3000 - i * 10), TF_ONE_SHOT, cb1);
+
+	// Stop one timer out of four, and restart one out of four
+	for (int i = 0; i < NUM_TIMERS; i += 4) {
+		stop_timer(&tt[i]);
+		restart_timer(&tt[i+1]);
+	}
+
+	wait_ms(5);
+	ASSERT_EQUAL_SIGNED(cb1_called, NUM_TIMERS - NUM_TIMERS/4, "invalid number of timers called");
+
+	wait_ms(3);
+	ASSERT_EQUAL_SIGNED(cb1_called, NUM_TIMERS - NUM_TIMERS/4, "timers called again?");
+
+	#undef NUM_TIMERS
+}
+
+void test_timer_conversions(TestContext *ctx) {
+	// The fast paths must match the 64-bit macros, on both sides of the
+	// 32-bit boundary where they switch implementation
+	long long ticks[] = { 0, 1, 2, 3, 374, 375, 46875, 0x7FFFFFFF, 0xFFFFFFFE, 0xFFFFFFFF,
+		0x100000000LL, 0x123456789ALL };
+
+	for (int i=0; i<sizeof(ticks)/sizeof(ticks[0]); i++) {
+		long long tk = ticks[i];
+		ASSERT(timer_ticks_to_us(tk) == TIMER_MICROS_LL(tk),
+			"invalid conversion to us [%llx]: %lld != %lld", tk, timer_ticks_to_us(tk), TIMER_MICROS_LL(tk));
+		ASSERT(timer_ticks_to_ns(tk) == TIMER_NANOS_LL(tk),
+			"invalid conversion to ns [%llx]: %lld != %lld", tk, timer_ticks_to_ns(tk), TIMER_NANOS_LL(tk));
+	}
+
+	for (int i=0; i<4096; i++) {
+		long long tk = RANDN(0x7FFFFFFF) * 2 + RANDN(2);
+		ASSERT(timer_ticks_to_us(tk) == TIMER_MICROS_LL(tk), "invalid conversion to us [%llx]", tk);
+		ASSERT(timer_ticks_to_ns(tk) == TIMER_NANOS_LL(tk), "invalid conversion to ns [%llx]", tk);
+	}
+
+	ASSERT_EQUAL_SIGNED(timer_ticks_to_us(TICKS_FROM_MS(1)), 1000, "invalid conversion of 1 ms");
+}
@@ -0,0 +1,126 @@
+#include <math.h>
+
+static bool near_equal(float a, float b) {
+	return fabsf(a - b) < 1e-4f;
+}
+
+static bool near_equal_fix16(fix16_t a, fix16_t b) {
+	return a - b < 4 && b - a < 4;
+}
+
+void test_vmath_mat4(TestContext *ctx) {
+	mat4_t t, s, m, id;
+	mat4_translation(&t, 1, 2, 3);
+	mat4_scaling(&s, 2, 4, 8);
+	mat4_identity(&id);
+
+	// Scale first, then translate
+	mat4_mul(&m, &t, &s);
+	vec4_t v = { 1, 1, 1, 1 };
+	mat4_transform(&v, &m, &v);
+	ASSERT(near_equal(v.x, 3) && near_equal(v.y, 6) && near_equal(v.z, 11) && near_equal(v.w, 1),
+		"invalid transform: %f %f %f %f", v.x, v.y, v.z, v.w);
+
+	// Multiplying by the identity in place does not change the matrix
+	mat4_t m2 = m;
+	mat4_mul(&m2, &m2, &id);
+	for (int r=0; r<4; r++)
+		for (int c=0; c<4; c++)
+			ASSERT(near_equal(m2.m[r][c], m.m[r][c]), "identity changed the matrix at %d,%d", r, c);
+
+	// The batch transform matches the single one
+	vec3_t pts[3] = { { 1, 2, 3 }, { -4, 5, -6 }, { 0, 0, 0 } };
+	vec4_t out[3];
+	mat4_transform_points(out, &m, pts, 3);
+	for (int i=0; i<3; i++) {
+		vec4_t p = { pts[i].x, pts[i].y, pts[i].z, 1 };
+		mat4_transform(&p, &m, &p);
+		ASSERT(near_equal(p.x, out[i].x) && near_equal(p.y, out[i].y) &&
+			near_equal(p.z, out[i].z) && near_equal(p.w, out[i].w), "invalid batch transform of point %d", i);
+	}
+}
+
+void test_vmath_quat(TestContext *ctx) {
+	// 90 degrees around Z turns X into Y
+	quat_t q;
+	vec3_t axis = { 0, 0, 1 };
+	quat_from_axis_angle(&q, &axis, M_PI / 2);
+
+	vec3_t v = { 1, 0, 0 };
+	quat_rotate(&v, &q, &v);
+	ASSERT(near_equal(v.x, 0) && near_equal(v.y, 1) && near_equal(v.z, 0),
+		"invalid rotation: %f %f %f", v.x, v.y, v.z);
+
+	// The matrix rotates the same way
+	mat4_t m;
+	mat4_rotation(&m, &q);
+	vec4_t v4 = { 1, 0, 0, 1 };
+	mat4_transform(&v4, &m, &v4);
+	ASSERT(near_equal(v4.x, 0) && near_equal(v4.y, 1) && near_equal(v4.z, 0),
+		"invalid rotation matrix: %f %f %f", v4.x, v4.y, v4.z);
+
+	// Two rotations of 90 degrees are one of 180 degrees, and halfway
+	// between no rotation and 180 degrees there is 90 degrees
+	quat_t q2, id, half;
+	quat_mul(&q2, &q, &q);
+	v = (vec3_t){ 1, 0, 0 };
+	quat_rotate(&v, &q2, &v);
+	ASSERT(near_equal(v.x, -1) && near_equal(v.y, 0), "invalid quaternion product: %f %f", v.x, v.y);
+
+	quat_identity(&id);
+	quat_nlerp(&half, &id, &q2, 0.5f);
+	ASSERT(near_equal(half.x, q.x) && near_equal(half.y, q.y) &&
+		near_equal(half.z, q.z) && near_equal(half.w, q.w), "invalid interpolation");
+}
+
+void test_vmath_fix16(TestContext *ctx) {
+	ASSERT_EQUAL_SIGNED(fix16_from_float(1.5f), 0x18000, "invalid conversion");
+	ASSERT_EQUAL_SIGNED(fix16_from_float(-0.25f), -0x4000, "invalid conversion");
+	ASSERT_EQUAL_SIGNED(fix16_mul(FIX16(1.5), FIX16(-2)), FIX16(-3), "invalid product");
+	ASSERT_EQUAL_HEX(fix16_to_rdp_y(FIX16(10.75)), 43, "invalid RDP Y coordinate");
+
+	mat4_t m;
+	mat4_translation(&m, 10, -20, 0.5f);
+	m.m[0][0] = 2;
+
+	mat4x_t mx;
+	mat4_to_fix16(&mx, &m);
+	vec3x_t p = { FIX16(3), FIX16(1), FIX16(-1) };
+	vec4x_t out;
+	mat4x_transform_points(&out, &mx, &p, 1);
+	ASSERT_EQUAL_SIGNED(out.x, FIX16(16), "invalid fixed point transform (x)");
+	ASSERT_EQUAL_SIGNED(out.y, FIX16(-19), "invalid fixed point transform (y)");
+	ASSERT_EQUAL_SIGNED(out.z, FIX16(-0.5), "invalid fixed point transform (z)");
+	ASSERT_EQUAL_SIGNED(out.w, FIX16(1), "invalid fixed point transform (w)");
+
+	// The RSP layout splits each coefficient in integer and fractional part,
+	// by input coordinate, twice
+	static int16_t rsp[8][8] __attribute__((aligned(8)));
+	mat4_to_rsp(rsp, &m);
+	ASSERT_EQUAL_SIGNED(rsp[0][0], 2, "invalid RSP matrix");
+	ASSERT_EQUAL_SIGNED(rsp[0][4], 2, "invalid RSP matrix");
+	ASSERT_EQUAL_SIGNED(rsp[3][1], -20, "invalid RSP matrix");
+	ASSERT_EQUAL_HEX((uint16_t)rsp[7][2], 0x8000, "invalid RSP matrix");
+}
+
+void test_vmath_rsp_transform(TestContext *ctx) {
+	mat4_t m;
+	mat4_translation(&m, 100, 50, 0);
+	m.m[0][0] = 2;
+	rdp_geom_set_matrix(m.m);
+
+	static rdp_geom_vertex_t vtx[3] __attribute__((aligned(8))) = {
+		{ 10, 20, 0 }, { -5, 7, 3 }, { 0, 0, 0 },
+	};
+	static rdp_geom_tvertex_t out[3];
+
+	rdp_geom_transform_vertices(vtx, 3, out);
+	rdp_geom_wait();
+
+	for (int i=0; i<3; i++) {
+		int32_t x = rdp_geom_tvertex_x(&out[i]);
+		int32_t y = rdp_geom_tvertex_y(&out[i]);
+		ASSERT(near_equal_fix16(x, FIX16(vtx[i].x * 2 + 100)) && near_equal_fix16(y, FIX16(vtx[i].y + 50)),
+			"invalid RSP transform of vertex %d: %lx %lx", i, x, y);
+	}
+}
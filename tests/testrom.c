@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <malloc.h>
+#include <system.h>
 
 // Activate this when running under emulators such as cen64
 #ifndef IN_EMULATOR
@@ -160,6 +162,7 @@ int assert_equal_mem(TestContext *ctx, const char *file, int line, const uint8_t
 
 #include "test_dfs.c"
 #include "test_eepromfs.c"
+#include "test_save.c"
 #include "test_cache.c"
 #include "test_ticks.c"
 #include "test_timer.c"
@@ -167,6 +170,15 @@ int assert_equal_mem(TestContext *ctx, const char *file, int line, const uint8_t
 #include "test_exception.c"
 #include "test_debug.c"
 #include "test_dma.c"
+#include "test_thread.c"
+#include "test_heap.c"
+#include "test_profile.c"
+#include "test_memops.c"
+#include "test_rsp.c"
+#include "test_vmath.c"
+#include "test_rdp.c"
+#include "test_mixer.c"
+#include "test_controller.c"
 
 /**********************************************************************
  * MAIN
@@ -188,21 +200,73 @@ static const struct Testsuite
 	uint32_t flags;
 } tests[] = {
 	TEST_FUNC(test_exception,              	   5, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_exception_fpu_denormal, 	   0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_ticks,                  	   0, TEST_FLAGS_NO_BENCHMARK | TEST_FLAGS_NO_EMULATOR),
 	TEST_FUNC(test_timer_ticks,          	 292, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_timer_conversions,    	   0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_timer_oneshot,        	 596, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_slow_callback, 	1468, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_continuous,     	 688, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_mixed,         	1467, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_disabled_start, 	 733, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_timer_disabled_restart,	 733, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_timer_deferred,       	 366, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_timer_many,           	   8, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_irq_reentrancy,       	 230, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_irq_handler_ctx,             7, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_irq_stats,                   3, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_irq_fpu,                     3, TEST_FLAGS_RESET_COUNT),
+	TEST_FUNC(test_irq_vi_line,               100, TEST_FLAGS_RESET_COUNT),
 	TEST_FUNC(test_dfs_read,            	 948, TEST_FLAGS_IO),
 	TEST_FUNC(test_dfs_rom_addr,              25, TEST_FLAGS_IO),
+	TEST_FUNC(test_dfs_rom_desc,               0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_dir_cache,              0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_index,                  0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_order,                  0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_readahead,              0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_read_async,             0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_fopen,                  0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_bundle,                 0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_asset,                  0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_open_files,             0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_mount,                  0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_eepromfs,                   0, TEST_FLAGS_IO),
+	TEST_FUNC(test_eepromfs_async,             0, TEST_FLAGS_IO),
+	TEST_FUNC(test_eeprom_read_bytes,          0, TEST_FLAGS_IO),
+	TEST_FUNC(test_eepromfs_crc16,             0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_save,                       0, TEST_FLAGS_IO),
 	TEST_FUNC(test_cache_invalidate,    	1763, TEST_FLAGS_NONE),
+	TEST_FUNC(test_cache_malloc_uncached,      0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_cache_writeback_large,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_debug_sdfs,             	   0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dma_read_misalign,       7003, TEST_FLAGS_NONE),
+	TEST_FUNC(test_dma_queue,                  0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_thread_yield,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_thread_priority,            0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_thread_semaphore,           6, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_thread_preempt,            20, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_heap_arena,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_heap_pool,                  0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_heap_stats,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_heap_tags,                  0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_heap_stack_watermark,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_profile_scopes,             0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_profile_sampling,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_profile_bus,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_memops,                     0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_memops_overwrite_cache,     0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rsp_memops,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rsp_dma_async,              0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rsp_overlay,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_vmath_mat4,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_vmath_quat,                 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_vmath_fix16,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_vmath_rsp_transform,        0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdp_commands,               0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_mixer_spatial,              0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_mixer_event_order,          0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_mixer_voice_pool,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_controller_pack,            0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
 };
 
 int main() {
@@ -8,8 +8,11 @@
 #include <dirent.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
 
 bool flag_verbose = false;
+int flag_jobs = 1;
 
 #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 	#define LE32_TO_HOST(i) __builtin_bswap32(i)
@@ -19,7 +22,7 @@ bool flag_verbose = false;
 
 	#define BE32_TO_HOST(i) (i)
 	#define HOST_TO_BE32(i) (i)
-	#define LE16_TO_HOST(i) (i)
+	#define BE16_TO_HOST(i) (i)
 	#define HOST_TO_BE16(i) (i)
 #else
 	#define BE32_TO_HOST(i) __builtin_bswap32(i)
@@ -48,6 +51,7 @@ void usage(void) {
 	printf("\n");
 	printf("Usage:\n");
 	printf("   audioconv64 [flags] <file-or-dir> [[flags] <file-or-dir>..]\n");
+	printf("   (a file named @<list> is read as a list of files or directories, one per line)\n");
 	printf("\n");
 	printf("Supported conversions:\n");
 	printf("   * WAV => WAV64 (Waveforms)\n");
@@ -55,13 +59,32 @@ void usage(void) {
 	printf("Global options:\n");
 	printf("   -o / --output <dir>       Specify output directory\n");
 	printf("   -v / --verbose            Verbose mode\n");
+	printf("   -j / --jobs <N>           Convert N files in parallel (default: 1; 0: one per CPU)\n");
 	printf("\n");
 	printf("WAV options:\n");
 	printf("   --wav-loop <true|false>   Activate playback loop by default\n");
 	printf("   --wav-loop-offset <N>     Set looping offset (in samples; default: 0)\n");
+	printf("   --wav-compress <true|false>  Compress samples with VADPCM (default: false)\n");
+	printf("   --wav-resample <freq>     Resample to <freq> Hz (eg: the output rate of the mixer,\n");
+	printf("                             so that it does not resample at runtime; default: keep)\n");
+	printf("   --wav-mono <true|false>   Downmix stereo to mono, to use one mixer channel (default: false)\n");
+	printf("   --wav-bits <8|16>         Bits per sample (with dithering when reducing to 8;\n");
+	printf("                             default: keep 8-bit files, expand the others to 16)\n");
 	printf("\n");
 }
 
+// Conversion queued while parsing the command line, run by convert_all
+typedef struct {
+	char *infn;
+	char *outfn;
+	wav_options_t opt;
+} job_t;
+
+job_t *jobs = NULL;
+int num_jobs = 0;
+int next_job = 0;
+int num_errors = 0;
+
 void convert(char *infn, char *outfn1) {
 	char *ext = strrchr(infn, '.');
 	if (!ext) {
@@ -72,16 +95,64 @@ void convert(char *infn, char *outfn1) {
 	char *infn_basename = strrchr(infn, '/');
 	if (!infn_basename) infn_basename = infn;
 
-	char *outfn;
 	if (strcmp(ext, ".wav") == 0 || strcmp(ext, ".WAV") == 0) {
+		char *outfn;
 		asprintf(&outfn, "%s/%s64", outfn1, infn_basename);
-		wav_convert(infn, outfn);
-		free(outfn);
+
+		// A file converted twice keeps the last flags, like a serial conversion
+		// would. Jobs writing the same file must not run in parallel anyway.
+		job_t *job = NULL;
+		for (int i=0; i<num_jobs && !job; i++)
+			if (!strcmp(jobs[i].outfn, outfn)) job = &jobs[i];
+
+		if (job) {
+			free(job->infn);
+			free(job->outfn);
+		} else {
+			jobs = realloc(jobs, (num_jobs+1) * sizeof(job_t));
+			job = &jobs[num_jobs++];
+		}
+
+		// Snapshot the flags given so far, as they apply to this file only
+		job->infn = strdup(infn);
+		job->outfn = outfn;
+		job->opt = wav_options();
 	} else {
 		fprintf(stderr, "WARNING: ignoring unknown file: %s\n", infn);
 	}
 }
 
+void *convert_worker(void *arg) {
+	int i;
+	while ((i = __sync_fetch_and_add(&next_job, 1)) < num_jobs) {
+		if (wav_convert(jobs[i].infn, jobs[i].outfn, &jobs[i].opt) != 0)
+			__sync_fetch_and_add(&num_errors, 1);
+	}
+	return NULL;
+}
+
+// Run all the queued conversions, on flag_jobs threads
+void convert_all(void) {
+	int nthreads = flag_jobs > 0 ? flag_jobs : sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > num_jobs) nthreads = num_jobs;
+
+	if (nthreads <= 1) {
+		convert_worker(NULL);
+	} else {
+		pthread_t threads[nthreads];
+		for (int i=0; i<nthreads; i++)
+			pthread_create(&threads[i], NULL, convert_worker, NULL);
+		for (int i=0; i<nthreads; i++)
+			pthread_join(threads[i], NULL);
+	}
+
+	for (int i=0; i<num_jobs; i++) {
+		free(jobs[i].infn);
+		free(jobs[i].outfn);
+	}
+	free(jobs);
+}
+
 bool isfile(const char *path) {
 	struct stat st;
 	stat(path, &st);
@@ -95,7 +166,24 @@ bool isdir(const char *path) {
 }
 
 void walkdir(char *inpath, char *outpath, void (*func)(char *, char*)) {
-	if (isdir(inpath)) {
+	if (inpath[0] == '@') {
+		// List of files or directories, one per line
+		FILE *f = fopen(inpath+1, "r");
+		if (!f) {
+			fprintf(stderr, "ERROR: cannot open file list: %s\n", inpath+1);
+			num_errors++;
+			return;
+		}
+		char *line = NULL; size_t n = 0; ssize_t len;
+		while ((len = getline(&line, &n, f)) > 0) {
+			while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+				line[--len] = 0;
+			if (len > 0)
+				walkdir(line, outpath, func);
+		}
+		free(line);
+		fclose(f);
+	} else if (isdir(inpath)) {
 		DIR* d = opendir(inpath);
 		struct dirent *de;
 		while ((de = readdir(d))) {
@@ -129,6 +217,16 @@ int main(int argc, char *argv[]) {
 		if (argv[i][0] == '-') {	
 			if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
 				flag_verbose = true;
+			} else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for -j/--jobs\n");
+					return 1;
+				}
+				char extra;
+				if (sscanf(argv[i], "%d%c", &flag_jobs, &extra) != 1 || flag_jobs < 0) {
+					fprintf(stderr, "invalid integer argument for -j/--jobs: %s\n", argv[i]);
+					return 1;
+				}
 			} else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
 				if (++i == argc) {
 					fprintf(stderr, "missing argument for -o/--output\n");
@@ -148,6 +246,52 @@ int main(int argc, char *argv[]) {
 					fprintf(stderr, "invalid boolean argument for --wav-loop: %s\n", argv[i]);
 					return 1;
 				}
+			} else if (!strcmp(argv[i], "--wav-compress")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --wav-compress\n");
+					return 1;
+				}
+				if (!strcmp(argv[i], "true") || !strcmp(argv[i], "1"))
+					flag_wav_compress = true;
+				else if (!strcmp(argv[i], "false") || !strcmp(argv[i], "0"))
+					flag_wav_compress = false;
+				else {
+					fprintf(stderr, "invalid boolean argument for --wav-compress: %s\n", argv[i]);
+					return 1;
+				}
+			} else if (!strcmp(argv[i], "--wav-mono")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --wav-mono\n");
+					return 1;
+				}
+				if (!strcmp(argv[i], "true") || !strcmp(argv[i], "1"))
+					flag_wav_mono = true;
+				else if (!strcmp(argv[i], "false") || !strcmp(argv[i], "0"))
+					flag_wav_mono = false;
+				else {
+					fprintf(stderr, "invalid boolean argument for --wav-mono: %s\n", argv[i]);
+					return 1;
+				}
+			} else if (!strcmp(argv[i], "--wav-resample")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --wav-resample\n");
+					return 1;
+				}
+				char extra;
+				if (sscanf(argv[i], "%d%c", &flag_wav_resample, &extra) != 1 || flag_wav_resample < 0) {
+					fprintf(stderr, "invalid integer argument for --wav-resample: %s\n", argv[i]);
+					return 1;
+				}
+			} else if (!strcmp(argv[i], "--wav-bits")) {
+				if (++i == argc) {
+					fprintf(stderr, "missing argument for --wav-bits\n");
+					return 1;
+				}
+				char extra;
+				if (sscanf(argv[i], "%d%c", &flag_wav_bits, &extra) != 1 || (flag_wav_bits != 8 && flag_wav_bits != 16)) {
+					fprintf(stderr, "invalid argument for --wav-bits (must be 8 or 16): %s\n", argv[i]);
+					return 1;
+				}
 			} else if (!strcmp(argv[i], "--wav-loop-offset")) {
 				if (++i == argc) {
 					fprintf(stderr, "missing argument for --wav-loop-offset\n");
@@ -164,10 +308,12 @@ int main(int argc, char *argv[]) {
 				return 1;
 			}
 		} else {
-			// Positional argument. It's either a file or a directory. Convert it
+			// Positional argument. It's either a file or a directory. Queue it
+			// for conversion with the current flags.
 			walkdir(argv[i], outdir, convert);
 		}
 	}
 
-	return 0;
+	convert_all();
+	return num_errors ? 1 : 0;
 }
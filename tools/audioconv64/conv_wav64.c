@@ -2,11 +2,368 @@
 
 #define DR_WAV_IMPLEMENTATION
 #include "dr_wav.h"
+#include <math.h>
 
 bool flag_wav_looping = false;
 int flag_wav_looping_offset = 0;
+bool flag_wav_compress = false;
+int flag_wav_resample = 0;
+bool flag_wav_mono = false;
+int flag_wav_bits = 0;
 
-int wav_convert(const char *infn, const char *outfn) {
+// Options of a single conversion, taken from the flags preceding the file on
+// the command line (conversions can run in parallel, see --jobs).
+typedef struct {
+	bool looping;
+	int looping_offset;
+	bool compress;
+	int resample;	// Output frequency (0: keep the original one)
+	bool mono;		// Downmix stereo to mono
+	int bits;		// Output bits per sample (0: keep 8 bits, expand anything else to 16)
+} wav_options_t;
+
+static wav_options_t wav_options(void) {
+	return (wav_options_t){
+		.looping = flag_wav_looping,
+		.looping_offset = flag_wav_looping_offset,
+		.compress = flag_wav_compress,
+		.resample = flag_wav_resample,
+		.mono = flag_wav_mono,
+		.bits = flag_wav_bits,
+	};
+}
+
+// Number of zero crossings of the resampling filter on each side: the
+// passband is flat up to ~90% of the Nyquist frequency of the lower rate.
+#define RESAMPLE_ZERO_CROSSINGS   24
+// Shape of the Kaiser window of the filter (~90 dB of stopband attenuation)
+#define RESAMPLE_KAISER_BETA      9.0
+
+// Modified Bessel function of the first kind, order 0 (for the Kaiser window)
+static double bessel_i0(double x) {
+	double sum = 1, term = 1;
+	for (int k=1; k<32; k++) {
+		term *= (x / (2*k)) * (x / (2*k));
+		sum += term;
+	}
+	return sum;
+}
+
+// Index of an input frame, wrapping around the loop past the end. Returns -1
+// for silence (before the start, or after the end of a waveform that does not loop).
+static long resample_index(long i, long cnt, long loop_len) {
+	if (i < 0) return -1;
+	if (i < cnt) return i;
+	if (!loop_len) return -1;
+	return cnt - loop_len + (i - cnt) % loop_len;
+}
+
+// Resample interleaved host-endian samples with a Kaiser-windowed sinc filter,
+// which also acts as the anti-aliasing filter when downsampling. Returns the
+// new buffer, and updates the number of frames.
+static int16_t *wav_resample(int16_t *samples, size_t *cnt, int channels, int in_freq, int out_freq, long loop_len) {
+	double ratio = (double)out_freq / in_freq;
+	double fc = 0.5 * (ratio < 1 ? ratio : 1);	// Cutoff, in cycles per input sample
+	double width = RESAMPLE_ZERO_CROSSINGS / (2 * fc);	// Half length of the filter, in input samples
+	double norm = 1 / bessel_i0(RESAMPLE_KAISER_BETA);
+	size_t out_cnt = (size_t)floor(*cnt * ratio);
+	int16_t *out = malloc((out_cnt ? out_cnt : 1) * channels * sizeof(int16_t));
+
+	for (size_t j=0; j<out_cnt; j++) {
+		double t = j / ratio;
+		long first = (long)ceil(t - width), last = (long)floor(t + width);
+		double acc[2] = {0};
+
+		for (long i=first; i<=last; i++) {
+			long idx = resample_index(i, *cnt, loop_len);
+			if (idx < 0) continue;
+
+			double x = i - t;
+			double w = 1 - (x/width)*(x/width);
+			if (w <= 0) continue;
+			double arg = 2 * M_PI * fc * x;
+			double h = 2 * fc * (arg == 0 ? 1 : sin(arg) / arg) * bessel_i0(RESAMPLE_KAISER_BETA * sqrt(w)) * norm;
+
+			for (int ch=0; ch<channels; ch++)
+				acc[ch] += h * samples[idx*channels + ch];
+		}
+
+		for (int ch=0; ch<channels; ch++) {
+			long v = lrint(acc[ch]);
+			out[j*channels + ch] = v < -32768 ? -32768 : v > 32767 ? 32767 : v;
+		}
+	}
+
+	free(samples);
+	*cnt = out_cnt;
+	return out;
+}
+
+// Reduce host-endian samples to 8 bits (kept in the top byte), with triangular
+// dither to avoid the harmonic distortion of plain truncation.
+static void wav_reduce_8bit(int16_t *samples, size_t num) {
+	uint32_t seed = 0x12345678;
+
+	for (size_t i=0; i<num; i++) {
+		// Two uniform values in [0,256), their sum is triangular in [0,512)
+		seed = seed * 1103515245 + 12345; int r1 = (seed >> 16) & 0xFF;
+		seed = seed * 1103515245 + 12345; int r2 = (seed >> 16) & 0xFF;
+		int v = samples[i] + r1 + r2 - 256 + 128;
+		v = (v >> 8) << 8;
+		samples[i] = v < -32768 ? -32768 : v > 32512 ? 32512 : v;
+	}
+}
+
+// Number of predictors designed for each channel of a VADPCM file
+#define VADPCM_PREDICTORS   4
+// Number of refinement iterations of the predictors, after each split
+#define VADPCM_ITERATIONS   8
+
+// Autocorrelation of a frame, including the two samples before it:
+// r[i][j] = sum of x[t-i]*x[t-j] over the samples of the frame.
+typedef struct {
+	double r[3][3];
+} vadpcm_autocorr_t;
+
+// Prediction error of a frame with an order-2 predictor (x[t] ~ a[0]*x[t-1] + a[1]*x[t-2])
+static double vadpcm_pred_error(const vadpcm_autocorr_t *ac, const double a[2]) {
+	const double (*r)[3] = ac->r;
+	return r[0][0] - 2*a[0]*r[0][1] - 2*a[1]*r[0][2] +
+		a[0]*a[0]*r[1][1] + 2*a[0]*a[1]*r[1][2] + a[1]*a[1]*r[2][2];
+}
+
+// Optimal predictor for the sum of the autocorrelation of some frames
+static void vadpcm_pred_solve(const vadpcm_autocorr_t *ac, double a[2]) {
+	const double (*r)[3] = ac->r;
+	double det = r[1][1]*r[2][2] - r[1][2]*r[1][2];
+	if (fabs(det) < 1e-6 * (r[1][1]*r[2][2] + 1)) {
+		// Singular (eg: silence): fall back to order 1
+		a[0] = r[1][1] > 0 ? r[0][1] / r[1][1] : 0;
+		a[1] = 0;
+	} else {
+		a[0] = (r[0][1]*r[2][2] - r[0][2]*r[1][2]) / det;
+		a[1] = (r[0][2]*r[1][1] - r[0][1]*r[1][2]) / det;
+	}
+
+	// Keep the predictor stable, so that errors fade away
+	if (a[1] > 0.99) a[1] = 0.99;
+	if (a[1] < -0.99) a[1] = -0.99;
+	double lim = 0.99 * (1 - a[1]);
+	if (a[0] > lim) a[0] = lim;
+	if (a[0] < -lim) a[0] = -lim;
+}
+
+// Design the predictors of a channel, by clustering the frames (splitting
+// each predictor in two, then refining them as in k-means). Returns the
+// number of predictors.
+static int vadpcm_design(const vadpcm_autocorr_t *ac, int nframes, double pred[][2]) {
+	int *cluster = calloc(nframes ? nframes : 1, sizeof(int));
+	vadpcm_autocorr_t sum = {0};
+	for (int f=0; f<nframes; f++)
+		for (int i=0; i<9; i++)
+			sum.r[i/3][i%3] += ac[f].r[i/3][i%3];
+	vadpcm_pred_solve(&sum, pred[0]);
+
+	int npred = 1;
+	while (npred < VADPCM_PREDICTORS) {
+		for (int p=0; p<npred; p++) {
+			pred[npred+p][0] = pred[p][0] * 0.99 + 0.01;
+			pred[npred+p][1] = pred[p][1] * 0.99 - 0.01;
+		}
+		npred *= 2;
+
+		for (int it=0; it<VADPCM_ITERATIONS; it++) {
+			vadpcm_autocorr_t sums[VADPCM_PREDICTORS] = {0};
+			int count[VADPCM_PREDICTORS] = {0};
+
+			for (int f=0; f<nframes; f++) {
+				double best = INFINITY;
+				for (int p=0; p<npred; p++) {
+					double err = vadpcm_pred_error(&ac[f], pred[p]);
+					if (err < best) { best = err; cluster[f] = p; }
+				}
+				for (int i=0; i<9; i++)
+					sums[cluster[f]].r[i/3][i%3] += ac[f].r[i/3][i%3];
+				count[cluster[f]]++;
+			}
+
+			// Predictors with no frames are kept as they are
+			for (int p=0; p<npred; p++)
+				if (count[p])
+					vadpcm_pred_solve(&sums[p], pred[p]);
+		}
+	}
+
+	free(cluster);
+	return npred;
+}
+
+// Convert a predictor into the codebook vectors (5.11 fixed point) applied by
+// the decoder to the state: book[0] for the older sample, book[1] for the
+// newer one, which is also the impulse response applied to the residuals.
+static void vadpcm_book(const double a[2], int16_t book[2][8]) {
+	double b0[8], g[9];
+	g[0] = 1; g[1] = a[0];
+	for (int m=2; m<9; m++)
+		g[m] = a[0]*g[m-1] + a[1]*g[m-2];
+	b0[0] = a[1]; b0[1] = a[0]*a[1];
+	for (int j=2; j<8; j++)
+		b0[j] = a[0]*b0[j-1] + a[1]*b0[j-2];
+
+	for (int j=0; j<8; j++) {
+		double v0 = round(b0[j] * 2048), v1 = round(g[j+1] * 2048);
+		book[0][j] = v0 > 32767 ? 32767 : v0 < -32768 ? -32768 : v0;
+		book[1][j] = v1 > 32767 ? 32767 : v1 < -32768 ? -32768 : v1;
+	}
+}
+
+// Encode a frame of one channel with a given predictor and scale, choosing
+// each residual from the decoded samples before it, as the decoder will
+// compute them. Returns the squared error of the decoded frame.
+static double vadpcm_encode_frame(const int16_t book[][2][8], int pred, int scale,
+	const int16_t x[16], const int16_t state[2], uint8_t frame[WAV64_VADPCM_FRAME_BYTES])
+{
+	const int16_t (*b)[8] = book[pred];
+	int16_t s[2] = { state[0], state[1] };
+	int16_t out[16];
+
+	memset(frame, 0, WAV64_VADPCM_FRAME_BYTES);
+	frame[0] = (scale << 4) | pred;
+
+	for (int h=0; h<2; h++) {
+		int e[8];
+		for (int j=0; j<8; j++) {
+			int64_t acc = b[0][j]*s[0] + b[1][j]*s[1];
+			for (int k=0; k<j; k++)
+				acc += b[1][j-k-1]*e[k];
+			double n = round((x[h*8+j]*2048.0 - acc) / (2048.0 * (1 << scale)));
+			int ni = n > 7 ? 7 : n < -8 ? -8 : (int)n;
+			e[j] = ni * (1 << scale);
+			frame[1+j] |= h ? (ni & 0xF) : (ni & 0xF) << 4;
+		}
+
+		// Decode what has been encoded so far (the first half does not
+		// depend on the second one), for the state of the next half.
+		int16_t st[2] = { state[0], state[1] };
+		wav64_vadpcm_decode(book, frame, st, out);
+		s[0] = out[h*8+6];
+		s[1] = out[h*8+7];
+	}
+
+	double err = 0;
+	for (int j=0; j<16; j++)
+		err += (double)(out[j] - x[j]) * (out[j] - x[j]);
+	return err;
+}
+
+// Write all samples as VADPCM (see wav64internal.h): the VADPCM header and
+// codebook, then the frames. Returns the size in bytes of what precedes the
+// frames.
+static int vadpcm_write(FILE *out, int16_t *samples, int cnt, int channels, int loop_len) {
+	int nframes = (cnt + WAV64_VADPCM_FRAME_SAMPLES - 1) / WAV64_VADPCM_FRAME_SAMPLES;
+	int loop_frame = loop_len ? (cnt - loop_len) / WAV64_VADPCM_FRAME_SAMPLES : -1;
+	int16_t book[2][WAV64_VADPCM_MAX_PREDICTORS][2][8] = {0};
+	int npred = 1;
+
+	// Samples of each channel, host-endian, padding the last frame with silence
+	int16_t *x[2];
+	for (int ch=0; ch<channels; ch++) {
+		x[ch] = calloc(nframes * WAV64_VADPCM_FRAME_SAMPLES + 1, sizeof(int16_t));
+		for (int i=0; i<cnt; i++)
+			x[ch][i] = BE16_TO_HOST(samples[i*channels + ch]);
+	}
+
+	// Design the predictors of each channel from the autocorrelation of its frames
+	vadpcm_autocorr_t *ac = calloc(nframes ? nframes : 1, sizeof(vadpcm_autocorr_t));
+	for (int ch=0; ch<channels; ch++) {
+		for (int f=0; f<nframes; f++) {
+			for (int t=f*16; t<f*16+16; t++) {
+				double v[3];
+				for (int i=0; i<3; i++)
+					v[i] = t-i >= 0 ? x[ch][t-i] : 0;
+				for (int i=0; i<9; i++)
+					ac[f].r[i/3][i%3] += v[i/3] * v[i%3];
+			}
+		}
+
+		double pred[VADPCM_PREDICTORS][2];
+		npred = vadpcm_design(ac, nframes, pred);
+		for (int p=0; p<npred; p++)
+			vadpcm_book(pred[p], book[ch][p]);
+		memset(ac, 0, nframes * sizeof(vadpcm_autocorr_t));
+	}
+	free(ac);
+
+	// Encode the frames, trying each predictor with the scales around the
+	// one fitting its largest residual.
+	uint8_t *frames = malloc(nframes * channels * WAV64_VADPCM_FRAME_BYTES + 1);
+	int16_t state[2][2] = {{0}}, loop_state[2][2] = {{0}};
+
+	for (int f=0; f<nframes; f++) {
+		if (f == loop_frame)
+			memcpy(loop_state, state, sizeof(state));
+
+		for (int ch=0; ch<channels; ch++) {
+			const int16_t *xf = x[ch] + f*16;
+			uint8_t *best_frame = frames + (f*channels + ch) * WAV64_VADPCM_FRAME_BYTES;
+			double best = INFINITY;
+
+			for (int p=0; p<npred; p++) {
+				const int16_t (*b)[8] = book[ch][p];
+				int maxr = 0;
+				for (int j=0; j<16; j++) {
+					int prev1 = j >= 1 ? xf[j-1] : state[ch][1];
+					int prev2 = j >= 2 ? xf[j-2] : j == 1 ? state[ch][1] : state[ch][0];
+					int r = abs(xf[j] - ((b[1][0]*prev1 + b[0][0]*prev2) >> 11));
+					if (r > maxr) maxr = r;
+				}
+				int scale0 = 0;
+				while (scale0 < WAV64_VADPCM_MAX_SCALE && (7 << scale0) < maxr)
+					scale0++;
+
+				for (int scale=scale0-1; scale<=scale0+1; scale++) {
+					if (scale < 0 || scale > WAV64_VADPCM_MAX_SCALE)
+						continue;
+					uint8_t frame[WAV64_VADPCM_FRAME_BYTES];
+					double err = vadpcm_encode_frame(book[ch], p, scale, xf, state[ch], frame);
+					if (err < best) {
+						best = err;
+						memcpy(best_frame, frame, WAV64_VADPCM_FRAME_BYTES);
+					}
+				}
+			}
+
+			int16_t out[16];
+			wav64_vadpcm_decode(book[ch], best_frame, state[ch], out);
+		}
+	}
+
+	wav64_vadpcm_header_t vhead = {0};
+	vhead.npredictors = npred;
+	vhead.order = 2;
+	for (int ch=0; ch<2; ch++)
+		for (int i=0; i<2; i++)
+			vhead.loop_state[ch][i] = HOST_TO_BE16(loop_state[ch][i]);
+	fwrite(&vhead, 1, sizeof(vhead), out);
+
+	for (int ch=0; ch<channels; ch++) {
+		for (int p=0; p<npred; p++) {
+			for (int i=0; i<16; i++) {
+				int16_t v = HOST_TO_BE16(book[ch][p][i/8][i%8]);
+				fwrite(&v, 1, 2, out);
+			}
+		}
+	}
+
+	fwrite(frames, 1, nframes * channels * WAV64_VADPCM_FRAME_BYTES, out);
+
+	free(frames);
+	for (int ch=0; ch<channels; ch++)
+		free(x[ch]);
+	return sizeof(vhead) + channels * npred * 16 * sizeof(int16_t);
+}
+
+int wav_convert(const char *infn, const char *outfn, const wav_options_t *opt) {
 	drwav wav;
 	if (!drwav_init_file(&wav, infn, NULL)) {
 		fprintf(stderr, "ERROR: %s: not a valid WAV file\n", infn);
@@ -22,14 +379,55 @@ int wav_convert(const char *infn, const char *outfn) {
 		fprintf(stderr, "WARNING: %s: %llu frames found, but only %zu decoded\n", infn, wav.totalPCMFrameCount, cnt);
 	}
 
-	// Keep 8 bits file if original is 8 bit, otherwise expand to 16 bit.
-	int nbits = wav.bitsPerSample == 8 ? 8 : 16;
+	int channels = wav.channels;
+	int freq = wav.sampleRate;
+	int looping_offset = opt->looping_offset;
+
+	// Keep 8 bits file if original is 8 bit, otherwise expand to 16 bit, unless
+	// asked otherwise. VADPCM is always decoded as 16 bit.
+	int nbits = opt->bits ? opt->bits : wav.bitsPerSample == 8 ? 8 : 16;
+	if (opt->compress) nbits = 16;
+
+	if (opt->looping && (looping_offset < 0 || looping_offset > cnt)) {
+		fprintf(stderr, "WARNING: %s: invalid looping offset: %d (size: %zu)\n", infn, looping_offset, cnt);
+		looping_offset = cnt;
+	}
+
+	bool mono = opt->mono && channels == 2;
+	bool resample = opt->resample && opt->resample != freq;
+	bool reduce = nbits == 8 && wav.bitsPerSample > 8;
+
+	if (mono || resample || reduce) {
+		// Process the samples in host order
+		for (size_t i=0; i<cnt*channels; i++)
+			samples[i] = BE16_TO_HOST(samples[i]);
+
+		if (mono) {
+			// A single mixer channel instead of two
+			for (size_t i=0; i<cnt; i++)
+				samples[i] = (samples[i*2] + samples[i*2+1]) >> 1;
+			channels = 1;
+		}
+
+		if (resample) {
+			// Playing at the output rate of the mixer saves the resampling at runtime.
+			// The loop is resampled as part of the waveform, so that it stays seamless.
+			long loop = opt->looping ? cnt - looping_offset : 0;
+			double ratio = (double)opt->resample / freq;
+			samples = wav_resample(samples, &cnt, channels, freq, opt->resample, loop);
+			looping_offset = lrint(looping_offset * ratio);
+			if (looping_offset > cnt) looping_offset = cnt;
+			freq = opt->resample;
+		}
+
+		if (reduce)
+			wav_reduce_8bit(samples, cnt*channels);
 
-	int loop_len = flag_wav_looping ? cnt - flag_wav_looping_offset : 0;
-	if (loop_len < 0) {
-		fprintf(stderr, "WARNING: %s: invalid looping offset: %d (size: %zu)\n", infn, flag_wav_looping_offset, cnt);
-		loop_len = 0;
+		for (size_t i=0; i<cnt*channels; i++)
+			samples[i] = HOST_TO_BE16(samples[i]);
 	}
+
+	int loop_len = opt->looping ? cnt - looping_offset : 0;
 	if (loop_len&1 && nbits==8) {
 		// Odd loop lengths are not supported for 8-bit waveforms because they would
 		// change the 2-byte phase between ROM and RDRAM addresses during loop unrolling.
@@ -43,10 +441,10 @@ int wav_convert(const char *infn, const char *outfn) {
 
 	memcpy(head.id, "WV64", 4);
 	head.version = WAV64_FILE_VERSION;
-	head.format = 0;
-	head.channels = wav.channels;
+	head.format = opt->compress ? WAV64_FORMAT_VADPCM : WAV64_FORMAT_RAW;
+	head.channels = channels;
 	head.nbits = nbits;
-	head.freq = HOST_TO_BE32(wav.sampleRate);
+	head.freq = HOST_TO_BE32(freq);
 	head.len = HOST_TO_BE32(cnt);
 	head.loop_len = HOST_TO_BE32(loop_len);
 	head.start_offset = HOST_TO_BE32(sizeof(wav64_header_t));
@@ -64,8 +462,22 @@ int wav_convert(const char *infn, const char *outfn) {
 
 	fwrite(&head, 1, sizeof(wav64_header_t), out);
 
+	if (opt->compress) {
+		// VADPCM frames are decoded at any position, so the player does not
+		// need padding to overread. The samples follow the codebook, whose
+		// size is known only after designing it.
+		int book_size = vadpcm_write(out, samples, cnt, channels, loop_len);
+		head.start_offset = HOST_TO_BE32(sizeof(wav64_header_t) + book_size);
+		fseek(out, 0, SEEK_SET);
+		fwrite(&head, 1, sizeof(wav64_header_t), out);
+		fclose(out);
+		free(samples);
+		drwav_uninit(&wav);
+		return 0;
+	}
+
 	int16_t *sptr = samples;
-	for (int i=0;i<cnt*wav.channels;i++) {
+	for (int i=0;i<cnt*channels;i++) {
 		// Write the sample as 16bit or 8bit. Since *sptr is 16-bit big-endian,
 		// the 8bit representation is just the first byte (MSB). Notice
 		// that WAV64 8bit is signed anyway.
@@ -82,8 +494,8 @@ int wav_convert(const char *infn, const char *outfn) {
 		int idx = cnt - loop_len;
 		int nb = 0;
 		while (nb < OVERREAD_BYTES) {
-			int16_t *sptr = samples + idx*wav.channels;
-			for (int ch=0;ch<wav.channels;ch++) {
+			int16_t *sptr = samples + idx*channels;
+			for (int ch=0;ch<channels;ch++) {
 				nb += fwrite(sptr, 1, nbits==8 ? 1 : 2, out);
 				sptr++;
 			}
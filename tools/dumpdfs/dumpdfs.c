@@ -531,6 +531,34 @@ int dfs_open(const char * const path)
     file->loc = 0;
     file->cart_start_loc = t_node.file_pointer;
     file->cached_loc = 0xFFFFFFFF;
+    file->comp = 0;
+
+    if(get_flags(&t_node) & FLAGS_COMPRESSED)
+    {
+        /* Block offsets are read straight from the image */
+        dfs_compressed_header_t *header = (dfs_compressed_header_t *)get_file_location(file->cart_start_loc, 0);
+
+        file->comp = calloc(1, sizeof(dfs_compressed_file_t));
+
+        if(!file->comp)
+        {
+            memset(file, 0, sizeof(open_file_t));
+            return DFS_ENOMEM;
+        }
+
+        file->comp->block_size = SWAPLONG(header->block_size);
+        file->comp->num_blocks = SWAPLONG(header->num_blocks);
+        file->comp->offsets = (uint32_t *)(header + 1);
+        file->comp->decoded = malloc(file->comp->block_size);
+        file->comp->decoded_block = -1;
+
+        if(!file->comp->decoded)
+        {
+            free(file->comp);
+            memset(file, 0, sizeof(open_file_t));
+            return DFS_ENOMEM;
+        }
+    }
 
     return file->handle;
 }
@@ -546,6 +574,12 @@ int dfs_close(uint32_t handle)
         return DFS_EBADHANDLE;
     }
 
+    if(file->comp)
+    {
+        free(file->comp->decoded);
+        free(file->comp);
+    }
+
     /* Closing the handle is easy as zeroing out the file */
     memset(file, 0, sizeof(open_file_t));
 
@@ -627,6 +661,61 @@ int dfs_tell(uint32_t handle)
     return file->loc;
 }
 
+/* Decompress a block of a compressed file into the file's buffer */
+static int comp_decode(open_file_t *file, int blk)
+{
+    dfs_compressed_file_t *comp = file->comp;
+    uint32_t start = SWAPLONG(comp->offsets[blk]);
+    int comp_len = SWAPLONG(comp->offsets[blk+1]) - start;
+    int blk_len = file->size - blk * comp->block_size;
+
+    if(blk_len > comp->block_size) { blk_len = comp->block_size; }
+
+    uint8_t *src = get_file_location(file->cart_start_loc, start);
+
+    if(comp_len >= blk_len)
+    {
+        memcpy(comp->decoded, src, blk_len);
+    }
+    else if(dfs_lz4_decompress(src, comp_len, comp->decoded, blk_len) != blk_len)
+    {
+        comp->decoded_block = -1;
+        return DFS_EBADFS;
+    }
+
+    comp->decoded_block = blk;
+    return DFS_ESUCCESS;
+}
+
+/* Read from a compressed file, one block at a time */
+static int comp_read(open_file_t *file, uint8_t *data, int to_read)
+{
+    dfs_compressed_file_t *comp = file->comp;
+    int did_read = 0;
+
+    while(to_read)
+    {
+        int blk = file->loc / comp->block_size;
+        int offset = file->loc % comp->block_size;
+
+        if(blk != comp->decoded_block && comp_decode(file, blk) != DFS_ESUCCESS)
+        {
+            return DFS_EBADFS;
+        }
+
+        int copy = comp->block_size - offset;
+        if(copy > to_read) { copy = to_read; }
+
+        memcpy(data, comp->decoded + offset, copy);
+        file->loc += copy;
+        data += copy;
+        to_read -= copy;
+        did_read += copy;
+    }
+
+    return did_read;
+}
+
 int dfs_read(void * const buf, int size, int count, uint32_t handle)
 {
     /* This is where we do all the work */
@@ -652,6 +741,11 @@ int dfs_read(void * const buf, int size, int count, uint32_t handle)
         to_read = file->size - file->loc;
     }
 
+    if(file->comp)
+    {
+        return comp_read(file, buf, to_read);
+    }
+
     memcpy(buf, get_file_location(file->cart_start_loc, file->loc), to_read);
     file->loc += to_read;
 
@@ -713,7 +807,10 @@ void list_dir( char *directory, int depth )
 
         if( FILETYPE( dir ) == FLAGS_DIR )
         {
+            /* The listing of the subdirectory replaces the current one */
+            directory_entry_t *next = next_entry;
             list_dir( path, depth + 2 );
+            next_entry = next;
         }
     } while( (dir = dfs_dir_findnext( path )) != FLAGS_EOF );
 }
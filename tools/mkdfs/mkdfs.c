@@ -19,6 +19,55 @@
 uint8_t *dfs = NULL;
 uint32_t fs_size = 0;
 
+/* Files collected for the optional path index */
+typedef struct
+{
+    char *path;
+    uint32_t flags;
+    uint32_t file_pointer;
+} index_file_t;
+
+int build_index = 0;
+int compress_files = 0;
+int build_bundles = 0;
+index_file_t *index_files = NULL;
+int num_index_files = 0;
+
+/* Files placed first, in the order of the layout manifest */
+typedef struct
+{
+    char *path;
+    uint32_t blob;
+    uint32_t size;
+    uint32_t flags;
+    int used;
+} placed_file_t;
+
+placed_file_t *placed_files = NULL;
+int num_placed_files = 0;
+
+/* Payload of a file stored in an image, recorded in the cache of --incremental */
+typedef struct
+{
+    char *path;
+    uint32_t size;
+    int64_t mtime;
+    uint32_t flags;
+    uint32_t blob;
+    uint32_t stored_size;
+} cached_file_t;
+
+/* Version of the cache file written next to the image */
+#define CACHE_VERSION 1
+
+int incremental = 0;
+uint8_t *old_dfs = NULL;
+uint32_t old_fs_size = 0;
+cached_file_t *old_files = NULL;
+int num_old_files = 0;
+cached_file_t *new_files = NULL;
+int num_new_files = 0;
+
 /* Offset from start of filesystem */
 inline uint32_t sector_offset(void *sector)
 {
@@ -35,7 +84,7 @@ inline void *sector_to_memory(uint32_t offset)
 uint32_t dfs_alloc(int size)
 {
     void *end;
-    int rsize = (size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+    uint32_t rsize = (size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
 
     if(!dfs)
     {
@@ -69,22 +118,481 @@ uint32_t new_blob(int size)
     return dfs_alloc(size);    
 }
 
+/* Sector reserved for the first entry of the root directory. DragonFS looks
+   for it right after the root sector, so it is reserved before the files of
+   the layout manifest are placed. */
+uint32_t root_entry = 0;
+
+/* Add a new sector for a directory entry, return that sector pointer */
+uint32_t new_entry_sector(void)
+{
+    uint32_t entry = root_entry;
+
+    if(!entry)
+    {
+        return new_sector();
+    }
+
+    root_entry = 0;
+    return entry;
+}
+
 void kill_fs()
 {
     if(dfs)
     {
         free(dfs);
     }
+
+    for(int i = 0; i < num_index_files; i++)
+    {
+        free(index_files[i].path);
+    }
+
+    free(index_files);
+
+    for(int i = 0; i < num_placed_files; i++)
+    {
+        free(placed_files[i].path);
+    }
+
+    free(placed_files);
+
+    for(int i = 0; i < num_old_files; i++)
+    {
+        free(old_files[i].path);
+    }
+
+    free(old_files);
+    free(old_dfs);
+
+    for(int i = 0; i < num_new_files; i++)
+    {
+        free(new_files[i].path);
+    }
+
+    free(new_files);
 }
 
 void print_help(const char * const prog_name)
 {
-    fprintf(stderr, "Usage: %s <File> <Directory>\n", prog_name);
+    fprintf(stderr, "Usage: %s [--index] [--compress] [--bundles] [--order <Manifest>] [--incremental] <File> <Directory>\n", prog_name);
     fprintf(stderr, "  where <File> is the resulting filesystem image\n");
     fprintf(stderr, "  and <Directory> is the directory (including subdirectories) to include\n");
+    fprintf(stderr, "  --index     Append a hash table of all paths, for faster file lookups\n");
+    fprintf(stderr, "  --compress  Compress files with LZ4 (only those that shrink)\n");
+    fprintf(stderr, "  --bundles   Store each directory named *.bundle as a single file, packing\n");
+    fprintf(stderr, "              all the files in it (see bundle_load)\n");
+    fprintf(stderr, "  --order     Place the files listed in <Manifest> first, one after the other,\n");
+    fprintf(stderr, "              in the order given (one path relative to <Directory> per line;\n");
+    fprintf(stderr, "              empty lines and lines starting with # are ignored; paths that\n");
+    fprintf(stderr, "              are not found are skipped with a warning)\n");
+    fprintf(stderr, "  --incremental  Reuse the data of the files that did not change (same size and\n");
+    fprintf(stderr, "              modification time) from the previous <File>, as recorded in\n");
+    fprintf(stderr, "              <File>.cache, and leave <File> untouched if nothing changed\n");
+    fprintf(stderr, "The data of each file starts on a %d-byte boundary of the image.\n", SECTOR_SIZE);
+}
+
+/* Record a file for the path index. Flags and pointer are already byteswapped. */
+int index_add_file(const char * const prefix, const char * const name, uint32_t flags, uint32_t file_pointer)
+{
+    if(!build_index)
+    {
+        return 1;
+    }
+
+    int len = strlen(prefix) + strlen(name) + 1;
+
+    if(len + 1 > DFS_INDEX_MAX_PATH)
+    {
+        /* Too long for the index: the runtime will fall back to a directory walk */
+        fprintf(stderr, "Warning: path '%s%s' too long, not indexed.\n", prefix, name);
+        return 1;
+    }
+
+    index_files = realloc(index_files, (num_index_files + 1) * sizeof(index_file_t));
+
+    if(!index_files)
+    {
+        return 0;
+    }
+
+    index_file_t *f = &index_files[num_index_files++];
+    f->path = malloc(len);
+
+    if(!f->path)
+    {
+        return 0;
+    }
+
+    strcpy(f->path, prefix);
+    strcat(f->path, name);
+    f->flags = flags;
+    f->file_pointer = file_pointer;
+
+    return 1;
+}
+
+/* Number of buckets used by the index, stashed for the qsort comparator */
+uint32_t index_num_buckets = 0;
+
+int index_compare(const void *a, const void *b)
+{
+    uint32_t ba = dfs_path_hash(((const index_file_t *)a)->path) & (index_num_buckets - 1);
+    uint32_t bb = dfs_path_hash(((const index_file_t *)b)->path) & (index_num_buckets - 1);
+
+    return (ba > bb) - (ba < bb);
 }
 
-uint32_t add_file(const char * const file, uint32_t *size)
+/* Append the path index to the filesystem, and return its offset */
+uint32_t add_index(void)
+{
+    uint32_t num_buckets = 1;
+
+    /* Keep the load factor below 1, so that buckets are mostly 0 or 1 entries */
+    while(num_buckets < (uint32_t)num_index_files)
+    {
+        num_buckets <<= 1;
+    }
+
+    index_num_buckets = num_buckets;
+    qsort(index_files, num_index_files, sizeof(index_file_t), index_compare);
+
+    uint32_t strings_size = 0;
+
+    for(int i = 0; i < num_index_files; i++)
+    {
+        strings_size += strlen(index_files[i].path) + 1;
+    }
+
+    uint32_t buckets_off = sizeof(dfs_index_header_t);
+    uint32_t entries_off = buckets_off + (num_buckets + 1) * sizeof(uint32_t);
+    uint32_t strings_off = entries_off + num_index_files * sizeof(dfs_index_entry_t);
+
+    uint32_t index = new_blob(strings_off + strings_size);
+
+    /* Fill the index (after allocating, as the image might have moved) */
+    uint8_t *base = sector_to_memory(index);
+    dfs_index_header_t *header = (dfs_index_header_t *)base;
+    uint32_t *buckets = (uint32_t *)(base + buckets_off);
+    dfs_index_entry_t *entries = (dfs_index_entry_t *)(base + entries_off);
+    char *strings = (char *)(base + strings_off);
+
+    header->magic = SWAPLONG(DFS_INDEX_MAGIC);
+    header->num_buckets = SWAPLONG(num_buckets);
+    header->num_entries = SWAPLONG(num_index_files);
+    header->reserved = 0;
+
+    uint32_t b = 0;
+
+    for(int i = 0; i < num_index_files; i++)
+    {
+        uint32_t hash = dfs_path_hash(index_files[i].path);
+
+        /* Open all buckets up to this entry's one */
+        while(b <= (hash & (num_buckets - 1)))
+        {
+            buckets[b++] = SWAPLONG(i);
+        }
+
+        entries[i].hash = SWAPLONG(hash);
+        entries[i].path = SWAPLONG(index + (uint32_t)(strings - (char *)base));
+        entries[i].flags = index_files[i].flags;
+        entries[i].file_pointer = index_files[i].file_pointer;
+
+        strcpy(strings, index_files[i].path);
+        strings += strlen(index_files[i].path) + 1;
+    }
+
+    while(b <= num_buckets)
+    {
+        buckets[b++] = SWAPLONG(num_index_files);
+    }
+
+    return index;
+}
+
+/* LZ4 block format parameters */
+#define LZ4_MIN_MATCH   4
+#define LZ4_MFLIMIT     12
+#define LZ4_LAST_LITERALS 5
+#define LZ4_HASH_BITS   12
+
+static uint8_t *lz4_write_len(uint8_t *out, int len)
+{
+    while(len >= 255)
+    {
+        *out++ = 255;
+        len -= 255;
+    }
+
+    *out++ = len;
+    return out;
+}
+
+static uint8_t *lz4_write_sequence(uint8_t *out, const uint8_t *lit, int lit_len, int offset, int match_len)
+{
+    uint8_t *token = out++;
+
+    *token = (lit_len >= 15 ? 15 : lit_len) << 4;
+    if(lit_len >= 15) { out = lz4_write_len(out, lit_len - 15); }
+
+    memcpy(out, lit, lit_len);
+    out += lit_len;
+
+    if(match_len)
+    {
+        *out++ = offset & 0xFF;
+        *out++ = offset >> 8;
+
+        match_len -= LZ4_MIN_MATCH;
+        *token |= (match_len >= 15 ? 15 : match_len);
+        if(match_len >= 15) { out = lz4_write_len(out, match_len - 15); }
+    }
+
+    return out;
+}
+
+/* Greedy LZ4 block compressor. The output buffer must hold at least
+   len + len/255 + 16 bytes. Returns the compressed size. */
+int lz4_compress(const uint8_t *src, int len, uint8_t *out)
+{
+    static int table[1 << LZ4_HASH_BITS];
+    const uint8_t *anchor = src;
+    uint8_t *o = out;
+    int i = 0;
+
+    for(int j = 0; j < (1 << LZ4_HASH_BITS); j++) { table[j] = -1; }
+
+    while(i + LZ4_MFLIMIT <= len)
+    {
+        uint32_t seq = src[i] | (src[i+1] << 8) | (src[i+2] << 16) | ((uint32_t)src[i+3] << 24);
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        int ref = table[h];
+
+        table[h] = i;
+
+        if(ref < 0 || i - ref > 0xFFFF || memcmp(src + ref, src + i, LZ4_MIN_MATCH))
+        {
+            i++;
+            continue;
+        }
+
+        /* Extend the match, leaving the last literals alone */
+        int mlen = LZ4_MIN_MATCH;
+        while(i + mlen < len - LZ4_LAST_LITERALS && src[ref + mlen] == src[i + mlen]) { mlen++; }
+
+        o = lz4_write_sequence(o, anchor, (src + i) - anchor, i - ref, mlen);
+
+        i += mlen;
+        anchor = src + i;
+    }
+
+    /* Last sequence: only literals */
+    return lz4_write_sequence(o, anchor, (src + len) - anchor, 0, 0) - out;
+}
+
+/* Compress the contents of a file already added to the image, replacing
+   them in place. Returns 1 if the file was compressed, 0 if it was left as is. */
+int compress_blob(uint32_t blob, uint32_t size)
+{
+    uint32_t num_blocks = (size + DFS_COMPRESS_BLOCK_SIZE - 1) / DFS_COMPRESS_BLOCK_SIZE;
+
+    if(!num_blocks)
+    {
+        return 0;
+    }
+
+    uint32_t header_size = sizeof(dfs_compressed_header_t) + (num_blocks + 1) * sizeof(uint32_t);
+    uint8_t *out = malloc(header_size + size + num_blocks * (DFS_COMPRESS_BLOCK_SIZE / 255 + 16));
+
+    if(!out)
+    {
+        return 0;
+    }
+
+    const uint8_t *data = sector_to_memory(blob);
+    dfs_compressed_header_t *header = (dfs_compressed_header_t *)out;
+    uint32_t *offsets = (uint32_t *)(out + sizeof(dfs_compressed_header_t));
+    uint32_t pos = header_size;
+
+    header->block_size = SWAPLONG(DFS_COMPRESS_BLOCK_SIZE);
+    header->num_blocks = SWAPLONG(num_blocks);
+
+    for(uint32_t i = 0; i < num_blocks; i++)
+    {
+        int blk_len = MIN(size - i * DFS_COMPRESS_BLOCK_SIZE, DFS_COMPRESS_BLOCK_SIZE);
+        const uint8_t *blk = data + i * DFS_COMPRESS_BLOCK_SIZE;
+        int clen = lz4_compress(blk, blk_len, out + pos);
+
+        offsets[i] = SWAPLONG(pos);
+
+        /* Blocks are padded to 2 bytes for DMA; store them raw if that doesn't help */
+        if(clen + (clen & 1) >= blk_len)
+        {
+            memcpy(out + pos, blk, blk_len);
+            clen = blk_len;
+        }
+
+        if(clen & 1) { out[pos + clen++] = 0; }
+
+        pos += clen;
+    }
+
+    offsets[num_blocks] = SWAPLONG(pos);
+
+    /* Keep the file uncompressed unless it saves at least one sector */
+    uint32_t rsize = (size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+
+    if(pos > rsize - SECTOR_SIZE)
+    {
+        free(out);
+        return 0;
+    }
+
+    /* The file is the last blob in the image, so it can be shrunk in place */
+    fs_size = blob;
+    dfs_alloc(pos);
+    memcpy(sector_to_memory(blob), out, pos);
+
+    free(out);
+    return 1;
+}
+
+int cached_file_compare(const void *a, const void *b)
+{
+    return strcmp(((const cached_file_t *)a)->path, ((const cached_file_t *)b)->path);
+}
+
+/* Load the previous image and its cache, for --incremental. Missing or stale
+   caches are not an error: all the files are just added again. */
+void load_cache(const char * const out_file)
+{
+    char *cache_file = malloc(strlen(out_file) + 7);
+    sprintf(cache_file, "%s.cache", out_file);
+
+    FILE *cp = fopen(cache_file, "r");
+    FILE *fp = fopen(out_file, "rb");
+    int version, compressed;
+
+    free(cache_file);
+
+    if(!cp || !fp || fscanf(cp, "mkdfs-cache %d %d\n", &version, &compressed) != 2 ||
+       version != CACHE_VERSION || compressed != compress_files)
+    {
+        if(cp) { fclose(cp); }
+        if(fp) { fclose(fp); }
+        return;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    old_fs_size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    old_dfs = malloc(old_fs_size);
+
+    if(!old_dfs || fread(old_dfs, 1, old_fs_size, fp) != old_fs_size)
+    {
+        free(old_dfs);
+        old_dfs = NULL;
+        old_fs_size = 0;
+        fclose(cp);
+        fclose(fp);
+        return;
+    }
+
+    fclose(fp);
+
+    cached_file_t entry;
+    long long mtime;
+    char path[4096];
+
+    while(fscanf(cp, "%u %lld %u %u %u %4095[^\n]\n", &entry.size, &mtime, &entry.flags,
+                 &entry.blob, &entry.stored_size, path) == 6)
+    {
+        if(entry.blob > old_fs_size || entry.stored_size > old_fs_size - entry.blob)
+        {
+            continue;
+        }
+
+        entry.mtime = mtime;
+        entry.path = strdup(path);
+        old_files = realloc(old_files, (num_old_files + 1) * sizeof(cached_file_t));
+        old_files[num_old_files++] = entry;
+    }
+
+    fclose(cp);
+
+    qsort(old_files, num_old_files, sizeof(cached_file_t), cached_file_compare);
+}
+
+/* Write the cache of the image just built, for the next --incremental run */
+int save_cache(const char * const out_file)
+{
+    char *cache_file = malloc(strlen(out_file) + 7);
+    sprintf(cache_file, "%s.cache", out_file);
+
+    FILE *cp = fopen(cache_file, "w");
+
+    if(!cp)
+    {
+        fprintf(stderr, "Error opening '%s' for writing.\n", cache_file);
+        free(cache_file);
+        return 0;
+    }
+
+    free(cache_file);
+
+    fprintf(cp, "mkdfs-cache %d %d\n", CACHE_VERSION, compress_files);
+
+    for(int i = 0; i < num_new_files; i++)
+    {
+        cached_file_t *entry = &new_files[i];
+
+        fprintf(cp, "%u %lld %u %u %u %s\n", entry->size, (long long)entry->mtime, entry->flags,
+                entry->blob, entry->stored_size, entry->path);
+    }
+
+    fclose(cp);
+
+    return 1;
+}
+
+/* Find a file in the previous image, if its payload can be reused */
+cached_file_t *find_cached_file(const char * const file, uint32_t size, int64_t mtime)
+{
+    cached_file_t key = { .path = (char *)file };
+    cached_file_t *entry = bsearch(&key, old_files, num_old_files, sizeof(cached_file_t), cached_file_compare);
+
+    if(!entry || entry->size != size || entry->mtime != mtime)
+    {
+        return NULL;
+    }
+
+    return entry;
+}
+
+/* Remember where the data of a file is stored, for the cache of --incremental */
+void record_file(const char * const file, uint32_t size, int64_t mtime, uint32_t flags, uint32_t blob)
+{
+    if(!incremental)
+    {
+        return;
+    }
+
+    new_files = realloc(new_files, (num_new_files + 1) * sizeof(cached_file_t));
+
+    cached_file_t *entry = &new_files[num_new_files++];
+
+    entry->path = strdup(file);
+    entry->size = size;
+    entry->mtime = mtime;
+    entry->flags = flags;
+    entry->blob = blob;
+    /* The file is the last blob in the image */
+    entry->stored_size = fs_size - blob;
+}
+
+uint32_t add_file(const char * const file, uint32_t *size, uint32_t *flags)
 {
     FILE *fp;
 
@@ -108,6 +616,23 @@ uint32_t add_file(const char * const file, uint32_t *size)
         return 0;
     }
 
+    struct stat st;
+    int64_t mtime = (stat(file, &st) == 0) ? st.st_mtime : -1;
+    cached_file_t *cached = incremental ? find_cached_file(file, *size, mtime) : NULL;
+
+    if(cached)
+    {
+        /* Unchanged since the previous image: copy the data as it was stored */
+        fclose(fp);
+
+        uint32_t blob = new_blob(cached->stored_size);
+        memcpy(sector_to_memory(blob), old_dfs + cached->blob, cached->stored_size);
+        *flags = cached->flags;
+
+        record_file(file, *size, mtime, *flags, blob);
+        return blob;
+    }
+
     uint32_t blob = new_blob(*size);
     uint8_t *data = sector_to_memory(blob);
 
@@ -120,10 +645,313 @@ uint32_t add_file(const char * const file, uint32_t *size)
     }
 
     fclose(fp);
+
+    *flags = FLAGS_FILE;
+
+    if(compress_files && compress_blob(blob, *size))
+    {
+        *flags |= FLAGS_COMPRESSED;
+    }
+
+    record_file(file, *size, mtime, *flags, blob);
     return blob;
 }
 
-uint32_t add_directory(const char * const path)
+/* Member of the bundle being built */
+typedef struct
+{
+    char *name;
+    char *file;
+    uint32_t size;
+} bundle_member_t;
+
+/* Round up an offset within a bundle to the alignment of the members */
+#define BUNDLE_ALIGN(x) (((x) + DFS_BUNDLE_ALIGN - 1) & ~(DFS_BUNDLE_ALIGN - 1))
+
+int is_bundle(const char * const name)
+{
+    int len = strlen(name);
+
+    return build_bundles && len > 7 && !strcmp(name + len - 7, ".bundle");
+}
+
+int bundle_compare(const void *a, const void *b)
+{
+    return strcmp(((const bundle_member_t *)a)->name, ((const bundle_member_t *)b)->name);
+}
+
+/* Collect the files of a bundle directory, including subdirectories */
+int collect_bundle(const char * const path, const char * const prefix, bundle_member_t **members, int *num_members)
+{
+    DIR *dirp;
+    struct dirent *dp;
+    int ok = 1;
+
+    if((dirp = opendir(path)) == NULL)
+    {
+        return 0;
+    }
+
+    while(ok && (dp = readdir(dirp)) != NULL)
+    {
+        if(strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char *file = malloc(strlen(path) + strlen(dp->d_name) + 2);
+        char *name = malloc(strlen(prefix) + strlen(dp->d_name) + 2);
+        struct stat stats;
+
+        if(!file || !name)
+        {
+            /* Out of memory */
+            free(file);
+            free(name);
+            ok = 0;
+            break;
+        }
+
+        sprintf(file, "%s/%s", path, dp->d_name);
+        sprintf(name, "%s%s", prefix, dp->d_name);
+        stat(file, &stats);
+
+        if(S_ISREG(stats.st_mode))
+        {
+            *members = realloc(*members, (*num_members + 1) * sizeof(bundle_member_t));
+
+            if(!*members)
+            {
+                free(file);
+                free(name);
+                ok = 0;
+                break;
+            }
+
+            bundle_member_t *m = &(*members)[(*num_members)++];
+            m->name = name;
+            m->file = file;
+            m->size = stats.st_size;
+            continue;
+        }
+
+        if(S_ISDIR(stats.st_mode))
+        {
+            strcat(name, "/");
+            ok = collect_bundle(file, name, members, num_members);
+        }
+
+        free(file);
+        free(name);
+    }
+
+    closedir(dirp);
+    return ok;
+}
+
+/* Pack all the files of a directory into a bundle (see dfs_bundle_header_t) */
+uint32_t add_bundle(const char * const path, uint32_t *size, uint32_t *flags)
+{
+    bundle_member_t *members = NULL;
+    int num_members = 0;
+    uint32_t blob = 0;
+
+    printf("Adding bundle '%s' to filesystem image.\n", path);
+
+    if(!collect_bundle(path, "", &members, &num_members) || !num_members)
+    {
+        fprintf(stderr, "Cannot read the files of bundle '%s'!\n", path);
+        goto end;
+    }
+
+    /* Sort the members, so that they can be looked up with a binary search */
+    qsort(members, num_members, sizeof(bundle_member_t), bundle_compare);
+
+    uint32_t names_off = sizeof(dfs_bundle_header_t) + num_members * sizeof(dfs_bundle_entry_t);
+    uint32_t total = names_off;
+
+    for(int i = 0; i < num_members; i++)
+    {
+        total += strlen(members[i].name) + 1;
+    }
+
+    uint32_t data_off = BUNDLE_ALIGN(total);
+    total = data_off;
+
+    for(int i = 0; i < num_members; i++)
+    {
+        total = BUNDLE_ALIGN(total + members[i].size);
+    }
+
+    if(total > 0x0FFFFFFF)
+    {
+        fprintf(stderr, "Bundle '%s' too big for the filesystem!\n", path);
+        goto end;
+    }
+
+    blob = new_blob(total);
+
+    uint8_t *base = sector_to_memory(blob);
+    dfs_bundle_header_t *header = (dfs_bundle_header_t *)base;
+    dfs_bundle_entry_t *entries = (dfs_bundle_entry_t *)(base + sizeof(dfs_bundle_header_t));
+    uint32_t name_pos = names_off;
+    uint32_t pos = data_off;
+
+    header->magic = SWAPLONG(DFS_BUNDLE_MAGIC);
+    header->num_files = SWAPLONG(num_members);
+    header->size = SWAPLONG(total);
+    header->reserved = 0;
+
+    for(int i = 0; i < num_members; i++)
+    {
+        FILE *fp = fopen(members[i].file, "rb");
+
+        if(!fp || fread(base + pos, 1, members[i].size, fp) != members[i].size)
+        {
+            fprintf(stderr, "Cannot add all contents of file '%s' to bundle!\n", members[i].file);
+            if(fp) { fclose(fp); }
+            blob = 0;
+            goto end;
+        }
+
+        fclose(fp);
+
+        entries[i].name = SWAPLONG(name_pos);
+        entries[i].data = SWAPLONG(pos);
+        entries[i].size = SWAPLONG(members[i].size);
+        entries[i].reserved = 0;
+
+        strcpy((char *)base + name_pos, members[i].name);
+        name_pos += strlen(members[i].name) + 1;
+        pos = BUNDLE_ALIGN(pos + members[i].size);
+    }
+
+    *size = total;
+    *flags = FLAGS_FILE;
+
+    if(compress_files && compress_blob(blob, total))
+    {
+        *flags |= FLAGS_COMPRESSED;
+    }
+
+end:
+    for(int i = 0; i < num_members; i++)
+    {
+        free(members[i].name);
+        free(members[i].file);
+    }
+
+    free(members);
+    return blob;
+}
+
+/* Find a file placed by the layout manifest, given its path relative to the root */
+placed_file_t *find_placed_file(const char * const prefix, const char * const name)
+{
+    for(int i = 0; i < num_placed_files; i++)
+    {
+        const char *path = placed_files[i].path;
+        int len = strlen(prefix);
+
+        if(!strncmp(path, prefix, len) && !strcmp(path + len, name))
+        {
+            return &placed_files[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Add the files listed in the layout manifest, so that their data is contiguous */
+int place_files(const char * const manifest, const char * const in_dir)
+{
+    FILE *fp = fopen(manifest, "r");
+    char line[1024];
+
+    if(!fp)
+    {
+        fprintf(stderr, "Cannot open manifest '%s' for read!\n", manifest);
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        /* Strip the newline and skip comments */
+        line[strcspn(line, "\r\n")] = 0;
+
+        const char *path = line;
+        while(*path == '/') { path++; }
+
+        if(!*path || line[0] == '#')
+        {
+            continue;
+        }
+
+        if(find_placed_file("", path))
+        {
+            fprintf(stderr, "Warning: '%s' is listed twice in the manifest.\n", path);
+            continue;
+        }
+
+        char *file = malloc(strlen(in_dir) + strlen(path) + 2);
+
+        if(!file)
+        {
+            /* Out of memory */
+            fclose(fp);
+            return 0;
+        }
+
+        sprintf(file, "%s/%s", in_dir, path);
+
+        struct stat stats;
+
+        if(stat(file, &stats) != 0)
+        {
+            /* Like the entries that are not reached by the directory tree */
+            fprintf(stderr, "Warning: '%s' in the manifest is not in '%s'.\n", path, in_dir);
+            free(file);
+            continue;
+        }
+
+        placed_files = realloc(placed_files, (num_placed_files + 1) * sizeof(placed_file_t));
+
+        if(!placed_files)
+        {
+            /* Out of memory */
+            free(file);
+            fclose(fp);
+            return 0;
+        }
+
+        placed_file_t *f = &placed_files[num_placed_files++];
+        f->path = strdup(path);
+        f->used = 0;
+
+        /* A bundle can be placed as a whole */
+        if(S_ISDIR(stats.st_mode) && is_bundle(path))
+        {
+            f->blob = add_bundle(file, &f->size, &f->flags);
+        }
+        else
+        {
+            f->blob = add_file(file, &f->size, &f->flags);
+        }
+
+        free(file);
+
+        if(!f->path || !f->blob)
+        {
+            fclose(fp);
+            return 0;
+        }
+    }
+
+    fclose(fp);
+    return 1;
+}
+
+uint32_t add_directory(const char * const path, const char * const prefix)
 {
     directory_entry_t *tmp_entry;
     uint32_t first_entry = 0;
@@ -171,10 +999,12 @@ uint32_t add_directory(const char * const path)
                 /* Figure out if it is a directory or regular (windows doesn't include d_type in dirent) */
                 stat( file, &stats );
 
-                if(S_ISREG(stats.st_mode))
+                /* Bundles are stored as regular files */
+                if(S_ISREG(stats.st_mode) || (S_ISDIR(stats.st_mode) && is_bundle(dp->d_name)))
                 {
-                    uint32_t new_entry = new_sector();
+                    uint32_t new_entry = new_entry_sector();
                     uint32_t file_size = 0;
+                    uint32_t file_flags = 0;
 
                     tmp_entry = sector_to_memory(new_entry);
                     tmp_entry->next_entry = 0;
@@ -183,7 +1013,25 @@ uint32_t add_directory(const char * const path)
                     strncpy(tmp_entry->path, dp->d_name, MAX_FILENAME_LEN);
                     tmp_entry->path[MAX_FILENAME_LEN] = 0;
 
-                    uint32_t new_file = add_file(file, &file_size);
+                    /* Files in the manifest have been added already */
+                    placed_file_t *placed = find_placed_file(prefix, tmp_entry->path);
+                    uint32_t new_file;
+
+                    if(placed)
+                    {
+                        new_file = placed->blob;
+                        file_size = placed->size;
+                        file_flags = placed->flags;
+                        placed->used = 1;
+                    }
+                    else if(S_ISDIR(stats.st_mode))
+                    {
+                        new_file = add_bundle(file, &file_size, &file_flags);
+                    }
+                    else
+                    {
+                        new_file = add_file(file, &file_size, &file_flags);
+                    }
 
                     if(!new_file)
                     {
@@ -193,7 +1041,14 @@ uint32_t add_directory(const char * const path)
 
                     tmp_entry = sector_to_memory(new_entry);
                     tmp_entry->file_pointer = SWAPLONG(new_file);
-                    tmp_entry->flags = SWAPLONG((FLAGS_FILE << 28) | (file_size & 0x0FFFFFFF));
+                    tmp_entry->flags = SWAPLONG((file_flags << 28) | (file_size & 0x0FFFFFFF));
+
+                    if(!index_add_file(prefix, tmp_entry->path, tmp_entry->flags, tmp_entry->file_pointer))
+                    {
+                        /* Out of memory */
+                        free(file);
+                        return 0;
+                    }
 
                     if(cur_entry)
                     {
@@ -207,7 +1062,7 @@ uint32_t add_directory(const char * const path)
                 }
                 else if(S_ISDIR(stats.st_mode))
                 {
-                    uint32_t new_entry = new_sector();
+                    uint32_t new_entry = new_entry_sector();
 
                     tmp_entry = sector_to_memory(new_entry);
                     tmp_entry->flags = SWAPLONG(FLAGS_DIR << 28); /* Size doesn't matter for directories */
@@ -217,7 +1072,20 @@ uint32_t add_directory(const char * const path)
                     strncpy(tmp_entry->path, dp->d_name, MAX_FILENAME_LEN);
                     tmp_entry->path[MAX_FILENAME_LEN] = 0;
 
-                    uint32_t new_directory = add_directory(file);
+                    char *subprefix = malloc(strlen(prefix) + strlen(tmp_entry->path) + 2);
+
+                    if(!subprefix)
+                    {
+                        /* Out of memory */
+                        free(file);
+                        return 0;
+                    }
+
+                    sprintf(subprefix, "%s%s/", prefix, tmp_entry->path);
+
+                    uint32_t new_directory = add_directory(file, subprefix);
+
+                    free(subprefix);
 
                     if(!new_directory)
                     {
@@ -258,12 +1126,53 @@ uint32_t add_directory(const char * const path)
 
 int main(int argc, char *argv[])
 {
-    if(argc != 3)
+    const char *manifest = NULL;
+    int i = 1;
+
+    for(; i < argc && argv[i][0] == '-'; i++)
+    {
+        if(!strcmp(argv[i], "--index"))
+        {
+            build_index = 1;
+        }
+        else if(!strcmp(argv[i], "--compress"))
+        {
+            compress_files = 1;
+        }
+        else if(!strcmp(argv[i], "--bundles"))
+        {
+            build_bundles = 1;
+        }
+        else if(!strcmp(argv[i], "--incremental"))
+        {
+            incremental = 1;
+        }
+        else if(!strcmp(argv[i], "--order") && i + 1 < argc)
+        {
+            manifest = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            print_help(argv[0]);
+            return -1;
+        }
+    }
+
+    if(argc - i != 2)
     {
         print_help(argv[0]);
         return -1;
     }
 
+    const char *out_file = argv[i];
+    const char *in_dir = argv[i+1];
+
+    if(incremental)
+    {
+        load_cache(out_file);
+    }
+
     /* Add in identifier */
     directory_entry_t *id = sector_to_memory(new_sector());
 
@@ -278,7 +1187,22 @@ int main(int argc, char *argv[])
     id->next_entry = SWAPLONG(ROOT_NEXT_ENTRY);
     strcpy(id->path, ROOT_PATH);
 
-    if(!add_directory(argv[2]))
+    /* Files loaded together go first, so that they are contiguous in ROM */
+    if(manifest)
+    {
+        root_entry = new_sector();
+    }
+
+    if(manifest && !place_files(manifest, in_dir))
+    {
+        fprintf(stderr, "Error creating filesystem.\n");
+
+        kill_fs();
+
+        return -1;
+    }
+
+    if(!add_directory(in_dir, ""))
     {
         /* Error adding directory */
         fprintf(stderr, "Error creating filesystem.\n");
@@ -288,20 +1212,59 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    for(int j = 0; j < num_placed_files; j++)
+    {
+        if(!placed_files[j].used)
+        {
+            /* Its data is in the image, but no directory entry points to it */
+            fprintf(stderr, "Warning: '%s' in the manifest is not in '%s'.\n", placed_files[j].path, in_dir);
+        }
+    }
+
+    if(build_index)
+    {
+        /* Reference the index from the root sector (id might have moved) */
+        uint32_t index = add_index();
+
+        id = sector_to_memory(0);
+        id->file_pointer = SWAPLONG(index);
+    }
+
+    if(incremental && old_dfs && old_fs_size == fs_size && !memcmp(old_dfs, dfs, fs_size))
+    {
+        /* Keep the timestamp of the image, so that the ROM is not rebuilt */
+        printf("Filesystem image '%s' is up to date.\n", out_file);
+
+        int ok = save_cache(out_file);
+
+        kill_fs();
+
+        return ok ? 0 : -1;
+    }
+
     /* Write out filesystem */
-    FILE *fp = fopen(argv[1], "w");
+    FILE *fp = fopen(out_file, "w");
 
     if(!fp)
     {
         /* Error writing file out */
-        fprintf(stderr, "Error opening '%s' for writing.\n", argv[1]);
+        fprintf(stderr, "Error opening '%s' for writing.\n", out_file);
 
         kill_fs();
+
+        return -1;
     }
 
     fwrite(dfs, 1, fs_size, fp);
     fclose(fp);
 
+    if(incremental && !save_cache(out_file))
+    {
+        kill_fs();
+
+        return -1;
+    }
+
     kill_fs();
 
     return 0;
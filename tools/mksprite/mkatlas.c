@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <png.h>
+#include <sys/types.h>
+#include <sys/param.h>
+
+/* Layout of the atlas file, see rdp_atlas_load in rdp.c.  All values are big-endian:
+ *
+ *   "ATLS", uint16 number of pages, uint16 number of entries
+ *   entries: char name[22], uint8 page, uint8 pad, uint16 x, y, width, height
+ *   pages: 16-bit sprites (same format as mksprite), each fitting TMEM
+ */
+#define ATLAS_MAGIC         "ATLS"
+#define NAME_SIZE           22
+#define TMEM_SIZE           4096
+
+#define FORMAT_UNCOMPRESSED 0
+
+#if BYTE_ORDER == BIG_ENDIAN
+#define SWAP_WORD(x) (x)
+#else
+#define SWAP_WORD(x) ((((x)>>8) & 0x00FF) | (((x)<<8) & 0xFF00))
+#endif
+
+typedef struct
+{
+    char name[NAME_SIZE];
+    png_image image;
+    uint8_t *pixels;
+    int page, x, y;
+} image_t;
+
+void write_word( FILE *fp, uint16_t value )
+{
+    uint16_t out = SWAP_WORD( value );
+
+    fwrite( &out, sizeof( out ), 1, fp );
+}
+
+int load_image( image_t *img, const char *fn )
+{
+    memset( img, 0, sizeof( *img ) );
+    img->image.version = PNG_IMAGE_VERSION;
+
+    if( !png_image_begin_read_from_file( &img->image, fn ) )
+    {
+        fprintf( stderr, "Unable to read %s: %s\n", fn, img->image.message );
+        return -ENOENT;
+    }
+
+    img->image.format = PNG_FORMAT_RGBA;
+    img->pixels = malloc( PNG_IMAGE_SIZE( img->image ) );
+
+    if( img->pixels == NULL )
+    {
+        png_image_free( &img->image );
+        return -ENOMEM;
+    }
+
+    if( !png_image_finish_read( &img->image, NULL, img->pixels, 0, NULL ) )
+    {
+        fprintf( stderr, "Unable to read %s: %s\n", fn, img->image.message );
+        return -EINVAL;
+    }
+
+    /* The name is the file name without directory and extension */
+    const char *base = strrchr( fn, '/' );
+    base = base ? base + 1 : fn;
+
+    for( int i = 0; i < NAME_SIZE - 1 && base[i] && base[i] != '.'; i++ )
+    {
+        img->name[i] = base[i];
+    }
+
+    return 0;
+}
+
+/* Pack the images in shelves, in the order given, so that images drawn together can be
+   listed together and end up in the same page */
+int pack_images( image_t *images, int count, int page_width, int page_height )
+{
+    int page = 0, x = 0, y = 0, shelf_height = 0;
+
+    for( int i = 0; i < count; i++ )
+    {
+        int w = images[i].image.width;
+        int h = images[i].image.height;
+
+        if( w > page_width || h > page_height )
+        {
+            fprintf( stderr, "%s is larger than a page (%dx%d)!\n", images[i].name, page_width, page_height );
+            return -EINVAL;
+        }
+
+        if( x + w > page_width )
+        {
+            /* Next shelf */
+            x = 0;
+            y += shelf_height;
+            shelf_height = 0;
+        }
+
+        if( y + h > page_height )
+        {
+            /* Next page */
+            page++;
+            x = 0;
+            y = 0;
+            shelf_height = 0;
+        }
+
+        images[i].page = page;
+        images[i].x = x;
+        images[i].y = y;
+
+        x += w;
+        if( h > shelf_height ) { shelf_height = h; }
+    }
+
+    return page + 1;
+}
+
+int write_atlas( const char *fn, image_t *images, int count, int pages, int page_width, int page_height )
+{
+    FILE *op = fopen( fn, "wb" );
+
+    if( op == NULL )
+    {
+        return -ENOENT;
+    }
+
+    fwrite( ATLAS_MAGIC, 1, 4, op );
+    write_word( op, pages );
+    write_word( op, count );
+
+    for( int i = 0; i < count; i++ )
+    {
+        uint8_t page[2] = { images[i].page, 0 };
+
+        fwrite( images[i].name, 1, NAME_SIZE, op );
+        fwrite( page, 1, 2, op );
+        write_word( op, images[i].x );
+        write_word( op, images[i].y );
+        write_word( op, images[i].image.width );
+        write_word( op, images[i].image.height );
+    }
+
+    uint16_t *pixels = malloc( page_width * page_height * sizeof( uint16_t ) );
+
+    if( pixels == NULL )
+    {
+        fclose( op );
+        return -ENOMEM;
+    }
+
+    for( int p = 0; p < pages; p++ )
+    {
+        /* Unused parts of the page are transparent */
+        memset( pixels, 0, page_width * page_height * sizeof( uint16_t ) );
+
+        for( int i = 0; i < count; i++ )
+        {
+            if( images[i].page != p ) { continue; }
+
+            for( int y = 0; y < images[i].image.height; y++ )
+            {
+                for( int x = 0; x < images[i].image.width; x++ )
+                {
+                    uint8_t *c = &images[i].pixels[(y * images[i].image.width + x) * 4];
+
+                    pixels[(images[i].y + y) * page_width + images[i].x + x] = SWAP_WORD(
+                        (((c[0] >> 3) & 0x1F) << 11) | (((c[1] >> 3) & 0x1F) << 6) |
+                        (((c[2] >> 3) & 0x1F) << 1) | (c[3] >> 7) );
+                }
+            }
+        }
+
+        /* Sprite header: width, height, bitdepth, format, slices */
+        uint8_t header[4] = { 2, FORMAT_UNCOMPRESSED, 1, 1 };
+
+        write_word( op, page_width );
+        write_word( op, page_height );
+        fwrite( header, 1, 4, op );
+        fwrite( pixels, sizeof( uint16_t ), page_width * page_height, op );
+    }
+
+    free( pixels );
+    fclose( op );
+
+    return 0;
+}
+
+int write_header( const char *fn, image_t *images, int count )
+{
+    FILE *op = fopen( fn, "w" );
+
+    if( op == NULL )
+    {
+        return -ENOENT;
+    }
+
+    fprintf( op, "/* Generated by mkatlas, do not edit */\n" );
+
+    for( int i = 0; i < count; i++ )
+    {
+        fprintf( op, "#define ATLAS_" );
+
+        for( int j = 0; images[i].name[j]; j++ )
+        {
+            fputc( isalnum( (unsigned char)images[i].name[j] ) ? toupper( (unsigned char)images[i].name[j] ) : '_', op );
+        }
+
+        fprintf( op, " %d\n", i );
+    }
+
+    fclose( op );
+
+    return 0;
+}
+
+void print_args( char * name )
+{
+    fprintf( stderr, "Usage: %s [-w <page width>] [-h <page height>] <output atlas> <output header> <input png>...\n", name );
+    fprintf( stderr, "\tPacks the images in 16-bit pages that fit TMEM (default 64x32), in the order given:\n" );
+    fprintf( stderr, "\tlist together the images that are drawn together, so that they share a page.\n" );
+    fprintf( stderr, "\t<output atlas> will be written in binary for inclusion using DragonFS.\n" );
+    fprintf( stderr, "\t<output header> will define the index of each image, named after its file.\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+    int page_width = 64, page_height = 32;
+    int arg = 1;
+
+    while( arg + 1 < argc && argv[arg][0] == '-' )
+    {
+        if( !strcmp( argv[arg], "-w" ) )
+        {
+            page_width = atoi( argv[arg + 1] );
+        }
+        else if( !strcmp( argv[arg], "-h" ) )
+        {
+            page_height = atoi( argv[arg + 1] );
+        }
+        else
+        {
+            print_args( argv[0] );
+            return -EINVAL;
+        }
+
+        arg += 2;
+    }
+
+    /* The RDP loads textures with power of two sizes */
+    if( page_width <= 0 || page_height <= 0 || (page_width & (page_width - 1)) ||
+        (page_height & (page_height - 1)) || page_width * page_height * 2 > TMEM_SIZE )
+    {
+        fprintf( stderr, "Pages must have power of two sizes and fit in %d bytes!\n", TMEM_SIZE );
+        return -EINVAL;
+    }
+
+    if( argc - arg < 3 )
+    {
+        print_args( argv[0] );
+        return -EINVAL;
+    }
+
+    int count = argc - arg - 2;
+    image_t *images = calloc( count, sizeof( image_t ) );
+
+    if( images == NULL )
+    {
+        return -ENOMEM;
+    }
+
+    int err = 0;
+
+    for( int i = 0; i < count && !err; i++ )
+    {
+        err = load_image( &images[i], argv[arg + 2 + i] );
+    }
+
+    if( !err )
+    {
+        int pages = pack_images( images, count, page_width, page_height );
+
+        if( pages < 0 )
+        {
+            err = pages;
+        }
+        else
+        {
+            err = write_atlas( argv[arg], images, count, pages, page_width, page_height );
+
+            if( !err )
+            {
+                err = write_header( argv[arg + 1], images, count );
+            }
+        }
+    }
+
+    for( int i = 0; i < count; i++ )
+    {
+        png_image_free( &images[i].image );
+        free( images[i].pixels );
+    }
+
+    free( images );
+
+    return err;
+}
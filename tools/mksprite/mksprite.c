@@ -4,13 +4,33 @@
 #include <string.h>
 #include <errno.h>
 #include <png.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/param.h>
 
 #define BITDEPTH_16BPP      16
 #define BITDEPTH_32BPP      32
 
+/* Sprite formats, see SPRITE_FORMAT_* in graphics.h */
 #define FORMAT_UNCOMPRESSED 0
+#define FORMAT_CI4          1
+#define FORMAT_CI8          2
+#define FORMAT_I4           3
+#define FORMAT_I8           4
+#define FORMAT_IA4          5
+#define FORMAT_IA8          6
+
+/* Flag of the format: the pixels are compressed, see SPRITE_FLAGS_COMPRESSED in graphics.h */
+#define FLAG_COMPRESSED     0x80
+
+/* Parameters of the LZ77 compressor */
+#define LZ_MIN_MATCH        3
+#define LZ_MAX_DIST         65535
+#define LZ_HASH_BITS        14
+#define LZ_MAX_CHAIN        256
 
 #if BYTE_ORDER == BIG_ENDIAN
 #define SWAP_WORD(x) (x)
@@ -18,12 +38,13 @@
 #define SWAP_WORD(x) ((((x)>>8) & 0x00FF) | (((x)<<8) & 0xFF00))
 #endif
 
+uint16_t rgba5551( const uint8_t *colorbuf );
+
 void write_value( uint8_t *colorbuf, FILE *fp, int bitdepth )
 {
     if( bitdepth == BITDEPTH_16BPP )
     {
-        uint16_t out = SWAP_WORD((((colorbuf[0] >> 3) & 0x1F) << 11) | (((colorbuf[1] >> 3) & 0x1F) << 6) |
-                       (((colorbuf[2] >> 3) & 0x1F) << 1) | (colorbuf[3] >> 7));
+        uint16_t out = SWAP_WORD(rgba5551( colorbuf ));
 
         fwrite( &out, 1, 2, fp );
     }
@@ -34,7 +55,283 @@ void write_value( uint8_t *colorbuf, FILE *fp, int bitdepth )
     }
 }
 
-int read_png( char *png_file, char *spr_file, int depth, int hslices, int vslices )
+uint16_t rgba5551( const uint8_t *colorbuf )
+{
+    return (((colorbuf[0] >> 3) & 0x1F) << 11) | (((colorbuf[1] >> 3) & 0x1F) << 6) |
+           (((colorbuf[2] >> 3) & 0x1F) << 1) | (colorbuf[3] >> 7);
+}
+
+uint8_t intensity( const uint8_t *colorbuf )
+{
+    return (colorbuf[0] * 77 + colorbuf[1] * 150 + colorbuf[2] * 29) >> 8;
+}
+
+/* Write the pixels of a sprite in one of the 4-bit or 8-bit texture formats (and its palette) */
+int write_texture( uint8_t *rgba, int width, int height, FILE *fp, int format )
+{
+    int bits = (format == FORMAT_CI4 || format == FORMAT_I4 || format == FORMAT_IA4) ? 4 : 8;
+    int count = width * height;
+    uint16_t palette[256];
+    int colors = 0;
+
+    if( bits == 4 && (width & 1) )
+    {
+        fprintf(stderr, "4-bit sprites must have an even width!\n");
+        return -EINVAL;
+    }
+
+    uint8_t *texels = malloc( count );
+
+    if( texels == NULL )
+    {
+        return -ENOMEM;
+    }
+
+    for( int i = 0; i < count; i++ )
+    {
+        uint8_t *color = &rgba[i * 4];
+
+        switch( format )
+        {
+            case FORMAT_CI4:
+            case FORMAT_CI8:
+            {
+                uint16_t c = rgba5551( color );
+                int index = 0;
+
+                /* Look the color up in the palette, add it if new */
+                while( index < colors && palette[index] != c ) { index++; }
+
+                if( index == colors )
+                {
+                    if( colors == (1 << bits) )
+                    {
+                        fprintf(stderr, "The image has more than %d colors!\n", 1 << bits);
+                        free( texels );
+                        return -EINVAL;
+                    }
+
+                    palette[colors++] = c;
+                }
+
+                texels[i] = index;
+                break;
+            }
+            case FORMAT_I4:
+                texels[i] = intensity( color ) >> 4;
+                break;
+            case FORMAT_I8:
+                texels[i] = intensity( color );
+                break;
+            case FORMAT_IA4:
+                texels[i] = ((intensity( color ) >> 5) << 1) | (color[3] >> 7);
+                break;
+            case FORMAT_IA8:
+                texels[i] = (intensity( color ) & 0xF0) | (color[3] >> 4);
+                break;
+        }
+    }
+
+    /* Pack the texels, 4-bit ones two per byte with the leftmost in the high nibble */
+    int size = count * bits / 8;
+
+    for( int i = 0; i < size; i++ )
+    {
+        uint8_t out = (bits == 4) ? ((texels[i * 2] << 4) | texels[i * 2 + 1]) : texels[i];
+
+        fwrite( &out, 1, 1, fp );
+    }
+
+    free( texels );
+
+    if( format == FORMAT_CI4 || format == FORMAT_CI8 )
+    {
+        /* The palette follows the pixels, 8-byte aligned */
+        uint8_t zero = 0;
+
+        for( ; size % 8; size++ )
+        {
+            fwrite( &zero, 1, 1, fp );
+        }
+
+        for( int i = 0; i < (1 << bits); i++ )
+        {
+            uint16_t out = SWAP_WORD( (i < colors) ? palette[i] : 0 );
+
+            fwrite( &out, 1, 2, fp );
+        }
+    }
+
+    return 0;
+}
+
+/* Write a length nibble extension: bytes added to 15 until one is not 255 */
+uint8_t *lz_write_length( uint8_t *out, int len )
+{
+    for( len -= 15; len >= 255; len -= 255 )
+    {
+        *out++ = 255;
+    }
+
+    *out++ = len;
+    return out;
+}
+
+/* Write a block of literals followed by a match (none if len is 0) */
+uint8_t *lz_write_block( uint8_t *out, const uint8_t *lit, int num_lit, int dist, int len )
+{
+    int match = len ? len - LZ_MIN_MATCH : 0;
+
+    *out++ = ((num_lit < 15 ? num_lit : 15) << 4) | (match < 15 ? match : 15);
+
+    if( num_lit >= 15 ) { out = lz_write_length( out, num_lit ); }
+
+    memcpy( out, lit, num_lit );
+    out += num_lit;
+
+    if( len )
+    {
+        *out++ = dist >> 8;
+        *out++ = dist & 0xFF;
+
+        if( match >= 15 ) { out = lz_write_length( out, match ); }
+    }
+
+    return out;
+}
+
+/* Compress with LZ77 (see __sprite_decompress in sprite.c for the format), return the compressed size */
+int lz_compress( const uint8_t *in, int size, uint8_t *out )
+{
+    int *head = malloc( sizeof( int ) * (1 << LZ_HASH_BITS) );
+    int *prev = malloc( sizeof( int ) * (size ? size : 1) );
+    uint8_t *start = out;
+    int lit = 0;
+    int pos = 0;
+
+    if( head == NULL || prev == NULL )
+    {
+        free( head );
+        free( prev );
+        return -ENOMEM;
+    }
+
+    for( int i = 0; i < (1 << LZ_HASH_BITS); i++ )
+    {
+        head[i] = -1;
+    }
+
+    while( pos < size )
+    {
+        int best_len = 0;
+        int best_dist = 0;
+
+        if( pos + LZ_MIN_MATCH <= size )
+        {
+            uint32_t hash = ((in[pos] << 16) | (in[pos + 1] << 8) | in[pos + 2]) * 2654435761u >> (32 - LZ_HASH_BITS);
+            int chain = LZ_MAX_CHAIN;
+
+            /* Find the longest match among the previous positions with the same hash */
+            for( int cand = head[hash]; cand >= 0 && pos - cand <= LZ_MAX_DIST && chain--; cand = prev[cand] )
+            {
+                int len = 0;
+
+                while( pos + len < size && in[cand + len] == in[pos + len] )
+                {
+                    len++;
+                }
+
+                if( len > best_len )
+                {
+                    best_len = len;
+                    best_dist = pos - cand;
+                }
+            }
+
+            prev[pos] = head[hash];
+            head[hash] = pos;
+        }
+
+        if( best_len < LZ_MIN_MATCH )
+        {
+            pos++;
+            lit++;
+            continue;
+        }
+
+        out = lz_write_block( out, in + pos - lit, lit, best_dist, best_len );
+        lit = 0;
+
+        /* Index the positions covered by the match */
+        for( int end = pos + best_len, i = pos + 1; i < end; i++ )
+        {
+            if( i + LZ_MIN_MATCH <= size )
+            {
+                uint32_t hash = ((in[i] << 16) | (in[i + 1] << 8) | in[i + 2]) * 2654435761u >> (32 - LZ_HASH_BITS);
+
+                prev[i] = head[hash];
+                head[hash] = i;
+            }
+        }
+
+        pos += best_len;
+    }
+
+    /* The last block ends the stream: if the data ended with a match, it has no literals */
+    if( lit || out == start )
+    {
+        out = lz_write_block( out, in + pos - lit, lit, 0, 0 );
+    }
+
+    free( head );
+    free( prev );
+    return out - start;
+}
+
+/* Write the compressed pixels, read back from the temporary file they were written to */
+int write_compressed( FILE *pixels, FILE *op )
+{
+    long size;
+
+    if( fseek( pixels, 0, SEEK_END ) || (size = ftell( pixels )) < 0 || fseek( pixels, 0, SEEK_SET ) )
+    {
+        return -EIO;
+    }
+
+    /* Blocks with a short match after many literals are larger than the bytes they cover */
+    uint8_t *in = malloc( size ? size : 1 );
+    uint8_t *out = malloc( size + size / 2 + 16 );
+    int err = 0;
+
+    if( in == NULL || out == NULL )
+    {
+        err = -ENOMEM;
+    }
+    else if( fread( in, 1, size, pixels ) != size )
+    {
+        err = -EIO;
+    }
+    else
+    {
+        int out_size = lz_compress( in, size, out );
+        uint8_t hdr[4] = { size >> 24, size >> 16, size >> 8, size };
+
+        if( out_size < 0 )
+        {
+            err = out_size;
+        }
+        else if( fwrite( hdr, 1, 4, op ) != 4 || fwrite( out, 1, out_size, op ) != out_size )
+        {
+            err = -EIO;
+        }
+    }
+
+    free( in );
+    free( out );
+    return err;
+}
+
+int read_png( char *png_file, char *spr_file, int depth, int format, int hslices, int vslices, int compress )
 {
     png_structp png_ptr;
     png_infop info_ptr;
@@ -44,6 +341,7 @@ int read_png( char *png_file, char *spr_file, int depth, int hslices, int vslice
     uint16_t wval16;
     FILE *fp;
     FILE *op;
+    FILE *pp;
     int err = 0;
 
     /* Open file descriptors for read and write */
@@ -100,12 +398,19 @@ int read_png( char *png_file, char *spr_file, int depth, int hslices, int vslice
     wval16 = SWAP_WORD((uint16_t)height);
     fwrite( &wval16, sizeof( wval16 ), 1, op );
 
-    /* Bitdepth */
-    wval8 = (depth == BITDEPTH_32BPP) ? 4 : 2;
+    /* Bitdepth (in bytes, 0 for 4-bit formats) */
+    if( format == FORMAT_UNCOMPRESSED )
+    {
+        wval8 = (depth == BITDEPTH_32BPP) ? 4 : 2;
+    }
+    else
+    {
+        wval8 = (format == FORMAT_CI4 || format == FORMAT_I4 || format == FORMAT_IA4) ? 0 : 1;
+    }
     fwrite( &wval8, sizeof( wval8 ), 1, op );
 
     /* Format */
-    wval8 = FORMAT_UNCOMPRESSED;
+    wval8 = format | (compress ? FLAG_COMPRESSED : 0);
     fwrite( &wval8, sizeof( wval8 ), 1, op );
 
     /* Horizontal and vertical slices */
@@ -163,7 +468,15 @@ int read_png( char *png_file, char *spr_file, int depth, int hslices, int vslice
         /* Now it's time to read the image. */
         png_read_image(png_ptr, row_pointers);
 
-        /* Translate out to sprite format */
+        /* Gather the image as RGBA */
+        uint8_t *rgba = malloc( width * height * 4 );
+
+        if( rgba == NULL )
+        {
+            err = -ENOMEM;
+            goto exitmem;
+        }
+
         switch( color_type )
         {
             case PNG_COLOR_TYPE_RGB:
@@ -174,31 +487,61 @@ int read_png( char *png_file, char *spr_file, int depth, int hslices, int vslice
                 {
                     for( int i = 0; i < width; i++ )
                     {
-                        uint8_t buf[4];
+                        uint8_t *buf = &rgba[(j * width + i) * 4];
 
                         buf[0] = row_pointers[j][(i * 3)];
                         buf[1] = row_pointers[j][(i * 3) + 1];
                         buf[2] = row_pointers[j][(i * 3) + 2];
                         buf[3] = 255;
-
-                        write_value( buf, op, depth );
                     }
                 }
 
                 break;
             case PNG_COLOR_TYPE_RGB_ALPHA:
-                /* Easy, just dump rows or convert */
+                /* Easy, just copy rows */
                 for( int row = 0; row < height; row++ )
                 {
-                    for( int col = 0; col < width; col++ )
-                    {
-                        write_value( &row_pointers[row][col * 4], op, depth );
-                    }
+                    memcpy( &rgba[row * width * 4], row_pointers[row], width * 4 );
                 }
 
                 break;
         }
 
+        /* Compressed pixels are gathered in a temporary file first */
+        pp = compress ? tmpfile() : op;
+
+        if( pp == NULL )
+        {
+            free( rgba );
+            err = -EIO;
+            goto exitmem;
+        }
+
+        /* Translate out to sprite format */
+        if( format == FORMAT_UNCOMPRESSED )
+        {
+            for( int i = 0; i < width * height; i++ )
+            {
+                write_value( &rgba[i * 4], pp, depth );
+            }
+        }
+        else
+        {
+            err = write_texture( rgba, width, height, pp, format );
+        }
+
+        if( compress )
+        {
+            if( !err )
+            {
+                err = write_compressed( pp, op );
+            }
+
+            fclose( pp );
+        }
+
+        free( rgba );
+
 exitmem:
         /* Free the row pointers memory */
         for( int row = 0; row < height; row++ )
@@ -225,45 +568,295 @@ exitfiles:
 
 void print_args( char * name )
 {
-    fprintf( stderr, "Usage: %s <bit depth> [<horizontal slices> <vertical slices>] <input png> <output file>\n", name );
-    fprintf( stderr, "\t<bit depth> should be 16 or 32.\n" );
+    fprintf( stderr, "Usage: %s [--compress] <bit depth> [<horizontal slices> <vertical slices>] <input png> <output file>\n", name );
+    fprintf( stderr, "       %s [--compress] --batch <output dir> [--jobs <N>] <bit depth> [<horizontal slices> <vertical slices>] <input>...\n", name );
+    fprintf( stderr, "\t<bit depth> should be 16 or 32, or one of the RDP texture formats CI4, CI8, I4, I8, IA4 or IA8.\n" );
+    fprintf( stderr, "\t(CI formats store the colors in a palette, and the image must have at most 16 or 256 colors.)\n" );
     fprintf( stderr, "\t<horizontal slices> should be a number two or greater signifying how many images are in this spritemap horizontally.\n" );
     fprintf( stderr, "\t<vertical slices> should be a number two or greater signifying how many images are in this spritemap vertically.\n" );
     fprintf( stderr, "\t<input png> should be any valid PNG file.\n" );
     fprintf( stderr, "\t<output file> will be written in binary for inclusion using DragonFS.\n" );
+    fprintf( stderr, "\tIn batch mode, each <input> is a PNG file, a directory (all the PNG files in it) or @<list>\n" );
+    fprintf( stderr, "\t(a file listing one of them per line), converted to <output dir>/<name>.sprite on N threads\n" );
+    fprintf( stderr, "\t(one per CPU by default).\n" );
+    fprintf( stderr, "\tWith --compress, the pixels are compressed with LZ77: load the sprite with sprite_load().\n" );
+}
+
+/* Conversion of a batch */
+typedef struct
+{
+    char **inputs;
+    int num_inputs;
+    const char *out_dir;
+    int depth;
+    int format;
+    int hslices;
+    int vslices;
+    int compress;
+    int next;
+    int errors;
+} batch_t;
+
+int has_png_extension( const char *fn )
+{
+    const char *ext = strrchr( fn, '.' );
+
+    return ext && !strcasecmp( ext, ".png" );
+}
+
+void batch_add( batch_t *batch, const char *fn )
+{
+    batch->inputs = realloc( batch->inputs, (batch->num_inputs + 1) * sizeof( char * ) );
+    batch->inputs[batch->num_inputs++] = strdup( fn );
+}
+
+/* Add a PNG file, the PNG files in a directory, or the inputs listed in a file */
+int batch_add_input( batch_t *batch, const char *input )
+{
+    struct stat st;
+
+    if( input[0] == '@' )
+    {
+        FILE *fp = fopen( input + 1, "r" );
+        char line[4096];
+        int err = 0;
+
+        if( fp == NULL )
+        {
+            fprintf( stderr, "Unable to open the list %s!\n", input + 1 );
+            return -ENOENT;
+        }
+
+        while( fgets( line, sizeof( line ), fp ) )
+        {
+            line[strcspn( line, "\r\n" )] = 0;
+
+            if( line[0] && batch_add_input( batch, line ) )
+            {
+                err = -ENOENT;
+            }
+        }
+
+        fclose( fp );
+        return err;
+    }
+
+    if( stat( input, &st ) != 0 )
+    {
+        fprintf( stderr, "Unable to find %s!\n", input );
+        return -ENOENT;
+    }
+
+    if( S_ISDIR( st.st_mode ) )
+    {
+        DIR *dir = opendir( input );
+        struct dirent *de;
+
+        if( dir == NULL )
+        {
+            fprintf( stderr, "Unable to open the directory %s!\n", input );
+            return -ENOENT;
+        }
+
+        while( (de = readdir( dir )) )
+        {
+            if( has_png_extension( de->d_name ) )
+            {
+                char fn[strlen( input ) + strlen( de->d_name ) + 2];
+
+                sprintf( fn, "%s/%s", input, de->d_name );
+                batch_add( batch, fn );
+            }
+        }
+
+        closedir( dir );
+        return 0;
+    }
+
+    batch_add( batch, input );
+    return 0;
+}
+
+void *batch_worker( void *arg )
+{
+    batch_t *batch = arg;
+    int i;
+
+    while( (i = __sync_fetch_and_add( &batch->next, 1 )) < batch->num_inputs )
+    {
+        const char *in = batch->inputs[i];
+        const char *base = strrchr( in, '/' ) ? strrchr( in, '/' ) + 1 : in;
+        int len = has_png_extension( base ) ? strlen( base ) - 4 : strlen( base );
+        char out[strlen( batch->out_dir ) + len + 9];
+
+        sprintf( out, "%s/%.*s.sprite", batch->out_dir, len, base );
+
+        int err = read_png( (char *)in, out, batch->depth, batch->format, batch->hslices, batch->vslices, batch->compress );
+
+        if( err )
+        {
+            fprintf( stderr, "Unable to convert %s: %s\n", in, strerror( -err ) );
+            __sync_fetch_and_add( &batch->errors, 1 );
+        }
+    }
+
+    return NULL;
+}
+
+/* Convert all the inputs of a batch in parallel */
+int run_batch( batch_t *batch, int jobs )
+{
+    if( jobs <= 0 )
+    {
+        jobs = sysconf( _SC_NPROCESSORS_ONLN );
+    }
+
+    if( jobs > batch->num_inputs )
+    {
+        jobs = batch->num_inputs;
+    }
+
+    pthread_t threads[MAX( jobs, 1 )];
+
+    for( int i = 0; i < jobs; i++ )
+    {
+        if( pthread_create( &threads[i], NULL, batch_worker, batch ) )
+        {
+            /* Run the rest in the threads already started */
+            jobs = i;
+            break;
+        }
+    }
+
+    if( jobs == 0 )
+    {
+        batch_worker( batch );
+    }
+
+    for( int i = 0; i < jobs; i++ )
+    {
+        pthread_join( threads[i], NULL );
+    }
+
+    for( int i = 0; i < batch->num_inputs; i++ )
+    {
+        free( batch->inputs[i] );
+    }
+
+    free( batch->inputs );
+
+    return batch->errors ? -EINVAL : 0;
+}
+
+int is_number( const char *arg )
+{
+    return arg[0] && strspn( arg, "0123456789" ) == strlen( arg );
 }
 
 int main( int argc, char *argv[] )
 {
-    int bitdepth;
+    static const struct { const char *name; int format; } formats[] = {
+        { "CI4", FORMAT_CI4 }, { "CI8", FORMAT_CI8 }, { "I4", FORMAT_I4 },
+        { "I8", FORMAT_I8 }, { "IA4", FORMAT_IA4 }, { "IA8", FORMAT_IA8 },
+    };
+    int bitdepth = BITDEPTH_16BPP;
+    int format = FORMAT_UNCOMPRESSED;
+    const char *out_dir = NULL;
+    int jobs = 0;
+    int compress = 0;
+
+    if( argc > 1 && !strcmp( argv[1], "--compress" ) )
+    {
+        compress = 1;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
 
-    if( argc != 4 && argc != 6 )
+    /* Batch mode options */
+    if( argc > 2 && !strcmp( argv[1], "--batch" ) )
+    {
+        out_dir = argv[2];
+        argv += 2;
+        argc -= 2;
+
+        if( argc > 2 && !strcmp( argv[1], "--jobs" ) )
+        {
+            jobs = atoi( argv[2] );
+            argv += 2;
+            argc -= 2;
+        }
+
+        if( argc < 3 )
+        {
+            print_args( argv[0] );
+            return -EINVAL;
+        }
+    }
+    else if( argc != 4 && argc != 6 )
     {
         print_args( argv[0] );
         return -EINVAL;
     }
 
     /* Covert bitdepth argument */
-    bitdepth = atoi( argv[1] );
-
-    if( bitdepth == 32 )
+    for( int i = 0; i < sizeof(formats) / sizeof(formats[0]); i++ )
     {
-        bitdepth = BITDEPTH_32BPP;
+        if( !strcasecmp( argv[1], formats[i].name ) )
+        {
+            format = formats[i].format;
+        }
     }
-    else if( bitdepth == 16 )
+
+    if( format == FORMAT_UNCOMPRESSED )
     {
-        bitdepth = BITDEPTH_16BPP;
+        bitdepth = atoi( argv[1] );
+
+        if( bitdepth == 32 )
+        {
+            bitdepth = BITDEPTH_32BPP;
+        }
+        else if( bitdepth == 16 )
+        {
+            bitdepth = BITDEPTH_16BPP;
+        }
+        else
+        {
+            print_args( argv[0] );
+            return -EINVAL;
+        }
     }
-    else
+
+    if( out_dir )
     {
-        print_args( argv[0] );
-        return -EINVAL;
+        batch_t batch = { .out_dir = out_dir, .depth = bitdepth, .format = format, .hslices = 1, .vslices = 1, .compress = compress };
+        int arg = 2;
+        int err = 0;
+
+        if( argc > 4 && is_number( argv[2] ) && is_number( argv[3] ) )
+        {
+            batch.hslices = atoi( argv[2] );
+            batch.vslices = atoi( argv[3] );
+            arg = 4;
+        }
+
+        for( ; arg < argc; arg++ )
+        {
+            if( batch_add_input( &batch, argv[arg] ) )
+            {
+                err = -ENOENT;
+            }
+        }
+
+        int batch_err = run_batch( &batch, jobs );
+
+        return err ? err : batch_err;
     }
 
     if( argc == 4 )
     {
         /* Translate, return result */
-        return read_png( argv[2], argv[3], bitdepth, 1, 1 );
+        return read_png( argv[2], argv[3], bitdepth, format, 1, 1, compress );
     }
     else
     {
@@ -271,6 +864,6 @@ int main( int argc, char *argv[] )
         int vslices = atoi( argv[3] );
 
         /* Translate, return result */
-        return read_png( argv[4], argv[5], bitdepth, hslices, vslices );
+        return read_png( argv[4], argv[5], bitdepth, format, hslices, vslices, compress );
     }
 }
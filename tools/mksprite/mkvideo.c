@@ -0,0 +1,614 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <png.h>
+
+/* Layout of the video file, see video.c.  All values are big-endian:
+ *
+ *   "VD64", uint16 version, uint16 flags, uint16 width, uint16 height,
+ *   uint32 fps (16.16), uint32 frames, uint32 max record size,
+ *   uint32 first record size, uint32 max coded blocks in a frame
+ *   records, one per frame (multiple of 8 bytes):
+ *     uint32 size of the next record (0 for the last one),
+ *     uint8 quantizer scale (padded to 8 bytes),
+ *     macroblocks in raster order:
+ *       uint8 mode (MB_SKIP, MB_INTER or MB_INTRA),
+ *       int8 motion vector x, y (MB_INTER only),
+ *       uint8 coded block pattern (MB_INTER and MB_INTRA),
+ *       for each coded block, uint16 tokens: bit 15 last, bits 9-14 zero
+ *       run, bits 0-8 quantized coefficient (zigzag order)
+ */
+#define VIDEO_MAGIC         "VD64"
+#define VIDEO_VERSION       2
+#define MB_SIZE             16
+
+#define MB_SKIP             0
+#define MB_INTER            1
+#define MB_INTRA            2
+
+/* Motion vectors are even (so that they are whole pixels for chroma too),
+   and up to this many pixels in each direction */
+#define MV_RANGE            16
+
+/* Largest size of a coded macroblock: mode, vector, pattern and 6 blocks of 64 tokens */
+#define MB_MAX_BYTES        (4 + 6 * 64 * 2)
+
+/* Zigzag order and quantizer steps, see video.c */
+static const uint8_t zigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static int quant( int pos )
+{
+    return pos ? 16 + 4 * ((pos & 7) + (pos >> 3)) : 32;
+}
+
+/* IDCT matrix of the RSP ucode (rsp_video.S): a(u) * cos((2x+1) u pi / 16) in 1.15 */
+static const int16_t idct_matrix[8][8] = {
+    { 11585, 11585, 11585, 11585, 11585, 11585, 11585, 11585 },
+    { 16069, 13623,  9102,  3196, -3196, -9102,-13623,-16069 },
+    { 15137,  6270, -6270,-15137,-15137, -6270,  6270, 15137 },
+    { 13623, -3196,-16069, -9102,  9102, 16069,  3196,-13623 },
+    { 11585,-11585,-11585, 11585, 11585,-11585,-11585, 11585 },
+    {  9102,-16069,  3196, 13623,-13623, -3196, 16069, -9102 },
+    {  6270,-15137, 15137, -6270, -6270, 15137,-15137,  6270 },
+    {  3196, -9102, 13623,-16069, 16069,-13623,  9102, -3196 },
+};
+
+typedef struct
+{
+    int width, height;
+    uint8_t *y;
+    uint8_t *uv;
+} frame_t;
+
+void write_half( FILE *fp, uint16_t value )
+{
+    uint8_t out[2] = { value >> 8, value };
+
+    fwrite( out, 1, 2, fp );
+}
+
+void write_word( FILE *fp, uint32_t value )
+{
+    uint8_t out[4] = { value >> 24, value >> 16, value >> 8, value };
+
+    fwrite( out, 1, 4, fp );
+}
+
+void put_word( uint8_t *p, uint32_t value )
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+uint8_t clamp( float value )
+{
+    if( value < 0 ) { return 0; }
+    if( value > 255 ) { return 255; }
+    return (uint8_t)(value + 0.5f);
+}
+
+/* Convert a PNG to YUV 4:2:0, using full range BT.601 as the RSP ucode (rsp_video.S) */
+int load_frame( frame_t *frame, const char *fn )
+{
+    png_image image;
+
+    memset( &image, 0, sizeof( image ) );
+    image.version = PNG_IMAGE_VERSION;
+
+    if( !png_image_begin_read_from_file( &image, fn ) )
+    {
+        fprintf( stderr, "Unable to read %s: %s\n", fn, image.message );
+        return -ENOENT;
+    }
+
+    image.format = PNG_FORMAT_RGB;
+
+    if( frame->y == NULL )
+    {
+        if( image.width % MB_SIZE || image.height % MB_SIZE )
+        {
+            fprintf( stderr, "%s: the size must be a multiple of %d!\n", fn, MB_SIZE );
+            png_image_free( &image );
+            return -EINVAL;
+        }
+
+        frame->width = image.width;
+        frame->height = image.height;
+        frame->y = malloc( frame->width * frame->height );
+        frame->uv = malloc( frame->width * frame->height / 2 );
+
+        if( frame->y == NULL || frame->uv == NULL )
+        {
+            png_image_free( &image );
+            return -ENOMEM;
+        }
+    }
+    else if( image.width != frame->width || image.height != frame->height )
+    {
+        fprintf( stderr, "%s: all the frames must have the same size!\n", fn );
+        png_image_free( &image );
+        return -EINVAL;
+    }
+
+    uint8_t *rgb = malloc( PNG_IMAGE_SIZE( image ) );
+
+    if( rgb == NULL )
+    {
+        png_image_free( &image );
+        return -ENOMEM;
+    }
+
+    if( !png_image_finish_read( &image, NULL, rgb, 0, NULL ) )
+    {
+        fprintf( stderr, "Unable to read %s: %s\n", fn, image.message );
+        free( rgb );
+        return -EINVAL;
+    }
+
+    for( int y = 0; y < frame->height; y += 2 )
+    {
+        for( int x = 0; x < frame->width; x += 2 )
+        {
+            float u = 0, v = 0;
+
+            for( int i = 0; i < 4; i++ )
+            {
+                int px = x + (i & 1), py = y + (i >> 1);
+                uint8_t *c = &rgb[(py * frame->width + px) * 3];
+
+                frame->y[py * frame->width + px] = clamp( 0.299f * c[0] + 0.587f * c[1] + 0.114f * c[2] );
+                u += -0.168736f * c[0] - 0.331264f * c[1] + 0.5f * c[2];
+                v += 0.5f * c[0] - 0.418688f * c[1] - 0.081312f * c[2];
+            }
+
+            frame->uv[(y / 2) * frame->width + x + 0] = clamp( u / 4 + 128 );
+            frame->uv[(y / 2) * frame->width + x + 1] = clamp( v / 4 + 128 );
+        }
+    }
+
+    free( rgb );
+
+    return 0;
+}
+
+static int16_t clamp16( int64_t value )
+{
+    return value < -32768 ? -32768 : value > 32767 ? 32767 : value;
+}
+
+/* Add the IDCT of the coefficients to a block, with the same arithmetic of
+   the RSP ucode (see rsp_video.S), so that the reference frames match */
+void idct_add( const int16_t coef[64], uint8_t *pix, int step, int pitch )
+{
+    for( int y = 0; y < 8; y++ )
+    {
+        int16_t t[8];
+
+        /* Column pass (vmulf / vmacf) */
+        for( int u = 0; u < 8; u++ )
+        {
+            int64_t acc = 0x8000;
+            for( int v = 0; v < 8; v++ ) { acc += coef[v * 8 + u] * idct_matrix[v][y] * 2; }
+            t[u] = clamp16( acc >> 16 );
+        }
+
+        /* Row pass, then add to the prediction (pixel << 7), round and clamp */
+        for( int x = 0; x < 8; x++ )
+        {
+            int64_t acc = 0x8000;
+            for( int u = 0; u < 8; u++ ) { acc += idct_matrix[u][x] * t[u] * 2; }
+
+            uint8_t *p = &pix[y * pitch + x * step];
+            int value = clamp16( clamp16( acc >> 16 ) * 16 + (*p << 7) + 64 );
+            *p = value < 0 ? 0 : value >> 7;
+        }
+    }
+}
+
+/* Code a block of residuals: quantize its DCT, write the tokens and return the
+   dequantized coefficients. Returns the end of the tokens, or NULL if all the
+   coefficients are zero. Residuals of predicted blocks are rounded towards
+   zero, so that the noise left by the quantization is not coded again. */
+uint8_t *code_block( const int res[64], int qscale, bool inter, uint8_t *out, int16_t coef[64] )
+{
+    int level[64];
+    int last = -1;
+
+    for( int pos = 0; pos < 64; pos++ )
+    {
+        int u = pos & 7, v = pos >> 3;
+        double sum = 0;
+
+        for( int y = 0; y < 8; y++ )
+        {
+            for( int x = 0; x < 8; x++ )
+            {
+                sum += idct_matrix[v][y] * idct_matrix[u][x] * (double)res[y * 8 + x];
+            }
+        }
+
+        /* Coefficients with 3 fractional bits */
+        sum = sum * 8 / (32768.0 * 32768.0);
+        double q = fabs( sum ) / (quant( pos ) * qscale);
+        int l = (int)(q + (inter ? 1.0 / 3 : 0.5)) * (sum < 0 ? -1 : 1);
+        level[pos] = l < -256 ? -256 : l > 255 ? 255 : l;
+    }
+
+    for( int i = 0; i < 64; i++ )
+    {
+        if( level[zigzag[i]] ) { last = i; }
+    }
+
+    if( last < 0 ) { return NULL; }
+
+    int run = 0;
+
+    for( int i = 0; i <= last; i++ )
+    {
+        int pos = zigzag[i];
+
+        coef[pos] = clamp16( level[pos] * quant( pos ) * qscale );
+
+        if( !level[pos] )
+        {
+            run++;
+            continue;
+        }
+
+        uint16_t token = (i == last ? 0x8000 : 0) | (run << 9) | (level[pos] & 0x1FF);
+        *out++ = token >> 8;
+        *out++ = token;
+        run = 0;
+    }
+
+    for( int i = last + 1; i < 64; i++ )
+    {
+        coef[zigzag[i]] = 0;
+    }
+
+    return out;
+}
+
+/* Sum of absolute differences between a luma macroblock and a block of the reference */
+int mb_sad( const frame_t *frame, const frame_t *ref, int x, int y, int rx, int ry )
+{
+    int sad = 0;
+
+    for( int r = 0; r < MB_SIZE; r++ )
+    {
+        const uint8_t *a = &frame->y[(y + r) * frame->width + x];
+        const uint8_t *b = &ref->y[(ry + r) * frame->width + rx];
+
+        for( int c = 0; c < MB_SIZE; c++ ) { sad += abs( a[c] - b[c] ); }
+    }
+
+    return sad;
+}
+
+/* Sum of absolute differences of a luma macroblock from its mean, as the cost of intra coding */
+int mb_activity( const frame_t *frame, int x, int y )
+{
+    int sum = 0, act = 0;
+
+    for( int r = 0; r < MB_SIZE; r++ )
+    {
+        for( int c = 0; c < MB_SIZE; c++ ) { sum += frame->y[(y + r) * frame->width + x + c]; }
+    }
+
+    int mean = sum / (MB_SIZE * MB_SIZE);
+
+    for( int r = 0; r < MB_SIZE; r++ )
+    {
+        for( int c = 0; c < MB_SIZE; c++ ) { act += abs( frame->y[(y + r) * frame->width + x + c] - mean ); }
+    }
+
+    return act;
+}
+
+/* Code a macroblock into a record, and reconstruct it into cur as the player
+   will do. ref is the reconstruction of the previous frame, or NULL for a key
+   frame. Returns the end of the macroblock in the record. */
+uint8_t *code_mb( uint8_t *out, const frame_t *frame, const frame_t *ref, frame_t *cur,
+                  int x, int y, int qscale, int *num_blocks )
+{
+    int w = frame->width;
+    int mode = MB_INTRA, mvx = 0, mvy = 0;
+
+    if( ref )
+    {
+        /* Full search of the motion vector, preferring short ones on ties */
+        int best = mb_sad( frame, ref, x, y, x, y );
+
+        for( int dy = -MV_RANGE; dy <= MV_RANGE; dy += 2 )
+        {
+            for( int dx = -MV_RANGE; dx <= MV_RANGE; dx += 2 )
+            {
+                if( x + dx < 0 || y + dy < 0 || x + dx + MB_SIZE > w || y + dy + MB_SIZE > frame->height ) { continue; }
+
+                int sad = mb_sad( frame, ref, x, y, x + dx, y + dy );
+                if( sad < best || (sad == best && abs( dx ) + abs( dy ) < abs( mvx ) + abs( mvy )) )
+                {
+                    best = sad;
+                    mvx = dx;
+                    mvy = dy;
+                }
+            }
+        }
+
+        if( best <= mb_activity( frame, x, y ) + MB_SIZE * MB_SIZE * 2 )
+        {
+            mode = MB_INTER;
+        }
+        else
+        {
+            mvx = mvy = 0;
+        }
+    }
+
+    /* Prediction */
+    for( int r = 0; r < MB_SIZE; r++ )
+    {
+        uint8_t *dst = &cur->y[(y + r) * w + x];
+
+        if( mode == MB_INTER ) { memcpy( dst, &ref->y[(y + mvy + r) * w + x + mvx], MB_SIZE ); }
+        else { memset( dst, 128, MB_SIZE ); }
+    }
+
+    for( int r = 0; r < MB_SIZE / 2; r++ )
+    {
+        uint8_t *dst = &cur->uv[(y / 2 + r) * w + x];
+
+        if( mode == MB_INTER ) { memcpy( dst, &ref->uv[((y + mvy) / 2 + r) * w + x + mvx], MB_SIZE ); }
+        else { memset( dst, 128, MB_SIZE ); }
+    }
+
+    /* Residuals of the blocks: Y0 Y1 Y2 Y3 U V */
+    uint8_t tokens[6 * 64 * 2];
+    uint8_t *t = tokens;
+    int cbp = 0;
+
+    for( int b = 0; b < 6; b++ )
+    {
+        const uint8_t *src, *pred;
+        uint8_t *pix;
+        int step, res[64];
+        int16_t coef[64];
+
+        if( b < 4 )
+        {
+            int ofs = (y + (b >> 1) * 8) * w + x + (b & 1) * 8;
+            src = &frame->y[ofs];
+            pix = &cur->y[ofs];
+            step = 1;
+        }
+        else
+        {
+            int ofs = (y / 2) * w + x + (b - 4);
+            src = &frame->uv[ofs];
+            pix = &cur->uv[ofs];
+            step = 2;
+        }
+
+        pred = pix;
+        for( int r = 0; r < 8; r++ )
+        {
+            for( int c = 0; c < 8; c++ ) { res[r * 8 + c] = src[r * w + c * step] - pred[r * w + c * step]; }
+        }
+
+        uint8_t *end = code_block( res, qscale, mode == MB_INTER, t, coef );
+        if( end )
+        {
+            idct_add( coef, pix, step, w );
+            cbp |= 1 << b;
+            t = end;
+            (*num_blocks)++;
+        }
+    }
+
+    if( mode == MB_INTER && !cbp && !mvx && !mvy )
+    {
+        *out++ = MB_SKIP;
+        return out;
+    }
+
+    *out++ = mode;
+    if( mode == MB_INTER )
+    {
+        *out++ = (int8_t)mvx;
+        *out++ = (int8_t)mvy;
+    }
+    *out++ = cbp;
+
+    memcpy( out, tokens, t - tokens );
+    return out + (t - tokens);
+}
+
+void write_header( FILE *op, const frame_t *frame, uint32_t fps, int frames, int max_size, int first_size, int max_blocks )
+{
+    fseek( op, 0, SEEK_SET );
+    fwrite( VIDEO_MAGIC, 1, 4, op );
+    write_half( op, VIDEO_VERSION );
+    write_half( op, 0 );
+    write_half( op, frame->width );
+    write_half( op, frame->height );
+    write_word( op, fps );
+    write_word( op, frames );
+    write_word( op, max_size );
+    write_word( op, first_size );
+    write_word( op, max_blocks );
+}
+
+void print_args( char * name )
+{
+    fprintf( stderr, "Usage: %s [-f <fps>] [-q <qscale>] [-k <interval>] <output video> <input png>...\n", name );
+    fprintf( stderr, "\tConverts a sequence of frames (default 30 fps) into a video for video_open.\n" );
+    fprintf( stderr, "\tAll the frames must have the same size, a multiple of 16 pixels.\n" );
+    fprintf( stderr, "\tFrames are coded as 8x8 DCT blocks, predicted from the previous frame with\n" );
+    fprintf( stderr, "\tmotion compensation. <qscale> (1-32, default 2) trades quality for size.\n" );
+    fprintf( stderr, "\tA key frame, coded without prediction, is stored every <interval> frames\n" );
+    fprintf( stderr, "\t(default 60, 0 for the first frame only).\n" );
+    fprintf( stderr, "\t<output video> will be written in binary for inclusion using DragonFS.\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+    float fps = 30;
+    int qscale = 2;
+    int keyint = 60;
+    int arg = 1;
+
+    while( arg + 1 < argc && argv[arg][0] == '-' )
+    {
+        if( !strcmp( argv[arg], "-f" ) )
+        {
+            fps = atof( argv[arg + 1] );
+        }
+        else if( !strcmp( argv[arg], "-q" ) )
+        {
+            qscale = atoi( argv[arg + 1] );
+        }
+        else if( !strcmp( argv[arg], "-k" ) )
+        {
+            keyint = atoi( argv[arg + 1] );
+        }
+        else
+        {
+            print_args( argv[0] );
+            return -EINVAL;
+        }
+
+        arg += 2;
+    }
+
+    if( argc - arg < 2 || fps <= 0 || qscale < 1 || qscale > 32 || keyint < 0 )
+    {
+        print_args( argv[0] );
+        return -EINVAL;
+    }
+
+    FILE *op = fopen( argv[arg], "wb" );
+
+    if( op == NULL )
+    {
+        return -ENOENT;
+    }
+
+    int frames = argc - arg - 1;
+    frame_t frame, recon[2];
+    uint8_t *record[2] = { NULL, NULL };
+    int size[2] = { 0, 0 };
+    int max_size = 0, first_size = 0, max_blocks = 0;
+    int err = 0;
+
+    memset( &frame, 0, sizeof( frame ) );
+    memset( recon, 0, sizeof( recon ) );
+
+    for( int f = 0; f < frames && !err; f++ )
+    {
+        err = load_frame( &frame, argv[arg + 1 + f] );
+        if( err ) { break; }
+
+        int mb_width = frame.width / MB_SIZE;
+        int num_mbs = mb_width * (frame.height / MB_SIZE);
+
+        if( f == 0 )
+        {
+            for( int i = 0; i < 2; i++ )
+            {
+                recon[i].width = frame.width;
+                recon[i].height = frame.height;
+                recon[i].y = malloc( frame.width * frame.height );
+                recon[i].uv = malloc( frame.width * frame.height / 2 );
+                record[i] = malloc( 8 + num_mbs * MB_MAX_BYTES + 8 );
+
+                if( !recon[i].y || !recon[i].uv || !record[i] )
+                {
+                    err = -ENOMEM;
+                }
+            }
+
+            if( err ) { break; }
+
+            /* Write a placeholder, the header is completed at the end */
+            write_header( op, &frame, 0, 0, 0, 0, 0 );
+        }
+
+        /* Encode this frame in the current record, reconstructing it as the
+           reference of the next one */
+        bool key = f == 0 || (keyint && f % keyint == 0);
+        frame_t *ref = key ? NULL : &recon[(f - 1) & 1];
+        frame_t *cur = &recon[f & 1];
+        uint8_t *rec = record[f & 1];
+        uint8_t *out = rec + 8;
+        int blocks = 0, skipped = 0;
+
+        memset( rec, 0, 8 );
+        rec[4] = qscale;
+
+        for( int i = 0; i < num_mbs; i++ )
+        {
+            int x = (i % mb_width) * MB_SIZE, y = (i / mb_width) * MB_SIZE;
+
+            uint8_t *mb = out;
+
+            out = code_mb( out, &frame, ref, cur, x, y, qscale, &blocks );
+            if( *mb == MB_SKIP ) { skipped++; }
+        }
+
+        /* Records are padded to 8 bytes */
+        while( (out - rec) & 7 ) { *out++ = 0; }
+
+        size[f & 1] = out - rec;
+        if( size[f & 1] > max_size ) { max_size = size[f & 1]; }
+        if( blocks > max_blocks ) { max_blocks = blocks; }
+
+        /* The previous record can be written now that the size of this one is known */
+        if( f == 0 )
+        {
+            first_size = size[0];
+        }
+        else
+        {
+            uint8_t *prev = record[(f - 1) & 1];
+
+            put_word( prev, size[f & 1] );
+            fwrite( prev, 1, size[(f - 1) & 1], op );
+        }
+
+        fprintf( stderr, "Frame %d%s: %d bytes, %d blocks, %d/%d skipped\n",
+                 f, key ? " (key)" : "", size[f & 1], blocks, skipped, num_mbs );
+    }
+
+    if( !err )
+    {
+        /* The last record has no next one */
+        uint8_t *last = record[(frames - 1) & 1];
+
+        put_word( last, 0 );
+        fwrite( last, 1, size[(frames - 1) & 1], op );
+        write_header( op, &frame, (uint32_t)(fps * 65536), frames, max_size, first_size, max_blocks );
+    }
+
+    fclose( op );
+    free( frame.y );
+    free( frame.uv );
+    for( int i = 0; i < 2; i++ )
+    {
+        free( recon[i].y );
+        free( recon[i].uv );
+        free( record[i] );
+    }
+
+    return err;
+}
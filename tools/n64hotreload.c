@@ -0,0 +1,105 @@
+/*
+	n64hotreload, a program to wrap an asset into a libdragon USB hot-reload packet.
+
+	The packet is meant to be sent as a single DATATYPE_RAWBINARY transfer by a
+	USB host tool compatible with the UNFLoader protocol. On the N64 side,
+	debug_usbfs_poll() stores the asset in the "usb:/" RAM filesystem, which can
+	shadow the files of the ROM through overlayfs_attach().
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PACKET_MAGIC    0x48524C44  // "HRLD"
+#define MAX_PATH_LEN    255
+#define MAX_PACKET_SIZE 0xFFFFFF    // USB packet sizes are 24-bit
+
+#define STATUS_OK       0
+#define STATUS_ERROR    1
+#define STATUS_BADUSAGE 2
+
+static int print_usage(const char * prog_name)
+{
+	fprintf(stderr, "Usage: %s <path> <asset> <output>\n\n", prog_name);
+	fprintf(stderr, "This program wraps an asset into a packet that, once sent through USB\n");
+	fprintf(stderr, "to a ROM running debug_usbfs_poll(), replaces the file <path>\n");
+	fprintf(stderr, "(relative to usb:/, eg: gfx/hero.sprite) with the contents of <asset>.\n");
+	return STATUS_BADUSAGE;
+}
+
+static void write_be32(uint8_t *buf, uint32_t v)
+{
+	buf[0] = v >> 24;
+	buf[1] = v >> 16;
+	buf[2] = v >> 8;
+	buf[3] = v;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 4)
+		return print_usage(argv[0]);
+
+	const char *path = argv[1];
+	size_t path_len = strlen(path);
+	if (path_len == 0 || path_len > MAX_PATH_LEN)
+	{
+		fprintf(stderr, "ERROR: invalid path length: %s\n", path);
+		return STATUS_BADUSAGE;
+	}
+
+	FILE *in = fopen(argv[2], "rb");
+	if (!in)
+	{
+		fprintf(stderr, "ERROR: cannot open %s\n", argv[2]);
+		return STATUS_ERROR;
+	}
+	fseek(in, 0, SEEK_END);
+	long size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+
+	// The contents start 8-byte aligned, so that they can be DMA'd on the N64
+	size_t hdr_len = (12 + path_len + 7) & ~7;
+	if (size < 0 || hdr_len + size > MAX_PACKET_SIZE)
+	{
+		fprintf(stderr, "ERROR: %s is too large for a USB packet\n", argv[2]);
+		fclose(in);
+		return STATUS_ERROR;
+	}
+
+	uint8_t *packet = calloc(1, hdr_len + size);
+	if (!packet)
+	{
+		fprintf(stderr, "ERROR: out of memory\n");
+		fclose(in);
+		return STATUS_ERROR;
+	}
+	write_be32(packet + 0, PACKET_MAGIC);
+	write_be32(packet + 4, size);
+	write_be32(packet + 8, path_len);
+	memcpy(packet + 12, path, path_len);
+
+	if (fread(packet + hdr_len, 1, size, in) != (size_t)size)
+	{
+		fprintf(stderr, "ERROR: cannot read %s\n", argv[2]);
+		fclose(in);
+		free(packet);
+		return STATUS_ERROR;
+	}
+	fclose(in);
+
+	FILE *out = fopen(argv[3], "wb");
+	if (!out || fwrite(packet, 1, hdr_len + size, out) != hdr_len + size)
+	{
+		fprintf(stderr, "ERROR: cannot write %s\n", argv[3]);
+		if (out)
+			fclose(out);
+		free(packet);
+		return STATUS_ERROR;
+	}
+	fclose(out);
+	free(packet);
+	return STATUS_OK;
+}
@@ -33,6 +33,15 @@
 #define TITLE_OFFSET 0x20
 #define TITLE_SIZE   20
 
+/* Header of a compressed file, recognized by the boot code (entrypoint.S) */
+#define COMPRESSED_MAGIC       0x4C5A3442
+#define COMPRESSED_HEADER_SIZE 16
+
+/* LZ4 compressor parameters */
+#define LZ4_HASH_BITS   16
+#define LZ4_MAX_OFFSET  65535
+#define LZ4_MIN_MATCH   4
+
 #define STATUS_OK       0
 #define STATUS_ERROR    1 
 #define STATUS_BADUSAGE 2
@@ -40,10 +49,12 @@
 static const unsigned char zero[1024] = {0};
 static char * tmp_output = NULL;
 
+ssize_t output_zeros(FILE * dest, ssize_t amount);
+
 
 int print_usage(const char * prog_name)
 {
-	fprintf(stderr, "Usage: %s [-t <title>] [-l <size>B/K/M] -h <file> -o <file> <file> [[-s <offset>B/K/M] <file>]*\n\n", prog_name);
+	fprintf(stderr, "Usage: %s [-t <title>] [-l <size>B/K/M] -h <file> -o <file> <file> [[-s <offset>B/K/M] [-z] <file>]*\n\n", prog_name);
 	fprintf(stderr, "This program creates an N64 ROM from a header and a list of files,\n");
 	fprintf(stderr, "the first being an Nintendo64 binary and the rest arbitrary data.\n");
 	fprintf(stderr, "\n");
@@ -53,6 +64,7 @@ int print_usage(const char * prog_name)
 	fprintf(stderr, "\t-h, --header <file>    Use <file> as IPL3 header.\n");
 	fprintf(stderr, "\t-o, --output <file>    Save output ROM to <file>.\n");
 	fprintf(stderr, "\t-s, --offset <offset>  Next file starts at <offset> from top of memory. Offset must be 32-bit aligned.\n");
+	fprintf(stderr, "\t-z, --compress         Compress the next file (the program image, decompressed by the boot code).\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Binary byte size/offset suffix notation:\n");
 	fprintf(stderr, "\tB for bytes.\n");
@@ -121,6 +133,148 @@ ssize_t copy_file(FILE * dest, const char * file)
 	return rsize;
 }
 
+void write_be32(FILE * dest, uint32_t value)
+{
+	uint8_t buf[4] = { value >> 24, value >> 16, value >> 8, value };
+	fwrite(buf, 1, 4, dest);
+}
+
+uint32_t read_le32(const uint8_t * p)
+{
+	uint32_t value;
+	memcpy(&value, p, 4);
+	return value;
+}
+
+void lz4_write_length(uint8_t ** out, size_t len)
+{
+	while(len >= 255)
+	{
+		*(*out)++ = 255;
+		len -= 255;
+	}
+	*(*out)++ = len;
+}
+
+void lz4_write_sequence(uint8_t ** out, const uint8_t * literals, size_t num_literals, size_t offset, size_t match_len)
+{
+	uint8_t * token = (*out)++;
+	size_t ml = match_len ? match_len - LZ4_MIN_MATCH : 0;
+
+	*token = ((num_literals < 15 ? num_literals : 15) << 4) | (ml < 15 ? ml : 15);
+	if(num_literals >= 15)
+		lz4_write_length(out, num_literals - 15);
+
+	memcpy(*out, literals, num_literals);
+	*out += num_literals;
+
+	if(!match_len)
+		return;
+
+	*(*out)++ = offset & 0xFF;
+	*(*out)++ = offset >> 8;
+	if(ml >= 15)
+		lz4_write_length(out, ml - 15);
+}
+
+/* Compress a buffer as a LZ4 block (greedy parsing, with a hash table of the last
+   position of each 4-byte sequence). The output buffer must be at least
+   len + len/255 + 16 bytes. Returns the compressed size. */
+size_t lz4_compress(const uint8_t * src, size_t len, uint8_t * dst)
+{
+	static uint32_t table[1 << LZ4_HASH_BITS];
+	const uint8_t * end = src + len;
+	/* As per the LZ4 format, the last match must start 12 bytes before the end
+	   and the last 5 bytes are always literals */
+	const uint8_t * match_limit = len > 12 ? end - 12 : src;
+	const uint8_t * ip = src;
+	const uint8_t * anchor = src;
+	uint8_t * out = dst;
+
+	memset(table, 0, sizeof(table));
+
+	while(ip < match_limit)
+	{
+		uint32_t seq = read_le32(ip);
+		uint32_t hash = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+		uint32_t prev = table[hash];
+		table[hash] = ip - src + 1;
+
+		const uint8_t * ref = src + prev - 1;
+		if(!prev || ip - ref > LZ4_MAX_OFFSET || read_le32(ref) != seq)
+		{
+			ip++;
+			continue;
+		}
+
+		size_t match_len = LZ4_MIN_MATCH;
+		while(ip + match_len < end - 5 && ref[match_len] == ip[match_len])
+			match_len++;
+
+		lz4_write_sequence(&out, anchor, ip - anchor, ip - ref, match_len);
+		ip += match_len;
+		anchor = ip;
+	}
+
+	lz4_write_sequence(&out, anchor, end - anchor, 0, 0);
+	return out - dst;
+}
+
+ssize_t compress_file(FILE * dest, const char * file)
+{
+	FILE *read_file = fopen(file, "rb");
+
+	if(!read_file)
+	{
+		fprintf(stderr, "ERROR: Cannot open %s for reading!\n", file);
+		return -1;
+	}
+
+	size_t size = get_file_size(read_file);
+	uint8_t *src = malloc(size + 1);
+	uint8_t *dst = malloc(size + size / 255 + 16);
+
+	if(!src || !dst)
+	{
+		fprintf(stderr, "ERROR: Out of memory!\n");
+
+		free(src);
+		free(dst);
+		fclose(read_file);
+
+		return -1;
+	}
+
+	if(fread(src, 1, size, read_file) != size)
+	{
+		fprintf(stderr, "ERROR: Cannot read %s!\n", file);
+
+		free(src);
+		free(dst);
+		fclose(read_file);
+
+		return -1;
+	}
+
+	size_t csize = lz4_compress(src, size, dst);
+
+	/* Header, followed by the data padded to 16 bytes */
+	write_be32(dest, COMPRESSED_MAGIC);
+	write_be32(dest, size);
+	write_be32(dest, csize);
+	write_be32(dest, 0);
+	fwrite(dst, 1, csize, dest);
+
+	ssize_t padding = (16 - csize % 16) % 16;
+	output_zeros(dest, padding);
+
+	free(src);
+	free(dst);
+	fclose(read_file);
+
+	return COMPRESSED_HEADER_SIZE + csize + padding;
+}
+
 ssize_t output_zeros(FILE * dest, ssize_t amount)
 {
 	if(amount < 0)
@@ -183,6 +337,7 @@ int main(int argc, char *argv[])
 	const char * output = NULL;
 	size_t declared_size = 0;
 	size_t total_bytes_written = 0;
+	bool compress_next = false;
 	char title[TITLE_SIZE + 1] = { 0, };
 
 	if(argc <= 1)
@@ -330,6 +485,11 @@ int main(int argc, char *argv[])
 			total_bytes_written += num_zeros;
 			continue;
 		}
+		if(check_flag(arg, "-z", "--compress"))
+		{
+			compress_next = true;
+			continue;
+		}
 		if(check_flag(arg, "-t", "--title"))
 		{
 			if(i >= argc)
@@ -387,7 +547,8 @@ int main(int argc, char *argv[])
 		}
 
 		/* Copy the input file into the output file */
-		ssize_t bytes_copied = copy_file(write_file, arg);
+		ssize_t bytes_copied = compress_next ? compress_file(write_file, arg) : copy_file(write_file, arg);
+		compress_next = false;
 
 		if(bytes_copied < 0)
 		{
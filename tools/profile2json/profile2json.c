@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+/* Layout of an exported frame, see profile_export in profile.c.  All values are big-endian:
+ *
+ *   uint32 magic ("PRF1"), uint32 frame ticks, uint32 RSP ticks, uint32 RDP busy ticks,
+ *   uint16 number of RSP tasks, uint16 number of names, uint16 number of scopes, uint16 pad
+ *   RSP tasks: uint32 start, uint32 ticks
+ *   names: uint8 length, characters; padded to 4 bytes
+ *   scopes: uint16 name index, uint16 depth, uint32 start, uint32 ticks
+ */
+#define PROFILE_MAGIC       0x50524631
+#define HEADER_SIZE         24
+
+/* COP0 count register rate, in ticks per microsecond */
+#define TICKS_PER_US        46.875
+
+/* Timeline of the trace: frames are laid out one after another */
+static double frame_start_us = 0.0;
+static int frame_number = 0;
+static int first_event = 1;
+
+uint32_t read_word( const uint8_t *p )
+{
+    return (p[0] << 8) | p[1];
+}
+
+uint32_t read_long( const uint8_t *p )
+{
+    return (read_word( p ) << 16) | read_word( p + 2 );
+}
+
+void write_string( FILE *op, const uint8_t *str, int len )
+{
+    fputc( '"', op );
+
+    for( int i = 0; i < len; i++ )
+    {
+        if( str[i] == '"' || str[i] == '\\' )
+        {
+            fprintf( op, "\\%c", str[i] );
+        }
+        else if( str[i] < 0x20 || str[i] >= 0x7F )
+        {
+            fprintf( op, "\\u%04x", str[i] );
+        }
+        else
+        {
+            fputc( str[i], op );
+        }
+    }
+
+    fputc( '"', op );
+}
+
+void write_event( FILE *op, const uint8_t *name, int len, int tid, uint32_t start, uint32_t ticks )
+{
+    fprintf( op, "%s\n{\"name\":", first_event ? "" : "," );
+    write_string( op, name, len );
+    fprintf( op, ",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+             tid, frame_start_us + start / TICKS_PER_US, ticks / TICKS_PER_US );
+    first_event = 0;
+}
+
+/* Convert one frame, returning its size or a negative error */
+int convert_frame( FILE *op, const uint8_t *data, int size )
+{
+    if( size < HEADER_SIZE || read_long( data ) != PROFILE_MAGIC )
+    {
+        return -EINVAL;
+    }
+
+    uint32_t frame_ticks = read_long( data + 4 );
+    uint32_t rdp_ticks = read_long( data + 12 );
+    int num_rsp_tasks = read_word( data + 16 );
+    int num_names = read_word( data + 18 );
+    int num_scopes = read_word( data + 20 );
+    const uint8_t *p = data + HEADER_SIZE;
+    const uint8_t *end = data + size;
+    char frame_name[32];
+
+    if( p + num_rsp_tasks * 8 > end )
+    {
+        return -EINVAL;
+    }
+
+    snprintf( frame_name, sizeof( frame_name ), "Frame %d", frame_number );
+    write_event( op, (const uint8_t *)frame_name, strlen( frame_name ), 0, 0, frame_ticks );
+
+    for( int i = 0; i < num_rsp_tasks; i++, p += 8 )
+    {
+        write_event( op, (const uint8_t *)"RSP task", 8, 2, read_long( p ), read_long( p + 4 ) );
+    }
+
+    /* The RDP does not time-stamp its work: show the total, at the start of the frame */
+    if( rdp_ticks )
+    {
+        write_event( op, (const uint8_t *)"RDP busy", 8, 3, 0, rdp_ticks );
+    }
+
+    const uint8_t **names = calloc( num_names + 1, sizeof( *names ) );
+
+    if( names == NULL )
+    {
+        return -ENOMEM;
+    }
+
+    const uint8_t *names_start = p;
+
+    for( int i = 0; i < num_names; i++ )
+    {
+        if( p >= end || p + 1 + p[0] > end )
+        {
+            free( names );
+            return -EINVAL;
+        }
+
+        names[i] = p;
+        p += 1 + p[0];
+    }
+
+    p = names_start + (((p - names_start) + 3) & ~3);
+
+    if( p + num_scopes * 12 > end )
+    {
+        free( names );
+        return -EINVAL;
+    }
+
+    for( int i = 0; i < num_scopes; i++, p += 12 )
+    {
+        int index = read_word( p );
+
+        if( index >= num_names )
+        {
+            free( names );
+            return -EINVAL;
+        }
+
+        /* Scopes still open at the end of the frame have no duration */
+        uint32_t start = read_long( p + 4 );
+        uint32_t ticks = read_long( p + 8 );
+
+        if( ticks == 0 && start < frame_ticks ) { ticks = frame_ticks - start; }
+
+        write_event( op, names[index] + 1, names[index][0], 1, start, ticks );
+    }
+
+    free( names );
+
+    frame_start_us += frame_ticks / TICKS_PER_US;
+    frame_number++;
+
+    return p - data;
+}
+
+int convert_file( FILE *op, const char *fn )
+{
+    FILE *fp = fopen( fn, "rb" );
+
+    if( fp == NULL )
+    {
+        fprintf( stderr, "Unable to open %s!\n", fn );
+        return -ENOENT;
+    }
+
+    fseek( fp, 0, SEEK_END );
+    long size = ftell( fp );
+    fseek( fp, 0, SEEK_SET );
+
+    uint8_t *data = malloc( size > 0 ? size : 1 );
+
+    if( data == NULL )
+    {
+        fclose( fp );
+        return -ENOMEM;
+    }
+
+    fread( data, 1, size, fp );
+    fclose( fp );
+
+    /* A file can hold many frames, one after another */
+    long offset = 0;
+    int err = 0;
+
+    while( offset < size )
+    {
+        int len = convert_frame( op, data + offset, size - offset );
+
+        if( len < 0 )
+        {
+            fprintf( stderr, "%s: invalid frame at offset %ld!\n", fn, offset );
+            err = len;
+            break;
+        }
+
+        offset += len;
+    }
+
+    free( data );
+
+    return err;
+}
+
+void print_args( char * name )
+{
+    fprintf( stderr, "Usage: %s <output json> <input profile>...\n", name );
+    fprintf( stderr, "\tConverts frames exported by profile_export or profile_export_usb to the Chrome trace\n" );
+    fprintf( stderr, "\tformat, to view in chrome://tracing or Perfetto. Frames are laid out one after another,\n" );
+    fprintf( stderr, "\tin the order of the input files.\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc < 3 )
+    {
+        print_args( argv[0] );
+        return -EINVAL;
+    }
+
+    FILE *op = fopen( argv[1], "w" );
+
+    if( op == NULL )
+    {
+        fprintf( stderr, "Unable to open %s for writing!\n", argv[1] );
+        return -ENOENT;
+    }
+
+    fprintf( op, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+
+    /* Name the tracks */
+    static const char *tracks[] = { "Frames", "CPU", "RSP", "RDP" };
+
+    for( int i = 0; i < 4; i++ )
+    {
+        fprintf( op, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                 first_event ? "" : ",", i, tracks[i] );
+        first_event = 0;
+    }
+
+    int err = 0;
+
+    for( int i = 2; i < argc && !err; i++ )
+    {
+        err = convert_file( op, argv[i] );
+    }
+
+    fprintf( op, "\n]}\n" );
+    fclose( op );
+
+    return err;
+}
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+/* Layout of the exported samples, see profile_sampling_export in profile.c.  All values
+ * are big-endian:
+ *
+ *   uint32 magic ("PRS1"), uint32 rate, uint32 text start, uint32 log2 of the bucket size,
+ *   uint32 number of samples, uint32 samples outside of the text, uint32 number of buckets
+ *   buckets: uint32 address, uint32 number of samples
+ */
+#define SAMPLING_MAGIC      0x50525331
+#define HEADER_SIZE         28
+
+/* ELF32 definitions (the N64 ELF files are big-endian) */
+#define SHT_SYMTAB          2
+#define SHF_EXECINSTR       0x4
+#define STT_NOTYPE          0
+#define STT_FUNC            2
+
+typedef struct
+{
+    uint32_t address;
+    uint32_t size;
+    const char *name;
+    uint32_t samples;
+} symbol_t;
+
+typedef struct
+{
+    uint32_t address;
+    uint32_t samples;
+} bucket_t;
+
+static symbol_t *symbols = NULL;
+static int num_symbols = 0;
+
+static bucket_t *buckets = NULL;
+static int num_buckets = 0;
+
+uint32_t read_word( const uint8_t *p )
+{
+    return (p[0] << 8) | p[1];
+}
+
+uint32_t read_long( const uint8_t *p )
+{
+    return (read_word( p ) << 16) | read_word( p + 2 );
+}
+
+uint8_t *read_file( const char *fn, long *size )
+{
+    FILE *fp = fopen( fn, "rb" );
+
+    if( fp == NULL )
+    {
+        fprintf( stderr, "Unable to open %s!\n", fn );
+        return NULL;
+    }
+
+    fseek( fp, 0, SEEK_END );
+    *size = ftell( fp );
+    fseek( fp, 0, SEEK_SET );
+
+    uint8_t *data = malloc( *size > 0 ? *size : 1 );
+
+    if( data != NULL )
+    {
+        fread( data, 1, *size, fp );
+    }
+
+    fclose( fp );
+
+    return data;
+}
+
+int compare_symbols( const void *a, const void *b )
+{
+    const symbol_t *sa = a, *sb = b;
+
+    if( sa->address != sb->address ) { return sa->address < sb->address ? -1 : 1; }
+
+    /* Prefer sized (function) symbols */
+    return (int)sb->size - (int)sa->size;
+}
+
+int compare_samples( const void *a, const void *b )
+{
+    const symbol_t *sa = a, *sb = b;
+
+    if( sa->samples != sb->samples ) { return sa->samples > sb->samples ? -1 : 1; }
+    return sa->address < sb->address ? -1 : 1;
+}
+
+/* Load the code symbols of the ELF file */
+int load_symbols( const char *fn )
+{
+    long size;
+    uint8_t *elf = read_file( fn, &size );
+
+    if( elf == NULL )
+    {
+        return -ENOENT;
+    }
+
+    if( size < 52 || memcmp( elf, "\x7F" "ELF", 4 ) || elf[4] != 1 || elf[5] != 2 )
+    {
+        fprintf( stderr, "%s is not a big-endian ELF32 file!\n", fn );
+        free( elf );
+        return -EINVAL;
+    }
+
+    uint32_t shoff = read_long( elf + 0x20 );
+    uint32_t shentsize = read_word( elf + 0x2E );
+    uint32_t shnum = read_word( elf + 0x30 );
+
+    if( shoff + shnum * shentsize > size )
+    {
+        free( elf );
+        return -EINVAL;
+    }
+
+    for( int i = 0; i < shnum; i++ )
+    {
+        const uint8_t *sh = elf + shoff + i * shentsize;
+
+        if( read_long( sh + 4 ) != SHT_SYMTAB ) { continue; }
+
+        uint32_t offset = read_long( sh + 16 );
+        uint32_t symsize = read_long( sh + 20 );
+        uint32_t link = read_long( sh + 24 );
+        uint32_t entsize = read_long( sh + 36 );
+
+        if( link >= shnum || entsize < 16 || offset + symsize > size ) { continue; }
+
+        const uint8_t *strsh = elf + shoff + link * shentsize;
+        const char *strtab = (const char *)elf + read_long( strsh + 16 );
+        uint32_t strsize = read_long( strsh + 20 );
+
+        symbols = realloc( symbols, (num_symbols + symsize / entsize) * sizeof( symbol_t ) );
+
+        if( symbols == NULL )
+        {
+            free( elf );
+            return -ENOMEM;
+        }
+
+        for( uint32_t s = 0; s < symsize / entsize; s++ )
+        {
+            const uint8_t *sym = elf + offset + s * entsize;
+            uint32_t name = read_long( sym );
+            int type = sym[12] & 0xF;
+            uint32_t shndx = read_word( sym + 14 );
+
+            if( name == 0 || name >= strsize || shndx == 0 || shndx >= shnum ) { continue; }
+            if( type != STT_FUNC && type != STT_NOTYPE ) { continue; }
+
+            /* Labels of assembly code are code symbols without a type */
+            const uint8_t *section = elf + shoff + shndx * shentsize;
+            if( !(read_long( section + 8 ) & SHF_EXECINSTR) ) { continue; }
+            if( strtab[name] == '$' || !strncmp( strtab + name, ".L", 2 ) ) { continue; }
+
+            symbols[num_symbols].address = read_long( sym + 4 );
+            symbols[num_symbols].size = read_long( sym + 8 );
+            symbols[num_symbols].name = strdup( strtab + name );
+            symbols[num_symbols].samples = 0;
+            num_symbols++;
+        }
+    }
+
+    free( elf );
+
+    if( num_symbols == 0 )
+    {
+        fprintf( stderr, "%s has no symbols!\n", fn );
+        return -EINVAL;
+    }
+
+    qsort( symbols, num_symbols, sizeof( symbol_t ), compare_symbols );
+
+    return 0;
+}
+
+/* Add the samples of a file to the buckets */
+int load_samples( const char *fn, uint32_t *total, uint32_t *outside, int *shift, int *rate )
+{
+    long size;
+    uint8_t *data = read_file( fn, &size );
+
+    if( data == NULL )
+    {
+        return -ENOENT;
+    }
+
+    if( size < HEADER_SIZE || read_long( data ) != SAMPLING_MAGIC ||
+        HEADER_SIZE + read_long( data + 24 ) * 8 > size )
+    {
+        fprintf( stderr, "%s does not contain samples!\n", fn );
+        free( data );
+        return -EINVAL;
+    }
+
+    int count = read_long( data + 24 );
+
+    *rate = read_long( data + 4 );
+    *shift = read_long( data + 12 );
+    *total += read_long( data + 16 );
+    *outside += read_long( data + 20 );
+
+    buckets = realloc( buckets, (num_buckets + count) * sizeof( bucket_t ) );
+
+    if( buckets == NULL )
+    {
+        free( data );
+        return -ENOMEM;
+    }
+
+    for( int i = 0; i < count; i++ )
+    {
+        buckets[num_buckets].address = read_long( data + HEADER_SIZE + i * 8 );
+        buckets[num_buckets].samples = read_long( data + HEADER_SIZE + i * 8 + 4 );
+        num_buckets++;
+    }
+
+    free( data );
+
+    return 0;
+}
+
+/* Find the symbol containing an address */
+symbol_t *find_symbol( uint32_t address )
+{
+    int lo = 0, hi = num_symbols - 1, found = -1;
+
+    while( lo <= hi )
+    {
+        int mid = (lo + hi) / 2;
+
+        if( symbols[mid].address <= address )
+        {
+            found = mid;
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    if( found < 0 ) { return NULL; }
+
+    /* Move back to the first (sized) symbol at the same address */
+    while( found > 0 && symbols[found - 1].address == symbols[found].address ) { found--; }
+
+    if( symbols[found].size && address >= symbols[found].address + symbols[found].size ) { return NULL; }
+
+    return &symbols[found];
+}
+
+void print_args( char * name )
+{
+    fprintf( stderr, "Usage: %s <elf file> <input samples>...\n", name );
+    fprintf( stderr, "\tAttributes the samples exported by profile_sampling_export or profile_sampling_export_usb\n" );
+    fprintf( stderr, "\tto the functions of the ELF file of the ROM, and prints them from the hottest.\n" );
+    fprintf( stderr, "\tSamples of many input files are added together.\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc < 3 )
+    {
+        print_args( argv[0] );
+        return -EINVAL;
+    }
+
+    int err = load_symbols( argv[1] );
+    uint32_t total = 0, outside = 0, unknown = 0;
+    int shift = 2, rate = 0;
+
+    for( int i = 2; i < argc && !err; i++ )
+    {
+        err = load_samples( argv[i], &total, &outside, &shift, &rate );
+    }
+
+    if( err )
+    {
+        return err;
+    }
+
+    /* A bucket larger than an instruction is attributed to the function at its start */
+    for( int i = 0; i < num_buckets; i++ )
+    {
+        symbol_t *sym = find_symbol( buckets[i].address );
+
+        if( sym ) { sym->samples += buckets[i].samples; }
+        else { unknown += buckets[i].samples; }
+    }
+
+    qsort( symbols, num_symbols, sizeof( symbol_t ), compare_samples );
+
+    printf( "%u samples at %d Hz, %d bytes per bucket\n", total, rate, 1 << shift );
+    printf( "%8s %7s  %s\n", "samples", "%", "function" );
+
+    for( int i = 0; i < num_symbols && symbols[i].samples; i++ )
+    {
+        printf( "%8u %6.2f%%  %s\n", symbols[i].samples, total ? 100.0 * symbols[i].samples / total : 0.0, symbols[i].name );
+    }
+
+    if( unknown ) { printf( "%8u %6.2f%%  (unknown)\n", unknown, total ? 100.0 * unknown / total : 0.0 ); }
+    if( outside ) { printf( "%8u %6.2f%%  (outside of text)\n", outside, total ? 100.0 * outside / total : 0.0 ); }
+
+    return 0;
+}